@@ -12,6 +12,7 @@
 #include <cstdlib>
 #include <getopt.h>
 #include <mapitags.h>
+#include <kopano/cdc.hpp>
 #include <kopano/ECConfig.h>
 #include <kopano/ECLogger.h>
 #include <kopano/ECThreadPool.h>
@@ -667,6 +668,30 @@ static ECRESULT db_populate(std::shared_ptr<ECConfig> cfg)
 	return erSuccess;
 }
 
+static ECRESULT att_dedup_stat(std::shared_ptr<ECConfig> cfg)
+{
+	auto dir = cfg->GetSetting("attachment_path");
+	cdc_stats st;
+	auto ret = cdc_scan(dir, &st);
+	if (ret != erSuccess)
+		return ret;
+	auto ratio = [](uint64_t a, uint64_t b) { return b == 0 ? 1.0 : static_cast<double>(a) / b; };
+	printf("Attachment instances: %zu (%zu chunked), %zu references\n",
+	       st.objects, st.chunked, st.references);
+	printf("Logical size (all references): %llu bytes\n",
+	       static_cast<unsigned long long>(st.logical));
+	printf("Size of distinct instances: %llu bytes\n",
+	       static_cast<unsigned long long>(st.instance_bytes));
+	printf("Chunk store: %zu chunks, %zu references, %llu bytes for %llu bytes of chunked instances\n",
+	       st.chunks, st.chunk_refs, static_cast<unsigned long long>(st.chunk_bytes),
+	       static_cast<unsigned long long>(st.manifest_bytes));
+	printf("Stored on disk: %llu bytes\n", static_cast<unsigned long long>(st.stored));
+	printf("Dedup ratio: %.2f (whole-instance %.2f, chunk-level %.2f)\n",
+	       ratio(st.logical, st.stored), ratio(st.logical, st.instance_bytes),
+	       ratio(st.manifest_bytes, st.chunk_bytes));
+	return erSuccess;
+}
+
 static void adm_sigterm(int sig)
 {
 	if (--adm_sigterm_count <= 0) {
@@ -717,6 +742,7 @@ int main(int argc, char **argv) try
 		{"log_method", ""},
 		{"log_timestamp", "1", CONFIGSETTING_RELOADABLE},
 		{"mysql_group_concat_max_len", "21844", CONFIGSETTING_RELOADABLE},
+		{"attachment_path", "/var/lib/kopano/attachments"},
 		{nullptr, nullptr},
 	};
 	const char *cfg_file = ECConfig::GetDefaultPath("server.cfg");
@@ -788,6 +814,8 @@ int main(int argc, char **argv) try
 			ret = usmp(db);
 		else if (strcmp(argv[i], "populate") == 0)
 			ret = db_populate(cfg);
+		else if (strcmp(argv[i], "att-dedup-stat") == 0)
+			ret = att_dedup_stat(cfg);
 		if (ret == KCERR_NOT_FOUND) {
 			ec_log_err("dbadm: unknown action \"%s\"", argv[i]);
 			return EXIT_FAILURE;
@@ -5,15 +5,19 @@
 #ifdef HAVE_CONFIG_H
 #	include "config.h"
 #endif
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <dirent.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <spawn.h>
@@ -46,6 +50,7 @@ class mpt_job {
 	public:
 	virtual HRESULT init();
 	virtual HRESULT run() = 0;
+	virtual void report() {}
 	private:
 	AutoMAPI m_mapi;
 };
@@ -57,6 +62,8 @@ static duration mpt_stat_time;
 static std::mutex mpt_stat_lock;
 static const char *mpt_user, *mpt_pass, *mpt_socket;
 static size_t mpt_repeat = ~0U;
+static unsigned int mpt_sessions = 50;
+static unsigned int mpt_profile_flags = NO_NOTIFY;
 static int mpt_loglevel = EC_LOGLEVEL_NOTICE;
 
 static void *mpt_stat_dump(void *)
@@ -113,7 +120,7 @@ static int mpt_basic_open(object_ptr<IMAPISession> &ses,
     object_ptr<IMsgStore> &store)
 {
 	auto ret = HrOpenECSession(&~ses, PROJECT_VERSION, "mapitime", mpt_user,
-	           mpt_pass, mpt_socket, NO_NOTIFY, nullptr, nullptr);
+	           mpt_pass, mpt_socket, mpt_profile_flags, nullptr, nullptr);
 	if (ret != hrSuccess) {
 		fprintf(stderr, "Logon failed: %s\n", GetMAPIErrorMessage(ret));
 		sleep(1);
@@ -201,6 +208,7 @@ class mpt_proplist : public mpt_job {
 	HRESULT run() override;
 
 	protected:
+	object_ptr<IMsgStore> m_store;
 	object_ptr<IMAPIFolder> m_inbox;
 	rowset_ptr m_rows;
 };
@@ -212,18 +220,17 @@ HRESULT mpt_proplist::init()
 		return kc_perror("mpt_job::init", ret);
 
 	object_ptr<IMAPISession> ses;
-	object_ptr<IMsgStore> store;
-	ret = mpt_basic_open(ses, store);
+	ret = mpt_basic_open(ses, m_store);
 	if (ret != hrSuccess)
 		return kc_perror("mpt_basic_open", ret);
 
 	memory_ptr<ENTRYID> eid;
 	unsigned int neid = 0;
-	ret = store->GetReceiveFolder(reinterpret_cast<const TCHAR *>("IPM"), 0, &neid, &~eid, nullptr);
+	ret = m_store->GetReceiveFolder(reinterpret_cast<const TCHAR *>("IPM"), 0, &neid, &~eid, nullptr);
 	if (ret != hrSuccess)
 		return kc_perror("GetReceiveFolder", ret);
 	unsigned int type = 0;
-	ret = store->OpenEntry(neid, eid, &iid_of(m_inbox), MAPI_MODIFY, &type, &~m_inbox);
+	ret = m_store->OpenEntry(neid, eid, &iid_of(m_inbox), MAPI_MODIFY, &type, &~m_inbox);
 	if (ret != hrSuccess)
 		return kc_perror("OpenEntry", ret);
 
@@ -298,6 +305,238 @@ HRESULT mpt_proplist1::run()
 	return hrSuccess;
 }
 
+/*
+ * Opens every message of the inbox and reads a few properties, like WebApp
+ * does for the preview pane, and reports the latency per message. Compare
+ * -F 1 with -F 0x10001 (EC_PROFILE_FLAGS_NO_COMPOUND_RPC), and -F 0 with
+ * -F 0x20000 (EC_PROFILE_FLAGS_CLIENT_CACHE) over several iterations.
+ */
+class mpt_openmsg final : public mpt_proplist {
+	public:
+	HRESULT run() override;
+	void report() override;
+
+	private:
+	std::vector<duration> m_lat;
+};
+
+HRESULT mpt_openmsg::run()
+{
+	static constexpr const SizedSPropTagArray(4, cols) =
+		{4, {PR_SUBJECT_W, PR_SENDER_NAME_W, PR_MESSAGE_DELIVERY_TIME, PR_MESSAGE_FLAGS}};
+
+	for (unsigned int i = 0; i < m_rows.size(); ++i) {
+		auto prop = m_rows[i].find(PR_ENTRYID);
+		if (prop == nullptr)
+			continue;
+		auto start = clk::now();
+		unsigned int type = 0, nvals = 0;
+		object_ptr<IMessage> msg;
+		auto ret = m_inbox->OpenEntry(prop->Value.bin.cb,
+		           reinterpret_cast<const ENTRYID *>(prop->Value.bin.lpb),
+		           &iid_of(msg), MAPI_BEST_ACCESS, &type, &~msg);
+		if (ret != hrSuccess)
+			return kc_perror("OpenEntry", ret);
+		memory_ptr<SPropValue> props;
+		ret = msg->GetProps(cols, 0, &nvals, &~props);
+		if (FAILED(ret))
+			return kc_perror("GetProps", ret);
+		m_lat.emplace_back(clk::now() - start);
+	}
+	return hrSuccess;
+}
+
+void mpt_openmsg::report()
+{
+	if (m_lat.empty())
+		return;
+	std::sort(m_lat.begin(), m_lat.end());
+	auto us = [&](double q) {
+		return std::chrono::duration<double, std::micro>(m_lat[(m_lat.size() - 1) * q]).count();
+	};
+	printf("\n%zu opens: p50 %.0f µs, p99 %.0f µs, max %.0f µs\n",
+	       m_lat.size(), us(0.5), us(0.99), us(1));
+
+	static constexpr const SizedSPropTagArray(4, stats) =
+		{4, {PR_EC_STATS_CLIENT_CACHE_HITS, PR_EC_STATS_CLIENT_CACHE_MISSES,
+		PR_EC_STATS_CLIENT_CACHE_SAVED_CALLS, PR_EC_STATS_CLIENT_CACHE_BYTES}};
+	unsigned int nvals = 0;
+	memory_ptr<SPropValue> props;
+	if (m_store->GetProps(stats, 0, &nvals, &~props) != hrSuccess)
+		return;
+	printf("client cache: %lld hits, %lld misses, %lld loads from cache, %lld bytes\n",
+	       static_cast<long long>(props[0].Value.li.QuadPart),
+	       static_cast<long long>(props[1].Value.li.QuadPart),
+	       static_cast<long long>(props[2].Value.li.QuadPart),
+	       static_cast<long long>(props[3].Value.li.QuadPart));
+}
+
+/*
+ * Opens -N sessions, each its own session group, with an advise on the
+ * inbox, and measures how long it takes from saving a new message until
+ * every session has been told, along with the threads and sockets the
+ * process needs to listen. Compare -F 0 with -F 0x40000
+ * (EC_PROFILE_FLAGS_NO_NOTIFY_MUX).
+ */
+class mpt_notifymux final : public mpt_job {
+	public:
+	HRESULT init() override;
+	HRESULT run() override;
+	void report() override;
+
+	private:
+	struct listener {
+		object_ptr<IMAPISession> ses;
+		object_ptr<IMsgStore> store;
+		unsigned int conn = 0;
+	};
+	static LONG notified(void *, ULONG, NOTIFICATION *);
+	static void count_tasks(size_t &threads, size_t &sockets);
+
+	std::vector<listener> m_listeners;
+	object_ptr<IMAPIFolder> m_inbox;
+	std::vector<duration> m_lat;
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	clk::time_point m_start;
+	size_t m_seen = 0, m_timeouts = 0;
+	size_t m_threads[2]{}, m_sockets[2]{};
+};
+
+void mpt_notifymux::count_tasks(size_t &threads, size_t &sockets)
+{
+	threads = sockets = 0;
+	std::unique_ptr<DIR, int (*)(DIR *)> dh(opendir("/proc/self/task"), closedir);
+	if (dh != nullptr)
+		for (const struct dirent *de; (de = readdir(dh.get())) != nullptr; )
+			if (de->d_name[0] != '.')
+				++threads;
+	dh.reset(opendir("/proc/self/fd"));
+	if (dh == nullptr)
+		return;
+	for (const struct dirent *de; (de = readdir(dh.get())) != nullptr; ) {
+		char path[64], target[64];
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", de->d_name);
+		auto z = readlink(path, target, sizeof(target) - 1);
+		if (z > 0 && strncmp(target, "socket:", 7) == 0)
+			++sockets;
+	}
+}
+
+LONG mpt_notifymux::notified(void *ctx, ULONG n, NOTIFICATION *notif)
+{
+	auto self = static_cast<mpt_notifymux *>(ctx);
+	auto now = clk::now();
+	std::lock_guard<std::mutex> lk(self->m_lock);
+	for (ULONG i = 0; i < n; ++i) {
+		if (notif[i].ulEventType != fnevObjectCreated)
+			continue;
+		self->m_lat.emplace_back(now - self->m_start);
+		++self->m_seen;
+	}
+	self->m_cond.notify_all();
+	return 0;
+}
+
+HRESULT mpt_notifymux::init()
+{
+	auto ret = mpt_job::init();
+	if (ret != hrSuccess)
+		return kc_perror("mpt_job::init", ret);
+	count_tasks(m_threads[0], m_sockets[0]);
+
+	/* Every session gets a profile of its own, and so a session group */
+	m_listeners.resize(mpt_sessions);
+	for (auto &l : m_listeners) {
+		ret = HrOpenECSession(&~l.ses, PROJECT_VERSION, "mapitime", mpt_user,
+		      mpt_pass, mpt_socket, mpt_profile_flags & ~NO_NOTIFY, nullptr, nullptr);
+		if (ret != hrSuccess)
+			return kc_perror("HrOpenECSession", ret);
+		ret = HrOpenDefaultStore(l.ses, &~l.store);
+		if (ret != hrSuccess)
+			return kc_perror("HrOpenDefaultStore", ret);
+		memory_ptr<ENTRYID> eid;
+		unsigned int neid = 0;
+		ret = l.store->GetReceiveFolder(reinterpret_cast<const TCHAR *>("IPM"), 0, &neid, &~eid, nullptr);
+		if (ret != hrSuccess)
+			return kc_perror("GetReceiveFolder", ret);
+		object_ptr<IMAPIAdviseSink> sink;
+		ret = HrAllocAdviseSink(notified, this, &~sink);
+		if (ret != hrSuccess)
+			return kc_perror("HrAllocAdviseSink", ret);
+		ret = l.store->Advise(neid, eid, fnevObjectCreated, sink, &l.conn);
+		if (ret != hrSuccess)
+			return kc_perror("Advise", ret);
+		if (m_inbox != nullptr)
+			continue;
+		unsigned int type = 0;
+		ret = l.store->OpenEntry(neid, eid, &iid_of(m_inbox), MAPI_MODIFY, &type, &~m_inbox);
+		if (ret != hrSuccess)
+			return kc_perror("OpenEntry", ret);
+	}
+	/* Let the notification connections settle */
+	sleep(1);
+	count_tasks(m_threads[1], m_sockets[1]);
+	return hrSuccess;
+}
+
+HRESULT mpt_notifymux::run()
+{
+	object_ptr<IMessage> msg;
+	auto ret = m_inbox->CreateMessage(nullptr, 0, &~msg);
+	if (ret != hrSuccess)
+		return kc_perror("CreateMessage", ret);
+	SPropValue subj;
+	subj.ulPropTag = PR_SUBJECT_A;
+	subj.Value.lpszA = const_cast<char *>("mapitime notifymux");
+	ret = msg->SetProps(1, &subj, nullptr);
+	if (ret != hrSuccess)
+		return kc_perror("SetProps", ret);
+
+	std::unique_lock<std::mutex> lk(m_lock);
+	m_seen = 0;
+	m_start = clk::now();
+	lk.unlock();
+	ret = msg->SaveChanges(KEEP_OPEN_READWRITE);
+	if (ret != hrSuccess)
+		return kc_perror("SaveChanges", ret);
+	lk.lock();
+	if (!m_cond.wait_for(lk, std::chrono::seconds(10),
+	    [&]() { return m_seen >= m_listeners.size(); }))
+		m_timeouts += m_listeners.size() - m_seen;
+	lk.unlock();
+
+	memory_ptr<SPropValue> eid;
+	ret = HrGetOneProp(msg, PR_ENTRYID, &~eid);
+	if (ret != hrSuccess)
+		return kc_perror("PR_ENTRYID", ret);
+	ENTRYLIST del = {1, &eid->Value.bin};
+	ret = m_inbox->DeleteMessages(&del, 0, nullptr, DELETE_HARD_DELETE);
+	if (ret != hrSuccess)
+		return kc_perror("DeleteMessages", ret);
+	return hrSuccess;
+}
+
+void mpt_notifymux::report()
+{
+	for (auto &l : m_listeners)
+		if (l.store != nullptr && l.conn != 0)
+			l.store->Unadvise(l.conn);
+	printf("\n%zu sessions: %zu threads and %zu sockets before, %zu threads and %zu sockets listening\n",
+	       m_listeners.size(), m_threads[0], m_sockets[0], m_threads[1], m_sockets[1]);
+	std::lock_guard<std::mutex> lk(m_lock);
+	if (m_timeouts > 0)
+		printf("%zu notifications did not arrive within 10 s\n", m_timeouts);
+	if (m_lat.empty())
+		return;
+	std::sort(m_lat.begin(), m_lat.end());
+	auto us = [&](double q) {
+		return std::chrono::duration<double, std::micro>(m_lat[(m_lat.size() - 1) * q]).count();
+	};
+	printf("%zu notifications: p50 %.0f µs, p99 %.0f µs, max %.0f µs\n",
+	       m_lat.size(), us(0.5), us(0.99), us(1));
+}
+
 class mpt_search final : public mpt_job {
 	public:
 	HRESULT init() override;
@@ -463,6 +702,7 @@ static int mpt_runner(mpt_job &&fct)
 		auto stop = clk::now();
 		mpt_stat_record(stop - start);
 	}
+	fct.report();
 	return EXIT_SUCCESS;
 }
 
@@ -589,7 +829,9 @@ static int mpt_main_bin2hex()
 
 static void mpt_usage()
 {
-	fprintf(stderr, "mapitime [-p pass] [-s server] [-u username] [-z count] benchmark_choice\n");
+	fprintf(stderr, "mapitime [-F flags] [-N sessions] [-p pass] [-s server] [-u username] [-z count] benchmark_choice\n");
+	fprintf(stderr, "  -F flags    EC_PROFILE_FLAGS_* for the logon (default: 0x1, no notifications)\n");
+	fprintf(stderr, "  -N count    Number of sessions for notifymux (default: 50)\n");
 	fprintf(stderr, "  -z count    Run this many iterations (default: finite but almost forever)\n");
 	fprintf(stderr, "Benchmark choices:\n");
 	fprintf(stderr, "  init        Just the library initialization\n");
@@ -597,6 +839,8 @@ static void mpt_usage()
 	fprintf(stderr, "  open2       Like open1, but use Save-Restore\n");
 	fprintf(stderr, "  proplist    Measure GetPropList over inbox\n");
 	fprintf(stderr, "  proplist1   Measure IMessage::GetPropList over first message\n");
+	fprintf(stderr, "  openmsg     Measure opening and reading each inbox message (p50/p99)\n");
+	fprintf(stderr, "  notifymux   Measure notification latency, threads and sockets of many sessions\n");
 	fprintf(stderr, "  pagetime    Measure webpage retrieval time\n");
 	fprintf(stderr, "  exectime    Measure process runtime\n");
 	fprintf(stderr, "  qicast      Measure QueryInterface throughput\n");
@@ -612,8 +856,12 @@ static int mpt_option_parse(int argc, char **argv)
 		mpt_usage();
 		return EXIT_FAILURE;
 	}
-	while ((c = getopt(argc, argv, "p:s:u:vz:")) != -1) {
-		if (c == 'p') {
+	while ((c = getopt(argc, argv, "F:N:p:s:u:vz:")) != -1) {
+		if (c == 'F') {
+			mpt_profile_flags = strtoul(optarg, nullptr, 0);
+		} else if (c == 'N') {
+			mpt_sessions = strtoul(optarg, nullptr, 0);
+		} else if (c == 'p') {
 			mpt_pass = optarg;
 		} else if (c == 'u') {
 			mpt_user = optarg;
@@ -673,6 +921,10 @@ int main(int argc, char **argv)
 		ret = mpt_runner(mpt_proplist());
 	else if (strcmp(argv[1], "proplist1") == 0)
 		ret = mpt_runner(mpt_proplist1());
+	else if (strcmp(argv[1], "openmsg") == 0)
+		ret = mpt_runner(mpt_openmsg());
+	else if (strcmp(argv[1], "notifymux") == 0)
+		ret = mpt_runner(mpt_notifymux());
 	else if (strcmp(argv[1], "exectime") == 0)
 		ret = mpt_main_exectime(argc - 1, argv + 1);
 	else if (strcmp(argv[1], "pagetime") == 0)
@@ -5,8 +5,11 @@
 #pragma once
 #include <kopano/zcdefs.h>
 #include <algorithm>
+#include <atomic>
 #include <list>
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <cassert>
@@ -55,14 +58,14 @@ public:
 	KC_HIDDEN virtual size_type Size() const = 0;
 	KC_HIDDEN size_type MaxSize() const { return m_ulMaxSize; }
 	KC_HIDDEN long MaxAge() const { return m_lMaxAge; }
-	KC_HIDDEN size_type HitCount() const { return m_ulCacheHit; }
-	KC_HIDDEN size_type ValidCount() const { return m_ulCacheValid; }
+	KC_HIDDEN size_type HitCount() const { return m_ulCacheHit.load(std::memory_order_relaxed); }
+	KC_HIDDEN size_type ValidCount() const { return m_ulCacheValid.load(std::memory_order_relaxed); }
 
 	// Decrement the valid count. Used from ECCacheManger::GetCell.
 	KC_HIDDEN void DecrementValidCount()
 	{
 		assert(m_ulCacheValid >= 1);
-		--m_ulCacheValid;
+		m_ulCacheValid.fetch_sub(1, std::memory_order_relaxed);
 	}
 
 	// Call the provided callback with some statistics.
@@ -76,8 +79,8 @@ public:
 
 protected:
 	CacheBase(const std::string &name, size_type maxsize, long maxage);
-	KC_HIDDEN void IncrementHitCount() { ++m_ulCacheHit; }
-	KC_HIDDEN void IncrementValidCount() { ++m_ulCacheValid; }
+	KC_HIDDEN void IncrementHitCount() { m_ulCacheHit.fetch_add(1, std::memory_order_relaxed); }
+	KC_HIDDEN void IncrementValidCount() { m_ulCacheValid.fetch_add(1, std::memory_order_relaxed); }
 	KC_HIDDEN void ClearCounters() { m_ulCacheHit = m_ulCacheValid = 0; }
 
 	const std::string	m_strCachename;
@@ -85,11 +88,45 @@ protected:
 private:
 	size_type		m_ulMaxSize;
 	const long			m_lMaxAge;
-	size_type m_ulCacheHit = 0, m_ulCacheValid = 0;
+	/* Atomic, since PeekCacheItem may run concurrently on one cache. */
+	std::atomic<size_type> m_ulCacheHit{0}, m_ulCacheValid{0};
 };
 
 using ECCacheBase = CacheBase;
 
+/*
+ * Cache<> keeps its values in a map whose mapped type is wrapped in a node
+ * that carries intrusive LRU links. The traits below derive that storage
+ * map from the (std::map or std::unordered_map) type given by the user.
+ */
+template<typename MapType, typename Node> struct cache_rebind;
+
+template<typename K, typename T, typename C, typename A, typename Node>
+struct cache_rebind<std::map<K, T, C, A>, Node> {
+	typedef std::map<K, Node, C> type;
+};
+
+template<typename K, typename T, typename H, typename E, typename A, typename Node>
+struct cache_rebind<std::unordered_map<K, T, H, E, A>, Node> {
+	typedef std::unordered_map<K, Node, H, E> type;
+};
+
+/*
+ * All cache entries are chained on a doubly-linked list, most recently used
+ * at the head. A hit moves the entry to the head (for non-aging caches), an
+ * insertion links it there, and eviction pops from the tail, so that all
+ * operations are O(1) and a purge no longer needs to sort the whole map.
+ *
+ * Aging caches (MaxAge() != 0) never refresh ulLastAccess on a hit, which
+ * keeps their list ordered by insertion time. The tail is then always the
+ * entry that expires first, and expiry is a matter of popping the tail until
+ * a live entry shows up.
+ *
+ * PeekCacheItem does not relink; it only flags the entry as referenced, and
+ * eviction gives such entries a second chance (CLOCK-style) before dropping
+ * them. This lets callers serialize writers only and run lookups under a
+ * shared lock.
+ */
 template<typename MapType> class Cache KC_FINAL : public CacheBase {
 public:
 	typedef typename MapType::key_type key_type;
@@ -99,10 +136,25 @@ public:
 		CacheBase(name, size, age), m_ulSize(0)
 	{ }
 
+	Cache(Cache &&o) :
+		CacheBase(o.m_strCachename, o.MaxSize(), o.MaxAge()),
+		m_map(std::move(o.m_map)), m_ulSize(o.m_ulSize),
+		m_lru_head(o.m_lru_head), m_lru_tail(o.m_lru_tail)
+	{
+		/* Node addresses survive a container move, the links stay valid. */
+		o.m_map.clear();
+		o.m_ulSize = 0;
+		o.m_lru_head = o.m_lru_tail = nullptr;
+	}
+
+	Cache(const Cache &) = delete;
+	Cache &operator=(const Cache &) = delete;
+
 	void ClearCache()
 	{
 		m_map.clear();
 		m_ulSize = 0;
+		m_lru_head = m_lru_tail = nullptr;
 		ClearCounters();
 	}
 
@@ -114,7 +166,7 @@ public:
 	size_type Size() const override
 	{
 		/* It works with map and unordered_map. */
-		return m_map.size() * sizeof(typename MapType::value_type) + sizeof(MapType) + m_ulSize;
+		return m_map.size() * sizeof(typename storage_type::value_type) + sizeof(storage_type) + m_ulSize;
 	}
 
 	ECRESULT RemoveCacheItem(const key_type &key)
@@ -122,10 +174,7 @@ public:
 		auto iter = m_map.find(key);
 		if (iter == m_map.end())
 			return KCERR_NOT_FOUND;
-
-		m_ulSize -= GetCacheAdditionalSize(iter->second);
-		m_ulSize -= GetCacheAdditionalSize(key);
-		m_map.erase(iter);
+		EraseEntry(iter);
 		return erSuccess;
 	}
 
@@ -138,43 +187,55 @@ public:
 			IncrementHitCount();
 			return KCERR_NOT_FOUND;
 		}
-		if (MaxAge() == 0 || static_cast<long>(tNow - iter->second.ulLastAccess) < MaxAge()) {
-			*lppValue = &iter->second;
+		auto &node = iter->second;
+		if (MaxAge() == 0 || static_cast<long>(tNow - node.value.ulLastAccess) < MaxAge()) {
+			*lppValue = &node.value;
 			// If we have an aging cache, we don't update the timestamp,
 			// so we can't keep a value longer in the cache than the max age.
 			// If we have a non-aging cache, we need to update it,
-			// to see the oldest 5% to purge from the cache.
-			if (MaxAge() == 0)
-				iter->second.ulLastAccess = tNow;
+			// and move it away from the eviction end of the LRU list.
+			if (MaxAge() == 0) {
+				node.value.ulLastAccess = tNow;
+				LruTouch(&node);
+			}
 			IncrementHitCount();
 			IncrementValidCount();
 			return erSuccess;
 		}
 		// Cache age of the cached item, if expired remove the item from the cache
-		/*
-		 * Because of templates, there is no guarantee
-		 * that m_map keeps iterators valid while
-		 * elements are deleted from it. Track them in
-		 * a separate delete list.
-		 */
-		std::vector<key_type> dl;
-
-		// Loop through all items and check
-		for (iter = m_map.begin(); iter != m_map.end(); ++iter)
-			if ((long)(tNow - iter->second.ulLastAccess) >= MaxAge())
-				dl.emplace_back(iter->first);
-		for (const auto &i : dl)
-			m_map.erase(i);
+		EraseEntry(iter);
+		ExpireCache(tNow);
 		IncrementHitCount();
 		return KCERR_NOT_FOUND;
 	}
 
+	/*
+	 * Lookup for callers that only hold a shared lock on the cache:
+	 * neither the map nor the LRU list are modified. Expired entries are
+	 * reported as not found and left for the next writer to reap.
+	 */
+	ECRESULT PeekCacheItem(const key_type &key, const mapped_type **lppValue)
+	{
+		auto iter = m_map.find(key);
+
+		IncrementHitCount();
+		if (iter == m_map.end())
+			return KCERR_NOT_FOUND;
+		auto &node = iter->second;
+		if (MaxAge() != 0 && static_cast<long>(GetProcessTime() - node.value.ulLastAccess) >= MaxAge())
+			return KCERR_NOT_FOUND;
+		node.referenced.store(true, std::memory_order_relaxed);
+		*lppValue = &node.value;
+		IncrementValidCount();
+		return erSuccess;
+	}
+
 	ECRESULT GetCacheRange(const key_type &lower, const key_type &upper, std::list<typename MapType::value_type> *values)
 	{
 		auto iLower = m_map.lower_bound(lower);
 		auto iUpper = m_map.upper_bound(upper);
 		for (auto i = iLower; i != iUpper; ++i)
-			values->emplace_back(*i);
+			values->emplace_back(i->first, i->second.value);
 		return erSuccess;
 	}
 
@@ -182,20 +243,26 @@ public:
 	{
 		if (MaxSize() == 0)
 			return erSuccess;
+		auto tNow = GetProcessTime();
 		auto result = m_map.emplace(key, value);
+		auto &node = result.first->second;
 		if (!result.second) {
 			// The key already exists but its value is unmodified. So update it now
 			m_ulSize += GetCacheAdditionalSize(value);
-			m_ulSize -= GetCacheAdditionalSize(result.first->second);
-			result.first->second = value;
-			result.first->second.ulLastAccess = GetProcessTime();
+			m_ulSize -= GetCacheAdditionalSize(node.value);
+			node.value = value;
+			node.value.ulLastAccess = tNow;
+			LruTouch(&node);
 			// Since there is a very small chance that we need to purge the cache, we're skipping that here.
 			return erSuccess;
 		}
 		// We just inserted a new entry.
 		m_ulSize += GetCacheAdditionalSize(value);
 		m_ulSize += GetCacheAdditionalSize(key);
-		result.first->second.ulLastAccess = GetProcessTime();
+		node.key = &result.first->first;
+		node.value.ulLastAccess = tNow;
+		LruPushFront(&node);
+		ExpireCache(tNow);
 		UpdateCache(0.05F);
 		return erSuccess;
 	}
@@ -205,7 +272,9 @@ public:
 	{
 		if (MaxSize() == 0)
 			return erSuccess;
+		auto tNow = GetProcessTime();
 		auto result = m_map.try_emplace(key, std::move(value));
+		auto &node = result.first->second;
 		if (!result.second) {
 			/*
 			 * The key already exists but its value is unmodified,
@@ -214,20 +283,39 @@ public:
 			 * could not be subtracted.
 			 */
 			m_ulSize += GetCacheAdditionalSize(value);
-			m_ulSize -= GetCacheAdditionalSize(result.first->second);
-			result.first->second = std::move(value);
-			result.first->second.ulLastAccess = GetProcessTime();
+			m_ulSize -= GetCacheAdditionalSize(node.value);
+			node.value = std::move(value);
+			node.value.ulLastAccess = tNow;
+			LruTouch(&node);
 			return erSuccess;
 		}
 		/* New entry */
-		m_ulSize += GetCacheAdditionalSize(result.first->second);
+		m_ulSize += GetCacheAdditionalSize(node.value);
 		m_ulSize += GetCacheAdditionalSize(key);
-		result.first->second.ulLastAccess = GetProcessTime();
+		node.key = &result.first->first;
+		node.value.ulLastAccess = tNow;
+		LruPushFront(&node);
+		ExpireCache(tNow);
 		UpdateCache(0.05);
 		return erSuccess;
 	}
 #endif
 
+	/*
+	 * Call @f(key, value) for every live entry, least recently used
+	 * first, so that re-adding them in that order reproduces the LRU
+	 * list. Does not modify the cache; a shared lock suffices.
+	 */
+	template<typename F> void Walk(F &&f) const
+	{
+		auto tNow = GetProcessTime();
+		for (auto n = m_lru_tail; n != nullptr; n = n->prev) {
+			if (MaxAge() != 0 && static_cast<long>(tNow - n->value.ulLastAccess) >= MaxAge())
+				continue;
+			f(*n->key, n->value);
+		}
+	}
+
 	// Used in ECCacheManager::SetCell, where the content of a cache item is modified.
 	void AddToSize(int64_t ulSize)
 	{
@@ -236,34 +324,102 @@ public:
 	}
 
 private:
-	ECRESULT PurgeCache(float ratio)
+	/* Referenced entries given a second chance per eviction */
+	static constexpr unsigned int CLOCK_SWEEP = 8;
+
+	struct node_type {
+		node_type(const mapped_type &v) : value(v) {}
+		node_type(mapped_type &&v) : value(std::move(v)) {}
+
+		mapped_type value;
+		const key_type *key = nullptr;
+		node_type *prev = nullptr, *next = nullptr;
+		std::atomic<bool> referenced{false};
+	};
+	typedef typename cache_rebind<MapType, node_type>::type storage_type;
+
+	void LruPushFront(node_type *n)
+	{
+		n->prev = nullptr;
+		n->next = m_lru_head;
+		if (m_lru_head != nullptr)
+			m_lru_head->prev = n;
+		m_lru_head = n;
+		if (m_lru_tail == nullptr)
+			m_lru_tail = n;
+	}
+
+	void LruUnlink(node_type *n)
 	{
-		std::vector<decltype(m_map.begin())> lstEntries;
+		if (n->prev != nullptr)
+			n->prev->next = n->next;
+		else
+			m_lru_head = n->next;
+		if (n->next != nullptr)
+			n->next->prev = n->prev;
+		else
+			m_lru_tail = n->prev;
+		n->prev = n->next = nullptr;
+	}
 
-		/*
-		 * Creating a list of iterators requires that .erase() is
-		 * non-invalidating, which limits ECCache<> to be used with
-		 * (unordered_)map only.
-		 */
-		for (auto i = m_map.begin(); i != m_map.end(); ++i)
-			lstEntries.emplace_back(i);
-		std::sort(lstEntries.begin(), lstEntries.end(),
-			[](const auto &i, const auto &j) { return i->second.ulLastAccess < j->second.ulLastAccess; });
-		// We now have a list of all cache items, sorted by access time, (oldest first)
+	void LruTouch(node_type *n)
+	{
+		if (n == m_lru_head)
+			return;
+		LruUnlink(n);
+		LruPushFront(n);
+	}
+
+	void EraseEntry(typename storage_type::iterator iter)
+	{
+		m_ulSize -= GetCacheAdditionalSize(iter->second.value);
+		m_ulSize -= GetCacheAdditionalSize(iter->first);
+		LruUnlink(&iter->second);
+		m_map.erase(iter);
+	}
+
+	/*
+	 * Drop the least recently used entry. Its key lives in the map node.
+	 * Entries that were hit through PeekCacheItem since they last came
+	 * by are moved back to the head instead, but at most CLOCK_SWEEP of
+	 * them: lookups under the shared lock can keep setting the flag, so
+	 * after that the tail goes regardless. Aging caches skip the second
+	 * chance, to keep their list in insertion order.
+	 */
+	void EvictTail()
+	{
+		if (MaxAge() == 0)
+			for (unsigned int i = 0; i < CLOCK_SWEEP &&
+			     m_lru_tail->referenced.exchange(false, std::memory_order_relaxed); ++i)
+				LruTouch(m_lru_tail);
+		auto iter = m_map.find(*m_lru_tail->key);
+		assert(iter != m_map.end());
+		EraseEntry(iter);
+	}
+
+	/* Remove entries from the tail for as long as they are expired. */
+	void ExpireCache(time_t tNow)
+	{
+		if (MaxAge() == 0)
+			return;
+		while (m_lru_tail != nullptr &&
+		       static_cast<long>(tNow - m_lru_tail->value.ulLastAccess) >= MaxAge())
+			EvictTail();
+	}
+
+	ECRESULT PurgeCache(float ratio)
+	{
 		size_t shrinkto = m_map.size() - m_map.size() * ratio;
 
 		/*
-		 * Remove [ratio] % of all cache entries, and then some more
-		 * until the size constraint is met.
+		 * Remove [ratio] % of all cache entries, oldest first, and
+		 * then some more until the size constraint is met.
 		 */
-		for (auto iterMap : lstEntries) {
-			m_ulSize -= GetCacheAdditionalSize(iterMap->second);
-			m_ulSize -= GetCacheAdditionalSize(iterMap->first);
-			m_map.erase(iterMap);
+		while (m_lru_tail != nullptr) {
+			EvictTail();
 			if (m_map.size() <= shrinkto && Size() <= MaxSize())
 				break;
 		}
-
 		return erSuccess;
 	}
 
@@ -284,8 +440,9 @@ private:
 		return erSuccess;
 	}
 
-	MapType m_map;
+	storage_type m_map;
 	size_type			m_ulSize;
+	node_type *m_lru_head = nullptr, *m_lru_tail = nullptr;
 };
 
 template<typename T> using ECCache = Cache<T>;
@@ -75,6 +75,8 @@ openssl req -new -x509 -key privkey.pem -out cacert.pem -days 1095
 */
 
 shared_mutex ECChannel::ctx_lock;
+
+enum { SSLIO_READ, SSLIO_PEEK, SSLIO_WRITE };
 SSL_CTX *ECChannel::lpCTX;
 
 HRESULT ECChannel::HrSetCtx(ECConfig *lpConfig)
@@ -242,9 +244,17 @@ HRESULT ECChannel::HrFreeCtx() {
 	return hrSuccess;
 }
 
+/*
+ * The socket does not block: waits are done in poll, outside m_ssl_lock, so
+ * that an IMAP IDLE notification can be written while a read waits for
+ * input on the same TLS session.
+ */
 ECChannel::ECChannel(int inputfd) :
 	fd(inputfd), peer_atxt(), peer_sockaddr()
 {
+	auto fl = fcntl(fd, F_GETFL);
+	if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0)
+		ec_log_warn("ECChannel: cannot make socket %d non-blocking: %s", fd, strerror(errno));
 }
 
 ECChannel::~ECChannel() {
@@ -295,9 +305,13 @@ HRESULT ECChannel::HrEnableTLS()
 	}
 
 	ERR_clear_error();
-	rc = SSL_accept(ssl);
-	if (rc != 1) {
+	while ((rc = SSL_accept(ssl)) != 1) {
 		int err = SSL_get_error(ssl, rc);
+		if ((err == SSL_ERROR_WANT_READ && wait_for(POLLIN, m_timeout)) ||
+		    (err == SSL_ERROR_WANT_WRITE && wait_for(POLLOUT, m_timeout))) {
+			ERR_clear_error();
+			continue;
+		}
 		ec_log_err("ECChannel::HrEnableTLS(): SSL_accept failed: %d", err);
 		if (err != SSL_ERROR_SYSCALL && err != SSL_ERROR_SSL)
 			SSL_shutdown(ssl);
@@ -305,6 +319,11 @@ HRESULT ECChannel::HrEnableTLS()
 	}
 
 	std::swap(lpSSL, ssl);
+	/*
+	 * Plaintext read ahead of the switch (STARTTLS) was not protected by
+	 * TLS, and must not be taken as if it was.
+	 */
+	m_inbuf.clear();
 	hr = hrSuccess;
 exit:
 	if (ssl != nullptr)
@@ -319,6 +338,33 @@ HRESULT ECChannel::HrGets(char *szBuffer, size_t ulBufSize, size_t *lpulRead)
 
 	if (!szBuffer || !lpulRead)
 		return MAPI_E_INVALID_PARAMETER;
+	if (!m_inbuf.empty() && ulBufSize > 1) {
+		/* Input read ahead comes first, up to and including a newline */
+		auto n = std::min(m_inbuf.size(), ulBufSize - 1);
+		auto nl = static_cast<const char *>(memchr(m_inbuf.data(), '\n', n));
+		if (nl != nullptr)
+			n = nl - m_inbuf.data() + 1;
+		memcpy(szBuffer, m_inbuf.data(), n);
+		m_inbuf.erase(0, n);
+		if (nl != nullptr) {
+			//remove the lf or crlf
+			--n;
+			if (n > 0 && szBuffer[n-1] == '\r')
+				--n;
+		} else if (n < ulBufSize - 1) {
+			/* The rest of the line is still on the socket */
+			size_t more = 0;
+			auto ret = HrGets(szBuffer + n, ulBufSize - n, &more);
+			if (ret != hrSuccess)
+				return ret;
+			if (more == 0 && szBuffer[n-1] == '\r')
+				--n;
+			n += more;
+		}
+		szBuffer[n] = '\0';
+		*lpulRead = n;
+		return hrSuccess;
+	}
 	if (lpSSL)
 		lpRet = SSL_gets(szBuffer, &len);
 	else
@@ -365,10 +411,23 @@ HRESULT ECChannel::HrReadLine(std::string &strBuffer, std::size_t ulMaxBuffer)
 HRESULT ECChannel::HrWriteString(const string_view &strBuffer)
 {
 	if (lpSSL) {
-		if (SSL_write(lpSSL, strBuffer.data(), static_cast<int>(strBuffer.size())) < 1)
+		if (strBuffer.size() > 0 &&
+		    ssl_io(SSLIO_WRITE, const_cast<char *>(strBuffer.data()),
+		    static_cast<int>(strBuffer.size()), -1) < 1)
+			return MAPI_E_NETWORK_ERROR;
+		return hrSuccess;
+	}
+	for (size_t done = 0; done < strBuffer.size(); ) {
+		auto n = send(fd, strBuffer.data() + done, strBuffer.size() - done, 0);
+		if (n > 0)
+			done += n;
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+		    wait_for(POLLOUT, -1))
+			continue;
+		else
 			return MAPI_E_NETWORK_ERROR;
-	} else if (send(fd, strBuffer.data(), strBuffer.size(), 0) < 1) {
-		return MAPI_E_NETWORK_ERROR;
 	}
 	return hrSuccess;
 }
@@ -413,52 +472,39 @@ HRESULT ECChannel::HrWriteLine(const string_view &strBuffer)
  */
 HRESULT ECChannel::HrReadAndDiscardBytes(size_t ulByteCount)
 {
-	size_t ulTotRead = 0;
+	size_t ulTotRead = take(nullptr, ulByteCount);
 	static constexpr size_t BUFSIZE = 4096;
 	auto szBuffer = std::make_unique<char[]>(BUFSIZE);
 
 	while (ulTotRead < ulByteCount) {
 		size_t ulBytesLeft = ulByteCount - ulTotRead;
-		auto ulRead = std::min(ulBytesLeft, BUFSIZE);
-
-		if (lpSSL)
-			ulRead = SSL_read(lpSSL, szBuffer.get(), ulRead);
-		else
-			ulRead = recv(fd, szBuffer.get(), ulRead, 0);
-
-		if (ulRead == static_cast<size_t>(-1)) {
-			if (errno == EINTR)
-				continue;
-			return MAPI_E_NETWORK_ERROR;
-		}
-		if (ulRead == 0 || ulRead > ulByteCount)
+		auto want = std::min(ulBytesLeft, BUFSIZE);
+		ssize_t n = lpSSL != nullptr ?
+		            ssl_io(SSLIO_READ, szBuffer.get(), want, m_timeout) :
+		            sock_recv(szBuffer.get(), want, 0);
+		if (n <= 0)
 			return MAPI_E_NETWORK_ERROR;
-		ulTotRead += ulRead;
+		ulTotRead += n;
 	}
 	return (ulTotRead == ulByteCount) ? hrSuccess : MAPI_E_CALL_FAILED;
 }
 
 HRESULT ECChannel::HrReadBytes(char *szBuffer, size_t ulByteCount)
 {
-	size_t ulRead = 0, ulTotRead = 0;
+	size_t ulTotRead = 0;
 
 	if(!szBuffer)
 		return MAPI_E_INVALID_PARAMETER;
+	ulTotRead = take(szBuffer, ulByteCount);
 
 	while(ulTotRead < ulByteCount) {
-		if (lpSSL)
-			ulRead = SSL_read(lpSSL, szBuffer + ulTotRead, ulByteCount - ulTotRead);
-		else
-			ulRead = recv(fd, szBuffer + ulTotRead, ulByteCount - ulTotRead, 0);
-
-		if (ulRead == static_cast<size_t>(-1)) {
-			if (errno == EINTR)
-				continue;
-			return MAPI_E_NETWORK_ERROR;
-		}
-		if (ulRead == 0 || ulRead > ulByteCount)
+		auto want = std::min(ulByteCount - ulTotRead, static_cast<size_t>(INT_MAX));
+		ssize_t n = lpSSL != nullptr ?
+		            ssl_io(SSLIO_READ, szBuffer + ulTotRead, want, m_timeout) :
+		            sock_recv(szBuffer + ulTotRead, want, 0);
+		if (n <= 0)
 			return MAPI_E_NETWORK_ERROR;
-		ulTotRead += ulRead;
+		ulTotRead += n;
 	}
 	szBuffer[ulTotRead] = '\0';
 	return (ulTotRead == ulByteCount) ? hrSuccess : MAPI_E_CALL_FAILED;
@@ -483,8 +529,13 @@ HRESULT ECChannel::HrReadBytes(std::string * strBuffer, size_t ulByteCount)
 HRESULT ECChannel::HrSelect(int seconds) {
 	struct pollfd pollfd = {fd, POLLIN, 0};
 
-	if(lpSSL && SSL_pending(lpSSL))
+	if (!m_inbuf.empty())
 		return hrSuccess;
+	if (lpSSL != nullptr) {
+		scoped_lock lk(m_ssl_lock);
+		if (SSL_pending(lpSSL))
+			return hrSuccess;
+	}
 	int res = poll(&pollfd, 1, seconds * 1000);
 	if (res == -1) {
 		if (errno == EINTR)
@@ -500,6 +551,121 @@ HRESULT ECChannel::HrSelect(int seconds) {
 	return hrSuccess;
 }
 
+/**
+ * Reads the input that is available without waiting for more, and keeps it
+ * for the other read functions. This is for event loops that only give a
+ * connection to a thread once a complete request has come in (see pending).
+ *
+ * @maxbuf:	stop once this much input is held
+ *
+ * @retval MAPI_E_NETWORK_ERROR the other side closed the connection (or it
+ * broke) and there was no more input
+ */
+HRESULT ECChannel::HrReadAvailable(size_t maxbuf)
+{
+	char buf[16384];
+	bool got = false;
+	HRESULT hr = hrSuccess;
+
+	while (m_inbuf.size() < maxbuf) {
+		auto want = std::min(sizeof(buf), maxbuf - m_inbuf.size());
+		ssize_t n;
+		if (lpSSL != nullptr) {
+			scoped_lock lk(m_ssl_lock);
+			ERR_clear_error();
+			n = SSL_read(lpSSL, buf, want);
+			if (n <= 0) {
+				auto err = SSL_get_error(lpSSL, n);
+				if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE && !got)
+					hr = MAPI_E_NETWORK_ERROR;
+				break;
+			}
+		} else {
+			n = recv(fd, buf, want, MSG_DONTWAIT);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (n <= 0) {
+				if (!got)
+					hr = MAPI_E_NETWORK_ERROR;
+				break;
+			}
+		}
+		m_inbuf.append(buf, n);
+		got = true;
+	}
+	return hr;
+}
+
+/* Waits until the socket is ready for @events; false on a timeout or an error */
+bool ECChannel::wait_for(short events, int timeout) const
+{
+	struct pollfd pfd = {fd, events, 0};
+	while (true) {
+		auto ret = poll(&pfd, 1, timeout);
+		if (ret > 0)
+			/* also on POLLERR/POLLHUP, for the call to see the error */
+			return true;
+		if (ret == 0 || errno != EINTR)
+			return false;
+	}
+}
+
+/* recv(2), waiting for input like on a blocking socket */
+ssize_t ECChannel::sock_recv(void *buf, size_t len, int flags)
+{
+	while (true) {
+		auto n = recv(fd, buf, len, flags);
+		if (n >= 0)
+			return n;
+		if (errno == EINTR)
+			continue;
+		if ((errno != EAGAIN && errno != EWOULDBLOCK) || !wait_for(POLLIN, m_timeout))
+			return -1;
+	}
+}
+
+/*
+ * SSL_read, SSL_peek or SSL_write under m_ssl_lock, waiting for the socket
+ * without the lock as long as OpenSSL wants it. Returns the call's result.
+ */
+int ECChannel::ssl_io(unsigned int op, void *buf, int len, int timeout)
+{
+	while (true) {
+		int n, err;
+		{
+			scoped_lock lk(m_ssl_lock);
+			ERR_clear_error();
+			n = op == SSLIO_WRITE ? SSL_write(lpSSL, buf, len) :
+			    op == SSLIO_PEEK ? SSL_peek(lpSSL, buf, len) :
+			    SSL_read(lpSSL, buf, len);
+			if (n > 0)
+				return n;
+			err = SSL_get_error(lpSSL, n);
+		}
+		if (err == SSL_ERROR_WANT_READ) {
+			if (!wait_for(POLLIN, timeout))
+				return -1;
+		} else if (err == SSL_ERROR_WANT_WRITE) {
+			if (!wait_for(POLLOUT, timeout))
+				return -1;
+		} else {
+			return n;
+		}
+	}
+}
+
+/* Hands out up to @len bytes of the input read ahead */
+size_t ECChannel::take(char *buf, size_t len)
+{
+	auto n = std::min(len, m_inbuf.size());
+	if (buf != nullptr)
+		memcpy(buf, m_inbuf.data(), n);
+	m_inbuf.erase(0, n);
+	return n;
+}
+
 /**
  * read from buffer until \n is found, or buffer length is reached
  * return buffer always contains \0 in the end, so max read from network is *lpulLen -1
@@ -520,27 +686,16 @@ char * ECChannel::fd_gets(char *buf, int *lpulLen) {
 		 * Return NULL when we read nothing:
 		 * other side has closed its writing socket.
 		 */
-		int n = recv(fd, bp, len, MSG_PEEK);
-		if (n == 0)
-			return NULL;
-		if (n == -1) {
-			if (errno == EINTR)
-				continue;
+		ssize_t n = sock_recv(bp, len, MSG_PEEK);
+		if (n <= 0)
 			return NULL;
-		}
 		newline = static_cast<char *>(memchr(bp, '\n', n));
 		if (newline != nullptr)
 			n = newline - bp + 1;
 
-	retry:
-		int recv_n = recv(fd, bp, n, 0);
-		if (recv_n == 0)
-			return NULL;
-		if (recv_n == -1) {
-			if (errno == EINTR)
-				goto retry;
+		auto recv_n = sock_recv(bp, n, 0);
+		if (recv_n <= 0)
 			return NULL;
-		}
 		bp += recv_n;
 		len -= recv_n;
 	}
@@ -569,14 +724,14 @@ char * ECChannel::SSL_gets(char *buf, int *lpulLen) {
 		 * Return NULL when we read nothing:
 		 * other side has closed its writing socket.
 		 */
-		int n = SSL_peek(lpSSL, bp, len);
+		int n = ssl_io(SSLIO_PEEK, bp, len, m_timeout);
 		if (n <= 0)
 			return NULL;
 		newline = static_cast<char *>(memchr(bp, '\n', n));
 		if (newline != nullptr)
 			n = newline - bp + 1;
-		n = SSL_read(lpSSL, bp, n);
-		if (n < 0)
+		n = ssl_io(SSLIO_READ, bp, n, m_timeout);
+		if (n <= 0)
 			return NULL;
 		bp += n;
 		len -= n;
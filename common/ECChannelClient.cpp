@@ -47,6 +47,11 @@ ECRESULT ECChannelClient::DoCmd(const std::string &strCommand, std::vector<std::
 	auto er = Connect();
 	if (er != erSuccess)
 		return er;
+	/* A channel that failed once is out of step with the other side */
+	auto drop = make_scope_success([&]() {
+		if (er != erSuccess && er != KCERR_CALL_FAILED)
+			m_lpChannel.reset();
+	});
 	er = m_lpChannel->HrWriteLine(strCommand);
 	if (er != erSuccess)
 		return er;
@@ -57,7 +62,64 @@ ECRESULT ECChannelClient::DoCmd(const std::string &strCommand, std::vector<std::
 	er = m_lpChannel->HrReadLine(strResponse, 4*1024*1024);
 	if (er != erSuccess)
 		return er;
+	return er = ParseResponse(strResponse, lstResponse);
+}
+
+/**
+ * Sends @cmds without waiting for each response in turn, keeping at most
+ * @window commands outstanding, and collects the responses in order.
+ *
+ * @rsp:	response tokens of every command
+ * @status:	erSuccess, or KCERR_CALL_FAILED if that command was refused
+ *
+ * Returns an error only when the channel itself failed; the channel is
+ * dropped then, and the next command reconnects.
+ */
+ECRESULT ECChannelClient::DoCmds(const std::vector<std::string> &cmds,
+    std::vector<std::vector<std::string>> &rsp, std::vector<ECRESULT> &status,
+    size_t window)
+{
+	std::string strResponse, out;
+	size_t sent = 0, recvd = 0;
+
+	rsp.assign(cmds.size(), {});
+	status.assign(cmds.size(), erSuccess);
+	auto er = Connect();
+	if (er != erSuccess)
+		return er;
+	auto drop = make_scope_success([&]() {
+		if (er != erSuccess)
+			m_lpChannel.reset();
+	});
+	if (window == 0)
+		window = 1;
+	while (recvd < cmds.size()) {
+		/* all commands that fit the window in one write */
+		out.clear();
+		for (; sent < cmds.size() && sent - recvd < window; ++sent) {
+			out += cmds[sent];
+			out += "\r\n";
+		}
+		if (!out.empty()) {
+			er = m_lpChannel->HrWriteString(out);
+			if (er != erSuccess)
+				return er = KCERR_NETWORK_ERROR;
+		}
+		auto hr = m_lpChannel->HrSelect(m_ulTimeout);
+		if (hr != hrSuccess)
+			return er = hr == MAPI_E_TIMEOUT ? KCERR_TIMEOUT : KCERR_NETWORK_ERROR;
+		er = m_lpChannel->HrReadLine(strResponse, 4 * 1024 * 1024);
+		if (er != erSuccess)
+			return er = KCERR_NETWORK_ERROR;
+		status[recvd] = ParseResponse(strResponse, rsp[recvd]);
+		++recvd;
+	}
+	return erSuccess;
+}
 
+ECRESULT ECChannelClient::ParseResponse(const std::string &strResponse,
+    std::vector<std::string> &lstResponse)
+{
 	lstResponse = tokenize(strResponse, m_strTokenizer);
 	if (!lstResponse.empty() && lstResponse.front() == "OK")
 		lstResponse.erase(lstResponse.begin());
@@ -17,9 +17,12 @@ class KC_EXPORT ECChannelClient {
 public:
 	ECChannelClient(const char *szPath, const char *szTokenizer);
 	ECRESULT DoCmd(const std::string &strCommand, std::vector<std::string> &lstResponse);
+	ECRESULT DoCmds(const std::vector<std::string> &cmds, std::vector<std::vector<std::string>> &rsp, std::vector<ECRESULT> &status, size_t window = 16);
+	bool Connected() const { return m_lpChannel != nullptr; }
 
 protected:
 	ECRESULT Connect();
+	KC_HIDDEN ECRESULT ParseResponse(const std::string &, std::vector<std::string> &);
 	KC_HIDDEN ECRESULT ConnectSocket();
 	KC_HIDDEN ECRESULT ConnectHttp();
 
@@ -4,18 +4,23 @@
  */
 #include <kopano/platform.h>
 #include <algorithm>
+#include <iterator>
+#include <string>
 #include <utility>
 #include <vector>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <kopano/ECKeyTable.h>
 #include <kopano/ustringutil.h>
 
 namespace KC {
 
 /*
- * Balanced binary tree node system
+ * Order-statistic B+-tree
  *
- * To make the row system as fast as possible, we use a balanced binary tree algorithm. Main speed interests are:
+ * To make the row system as fast as possible, we use a B+-tree whose nodes count the rows below them.
+ * Main speed interests are:
  *
  * - Fast insertion
  * - Fast deletion by row ID
@@ -23,23 +28,386 @@ namespace KC {
  * - Fast seek by row number
  * - Fast current row number retrieval
  *
- * The insertion and row number functions can be directly related to the balanced b-tree. This makes sure that
- * inserting data only requires updating parent nodes and is therefore a O(log n) operation. Deletion also needs
- * to update parent nodes, and is therefore also a O(log n) operation.
+ * Rows are kept in sorted order in the leaves, which are linked so that the table can be walked. Inner nodes
+ * hold, for every child but the first, a separator key that is not greater than any key in that child, nor
+ * less than any key in the children before it. Every node counts the unhidden rows below it, so the row
+ * number of a row (walk up, adding the counts of the siblings on the left) and the row at a row number
+ * (walk down) are both O(log n). Rows with equal sort keys stay in insertion order.
  *
- * For the row ID retrieval, a simple hash map is used for almost constant-time retrieval of nodes. This makes row
- * update extremely fast, while getting the current row number is also O(log n)
- *
- * The b-tree is built up basically like a binary search tree, with the ordering being
- *
- *   2
- *  / \
- * 1   3
- *
- * .. in each node. This means that the natural order for the tree is the sorted order.
+ * For the row ID retrieval, a hash map to the leaf is used for almost constant-time retrieval of rows.
  *
+ * Sort keys are stored packed (see kt_encode) in one buffer per leaf, and front-coded: each entry records
+ * how many leading bytes it shares with the key of the entry before it, and only stores the rest. An entry
+ * that shares nothing is a restart point from which keys can be rebuilt; at most KT_RESTART entries follow
+ * one when a leaf is (re)built.
  */
 
+static constexpr unsigned int KT_LEAF_MAX = 64, KT_INNER_MAX = 64, KT_RESTART = 8;
+
+struct ECKeyTable::kt_entry {
+	sObjectTableKey key;
+	uint32_t off; /* start of the unshared part of the sort key in the arena */
+	uint16_t shared; /* bytes shared with the sort key of the previous entry */
+	bool hidden;
+};
+
+struct ECKeyTable::kt_node {
+	kt_node(bool l) : leaf(l) {}
+
+	kt_inner *parent = nullptr;
+	unsigned int visible = 0; /* unhidden rows in this subtree */
+	bool leaf;
+};
+
+struct ECKeyTable::kt_leaf final : public ECKeyTable::kt_node {
+	kt_leaf() : kt_node(true) {}
+	size_t size() const { return ent.size(); }
+	size_t suffix(unsigned int i) const { return (i + 1 < ent.size() ? ent[i+1].off : arena.size()) - ent[i].off; }
+	/* Turns @k from the key of entry @i - 1 into that of entry @i */
+	void step(unsigned int i, std::string &k) const
+	{
+		k.resize(ent[i].shared);
+		k.append(arena, ent[i].off, suffix(i));
+	}
+	void key(unsigned int, std::string &) const;
+	void keys(std::vector<std::string> &) const;
+	unsigned int bound(const std::string &, bool lower, std::string &cur) const;
+	void assign(std::vector<kt_entry> &&, const std::vector<std::string> &);
+	void insert(unsigned int, kt_entry, const std::string &);
+	void erase(unsigned int);
+	void recode(unsigned int, const std::string &k, const std::string &prev);
+
+	kt_leaf *prev = nullptr, *next = nullptr;
+	std::vector<kt_entry> ent;
+	std::string arena;
+};
+
+struct ECKeyTable::kt_inner final : public ECKeyTable::kt_node {
+	kt_inner() : kt_node(false) {}
+	unsigned int index(const kt_node *n) const
+	{
+		return std::find(kids.cbegin(), kids.cend(), n) - kids.cbegin();
+	}
+
+	/* Separators live in one buffer; the one of kids[0] is unused */
+	size_t sepend(unsigned int i) const { return i + 1 < sepoff.size() ? sepoff[i+1] : seps.size(); }
+	const char *sep(unsigned int i) const { return seps.data() + sepoff[i]; }
+	size_t sepsize(unsigned int i) const { return sepend(i) - sepoff[i]; }
+	std::string sepstr(unsigned int i) const { return seps.substr(sepoff[i], sepsize(i)); }
+	void sep_insert(unsigned int i, const std::string &s)
+	{
+		auto off = i < sepoff.size() ? sepoff[i] : seps.size();
+		seps.insert(off, s);
+		sepoff.insert(sepoff.begin() + i, off);
+		for (auto j = i + 1; j < sepoff.size(); ++j)
+			sepoff[j] += s.size();
+	}
+	void sep_erase(unsigned int i)
+	{
+		auto z = sepsize(i);
+		seps.erase(sepoff[i], z);
+		sepoff.erase(sepoff.begin() + i);
+		for (auto j = i; j < sepoff.size(); ++j)
+			sepoff[j] -= z;
+	}
+	void sep_truncate(unsigned int n)
+	{
+		seps.resize(n < sepoff.size() ? sepoff[n] : seps.size());
+		sepoff.resize(n);
+	}
+
+	std::vector<kt_node *> kids;
+	std::vector<uint32_t> sepoff;
+	std::string seps;
+};
+
+/* The rows of a table; shared between tables by Share() and Adopt() */
+struct ECKeyTable::kt_tree final {
+	kt_tree() : root(new kt_leaf) {}
+	kt_tree(const kt_tree &);
+	~kt_tree();
+	void operator=(const kt_tree &) = delete;
+
+	std::recursive_mutex lock; /* Locks the rows, and the cursors of their tables */
+	kt_node *root;
+	std::unordered_map<sObjectTableKey, kt_leaf *> rows; /* row id -> leaf */
+	std::vector<ECKeyTable *> users; /* tables showing these rows */
+	bool shared = false; /* handed out by Share() */
+};
+
+/* Locks a table and its rows, in that order */
+struct ECKeyTable::kt_lock final {
+	kt_lock(ECKeyTable &t) : table(t.mLock), tree(t.m_tree), rows(tree->lock) {}
+
+	scoped_rlock table;
+	std::shared_ptr<kt_tree> tree; /* keeps the locked rows while we change m_tree */
+	scoped_rlock rows;
+};
+
+struct kt_col {
+	uint8_t flags = 0;
+	bool isnull = false;
+	const char *data = nullptr;
+	size_t size = 0;
+};
+
+/*
+ * Packs sort columns into a single string: per column the flags, the null
+ * indicator, the key length (base-128) and the key.
+ */
+static void kt_encode(const std::vector<ECSortCol> &cols, std::string &out)
+{
+	out.clear();
+	for (const auto &c : cols) {
+		out += static_cast<char>(c.flags);
+		out += static_cast<char>(c.isnull);
+		auto z = c.key.size();
+		for (; z >= 0x80; z >>= 7)
+			out += static_cast<char>(z | 0x80);
+		out += static_cast<char>(z);
+		out += c.key;
+	}
+}
+
+/* Reads the next column of a packed key; false at the end */
+static bool kt_next(const char *&p, const char *end, kt_col &c)
+{
+	if (p >= end)
+		return false;
+	c.flags = *p++;
+	c.isnull = *p++;
+	c.size = 0;
+	for (unsigned int shift = 0; p < end; shift += 7) {
+		auto b = static_cast<unsigned char>(*p++);
+		c.size |= static_cast<size_t>(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			break;
+	}
+	c.data = p;
+	p += c.size;
+	return true;
+}
+
+static void kt_decode(const std::string &s, std::vector<ECSortCol> &cols)
+{
+	const char *p = s.data(), *end = p + s.size();
+	kt_col c;
+
+	cols.clear();
+	while (kt_next(p, end, c)) {
+		ECSortCol x;
+		x.flags = c.flags;
+		x.isnull = c.isnull;
+		x.key.assign(c.data, c.size);
+		cols.emplace_back(std::move(x));
+	}
+}
+
+static size_t kt_columns(const std::string &s)
+{
+	const char *p = s.data(), *end = p + s.size();
+	kt_col c;
+	size_t n = 0;
+	while (kt_next(p, end, c))
+		++n;
+	return n;
+}
+
+static size_t kt_common(const std::string &a, const std::string &b)
+{
+	size_t n = std::min(std::min(a.size(), b.size()), static_cast<size_t>(UINT16_MAX));
+	return std::mismatch(a.cbegin(), a.cbegin() + n, b.cbegin()).first - a.cbegin();
+}
+
+/*
+ * Compares one sort column of two rows; the flags of @a decide how. See
+ * ECTableRow::rowcompare.
+ */
+static int kt_colcmp(uint8_t flags, bool anull, const char *ak, size_t az,
+    bool bnull, const char *bk, size_t bz)
+{
+	int cmp = 0;
+
+	if (flags & TABLEROW_FLAG_FLOAT) {
+		if (az == sizeof(double) && bz == sizeof(double)) {
+			double ad, bd;
+			memcpy(&ad, ak, sizeof(double));
+			memcpy(&bd, bk, sizeof(double));
+			cmp = ad == bd ? 0 : ad < bd ? -1 : 1;
+		}
+	} else if (anull && bnull) {
+		cmp = 0;
+	} else if (anull) {
+		return -1;
+	} else if (bnull) {
+		return 1;
+	} else if (flags & TABLEROW_FLAG_STRING) {
+		cmp = compareSortKeys(ak, az, bk, bz);
+	} else if (az > 0 && bz > 0) {
+		// Sort data is pre-constructed so a simple memcmp suffices for sorting
+		cmp = memcmp(ak, bk, std::min(az, bz));
+	}
+	if (cmp != 0 || az == bz)
+		return cmp;
+	return az < bz ? -1 : 1;
+}
+
+/* ECTableRow::rowcompare on packed keys, looking at the first @prefix columns */
+static bool kt_less(const char *ap, size_t az, const char *bp, size_t bz,
+    bool ignore_order = false, size_t prefix = -1)
+{
+	const char *ae = ap + az, *be = bp + bz;
+	kt_col ac, bc;
+
+	for (size_t i = 0; i < prefix; ++i) {
+		bool ha = kt_next(ap, ae, ac), hb = kt_next(bp, be, bc);
+		if (!ha || !hb)
+			// the item with the least sort columns comes first, independent of asc/desc
+			return !ha && hb;
+		auto cmp = kt_colcmp(ac.flags, ac.isnull, ac.data, ac.size,
+		           bc.isnull, bc.data, bc.size);
+		if (cmp == 0)
+			continue;
+		if (!ignore_order && ac.flags & TABLEROW_FLAG_DESC)
+			return cmp > 0;
+		return cmp < 0;
+	}
+	return false;
+}
+
+static inline bool kt_less(const std::string &a, const std::string &b,
+    bool ignore_order = false, size_t prefix = -1)
+{
+	return kt_less(a.data(), a.size(), b.data(), b.size(), ignore_order, prefix);
+}
+
+/* Rebuilds the packed sort key of entry @pos from the last restart point */
+void ECKeyTable::kt_leaf::key(unsigned int pos, std::string &k) const
+{
+	unsigned int r = pos;
+	while (r > 0 && ent[r].shared != 0)
+		--r;
+	for (; r <= pos; ++r)
+		step(r, k);
+}
+
+/*
+ * Returns the position of the first entry that sorts after @k, or (for
+ * @lower) of the first one that does not sort before it. The restart points
+ * are binary searched, the entries after the chosen one scanned. @cur is
+ * scratch space.
+ */
+unsigned int ECKeyTable::kt_leaf::bound(const std::string &k, bool lower,
+    std::string &cur) const
+{
+	auto before = [&](const std::string &e) { return lower ? kt_less(e, k) : !kt_less(k, e); };
+	unsigned int rs[KT_LEAF_MAX+1], nrs = 0;
+
+	for (unsigned int i = 0; i < ent.size(); ++i)
+		if (ent[i].shared == 0)
+			rs[nrs++] = i;
+	/* Find the last restart point that sorts before the position */
+	unsigned int lo = 0, hi = nrs;
+	while (lo < hi) {
+		auto mid = (lo + hi) / 2;
+		cur.assign(arena, ent[rs[mid]].off, suffix(rs[mid]));
+		if (before(cur))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return 0;
+	auto i = rs[lo-1];
+	cur.assign(arena, ent[i].off, suffix(i));
+	for (++i; i < ent.size(); ++i) {
+		step(i, cur);
+		if (!before(cur))
+			break;
+	}
+	return i;
+}
+
+void ECKeyTable::kt_leaf::keys(std::vector<std::string> &k) const
+{
+	std::string cur;
+	k.clear();
+	k.reserve(ent.size());
+	for (unsigned int i = 0; i < ent.size(); ++i) {
+		step(i, cur);
+		k.emplace_back(cur);
+	}
+}
+
+void ECKeyTable::kt_leaf::assign(std::vector<kt_entry> &&e,
+    const std::vector<std::string> &k)
+{
+	ent = std::move(e);
+	arena.clear();
+	for (size_t i = 0; i < ent.size(); ++i) {
+		auto sh = i % KT_RESTART == 0 ? 0 : kt_common(k[i-1], k[i]);
+		ent[i].off = arena.size();
+		ent[i].shared = sh;
+		arena.append(k[i], sh, std::string::npos);
+	}
+	arena.shrink_to_fit();
+}
+
+/* Re-encodes entry @i (with key @k) against the key @prev before it */
+void ECKeyTable::kt_leaf::recode(unsigned int i, const std::string &k,
+    const std::string &prev)
+{
+	auto sh = i == 0 ? 0 : kt_common(prev, k);
+	auto oldz = suffix(i), newz = k.size() - sh;
+	arena.replace(ent[i].off, oldz, k, sh, std::string::npos);
+	ent[i].shared = sh;
+	for (auto j = i + 1; j < ent.size(); ++j)
+		ent[j].off = ent[j].off + newz - oldz;
+}
+
+void ECKeyTable::kt_leaf::insert(unsigned int pos, kt_entry e,
+    const std::string &k)
+{
+	std::string prev, succ;
+	bool recode_next = pos < ent.size() && ent[pos].shared != 0;
+	unsigned int chain = 0;
+
+	if (recode_next)
+		key(pos, succ);
+	if (pos > 0) {
+		key(pos - 1, prev);
+		for (auto r = pos - 1; r > 0 && ent[r].shared != 0; --r)
+			++chain;
+	}
+	e.shared = pos > 0 && chain + 1 < KT_RESTART ? kt_common(prev, k) : 0;
+	e.off = pos < ent.size() ? ent[pos].off : arena.size();
+	arena.insert(e.off, k, e.shared, std::string::npos);
+	for (auto i = pos; i < ent.size(); ++i)
+		ent[i].off += k.size() - e.shared;
+	ent.insert(ent.begin() + pos, e);
+	if (recode_next)
+		recode(pos + 1, succ, k);
+}
+
+void ECKeyTable::kt_leaf::erase(unsigned int pos)
+{
+	std::string prev, succ;
+	bool recode_next = pos + 1 < ent.size() && ent[pos+1].shared != 0;
+
+	if (recode_next) {
+		key(pos + 1, succ);
+		if (pos > 0)
+			key(pos - 1, prev);
+	}
+	auto z = suffix(pos);
+	arena.erase(ent[pos].off, z);
+	for (auto i = pos + 1; i < ent.size(); ++i)
+		ent[i].off -= z;
+	ent.erase(ent.begin() + pos);
+	if (recode_next)
+		recode(pos, succ, prev);
+}
+
 /*
  * A table row in the KeyTable contains only the row ID, used for the PR_INSTANCE_KEY in
  * the client table, and any columns that are required for sorting. This class does *not*
@@ -66,11 +434,6 @@ ECTableRow::ECTableRow(sObjectTableKey &&k, std::vector<ECSortCol> &&cols,
 {
 }
 
-ECTableRow::ECTableRow(const ECTableRow &other) :
-	sKey(other.sKey), m_cols(other.m_cols), fHidden(other.fHidden)
-{
-}
-
 /*
  * The sortkeys are stored as binary data, the caller must ensure that the ordering of this
  * binary data is the same as the ordering of the underlying fields; variable-size columns
@@ -82,11 +445,6 @@ ECTableRow::ECTableRow(const ECTableRow &other) :
  */
 bool ECTableRow::rowcompare(const ECTableRow *a, const ECTableRow *b)
 {
-	// The root node is before anything!
-	if(a->fRoot && !b->fRoot)
-		return true;
-	if(b->fRoot)
-		return false;
 	return rowcompare(a->m_cols, b->m_cols);
 }
 
@@ -99,47 +457,12 @@ bool ECTableRow::rowcompare(const ECSortColView &a, const ECSortColView &b,
 
 	for (i = 0; i < ulSortCols; ++i) {
 		const auto &ak = a[i].key, &bk = b[i].key;
-	    int cmp = 0;
-
-	    if (a[i].flags & TABLEROW_FLAG_FLOAT) {
-			if (ak.size() != sizeof(double) || bk.size() != sizeof(double)) {
-	            cmp = 0;
-            } else {
-				double ad, bd;
-				memcpy(&ad, ak.c_str(), sizeof(double));
-				memcpy(&bd, bk.c_str(), sizeof(double));
-				if (ad == bd)
-					cmp = 0;
-				else if (ad < bd)
-					cmp = -1;
-				else
-					cmp = 1;
-            }
-		} else if (a[i].isnull && b[i].isnull) {
-			cmp = 0;
-		} else if (a[i].isnull) {
-			cmp = -1;
-		} else if (b[i].isnull) {
-			cmp = 1;
-		} else if (a[i].flags & TABLEROW_FLAG_STRING) {
-			cmp = compareSortKeys(ak, bk);
-		} else {
-	        // Sort data is pre-constructed so a simple memcmp suffices for sorting
-			cmp = memcmp(ak.c_str(), bk.c_str(), ak.size() < bk.size() ? ak.size() : bk.size());
-        }
-
-		if(cmp < 0) {
-			ret = true;
-			break;
-		} else if (cmp == 0) {
-			if (ak.size() == bk.size())
-				continue;
-			ret = ak.size() < bk.size();
-			break;
-		} else {
-			ret = false;
-			break;
-		}
+		auto cmp = kt_colcmp(a[i].flags, a[i].isnull, ak.c_str(), ak.size(),
+		           b[i].isnull, bk.c_str(), bk.size());
+		if (cmp == 0)
+			continue;
+		ret = cmp < 0;
+		break;
 	}
 
 	if(i == ulSortCols) {
@@ -181,153 +504,545 @@ size_t ECTableRow::GetObjectSize() const
 	return ulSize;
 }
 
+
 ECKeyTable::ECKeyTable() :
-	lpRoot(new ECTableRow(sObjectTableKey(), {}, false)), lpCurrent(lpRoot)
-{
-	lpRoot->fRoot = true;
 	// The start of bookmark, the first 3 (0,1,2) are default
-	m_ulBookmarkPosition = 3;
+	m_ulBookmarkPosition(3)
+{
+	Attach(std::make_shared<kt_tree>());
 }
 
 ECKeyTable::~ECKeyTable()
 {
-	Clear();
-	delete lpRoot;
+	Detach();
 }
 
-// Propagate this node's counts up to the root
-ECRESULT ECKeyTable::UpdateCounts(ECTableRow *lpRow)
+ECKeyTable::kt_tree::kt_tree(const kt_tree &o)
 {
-	while(lpRow != NULL) {
-		if(lpRow == lpRoot) {
-			lpRow->ulHeight = 0;
-			lpRow->ulBranchCount = 0; // makes sure that lpRoot->ulBranchCount is the total size
-		} else if(lpRow->fHidden) {
-		    lpRow->ulHeight = 1;		// Hidden rows count as 'height' for AVL ..
-		    lpRow->ulBranchCount = 0;   // .. but not as a 'row' for rowcount
-		} else {
-			lpRow->ulHeight = 1;
-			lpRow->ulBranchCount = 1;
-		}
+	kt_leaf *last = nullptr;
+	rows.reserve(o.rows.size());
+	root = CloneNode(o.root, nullptr, last, rows);
+}
+
+ECKeyTable::kt_tree::~kt_tree()
+{
+	FreeNode(root);
+}
 
-		if(lpRow->lpLeft)
-			lpRow->ulBranchCount += lpRow->lpLeft->ulBranchCount;
-		if(lpRow->lpRight)
-			lpRow->ulBranchCount += lpRow->lpRight->ulBranchCount;
-
-		// Get the height of the highest subtree
-		unsigned int ulHeight = 0;
-		if(lpRow->lpLeft)
-			ulHeight = lpRow->lpLeft->ulHeight;
-		if(lpRow->lpRight)
-			ulHeight = std::max(lpRow->lpRight->ulHeight, ulHeight);
-
-		// Our height is highest subtree plus one
-		lpRow->ulHeight += ulHeight;
-		lpRow = lpRow->lpParent;
+/*
+ * Copies the subtree @n below @parent. Leaves are linked to @last, the
+ * previously copied leaf, and their rows entered in @rows.
+ */
+ECKeyTable::kt_node *ECKeyTable::CloneNode(const kt_node *n, kt_inner *parent,
+    kt_leaf *&last, std::unordered_map<sObjectTableKey, kt_leaf *> &rows)
+{
+	if (n->leaf) {
+		auto lf = new kt_leaf(*static_cast<const kt_leaf *>(n));
+		lf->parent = parent;
+		lf->prev = last;
+		lf->next = nullptr;
+		if (last != nullptr)
+			last->next = lf;
+		last = lf;
+		for (const auto &e : lf->ent)
+			rows.emplace(e.key, lf);
+		return lf;
 	}
-	return erSuccess;
+	auto in = new kt_inner(*static_cast<const kt_inner *>(n));
+	in->parent = parent;
+	for (auto &k : in->kids)
+		k = CloneNode(k, in, last, rows);
+	return in;
 }
 
-ECRESULT ECKeyTable::UpdateRow_Delete(const sObjectTableKey *lpsRowItem,
-    std::vector<ECSortCol> &&dat, sObjectTableKey *lpsPrevRow, bool fHidden,
-    UpdateType *lpulAction)
+/* Makes @t the rows of this table; they must not be locked by us */
+void ECKeyTable::Attach(const std::shared_ptr<kt_tree> &t)
 {
-	scoped_rlock biglock(mLock);
+	scoped_rlock lk(t->lock);
+	t->users.emplace_back(this);
+	m_tree = t;
+}
 
-	// Find the row by ID
-	auto iterMap = mapRow.find(*lpsRowItem);
-	if (iterMap == mapRow.cend())
-		return KCERR_NOT_FOUND;
-	// The row exists
-	auto lpRow = iterMap->second;
-
-	// Do the delete
-	if (lpRow->lpLeft == NULL && lpRow->lpRight == NULL) {
-		// This is a leaf node, just delete the leaf
-		if (lpRow->fLeft)
-			lpRow->lpParent->lpLeft = NULL;
-		else
-			lpRow->lpParent->lpRight = NULL;
-		UpdateCounts(lpRow->lpParent);
-		RestructureRecursive(lpRow->lpParent);
-	} else if (lpRow->lpLeft != NULL && lpRow->lpRight == NULL) {
-		// We have a left branch, put that branch in place of this node
-		if (lpRow->fLeft)
-			lpRow->lpParent->lpLeft = lpRow->lpLeft;
-		else
-			lpRow->lpParent->lpRight = lpRow->lpLeft;
-		lpRow->lpLeft->lpParent = lpRow->lpParent;
-		lpRow->lpLeft->fLeft = lpRow->fLeft;
-		UpdateCounts(lpRow->lpParent);
-		RestructureRecursive(lpRow->lpParent);
-	} else if (lpRow->lpRight != NULL && lpRow->lpLeft == NULL) {
-		// We have a right branch, put that branch in place of this node
-		if (lpRow->fLeft)
-			lpRow->lpParent->lpLeft = lpRow->lpRight;
+void ECKeyTable::Detach()
+{
+	if (m_tree == nullptr)
+		return;
+	scoped_rlock lk(m_tree->lock);
+	auto &u = m_tree->users;
+	u.erase(std::remove(u.begin(), u.end(), this), u.end());
+}
+
+/*
+ * Before changing rows that were handed out, outside LockRows(), gets a
+ * copy of them. Must hold the rows locked.
+ */
+void ECKeyTable::CopyOnWrite()
+{
+	if (!m_tree->shared || m_locked != nullptr)
+		return;
+	auto t = std::make_shared<kt_tree>(*m_tree);
+	auto &u = m_tree->users;
+	u.erase(std::remove(u.begin(), u.end(), this), u.end());
+	/* Nobody else knows about the copy yet: no need to lock it */
+	t->users.emplace_back(this);
+	m_tree = std::move(t);
+}
+
+std::shared_ptr<ECKeyTable::kt_tree> ECKeyTable::Share()
+{
+	kt_lock biglock(*this);
+	m_tree->shared = true;
+	return m_tree;
+}
+
+/* Gets a copy of the rows for this table only, if they are shared */
+void ECKeyTable::Unshare()
+{
+	kt_lock biglock(*this);
+	CopyOnWrite();
+}
+
+/*
+ * Locks the rows, and changes the table makes before UnlockRows() go to
+ * them even if they are shared. This is how one table can change the rows
+ * of all tables sharing them.
+ */
+void ECKeyTable::LockRows()
+{
+	mLock.lock();
+	m_locked = m_tree;
+	m_locked->lock.lock();
+}
+
+void ECKeyTable::UnlockRows()
+{
+	auto t = std::move(m_locked);
+	t->lock.unlock();
+	mLock.unlock();
+}
+
+/*
+ * Replaces the rows with shared ones. The cursor and bookmarks are kept on
+ * their rows; if the row under the cursor is gone, the cursor moves to the
+ * row that now has its row number, as if that row was deleted.
+ */
+ECRESULT ECKeyTable::Adopt(const std::shared_ptr<kt_tree> &rows)
+{
+	unsigned int ulCursorRow = 0;
+
+	if (rows == nullptr)
+		return KCERR_INVALID_PARAMETER;
+	scoped_rlock biglock(mLock);
+	if (rows == m_tree)
+		return erSuccess;
+	{
+		scoped_rlock lk(m_tree->lock);
+		if (m_current.ulWhere == sKeyTablePos::ON_ROW) {
+			auto it = LocateId(m_current.sKey);
+			if (it.lf != nullptr)
+				ulCursorRow = Rank(it);
+		}
+	}
+	Detach();
+	Attach(rows);
+	scoped_rlock lk(m_tree->lock);
+	if (m_current.ulWhere == sKeyTablePos::ON_ROW &&
+	    m_tree->rows.find(m_current.sKey) == m_tree->rows.cend())
+		m_current = Store(SeekVisible(ulCursorRow));
+	for (auto i = m_mapBookmarks.begin(); i != m_mapBookmarks.end(); ) {
+		const auto &pos = i->second.sPosition;
+		if (pos.ulWhere == sKeyTablePos::ON_ROW &&
+		    m_tree->rows.find(pos.sKey) == m_tree->rows.cend())
+			i = m_mapBookmarks.erase(i);
 		else
-			lpRow->lpParent->lpRight = lpRow->lpRight;
-		lpRow->lpRight->lpParent = lpRow->lpParent;
-		lpRow->lpRight->fLeft = lpRow->fLeft;
-		UpdateCounts(lpRow->lpParent);
-		RestructureRecursive(lpRow->lpParent);
+			++i;
+	}
+	return erSuccess;
+}
+
+void ECKeyTable::FreeNode(kt_node *n)
+{
+	if (n->leaf) {
+		delete static_cast<kt_leaf *>(n);
+		return;
+	}
+	auto in = static_cast<kt_inner *>(n);
+	for (auto k : in->kids)
+		FreeNode(k);
+	delete in;
+}
+
+// Propagate a change in the number of unhidden rows up to the root
+void ECKeyTable::AddVisible(kt_node *n, int d)
+{
+	for (; n != nullptr; n = n->parent)
+		n->visible += d;
+}
+
+/*
+ * Finds the leaf for a packed sort key: the last one whose separator is not
+ * greater than @key (new rows go after equal ones), or less than @key when
+ * looking for the lower bound.
+ */
+ECKeyTable::kt_leaf *ECKeyTable::FindLeaf(const std::string &key, bool lower) const
+{
+	auto n = m_tree->root;
+	while (!n->leaf) {
+		auto in = static_cast<kt_inner *>(n);
+		size_t lo = 1, hi = in->kids.size();
+		while (lo < hi) {
+			auto mid = (lo + hi) / 2;
+			auto s = in->sep(mid);
+			auto z = in->sepsize(mid);
+			if (lower ? kt_less(s, z, key.data(), key.size()) :
+			    !kt_less(key.data(), key.size(), s, z))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		n = in->kids[lo-1];
+	}
+	return static_cast<kt_leaf *>(n);
+}
+
+// Links @right into the tree just after @left, splitting upwards as needed
+void ECKeyTable::InsertChild(kt_node *left, kt_node *right, const std::string &sep)
+{
+	auto p = left->parent;
+	if (p == nullptr) {
+		p = new kt_inner;
+		p->kids.emplace_back(left);
+		p->sep_insert(0, std::string());
+		p->visible = left->visible + right->visible;
+		left->parent = p;
+		m_tree->root = p;
+	}
+	auto i = p->index(left) + 1;
+	p->kids.emplace(p->kids.begin() + i, right);
+	p->sep_insert(i, sep);
+	right->parent = p;
+	if (p->kids.size() > KT_INNER_MAX)
+		SplitInner(p);
+}
+
+void ECKeyTable::SplitLeaf(kt_leaf *lf)
+{
+	std::vector<std::string> lk, rk;
+	lf->keys(lk);
+	auto half = lf->size() / 2;
+	auto rt = new kt_leaf;
+	std::vector<kt_entry> le(lf->ent.cbegin(), lf->ent.cbegin() + half);
+	std::vector<kt_entry> re(lf->ent.cbegin() + half, lf->ent.cend());
+	rk.assign(std::make_move_iterator(lk.begin() + half), std::make_move_iterator(lk.end()));
+	lk.resize(half);
+	rt->assign(std::move(re), rk);
+	lf->assign(std::move(le), lk);
+
+	for (const auto &e : rt->ent) {
+		if (!e.hidden)
+			++rt->visible;
+		m_tree->rows[e.key] = rt;
+	}
+	lf->visible -= rt->visible;
+	rt->next = lf->next;
+	if (rt->next != nullptr)
+		rt->next->prev = rt;
+	rt->prev = lf;
+	lf->next = rt;
+	InsertChild(lf, rt, rk[0]);
+}
+
+void ECKeyTable::SplitInner(kt_inner *in)
+{
+	auto half = in->kids.size() / 2;
+	auto rt = new kt_inner;
+	rt->kids.assign(in->kids.cbegin() + half, in->kids.cend());
+	rt->sep_insert(0, std::string());
+	for (auto j = half + 1; j < in->kids.size(); ++j)
+		rt->sep_insert(j - half, in->sepstr(j));
+	auto up = in->sepstr(half);
+	in->kids.resize(half);
+	in->sep_truncate(half);
+	for (auto k : rt->kids) {
+		k->parent = rt;
+		rt->visible += k->visible;
+	}
+	in->visible -= rt->visible;
+	InsertChild(in, rt, up);
+}
+
+// Unlinks (but does not free) @child from @p
+void ECKeyTable::RemoveChild(kt_inner *p, kt_node *child)
+{
+	auto i = p->index(child);
+	p->kids.erase(p->kids.begin() + i);
+	p->sep_erase(i);
+	if (!p->kids.empty()) {
+		Rebalance(p);
+		return;
+	}
+	if (p == m_tree->root) {
+		m_tree->root = new kt_leaf;
+		delete p;
+		return;
+	}
+	RemoveChild(p->parent, p);
+	delete p;
+}
+
+/*
+ * Merges an underfull node into a neighbour when both fit in one node, and
+ * removes the levels above the root that have a single child.
+ */
+void ECKeyTable::Rebalance(kt_node *n)
+{
+	if (n == m_tree->root) {
+		while (!m_tree->root->leaf && static_cast<kt_inner *>(m_tree->root)->kids.size() == 1) {
+			auto old = static_cast<kt_inner *>(m_tree->root);
+			m_tree->root = old->kids[0];
+			m_tree->root->parent = nullptr;
+			delete old;
+		}
+		return;
+	}
+	auto size = [](const kt_node *x) {
+		return x->leaf ? static_cast<const kt_leaf *>(x)->size() :
+		       static_cast<const kt_inner *>(x)->kids.size();
+	};
+	auto max = n->leaf ? KT_LEAF_MAX : KT_INNER_MAX;
+	if (size(n) >= max / 4)
+		return;
+	auto p = n->parent;
+	auto i = p->index(n);
+	kt_node *l = n, *r = nullptr;
+	if (i > 0)
+		l = p->kids[i-1], r = n;
+	else if (p->kids.size() > 1)
+		r = p->kids[1];
+	if (r == nullptr || size(l) + size(r) > max)
+		return;
+
+	if (n->leaf) {
+		auto ll = static_cast<kt_leaf *>(l), rl = static_cast<kt_leaf *>(r);
+		std::vector<std::string> lk, rk;
+		ll->keys(lk);
+		rl->keys(rk);
+		std::move(rk.begin(), rk.end(), std::back_inserter(lk));
+		auto e = std::move(ll->ent);
+		e.insert(e.end(), rl->ent.cbegin(), rl->ent.cend());
+		ll->assign(std::move(e), lk);
+		for (const auto &x : rl->ent)
+			m_tree->rows[x.key] = ll;
+		ll->next = rl->next;
+		if (ll->next != nullptr)
+			ll->next->prev = ll;
 	} else {
-		// We have two child nodes ..
-		ECTableRow *lpPredecessor = lpRow->lpLeft, *lpPredecessorParent = nullptr;
+		auto li = static_cast<kt_inner *>(l), ri = static_cast<kt_inner *>(r);
+		li->sep_insert(li->kids.size(), p->sepstr(p->index(r)));
+		for (size_t j = 0; j < ri->kids.size(); ++j) {
+			ri->kids[j]->parent = li;
+			li->kids.emplace_back(ri->kids[j]);
+			if (j > 0)
+				li->sep_insert(li->kids.size() - 1, ri->sepstr(j));
+		}
+		ri->kids.clear();
+	}
+	l->visible += r->visible;
+	RemoveChild(p, r);
+	if (r->leaf)
+		delete static_cast<kt_leaf *>(r);
+	else
+		delete static_cast<kt_inner *>(r);
+}
 
-		while (lpPredecessor->lpRight)
-			lpPredecessor = lpPredecessor->lpRight;
+ECKeyTable::kt_iter ECKeyTable::LocateId(const sObjectTableKey &k) const
+{
+	kt_iter it;
+	auto i = m_tree->rows.find(k);
+	if (i == m_tree->rows.cend())
+		return it;
+	auto lf = i->second;
+	for (unsigned int j = 0; j < lf->size(); ++j)
+		if (lf->ent[j].key == k) {
+			it.lf = lf;
+			it.i = j;
+			it.where = sKeyTablePos::ON_ROW;
+			break;
+		}
+	assert(it.lf != nullptr);
+	return it;
+}
 
-		// Remove the predecessor from the tree, optionally moving the left tree into place
-		if (lpPredecessor->fLeft)
-			lpPredecessor->lpParent->lpLeft = lpPredecessor->lpLeft;
-		else
-			lpPredecessor->lpParent->lpRight = lpPredecessor->lpLeft;
+ECKeyTable::kt_iter ECKeyTable::Locate(const sKeyTablePos &pos) const
+{
+	if (pos.ulWhere == sKeyTablePos::ON_ROW) {
+		auto it = LocateId(pos.sKey);
+		if (it.lf != nullptr)
+			return it;
+	}
+	kt_iter it;
+	it.where = pos.ulWhere == sKeyTablePos::BEFORE_FIRST ?
+	           sKeyTablePos::BEFORE_FIRST : sKeyTablePos::AFTER_LAST;
+	return it;
+}
+
+sKeyTablePos ECKeyTable::Store(const kt_iter &it)
+{
+	sKeyTablePos pos;
+	pos.ulWhere = it.where;
+	if (it.where == sKeyTablePos::ON_ROW)
+		pos.sKey = it.lf->ent[it.i].key;
+	return pos;
+}
 
-		if (lpPredecessor->lpLeft) {
-			lpPredecessor->lpLeft->lpParent = lpPredecessor->lpParent;
-			lpPredecessor->lpLeft->fLeft = lpPredecessor->fLeft;
+// Finds the unhidden row with row number @row
+ECKeyTable::kt_iter ECKeyTable::SeekVisible(unsigned int row) const
+{
+	kt_iter it;
+	if (m_tree->root->visible == 0)
+		return it; /* before front in empty table */
+	if (row >= m_tree->root->visible) {
+		it.where = sKeyTablePos::AFTER_LAST;
+		return it;
+	}
+	auto n = m_tree->root;
+	while (!n->leaf)
+		for (auto k : static_cast<kt_inner *>(n)->kids) {
+			if (row < k->visible) {
+				n = k;
+				break;
+			}
+			row -= k->visible;
 		}
+	auto lf = static_cast<kt_leaf *>(n);
+	for (unsigned int i = 0; i < lf->size(); ++i) {
+		if (lf->ent[i].hidden)
+			continue;
+		if (row-- > 0)
+			continue;
+		it.lf = lf;
+		it.i = i;
+		it.where = sKeyTablePos::ON_ROW;
+		break;
+	}
+	assert(it.lf != nullptr);
+	return it;
+}
 
-		// Remember the predecessor parent for later use
-		lpPredecessorParent = lpPredecessor->lpParent;
+// Number of unhidden rows before the row at @it
+unsigned int ECKeyTable::Rank(const kt_iter &it) const
+{
+	unsigned int row = 0;
+	for (unsigned int i = 0; i < it.i; ++i)
+		if (!it.lf->ent[i].hidden)
+			++row;
+	const kt_node *n = it.lf;
+	for (auto p = n->parent; p != nullptr; n = p, p = p->parent)
+		for (auto k : p->kids) {
+			if (k == n)
+				break;
+			row += k->visible;
+		}
+	return row;
+}
 
-		// Replace the row to be deleted with the predecessor
-		if (lpRow->fLeft)
-			lpRow->lpParent->lpLeft = lpPredecessor;
-		else
-			lpRow->lpParent->lpRight = lpPredecessor;
-
-		lpPredecessor->lpParent = lpRow->lpParent;
-		lpPredecessor->fLeft = lpRow->fLeft;
-		lpPredecessor->lpLeft = lpRow->lpLeft;
-		lpPredecessor->lpRight = lpRow->lpRight;
-		if (lpPredecessor->lpLeft)
-			lpPredecessor->lpLeft->lpParent = lpPredecessor;
-		if (lpPredecessor->lpRight)
-			lpPredecessor->lpRight->lpParent = lpPredecessor;
-
-		// Do a recursive update of the counts in the branch of the predecessorparent, (where we removed the predecessor)
-		UpdateCounts(lpPredecessorParent);
-		// Do a recursive update of the counts in the branch we moved to predecessor to
-		UpdateCounts(lpPredecessor);
-		// Restructure
-		RestructureRecursive(lpPredecessor);
-		if (lpPredecessorParent->sKey != *lpsRowItem)
-			RestructureRecursive(lpPredecessorParent);
+void ECKeyTable::SetHidden(const kt_iter &it, bool hidden)
+{
+	auto &e = it.lf->ent[it.i];
+	if (e.hidden == hidden)
+		return;
+	e.hidden = hidden;
+	AddVisible(it.lf, hidden ? -1 : 1);
+}
+
+void ECKeyTable::Next(kt_iter &it) const
+{
+	if (it.where == sKeyTablePos::AFTER_LAST)
+		return; // Already at end
+	if (it.where == sKeyTablePos::ON_ROW) {
+		if (++it.i < it.lf->size())
+			return;
+		it.lf = it.lf->next;
+		it.i = 0;
+	} else {
+		auto n = m_tree->root;
+		while (!n->leaf)
+			n = static_cast<kt_inner *>(n)->kids.front();
+		it.lf = static_cast<kt_leaf *>(n);
+		it.i = 0;
 	}
+	if (it.lf != nullptr && it.lf->size() > 0) {
+		it.where = sKeyTablePos::ON_ROW;
+		return;
+	}
+	it.lf = nullptr;
+	it.where = sKeyTablePos::AFTER_LAST;
+}
 
-	// Move cursor to next node (or previous if this was the last row)
-	if (lpCurrent == lpRow) {
-		SeekRow(EC_SEEK_CUR, -1, nullptr);
-		SeekRow(EC_SEEK_CUR, 1, nullptr);
+void ECKeyTable::Prev(kt_iter &it) const
+{
+	if (it.where == sKeyTablePos::BEFORE_FIRST)
+		return;
+	if (it.where == sKeyTablePos::ON_ROW) {
+		if (it.i-- > 0)
+			return;
+		it.lf = it.lf->prev;
+	} else {
+		auto n = m_tree->root;
+		while (!n->leaf)
+			n = static_cast<kt_inner *>(n)->kids.back();
+		it.lf = static_cast<kt_leaf *>(n);
 	}
+	if (it.lf != nullptr && it.lf->size() > 0) {
+		it.i = it.lf->size() - 1;
+		it.where = sKeyTablePos::ON_ROW;
+		return;
+	}
+	it.lf = nullptr;
+	it.i = 0;
+	it.where = sKeyTablePos::BEFORE_FIRST;
+}
+
+ECRESULT ECKeyTable::UpdateRow_Delete(const sObjectTableKey *lpsRowItem,
+    std::vector<ECSortCol> &&dat, sObjectTableKey *lpsPrevRow, bool fHidden,
+    UpdateType *lpulAction)
+{
+	kt_lock biglock(*this);
+	CopyOnWrite();
 
-	// Delete this uncoupled node
-	InvalidateBookmark(lpRow); //ignore errors
-	delete lpRow;
+	// Find the row by ID
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf == nullptr)
+		return KCERR_NOT_FOUND;
+	/* The cursors on the row, of all tables showing it */
+	std::vector<ECKeyTable *> cursors;
+	for (auto t : m_tree->users)
+		if (t->m_current.ulWhere == sKeyTablePos::ON_ROW && t->m_current.sKey == *lpsRowItem)
+			cursors.emplace_back(t);
+	auto ulCursorRow = cursors.empty() ? 0 : Rank(it);
+	auto lf = it.lf;
+
+	if (!lf->ent[it.i].hidden)
+		AddVisible(lf, -1);
+	lf->erase(it.i);
 	// Remove the row from the id map
-	mapRow.erase(*lpsRowItem);
+	m_tree->rows.erase(*lpsRowItem);
+	if (lf->size() == 0 && lf != m_tree->root) {
+		if (lf->prev != nullptr)
+			lf->prev->next = lf->next;
+		if (lf->next != nullptr)
+			lf->next->prev = lf->prev;
+		RemoveChild(lf->parent, lf);
+		delete lf;
+	} else {
+		Rebalance(lf);
+	}
+
+	for (auto t : m_tree->users)
+		t->InvalidateBookmark(*lpsRowItem); //ignore errors
+	// Move cursor to the row that now has the same row number
+	for (auto t : cursors)
+		t->m_current = Store(SeekVisible(ulCursorRow));
 	if (lpulAction)
 		*lpulAction = TABLE_ROW_DELETE;
 	return erSuccess;
@@ -337,126 +1052,68 @@ ECRESULT ECKeyTable::UpdateRow_Modify(const sObjectTableKey *lpsRowItem,
     std::vector<ECSortCol> &&dat, sObjectTableKey *lpsPrevRow, bool fHidden,
     UpdateType *lpulAction)
 {
-	ECTableRow *lpNewRow = nullptr;
-	unsigned int fLeft = 0;
-	bool fRelocateCursor = false;
-	scoped_rlock biglock(mLock);
+	std::vector<ECKeyTable *> relocate;
+	std::string key, cur;
+	kt_lock biglock(*this);
+	CopyOnWrite();
 
-	auto lpRow = lpRoot;
+	kt_encode(dat, key);
 	// Find the row by id (see if we already have the row)
-	auto iterMap = mapRow.find(*lpsRowItem);
-	if (iterMap != mapRow.cend()) {
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf != nullptr) {
 		// Found the row
 		// Indicate that we are modifying an existing row
 		if (lpulAction)
 			*lpulAction = TABLE_ROW_MODIFY;
-		// Create a new node
-		lpNewRow = new ECTableRow(*lpsRowItem, std::move(dat), fHidden);
-		if (iterMap->second == lpCurrent)
-		    fRelocateCursor = true;
-
 		// If the exact same row is already in here, just look up the predecessor
-		if (!ECTableRow::rowcompare(iterMap->second, lpNewRow) &&
-		    !ECTableRow::rowcompare(lpNewRow, iterMap->second)) {
-			// Find the predecessor
+		it.lf->key(it.i, cur);
+		if (!kt_less(cur, key) && !kt_less(key, cur)) {
 			if (lpsPrevRow) {
-				ECTableRow *lpPredecessor = NULL;
-
-				if (iterMap->second->lpLeft) {
-					lpPredecessor = iterMap->second->lpLeft;
-					while (lpPredecessor && lpPredecessor->lpRight)
-						lpPredecessor = lpPredecessor->lpRight;
-				} else {
-					lpPredecessor = iterMap->second;
-					while (lpPredecessor && lpPredecessor->fLeft)
-						lpPredecessor = lpPredecessor->lpParent;
-					if (lpPredecessor && lpPredecessor->lpParent)
-						lpPredecessor = lpPredecessor->lpParent;
-					else
-						lpPredecessor = NULL;
-				}
-				if (lpPredecessor) {
-					*lpsPrevRow = lpPredecessor->sKey;
-				} else {
-					lpsPrevRow->ulObjId = 0;
-					lpsPrevRow->ulOrderId = 0;
-				}
+				Prev(it);
+				*lpsPrevRow = it.where == sKeyTablePos::ON_ROW ?
+				              it.lf->ent[it.i].key : sObjectTableKey(0, 0);
 			}
-
-			// Delete the unused new node
-			delete lpNewRow;
 			return erSuccess;
 		}
+		for (auto t : m_tree->users)
+			if (t->m_current.ulWhere == sKeyTablePos::ON_ROW && t->m_current.sKey == *lpsRowItem)
+				relocate.emplace_back(t);
 		// new row data is different, so delete the old row now
-		auto er = UpdateRow(TABLE_ROW_DELETE, lpsRowItem, {}, nullptr);
-		if (er != erSuccess) {
-			// Delete the unused new node
-			delete lpNewRow;
+		auto er = UpdateRow_Delete(lpsRowItem, {}, nullptr);
+		if (er != erSuccess)
 			return er;
-		}
 		// Indicate that we are adding a new row
 	} else if (lpulAction != nullptr) {
 		*lpulAction = TABLE_ROW_ADD;
 	}
 
-	// Create the row that we will be inserting
-	if (lpNewRow == NULL)
-		lpNewRow = new ECTableRow(*lpsRowItem, std::move(dat), fHidden);
-
-	// Do a binary search in the tree
-	while (1) {
-		if (ECTableRow::rowcompare(lpNewRow, lpRow)) {
-			if (lpRow->lpLeft == NULL) {
-				fLeft = 1;
-				break;
-			}
-			lpRow = lpRow->lpLeft;
-			continue;
-		}
-		if (lpRow->lpRight == NULL) {
-			fLeft = 0;
-			break;
-		}
-		lpRow = lpRow->lpRight;
-	}
-
-	// lpRow now points to our parent, fLeft is whether we're the new left or right node of this parent
+	// Find the position after all rows that sort before or equal to the new one
+	auto lf = FindLeaf(key, false);
+	auto pos = lf->bound(key, false, cur);
 	// Get the predecessor ID
 	if (lpsPrevRow) {
-		if (fLeft) {
-			// Our predecessor is the parent of our rightmost parent
-			ECTableRow *lpPredecessor = lpRow;
-			while (lpPredecessor && lpPredecessor->fLeft)
-				lpPredecessor = lpPredecessor->lpParent;
-
-			if (lpPredecessor == NULL || lpPredecessor->lpParent == NULL) {
-				lpsPrevRow->ulObjId = 0;
-				lpsPrevRow->ulOrderId = 0;
-			} else
-				*lpsPrevRow = lpPredecessor->lpParent->sKey;
-		} else {
-			// Our predecessor is simply our parent
-			*lpsPrevRow = lpRow->sKey;
-		}
+		if (pos > 0)
+			*lpsPrevRow = lf->ent[pos-1].key;
+		else if (lf->prev != nullptr)
+			*lpsPrevRow = lf->prev->ent.back().key;
+		else
+			*lpsPrevRow = sObjectTableKey(0, 0);
 	}
 
-	// Link the row into the table
-	if (fLeft)
-		lpRow->lpLeft = lpNewRow;
-	else
-		lpRow->lpRight = lpNewRow;
-
-	lpNewRow->lpParent = lpRow;
-	lpNewRow->fLeft = fLeft;
-
-	// Add it in the id map
-	mapRow[*lpsRowItem] = lpNewRow;
-	// Do a recursive update of the counts in the branch
-	UpdateCounts(lpNewRow);
-	RestructureRecursive(lpNewRow);
-	// Reposition the cursor if it used to be on the old row
-	if (fRelocateCursor)
-		lpCurrent = lpNewRow;
+	kt_entry e;
+	e.key = *lpsRowItem;
+	e.hidden = fHidden;
+	lf->insert(pos, e, key);
+	m_tree->rows[*lpsRowItem] = lf;
+	if (!fHidden)
+		AddVisible(lf, 1);
+	if (lf->size() > KT_LEAF_MAX)
+		SplitLeaf(lf);
+	// Reposition the cursors that used to be on the old row
+	for (auto t : relocate) {
+		t->m_current.ulWhere = sKeyTablePos::ON_ROW;
+		t->m_current.sKey = *lpsRowItem;
+	}
 	return erSuccess;
 }
 
@@ -483,33 +1140,9 @@ ECRESULT ECKeyTable::UpdateRow(UpdateType ulType,
 ECRESULT ECKeyTable::Clear()
 {
 	scoped_rlock biglock(mLock);
-	ECTableRow *lpRow = lpRoot, *lpParent = nullptr;
-
-	/* Depth-first deletion of all nodes (excluding root) */
-	while(lpRow) {
-		if(lpRow->lpLeft)
-			lpRow = lpRow->lpLeft;
-		else if(lpRow->lpRight)
-			lpRow = lpRow->lpRight;
-		else if(lpRow == lpRoot)
-			break;
-		else {
-			// remember parent node
-			lpParent = lpRow->lpParent;
-			// decouple from parent
-			if(lpRow->fLeft)
-				lpParent->lpLeft = NULL;
-			else
-				lpParent->lpRight = NULL;
-			// delete this node
-			delete lpRow;
-			// continue with parent
-			lpRow = lpParent;
-		}
-	}
-	lpCurrent = lpRoot;
-	lpRoot->ulBranchCount = 0;
-	mapRow.clear();
+	Detach();
+	Attach(std::make_shared<kt_tree>());
+	m_current = sKeyTablePos();
 	// Remove all bookmarks
 	m_mapBookmarks.clear();
 	return erSuccess;
@@ -517,23 +1150,23 @@ ECRESULT ECKeyTable::Clear()
 
 ECRESULT ECKeyTable::SeekId(const sObjectTableKey *lpsRowItem)
 {
-	scoped_rlock biglock(mLock);
-	auto iterMap = mapRow.find(*lpsRowItem);
-	if (iterMap == mapRow.cend())
+	kt_lock biglock(*this);
+	if (m_tree->rows.find(*lpsRowItem) == m_tree->rows.cend())
 		return KCERR_NOT_FOUND;
-	lpCurrent = iterMap->second;
+	m_current.ulWhere = sKeyTablePos::ON_ROW;
+	m_current.sKey = *lpsRowItem;
 	return erSuccess;
 }
 
 ECRESULT ECKeyTable::GetBookmark(unsigned int ulbkPosition, int* lpbkPosition)
 {
 	unsigned int ulCurrPosition = 0;
-	scoped_rlock biglock(mLock);
+	kt_lock biglock(*this);
 
 	auto iPosition = m_mapBookmarks.find(ulbkPosition);
 	if (iPosition == m_mapBookmarks.cend())
 		return KCERR_INVALID_BOOKMARK;
-	auto er = CurrentRow(iPosition->second.lpPosition, &ulCurrPosition);
+	auto er = CurrentRow(iPosition->second.sPosition, &ulCurrPosition);
 	if (er != erSuccess)
 		return er;
 	if (iPosition->second.ulFirstRowPosition != ulCurrPosition)
@@ -546,12 +1179,12 @@ ECRESULT ECKeyTable::CreateBookmark(unsigned int* lpulbkPosition)
 {
 	sBookmarkPosition	sbkPosition;
 	unsigned int ulbkPosition = 0, ulRowCount = 0;
-	scoped_rlock biglock(mLock);
+	kt_lock biglock(*this);
 
 	// Limit of bookmarks
 	if (m_mapBookmarks.size() >= BOOKMARK_LIMIT)
 		return KCERR_UNABLE_TO_COMPLETE;
-	sbkPosition.lpPosition = lpCurrent;
+	sbkPosition.sPosition = m_current;
 	auto er = GetRowCount(&ulRowCount, &sbkPosition.ulFirstRowPosition);
 	if (er != erSuccess)
 		return er;
@@ -565,7 +1198,7 @@ ECRESULT ECKeyTable::CreateBookmark(unsigned int* lpulbkPosition)
 
 ECRESULT ECKeyTable::FreeBookmark(unsigned int ulbkPosition)
 {
-	scoped_rlock biglock(mLock);
+	kt_lock biglock(*this);
 	auto iPosition = m_mapBookmarks.find(ulbkPosition);
 	if (iPosition == m_mapBookmarks.cend())
 		return KCERR_INVALID_BOOKMARK;
@@ -574,13 +1207,14 @@ ECRESULT ECKeyTable::FreeBookmark(unsigned int ulbkPosition)
 }
 
 // Intern function, no locking
-ECRESULT ECKeyTable::InvalidateBookmark(ECTableRow *lpRow)
+ECRESULT ECKeyTable::InvalidateBookmark(const sObjectTableKey &row)
 {
 	// Nothing todo
 	if (m_mapBookmarks.empty())
 		return erSuccess;
 	for (auto iPosition = m_mapBookmarks.begin(); iPosition != m_mapBookmarks.end(); ) {
-		if (lpRow != iPosition->second.lpPosition)
+		const auto &pos = iPosition->second.sPosition;
+		if (pos.ulWhere != sKeyTablePos::ON_ROW || pos.sKey != row)
 			++iPosition;
 		else
 			iPosition = m_mapBookmarks.erase(iPosition);
@@ -592,8 +1226,7 @@ ECRESULT ECKeyTable::SeekRow(unsigned int lbkOrgin, int lSeekTo, int *lplRowsSou
 {
 	int lDestRow = 0;
 	unsigned int ulCurrentRow = 0, ulRowCount = 0;
-	ECTableRow *lpRow = NULL;
-	scoped_rlock biglock(mLock);
+	kt_lock biglock(*this);
 
 	auto er = GetRowCount(&ulRowCount, &ulCurrentRow);
 	if(er != erSuccess)
@@ -641,80 +1274,32 @@ ECRESULT ECKeyTable::SeekRow(unsigned int lbkOrgin, int lSeekTo, int *lplRowsSou
 			break;
 		}
 	}
-
-	if(ulRowCount == 0) {
-		lpCurrent = lpRoot; // before front in empty table
-		return er;
-	}
-
-	lpRow = lpRoot->lpRight;
-	while(1) {
-		if((!lpRow->lpLeft && lDestRow == 0) || (lpRow->lpLeft && lpRow->lpLeft->ulBranchCount == (ULONG)lDestRow))
-			break; // found the row!
-		if(lpRow->lpLeft == NULL && lpRow->lpRight == NULL) {
-			lpRow = NULL;
-			break;
-		}
-		else if(lpRow->lpLeft && lpRow->lpRight == NULL) {
-			// Follow the left branche
-			lpRow = lpRow->lpLeft;
-			continue;
-		}
-		else if(lpRow->lpLeft == NULL && lpRow->lpRight) {
-			// Follow the right branche
-			lDestRow -= lpRow->fHidden ? 0 : 1;
-			lpRow = lpRow->lpRight;
-			continue;
-		}
-		// There is both a left and a right branch ...
-		if (lpRow->lpLeft->ulBranchCount < (ULONG)lDestRow) {
-			// ... in which our row doesn't exist, so go to the right branch
-			lDestRow -= lpRow->lpLeft->ulBranchCount + (lpRow->fHidden ? 0 : 1);
-			lpRow = lpRow->lpRight;
-		} else {
-			// ... in which we should be looking
-			lpRow = lpRow->lpLeft;
-		}
-	}
-
-	lpCurrent = lpRow; // may be NULL (after end of table)
+	m_current = Store(SeekVisible(lDestRow));
 	return er;
 }
 
 ECRESULT ECKeyTable::GetRowCount(unsigned int *lpulRowCount, unsigned int *lpulCurrentRow)
 {
-	scoped_rlock biglock(mLock);
-	auto er = CurrentRow(lpCurrent, lpulCurrentRow);
+	kt_lock biglock(*this);
+	auto er = CurrentRow(m_current, lpulCurrentRow);
 	if (er != erSuccess)
 		return er;
-	*lpulRowCount = lpRoot->ulBranchCount;
+	*lpulRowCount = m_tree->root->visible;
 	return erSuccess;
 }
 
 // Intern function, no locking
-ECRESULT ECKeyTable::CurrentRow(ECTableRow *lpRow, unsigned int *lpulCurrentRow)
+ECRESULT ECKeyTable::CurrentRow(const sKeyTablePos &pos, unsigned int *lpulCurrentRow)
 {
-	unsigned int ulCurrentRow = 0;
-
 	if (lpulCurrentRow == NULL)
 		return KCERR_INVALID_PARAMETER;
-	if(lpRow == NULL) {
-		*lpulCurrentRow = lpRoot->ulBranchCount;
-		return erSuccess;
-	}
-	if(lpRow == lpRoot) {
+	auto it = Locate(pos);
+	if (it.where == sKeyTablePos::BEFORE_FIRST)
 		*lpulCurrentRow = 0;
-		return erSuccess;
-	}
-	if (lpRow->lpLeft)
-		ulCurrentRow += lpRow->lpLeft->ulBranchCount;
-
-	while (lpRow && lpRow->lpParent != NULL && lpRow->lpParent != lpRoot) {
-		if (!lpRow->fLeft)
-			ulCurrentRow += lpRow->lpParent->ulBranchCount - lpRow->ulBranchCount;
-		lpRow = lpRow->lpParent;
-	}
-	*lpulCurrentRow = ulCurrentRow;
+	else if (it.where == sKeyTablePos::AFTER_LAST)
+		*lpulCurrentRow = m_tree->root->visible;
+	else
+		*lpulCurrentRow = Rank(it);
 	return erSuccess;
 }
 
@@ -726,212 +1311,50 @@ ECRESULT ECKeyTable::CurrentRow(ECTableRow *lpRow, unsigned int *lpulCurrentRow)
  */
 ECRESULT ECKeyTable::QueryRows(unsigned int ulRows, ECObjectTableList* lpRowList, bool bDirBackward, unsigned int ulFlags, bool bShowHidden)
 {
-	scoped_rlock biglock(mLock);
-	auto lpOrig = lpCurrent;
+	kt_lock biglock(*this);
+	auto sOrig = m_current;
 
-	if (bDirBackward && lpCurrent == nullptr)
+	if (bDirBackward && m_current.ulWhere == sKeyTablePos::AFTER_LAST)
 		SeekRow(EC_SEEK_CUR, -1, NULL);
-	else if (lpCurrent == lpRoot && lpRoot->ulBranchCount != 0)
+	else if (m_current.ulWhere == sKeyTablePos::BEFORE_FIRST && m_tree->root->visible != 0)
 		// Go to actual first row if still pre-first row
 		SeekRow(EC_SEEK_SET, 0 , NULL);
 
 	// Cap to max. table length. (probably smaller due to cursor position not at start)
-	ulRows = std::min(ulRows, lpRoot->ulBranchCount);
-
-	while(ulRows && lpCurrent) {
-		if(!lpCurrent->fHidden || bShowHidden) {
-			lpRowList->emplace_back(lpCurrent->sKey);
-		--ulRows;
-        }
-		if (bDirBackward && lpCurrent == lpRoot->lpRight)
-			break;
+	ulRows = std::min(ulRows, m_tree->root->visible);
+
+	auto it = Locate(m_current);
+	while (ulRows && it.where == sKeyTablePos::ON_ROW) {
+		const auto &e = it.lf->ent[it.i];
+		if (!e.hidden || bShowHidden) {
+			lpRowList->emplace_back(e.key);
+			--ulRows;
+		}
 		if (bDirBackward)
-		    Prev();
+			Prev(it);
 		else /* Go to next row */
-		    Next();
+			Next(it);
 	}
 
-	if(ulFlags & EC_TABLE_NOADVANCE)
-		lpCurrent = lpOrig;
+	m_current = ulFlags & EC_TABLE_NOADVANCE ? sOrig : Store(it);
 	return erSuccess;
 }
 
-void ECKeyTable::Next()
-{
-    if(lpCurrent == NULL)
-        return; // Already at end
-
-    if(lpCurrent->lpRight) {
-        lpCurrent = lpCurrent->lpRight;
-        // go to leftmost node in right tree
-        while(lpCurrent->lpLeft)
-            lpCurrent = lpCurrent->lpLeft;
-        return;
-    }
-        // Find node to top right from here
-	while (lpCurrent && !lpCurrent->fLeft)
-		lpCurrent = lpCurrent->lpParent;
-	if (lpCurrent)
-		lpCurrent = lpCurrent->lpParent;
-}
-
-void ECKeyTable::Prev()
-{
-    if(lpCurrent == NULL) {
-        // Past end, seek back one row
-        SeekRow(EC_SEEK_END, -1, NULL);
-		return;
-    } else if(lpCurrent->lpLeft) {
-            lpCurrent = lpCurrent->lpLeft;
-            // Go to rightmost node in left tree
-            while(lpCurrent->lpRight)
-			lpCurrent = lpCurrent->lpRight;
-		return;
-	}
-	// Find node to top left from here
-	while (lpCurrent && lpCurrent->fLeft)
-		lpCurrent = lpCurrent->lpParent;
-	if (lpCurrent)
-		lpCurrent = lpCurrent->lpParent;
-}
-
 ECRESULT ECKeyTable::GetPreviousRow(const sObjectTableKey *lpsRowItem, sObjectTableKey *lpsPrev)
 {
-	scoped_rlock biglock(mLock);
-	auto lpPos = lpCurrent;
-	auto er = SeekId(lpsRowItem);
-    if(er != erSuccess)
-		return er;
-
-    Prev();
-    while (lpCurrent && lpCurrent->fHidden)
-        Prev();
-    if (lpCurrent != nullptr)
-        *lpsPrev = lpCurrent->sKey;
-    else
-        er = KCERR_NOT_FOUND;
-    // Go back to the previous cursor position
-    lpCurrent = lpPos;
-    return er;
-}
-
-// Do a Left rotation around lpPivot
-void ECKeyTable::RotateL(ECTableRow *lpPivot)
-{
-	ECTableRow *lpLeft = lpPivot->lpLeft;
-
-	// First, move left leg into position of pivot
-	lpLeft->lpParent = lpPivot->lpParent;
-	lpLeft->fLeft = lpPivot->fLeft;
-	if(lpPivot->fLeft)
-		lpPivot->lpParent->lpLeft = lpLeft;
-	else
-		lpPivot->lpParent->lpRight = lpLeft;
-
-	// Pivot is now an orphan, with only a right leg
-	// Now, move right leg of left leg to left leg of pivot
-	lpPivot->lpLeft = lpLeft->lpRight;
-	if(lpLeft->lpRight) {
-		lpLeft->lpRight->fLeft = true;
-		lpLeft->lpRight->lpParent = lpPivot;
-	}
-
-	// Now, pivot is orphan with left and right leg, and left leg has no right leg
-	// Connect pivot as right leg
-	lpLeft->lpRight = lpPivot;
-	lpPivot->lpParent = lpLeft;
-	lpPivot->fLeft = false;
-	UpdateCounts(lpPivot);
-	UpdateCounts(lpLeft);
-}
-
-// Do a Right rotation around lpPivot
-void ECKeyTable::RotateR(ECTableRow *lpPivot)
-{
-	ECTableRow *lpRight = lpPivot->lpRight;
-
-	// First, move right leg into position of pivot
-	lpRight->lpParent = lpPivot->lpParent;
-	lpRight->fLeft = lpPivot->fLeft;
-	if(lpPivot->fLeft)
-		lpPivot->lpParent->lpLeft = lpRight;
+	kt_lock biglock(*this);
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf == nullptr)
+		return KCERR_NOT_FOUND;
+	do
+		Prev(it);
+	while (it.where == sKeyTablePos::ON_ROW && it.lf->ent[it.i].hidden);
+	/* The first row has the (0,0) table head as its predecessor */
+	if (it.where != sKeyTablePos::ON_ROW)
+		*lpsPrev = sObjectTableKey(0, 0);
 	else
-		lpPivot->lpParent->lpRight = lpRight;
-
-	// Pivot is now an orphan, with only a left leg
-	// Now, move left leg of right leg to right leg of pivot
-	lpPivot->lpRight = lpRight->lpLeft;
-	if(lpRight->lpLeft) {
-		lpRight->lpLeft->fLeft = false;
-		lpRight->lpLeft->lpParent = lpPivot;
-	}
-
-	// Now, pivot is orphan with left and right leg, and right leg has no left leg
-	// Connect pivot as left leg
-	lpRight->lpLeft = lpPivot;
-	lpPivot->lpParent = lpRight;
-	lpPivot->fLeft = true;
-	UpdateCounts(lpPivot);
-	UpdateCounts(lpRight);
-}
-
-void ECKeyTable::RotateLR(ECTableRow *lpPivot)
-{
-	ECTableRow *lpParent = lpPivot->lpParent;
-	RotateR(lpPivot);
-	RotateL(lpParent);
-}
-
-void ECKeyTable::RotateRL(ECTableRow *lpPivot)
-{
-	ECTableRow *lpParent = lpPivot->lpParent;
-	RotateL(lpPivot);
-	RotateR(lpParent);
-}
-
-int ECKeyTable::GetBalance(ECTableRow *lpPivot)
-{
-	int balance = 0;
-
-	if (lpPivot == nullptr)
-		return 0;
-	if(lpPivot->lpLeft)
-		balance += lpPivot->lpLeft->ulHeight;
-	if(lpPivot->lpRight)
-		balance -= lpPivot->lpRight->ulHeight;
-	return balance;
-}
-
-void ECKeyTable::Restructure(ECTableRow *lpPivot)
-{
-	auto balance = GetBalance(lpPivot);
-	if(balance > 1) {
-		// Unbalanced (too much on the left)
-		balance = GetBalance(lpPivot->lpLeft);
-		if (balance >= 0)
-			// Subtree unbalanced in same direction
-			RotateL(lpPivot);
-		else
-			// Subtree unbalanced in the other direction
-			RotateLR(lpPivot->lpLeft);
-	} else if(balance < -1) {
-		// Unbalanced (too much on the right)
-		balance = GetBalance(lpPivot->lpRight);
-		if (balance <= 0)
-			// Subtree unbalanced in the same direction
-			RotateR(lpPivot);
-		else
-			// Subtree unbalanced in the other direction
-			RotateRL(lpPivot->lpRight);
-	}
-}
-
-void ECKeyTable::RestructureRecursive(ECTableRow *lpRow)
-{
-	while(lpRow != lpRoot && lpRow != NULL) {
-		Restructure(lpRow);
-		lpRow = lpRow->lpParent;
-	}
+		*lpsPrev = it.lf->ent[it.i].key;
+	return erSuccess;
 }
 
 /**
@@ -942,147 +1365,151 @@ void ECKeyTable::RestructureRecursive(ECTableRow *lpRow)
  */
 ECRESULT ECKeyTable::GetRowsBySortPrefix(sObjectTableKey *lpsRowItem, ECObjectTableList *lpRowList)
 {
-	scoped_rlock biglock(mLock);
-	auto lpCursor = lpCurrent;
-	auto er = SeekId(lpsRowItem);
-	if(er != erSuccess)
-		return er;
-	const auto &dat = lpCurrent->m_cols;
-    while(lpCurrent) {
-        // Stop when lpCurrent > prefix, so prefix < lpCurrent
-		if (ECTableRow::rowcompareprefix(dat.size(), dat, lpCurrent->m_cols))
-            break;
-		lpRowList->emplace_back(lpCurrent->sKey);
-        Next();
-    }
-
-    lpCurrent = lpCursor;
+	std::string prefix, cur;
+	kt_lock biglock(*this);
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf == nullptr)
+		return KCERR_NOT_FOUND;
+	it.lf->key(it.i, prefix);
+	auto ulCols = kt_columns(prefix);
+	for (; it.where == sKeyTablePos::ON_ROW; Next(it)) {
+		// Stop when current > prefix, so prefix < current
+		it.lf->key(it.i, cur);
+		if (kt_less(prefix, cur, false, ulCols))
+			break;
+		lpRowList->emplace_back(it.lf->ent[it.i].key);
+	}
 	return erSuccess;
 }
 
 ECRESULT ECKeyTable::HideRows(sObjectTableKey *lpsRowItem, ECObjectTableList *lpHiddenList)
 {
-    bool fCursorHidden = false;
-	scoped_rlock biglock(mLock);
-	auto lpCursor = lpCurrent;
-	auto er = SeekId(lpsRowItem);
-	if(er != erSuccess)
-		return er;
-	const auto &dat = lpCurrent->m_cols;
-    // Go to next row; we never hide the first row, as it is the header
-    Next();
-
-    while(lpCurrent) {
-        // Stop hiding when lpCurrent > prefix, so prefix < lpCurrent
-		if (ECTableRow::rowcompareprefix(dat.size(), dat, lpCurrent->m_cols))
-            break;
-		lpHiddenList->emplace_back(lpCurrent->sKey);
-        lpCurrent->fHidden = true;
-        UpdateCounts(lpCurrent); // FIXME SLOW
-        if(lpCurrent == lpCursor)
-            fCursorHidden = true;
-        Next();
-    }
-
-    // If the row pointed to by the cursor was not touched, leave it there, otherwise, put the cursor on the next unhidden row
-    if(!fCursorHidden) {
-        lpCurrent = lpCursor;
-    } else {
-        while(lpCurrent && lpCurrent->fHidden)
-            Next();
-    }
+	bool fCursorHidden = false;
+	std::string prefix, cur;
+	kt_lock biglock(*this);
+	CopyOnWrite();
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf == nullptr)
+		return KCERR_NOT_FOUND;
+	it.lf->key(it.i, prefix);
+	auto ulCols = kt_columns(prefix);
+	// Go to next row; we never hide the first row, as it is the header
+	for (Next(it); it.where == sKeyTablePos::ON_ROW; Next(it)) {
+		// Stop hiding when current > prefix, so prefix < current
+		it.lf->key(it.i, cur);
+		if (kt_less(prefix, cur, false, ulCols))
+			break;
+		const auto &k = it.lf->ent[it.i].key;
+		lpHiddenList->emplace_back(k);
+		SetHidden(it, true);
+		if (m_current.ulWhere == sKeyTablePos::ON_ROW && m_current.sKey == k)
+			fCursorHidden = true;
+	}
+
+	// If the row pointed to by the cursor was not touched, leave it there, otherwise, put the cursor on the next unhidden row
+	if (fCursorHidden) {
+		while (it.where == sKeyTablePos::ON_ROW && it.lf->ent[it.i].hidden)
+			Next(it);
+		m_current = Store(it);
+	}
 	return erSuccess;
 }
 
-// @todo lpCurrent should stay pointing at the same row we started at?
+// @todo the cursor should stay pointing at the same row we started at?
 ECRESULT ECKeyTable::UnhideRows(sObjectTableKey *lpsRowItem, ECObjectTableList *lpUnhiddenList)
 {
-	scoped_rlock biglock(mLock);
-	auto er = SeekId(lpsRowItem);
-	if(er != erSuccess)
-		return er;
-	const auto &dat = lpCurrent->m_cols;
-	if (lpCurrent->fHidden)
+	std::string prefix, cur;
+	kt_lock biglock(*this);
+	CopyOnWrite();
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf == nullptr)
+		return KCERR_NOT_FOUND;
+	m_current = Store(it);
+	if (it.lf->ent[it.i].hidden)
 		/* You cannot expand a category whose header is hidden */
 		return KCERR_NOT_FOUND;
+	it.lf->key(it.i, prefix);
+	auto ulCols = kt_columns(prefix);
 
-    // Go to next row; we don't unhide the first row, as it is the header,
-    Next();
-    if(lpCurrent == NULL)
+	// Go to next row; we don't unhide the first row, as it is the header,
+	Next(it);
+	m_current = Store(it);
+	if (it.where != sKeyTablePos::ON_ROW)
 		return erSuccess; /* No more rows */
 
-	auto ulFirstCols = lpCurrent->m_cols.size();
-    while(lpCurrent) {
-        // Stop unhiding when lpCurrent > prefix, so prefix < lpCurrent
-		if (ECTableRow::rowcompareprefix(dat.size(), dat, lpCurrent->m_cols))
-            break;
-
-        // Only unhide items with the same amount of sort columns as the first row (ensures we only expand the first layer)
-		if (lpCurrent->m_cols.size() == ulFirstCols) {
-			lpUnhiddenList->emplace_back(lpCurrent->sKey);
-            lpCurrent->fHidden = false;
-            UpdateCounts(lpCurrent); // FIXME SLOW
-        }
-        Next();
-    }
+	it.lf->key(it.i, cur);
+	auto ulFirstCols = kt_columns(cur);
+	for (; it.where == sKeyTablePos::ON_ROW; Next(it)) {
+		// Stop unhiding when current > prefix, so prefix < current
+		it.lf->key(it.i, cur);
+		if (kt_less(prefix, cur, false, ulCols))
+			break;
+		// Only unhide items with the same amount of sort columns as the first row (ensures we only expand the first layer)
+		if (kt_columns(cur) == ulFirstCols) {
+			lpUnhiddenList->emplace_back(it.lf->ent[it.i].key);
+			SetHidden(it, false);
+		}
+	}
+	m_current = Store(it);
 	return erSuccess;
 }
 
 ECRESULT ECKeyTable::LowerBound(const std::vector<ECSortCol> &cols)
 {
-	scoped_rlock biglock(mLock);
+	std::string key, cur;
+	kt_lock biglock(*this);
 
 	// With B being the passed sort key, find the first item A, for which !(A < B), AKA B >= A
-	lpCurrent = lpRoot->lpRight;
-
-    // This is a standard binary search through the entire tree
-	while(lpCurrent) {
-		if (ECTableRow::rowcompare(lpCurrent->m_cols, cols)) {
-	        // Value we're looking for is right
-	        if(lpCurrent->lpRight == NULL) {
-                // Value is not equal, go to next value
-   	            Next();
-	            break;
-            } else {
-                lpCurrent = lpCurrent->lpRight;
-            }
-		} else if (lpCurrent->lpLeft == nullptr) {
-			// Value we're looking for is left
-			// Found it, if the value is left, then we're just 'right' of that value now.
-			break;
-		} else {
-			lpCurrent = lpCurrent->lpLeft;
-		}
+	kt_encode(cols, key);
+	auto lf = FindLeaf(key, true);
+	kt_iter it;
+	it.i = lf->bound(key, true, cur);
+	if (it.i < lf->size()) {
+		it.lf = lf;
+		it.where = sKeyTablePos::ON_ROW;
+	} else {
+		// All rows in this leaf are less, so it is the first row of the next one
+		it.lf = lf;
+		it.i = lf->size() - 1;
+		it.where = lf->size() > 0 ? sKeyTablePos::ON_ROW : sKeyTablePos::AFTER_LAST;
+		Next(it);
 	}
+	m_current = Store(it);
 	return erSuccess;
 }
 
 // Find an exact match for a sort key
 ECRESULT ECKeyTable::Find(const std::vector<ECSortCol> &cols, sObjectTableKey *lpsKey)
 {
-	scoped_rlock biglock(mLock);
-	auto lpCurPos = lpCurrent;
+	std::string key, cur;
+	kt_lock biglock(*this);
+	auto sCurPos = m_current;
 	auto er = LowerBound(cols);
-    if(er != erSuccess)
-        goto exit;
-
-    // No item is *lpCurrent >= *search, so not found
-    if(lpCurrent == NULL) {
-        er = KCERR_NOT_FOUND;
-        goto exit;
-    }
-
-    // Lower bound has put us either on the first matching row, or at the first item which is *lpCurrent > *search, aka *lpCurrent >= *search
-    if (ECTableRow::rowcompare(cols, lpCurrent->m_cols))
-        // *lpCurrent >= *search && *lpCurrent > *search, so *lpCurrent != *search
-        er = KCERR_NOT_FOUND;
+	if (er != erSuccess)
+		goto exit;
+
+	// No item is *current >= *search, so not found
+	if (m_current.ulWhere != sKeyTablePos::ON_ROW) {
+		er = KCERR_NOT_FOUND;
+		goto exit;
+	}
+
+	// Lower bound has put us either on the first matching row, or at the first item which is *current > *search, aka *current >= *search
+	kt_encode(cols, key);
+	{
+		auto it = LocateId(m_current.sKey);
+		it.lf->key(it.i, cur);
+	}
+	if (kt_less(key, cur))
+		// *current >= *search && *current > *search, so *current != *search
+		er = KCERR_NOT_FOUND;
 	else
-		*lpsKey = lpCurrent->sKey;
+		*lpsKey = m_current.sKey;
 
-    // *lpCurrent >= *search && !(*lpCurrent > *search), so *lpCurrent >= *search && *lpCurrent <= *search, so *lpCurrent == *search
+	// *current >= *search && !(*current > *search), so *current >= *search && *current <= *search, so *current == *search
 exit:
-	lpCurrent = lpCurPos;
-    return er;
+	m_current = sCurPos;
+	return er;
 }
 
 /**
@@ -1093,15 +1520,46 @@ exit:
 size_t ECKeyTable::GetObjectSize()
 {
 	size_t ulSize = sizeof(*this);
-	scoped_rlock biglock(mLock);
+	unsigned int users = 1;
+	kt_lock biglock(*this);
 
-	ulSize += MEMORY_USAGE_MAP(mapRow.size(), ECTableRowMap);
-	for (const auto &r : mapRow)
-		ulSize += r.second->GetObjectSize();
+	/* Rows shared with other tables are counted once in total */
+	ulSize += RowsSize(*m_tree, &users) / std::max(users, 1U);
 	ulSize += MEMORY_USAGE_MAP(m_mapBookmarks.size(), ECBookmarkMap);
 	return ulSize;
 }
 
+/* Size of the rows @t, and the number of tables showing them */
+size_t ECKeyTable::RowsSize(kt_tree &t, unsigned int *users)
+{
+	size_t ulSize = sizeof(t);
+	scoped_rlock lk(t.lock);
+	std::vector<const kt_node *> todo{t.root};
+
+	if (users != nullptr)
+		*users = t.users.size();
+	while (!todo.empty()) {
+		auto n = todo.back();
+		todo.pop_back();
+		if (n->leaf) {
+			auto lf = static_cast<const kt_leaf *>(n);
+			ulSize += sizeof(*lf) + lf->ent.capacity() * sizeof(kt_entry) +
+			          MEMORY_USAGE_STRING(lf->arena);
+			continue;
+		}
+		auto in = static_cast<const kt_inner *>(n);
+		ulSize += sizeof(*in) + in->kids.capacity() * sizeof(kt_node *) +
+		          in->sepoff.capacity() * sizeof(uint32_t) +
+		          MEMORY_USAGE_STRING(in->seps);
+		todo.insert(todo.end(), in->kids.cbegin(), in->kids.cend());
+	}
+	/* hash nodes are a next pointer plus the value; buckets are one pointer */
+	ulSize += t.rows.size() * (sizeof(void *) + sizeof(decltype(t.rows)::value_type)) +
+	          t.rows.bucket_count() * sizeof(void *) +
+	          t.users.capacity() * sizeof(ECKeyTable *);
+	return ulSize;
+}
+
 /**
  * Update a part of the sort data for a specific row
  *
@@ -1110,9 +1568,7 @@ size_t ECKeyTable::GetObjectSize()
  *
  * @param[in] lpsRowItem Row item to modify
  * @param[in] ulColumn Column id to modify (must be already present in the sort data, you cannot add a new column)
- * @param[in] lpSortData New sort data
- * @param[in] ulSortLen New sort length
- * @param[in] ulFlags New sort flags (note: you MUST match the previous DESCENDING flag, or you will get unpredictable results)
+ * @param[in] col New sort data (note: you MUST match the previous DESCENDING flag, or you will get unpredictable results)
  * @param[out] lpsPrevRow Returns the 'previous row' of the new location of the row for notification
  * @param[out] lpfHidden Returns the hidden flag of the modified row
  * @param[out] lpulAction Returns the action of the modification (always TABLE_ROW_MODIFY). It's here only for convenience
@@ -1122,44 +1578,45 @@ ECRESULT ECKeyTable::UpdatePartialSortKey(sObjectTableKey *lpsRowItem,
     size_t ulColumn, const ECSortCol &col, sObjectTableKey *lpsPrevRow,
     bool *lpfHidden, ECKeyTable::UpdateType *lpulAction)
 {
-    ECTableRow *lpCursor = NULL;
-	ulock_rec biglock(mLock);
-	auto er = GetRow(lpsRowItem, &lpCursor);
-    if(er != erSuccess)
+	std::vector<ECSortCol> copy;
+	bool fHidden = false;
+	kt_lock biglock(*this);
+	/* Copy the sortkeys that we used to have; modify the updated column */
+	auto er = GetRow(lpsRowItem, &copy, &fHidden);
+	if (er != erSuccess)
 		return er;
-	if (ulColumn >= lpCursor->m_cols.size())
+	if (ulColumn >= copy.size())
 		return KCERR_INVALID_PARAMETER;
-
-	/* Copy the sortkeys that we used to have; modify the updated column */
-	auto copy = lpCursor->m_cols;
 	copy[ulColumn] = col;
-    if(lpfHidden)
-		*lpfHidden = lpCursor->fHidden;
+	if (lpfHidden)
+		*lpfHidden = fHidden;
 	return UpdateRow(TABLE_ROW_MODIFY, lpsRowItem, std::move(copy),
-	       lpsPrevRow, lpCursor->fHidden, lpulAction);
+	       lpsPrevRow, fHidden, lpulAction);
 }
 
 /**
  * Get row sort data
  *
- * NOTE, returning reference to internal data. Make sure that the table is not modified
- * while handling the returned data. Also, caller does *not* need to free returned data.
- *
  * @param[in] lpsRowItem Row ID
- * @param[out] lpRow Location to return reference to table's sort data
+ * @param[out] lpCols Sort data of the row (optional)
+ * @param[out] lpfHidden Hidden flag of the row (optional)
  * @return result
  */
-ECRESULT ECKeyTable::GetRow(sObjectTableKey *lpsRowItem, ECTableRow **lpRow)
-{
-	ulock_rec biglock(mLock);
-	ECTableRow *lpCursor = lpCurrent;
-	auto er = SeekId(lpsRowItem);
-    if(er != erSuccess)
-        goto exit;
-    *lpRow = lpCurrent;
-exit:
-    lpCurrent = lpCursor;
-    return er;
+ECRESULT ECKeyTable::GetRow(const sObjectTableKey *lpsRowItem,
+    std::vector<ECSortCol> *lpCols, bool *lpfHidden)
+{
+	kt_lock biglock(*this);
+	auto it = LocateId(*lpsRowItem);
+	if (it.lf == nullptr)
+		return KCERR_NOT_FOUND;
+	if (lpCols != nullptr) {
+		std::string key;
+		it.lf->key(it.i, key);
+		kt_decode(key, *lpCols);
+	}
+	if (lpfHidden != nullptr)
+		*lpfHidden = it.lf->ent[it.i].hidden;
+	return erSuccess;
 }
 
 } /* namespace */
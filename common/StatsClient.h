@@ -34,12 +34,16 @@ enum SCName {
 	SCN_SESSIONS_CREATED, SCN_SESSIONS_DELETED, SCN_SESSIONS_TIMEOUT, SCN_SESSIONS_INTERNAL_CREATED, SCN_SESSIONS_INTERNAL_DELETED,
 	/* system session group stats */
 	SCN_SESSIONGROUPS_CREATED, SCN_SESSIONGROUPS_DELETED,
+	/* notification queue stats */
+	SCN_NOTIFY_QUEUED, SCN_NOTIFY_COALESCED, SCN_NOTIFY_OVERFLOW, SCN_NOTIFY_BATCHES, SCN_NOTIFY_MAX_BATCH,
 	/* LDAP stats */
 	SCN_LDAP_CONNECTS, SCN_LDAP_RECONNECTS, SCN_LDAP_CONNECT_FAILED, SCN_LDAP_CONNECT_TIME, SCN_LDAP_CONNECT_TIME_MAX,
 	SCN_LDAP_AUTH_LOGINS, SCN_LDAP_AUTH_DENIED, SCN_LDAP_AUTH_TIME, SCN_LDAP_AUTH_TIME_MAX, SCN_LDAP_AUTH_TIME_AVG,
 	SCN_LDAP_SEARCH, SCN_LDAP_SEARCH_FAILED, SCN_LDAP_SEARCH_TIME, SCN_LDAP_SEARCH_TIME_MAX,
 	/* indexer stats */
 	SCN_INDEXER_SEARCH_ERRORS, SCN_INDEXER_SEARCH_MAX, SCN_INDEXER_SEARCH_AVG, SCN_INDEXED_SEARCHES, SCN_DATABASE_SEARCHES,
+	SCN_INDEXER_SEARCH_LT1MS, SCN_INDEXER_SEARCH_LT10MS, SCN_INDEXER_SEARCH_LT100MS, SCN_INDEXER_SEARCH_LT1S, SCN_INDEXER_SEARCH_GE1S,
+	SCN_INDEXER_POOL_WAITS, SCN_INDEXER_CONNECTS, SCN_INDEXER_NATIVE_DOCS, SCN_INDEXER_NATIVE_SIZE,
 
 	SCN_DAGENT_ATTACHMENT_COUNT,
 	SCN_DAGENT_AUTOACCEPT,
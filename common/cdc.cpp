@@ -0,0 +1,431 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <libHX/io.h>
+#include <mapidefs.h>
+#include <openssl/sha.h>
+#include <kopano/ECLogger.h>
+#include <kopano/UnixUtil.h>
+#include <kopano/cdc.hpp>
+#include <kopano/fileutil.hpp>
+#include <kopano/scope.hpp>
+
+namespace KC {
+
+/*
+ * Gear table for the rolling hash. Generated with splitmix64 from a fixed
+ * seed; it must never change, or chunk boundaries move.
+ */
+static const struct cdc_gear {
+	uint64_t v[256];
+	cdc_gear()
+	{
+		uint64_t x = 0x4b6f70616e6f4344ULL;
+		for (size_t i = 0; i < 256; ++i) {
+			uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			v[i] = z ^ (z >> 31);
+		}
+	}
+} cdc_gear;
+
+static std::atomic<unsigned int> cdc_tmp_seq;
+
+/* Mask with the topmost @k bits set; the high bits of a gear hash carry the most history. */
+static inline uint64_t cdc_mask(unsigned int k)
+{
+	return k == 0 ? 0 : ~0ULL << (64 - k);
+}
+
+static std::string cdc_hex(const std::string &md)
+{
+	static const char hex[] = "0123456789abcdef";
+	std::string s;
+	s.reserve(md.size() * 2);
+	for (auto c : md) {
+		s += hex[(c >> 4) & 0x0F];
+		s += hex[c & 0x0F];
+	}
+	return s;
+}
+
+static std::string cdc_unhex(const std::string &s)
+{
+	std::string md;
+	if (s.size() % 2 != 0)
+		return md;
+	for (size_t i = 0; i < s.size(); i += 2) {
+		auto hi = s[i], lo = s[i+1];
+		if (!isxdigit(hi) || !isxdigit(lo))
+			return std::string();
+		hi = isdigit(hi) ? hi - '0' : tolower(hi) - 'a' + 10;
+		lo = isdigit(lo) ? lo - '0' : tolower(lo) - 'a' + 10;
+		md += static_cast<char>((hi << 4) | lo);
+	}
+	return md;
+}
+
+cdc_chunker::cdc_chunker(size_t min, size_t avg, size_t max) :
+	m_min(min), m_avg(std::max(avg, min)), m_max(std::max(max, m_avg))
+{
+	unsigned int bits = 0;
+	while ((static_cast<size_t>(2) << bits) <= m_avg)
+		++bits;
+	/* Normalized chunking: harder to cut before avg, easier after */
+	m_mask_s = cdc_mask(bits + 1);
+	m_mask_l = cdc_mask(bits > 1 ? bits - 1 : 1);
+}
+
+size_t cdc_chunker::next(const void *p, size_t z) const
+{
+	auto b = static_cast<const unsigned char *>(p);
+	if (z <= m_min)
+		return z;
+	auto limit = std::min(z, m_max), normal = std::min(m_avg, limit);
+	uint64_t h = 0;
+	size_t i = m_min;
+	for (; i < normal; ++i) {
+		h = (h << 1) + cdc_gear.v[b[i]];
+		if ((h & m_mask_s) == 0)
+			return i + 1;
+	}
+	for (; i < limit; ++i) {
+		h = (h << 1) + cdc_gear.v[b[i]];
+		if ((h & m_mask_l) == 0)
+			return i + 1;
+	}
+	return limit;
+}
+
+std::string cdc_manifest::format() const
+{
+	auto s = "kcdc1 " + std::to_string(size) + " " + holder + "\n";
+	for (const auto &c : chunks)
+		s += cdc_hex(c.md) + " " + std::to_string(c.size) + "\n";
+	return s;
+}
+
+bool cdc_manifest::parse(const std::string &in)
+{
+	std::istringstream is(in);
+	std::string magic, hex;
+	uint64_t total = 0;
+	if (!(is >> magic >> size >> holder) || magic != "kcdc1")
+		return false;
+	chunks.clear();
+	size_t csize;
+	while (is >> hex >> csize) {
+		auto md = cdc_unhex(hex);
+		if (md.size() != SHA256_DIGEST_LENGTH)
+			return false;
+		chunks.push_back({std::move(md), csize});
+		total += csize;
+	}
+	return is.eof() && total == size;
+}
+
+cdc_store::cdc_store(const std::string &root, bool sync) :
+	m_root(root), m_sync(sync)
+{}
+
+std::string cdc_store::chunk_dir(const std::string &md) const
+{
+	auto hex = cdc_hex(md);
+	return m_root + "/" + hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/" + hex.substr(4);
+}
+
+/**
+ * Add a reference from @holder to the chunk @md, storing the chunk first if
+ * it does not exist yet. Uploads go to a private directory which is renamed
+ * into place, so readers never see a partial chunk.
+ */
+ECRESULT cdc_store::put(const std::string &md, const void *data, size_t z,
+    const std::string &holder)
+{
+	auto dir = chunk_dir(md);
+	auto ref = dir + "/holder/" + holder;
+	std::string tmp;
+	auto cleanup = make_scope_success([&]() {
+		if (!tmp.empty())
+			HX_rrmdir(tmp.c_str());
+	});
+
+	for (int retries = 3; ; ) {
+		int fd = open(ref.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRWUG);
+		if (fd >= 0) {
+			close(fd);
+			return erSuccess;
+		} else if (errno == EEXIST) {
+			/* Chunk occurs more than once in this object */
+			return erSuccess;
+		} else if (errno != ENOENT) {
+			ec_log_warn("cdc: create %s: %s", ref.c_str(), strerror(errno));
+		}
+
+		if (tmp.empty()) {
+			tmp = m_root + "/tmp/" + std::to_string(getpid()) + "-" +
+			      std::to_string(++cdc_tmp_seq);
+			auto ret = CreatePath(tmp + "/holder", S_IRWXUG);
+			if (ret != 0 && errno != EEXIST) {
+				ec_log_err("cdc: mkdir -p \"%s\": %s", tmp.c_str(), strerror(errno));
+				return KCERR_DATABASE_ERROR;
+			}
+			auto file = tmp + "/content";
+			fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWUG);
+			if (fd < 0) {
+				ec_log_err("cdc: open \"%s\": %s", file.c_str(), strerror(errno));
+				return KCERR_DATABASE_ERROR;
+			}
+			auto wr = write_retry(fd, data, z);
+			if (wr != static_cast<ssize_t>(z) || (m_sync && !force_buffers_to_disk(fd))) {
+				ec_log_err("cdc: write \"%s\": %s", file.c_str(), strerror(errno));
+				close(fd);
+				return KCERR_DATABASE_ERROR;
+			}
+			close(fd);
+			file = tmp + "/holder/" + holder;
+			fd = open(file.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
+			if (fd < 0) {
+				ec_log_err("cdc: open \"%s\": %s", file.c_str(), strerror(errno));
+				return KCERR_DATABASE_ERROR;
+			}
+			close(fd);
+		}
+
+		auto parent = dir.substr(0, dir.find_last_of('/'));
+		auto ret = CreatePath(parent, S_IRWXUG);
+		if (ret != 0 && errno != EEXIST) {
+			ec_log_err("cdc: mkdir -p \"%s\": %s", parent.c_str(), strerror(errno));
+			return KCERR_DATABASE_ERROR;
+		}
+		if (rename(tmp.c_str(), dir.c_str()) == 0) {
+			tmp.clear();
+			return erSuccess;
+		}
+		if (errno != EEXIST && errno != ENOTEMPTY) {
+			ec_log_err("cdc: rename \"%s\" -> \"%s\": %s",
+				tmp.c_str(), dir.c_str(), strerror(errno));
+			return KCERR_DATABASE_ERROR;
+		}
+		/* Uploaded by someone else meanwhile, or still being removed */
+		if (--retries == 0) {
+			ec_log_err("cdc: cannot reference chunk \"%s\"", dir.c_str());
+			return KCERR_DATABASE_ERROR;
+		}
+		Sleep(1);
+	}
+}
+
+ECRESULT cdc_store::get(const std::string &md, void *data, size_t z) const
+{
+	auto file = chunk_dir(md) + "/content";
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		ec_log_err("cdc: open \"%s\": %s", file.c_str(), strerror(errno));
+		return errno == ENOENT ? KCERR_NOT_FOUND : KCERR_NO_ACCESS;
+	}
+	auto rd = read_retry(fd, data, z);
+	close(fd);
+	if (rd != static_cast<ssize_t>(z)) {
+		ec_log_err("cdc: short read on \"%s\": %zd/%zu", file.c_str(), rd, z);
+		return KCERR_DATABASE_ERROR;
+	}
+	return erSuccess;
+}
+
+ECRESULT cdc_store::release(const std::string &md, const std::string &holder)
+{
+	auto dir = chunk_dir(md);
+	auto ref = dir + "/holder/" + holder;
+	if (unlink(ref.c_str()) != 0) {
+		if (errno != ENOENT) {
+			ec_log_err("cdc: unlink \"%s\": %s", ref.c_str(), strerror(errno));
+			return KCERR_DATABASE_ERROR;
+		}
+		ec_log_warn("cdc: \"%s\" already gone", ref.c_str());
+	}
+	auto hdir = dir + "/holder";
+	if (rmdir(hdir.c_str()) != 0) {
+		if (errno != ENOTEMPTY && errno != ENOENT)
+			ec_log_err("cdc: rmdir \"%s\": %s", hdir.c_str(), strerror(errno));
+		/* else: other holders exist */
+		return erSuccess;
+	}
+	HX_rrmdir(dir.c_str());
+	return erSuccess;
+}
+
+ECRESULT cdc_store::release(const cdc_manifest &m)
+{
+	std::set<std::string> seen;
+	ECRESULT ret = erSuccess;
+	for (const auto &c : m.chunks) {
+		if (!seen.emplace(c.md).second)
+			continue;
+		auto er = release(c.md, m.holder);
+		if (er != erSuccess)
+			ret = er;
+	}
+	return ret;
+}
+
+cdc_writer::cdc_writer(cdc_store &s, const cdc_chunker &c,
+    const std::string &holder) :
+	m_store(s), m_chunker(c)
+{
+	m_manifest.holder = holder;
+}
+
+ECRESULT cdc_writer::emit(size_t len)
+{
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	auto p = m_buf.data() + m_pos;
+	SHA256(reinterpret_cast<const unsigned char *>(p), len, md);
+	cdc_chunk c{std::string(reinterpret_cast<char *>(md), sizeof(md)), len};
+	auto ret = m_store.put(c.md, p, len, m_manifest.holder);
+	if (ret != erSuccess)
+		return ret;
+	m_manifest.chunks.push_back(std::move(c));
+	m_manifest.size += len;
+	m_pos += len;
+	return erSuccess;
+}
+
+ECRESULT cdc_writer::write(const void *data, size_t z)
+{
+	m_buf.append(static_cast<const char *>(data), z);
+	/* Only cut with a full window ahead, so cuts do not depend on how the data was fed */
+	while (m_buf.size() - m_pos >= m_chunker.max_size()) {
+		auto ret = emit(m_chunker.next(m_buf.data() + m_pos, m_buf.size() - m_pos));
+		if (ret != erSuccess)
+			return ret;
+	}
+	if (m_pos > 0) {
+		m_buf.erase(0, m_pos);
+		m_pos = 0;
+	}
+	return erSuccess;
+}
+
+ECRESULT cdc_writer::finish()
+{
+	while (m_pos < m_buf.size()) {
+		auto ret = emit(m_chunker.next(m_buf.data() + m_pos, m_buf.size() - m_pos));
+		if (ret != erSuccess)
+			return ret;
+	}
+	m_buf.clear();
+	m_pos = 0;
+	return erSuccess;
+}
+
+void cdc_writer::abort()
+{
+	m_store.release(m_manifest);
+	m_manifest.chunks.clear();
+	m_manifest.size = 0;
+}
+
+/* Calls @f for every entry of @dir whose name is two characters long */
+template<typename F> static void cdc_walk_shard(const std::string &dir, F &&f)
+{
+	std::unique_ptr<DIR, fs_deleter> dh(opendir(dir.c_str()));
+	if (dh == nullptr)
+		return;
+	for (const struct dirent *de = readdir(dh.get()); de != nullptr; de = readdir(dh.get()))
+		if (strlen(de->d_name) == 2 && de->d_name[0] != '.')
+			f(dir + "/" + de->d_name);
+}
+
+template<typename F> static void cdc_walk_leaf(const std::string &dir, F &&f)
+{
+	std::unique_ptr<DIR, fs_deleter> dh(opendir(dir.c_str()));
+	if (dh == nullptr)
+		return;
+	for (const struct dirent *de = readdir(dh.get()); de != nullptr; de = readdir(dh.get()))
+		if (de->d_name[0] != '.')
+			f(dir + "/" + de->d_name);
+}
+
+/* Number of holders of a files_v2 instance or chunk; 0 if @dir is neither */
+static size_t cdc_holders(const std::string &dir)
+{
+	size_t n = 0;
+	cdc_walk_leaf(dir + "/holder", [&](const std::string &) { ++n; });
+	return n;
+}
+
+/**
+ * Walks a files_v2 attachment directory and its chunk store and sums up
+ * sizes and reference counts, for reporting the deduplication ratio.
+ */
+ECRESULT cdc_scan(const std::string &base, cdc_stats *st)
+{
+	struct stat sb;
+	if (stat(base.c_str(), &sb) != 0) {
+		ec_log_err("cdc: stat \"%s\": %s", base.c_str(), strerror(errno));
+		return KCERR_NOT_FOUND;
+	}
+	cdc_walk_shard(base, [&](const std::string &l1) {
+	cdc_walk_shard(l1, [&](const std::string &l2) {
+	cdc_walk_leaf(l2, [&](const std::string &obj) {
+		auto holders = cdc_holders(obj);
+		if (holders == 0)
+			return;
+		uint64_t size = 0;
+		if (stat((obj + "/content").c_str(), &sb) == 0) {
+			size = sb.st_size;
+			st->stored += size;
+		} else {
+			std::string buf;
+			std::unique_ptr<FILE, file_deleter> fp(fopen((obj + "/manifest").c_str(), "r"));
+			cdc_manifest m;
+			if (fp == nullptr || HrMapFileToString(fp.get(), &buf) != hrSuccess ||
+			    !m.parse(buf)) {
+				ec_log_warn("cdc: \"%s\": no content or valid manifest", obj.c_str());
+				return;
+			}
+			size = m.size;
+			st->stored += buf.size();
+			st->manifest_bytes += size;
+			++st->chunked;
+		}
+		++st->objects;
+		st->references += holders;
+		st->instance_bytes += size;
+		st->logical += size * holders;
+	});
+	});
+	});
+	cdc_walk_shard(base + "/chunks", [&](const std::string &l1) {
+	cdc_walk_shard(l1, [&](const std::string &l2) {
+	cdc_walk_leaf(l2, [&](const std::string &chunk) {
+		if (stat((chunk + "/content").c_str(), &sb) != 0)
+			return;
+		++st->chunks;
+		st->chunk_refs += cdc_holders(chunk);
+		st->chunk_bytes += sb.st_size;
+		st->stored += sb.st_size;
+	});
+	});
+	});
+	return erSuccess;
+}
+
+} /* namespace */
@@ -8,10 +8,15 @@
 #include <algorithm>
 #include <exception>
 #include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
+#include <errmsg.h>
 #include <mysql.h>
 #include <mysqld_error.h>
 #include <kopano/ECConfig.h>
@@ -64,6 +69,186 @@ DB_LENGTHS DB_RESULT::fetch_row_lengths()
 	return mysql_fetch_lengths(static_cast<MYSQL_RES *>(m_res));
 }
 
+/* my_bool in MariaDB and MySQL < 8, bool afterwards */
+using kd_bool = std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type;
+
+struct kd_column {
+	std::unique_ptr<char[]> buf;
+	unsigned long len = 0, cap = 0;
+	kd_bool null = 0, error = 0;
+	bool numeric = false;
+	union {
+		long long i64;
+		unsigned long long u64;
+	} val;
+};
+
+/*
+ * A server-side prepared statement, with the result binding kept across
+ * executions so that buffers only need to grow, never be reallocated per
+ * row or per call.
+ */
+struct kd_stmt {
+	~kd_stmt();
+	bool bind_result();
+	bool fetch();
+
+	MYSQL_STMT *stmt = nullptr;
+	std::vector<MYSQL_BIND> pbind, rbind;
+	std::vector<kd_column> cols;
+	bool busy = false, cached = true;
+};
+
+kd_stmt::~kd_stmt()
+{
+	if (stmt != nullptr)
+		mysql_stmt_close(stmt);
+}
+
+bool kd_stmt::bind_result()
+{
+	for (size_t i = 0; i < cols.size(); ++i) {
+		auto &c = cols[i];
+		auto &b = rbind[i];
+		if (c.numeric) {
+			b.buffer_type = MYSQL_TYPE_LONGLONG;
+			b.buffer = &c.val;
+			b.buffer_length = sizeof(c.val);
+		} else {
+			b.buffer_type = MYSQL_TYPE_BLOB;
+			b.buffer = c.buf.get();
+			b.buffer_length = c.cap;
+		}
+		b.length = &c.len;
+		b.is_null = &c.null;
+		b.error = &c.error;
+	}
+	return mysql_stmt_bind_result(stmt, rbind.data()) == 0;
+}
+
+/*
+ * Fetch the next row. Columns that did not fit their buffer are refetched
+ * after growing it; the larger buffer is then kept for subsequent rows.
+ */
+bool kd_stmt::fetch()
+{
+	auto ret = mysql_stmt_fetch(stmt);
+	if (ret == MYSQL_DATA_TRUNCATED) {
+		bool rebind = false;
+		for (size_t i = 0; i < cols.size(); ++i) {
+			auto &c = cols[i];
+			if (c.numeric || !c.error || c.len <= c.cap)
+				continue;
+			c.cap = c.len;
+			c.buf.reset(new char[c.cap+1]);
+			rbind[i].buffer = c.buf.get();
+			rbind[i].buffer_length = c.cap;
+			if (mysql_stmt_fetch_column(stmt, &rbind[i], i, 0) != 0)
+				return false;
+			rebind = true;
+		}
+		if (rebind && !bind_result())
+			return false;
+	} else if (ret != 0) {
+		return false;
+	}
+	for (auto &c : cols)
+		if (!c.numeric && !c.null && c.buf != nullptr)
+			c.buf[c.len] = '\0';
+	return true;
+}
+
+void kd_stmt_delete::operator()(kd_stmt *s) const noexcept
+{
+	if (s == nullptr)
+		return;
+	if (!s->busy) {
+		delete s;
+		return;
+	}
+	/* Still referenced by a DB_STMT_RESULT, which will free it. */
+	s->cached = false;
+}
+
+DB_STMT_RESULT::~DB_STMT_RESULT()
+{
+	if (m_stmt == nullptr)
+		return;
+	mysql_stmt_free_result(m_stmt->stmt);
+	m_stmt->busy = false;
+	if (!m_stmt->cached)
+		delete m_stmt;
+	m_stmt = nullptr;
+}
+
+DB_STMT_RESULT &DB_STMT_RESULT::operator=(DB_STMT_RESULT &&o) noexcept
+{
+	if (this == &o)
+		return *this;
+	this->~DB_STMT_RESULT();
+	m_stmt = o.m_stmt;
+	o.m_stmt = nullptr;
+	return *this;
+}
+
+size_t DB_STMT_RESULT::get_num_rows() const
+{
+	return mysql_stmt_num_rows(m_stmt->stmt);
+}
+
+bool DB_STMT_RESULT::fetch_row()
+{
+	return m_stmt != nullptr && m_stmt->fetch();
+}
+
+bool DB_STMT_RESULT::is_null(size_t col) const
+{
+	return m_stmt->cols[col].null;
+}
+
+unsigned long long DB_STMT_RESULT::get_u64(size_t col) const
+{
+	const auto &c = m_stmt->cols[col];
+	if (c.null)
+		return 0;
+	if (c.numeric)
+		return c.val.u64;
+	return c.buf != nullptr ? strtoull(c.buf.get(), nullptr, 10) : 0;
+}
+
+long long DB_STMT_RESULT::get_i64(size_t col) const
+{
+	const auto &c = m_stmt->cols[col];
+	if (c.null)
+		return 0;
+	if (c.numeric)
+		return c.val.i64;
+	return c.buf != nullptr ? strtoll(c.buf.get(), nullptr, 10) : 0;
+}
+
+const char *DB_STMT_RESULT::get_data(size_t col, size_t *len) const
+{
+	const auto &c = m_stmt->cols[col];
+	if (c.null || c.numeric) {
+		if (len != nullptr)
+			*len = 0;
+		return nullptr;
+	}
+	if (len != nullptr)
+		*len = c.len;
+	return c.buf != nullptr ? c.buf.get() : "";
+}
+
+std::string DB_STMT_RESULT::get_string(size_t col) const
+{
+	const auto &c = m_stmt->cols[col];
+	if (c.null)
+		return {};
+	if (c.numeric)
+		return stringify_int64(c.val.i64);
+	return c.buf != nullptr ? std::string(c.buf.get(), c.len) : std::string();
+}
+
 KDatabase::KDatabase()
 {
 	memset(&m_lpMySQL, 0, sizeof(m_lpMySQL));
@@ -266,6 +451,7 @@ ECRESULT KDatabase::Close()
 {
 	/* No locking here */
 	m_bConnected = false;
+	stmt_flush();
 	if (m_bMysqlInitialize)
 		mysql_close(&m_lpMySQL);
 	m_bMysqlInitialize = false;
@@ -349,6 +535,200 @@ ECRESULT KDatabase::DoSelect(const std::string &q, DB_RESULT *res_p,
 	return er;
 }
 
+static inline bool is_integer_field(enum enum_field_types t)
+{
+	switch (t) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Prepare a statement and set up its result binding. The caller is
+ * responsible for putting it into the cache (or not).
+ */
+kd_stmt *KDatabase::stmt_prepare(const char *tmpl)
+{
+	LOG_SQL_DEBUG("SQL [%08lu]: prepare \"%s;\"", m_lpMySQL.thread_id, tmpl);
+	if (!m_bMysqlInitialize)
+		return nullptr;
+	std::unique_ptr<kd_stmt> s(new(std::nothrow) kd_stmt);
+	if (s == nullptr)
+		return nullptr;
+	s->stmt = mysql_stmt_init(&m_lpMySQL);
+	if (s->stmt == nullptr)
+		return nullptr;
+	if (mysql_stmt_prepare(s->stmt, tmpl, strlen(tmpl)) != 0) {
+		ec_log_err("SQL [%08lu] prepare failed: %s, Query: \"%s\"",
+			m_lpMySQL.thread_id, mysql_stmt_error(s->stmt), tmpl);
+		return nullptr;
+	}
+	s->pbind.resize(mysql_stmt_param_count(s->stmt));
+	auto nf = mysql_stmt_field_count(s->stmt);
+	if (nf == 0)
+		return s.release();
+	std::unique_ptr<MYSQL_RES, void (*)(MYSQL_RES *)> meta(mysql_stmt_result_metadata(s->stmt), mysql_free_result);
+	if (meta == nullptr)
+		return nullptr;
+	auto fields = mysql_fetch_fields(meta.get());
+	s->cols.resize(nf);
+	s->rbind.resize(nf);
+	for (unsigned int i = 0; i < nf; ++i) {
+		auto &c = s->cols[i];
+		c.numeric = is_integer_field(fields[i].type);
+		s->rbind[i].is_unsigned = fields[i].flags & UNSIGNED_FLAG;
+		if (c.numeric)
+			continue;
+		/* Start out with the declared width for short columns */
+		c.cap = std::min(fields[i].length, 256UL);
+		c.buf.reset(new char[c.cap+1]);
+	}
+	if (!s->bind_result())
+		return nullptr;
+	return s.release();
+}
+
+/**
+ * Look up (or prepare) the statement for @tmpl, bind the parameters and
+ * execute it. Statements lost because of a server reconnect are prepared
+ * again and the execution retried once.
+ */
+ECRESULT KDatabase::stmt_execute(const char *tmpl, const DB_PARAM *param,
+    size_t nparam, kd_stmt **sp)
+{
+	for (unsigned int attempt = 0; ; ++attempt) {
+		kd_stmt *s = nullptr;
+		auto iter = m_stmt_cache.find(tmpl);
+		if (iter != m_stmt_cache.cend() && !iter->second->busy) {
+			s = iter->second.get();
+		} else {
+			s = stmt_prepare(tmpl);
+			if (s == nullptr)
+				return KCERR_DATABASE_ERROR;
+			if (iter == m_stmt_cache.cend())
+				m_stmt_cache.emplace(tmpl, std::unique_ptr<kd_stmt, kd_stmt_delete>(s));
+			else
+				/* Nested use of a busy template: one-shot statement */
+				s->cached = false;
+		}
+		if (s->pbind.size() != nparam) {
+			assert(!"parameter count mismatch");
+			ec_log_err("SQL prepared statement expects %zu parameters, got %zu: \"%s\"",
+				s->pbind.size(), nparam, tmpl);
+			if (!s->cached)
+				delete s;
+			return KCERR_INVALID_PARAMETER;
+		}
+		for (size_t i = 0; i < nparam; ++i) {
+			auto &b = s->pbind[i];
+			const auto &p = param[i];
+			memset(&b, 0, sizeof(b));
+			b.buffer_type = p.m_type;
+			b.is_unsigned = p.m_unsigned;
+			if (p.m_type == MYSQL_TYPE_LONGLONG) {
+				b.buffer = const_cast<void *>(static_cast<const void *>(&p.m_val));
+			} else if (p.m_type != MYSQL_TYPE_NULL) {
+				b.buffer = const_cast<void *>(p.m_data);
+				b.buffer_length = p.m_len;
+			}
+		}
+		LOG_SQL_DEBUG("SQL [%08lu]: execute \"%s;\"", m_lpMySQL.thread_id, tmpl);
+		if ((nparam == 0 || mysql_stmt_bind_param(s->stmt, s->pbind.data()) == 0) &&
+		    mysql_stmt_execute(s->stmt) == 0 &&
+		    (s->cols.empty() || mysql_stmt_store_result(s->stmt) == 0)) {
+			s->busy = true;
+			*sp = s;
+			return erSuccess;
+		}
+
+		auto err = mysql_stmt_errno(s->stmt);
+		if (attempt == 0 && (err == CR_SERVER_LOST || err == CR_SERVER_GONE_ERROR ||
+		    err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE)) {
+			ec_log_warn("SQL [%08lu] info: %s. Preparing statement again.",
+				m_lpMySQL.thread_id, mysql_stmt_error(s->stmt));
+			if (!s->cached)
+				delete s;
+			else
+				m_stmt_cache.erase(tmpl);
+			if ((err == CR_SERVER_LOST || err == CR_SERVER_GONE_ERROR) &&
+			    Reconnect() != erSuccess)
+				return KCERR_DATABASE_ERROR;
+			continue;
+		}
+		if (!m_bSuppressLockErrorLogging ||
+		    (err != ER_LOCK_WAIT_TIMEOUT && err != ER_LOCK_DEADLOCK))
+			ec_log_err("SQL [%08lu] Failed: %s, Query: \"%s\"",
+				m_lpMySQL.thread_id, mysql_stmt_error(s->stmt), tmpl);
+		if (!s->cached)
+			delete s;
+		return KCERR_DATABASE_ERROR;
+	}
+}
+
+/**
+ * Perform a SELECT operation using a prepared statement
+ * @tmpl:	(in) query template with "?" placeholders
+ * @param:	(in) values for the placeholders, in order
+ * @res_p:	(out) Result output
+ *
+ * The result is fully transferred to the client (like DoSelect without
+ * streaming), so get_num_rows can be used right away.
+ *
+ * Returns erSuccess or %KCERR_DATABASE_ERROR.
+ */
+ECRESULT KDatabase::DoSelectPrepared(const char *tmpl, const DB_PARAM *param,
+    size_t nparam, DB_STMT_RESULT *res_p)
+{
+	autolock alk(*this);
+	kd_stmt *s = nullptr;
+	auto er = stmt_execute(tmpl, param, nparam, &s);
+	if (er != erSuccess)
+		return er;
+	DB_STMT_RESULT res(s);
+	if (res_p != nullptr)
+		*res_p = std::move(res);
+	return erSuccess;
+}
+
+/**
+ * Perform an INSERT, UPDATE or DELETE operation using a prepared statement
+ * @tmpl:	(in) query template with "?" placeholders
+ * @param:	(in) values for the placeholders, in order
+ * @aff:	(out) (optional) Receives the number of affected rows
+ * @idp:	(out) (optional) Receives the last insert id
+ *
+ * Returns erSuccess or %KCERR_DATABASE_ERROR.
+ */
+ECRESULT KDatabase::DoUpdatePrepared(const char *tmpl, const DB_PARAM *param,
+    size_t nparam, unsigned int *aff, unsigned int *idp)
+{
+	autolock alk(*this);
+	kd_stmt *s = nullptr;
+	auto er = stmt_execute(tmpl, param, nparam, &s);
+	if (er != erSuccess)
+		return er;
+	if (aff != nullptr)
+		*aff = mysql_stmt_affected_rows(s->stmt);
+	if (idp != nullptr)
+		*idp = mysql_stmt_insert_id(s->stmt);
+	/* Release it again */
+	DB_STMT_RESULT res(s);
+	return erSuccess;
+}
+
+/* Drop all prepared statements; they do not survive the connection. */
+void KDatabase::stmt_flush() noexcept
+{
+	m_stmt_cache.clear();
+}
+
 /**
  * This function updates a sequence in an atomic fashion - if called correctly;
  *
@@ -4,6 +4,7 @@
  */
 #pragma once
 #include <list>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -44,6 +45,11 @@ public:
 	HRESULT HrReadBytes(std::string *buf, size_t len);
 	HRESULT HrReadAndDiscardBytes(size_t);
 	HRESULT HrSelect(int seconds);
+	HRESULT HrReadAvailable(size_t maxbuf);
+	/* How long reads wait for input, -1 for no limit */
+	void SetReadTimeout(int seconds) { m_timeout = seconds < 0 ? -1 : seconds * 1000; }
+	const std::string &pending() const { return m_inbuf; }
+	int sockfd() const { return fd; }
 	KC_HIDDEN void SetIPAddress(const struct sockaddr *, size_t);
 	KC_HIDDEN const char *peer_addr() const { return peer_atxt; }
 	int peer_is_local() const;
@@ -60,7 +66,16 @@ private:
 	char peer_atxt[280];
 	struct sockaddr_storage peer_sockaddr;
 	socklen_t peer_salen = 0;
+	/* Read ahead by HrReadAvailable, handed out before the socket's */
+	std::string m_inbuf;
+	/* lpSSL, which a notification may write to while a read waits */
+	std::mutex m_ssl_lock;
+	int m_timeout = -1; /* for reads, in milliseconds */
 
+	KC_HIDDEN size_t take(char *buf, size_t len);
+	KC_HIDDEN bool wait_for(short events, int timeout) const;
+	KC_HIDDEN ssize_t sock_recv(void *buf, size_t len, int flags);
+	KC_HIDDEN int ssl_io(unsigned int op, void *buf, int len, int timeout);
 	KC_HIDDEN char *fd_gets(char *buf, int *len);
 	KC_HIDDEN char *SSL_gets(char *buf, int *len);
 };
@@ -11,10 +11,10 @@
  * in a table, so when data is requested, we can give a list of all the object IDs
  * and the actual data can be retrieved from the database.
  *
- * The table class handles this, by having a table of rows, with per-row a TableRow
- * object. Each row contains an object ID and a sort key. This makes it very fast
- * to add new rows into the table, because we can pretty easily add (or remove) the
- * row into the sorted tree.
+ * The table class handles this, by keeping per row an object ID and a sort key in
+ * an order-statistic B+-tree. This makes it very fast to add new rows into the table,
+ * and to find a row by its position, because every node knows how many (unhidden)
+ * rows are below it.
  *
  * The caller has to make sure that the sort key is correct.
  *
@@ -22,29 +22,26 @@
  *
  * Memory considerations:
  *
- * Say we have 100 users, with each having 10 tables open with in each table, 10000 rows,
- * this means we have 10000*100*10*sizeof(TableRow) data in memory. Assume we're sorting on
- * two columns, both ints, then this is another 8 bytes of data per row, which would
- * give us a mem. requirement of 10000*100*10*(12+8) = 190 Mb of memory. This is pretty
- * good for 100 (heavy) users.
- *
- * Of course, when we're sorting on strings, which are 50 bytes each, the memory usage goes
- * up dramatically; sorting on 1 column with 50 bytes of sort data uses 476 Mb of mem.
- *
- * This could optimised by only sorting the first X characters, and expanding the sort key
- * when more precision is required.
+ * The sort keys of the rows in a leaf are packed into one buffer, and each key
+ * only stores the part that differs from its predecessor (rows sorted on the
+ * same subject or sender share long prefixes). A row costs 16 bytes in its leaf,
+ * plus the id-to-leaf hash entry, plus its compressed sort key; the previous
+ * pointer-per-row AVL tree needed well over 200 bytes per row with a 50-byte
+ * string sort column (476 Mb for 1M rows). tests/keytabletime measures this.
  *
  * This structure will be hogging the largest amount of memory of all the server-side components,
- * that's for sure.
+ * that's for sure. Tables showing the same rows in the same order can share them (see Share).
  *
  */
 #include <kopano/zcdefs.h>
 #include <kopano/kcodes.h>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 #define BOOKMARK_LIMIT		100
 
@@ -73,6 +70,20 @@ struct sObjectTableKey {
 	}
 };
 
+} /* namespace */
+
+namespace std {
+	template<> struct hash<KC::sObjectTableKey> {
+		public:
+		size_t operator()(const KC::sObjectTableKey &k) const noexcept
+		{
+			return hash<uint64_t>()(static_cast<uint64_t>(k.ulObjId) << 32 | k.ulOrderId);
+		}
+	};
+}
+
+namespace KC {
+
 typedef std::map<sObjectTableKey, unsigned int> ECObjectTableMap;
 typedef std::list<sObjectTableKey> ECObjectTableList;
 
@@ -107,12 +118,15 @@ class ECSortColView {
 	}
 };
 
+/*
+ * A row with its sort key in plain form. The key table itself keeps rows in
+ * packed form; this is what ECKeyTable::GetRow and the category maps use.
+ */
 class KC_EXPORT ECTableRow KC_FINAL {
 public:
 	ECTableRow(const sObjectTableKey &, const std::vector<ECSortCol> &, bool hidden);
 	ECTableRow(const sObjectTableKey &, std::vector<ECSortCol> &&, bool hidden);
 	ECTableRow(sObjectTableKey &&, std::vector<ECSortCol> &&, bool hidden);
-	ECTableRow(const ECTableRow &other);
 	KC_HIDDEN size_t GetObjectSize() const;
 	KC_HIDDEN static bool rowcompare(const ECTableRow *, const ECTableRow *);
 	KC_HIDDEN static bool rowcompare(const ECSortColView &, const ECSortColView &, bool ignore_order = false);
@@ -121,23 +135,19 @@ public:
 
 	sObjectTableKey	sKey;
 	std::vector<ECSortCol> m_cols;
-
-	// b-tree data
-	ECTableRow *lpParent = nullptr;
-	ECTableRow *lpLeft = nullptr; // All nodes in left are such that *left < *this
-	ECTableRow *lpRight = nullptr; // All nodes in right are such that *this <= *right
-	unsigned int ulBranchCount = 0; // Count of all nodes in this branch (including this node)
-	unsigned int ulHeight = 0; // For AVL
-	unsigned int fLeft = 0; // 1 if this is a left node
-	bool fRoot = false; // Only the root node has TRUE here
 	bool		fHidden;		// The row is hidden (is it non-existent for all purposes)
 };
 
-typedef std::map<sObjectTableKey, ECTableRow *> ECTableRowMap;
+/* Cursor position: before the first row, on row sKey, or past the last row */
+struct sKeyTablePos {
+	enum { BEFORE_FIRST, ON_ROW, AFTER_LAST };
+	unsigned int ulWhere = BEFORE_FIRST;
+	sObjectTableKey sKey;
+};
 
 struct sBookmarkPosition {
 	unsigned int	ulFirstRowPosition;
-	ECTableRow*		lpPosition;
+	sKeyTablePos	sPosition;
 };
 
 typedef std::map<unsigned int, sBookmarkPosition> ECBookmarkMap;
@@ -176,32 +186,67 @@ public:
 	ECRESULT LowerBound(const std::vector<ECSortCol> &);
 	ECRESULT Find(const std::vector<ECSortCol> &, sObjectTableKey *);
 	ECRESULT UpdatePartialSortKey(sObjectTableKey *lpsRowItem, size_t ulColumn, const ECSortCol &, sObjectTableKey *lpsPrevRow, bool *lpfHidden, ECKeyTable::UpdateType *lpulAction);
-	ECRESULT 	GetRow(sObjectTableKey *lpsRowItem, ECTableRow **lpRow);
+	ECRESULT GetRow(const sObjectTableKey *, std::vector<ECSortCol> *cols, bool *hidden = nullptr);
 	size_t GetObjectSize();
 
+	/*
+	 * Tables showing the same rows can share them: Share() hands out the
+	 * rows, Adopt() makes them the rows of another table as well, which
+	 * keeps its own cursor and bookmarks. Shared rows are only changed in
+	 * place between LockRows() and UnlockRows(), and the change then shows
+	 * in all tables using them; other changes go to a copy of the rows
+	 * that the table makes for itself first, as does Unshare().
+	 */
+	struct kt_tree;
+	std::shared_ptr<kt_tree> Share();
+	ECRESULT Adopt(const std::shared_ptr<kt_tree> &);
+	void Unshare();
+	void LockRows();
+	void UnlockRows();
+	static size_t RowsSize(kt_tree &, unsigned int *users = nullptr);
+
 private:
-	KC_HIDDEN ECRESULT UpdateCounts(ECTableRow *);
-	KC_HIDDEN ECRESULT CurrentRow(ECTableRow *, unsigned int *current_row);
-	KC_HIDDEN ECRESULT InvalidateBookmark(ECTableRow *);
-
-	// Functions for implementation AVL balancing
-	KC_HIDDEN void RotateL(ECTableRow *pivot);
-	KC_HIDDEN void RotateR(ECTableRow *pivot);
-	KC_HIDDEN void RotateLR(ECTableRow *pivot);
-	KC_HIDDEN void RotateRL(ECTableRow *pivot);
-	KC_HIDDEN unsigned int GetHeight(ECTableRow *root) const { return root->ulHeight; }
-	KC_HIDDEN int GetBalance(ECTableRow *root);
-	KC_HIDDEN void Restructure(ECTableRow *pivot);
-	KC_HIDDEN void RestructureRecursive(ECTableRow *);
+	struct kt_entry;
+	struct kt_node;
+	struct kt_leaf;
+	struct kt_inner;
+	struct kt_lock;
+	/* A row position that is only valid while the table is not modified */
+	struct kt_iter {
+		kt_leaf *lf = nullptr;
+		unsigned int i = 0, where = sKeyTablePos::BEFORE_FIRST;
+	};
+
+	KC_HIDDEN kt_iter Locate(const sKeyTablePos &) const;
+	KC_HIDDEN kt_iter LocateId(const sObjectTableKey &) const;
+	KC_HIDDEN static sKeyTablePos Store(const kt_iter &);
+	KC_HIDDEN kt_iter SeekVisible(unsigned int) const;
+	KC_HIDDEN unsigned int Rank(const kt_iter &) const;
+	KC_HIDDEN ECRESULT CurrentRow(const sKeyTablePos &, unsigned int *current_row);
+	KC_HIDDEN ECRESULT InvalidateBookmark(const sObjectTableKey &);
+	KC_HIDDEN void SetHidden(const kt_iter &, bool);
+
+	// B+-tree maintenance
+	KC_HIDDEN kt_leaf *FindLeaf(const std::string &key, bool lower) const;
+	KC_HIDDEN void SplitLeaf(kt_leaf *);
+	KC_HIDDEN void SplitInner(kt_inner *);
+	KC_HIDDEN void InsertChild(kt_node *left, kt_node *right, const std::string &sep);
+	KC_HIDDEN void RemoveChild(kt_inner *, kt_node *);
+	KC_HIDDEN void Rebalance(kt_node *);
+	KC_HIDDEN void AddVisible(kt_node *, int);
+	KC_HIDDEN static void FreeNode(kt_node *);
+	KC_HIDDEN static kt_node *CloneNode(const kt_node *, kt_inner *parent, kt_leaf *&last, std::unordered_map<sObjectTableKey, kt_leaf *> &);
+	KC_HIDDEN void Attach(const std::shared_ptr<kt_tree> &);
+	KC_HIDDEN void Detach();
+	KC_HIDDEN void CopyOnWrite();
 
 	// Advance / reverse cursor by one position
-	KC_HIDDEN void Next();
-	KC_HIDDEN void Prev();
+	KC_HIDDEN void Next(kt_iter &) const;
+	KC_HIDDEN void Prev(kt_iter &) const;
 
-	std::recursive_mutex mLock; /* Locks the entire b-tree */
-	ECTableRow				*lpRoot;		// The root node, which is infinitely 'low', ie all nodes are such that *node > *root
-	ECTableRow				*lpCurrent;		// The current node
-	ECTableRowMap			mapRow;
+	std::recursive_mutex mLock; /* Locks m_tree; the rows have their own lock */
+	std::shared_ptr<kt_tree> m_tree, m_locked;
+	sKeyTablePos m_current;
 	ECBookmarkMap			m_mapBookmarks;
 	unsigned int			m_ulBookmarkPosition;
 };
@@ -0,0 +1,113 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <kopano/zcdefs.h>
+#include <kopano/kcodes.h>
+
+namespace KC {
+
+/**
+ * Content-defined chunking (FastCDC: gear rolling hash with normalized
+ * chunk sizes). Cut points depend only on the bytes just before them, so an
+ * insertion or edit in a stream only changes the chunks around it.
+ *
+ * The gear table is fixed; changing it or the size parameters only means
+ * that new chunks will not match old ones.
+ */
+class KC_EXPORT cdc_chunker final {
+	public:
+	cdc_chunker(size_t min = 8192, size_t avg = 32768, size_t max = 131072);
+	/*
+	 * Returns the length of the chunk at the start of @p. @z must be at
+	 * least max_size() unless this is the end of the stream.
+	 */
+	size_t next(const void *p, size_t z) const;
+	size_t min_size() const { return m_min; }
+	size_t max_size() const { return m_max; }
+
+	private:
+	size_t m_min, m_avg, m_max;
+	uint64_t m_mask_s, m_mask_l;
+};
+
+struct cdc_chunk {
+	std::string md; /* SHA-256, binary */
+	size_t size;
+};
+
+/**
+ * Manifest of a chunked object: its total size, the name under which it
+ * holds references to its chunks, and the chunk list in stream order.
+ */
+struct cdc_manifest {
+	uint64_t size = 0;
+	std::string holder;
+	std::vector<cdc_chunk> chunks;
+
+	std::string format() const;
+	bool parse(const std::string &);
+};
+
+/**
+ * Chunk store. Chunks live in @root under their hash in the same
+ * two-level sharded layout as files_v2 instances (ab/cd/<hash>), each with
+ * a holder/ directory with one entry per referencing object. The last
+ * holder to go removes the chunk.
+ */
+class KC_EXPORT cdc_store final {
+	public:
+	cdc_store(const std::string &root, bool sync = false);
+	ECRESULT put(const std::string &md, const void *data, size_t z, const std::string &holder);
+	ECRESULT get(const std::string &md, void *data, size_t z) const;
+	ECRESULT release(const std::string &md, const std::string &holder);
+	/* Releases all chunks of a manifest (each distinct chunk once) */
+	ECRESULT release(const cdc_manifest &);
+	std::string chunk_dir(const std::string &md) const;
+	const std::string &root() const { return m_root; }
+
+	private:
+	std::string m_root;
+	bool m_sync;
+};
+
+/**
+ * Splits a stream into chunks and puts them into a cdc_store, building up
+ * the manifest. Data may be fed in pieces of any size.
+ */
+class KC_EXPORT cdc_writer final {
+	public:
+	cdc_writer(cdc_store &, const cdc_chunker &, const std::string &holder);
+	ECRESULT write(const void *, size_t);
+	ECRESULT finish();
+	/* Drops the references taken so far */
+	void abort();
+	const cdc_manifest &manifest() const { return m_manifest; }
+
+	private:
+	ECRESULT emit(size_t);
+
+	cdc_store &m_store;
+	const cdc_chunker &m_chunker;
+	cdc_manifest m_manifest;
+	std::string m_buf;
+	size_t m_pos = 0;
+};
+
+struct cdc_stats {
+	/* Objects: files_v2 instances, stored whole or as a manifest */
+	size_t objects = 0, references = 0, chunked = 0;
+	/* Bytes as seen by users, one copy per instance, and on disk */
+	uint64_t logical = 0, instance_bytes = 0, stored = 0;
+	/* Chunk store */
+	size_t chunks = 0, chunk_refs = 0;
+	uint64_t manifest_bytes = 0, chunk_bytes = 0;
+};
+
+extern KC_EXPORT ECRESULT cdc_scan(const std::string &basepath, cdc_stats *);
+
+} /* namespace */
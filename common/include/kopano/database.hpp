@@ -1,6 +1,9 @@
 #pragma once
+#include <initializer_list>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <mapidefs.h>
 #include <mysql.h>
 #include <kopano/zcdefs.h>
@@ -66,6 +69,77 @@ class KC_EXPORT DB_RESULT KC_FINAL {
 	KDatabase *m_db = nullptr;
 };
 
+/**
+ * A typed parameter for the prepared statement functions of KDatabase.
+ * Integers are bound by value; strings and binaries are bound by reference
+ * and must stay alive until the call returns.
+ */
+class KC_EXPORT DB_PARAM KC_FINAL {
+	public:
+	DB_PARAM(std::nullptr_t) : m_type(MYSQL_TYPE_NULL) {}
+	DB_PARAM(int v) : m_type(MYSQL_TYPE_LONGLONG) { m_val.i64 = v; }
+	DB_PARAM(long v) : m_type(MYSQL_TYPE_LONGLONG) { m_val.i64 = v; }
+	DB_PARAM(long long v) : m_type(MYSQL_TYPE_LONGLONG) { m_val.i64 = v; }
+	DB_PARAM(unsigned int v) : m_type(MYSQL_TYPE_LONGLONG), m_unsigned(true) { m_val.u64 = v; }
+	DB_PARAM(unsigned long v) : m_type(MYSQL_TYPE_LONGLONG), m_unsigned(true) { m_val.u64 = v; }
+	DB_PARAM(unsigned long long v) : m_type(MYSQL_TYPE_LONGLONG), m_unsigned(true) { m_val.u64 = v; }
+	DB_PARAM(const std::string &s) : m_type(MYSQL_TYPE_STRING), m_data(s.data()), m_len(s.size()) {}
+	DB_PARAM(const void *p, size_t z) : m_type(MYSQL_TYPE_BLOB), m_data(p), m_len(z) {}
+	DB_PARAM(const SBinary &b) : m_type(MYSQL_TYPE_BLOB), m_data(b.lpb), m_len(b.cb) {}
+
+	private:
+	enum enum_field_types m_type;
+	bool m_unsigned = false;
+	union {
+		long long i64;
+		unsigned long long u64;
+	} m_val;
+	const void *m_data = nullptr;
+	size_t m_len = 0;
+
+	friend class KDatabase;
+};
+
+struct kd_stmt;
+
+/**
+ * Result of a prepared SELECT. Rows are fetched with the binary protocol:
+ * integer columns are returned as integers, and string/binary columns are
+ * returned as-is, without any text conversion or escaping.
+ *
+ * The result borrows the statement from the connection's statement cache;
+ * it must not outlive the KDatabase object it was obtained from.
+ */
+class KC_EXPORT DB_STMT_RESULT KC_FINAL {
+	public:
+	DB_STMT_RESULT() = default;
+	DB_STMT_RESULT(DB_STMT_RESULT &&o) noexcept : m_stmt(o.m_stmt) { o.m_stmt = nullptr; }
+	~DB_STMT_RESULT();
+	DB_STMT_RESULT &operator=(DB_STMT_RESULT &&o) noexcept;
+	operator bool() const { return m_stmt != nullptr; }
+
+	size_t get_num_rows() const;
+	bool fetch_row();
+	bool is_null(size_t col) const;
+	unsigned long long get_u64(size_t col) const;
+	unsigned int get_uint(size_t col) const { return get_u64(col); }
+	long long get_i64(size_t col) const;
+	/* Pointer to the (NUL-terminated) column data; valid until the next fetch_row */
+	const char *get_data(size_t col, size_t *len = nullptr) const;
+	std::string get_string(size_t col) const;
+
+	private:
+	DB_STMT_RESULT(kd_stmt *s) : m_stmt(s) {}
+
+	kd_stmt *m_stmt = nullptr;
+
+	friend class KDatabase;
+};
+
+struct KC_EXPORT kd_stmt_delete {
+	void operator()(kd_stmt *) const noexcept;
+};
+
 class kt_completion {
 	public:
 	virtual ECRESULT Commit() = 0;
@@ -108,6 +182,17 @@ class KC_EXPORT KDatabase : public kt_completion {
 	/* Sequence generator - Do not call this from within a transaction. */
 	virtual ECRESULT DoSequence(const std::string &seq, unsigned int count, unsigned long long *first_id);
 	virtual ECRESULT DoUpdate(const std::string &query, unsigned int *affect = nullptr);
+	/*
+	 * Prepared statements. @tmpl is a query with "?" placeholders; the
+	 * server-side statement is prepared once per connection and kept in a
+	 * cache keyed by the template text, so @tmpl must not embed values.
+	 * Only fixed-shape single-row lookups are worth porting; IN()-list
+	 * batches and results that go to DB_ROW converters stay on DoSelect.
+	 */
+	virtual ECRESULT DoSelectPrepared(const char *tmpl, const DB_PARAM *, size_t nparam, DB_STMT_RESULT *);
+	ECRESULT DoSelectPrepared(const char *tmpl, std::initializer_list<DB_PARAM> p, DB_STMT_RESULT *r) { return DoSelectPrepared(tmpl, p.begin(), p.size(), r); }
+	virtual ECRESULT DoUpdatePrepared(const char *tmpl, const DB_PARAM *, size_t nparam, unsigned int *affect = nullptr, unsigned int *insert_id = nullptr);
+	ECRESULT DoUpdatePrepared(const char *tmpl, std::initializer_list<DB_PARAM> p, unsigned int *affect = nullptr, unsigned int *insert_id = nullptr) { return DoUpdatePrepared(tmpl, p.begin(), p.size(), affect, insert_id); }
 	std::string Escape(const std::string &);
 	std::string EscapeBinary(const void *, size_t);
 	std::string EscapeBinary(const std::string &s) { return EscapeBinary(s.c_str(), s.size()); }
@@ -147,6 +232,8 @@ class KC_EXPORT KDatabase : public kt_completion {
 	bool isConnected() const { return m_bConnected; }
 	ECRESULT IsEngineSupported(const char *);
 	virtual ECRESULT Query(const std::string &q);
+	/* Reestablish a lost connection; the default policy is not to. */
+	virtual ECRESULT Reconnect() { return KCERR_DATABASE_ERROR; }
 	ECRESULT I_Update(const std::string &q, unsigned int *affected);
 
 	MYSQL m_lpMySQL;
@@ -157,8 +244,12 @@ class KC_EXPORT KDatabase : public kt_completion {
 	private:
 	void FreeResult_internal(void *) noexcept;
 	ECRESULT setup_gcm(size_t, bool);
+	kd_stmt *stmt_prepare(const char *tmpl);
+	ECRESULT stmt_execute(const char *tmpl, const DB_PARAM *, size_t nparam, kd_stmt **);
+	void stmt_flush() noexcept;
 
 	std::recursive_mutex m_hMutexMySql;
+	std::unordered_map<std::string, std::unique_ptr<kd_stmt, kd_stmt_delete>> m_stmt_cache;
 	bool m_bAutoLock = true;
 
 	friend class DB_RESULT;
@@ -0,0 +1,91 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace KC {
+
+/**
+ * Bounded lock-free queue for many producers and a single consumer (after
+ * D. Vyukov's bounded MPMC queue). Each cell carries a sequence number that
+ * tells whether it is free for the producer that claimed position @pos
+ * (seq == pos) or holds an element for the consumer (seq == pos + 1).
+ *
+ * push() fails when the ring is full; callers need a fallback. pop() must
+ * only ever be called by one thread at a time.
+ */
+template<typename T> class mpsc_ring final {
+	public:
+	/* @n is rounded up to a power of two */
+	mpsc_ring(size_t n)
+	{
+		size_t z = 2;
+		while (z < n)
+			z <<= 1;
+		m_mask = z - 1;
+		m_cells.reset(new cell[z]);
+		for (size_t i = 0; i < z; ++i)
+			m_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	bool push(T &&v)
+	{
+		auto pos = m_head.load(std::memory_order_relaxed);
+		for (;;) {
+			auto &c = m_cells[pos & m_mask];
+			auto seq = c.seq.load(std::memory_order_acquire);
+			auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (dif == 0) {
+				if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					c.val = std::move(v);
+					c.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool pop(T &v)
+	{
+		auto pos = m_tail.load(std::memory_order_relaxed);
+		auto &c = m_cells[pos & m_mask];
+		auto seq = c.seq.load(std::memory_order_acquire);
+		if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0)
+			return false;
+		v = std::move(c.val);
+		c.seq.store(pos + m_mask + 1, std::memory_order_release);
+		m_tail.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/* Number of elements; exact only when no push is in progress */
+	size_t size() const
+	{
+		auto tail = m_tail.load(std::memory_order_relaxed);
+		return m_head.load(std::memory_order_relaxed) - tail;
+	}
+	size_t capacity() const { return m_mask + 1; }
+
+	private:
+	struct cell {
+		std::atomic<size_t> seq;
+		T val{};
+	};
+
+	std::unique_ptr<cell[]> m_cells;
+	size_t m_mask = 0;
+	alignas(64) std::atomic<size_t> m_head{0};
+	alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+} /* namespace */
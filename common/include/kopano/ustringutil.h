@@ -5,6 +5,7 @@
 #pragma once
 #include <kopano/zcdefs.h>
 #include <kopano/kcodes.h>
+#include <memory>
 #include <string>
 #include <unicode/coll.h>
 #include <unicode/sortkey.h>
@@ -50,7 +51,45 @@ extern KC_EXPORT ECRESULT LocaleIdToLCID(const char *locale, unsigned int *id);
 extern KC_EXPORT ECRESULT LCIDToLocaleId(unsigned int id, const char **locale);
 extern KC_EXPORT std::string createSortKeyDataFromUTF8(const char *s, int ncap, const ECLocale &);
 extern KC_EXPORT int compareSortKeys(const std::string &, const std::string &);
+extern KC_EXPORT int compareSortKeys(const void *, size_t, const void *, size_t);
 extern KC_EXPORT std::string createSortKeyData(const char *s, int ncap, const ECLocale &);
 extern KC_EXPORT std::string createSortKeyData(const wchar_t *s, int ncap, const ECLocale &);
 
+/*
+ * A needle prepared for repeatedly calling u8_(i)equals, u8_(i)startswith
+ * or u8_(i)contains on many haystacks. Results are identical to those
+ * functions; pure-ASCII input is handled without converting to UTF-16.
+ */
+class KC_EXPORT u8_matcher final {
+	public:
+	enum mode { EQUALS, STARTSWITH, CONTAINS };
+	u8_matcher(const char *needle, enum mode, bool icase);
+	bool operator()(const char *haystack, size_t len) const;
+
+	private:
+	bool ascii_match(const char *, size_t) const;
+	bool projected_match(const char *, size_t) const;
+	bool icu_match(const char *) const;
+
+	std::string m_needle;
+	U_ICU_NAMESPACE::UnicodeString m_uneedle;
+	enum mode m_mode;
+	bool m_icase, m_ascii, m_valid = true;
+	unsigned int m_skip[256];
+};
+
+/*
+ * The right-hand side of u8_icompare, prepared for comparing many strings
+ * against it with a single collator.
+ */
+class KC_EXPORT u8_icomparer final {
+	public:
+	u8_icomparer(const char *s2, const ECLocale &);
+	int operator()(const char *s1) const;
+
+	private:
+	std::unique_ptr<U_ICU_NAMESPACE::Collator> m_collator;
+	U_ICU_NAMESPACE::UnicodeString m_folded;
+};
+
 } /* namespace */
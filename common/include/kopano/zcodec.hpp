@@ -0,0 +1,74 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <memory>
+#include <cstdint>
+#include <sys/types.h>
+#include <kopano/zcdefs.h>
+#include <kopano/kcodes.h>
+
+namespace KC {
+
+/**
+ * Compression codecs for attachment files. Readers determine the codec from
+ * the magic number at the start of the file, so files written with any codec
+ * (including the gzip files of older versions) can always be read back,
+ * regardless of what is configured for writing.
+ */
+enum class zcodec : unsigned char {
+	none, gzip, zstd, lz4,
+};
+
+extern KC_EXPORT bool zcodec_parse(const char *, zcodec *);
+extern KC_EXPORT const char *zcodec_name(zcodec);
+/* Whether the server was built with support for the codec */
+extern KC_EXPORT bool zcodec_available(zcodec);
+/* Identifies the codec from (at least 4) leading bytes of a file */
+extern KC_EXPORT zcodec zcodec_detect(const void *, size_t);
+
+/**
+ * Decompressing reader on a file descriptor. The descriptor is not owned
+ * and must be positioned at the start of the file.
+ */
+class KC_EXPORT zreader {
+	public:
+	virtual ~zreader() = default;
+	/*
+	 * Fills @data with up to @z uncompressed bytes. Returns less than @z
+	 * only at the end of the stream, and -1 on error.
+	 */
+	virtual ssize_t read(void *data, size_t z) = 0;
+	/* Detects the codec; zcodec::none yields a pass-through reader */
+	static std::unique_ptr<zreader> open(int fd, zcodec * = nullptr);
+};
+
+/**
+ * Compressing writer on a file descriptor (not owned).
+ *
+ * zstd and lz4 output is cut into independently compressed frames of
+ * @block bytes, of which up to @threads are compressed concurrently; a
+ * trailing skippable frame records the total uncompressed size for
+ * zcodec_size. gzip output is a single member, as before, so that the
+ * ISIZE trailer stays meaningful.
+ */
+class KC_EXPORT zwriter {
+	public:
+	virtual ~zwriter() = default;
+	virtual ECRESULT write(const void *, size_t) = 0;
+	/* Flushes all pending output; the writer is unusable afterwards */
+	virtual ECRESULT finish() = 0;
+	static std::unique_ptr<zwriter> create(int fd, zcodec, int level,
+		unsigned int threads = 1, size_t block = 1048576);
+};
+
+/*
+ * Uncompressed size of a compressed file, from its trailer where possible,
+ * else by decompressing it. Does not preserve the file offset. @exact is
+ * set to false when the size is only the gzip ISIZE, which is modulo 4 GiB
+ * and covers only the last member of a multi-member file.
+ */
+extern KC_EXPORT ECRESULT zcodec_size(int fd, uint64_t *, bool *exact = nullptr);
+
+} /* namespace */
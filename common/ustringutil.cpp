@@ -53,10 +53,14 @@ At some point we need to rewqrite these functions to do all the conversion on th
 #include <kopano/platform.h>
 #include <kopano/ustringutil.h>
 #include <kopano/CommonUtil.h>
+#include <algorithm>
+#include <bitset>
 #include <cassert>
 #include <clocale>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <unicode/unorm.h>
 #include <unicode/coll.h>
@@ -64,6 +68,7 @@ At some point we need to rewqrite these functions to do all the conversion on th
 #include <unicode/coleitr.h>
 #include <unicode/normlzr.h>
 #include <unicode/ustring.h>
+#include <unicode/utf8.h>
 #include <kopano/charset/convert.h>
 
 /*
@@ -185,27 +190,24 @@ bool str_iequals(const char *s1, const char *s2, const ECLocale &locale)
  * @retval	true	The strings are canonically equivalent
  * @retval	false	The strings are not canonically equivalent
  */
-static bool str_startswith_int(UnicodeString &&s1, UnicodeString &&s2, bool icase = false)
+static bool nfd_normalize(UnicodeString &&in, UnicodeString &out)
 {
 	UErrorCode err = U_ZERO_ERROR;
-	/* Force normalization; need it for the proper prefix length. */
-	UnicodeString r1, r2;
 #ifdef HAVE_NORMALIZER2
 	auto nfd = Normalizer2::getNFDInstance(err);
 	if (U_FAILURE(err))
 		return false;
-	nfd->normalize(std::move(s1), r1, err);
-	if (U_FAILURE(err))
-		return false;
-	nfd->normalize(std::move(s2), r2, err);
+	nfd->normalize(std::move(in), out, err);
 #else
-	Normalizer::normalize(std::move(s1), UNORM_NFD, 0, r1, err);
-	if (U_FAILURE(err))
-		return false;
-	Normalizer::normalize(std::move(s2), UNORM_NFD, 0, r2, err);
+	Normalizer::normalize(std::move(in), UNORM_NFD, 0, out, err);
 #endif
-	if (U_FAILURE(err))
-		return false;
+	return U_SUCCESS(err);
+}
+
+/* @r1 and @r2 must be in NFD already */
+static bool nfd_startswith(const UnicodeString &r1, const UnicodeString &r2, bool icase)
+{
+	UErrorCode err = U_ZERO_ERROR;
 	if (r2.length() > r1.length())
 		return false;
 	return unorm_compare(r1.getBuffer(), r2.length(), r2.getBuffer(),
@@ -213,6 +215,16 @@ static bool str_startswith_int(UnicodeString &&s1, UnicodeString &&s2, bool icas
 	       U_SUCCESS(err);
 }
 
+static bool str_startswith_int(UnicodeString &&s1, UnicodeString &&s2, bool icase = false)
+{
+	/* Force normalization; need it for the proper prefix length. */
+	UnicodeString r1, r2;
+	if (!nfd_normalize(std::move(s1), r1) ||
+	    !nfd_normalize(std::move(s2), r2))
+		return false;
+	return nfd_startswith(r1, r2, icase);
+}
+
 bool str_startswith(const char *s1, const char *s2, const ECLocale &locale)
 {
 	assert(s1);
@@ -288,23 +300,9 @@ int str_icompare(const char *s1, const char *s2, const ECLocale &locale)
  */
 static bool str_contains_int(UnicodeString &&text, UnicodeString &&needle, bool icase = false)
 {
-	UErrorCode err = U_ZERO_ERROR;
 	UnicodeString rt, rn;
-#ifdef HAVE_NORMALIZER2
-	auto nfd = Normalizer2::getNFDInstance(err);
-	if (U_FAILURE(err))
-		return false;
-	nfd->normalize(std::move(text), rt, err);
-	if (U_FAILURE(err))
-		return false;
-	nfd->normalize(std::move(needle), rn, err);
-#else
-	Normalizer::normalize(std::move(text), UNORM_NFD, 0, rt, err);
-	if (U_FAILURE(err))
-		return false;
-	Normalizer::normalize(std::move(needle), UNORM_NFD, 0, rn, err);
-#endif
-	if (U_FAILURE(err))
+	if (!nfd_normalize(std::move(text), rt) ||
+	    !nfd_normalize(std::move(needle), rn))
 		return false;
 	if (icase) {
 		rt.foldCase();
@@ -642,6 +640,254 @@ bool u8_icontains(const char *haystack, const char *needle, const ECLocale &loca
 	return str_contains_int(UTF8ToUnicode(haystack), UTF8ToUnicode(needle), true);
 }
 
+static inline unsigned char ascii_fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static bool is_ascii(const char *s, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t w;
+		memcpy(&w, s + i, sizeof(w));
+		if (w & 0x8080808080808080ULL)
+			return false;
+	}
+	for (; i < len; ++i)
+		if (static_cast<unsigned char>(s[i]) & 0x80)
+			return false;
+	return true;
+}
+
+/*
+ * What remains of a code point after NFD (and case folding), as far as it
+ * matters to an ASCII needle: its ASCII characters, with every run of
+ * non-ASCII ones replaced by a single 0x80 byte. Most non-ASCII code
+ * points leave nothing of interest; only those that do are in @map.
+ */
+struct u8_projection {
+	std::bitset<0x10000> has_ascii;
+	std::unordered_map<UChar32, std::string> map;
+};
+
+static bool ascii_projection(UChar32 cp, bool icase, std::string &out)
+{
+	UnicodeString r;
+	if (!nfd_normalize(UnicodeString(cp), r))
+		return false;
+	if (icase)
+		r.foldCase();
+	bool found = false;
+	out.clear();
+	for (int32_t i = 0; i < r.length(); ++i) {
+		auto c = r.charAt(i);
+		if (c < 0x80) {
+			out += static_cast<char>(c);
+			found = true;
+		} else if (out.empty() || out.back() != '\x80') {
+			out += '\x80';
+		}
+	}
+	return found;
+}
+
+static u8_projection make_projection(bool icase)
+{
+	u8_projection p;
+	std::string m;
+	for (UChar32 cp = 0x80; cp < 0x10000; ++cp) {
+		if (U_IS_SURROGATE(cp) || !ascii_projection(cp, icase, m))
+			continue;
+		p.has_ascii.set(cp);
+		p.map.emplace(cp, m);
+	}
+	return p;
+}
+
+static const u8_projection &get_projection(bool icase)
+{
+	static const u8_projection p[2] = {make_projection(false), make_projection(true)};
+	return p[icase];
+}
+
+/**
+ * Prepare @needle for matching against many haystacks.
+ *
+ * When the needle is pure ASCII, haystacks are first tried bytewise: an
+ * ASCII character is its own NFD form and (default) case folding maps
+ * ASCII only to ASCII, so a bytewise hit is always a hit in the Unicode
+ * sense. Only when that is inconclusive because the haystack contains
+ * non-ASCII characters, the normalizing ICU path is taken, except for
+ * substring searches: those look at the ASCII projection of the haystack
+ * (see u8_projection), which is only built when the haystack has a
+ * non-ASCII character that NFD or folding turns into ASCII (é, ß, K).
+ *
+ * Substring search uses Boyer-Moore-Horspool on the (folded) bytes.
+ */
+u8_matcher::u8_matcher(const char *needle, enum mode m, bool icase) :
+	m_needle(needle), m_mode(m), m_icase(icase),
+	m_ascii(is_ascii(needle, m_needle.size()))
+{
+	if (m_ascii) {
+		auto n = m_needle.size();
+		if (m_icase)
+			for (auto &c : m_needle)
+				c = ascii_fold(c);
+		for (size_t i = 0; i < ARRAY_SIZE(m_skip); ++i)
+			m_skip[i] = n;
+		for (size_t i = 0; i + 1 < n; ++i) {
+			unsigned char c = m_needle[i];
+			m_skip[c] = n - 1 - i;
+			if (m_icase && c >= 'a' && c <= 'z')
+				m_skip[c-('a'-'A')] = n - 1 - i;
+		}
+	}
+	/* Prepare the needle in the same way u8_equals & co. would */
+	m_uneedle = UTF8ToUnicode(needle);
+	if (m_mode == EQUALS)
+		return;
+	UnicodeString r;
+	m_valid = nfd_normalize(std::move(m_uneedle), r);
+	m_uneedle = std::move(r);
+	if (m_mode == CONTAINS && m_icase)
+		m_uneedle.foldCase();
+	/* Terminate once, so that u_strstr can use getBuffer() later on */
+	m_uneedle.getTerminatedBuffer();
+}
+
+bool u8_matcher::ascii_match(const char *s, size_t len) const
+{
+	auto n = m_needle.size();
+	auto z = reinterpret_cast<const unsigned char *>(s);
+	auto p = reinterpret_cast<const unsigned char *>(m_needle.data());
+	auto same = [&](const unsigned char *h, size_t cnt) {
+		if (!m_icase)
+			return memcmp(h, p, cnt) == 0;
+		for (size_t i = 0; i < cnt; ++i)
+			if (ascii_fold(h[i]) != p[i])
+				return false;
+		return true;
+	};
+
+	if (m_mode != CONTAINS)
+		return len >= n && same(z, n);
+	if (n == 0)
+		return true;
+	for (size_t pos = 0; pos + n <= len; pos += m_skip[z[pos+n-1]]) {
+		unsigned char last = m_icase ? ascii_fold(z[pos+n-1]) : z[pos+n-1];
+		if (last == p[n-1] && same(z + pos, n - 1))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Substring search of an ASCII needle in a non-ASCII @s. The needle can
+ * only match ASCII characters, which NFD and case folding never move across
+ * other characters, so the search on the projection is the one u_strstr
+ * would do on the normalized, folded text.
+ */
+bool u8_matcher::projected_match(const char *s, size_t len) const
+{
+	auto &proj = get_projection(m_icase);
+	std::string p, m;
+	bool useful = false;
+
+	p.reserve(len);
+	for (int32_t i = 0, n = len; i < n; ) {
+		UChar32 cp;
+		U8_NEXT(s, i, n, cp);
+		if (cp == 0)
+			break;
+		if (cp > 0 && cp < 0x80) {
+			p += static_cast<char>(cp);
+			continue;
+		}
+		const std::string *rep = nullptr;
+		if (cp >= 0x10000) {
+			if (ascii_projection(cp, m_icase, m))
+				rep = &m;
+		} else if (cp > 0 && proj.has_ascii.test(cp)) {
+			rep = &proj.map.at(cp);
+		}
+		if (rep != nullptr) {
+			p += *rep;
+			useful = true;
+		} else if (p.empty() || p.back() != '\x80') {
+			p += '\x80';
+		}
+	}
+	/* Without such characters, the bytewise search was conclusive */
+	return useful && ascii_match(p.c_str(), p.size());
+}
+
+bool u8_matcher::icu_match(const char *s) const
+{
+	if (!m_valid)
+		return false;
+	if (m_mode == EQUALS) {
+		UErrorCode err = U_ZERO_ERROR;
+		return Normalizer::compare(UTF8ToUnicode(s), m_uneedle,
+		       m_icase ? U_COMPARE_IGNORE_CASE : 0, err) == 0 &&
+		       U_SUCCESS(err);
+	}
+	UnicodeString r;
+	if (!nfd_normalize(UTF8ToUnicode(s), r))
+		return false;
+	if (m_mode == STARTSWITH)
+		return nfd_startswith(r, m_uneedle, m_icase);
+	if (m_icase)
+		r.foldCase();
+	return u_strstr(r.getTerminatedBuffer(), m_uneedle.getBuffer());
+}
+
+/**
+ * Match @haystack, which is @len bytes long, against the prepared needle.
+ */
+bool u8_matcher::operator()(const char *haystack, size_t len) const
+{
+	assert(haystack != nullptr);
+	if (!m_ascii)
+		return icu_match(haystack);
+	switch (m_mode) {
+	case EQUALS:
+		/* Non-ASCII text may still be canonically (or caselessly) equal */
+		if (!is_ascii(haystack, len))
+			return icu_match(haystack);
+		return len == m_needle.size() && ascii_match(haystack, len);
+	case STARTSWITH:
+		/* Only the leading part that could match matters */
+		if (!is_ascii(haystack, std::min(len, m_needle.size())))
+			return icu_match(haystack);
+		return ascii_match(haystack, len);
+	default:
+		if (ascii_match(haystack, len))
+			return true;
+		return !is_ascii(haystack, len) && projected_match(haystack, len);
+	}
+}
+
+u8_icomparer::u8_icomparer(const char *s2, const ECLocale &locale) :
+	m_folded(UTF8ToUnicode(s2))
+{
+	UErrorCode status = U_ZERO_ERROR;
+	m_collator.reset(Collator::createInstance(locale, status));
+	m_folded.foldCase();
+}
+
+/**
+ * Returns the same as u8_icompare(@s1, s2, locale).
+ */
+int u8_icomparer::operator()(const char *s1) const
+{
+	assert(s1 != nullptr);
+	UErrorCode status = U_ZERO_ERROR;
+	UnicodeString a = UTF8ToUnicode(s1);
+	a.foldCase();
+	return m_collator->compare(a, m_folded, status);
+}
+
 static const uint8_t utf8_widths[] = {
 	2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
 	3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,4,4,4,4,4,4,4,4,5,5,5,5,6,6,1,1,
@@ -1094,8 +1340,13 @@ std::string createSortKeyDataFromUTF8(const char *s, int nCap,
  */
 int compareSortKeys(const std::string &a, const std::string &b)
 {
-	CollationKey ckA(reinterpret_cast<const uint8_t *>(a.c_str()), a.size());
-	CollationKey ckB(reinterpret_cast<const uint8_t *>(b.c_str()), b.size());
+	return compareSortKeys(a.c_str(), a.size(), b.c_str(), b.size());
+}
+
+int compareSortKeys(const void *a, size_t az, const void *b, size_t bz)
+{
+	CollationKey ckA(static_cast<const uint8_t *>(a), az);
+	CollationKey ckB(static_cast<const uint8_t *>(b), bz);
 	UErrorCode status = U_ZERO_ERROR;
 	switch (ckA.compareTo(ckB, status)) {
 	case UCOL_LESS: return -1;
@@ -0,0 +1,649 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+#include <kopano/platform.h>
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD_H
+#	include <zstd.h>
+#endif
+#ifdef HAVE_LZ4FRAME_H
+#	include <lz4frame.h>
+#endif
+#include <kopano/ECLogger.h>
+#include <kopano/fileutil.hpp>
+#include <kopano/zcodec.hpp>
+
+namespace KC {
+
+/* as advised by http://www.zlib.net/manual.html, 128KB rather than 8KB */
+static constexpr size_t ZC_BUFSIZE = 128 * 1024;
+
+/*
+ * Trailer of block-compressed files: a skippable frame (valid in both the
+ * zstd and the lz4 frame format, and ignored by their decoders) holding a
+ * tag and the total uncompressed size, all little-endian.
+ */
+static constexpr uint32_t ZC_SKIP_MAGIC = 0x184D2A5B;
+static constexpr size_t ZC_TRAILER_SIZE = 20;
+static const char zc_tag[4] = {'K', 'C', 's', 'z'};
+
+static void zc_put_le(char *p, uint64_t v, unsigned int n)
+{
+	for (unsigned int i = 0; i < n; ++i, v >>= 8)
+		p[i] = v & 0xFF;
+}
+
+static uint64_t zc_get_le(const char *p, unsigned int n)
+{
+	uint64_t v = 0;
+	while (n-- > 0)
+		v = (v << 8) | static_cast<unsigned char>(p[n]);
+	return v;
+}
+
+/*
+ * Looks for the size trailer of a block-compressed file of @fsize bytes.
+ * Returns the uncompressed size, or -1 if there is none.
+ */
+static int64_t zc_trailer(int fd, off_t fsize)
+{
+	char t[ZC_TRAILER_SIZE];
+	if (fsize < static_cast<off_t>(sizeof(t)) ||
+	    pread(fd, t, sizeof(t), fsize - sizeof(t)) != sizeof(t) ||
+	    zc_get_le(&t[0], 4) != ZC_SKIP_MAGIC ||
+	    zc_get_le(&t[4], 4) != sizeof(t) - 8 ||
+	    memcmp(&t[8], zc_tag, sizeof(zc_tag)) != 0)
+		return -1;
+	return zc_get_le(&t[12], 8);
+}
+
+bool zcodec_parse(const char *s, zcodec *c)
+{
+	if (s == nullptr || *s == '\0' || strcmp(s, "gzip") == 0)
+		*c = zcodec::gzip;
+	else if (strcmp(s, "zstd") == 0)
+		*c = zcodec::zstd;
+	else if (strcmp(s, "lz4") == 0)
+		*c = zcodec::lz4;
+	else
+		return false;
+	return true;
+}
+
+const char *zcodec_name(zcodec c)
+{
+	switch (c) {
+	case zcodec::gzip: return "gzip";
+	case zcodec::zstd: return "zstd";
+	case zcodec::lz4:  return "lz4";
+	default:           return "none";
+	}
+}
+
+bool zcodec_available(zcodec c)
+{
+	switch (c) {
+	case zcodec::none:
+	case zcodec::gzip:
+		return true;
+#ifdef HAVE_ZSTD_H
+	case zcodec::zstd:
+		return true;
+#endif
+#ifdef HAVE_LZ4FRAME_H
+	case zcodec::lz4:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+zcodec zcodec_detect(const void *data, size_t z)
+{
+	auto p = static_cast<const unsigned char *>(data);
+	if (z >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+		return zcodec::gzip;
+	if (z >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+		return zcodec::zstd;
+	if (z >= 4 && p[0] == 0x04 && p[1] == 0x22 && p[2] == 0x4d && p[3] == 0x18)
+		return zcodec::lz4;
+	return zcodec::none;
+}
+
+namespace {
+
+class zreader_plain final : public zreader {
+	public:
+	zreader_plain(int fd) : m_fd(fd) {}
+	virtual ssize_t read(void *data, size_t z) override
+	{
+		auto ret = read_retry(m_fd, data, z);
+		if (ret < 0)
+			ec_log_err("zreader: read: %s", strerror(errno));
+		return ret;
+	}
+
+	private:
+	int m_fd;
+};
+
+/*
+ * Common input buffering of the decompressing readers. Input stops at
+ * @limit, so that our own trailer does not reach the zstd/lz4 decoders: past
+ * a skippable frame, they no longer tell whether the stream is complete.
+ */
+class zreader_buf : public zreader {
+	protected:
+	zreader_buf(int fd, uint64_t limit) :
+		m_fd(fd), m_in(new char[ZC_BUFSIZE]), m_left(limit)
+	{}
+	bool refill()
+	{
+		auto ret = read_retry(m_fd, m_in.get(), std::min(m_left, static_cast<uint64_t>(ZC_BUFSIZE)));
+		if (ret < 0) {
+			ec_log_err("zreader: read: %s", strerror(errno));
+			return false;
+		}
+		m_pos = 0;
+		m_len = ret;
+		m_left -= ret;
+		m_eof = ret == 0;
+		return true;
+	}
+
+	int m_fd;
+	std::unique_ptr<char[]> m_in;
+	uint64_t m_left;
+	size_t m_pos = 0, m_len = 0;
+	bool m_eof = false;
+};
+
+class zreader_gzip final : public zreader_buf {
+	public:
+	zreader_gzip(int fd) : zreader_buf(fd, UINT64_MAX)
+	{
+		m_init = inflateInit2(&m_zs, 15 + 16) == Z_OK;
+	}
+	~zreader_gzip()
+	{
+		if (m_init)
+			inflateEnd(&m_zs);
+	}
+	virtual ssize_t read(void *data, size_t z) override;
+
+	private:
+	z_stream m_zs{};
+	bool m_init = false, m_boundary = true, m_end = false, m_member = false;
+};
+
+ssize_t zreader_gzip::read(void *data, size_t z)
+{
+	if (!m_init) {
+		ec_log_err("zreader: inflateInit failed");
+		return -1;
+	}
+	auto out = static_cast<Bytef *>(data);
+	size_t done = 0;
+	while (done < z && !m_end) {
+		if (m_pos == m_len && !m_eof && !refill())
+			return -1;
+		if (m_pos == m_len && m_eof && m_boundary) {
+			m_end = true;
+			break;
+		}
+		m_zs.next_in   = reinterpret_cast<Bytef *>(&m_in[m_pos]);
+		m_zs.avail_in  = m_len - m_pos;
+		m_zs.next_out  = out + done;
+		m_zs.avail_out = std::min(z - done, static_cast<size_t>(UINT_MAX));
+		auto avail_out = m_zs.avail_out;
+		auto ret = inflate(&m_zs, Z_NO_FLUSH);
+		m_pos = m_len - m_zs.avail_in;
+		done += avail_out - m_zs.avail_out;
+		if (ret == Z_STREAM_END) {
+			/* Another member may follow (KC-104) */
+			inflateReset(&m_zs);
+			m_boundary = m_member = true;
+			continue;
+		} else if (ret == Z_DATA_ERROR && m_boundary && m_member) {
+			/* Trailing garbage after the last member, as gzread would */
+			m_end = true;
+			break;
+		} else if (ret == Z_BUF_ERROR && m_eof) {
+			ec_log_err("zreader: gzip stream is truncated");
+			return -1;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			ec_log_err("zreader: inflate: %s (%d)", m_zs.msg != nullptr ? m_zs.msg : "", ret);
+			return -1;
+		}
+		m_boundary = false;
+	}
+	return done;
+}
+
+#ifdef HAVE_ZSTD_H
+class zreader_zstd final : public zreader_buf {
+	public:
+	zreader_zstd(int fd, uint64_t limit) :
+		zreader_buf(fd, limit), m_ds(ZSTD_createDStream())
+	{
+		if (m_ds != nullptr)
+			ZSTD_initDStream(m_ds);
+	}
+	~zreader_zstd() { ZSTD_freeDStream(m_ds); }
+	virtual ssize_t read(void *data, size_t z) override;
+
+	private:
+	ZSTD_DStream *m_ds;
+	size_t m_hint = 0;
+};
+
+ssize_t zreader_zstd::read(void *data, size_t z)
+{
+	if (m_ds == nullptr) {
+		ec_log_err("zreader: ZSTD_createDStream failed");
+		return -1;
+	}
+	ZSTD_outBuffer out = {data, z, 0};
+	while (out.pos < out.size) {
+		if (m_pos == m_len && !m_eof && !refill())
+			return -1;
+		ZSTD_inBuffer in = {m_in.get(), m_len, m_pos};
+		auto before = out.pos;
+		auto ret = ZSTD_decompressStream(m_ds, &out, &in);
+		if (ZSTD_isError(ret)) {
+			ec_log_err("zreader: zstd: %s", ZSTD_getErrorName(ret));
+			return -1;
+		}
+		/* The hint is 0 at the end of a frame, until more input comes */
+		if (in.pos != m_pos || out.pos != before) {
+			m_pos = in.pos;
+			m_hint = ret;
+		} else if (m_eof) {
+			if (m_hint != 0) {
+				ec_log_err("zreader: zstd stream is truncated");
+				return -1;
+			}
+			break;
+		}
+	}
+	return out.pos;
+}
+#endif
+
+#ifdef HAVE_LZ4FRAME_H
+class zreader_lz4 final : public zreader_buf {
+	public:
+	zreader_lz4(int fd, uint64_t limit) : zreader_buf(fd, limit)
+	{
+		if (LZ4F_isError(LZ4F_createDecompressionContext(&m_dc, LZ4F_VERSION)))
+			m_dc = nullptr;
+	}
+	~zreader_lz4() { LZ4F_freeDecompressionContext(m_dc); }
+	virtual ssize_t read(void *data, size_t z) override;
+
+	private:
+	LZ4F_decompressionContext_t m_dc = nullptr;
+	size_t m_hint = 0;
+};
+
+ssize_t zreader_lz4::read(void *data, size_t z)
+{
+	if (m_dc == nullptr) {
+		ec_log_err("zreader: LZ4F_createDecompressionContext failed");
+		return -1;
+	}
+	auto out = static_cast<char *>(data);
+	size_t done = 0;
+	while (done < z) {
+		if (m_pos == m_len && !m_eof && !refill())
+			return -1;
+		size_t dsize = z - done, ssize = m_len - m_pos;
+		auto ret = LZ4F_decompress(m_dc, out + done, &dsize, &m_in[m_pos], &ssize, nullptr);
+		m_pos += ssize;
+		done += dsize;
+		if (LZ4F_isError(ret)) {
+			ec_log_err("zreader: lz4: %s", LZ4F_getErrorName(ret));
+			return -1;
+		}
+		if (ssize != 0 || dsize != 0) {
+			m_hint = ret;
+		} else if (m_eof) {
+			if (m_hint != 0) {
+				ec_log_err("zreader: lz4 stream is truncated");
+				return -1;
+			}
+			break;
+		}
+	}
+	return done;
+}
+#endif
+
+class zwriter_gzip final : public zwriter {
+	public:
+	zwriter_gzip(int fd, int level) : m_fd(fd), m_out(new Bytef[ZC_BUFSIZE])
+	{
+		m_init = deflateInit2(&m_zs, std::min(std::max(level, 1), 9),
+		         Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+	}
+	~zwriter_gzip()
+	{
+		if (m_init)
+			deflateEnd(&m_zs);
+	}
+	virtual ECRESULT write(const void *, size_t) override;
+	virtual ECRESULT finish() override;
+
+	private:
+	ECRESULT run(int flush);
+
+	int m_fd;
+	std::unique_ptr<Bytef[]> m_out;
+	z_stream m_zs{};
+	bool m_init = false;
+};
+
+ECRESULT zwriter_gzip::run(int flush)
+{
+	int ret;
+	do {
+		m_zs.next_out  = m_out.get();
+		m_zs.avail_out = ZC_BUFSIZE;
+		ret = deflate(&m_zs, flush);
+		if (ret == Z_STREAM_ERROR) {
+			ec_log_err("zwriter: deflate failed");
+			return KCERR_DATABASE_ERROR;
+		}
+		size_t have = ZC_BUFSIZE - m_zs.avail_out;
+		if (have > 0 && write_retry(m_fd, m_out.get(), have) != static_cast<ssize_t>(have)) {
+			ec_log_err("zwriter: write: %s", strerror(errno));
+			return KCERR_DATABASE_ERROR;
+		}
+	} while (m_zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+	return erSuccess;
+}
+
+ECRESULT zwriter_gzip::write(const void *data, size_t z)
+{
+	if (!m_init)
+		return KCERR_DATABASE_ERROR;
+	auto p = static_cast<const Bytef *>(data);
+	while (z > 0) {
+		auto n = std::min(z, static_cast<size_t>(UINT_MAX));
+		m_zs.next_in  = const_cast<Bytef *>(p);
+		m_zs.avail_in = n;
+		auto ret = run(Z_NO_FLUSH);
+		if (ret != erSuccess)
+			return ret;
+		p += n;
+		z -= n;
+	}
+	return erSuccess;
+}
+
+ECRESULT zwriter_gzip::finish()
+{
+	if (!m_init)
+		return KCERR_DATABASE_ERROR;
+	m_zs.next_in  = nullptr;
+	m_zs.avail_in = 0;
+	return run(Z_FINISH);
+}
+
+/* Compresses one block into a self-contained frame; empty on failure */
+static std::string zc_compress_block(zcodec codec, int level, const std::string &in)
+{
+	std::string out;
+#ifdef HAVE_ZSTD_H
+	if (codec == zcodec::zstd) {
+		out.resize(ZSTD_compressBound(in.size()));
+		auto ret = ZSTD_compress(&out[0], out.size(), in.data(), in.size(), level);
+		if (ZSTD_isError(ret)) {
+			ec_log_err("zwriter: zstd: %s", ZSTD_getErrorName(ret));
+			return {};
+		}
+		out.resize(ret);
+	}
+#endif
+#ifdef HAVE_LZ4FRAME_H
+	if (codec == zcodec::lz4) {
+		LZ4F_preferences_t pref;
+		memset(&pref, 0, sizeof(pref));
+		pref.frameInfo.contentSize = in.size();
+		pref.compressionLevel = level;
+		out.resize(LZ4F_compressFrameBound(in.size(), &pref));
+		auto ret = LZ4F_compressFrame(&out[0], out.size(), in.data(), in.size(), &pref);
+		if (LZ4F_isError(ret)) {
+			ec_log_err("zwriter: lz4: %s", LZ4F_getErrorName(ret));
+			return {};
+		}
+		out.resize(ret);
+	}
+#endif
+	return out;
+}
+
+class zwriter_block final : public zwriter {
+	public:
+	zwriter_block(int fd, zcodec codec, int level, unsigned int threads, size_t block) :
+		m_fd(fd), m_codec(codec), m_level(level),
+		m_threads(std::max(threads, 1U)), m_block(std::max(block, ZC_BUFSIZE))
+	{}
+	virtual ECRESULT write(const void *, size_t) override;
+	virtual ECRESULT finish() override;
+
+	private:
+	ECRESULT submit();
+	ECRESULT drain_one();
+
+	int m_fd;
+	zcodec m_codec;
+	int m_level;
+	unsigned int m_threads;
+	size_t m_block;
+	uint64_t m_total = 0;
+	std::string m_buf;
+	std::deque<std::future<std::string>> m_pending;
+};
+
+ECRESULT zwriter_block::drain_one()
+{
+	auto frame = m_pending.front().get();
+	m_pending.pop_front();
+	if (frame.empty())
+		return KCERR_DATABASE_ERROR;
+	if (write_retry(m_fd, frame.data(), frame.size()) != static_cast<ssize_t>(frame.size())) {
+		ec_log_err("zwriter: write: %s", strerror(errno));
+		return KCERR_DATABASE_ERROR;
+	}
+	return erSuccess;
+}
+
+ECRESULT zwriter_block::submit()
+{
+	while (m_pending.size() >= m_threads) {
+		auto ret = drain_one();
+		if (ret != erSuccess)
+			return ret;
+	}
+	/* With a single thread, blocks are compressed inline in drain_one */
+	m_pending.emplace_back(std::async(m_threads > 1 ? std::launch::async : std::launch::deferred,
+		zc_compress_block, m_codec, m_level, std::move(m_buf)));
+	m_buf = std::string();
+	return erSuccess;
+}
+
+ECRESULT zwriter_block::write(const void *data, size_t z)
+{
+	auto p = static_cast<const char *>(data);
+	while (z > 0) {
+		if (m_buf.capacity() < m_block)
+			m_buf.reserve(m_block);
+		auto n = std::min(z, m_block - m_buf.size());
+		m_buf.append(p, n);
+		m_total += n;
+		p += n;
+		z -= n;
+		if (m_buf.size() < m_block)
+			continue;
+		auto ret = submit();
+		if (ret != erSuccess)
+			return ret;
+	}
+	return erSuccess;
+}
+
+ECRESULT zwriter_block::finish()
+{
+	ECRESULT ret = erSuccess;
+	if (!m_buf.empty() || m_total == 0)
+		/* An empty input still yields one (empty) frame */
+		ret = submit();
+	while (!m_pending.empty()) {
+		auto r2 = drain_one();
+		if (ret == erSuccess)
+			ret = r2;
+	}
+	if (ret != erSuccess)
+		return ret;
+	char t[ZC_TRAILER_SIZE];
+	zc_put_le(&t[0], ZC_SKIP_MAGIC, 4);
+	zc_put_le(&t[4], ZC_TRAILER_SIZE - 8, 4);
+	memcpy(&t[8], zc_tag, sizeof(zc_tag));
+	zc_put_le(&t[12], m_total, 8);
+	if (write_retry(m_fd, t, sizeof(t)) != static_cast<ssize_t>(sizeof(t))) {
+		ec_log_err("zwriter: write: %s", strerror(errno));
+		return KCERR_DATABASE_ERROR;
+	}
+	return erSuccess;
+}
+
+} /* anon namespace */
+
+std::unique_ptr<zreader> zreader::open(int fd, zcodec *cp)
+{
+	unsigned char magic[4];
+	auto ret = pread(fd, magic, sizeof(magic), 0);
+	if (ret < 0) {
+		ec_log_err("zreader: read: %s", strerror(errno));
+		return nullptr;
+	}
+	auto codec = zcodec_detect(magic, ret);
+	if (cp != nullptr)
+		*cp = codec;
+#if defined(HAVE_ZSTD_H) || defined(HAVE_LZ4FRAME_H)
+	uint64_t limit = UINT64_MAX;
+	struct stat st;
+	if ((codec == zcodec::zstd || codec == zcodec::lz4) && fstat(fd, &st) == 0 &&
+	    zc_trailer(fd, st.st_size) >= 0)
+		limit = st.st_size - ZC_TRAILER_SIZE;
+#endif
+	switch (codec) {
+	case zcodec::gzip:
+		return std::make_unique<zreader_gzip>(fd);
+#ifdef HAVE_ZSTD_H
+	case zcodec::zstd:
+		return std::make_unique<zreader_zstd>(fd, limit);
+#endif
+#ifdef HAVE_LZ4FRAME_H
+	case zcodec::lz4:
+		return std::make_unique<zreader_lz4>(fd, limit);
+#endif
+	case zcodec::none:
+		return std::make_unique<zreader_plain>(fd);
+	default:
+		ec_log_err("zreader: file is %s-compressed, but support for it was not built in",
+			zcodec_name(codec));
+		return nullptr;
+	}
+}
+
+std::unique_ptr<zwriter> zwriter::create(int fd, zcodec codec, int level,
+    unsigned int threads, size_t block)
+{
+	if (codec == zcodec::gzip)
+		return std::make_unique<zwriter_gzip>(fd, level);
+	if (codec != zcodec::none && zcodec_available(codec))
+		return std::make_unique<zwriter_block>(fd, codec, level, threads, block);
+	ec_log_err("zwriter: codec %s is not available", zcodec_name(codec));
+	return nullptr;
+}
+
+ECRESULT zcodec_size(int fd, uint64_t *size, bool *exact)
+{
+	struct stat st;
+	char buf[4];
+	if (exact != nullptr)
+		*exact = true;
+	if (fstat(fd, &st) < 0) {
+		ec_log_err("zcodec_size: fstat: %s", strerror(errno));
+		return KCERR_DATABASE_ERROR;
+	}
+	auto ret = pread(fd, buf, 4, 0);
+	if (ret < 0) {
+		ec_log_err("zcodec_size: read: %s", strerror(errno));
+		return KCERR_DATABASE_ERROR;
+	}
+	auto codec = zcodec_detect(buf, ret);
+	if (codec == zcodec::none) {
+		*size = st.st_size;
+		return erSuccess;
+	}
+	if (codec == zcodec::gzip && st.st_size >= 18 &&
+	    pread(fd, buf, 4, st.st_size - 4) == 4) {
+		/*
+		 * ISIZE of the last member. A zero in a file this long is
+		 * likely a multi-member file (KC-104), so count those.
+		 */
+		*size = zc_get_le(buf, 4);
+		if (*size != 0 || st.st_size < 40) {
+			if (exact != nullptr)
+				*exact = false;
+			return erSuccess;
+		}
+	} else if (codec != zcodec::gzip) {
+		auto z = zc_trailer(fd, st.st_size);
+		if (z >= 0) {
+			*size = z;
+			return erSuccess;
+		}
+	}
+
+	/* No usable trailer: written by something else. Count the hard way. */
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		ec_log_err("zcodec_size: seek: %s", strerror(errno));
+		return KCERR_DATABASE_ERROR;
+	}
+	auto rd = zreader::open(fd);
+	if (rd == nullptr)
+		return KCERR_DATABASE_ERROR;
+	auto tmp = std::make_unique<char[]>(ZC_BUFSIZE);
+	*size = 0;
+	do {
+		ret = rd->read(tmp.get(), ZC_BUFSIZE);
+		if (ret < 0)
+			return KCERR_DATABASE_ERROR;
+		*size += ret;
+	} while (ret == static_cast<ssize_t>(ZC_BUFSIZE));
+	return erSuccess;
+}
+
+} /* namespace */
@@ -12,8 +12,19 @@
 
 #define LOGIN_RETRIES 5
 
+static constexpr std::size_t AUTHENTICATED_MAX_MESSAGE_SIZE = 65536;
+static constexpr std::size_t UNAUTHENTICATED_MAX_MESSAGE_SIZE = 256;
+
 class ClientProto {
 public:
+	enum frame_t {
+		FRAME_MORE,	/* no complete command yet */
+		FRAME_COMMAND,	/* a command is complete */
+		FRAME_HANDOFF,	/* the command reads the rest of itself */
+		FRAME_TOO_BIG,	/* the command exceeds the limits */
+		FRAME_CONTINUE,	/* the client waits for HrSendContinuation */
+	};
+
 	ClientProto(const char *szServerPath, std::shared_ptr<KC::ECChannel> &&ch, std::shared_ptr<KC::ECConfig> cfg) :
 		m_strPath(szServerPath), lpChannel(std::move(ch)),
 		lpConfig(std::move(cfg)), m_ulFailedLogins(0)
@@ -26,11 +37,31 @@ public:
 	virtual HRESULT HrCloseConnection(const std::string &strQuitMsg) = 0;
 	virtual HRESULT HrProcessCommand(const std::string &strInput) = 0;
 	virtual HRESULT HrProcessContinue(const std::string &strInput) { return MAPI_E_NO_SUPPORT; }; // imap only
+	virtual HRESULT HrSendContinuation() { return MAPI_E_NO_SUPPORT; } // imap only
 	virtual HRESULT HrDone(bool bSendResponse) = 0;
 
+	/*
+	 * For process_model=event: says whether @in, the input read so far,
+	 * starts with a complete command. Called again as more input comes
+	 * in; once it returns anything but FRAME_MORE, the next call looks
+	 * at a new command.
+	 */
+	virtual frame_t frame(const std::string &in)
+	{
+		auto max = isAuthenticated() ? AUTHENTICATED_MAX_MESSAGE_SIZE : UNAUTHENTICATED_MAX_MESSAGE_SIZE;
+		auto nl = in.find('\n', m_frame_pos);
+		if (nl == std::string::npos && in.size() < max) {
+			m_frame_pos = in.size();
+			return FRAME_MORE;
+		}
+		m_frame_pos = 0;
+		return nl != std::string::npos && nl <= max ? FRAME_COMMAND : FRAME_TOO_BIG;
+	}
+
 protected:
 	std::string	m_strPath;
 	std::shared_ptr<KC::ECChannel> lpChannel;
 	std::shared_ptr<KC::ECConfig> lpConfig;
 	ULONG		m_ulFailedLogins;
+	size_t m_frame_pos = 0; /* input looked at by frame() so far */
 };
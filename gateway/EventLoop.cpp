@@ -0,0 +1,349 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+#include <kopano/platform.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <mapicode.h>
+#include <kopano/ECLogger.h>
+#include <kopano/MAPIErrors.h>
+#include <kopano/UnixUtil.h>
+#include <kopano/hl.hpp>
+#include <kopano/stringutil.h>
+#include "EventLoop.h"
+#ifdef HAVE_EPOLL_CREATE
+
+using namespace KC;
+
+/* Input read per wakeup; a command is read in several if it is larger */
+static constexpr size_t READ_AHEAD = 256 * 1024;
+/*
+ * Workers still do blocking reads for the TLS handshake and for literals
+ * too large to read ahead. A client that stops sending halfway must not
+ * keep the worker forever.
+ */
+static constexpr time_t WORKER_READ_TIMEOUT = 60;
+
+class EventLoop::task final : public ECTask {
+	public:
+	task(EventLoop &l, std::shared_ptr<conn> c, task_type t) :
+		m_loop(l), m_conn(std::move(c)), m_type(t)
+	{}
+
+	protected:
+	virtual void run() override
+	{
+		kcsrv_blocksigs();
+		m_loop.run_task(m_conn, m_type);
+	}
+
+	private:
+	EventLoop &m_loop;
+	std::shared_ptr<conn> m_conn;
+	task_type m_type;
+};
+
+EventLoop::EventLoop(std::shared_ptr<ECConfig> cfg, greet_fn &&g,
+    command_fn &&c) :
+	m_config(std::move(cfg)), m_greet(std::move(g)),
+	m_command(std::move(c)), m_pool("gw", 0)
+{}
+
+EventLoop::~EventLoop()
+{
+	if (!m_exit)
+		stop("BYE server shutting down");
+}
+
+HRESULT EventLoop::start()
+{
+	auto n = atoui(m_config->GetSetting("event_reactors"));
+	if (n == 0) {
+		auto cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? cpus : 1;
+	}
+	for (unsigned int i = 0; i < n; ++i) {
+		auto r = std::make_unique<reactor>();
+		r->id = i;
+		r->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (r->epfd < 0) {
+			ec_log_crit("epoll_create: %s", strerror(errno));
+			return MAPI_E_CALL_FAILED;
+		}
+		m_reactors.emplace_back(std::move(r));
+	}
+	for (auto &r : m_reactors) {
+		auto arg = new std::pair<EventLoop *, reactor *>(this, r.get());
+		auto err = pthread_create(&r->thread, nullptr, reactor_thread, arg);
+		if (err != 0) {
+			delete arg;
+			ec_log_crit("Could not create reactor thread: %s", strerror(err));
+			return MAPI_E_CALL_FAILED;
+		}
+		r->thread_active = true;
+		set_thread_name(r->thread, "reactor/" + std::to_string(r->id));
+	}
+	auto workers = std::max(1U, atoui(m_config->GetSetting("event_threads")));
+	m_pool.set_thread_count(workers);
+	ec_log_info("Using %zu event loops and %u workers", m_reactors.size(), workers);
+	return hrSuccess;
+}
+
+/**
+ * Closes all connections; the reactors and workers are stopped first.
+ * Connections waiting for input are sent @bye.
+ */
+void EventLoop::stop(const std::string &bye)
+{
+	m_exit = true;
+	for (auto &r : m_reactors)
+		if (r->thread_active) {
+			pthread_join(r->thread, nullptr);
+			r->thread_active = false;
+		}
+	/* Commands still queued finish; in-flight ones give their connection back */
+	for (int i = 10 * 100; m_pool.queue_length() > 0 && i != 0; --i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	m_pool.set_thread_count(0, 0, true);
+
+	for (auto &r : m_reactors) {
+		std::unique_lock<std::mutex> lk(r->mtx);
+		auto conns = std::move(r->conns);
+		r->conns.clear();
+		lk.unlock();
+		for (auto &pair : conns) {
+			auto &c = *pair.second;
+			if (!c.busy)
+				try {
+					c.client->HrCloseConnection(bye);
+				} catch (const KMAPIError &) {
+				}
+			c.client->HrDone(false);
+		}
+		::close(r->epfd);
+		r->epfd = -1;
+	}
+	m_reactors.clear();
+}
+
+size_t EventLoop::connections()
+{
+	size_t n = 0;
+	for (auto &r : m_reactors) {
+		std::lock_guard<std::mutex> lk(r->mtx);
+		n += r->conns.size();
+	}
+	return n;
+}
+
+/* Takes a newly accepted connection; it is greeted on a worker */
+void EventLoop::add(std::unique_ptr<ClientProto> &&client,
+    std::shared_ptr<ECChannel> &&channel, bool ssl)
+{
+	auto c = std::make_shared<conn>();
+	c->client = std::move(client);
+	c->channel = std::move(channel);
+	c->ssl = ssl;
+	time(&c->last);
+	auto fd = c->channel->sockfd();
+	c->channel->SetReadTimeout(WORKER_READ_TIMEOUT);
+	auto &r = owner(fd);
+	std::unique_lock<std::mutex> lk(r.mtx);
+	r.conns[fd] = c;
+	lk.unlock();
+	dispatch(c, T_GREET);
+}
+
+void *EventLoop::reactor_thread(void *arg)
+{
+	auto pair = static_cast<std::pair<EventLoop *, reactor *> *>(arg);
+	auto self = pair->first;
+	auto &r = *pair->second;
+	delete pair;
+	kcsrv_blocksigs();
+	self->run_reactor(r);
+	return nullptr;
+}
+
+void EventLoop::run_reactor(reactor &r)
+{
+	epoll_event evs[256];
+	time_t last = 0;
+
+	while (!m_exit) {
+		auto now = time(nullptr);
+		if (now != last) {
+			sweep(r, now);
+			last = now;
+		}
+		auto n = epoll_wait(r.epfd, evs, ARRAY_SIZE(evs), 1000);
+		for (int i = 0; i < n; ++i) {
+			std::unique_lock<std::mutex> lk(r.mtx);
+			auto it = r.conns.find(evs[i].data.fd);
+			if (it == r.conns.cend() || it->second->busy)
+				continue;
+			auto c = it->second;
+			c->busy = true;
+			lk.unlock();
+			if (read(*c))
+				next(c);
+			else
+				dispatch(c, T_CLOSE);
+		}
+	}
+}
+
+/* Closes connections that have been waiting for input too long */
+void EventLoop::sweep(reactor &r, time_t now)
+{
+	std::vector<std::shared_ptr<conn>> expired;
+	std::unique_lock<std::mutex> lk(r.mtx);
+	for (auto &pair : r.conns) {
+		auto &c = *pair.second;
+		if (c.busy || now - c.last <= c.client->getTimeoutMinutes() * 60)
+			continue;
+		c.busy = true;
+		expired.emplace_back(pair.second);
+	}
+	lk.unlock();
+	for (auto &c : expired)
+		dispatch(c, T_TIMEOUT);
+}
+
+/**
+ * Reads what input there is. Returns false when the connection is closed
+ * and no input is left to run.
+ */
+bool EventLoop::read(conn &c)
+{
+	auto &ch = *c.channel;
+	if (ch.HrReadAvailable(ch.pending().size() + READ_AHEAD) != hrSuccess)
+		return !ch.pending().empty();
+	time(&c.last);
+	return true;
+}
+
+/* Runs the next command when it is complete, else waits for more input */
+void EventLoop::next(const std::shared_ptr<conn> &c)
+{
+	if (m_exit) {
+		arm(c);
+		return;
+	}
+	switch (c->client->frame(c->channel->pending())) {
+	case ClientProto::FRAME_MORE:
+		arm(c);
+		break;
+	case ClientProto::FRAME_COMMAND:
+	case ClientProto::FRAME_HANDOFF:
+		dispatch(c, T_COMMAND);
+		break;
+	case ClientProto::FRAME_CONTINUE:
+		dispatch(c, T_CONTINUE);
+		break;
+	default:
+		ec_log_err("Command from %s exceeds the size limit, closing connection", c->channel->peer_addr());
+		dispatch(c, T_CLOSE);
+		break;
+	}
+}
+
+/* Gives the connection back to its reactor */
+void EventLoop::arm(const std::shared_ptr<conn> &c)
+{
+	auto fd = c->channel->sockfd();
+	auto &r = owner(fd);
+	epoll_event ev{};
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	ev.data.fd = fd;
+	std::unique_lock<std::mutex> lk(r.mtx);
+	c->busy = false;
+	if (epoll_ctl(r.epfd, c->in_epoll ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == 0) {
+		c->in_epoll = true;
+		return;
+	}
+	c->busy = true;
+	lk.unlock();
+	ec_log_err("epoll_ctl %d: %s", fd, strerror(errno));
+	dispatch(c, T_CLOSE);
+}
+
+void EventLoop::dispatch(const std::shared_ptr<conn> &c, task_type t)
+{
+	m_pool.enqueue(new task(*this, c, t), true);
+}
+
+void EventLoop::run_task(const std::shared_ptr<conn> &c, task_type t)
+{
+	switch (t) {
+	case T_GREET:
+		if (m_greet(*c->client, *c->channel, c->ssl) != hrSuccess) {
+			close(c);
+			return;
+		}
+		break;
+	case T_COMMAND:
+		if (m_command(*c->client, *c->channel) != hrSuccess) {
+			close(c);
+			return;
+		}
+		/* Pipelined commands, and input SSL may have kept back */
+		if (!read(*c)) {
+			close(c);
+			return;
+		}
+		break;
+	case T_CONTINUE:
+		if (c->client->HrSendContinuation() != hrSuccess) {
+			close(c);
+			return;
+		}
+		break;
+	case T_TIMEOUT:
+		try {
+			// close idle first, so we don't have a race condition with the channel
+			c->client->HrCloseConnection("BYE Connection closed because of timeout");
+		} catch (const KMAPIError &) {
+		}
+		ec_log_err("Connection closed because of timeout");
+		close(c);
+		return;
+	case T_CLOSE:
+		close(c);
+		return;
+	}
+	next(c);
+}
+
+/* Takes the connection away from its reactor and ends the session */
+void EventLoop::close(const std::shared_ptr<conn> &c)
+{
+	auto fd = c->channel->sockfd();
+	auto &r = owner(fd);
+	std::unique_lock<std::mutex> lk(r.mtx);
+	if (c->in_epoll && epoll_ctl(r.epfd, EPOLL_CTL_DEL, fd, nullptr) != 0)
+		ec_log_err("epoll_ctl DEL %d: %s", fd, strerror(errno));
+	c->in_epoll = false;
+	auto it = r.conns.find(fd);
+	if (it != r.conns.cend() && it->second == c)
+		r.conns.erase(it);
+	lk.unlock();
+	ec_log_notice("Client %s connection closing", c->channel->peer_addr());
+	c->client->HrDone(false); // HrDone does not send an error string to the client
+	/* The socket closes with the last reference, so only after the erase */
+	c->client.reset();
+}
+#endif
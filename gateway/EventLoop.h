@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <pthread.h>
+#include <kopano/ECChannel.h>
+#include <kopano/ECConfig.h>
+#include <kopano/ECThreadPool.h>
+#include "ClientProto.h"
+
+/**
+ * @ingroup gateway
+ * @{
+ */
+
+/*
+ * The event process model. Rather than a thread (or process) per
+ * connection blocking in reads, a few reactor threads wait for input on
+ * all client sockets with epoll and read it into the connection's
+ * ECChannel. Once ClientProto::frame finds a complete command in there,
+ * the connection goes to one of a small pool of workers, which runs the
+ * command like the other process models do, reading it from the channel's
+ * buffer, and then gives the connection back. Connections that are idle,
+ * IDLE included, thus do not hold a thread of the gateway's own; a
+ * logged-on one still has its MAPI session, and with it the client
+ * library's notification thread and server connection.
+ *
+ * A connection is owned by reactor (fd % n), and by at most one thread at
+ * a time: its reactor while waiting for input (armed with EPOLLONESHOT),
+ * or the worker running a task for it (busy).
+ */
+class EventLoop final {
+	public:
+	/* TLS and greeting for a new connection; an error closes it */
+	typedef std::function<HRESULT(ClientProto &, KC::ECChannel &, bool ssl)> greet_fn;
+	/* Reads and runs one command; an error closes the connection */
+	typedef std::function<HRESULT(ClientProto &, KC::ECChannel &)> command_fn;
+
+	EventLoop(std::shared_ptr<KC::ECConfig>, greet_fn &&, command_fn &&);
+	~EventLoop();
+	HRESULT start();
+	void add(std::unique_ptr<ClientProto> &&, std::shared_ptr<KC::ECChannel> &&, bool ssl);
+	void stop(const std::string &bye);
+	size_t connections();
+
+	private:
+	struct conn {
+		std::unique_ptr<ClientProto> client;
+		std::shared_ptr<KC::ECChannel> channel;
+		time_t last = 0; /* last input */
+		bool ssl = false, busy = true, in_epoll = false;
+	};
+	struct reactor {
+		unsigned int id = 0;
+		int epfd = -1;
+		std::mutex mtx; /* protects conns */
+		std::map<int, std::shared_ptr<conn>> conns;
+		pthread_t thread;
+		bool thread_active = false;
+	};
+	enum task_type { T_GREET, T_COMMAND, T_CONTINUE, T_TIMEOUT, T_CLOSE };
+	class task;
+
+	reactor &owner(int fd) { return *m_reactors[fd % m_reactors.size()]; }
+	void run_reactor(reactor &);
+	void sweep(reactor &, time_t now);
+	bool read(conn &);
+	void next(const std::shared_ptr<conn> &);
+	void arm(const std::shared_ptr<conn> &);
+	void dispatch(const std::shared_ptr<conn> &, task_type);
+	void run_task(const std::shared_ptr<conn> &, task_type);
+	void close(const std::shared_ptr<conn> &);
+	static void *reactor_thread(void *);
+
+	std::shared_ptr<KC::ECConfig> m_config;
+	greet_fn m_greet;
+	command_fn m_command;
+	std::vector<std::unique_ptr<reactor>> m_reactors;
+	KC::ECThreadPool m_pool;
+	std::atomic<bool> m_exit{false};
+};
+
+/** @} */
@@ -42,6 +42,9 @@
 #include "charset/localeutil.h"
 #include "POP3.h"
 #include "IMAP.h"
+#ifdef HAVE_EPOLL_CREATE
+#	include "EventLoop.h"
+#endif
 #include <kopano/ecversion.h>
 #include "SSLUtil.h"
 #include <kopano/fileutil.hpp>
@@ -66,11 +69,8 @@ struct socks {
 	std::vector<bool> pop3, ssl;
 };
 
-static constexpr std::size_t AUTHENTICATED_MAX_MESSAGE_SIZE = 65536;
-static constexpr std::size_t UNAUTHENTICATED_MAX_MESSAGE_SIZE = 256;
-
 static bool quit = 0;
-static bool bThreads, g_dump_config;
+static bool bThreads, bEvents, g_dump_config;
 static std::atomic<bool> g_sighup_flag{false};
 static const char *szPath;
 static std::shared_ptr<ECLogger> g_lpLogger;
@@ -78,6 +78,9 @@ static std::shared_ptr<ECConfig> g_lpConfig;
 static std::atomic<int> nChildren{0};
 static std::string g_strHostString;
 static struct socks g_socks;
+#ifdef HAVE_EPOLL_CREATE
+static std::unique_ptr<EventLoop> g_events;
+#endif
 
 static void gw_sigterm_async(int)
 {
@@ -144,6 +147,80 @@ struct HandlerArgs {
 	bool bUseSSL;
 };
 
+/**
+ * TLS (for POP3S and IMAPS) and the greeting for a new connection.
+ */
+static HRESULT gw_greet(ClientProto &client, ECChannel &channel, bool bUseSSL)
+{
+	if (bUseSSL) {
+		auto ret = channel.HrEnableTLS();
+		if (ret != hrSuccess) {
+			ec_log_err("Unable to negotiate SSL connection with %s", channel.peer_addr());
+			return ret;
+		}
+	}
+	try {
+		return client.HrSendGreeting(g_strHostString);
+	} catch (const KMAPIError &e) {
+		return e.code();
+	}
+}
+
+/**
+ * Reads one command from the client and runs it.
+ *
+ * @return an error when the connection is to be closed
+ */
+static HRESULT gw_command(ClientProto &client, ECChannel &channel)
+{
+	std::string inBuffer;
+
+	// If we're not logged in lets cap the maximum buffer size to
+	// prevent obvious DDOS attacks.
+	const std::size_t bufferSize = client.isAuthenticated() ?
+		AUTHENTICATED_MAX_MESSAGE_SIZE : UNAUTHENTICATED_MAX_MESSAGE_SIZE;
+	auto hr = channel.HrReadLine(inBuffer, bufferSize);
+	if (hr != hrSuccess) {
+		if (errno)
+			ec_log_err("Failed to read line: %s", strerror(errno));
+		else
+			ec_log_err("Client disconnected");
+		return hr;
+	}
+	if (quit) {
+		client.HrCloseConnection("BYE server shutting down");
+		return MAPI_E_CALL_FAILED;
+	}
+	if (client.isContinue()) {
+		// we asked the client for more data, do not parse the buffer, but send it "to the previous command"
+		// that last part is currently only HrCmdAuthenticate(), so no difficulties here.
+		// also, PLAIN is the only supported auth method.
+		try {
+			client.HrProcessContinue(inBuffer);
+		} catch (const KMAPIError &e) {
+		}
+		// no matter what happens, we continue handling the connection.
+		return hrSuccess;
+	}
+
+	try {
+		/* Process IMAP command */
+		hr = client.HrProcessCommand(inBuffer);
+	} catch (const KMAPIError &e) {
+		hr = e.code();
+	}
+	if (hr == MAPI_E_NETWORK_ERROR) {
+		ec_log_err("HrProcessCommand threw KMAPIError: %s. (errno=%s)",
+			GetMAPIErrorMessage(hr), strerror(errno));
+		return hr;
+	}
+	if (hr == MAPI_E_END_OF_SESSION) {
+		ec_log_notice("gateway lost connection with storage server: remote side closed the connection.");
+		return hr;
+	}
+	return hrSuccess;
+}
+
 static void *Handler(void *lpArg)
 {
 	std::unique_ptr<HandlerArgs> lpHandlerArgs(static_cast<HandlerArgs *>(lpArg));
@@ -165,35 +242,21 @@ static void *Handler(void *lpArg)
 	if (pipelog != nullptr)
 		pipelog->Disown();
 
-	std::string inBuffer;
 	HRESULT hr;
-	bool bQuit = false;
 	int timeouts = 0;
 
-	if (bUseSSL) {
-		auto ret = lpChannel->HrEnableTLS();
-		if (ret != hrSuccess) {
-			ec_log_err("Unable to negotiate SSL connection with %s", lpChannel->peer_addr());
-			goto exit;
-		}
-	}
-
-	try {
-		hr = client->HrSendGreeting(g_strHostString);
-	} catch (const KMAPIError &e) {
-		hr = e.code();
-	}
+	hr = gw_greet(*client, *lpChannel, bUseSSL);
 	if (hr != hrSuccess)
 		goto exit;
 
 	// Main command loop
-	while (!bQuit && !quit) {
+	while (!quit) {
 		if (g_sighup_flag)
 			gw_sighup_sync();
 		// check for data
 		hr = lpChannel->HrSelect(60);
 		if (hr == MAPI_E_CANCEL)
-			/* signalled - reevaluate bQuit */
+			/* signalled - reevaluate quit */
 			continue;
 		if (hr == MAPI_E_TIMEOUT) {
 			if (++timeouts < client->getTimeoutMinutes())
@@ -208,55 +271,8 @@ static void *Handler(void *lpArg)
 			break;
 		}
 		timeouts = 0;
-
-		// If we're not logged in lets cap the maximum buffer size to
-		// prevent obvious DDOS attacks.
-		const std::size_t bufferSize = client->isAuthenticated() ?
-			AUTHENTICATED_MAX_MESSAGE_SIZE : UNAUTHENTICATED_MAX_MESSAGE_SIZE;
-		hr = lpChannel->HrReadLine(inBuffer, bufferSize);
-		if (hr != hrSuccess) {
-			if (errno)
-				ec_log_err("Failed to read line: %s", strerror(errno));
-			else
-				ec_log_err("Client disconnected");
+		if (gw_command(*client, *lpChannel) != hrSuccess)
 			break;
-		}
-		if (quit) {
-			client->HrCloseConnection("BYE server shutting down");
-			hr = MAPI_E_CALL_FAILED;
-			break;
-		}
-		if (client->isContinue()) {
-			// we asked the client for more data, do not parse the buffer, but send it "to the previous command"
-			// that last part is currently only HrCmdAuthenticate(), so no difficulties here.
-			// also, PLAIN is the only supported auth method.
-			try {
-				client->HrProcessContinue(inBuffer);
-			} catch (const KMAPIError &e) {
-			}
-			// no matter what happens, we continue handling the connection.
-			continue;
-		}
-
-		try {
-			/* Process IMAP command */
-			hr = client->HrProcessCommand(inBuffer);
-		} catch (const KMAPIError &e) {
-			hr = e.code();
-		}
-		if (hr == MAPI_E_NETWORK_ERROR) {
-			ec_log_err("HrProcessCommand threw KMAPIError: %s. (errno=%s)",
-				GetMAPIErrorMessage(hr), strerror(errno));
-			bQuit = true;
-		}
-		if (hr == MAPI_E_END_OF_SESSION) {
-			ec_log_notice("gateway lost connection with storage server: remote side closed the connection.");
-			bQuit = true;
-		}
-		// Clear the buffer from memory.
-		// Note: .clear() does not actually release memory, since it
-		// only changes the size not the capacity
-		std::string().swap(inBuffer);
 	}
 exit:
 	ec_log_notice("Client %s thread exiting", lpChannel->peer_addr());
@@ -321,6 +337,8 @@ int main(int argc, char *argv[]) {
 		{ "run_as_group", "kopano" },
 		{"pid_file", "", CONFIGSETTING_OBSOLETE},
 		{ "process_model", "thread" },
+		{"event_reactors", "1"},
+		{"event_threads", "8"},
 		{"coredump_enabled", "systemdefault"},
 		{"pop3_listen", "*%lo:110"},
 		{"pop3s_listen", ""},
@@ -333,6 +351,8 @@ int main(int argc, char *argv[]) {
 		{ "imap_max_messagesize", "128M", CONFIGSETTING_RELOADABLE | CONFIGSETTING_SIZE },
 		{ "imap_expunge_on_delete", "no", CONFIGSETTING_RELOADABLE },
 		{ "imap_ignore_command_idle", "no", CONFIGSETTING_RELOADABLE },
+		{ "imap_folder_cache_size", "64M", CONFIGSETTING_RELOADABLE | CONFIGSETTING_SIZE },
+		{ "imap_fetch_threads", "4" },
 		{ "disable_plaintext_auth", "no", CONFIGSETTING_RELOADABLE },
 		{ "server_socket", "http://localhost:236/" },
 		{ "server_hostname", "" },
@@ -431,7 +451,15 @@ int main(int argc, char *argv[]) {
 		ec_log_err("Ignoring invalid path-setting!");
 	if (parseBool(g_lpConfig->GetSetting("bypass_auth")))
 		ec_log_warn("Gateway is started with bypass_auth=yes meaning username and password will not be checked.");
-	if (strcmp(g_lpConfig->GetSetting("process_model"), "thread") == 0) {
+	if (strcmp(g_lpConfig->GetSetting("process_model"), "event") == 0) {
+#ifdef HAVE_EPOLL_CREATE
+		bEvents = true;
+#else
+		ec_log_warn("process_model=event is not available on this platform, using threads");
+#endif
+		bThreads = true;
+		g_lpLogger->SetLogprefix(LP_TID);
+	} else if (strcmp(g_lpConfig->GetSetting("process_model"), "thread") == 0) {
 		bThreads = true;
 		g_lpLogger->SetLogprefix(LP_TID);
 	}
@@ -554,6 +582,21 @@ static HRESULT handler_client(size_t i)
 	auto hr = HrAccept(g_socks.pollfd[i].fd, &unique_tie(lpHandlerArgs->lpChannel));
 	if (hr != hrSuccess)
 		return hr_lerr(hr, "Unable to accept %s socket connection", method);
+#ifdef HAVE_EPOLL_CREATE
+	if (bEvents) {
+		std::shared_ptr<ECChannel> channel(std::move(lpHandlerArgs->lpChannel));
+		std::unique_ptr<ClientProto> client;
+		if (lpHandlerArgs->type == ST_POP3)
+			client.reset(new(std::nothrow) POP3(szPath, channel, g_lpConfig));
+		else
+			client.reset(new(std::nothrow) IMAP(szPath, channel, g_lpConfig));
+		if (client == nullptr)
+			return MAPI_E_NOT_ENOUGH_MEMORY;
+		ec_log_info("Queueing %s connection from %s", method, channel->peer_addr());
+		g_events->add(std::move(client), std::move(channel), lpHandlerArgs->bUseSSL);
+		return hrSuccess;
+	}
+#endif
 
 	pthread_t tid;
 	ec_log_notice("Starting worker %s for %s request", model, method);
@@ -593,7 +636,8 @@ static HRESULT handler_client(size_t i)
 
 /**
  * Runs the gateway service, starting a new thread or fork child for
- * incoming connections on any configured service.
+ * incoming connections on any configured service, or handing them to the
+ * event loop.
  */
 static HRESULT running_service(char **argv)
 {
@@ -649,6 +693,17 @@ static HRESULT running_service(char **argv)
 			GetMAPIErrorMessage(hr), hr);
 		return hr;
 	}
+#ifdef HAVE_EPOLL_CREATE
+	if (bEvents) {
+		g_events.reset(new EventLoop(g_lpConfig, gw_greet, gw_command));
+		hr = g_events->start();
+		if (hr != hrSuccess) {
+			g_events.reset();
+			MAPIUninitialize();
+			return hr;
+		}
+	}
+#endif
 
 	// Mainloop
 	while (!quit) {
@@ -676,6 +731,13 @@ static HRESULT running_service(char **argv)
 	}
 
 	ec_log_always("POP3/IMAP Gateway will now exit");
+#ifdef HAVE_EPOLL_CREATE
+	if (g_events != nullptr) {
+		ec_log_notice("Closing %zu connections", g_events->connections());
+		g_events->stop("BYE server shutting down");
+		g_events.reset();
+	}
+#endif
 	// in forked mode, send all children the exit signal
 	if (!bThreads) {
 		signal(SIGTERM, SIG_IGN);
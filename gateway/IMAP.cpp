@@ -13,9 +13,11 @@
 #include <utility>
 #include <cerrno>
 #include <climits>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <sstream>
 #include <algorithm>
 #include <libHX/defs.h>
@@ -32,6 +34,7 @@
 #include <kopano/ECRestriction.h>
 #include <kopano/CommonUtil.h>
 #include <kopano/ECTags.h>
+#include <kopano/ECThreadPool.h>
 #include <kopano/MAPIErrors.h>
 #include <kopano/Util.h>
 #include <kopano/scope.hpp>
@@ -41,19 +44,24 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include <map>
 #include <algorithm>
 #include <inetmapi/options.h>
+#include <edkguid.h>
 #include <edkmdb.h>
 #include <kopano/stringutil.h>
 #include <kopano/codepage.h>
 #include <kopano/charset/convert.h>
 #include <kopano/ecversion.h>
 #include <kopano/ECGuid.h>
+#include <kopano/ECUnknown.h>
+#include <kopano/IECInterfaces.hpp>
 #include <kopano/namedprops.h>
 #include <kopano/ECFeatures.hpp>
 #include "IMAP.h"
+#include "IMAPModSeq.h"
 
 using namespace KC;
 using namespace std::string_literals;
@@ -66,7 +74,261 @@ static const std::string strMonth[] = {
 	"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
 };
 
-static constexpr std::size_t UNAUTHENTICATED_MAX_MESSAGE_SIZE = 256;
+/*
+ * Messages ICS reports changed are read back one at a time; beyond this
+ * (or 1/32nd of the folder), reading the whole folder is cheaper.
+ */
+static constexpr size_t ICS_MAX_CHANGES = 256;
+/* Expunged UIDs remembered per folder for QRESYNC */
+static constexpr size_t MAX_VANISHED = 10000;
+/* Folders of which the ICS state is kept once their message list is evicted */
+static constexpr size_t MAX_FOLDER_STATES = 4096;
+/* Beyond this, FETCH finds its rows in the whole folder */
+static constexpr size_t MAX_FETCH_RANGES = 64;
+/* Below this, FETCH finds its rows in the shared contents table */
+static constexpr size_t MIN_FETCH_RESTRICT = 500;
+
+/* Columns HrScanFolderMails, HrSyncFolderMails and IDLE read messages with */
+enum { ML_EID, ML_IMAPID, ML_SK, ML_MFLAGS, ML_FLAGSTATUS, ML_MSGSTATUS, ML_LAST_VERB, ML_IKEY, ML_NUM_COLS };
+static constexpr SizedSPropTagArray(ML_NUM_COLS, sptaMailListCols) =
+	{ML_NUM_COLS, {PR_ENTRYID, PR_EC_IMAP_ID, PR_SOURCE_KEY,
+	PR_MESSAGE_FLAGS, PR_FLAG_STATUS, PR_MSG_STATUS, PR_LAST_VERB_EXECUTED,
+	PR_INSTANCE_KEY}};
+
+/* The server's instance keys are the object id and the order id */
+static uint64_t InstanceKeyId(const SPropValue &ik)
+{
+	uint64_t id = 0;
+	if (ik.ulPropTag == PR_INSTANCE_KEY && ik.Value.bin.cb == sizeof(id))
+		memcpy(&id, ik.Value.bin.lpb, sizeof(id));
+	return id;
+}
+
+/*
+ * Collects what ICS reports for the selected folder, without importing
+ * anything: HrSyncFolderMails reads what it needs from the changed messages.
+ */
+class ICSChangeCollector final :
+    public ECUnknown, public IExchangeImportContentsChanges {
+	public:
+	virtual HRESULT QueryInterface(const IID &refiid, void **lppInterface) override
+	{
+		REGISTER_INTERFACE2(ECUnknown, this);
+		REGISTER_INTERFACE2(IExchangeImportContentsChanges, this);
+		REGISTER_INTERFACE2(IUnknown, this);
+		return MAPI_E_INTERFACE_NOT_SUPPORTED;
+	}
+	virtual HRESULT GetLastError(HRESULT, unsigned int, MAPIERROR **) override { return MAPI_E_NO_SUPPORT; }
+	virtual HRESULT Config(IStream *, unsigned int) override { return hrSuccess; }
+	virtual HRESULT UpdateState(IStream *) override { return hrSuccess; }
+	virtual HRESULT ImportMessageChange(unsigned int n, SPropValue *props, unsigned int, IMessage **) override
+	{
+		auto eid = PCpropFindProp(props, n, PR_ENTRYID);
+		if (eid != nullptr)
+			changed.emplace_back(eid->Value.bin);
+		/* Do not let the exporter copy the message */
+		return SYNC_E_IGNORE;
+	}
+	virtual HRESULT ImportMessageDeletion(unsigned int, ENTRYLIST *sks) override
+	{
+		for (unsigned int i = 0; i < sks->cValues; ++i)
+			deleted.emplace_back(reinterpret_cast<const char *>(sks->lpbin[i].lpb), sks->lpbin[i].cb);
+		return hrSuccess;
+	}
+	virtual HRESULT ImportPerUserReadStateChange(unsigned int n, READSTATE *rs) override
+	{
+		for (unsigned int i = 0; i < n; ++i)
+			read.emplace_back(std::string(reinterpret_cast<const char *>(rs[i].pbSourceKey), rs[i].cbSourceKey),
+				rs[i].ulFlags & MSGFLAG_READ);
+		return hrSuccess;
+	}
+	virtual HRESULT ImportMessageMove(unsigned int, BYTE *, unsigned int, BYTE *, unsigned int, BYTE *, unsigned int, BYTE *, unsigned int, BYTE *) override
+	{
+		return MAPI_E_NO_SUPPORT;
+	}
+
+	std::vector<BinaryArray> changed; /* entryids */
+	std::vector<std::string> deleted; /* sourcekeys */
+	std::vector<std::pair<std::string, bool>> read; /* sourcekey, read */
+};
+
+/*
+ * Message lists of folders no session has selected at the moment, with
+ * their ICS state, so that the next session selecting the folder only
+ * asks the server what changed since. Lists are kept up to
+ * imap_folder_cache_size bytes, least recently used ones go first. The
+ * ICS states of up to MAX_FOLDER_STATES folders are kept beyond that,
+ * so that a folder coming back does not register another sync on the
+ * server.
+ *
+ * Keys are per user, because of per-user read state in public folders.
+ * A session takes the entry out while it has the folder selected.
+ */
+class IMAPFolderCache final {
+	public:
+	bool take(const std::string &key, IMAP::SFolderSync &, std::vector<IMAP::SMail> &, ULONG &last_uid);
+	void put(const std::string &key, IMAP::SFolderSync &&, std::vector<IMAP::SMail> &&, ULONG last_uid, size_t limit);
+
+	private:
+	struct entry {
+		IMAP::SFolderSync sync;
+		std::vector<IMAP::SMail> mails;
+		ULONG last_uid = 0;
+		size_t size = 0;
+		std::list<std::string>::iterator lru;
+	};
+	static size_t size_of(const entry &);
+	static void drop_mails(entry &);
+
+	std::mutex m_lock;
+	std::map<std::string, entry> m_entries;
+	std::list<std::string> m_lru; /* most recently used first */
+	size_t m_size = 0;
+};
+
+static IMAPFolderCache imap_folder_cache;
+
+size_t IMAPFolderCache::size_of(const entry &e)
+{
+	size_t s = sizeof(e) + e.sync.strState.size() +
+	           e.sync.lstVanished.size() * sizeof(e.sync.lstVanished[0]) +
+	           e.sync.mapForeignKeys.size() * 64;
+	for (const auto &m : e.mails)
+		s += sizeof(m) + m.sEntryID.cb;
+	return s;
+}
+
+void IMAPFolderCache::drop_mails(entry &e)
+{
+	e.mails.clear();
+	e.mails.shrink_to_fit();
+	e.sync.mapForeignKeys.clear();
+	e.sync.lstVanished.clear();
+	e.sync.lstPendingExpunge.clear();
+	e.sync.bLoaded = false;
+}
+
+bool IMAPFolderCache::take(const std::string &key, IMAP::SFolderSync &sync,
+    std::vector<IMAP::SMail> &mails, ULONG &last_uid)
+{
+	scoped_lock lk(m_lock);
+	auto i = m_entries.find(key);
+	if (i == m_entries.cend())
+		return false;
+	auto &e = i->second;
+	sync = std::move(e.sync);
+	mails = std::move(e.mails);
+	last_uid = e.last_uid;
+	m_size -= e.size;
+	m_lru.erase(e.lru);
+	m_entries.erase(i);
+	return true;
+}
+
+void IMAPFolderCache::put(const std::string &key, IMAP::SFolderSync &&sync,
+    std::vector<IMAP::SMail> &&mails, ULONG last_uid, size_t limit)
+{
+	scoped_lock lk(m_lock);
+	auto i = m_entries.find(key);
+	if (i != m_entries.cend()) {
+		/* Another session had the folder selected too; keep the newer */
+		if (i->second.sync.ulHighestModSeq > sync.ulHighestModSeq)
+			return;
+		m_size -= i->second.size;
+		m_lru.erase(i->second.lru);
+		m_entries.erase(i);
+	}
+	auto &e = m_entries[key];
+	e.sync = std::move(sync);
+	e.mails = std::move(mails);
+	e.last_uid = last_uid;
+	if (!e.sync.bLoaded)
+		drop_mails(e);
+	e.size = size_of(e);
+	if (e.size > limit) {
+		/* Would never fit; keep just the ICS state */
+		drop_mails(e);
+		e.size = size_of(e);
+	}
+	m_size += e.size;
+	m_lru.emplace_front(key);
+	e.lru = m_lru.begin();
+
+	/* Older lists make room for the new one */
+	for (auto r = m_lru.rbegin(); m_size > limit && r != m_lru.rend(); ++r) {
+		if (*r == key)
+			continue;
+		auto &o = m_entries[*r];
+		if (!o.sync.bLoaded)
+			continue;
+		m_size -= o.size;
+		drop_mails(o);
+		o.size = size_of(o);
+		m_size += o.size;
+	}
+	while (m_lru.size() > MAX_FOLDER_STATES) {
+		auto j = m_entries.find(m_lru.back());
+		m_size -= j->second.size;
+		m_entries.erase(j);
+		m_lru.pop_back();
+	}
+}
+
+/*
+ * Builds the FETCH response for a message that has to be opened, on the
+ * fetch pool, while HrPropertyFetch goes on with the next messages.
+ */
+class IMAPFetchTask final : public ECWaitableTask {
+	public:
+	IMAPFetchTask(IMAP &imap, ULONG mailnr, bool force_flags,
+	    const std::vector<std::string> &items, memory_ptr<SPropValue> &&props,
+	    ULONG nprops) :
+		m_imap(imap), m_mailnr(mailnr), m_force_flags(force_flags),
+		m_items(items), m_props(std::move(props)), m_nprops(nprops)
+	{}
+
+	HRESULT m_hr = hrSuccess;
+	std::string m_response;
+
+	protected:
+	virtual void run() override
+	{
+		kcsrv_blocksigs();
+		m_hr = m_imap.HrPropertyFetchRow(m_props, m_nprops, m_response,
+		       m_mailnr, m_force_flags, m_items);
+	}
+
+	private:
+	IMAP &m_imap;
+	ULONG m_mailnr;
+	bool m_force_flags;
+	const std::vector<std::string> &m_items;
+	memory_ptr<SPropValue> m_props;
+	ULONG m_nprops;
+};
+
+/* A FETCH response, ready or still being built on the fetch pool */
+struct fetch_slot {
+	std::unique_ptr<IMAPFetchTask> task;
+	std::string response;
+	HRESULT hr = hrSuccess;
+};
+
+/*
+ * Shared by all sessions of the process, so that imap_fetch_threads
+ * bounds the threads, not the threads per connection.
+ */
+static ECThreadPool *imap_fetch_pool(unsigned int threads)
+{
+	static std::mutex lock;
+	static std::unique_ptr<ECThreadPool> pool;
+	scoped_lock lk(lock);
+	if (pool == nullptr) {
+		pool.reset(new ECThreadPool("imapfetch", 0));
+		pool->set_thread_count(threads);
+	}
+	return pool.get();
+}
 
 IMAP::IMAP(const char *szServerPath, std::shared_ptr<ECChannel> ch,
     std::shared_ptr<ECConfig> cfg) :
@@ -76,6 +338,9 @@ IMAP::IMAP(const char *szServerPath, std::shared_ptr<ECChannel> ch,
 	dopt.add_imap_data = true;
 	bOnlyMailFolders = parseBool(lpConfig->GetSetting("imap_only_mailfolders"));
 	bShowPublicFolder = parseBool(lpConfig->GetSetting("imap_public_folders"));
+	/* With processes, the cache would go when the connection does */
+	auto model = lpConfig->GetSetting("process_model");
+	m_bFolderCache = strcmp(model, "thread") == 0 || strcmp(model, "event") == 0;
 }
 
 IMAP::~IMAP() {
@@ -84,6 +349,7 @@ IMAP::~IMAP() {
 
 void IMAP::CleanupObject()
 {
+	ReleaseFolderState();
 	lpPublicStore.reset();
 	lpStore.reset();
 	lpAddrBook.reset();
@@ -153,39 +419,7 @@ HRESULT IMAP::HrUnsplitPath(const std::vector<std::wstring> &vPaths, std::wstrin
  */
 HRESULT IMAP::HrSplitInput(const std::string &strInput, std::vector<std::string> &vWords)
 {
-	unsigned int uSpecialCount = 0;
-	size_t beginPos = 0, currentPos = 0, specialPos = std::string::npos;
-	auto findPos = strInput.find_first_of("\"()[] ", currentPos);
-
-	while (findPos != strInput.npos) {
-		if (uSpecialCount == 0 && strInput[findPos] == '"') {
-			// find corresponding " and add the string
-			specialPos = findPos;
-			do {
-				specialPos = strInput.find_first_of("\"", specialPos + 1);
-			} while (specialPos != strInput.npos && strInput[specialPos-1] == '\\');
-
-			if (specialPos != strInput.npos) {
-				vWords.emplace_back(strInput.substr(findPos + 1, specialPos - findPos - 1));
-				findPos = specialPos;
-				beginPos = findPos + 1;
-			}
-		} else if (strInput[findPos] == '(' || strInput[findPos] == '[') {
-			++uSpecialCount;
-		} else if (strInput[findPos] == ')' || strInput[findPos] == ']') {
-			if (uSpecialCount > 0)
-				--uSpecialCount;
-		} else if (uSpecialCount == 0) {
-			if (findPos > beginPos)
-				vWords.emplace_back(strInput.substr(beginPos, findPos - beginPos));
-			beginPos = findPos + 1;
-		}
-		currentPos = findPos + 1;
-		findPos = strInput.find_first_of("\"()[] ", currentPos);
-	}
-
-	if (beginPos < strInput.size())
-		vWords.emplace_back(strInput.substr(beginPos));
+	imap_split(strInput, vWords);
 	return hrSuccess;
 }
 
@@ -236,33 +470,33 @@ HRESULT IMAP::HrProcessCommand(const std::string &strInput)
 
 	static constexpr struct {
 		const char *command;
-		int params;
+		int params, opt_params;
 		bool uid;
 		HRESULT (IMAP::*func)(const std::string &, const std::vector<std::string> &);
 	} cmds[] = {
-		{"SELECT", 1, false, &IMAP::HrCmdSelect<false>},
-		{"EXAMINE", 1, false, &IMAP::HrCmdSelect<true>},
-		{"LIST", 2, false, &IMAP::HrCmdList<false>},
-		{"LSUB", 2, false, &IMAP::HrCmdList<true>},
-		{"LOGIN", 2, false, &IMAP::HrCmdLogin},
-		{"CREATE", 1, false, &IMAP::HrCmdCreate},
-		{"DELETE", 1, false, &IMAP::HrCmdDelete},
-		{"SUBSCRIBE", 1, false, &IMAP::HrCmdSubscribe<true>},
-		{"UNSUBSCRIBE", 1, false, &IMAP::HrCmdSubscribe<false>},
-		{"GETQUOTAROOT", 1, false, &IMAP::HrCmdGetQuotaRoot},
-		{"GETQUOTA", 1, false, &IMAP::HrCmdGetQuota},
-		{"SETQUOTA", 2, false, &IMAP::HrCmdSetQuota},
-		{"RENAME", 2, false, &IMAP::HrCmdRename},
-		{"STATUS", 2, false, &IMAP::HrCmdStatus},
-		{"FETCH", 2, false, &IMAP::HrCmdFetch<false>},
-		{"FETCH", 2, true, &IMAP::HrCmdFetch<true>},
-		{"COPY", 2, false, &IMAP::HrCmdCopy<false>},
-		{"COPY", 2, true, &IMAP::HrCmdCopy<true>},
-		{"STORE", 3, false, &IMAP::HrCmdStore<false>},
-		{"STORE", 3, true, &IMAP::HrCmdStore<true>},
-		{"EXPUNGE", 0, false, &IMAP::HrCmdExpunge},
-		{"EXPUNGE", 1, true, &IMAP::HrCmdExpunge},
-		{"XAOL-MOVE", 2, true, &IMAP::HrCmdUidXaolMove}
+		{"SELECT", 1, 1, false, &IMAP::HrCmdSelect<false>},
+		{"EXAMINE", 1, 1, false, &IMAP::HrCmdSelect<true>},
+		{"LIST", 2, 0, false, &IMAP::HrCmdList<false>},
+		{"LSUB", 2, 0, false, &IMAP::HrCmdList<true>},
+		{"LOGIN", 2, 0, false, &IMAP::HrCmdLogin},
+		{"CREATE", 1, 0, false, &IMAP::HrCmdCreate},
+		{"DELETE", 1, 0, false, &IMAP::HrCmdDelete},
+		{"SUBSCRIBE", 1, 0, false, &IMAP::HrCmdSubscribe<true>},
+		{"UNSUBSCRIBE", 1, 0, false, &IMAP::HrCmdSubscribe<false>},
+		{"GETQUOTAROOT", 1, 0, false, &IMAP::HrCmdGetQuotaRoot},
+		{"GETQUOTA", 1, 0, false, &IMAP::HrCmdGetQuota},
+		{"SETQUOTA", 2, 0, false, &IMAP::HrCmdSetQuota},
+		{"RENAME", 2, 0, false, &IMAP::HrCmdRename},
+		{"STATUS", 2, 0, false, &IMAP::HrCmdStatus},
+		{"FETCH", 2, 1, false, &IMAP::HrCmdFetch<false>},
+		{"FETCH", 2, 1, true, &IMAP::HrCmdFetch<true>},
+		{"COPY", 2, 0, false, &IMAP::HrCmdCopy<false>},
+		{"COPY", 2, 0, true, &IMAP::HrCmdCopy<true>},
+		{"STORE", 3, 1, false, &IMAP::HrCmdStore<false>},
+		{"STORE", 3, 1, true, &IMAP::HrCmdStore<true>},
+		{"EXPUNGE", 0, 0, false, &IMAP::HrCmdExpunge},
+		{"EXPUNGE", 1, 0, true, &IMAP::HrCmdExpunge},
+		{"XAOL-MOVE", 2, 0, true, &IMAP::HrCmdUidXaolMove}
 	};
 	static constexpr struct {
 		const char *command;
@@ -308,7 +542,8 @@ HRESULT IMAP::HrProcessCommand(const std::string &strInput)
 
 		bool bPlus = (*lpcres == '+');
 		// no need to output the
-		if (!bPlus) {
+		// (nor when frame() already did, as the literal is then buffered)
+		if (!bPlus && lpChannel->pending().size() < ulByteCount) {
 			try {
 				HrResponse(RESP_CONTINUE, "Ready for literal data");
 			} catch (const KMAPIError &e) {
@@ -387,10 +622,16 @@ HRESULT IMAP::HrProcessCommand(const std::string &strInput)
 	for (const auto &cmd : cmds) {
 		if (strCommand != cmd.command || uid_command != cmd.uid)
 			continue;
-		if (strvResult.size() == cmd.params)
+		if (strvResult.size() >= static_cast<size_t>(cmd.params) &&
+		    strvResult.size() <= static_cast<size_t>(cmd.params + cmd.opt_params))
 			return (this->*cmd.func)(strTag, strvResult);
-		HrResponse(RESP_TAGGED_BAD, strTag, cmd.command +
-			" must have "s + stringify(cmd.params) + " arguments");
+		if (cmd.opt_params == 0)
+			HrResponse(RESP_TAGGED_BAD, strTag, cmd.command +
+				" must have "s + stringify(cmd.params) + " arguments");
+		else
+			HrResponse(RESP_TAGGED_BAD, strTag, cmd.command +
+				" must have "s + stringify(cmd.params) + " to " +
+				stringify(cmd.params + cmd.opt_params) + " arguments");
 		return hrSuccess;
 	}
 
@@ -413,6 +654,12 @@ HRESULT IMAP::HrProcessCommand(const std::string &strInput)
 		}
 		HrResponse(RESP_TAGGED_BAD, strTag, "APPEND must have 2, 3 or 4 arguments");
 		return hrSuccess;
+	} else if (strCommand == "ENABLE" && !uid_command) {
+		if (strvResult.empty()) {
+			HrResponse(RESP_TAGGED_BAD, strTag, "ENABLE must have 1 or more arguments");
+			return hrSuccess;
+		}
+		return HrCmdEnable(strTag, strvResult);
 	} else if (strCommand == "SEARCH" && !uid_command) {
 		if (strvResult.empty()) {
 			HrResponse(RESP_TAGGED_BAD, strTag, "SEARCH must have 1 or more arguments");
@@ -433,6 +680,81 @@ HRESULT IMAP::HrProcessCommand(const std::string &strInput)
 	return hrSuccess;
 }
 
+/**
+ * Frames IMAP commands for the event process model. A command is a line,
+ * or, when that line ends in a literal ({n} or {n+}), the line, n bytes,
+ * and the rest of the command after them. For a synchronizing literal the
+ * client waits for a continuation first: FRAME_CONTINUE has a worker send
+ * it (HrSendContinuation), so that the reactor thread does not write, and
+ * the literal is then read by the event loop rather than by a worker.
+ *
+ * A literal over imap_max_messagesize is not read ahead: the worker lets
+ * HrProcessCommand discard it as in the other process models.
+ */
+ClientProto::frame_t IMAP::frame(const std::string &in)
+{
+	size_t line_max = isAuthenticated() ? AUTHENTICATED_MAX_MESSAGE_SIZE : UNAUTHENTICATED_MAX_MESSAGE_SIZE;
+	size_t literal_max = isAuthenticated() ?
+		atoui(lpConfig->GetSetting("imap_max_messagesize")) : UNAUTHENTICATED_MAX_MESSAGE_SIZE;
+	auto reset = [this](frame_t f) {
+		m_frame_pos = m_frame_line = m_frame_literal = 0;
+		return f;
+	};
+
+	while (true) {
+		if (m_frame_literal > 0) {
+			auto n = std::min(m_frame_literal, in.size() - m_frame_pos);
+			m_frame_pos += n;
+			m_frame_literal -= n;
+			if (m_frame_literal > 0)
+				return FRAME_MORE;
+			m_frame_line = m_frame_pos;
+		}
+		auto nl = in.find('\n', m_frame_pos);
+		if (nl == std::string::npos) {
+			m_frame_pos = in.size();
+			return m_frame_pos - m_frame_line < line_max ? FRAME_MORE : reset(FRAME_TOO_BIG);
+		}
+		if (nl - m_frame_line > line_max)
+			return reset(FRAME_TOO_BIG);
+
+		/* Does the line end in a literal, as HrProcessCommand sees it? */
+		auto end = nl;
+		if (end > m_frame_line && in[end-1] == '\r')
+			--end;
+		if (end == m_frame_line || in[end-1] != '}')
+			return reset(FRAME_COMMAND);
+		auto digits_end = end - 1;
+		bool plus = digits_end > m_frame_line && in[digits_end-1] == '+';
+		if (plus)
+			--digits_end;
+		auto digits = digits_end;
+		while (digits > m_frame_line && isdigit(static_cast<unsigned char>(in[digits-1])))
+			--digits;
+		if (digits == digits_end || digits == m_frame_line || in[digits-1] != '{' ||
+		    (digits - 1 > m_frame_line && in[digits-2] != ' '))
+			return reset(FRAME_COMMAND);
+		auto count = strtoull(in.substr(digits, digits_end - digits).c_str(), nullptr, 10);
+		if (count > literal_max)
+			return reset(isAuthenticated() ? FRAME_HANDOFF : FRAME_TOO_BIG);
+		m_frame_literal = count;
+		m_frame_pos = m_frame_line = nl + 1;
+		if (!plus && in.size() == m_frame_pos)
+			return FRAME_CONTINUE;
+	}
+}
+
+HRESULT IMAP::HrSendContinuation()
+{
+	try {
+		HrResponse(RESP_CONTINUE, "Ready for literal data");
+	} catch (const KMAPIError &e) {
+		ec_log_err("Error sending during continuation");
+		return e.code();
+	}
+	return hrSuccess;
+}
+
 /**
  * Continue command, only supported for AUTHENTICATE command
  *
@@ -473,7 +795,7 @@ std::string IMAP::GetCapabilityString(bool bAllFlags)
 	}
 	if (lpSession || bAllFlags) {
 		// capabilities after authentication
-		strCapabilities += " CHILDREN XAOL-OPTION NAMESPACE QUOTA";
+		strCapabilities += " CHILDREN XAOL-OPTION NAMESPACE QUOTA ENABLE CONDSTORE QRESYNC";
 		if (parse_yesno(idle))
 			strCapabilities += " IDLE";
 	}
@@ -781,7 +1103,10 @@ int IMAP::check_mboxname_with_resp(const std::wstring &s,
 /**
  * @brief Handles the SELECT and EXAMINE commands
  *
- * Make the strFolder the current working folder.
+ * Make the strFolder the current working folder. The optional second
+ * argument holds the RFC 7162 select parameters: CONDSTORE, or QRESYNC
+ * with the UIDVALIDITY and MODSEQ the client last saw (and optionally
+ * the UIDs it knows), so that it is only sent what changed since.
  *
  * @param[in]	strTag	IMAP command tag
  * @param[in]	strFolder	IMAP folder name in UTF-7 something charset
@@ -795,11 +1120,23 @@ HRESULT IMAP::HrCmdSelect(const std::string &strTag,
 	ULONG ulUIDValidity = 1;
 	const std::string &strFolder = args[0];
 	std::string command = bReadOnly ? "EXAMINE" : "SELECT";
+	imap_select_params sp;
 
 	if (!lpSession) {
 		HrResponse(RESP_TAGGED_NO, strTag, command + " error no session");
 		return MAPI_E_CALL_FAILED;
 	}
+	if (args.size() > 1) {
+		/* QRESYNC is only allowed after ENABLE QRESYNC */
+		if (!imap_parse_select_params(args[1], m_bQresync, sp)) {
+			HrResponse(RESP_TAGGED_BAD, strTag, command + " invalid parameters");
+			return MAPI_E_CALL_FAILED;
+		}
+		if (sp.condstore)
+			m_bCondstore = true;
+	}
+	if (m_bQresync && !strCurrentFolder.empty())
+		HrResponse(RESP_UNTAGGED, "OK [CLOSED] Previous mailbox closed");
 
 	// close old contents table if cached version was open
 	ReleaseContentsCache();
@@ -835,11 +1172,67 @@ HRESULT IMAP::HrCmdSelect(const std::string &strTag,
 	}
 	snprintf(szResponse, sizeof(szResponse), "OK [UIDVALIDITY %u] UIDVALIDITY value", ulUIDValidity);
 	HrResponse(RESP_UNTAGGED, szResponse);
+	if (m_sync.strState.empty()) {
+		HrResponse(RESP_UNTAGGED, "OK [NOMODSEQ] No permanent modsequences");
+	} else {
+		snprintf(szResponse, sizeof(szResponse), "OK [HIGHESTMODSEQ %u] Highest", m_sync.ulHighestModSeq);
+		HrResponse(RESP_UNTAGGED, szResponse);
+	}
+
+	/* With a matching UIDVALIDITY, only what changed since the client's MODSEQ */
+	if (sp.qresync && sp.uidvalidity == ulUIDValidity && !m_sync.strState.empty()) {
+		auto vanished = VanishedSince(sp.modseq, sp.known_uids);
+		if (!vanished.empty())
+			HrResponse(RESP_UNTAGGED, "VANISHED (EARLIER) " + imap_seq_ranges(vanished));
+		for (size_t i = 0; i < lstFolderMailEIDs.size(); ++i) {
+			const auto &m = lstFolderMailEIDs[i];
+			if (m.ulModSeq > sp.modseq)
+				HrResponse(RESP_UNTAGGED, stringify(i + 1) + " FETCH (UID " +
+					stringify(m.ulUid) + " FLAGS (" + FlagBitsToString(m.ulFlags, m.bRecent) +
+					") MODSEQ (" + stringify(m.ulModSeq) + "))");
+		}
+	}
 	HrResponse(RESP_TAGGED_OK, strTag, bReadOnly ?
 		"[READ-ONLY] EXAMINE completed" : "[READ-WRITE] SELECT completed");
 	return hrSuccess;
 }
 
+/**
+ * @brief Handles the ENABLE command (RFC 5161)
+ *
+ * Turns on the CONDSTORE and QRESYNC extensions (RFC 7162) for the
+ * rest of the session. QRESYNC implies CONDSTORE.
+ *
+ * @param[in] strTag the IMAP tag for this command
+ * @param[in] args the extensions to enable
+ *
+ * @return MAPI Error code
+ */
+HRESULT IMAP::HrCmdEnable(const std::string &strTag, const std::vector<std::string> &args)
+{
+	std::string strEnabled = "ENABLED";
+
+	if (!lpSession) {
+		HrResponse(RESP_TAGGED_NO, strTag, "ENABLE error no session");
+		return MAPI_E_CALL_FAILED;
+	}
+	for (const auto &arg : args) {
+		auto ext = strToUpper(arg);
+		if (ext == "CONDSTORE" && !m_bCondstore) {
+			EnableCondstore();
+		} else if (ext == "QRESYNC" && !m_bQresync) {
+			m_bQresync = true;
+			EnableCondstore();
+		} else {
+			continue;
+		}
+		strEnabled += " " + ext;
+	}
+	HrResponse(RESP_UNTAGGED, strEnabled);
+	HrResponse(RESP_TAGGED_OK, strTag, "ENABLE completed");
+	return hrSuccess;
+}
+
 /**
  * @brief Handles the CREATE command
  *
@@ -1695,6 +2088,7 @@ HRESULT IMAP::HrCmdClose(const std::string &strTag)
 		goto exit;
 	HrResponse(RESP_TAGGED_OK, strTag, "CLOSE completed");
 exit:
+	ReleaseFolderState();
 	strCurrentFolder.clear();	// always "close" the SELECT command
 	current_folder_state.first = L"";
 	current_folder_state.second = false;
@@ -1759,9 +2153,10 @@ HRESULT IMAP::HrCmdSearch(const std::string &strTag,
     std::vector<std::string> &lstSearchCriteria, bool bUidMode)
 {
 	std::list<ULONG> lstMailnr;
-	ULONG ulCriterianr = 0;
+	ULONG ulCriterianr = 0, ulModSeq = 0, ulMaxModSeq = 0;
 	char szBuffer[33];
 	std::string strMode = bUidMode ? "UID " : "";
+	bool bModSeq = false;
 
 	if (strCurrentFolder.empty() || !lpSession) {
 		HrResponse(RESP_TAGGED_NO, strTag, strMode + "SEARCH error no folder");
@@ -1770,6 +2165,28 @@ HRESULT IMAP::HrCmdSearch(const std::string &strTag,
 	if (lstSearchCriteria[0] == "CHARSET")
 		/* No support for other charsets; skip the fields. */
 		ulCriterianr += 2;
+	/*
+	 * MODSEQ [entry-name entry-type] modseq (RFC 7162), matched against
+	 * the MODSEQs we keep. Only supported outside of OR/NOT.
+	 */
+	for (size_t i = ulCriterianr; i < lstSearchCriteria.size(); ++i) {
+		if (strToUpper(lstSearchCriteria[i]) != "MODSEQ")
+			continue;
+		size_t n = i + 1 < lstSearchCriteria.size() && lstSearchCriteria[i+1][0] == '/' ? 3 : 1;
+		if (i + n >= lstSearchCriteria.size()) {
+			HrResponse(RESP_TAGGED_BAD, strTag, strMode + "SEARCH invalid MODSEQ");
+			return MAPI_E_CALL_FAILED;
+		}
+		ulModSeq = strtoul(lstSearchCriteria[i+n].c_str(), nullptr, 10);
+		lstSearchCriteria.erase(lstSearchCriteria.begin() + i, lstSearchCriteria.begin() + i + n + 1);
+		bModSeq = true;
+		break;
+	}
+	if (bModSeq) {
+		EnableCondstore();
+		if (lstSearchCriteria.size() == ulCriterianr)
+			lstSearchCriteria.emplace_back("ALL");
+	}
 	auto hr = HrSearch(std::move(lstSearchCriteria), ulCriterianr, lstMailnr);
 	if (hr != hrSuccess) {
 		HrResponse(RESP_TAGGED_NO, strTag, strMode + "SEARCH error");
@@ -1778,9 +2195,14 @@ HRESULT IMAP::HrCmdSearch(const std::string &strTag,
 
 	std::string strResponse = "SEARCH";
 	for (auto nr : lstMailnr) {
+		if (bModSeq && lstFolderMailEIDs[nr].ulModSeq < ulModSeq)
+			continue;
+		ulMaxModSeq = std::max(ulMaxModSeq, lstFolderMailEIDs[nr].ulModSeq);
 		snprintf(szBuffer, 32, " %u", bUidMode ? lstFolderMailEIDs[nr].ulUid : nr + 1);
 		strResponse += szBuffer;
 	}
+	if (bModSeq && ulMaxModSeq != 0)
+		strResponse += " (MODSEQ " + stringify(ulMaxModSeq) + ")";
 
 	HrResponse(RESP_UNTAGGED, strResponse);
 	HrResponse(RESP_TAGGED_OK, strTag, strMode + "SEARCH completed");
@@ -1801,9 +2223,11 @@ HRESULT IMAP::HrCmdSearch(const std::string &strTag,
  */
 HRESULT IMAP::HrCmdFetch(const std::string &strTag, const std::vector<std::string> &args, bool bUidMode)
 {
-	std::vector<std::string> lstDataItems;
+	std::vector<std::string> lstDataItems, lstModifiers;
 	std::list<ULONG> lstMails;
 	bool bFound = false;
+	imap_fetch_modifiers fm;
+	std::string strError;
 	const std::string &strSeqSet = args[0];
 	const std::string &strMsgDataItemNames = args[1];
 	std::string strMode = bUidMode ? "UID " : "";
@@ -1813,6 +2237,14 @@ HRESULT IMAP::HrCmdFetch(const std::string &strTag, const std::vector<std::strin
 		return MAPI_E_CALL_FAILED;
 	}
 
+	/* (CHANGEDSINCE modseq [VANISHED]), RFC 7162 */
+	if (args.size() > 2)
+		HrGetDataItems(args[2], lstModifiers);
+	if (!imap_parse_fetch_modifiers(lstModifiers, bUidMode, m_bQresync, fm, strError)) {
+		HrResponse(RESP_TAGGED_BAD, strTag, strMode + "FETCH " + strError);
+		return MAPI_E_CALL_FAILED;
+	}
+
 	HrGetDataItems(strMsgDataItemNames, lstDataItems);
 	if (bUidMode) {
 		for (unsigned int ulCurrent = 0; !bFound && ulCurrent < lstDataItems.size(); ++ulCurrent)
@@ -1821,6 +2253,11 @@ HRESULT IMAP::HrCmdFetch(const std::string &strTag, const std::vector<std::strin
 		if (!bFound)
 			lstDataItems.emplace_back("UID");
 	}
+	bFound = std::find(lstDataItems.cbegin(), lstDataItems.cend(), "MODSEQ") != lstDataItems.cend();
+	if (fm.changedsince && !bFound)
+		lstDataItems.emplace_back("MODSEQ");
+	if (fm.changedsince || bFound)
+		EnableCondstore();
 
 	auto hr = bUidMode ? HrParseSeqUidSet(strSeqSet, lstMails) :
 	          HrParseSeqSet(strSeqSet, lstMails);
@@ -1828,6 +2265,13 @@ HRESULT IMAP::HrCmdFetch(const std::string &strTag, const std::vector<std::strin
 		HrResponse(RESP_TAGGED_NO, strTag, strMode + "FETCH sequence parse error in: " + strSeqSet);
 		return hr;
 	}
+	if (fm.changedsince)
+		lstMails.remove_if([&](ULONG n) { return lstFolderMailEIDs[n].ulModSeq <= fm.modseq; });
+	if (fm.vanished) {
+		auto vanished = VanishedSince(fm.modseq, strSeqSet);
+		if (!vanished.empty())
+			HrResponse(RESP_UNTAGGED, "VANISHED (EARLIER) " + imap_seq_ranges(vanished));
+	}
 
 	hr = HrPropertyFetch(lstMails, lstDataItems);
 	if (hr != hrSuccess)
@@ -1853,11 +2297,15 @@ HRESULT IMAP::HrCmdFetch(const std::string &strTag, const std::vector<std::strin
 HRESULT IMAP::HrCmdStore(const std::string &strTag, const std::vector<std::string> &args, bool bUidMode)
 {
 	std::list<ULONG> lstMails;
-	std::vector<std::string> lstDataItems;
-	bool bDelete = false;
+	std::vector<std::string> lstDataItems, lstModifiers;
+	std::vector<std::pair<ULONG, ULONG>> lstModified;
+	bool bDelete = false, bUnchangedSince = false;
+	ULONG ulUnchangedSince = 0;
+	/* (UNCHANGEDSINCE modseq) may precede the item, RFC 7162 */
+	size_t ulItem = args.size() > 3 ? 2 : 1;
 	const std::string &strSeqSet = args[0];
-	const std::string &strMsgDataItemName = args[1];
-	const std::string &strMsgDataItemValue = args[2];
+	const std::string &strMsgDataItemName = args[ulItem];
+	const std::string &strMsgDataItemValue = args[ulItem+1];
 	std::string strMode = bUidMode ? "UID" : "";
 	strMode += " STORE";
 
@@ -1870,21 +2318,58 @@ HRESULT IMAP::HrCmdStore(const std::string &strTag, const std::vector<std::strin
 		HrResponse(RESP_TAGGED_NO, strTag, strMode + " error folder read only");
 		return MAPI_E_CALL_FAILED;
 	}
+	if (ulItem > 1)
+		HrGetDataItems(args[1], lstModifiers);
+	if (lstModifiers.size() == 2 && lstModifiers[0] == "UNCHANGEDSINCE") {
+		ulUnchangedSince = strtoul(lstModifiers[1].c_str(), nullptr, 10);
+		bUnchangedSince = true;
+		EnableCondstore();
+	} else if (ulItem > 1) {
+		HrResponse(RESP_TAGGED_BAD, strTag, strMode + " invalid modifier " + args[1]);
+		return MAPI_E_CALL_FAILED;
+	}
 	lstDataItems.emplace_back("FLAGS");
 	if (bUidMode)
 		lstDataItems.emplace_back("UID");
+	if (m_bCondstore) {
+		lstDataItems.emplace_back("MODSEQ");
+		/* Current MODSEQs, for UNCHANGEDSINCE and to tell ours apart later */
+		HrRefreshFolderMails(false, !bCurrentFolderReadOnly, nullptr, nullptr, false);
+	}
 	auto hr = bUidMode ? HrParseSeqUidSet(strSeqSet, lstMails) :
 	          HrParseSeqSet(strSeqSet, lstMails);
 	if (hr != hrSuccess) {
 		HrResponse(RESP_TAGGED_NO, strTag, strMode + " sequence parse error in: " + strSeqSet);
 		return hr;
 	}
+	/*
+	 * Changes made by others between this check and our store can go
+	 * unnoticed: MAPI has no conditional write, so this is best effort.
+	 */
+	if (bUnchangedSince)
+		lstMails.remove_if([&](ULONG n) {
+			if (lstFolderMailEIDs[n].ulModSeq <= ulUnchangedSince)
+				return false;
+			auto id = bUidMode ? lstFolderMailEIDs[n].ulUid : n + 1;
+			lstModified.emplace_back(id, id);
+			return true;
+		});
 
 	hr = HrStore(lstMails, strMsgDataItemName, strMsgDataItemValue, &bDelete);
+	if (m_bCondstore)
+		/* Picks up the MODSEQs of our changes, without reporting them twice */
+		HrRefreshFolderMails(false, !bCurrentFolderReadOnly, nullptr, nullptr, false);
 	if (hr != MAPI_E_NOT_ME) {
 		HrPropertyFetch(lstMails, lstDataItems);
 		hr = hrSuccess;
+	} else if (bUnchangedSince) {
+		/* RFC 7162: MODSEQ even when silent */
+		lstDataItems.erase(lstDataItems.begin());
+		HrPropertyFetch(lstMails, lstDataItems);
+		hr = hrSuccess;
 	}
+	for (auto n : lstMails)
+		lstFolderMailEIDs[n].bStored = false;
 
 	if (bDelete && parseBool(lpConfig->GetSetting("imap_expunge_on_delete"))) {
 		std::unique_ptr<ECRestriction> rst;
@@ -1902,7 +2387,11 @@ HRESULT IMAP::HrCmdStore(const std::string &strTag, const std::vector<std::strin
 		HrRefreshFolderMails(false, !bCurrentFolderReadOnly, NULL);
 	}
 
-	HrResponse(RESP_TAGGED_OK, strTag, strMode + " completed");
+	if (!lstModified.empty())
+		HrResponse(RESP_TAGGED_OK, strTag, "[MODIFIED " + imap_seq_ranges(lstModified) +
+			"] " + strMode + " completed, some messages were modified");
+	else
+		HrResponse(RESP_TAGGED_OK, strTag, strMode + " completed");
 	return hr;
 }
 
@@ -2021,7 +2510,22 @@ HRESULT IMAP::HrCmdUidXaolMove(const std::string &strTag, const std::vector<std:
  * @return string with IMAP Flags
  */
 std::string IMAP::PropsToFlags(LPSPropValue lpProps, unsigned int cValues, bool bRecent, bool bRead) {
-	std::string strFlags;
+	return FlagBitsToString(PropsToFlagBits(lpProps, cValues, bRead), bRecent);
+}
+
+/**
+ * Convert a MAPI array of properties to the IMAP_FLAG_* bits kept per
+ * message in lstFolderMailEIDs.
+ *
+ * @param[in] lpProps Array of MAPI properties
+ * @param[in] cValues Number of properties in lpProps
+ * @param[in] bRead Set \Seen regardless of PR_MESSAGE_FLAGS
+ *
+ * @return IMAP_FLAG_* bits
+ */
+unsigned int IMAP::PropsToFlagBits(const SPropValue *lpProps, unsigned int cValues, bool bRead)
+{
+	unsigned int ulFlags = 0;
 	auto lpMessageFlags = PCpropFindProp(lpProps, cValues, PR_MESSAGE_FLAGS);
 	auto lpFlagStatus = PCpropFindProp(lpProps, cValues, PR_FLAG_STATUS);
 	auto lpMsgStatus = PCpropFindProp(lpProps, cValues, PR_MSG_STATUS);
@@ -2029,30 +2533,56 @@ std::string IMAP::PropsToFlags(LPSPropValue lpProps, unsigned int cValues, bool
 
 	if ((lpMessageFlags != NULL &&
 	    lpMessageFlags->Value.ul & MSGFLAG_READ) || bRead)
-		strFlags += "\\Seen ";
+		ulFlags |= IMAP_FLAG_SEEN;
 	if (lpFlagStatus != NULL && lpFlagStatus->Value.ul != 0)
-		strFlags += "\\Flagged ";
+		ulFlags |= IMAP_FLAG_FLAGGED;
 
 	if (lpLastVerb) {
 		if (lpLastVerb->Value.ul == NOTEIVERB_REPLYTOSENDER ||
 		    lpLastVerb->Value.ul == NOTEIVERB_REPLYTOALL)
-			strFlags += "\\Answered ";
+			ulFlags |= IMAP_FLAG_ANSWERED;
 		// there is no flag in imap for forwards. thunderbird uses the custom flag $Forwarded,
 		// and this is the only custom flag we support.
 		if (lpLastVerb->Value.ul == NOTEIVERB_FORWARD)
-			strFlags += "$Forwarded ";
+			ulFlags |= IMAP_FLAG_FORWARDED;
 	}
 
 	if (lpMsgStatus) {
 		if (lpMsgStatus->Value.ul & MSGSTATUS_DRAFT)
-			strFlags += "\\Draft ";
+			ulFlags |= IMAP_FLAG_DRAFT;
 		if (lpLastVerb == NULL &&
 		    lpMsgStatus->Value.ul & MSGSTATUS_ANSWERED)
-			strFlags += "\\Answered ";
+			ulFlags |= IMAP_FLAG_ANSWERED;
 		if (lpMsgStatus->Value.ul & MSGSTATUS_DELMARKED)
-			strFlags += "\\Deleted ";
+			ulFlags |= IMAP_FLAG_DELETED;
 	}
+	return ulFlags;
+}
 
+/**
+ * Convert IMAP_FLAG_* bits to an IMAP FLAGS list (without the ()).
+ *
+ * @param[in] ulFlags IMAP_FLAG_* bits
+ * @param[in] bRecent Add the recent flag to the list
+ *
+ * @return string with IMAP Flags
+ */
+std::string IMAP::FlagBitsToString(unsigned int ulFlags, bool bRecent)
+{
+	std::string strFlags;
+
+	if (ulFlags & IMAP_FLAG_SEEN)
+		strFlags += "\\Seen ";
+	if (ulFlags & IMAP_FLAG_FLAGGED)
+		strFlags += "\\Flagged ";
+	if (ulFlags & IMAP_FLAG_ANSWERED)
+		strFlags += "\\Answered ";
+	if (ulFlags & IMAP_FLAG_FORWARDED)
+		strFlags += "$Forwarded ";
+	if (ulFlags & IMAP_FLAG_DRAFT)
+		strFlags += "\\Draft ";
+	if (ulFlags & IMAP_FLAG_DELETED)
+		strFlags += "\\Deleted ";
 	if (bRecent)
 	    strFlags += "\\Recent ";
 	// strip final space
@@ -2075,22 +2605,6 @@ int IMAP::IdleAdviseCallback2(void *lpContext, unsigned int cNotif,
     LPNOTIFICATION lpNotif)
 {
 	auto lpIMAP = static_cast<IMAP *>(lpContext);
-	std::string strFlags;
-	unsigned int ulMailNr = 0, ulRecent = 0;
-	bool bReload = false;
-	std::vector<IMAP::SMail> oldMails;
-	enum { EID, IKEY, IMAPID, MESSAGE_FLAGS, FLAG_STATUS, MSG_STATUS, LAST_VERB, NUM_COLS };
-	IMAP::SMail sMail;
-
-	{
-		// modify:
-		// * [mailnr] FETCH (FLAGS (\Seen \Recent \Flagged \Deleted))
-		// remove:
-		// * [mailnr] EXPUNGE
-		// new mail/add:
-		// * [total] exists (optional?)
-		// * 1 recent
-	}
 
 	if (!lpIMAP)
 		return MAPI_E_CALL_FAILED;
@@ -2099,67 +2613,84 @@ int IMAP::IdleAdviseCallback2(void *lpContext, unsigned int cNotif,
 	if (!lpIMAP->m_bIdleMode)
 		return MAPI_E_CALL_FAILED;
 
+	/*
+	 * With ICS, the refresh asks for just what changed, and sends the
+	 * client the EXPUNGE, FETCH, EXISTS and RECENT responses for it.
+	 */
+	if (!lpIMAP->m_sync.strState.empty()) {
+		for (ULONG i = 0; i < cNotif; ++i) {
+			if (lpNotif[i].ulEventType != fnevTableModified)
+				continue;
+			lpIMAP->HrRefreshFolderMails(false, !lpIMAP->bCurrentFolderReadOnly, NULL);
+			break;
+		}
+		return S_OK;
+	}
+
+	/* Without, the rows are applied one by one */
+	auto &lstMails = lpIMAP->lstFolderMailEIDs;
+	unsigned int ulRecent = 0;
+	bool bReload = false;
 	for (ULONG i = 0; i < cNotif && !bReload; ++i) {
 		if (lpNotif[i].ulEventType != fnevTableModified)
 			continue;
+		const auto &tab = lpNotif[i].info.tab;
+		const auto &row = tab.row;
+		bool bRow = row.cValues == ML_NUM_COLS &&
+		            row.lpProps[ML_EID].ulPropTag == PR_ENTRYID &&
+		            row.lpProps[ML_IMAPID].ulPropTag == PR_EC_IMAP_ID;
 
-		switch (lpNotif[i].info.tab.ulTableEvent) {
+		switch (tab.ulTableEvent) {
 		case TABLE_ROW_ADDED:
-			sMail.sEntryID = lpNotif[i].info.tab.row.lpProps[EID].Value.bin;
-			sMail.sInstanceKey = lpNotif[i].info.tab.propIndex.Value.bin;
+		case TABLE_ROW_MODIFIED: {
+			if (!bRow) {
+				bReload = true;
+				break;
+			}
+			auto ulUid = row.lpProps[ML_IMAPID].Value.ul;
+			auto iterMail = std::lower_bound(lstMails.begin(), lstMails.end(), ulUid);
+			if (iterMail != lstMails.end() && iterMail->ulUid == ulUid) {
+				iterMail->ullInstanceKey = InstanceKeyId(row.lpProps[ML_IKEY]);
+				lpIMAP->MailChanged(iterMail - lstMails.begin(),
+					lpIMAP->PropsToFlagBits(row.lpProps, row.cValues, false),
+					lpIMAP->m_sync.ulHighestModSeq, true);
+				break;
+			}
+			SMail sMail;
+			lpIMAP->MailFromRow(row, sMail);
 			sMail.bRecent = true;
-
-			if (lpNotif[i].info.tab.row.lpProps[IMAPID].ulPropTag == PR_EC_IMAP_ID)
-				sMail.ulUid = lpNotif[i].info.tab.row.lpProps[IMAPID].Value.ul;
-
-			sMail.strFlags = lpIMAP->PropsToFlags(lpNotif[i].info.tab.row.lpProps, lpNotif[i].info.tab.row.cValues, true, false);
-			lpIMAP->lstFolderMailEIDs.emplace_back(sMail);
 			lpIMAP->m_ulLastUid = std::max(lpIMAP->m_ulLastUid, sMail.ulUid);
+			lstMails.emplace(iterMail, std::move(sMail));
 			++ulRecent;
 			break;
-
-		case TABLE_ROW_DELETED: {
-			// find number and print N EXPUNGE
-			if (lpNotif[i].info.tab.propIndex.ulPropTag != PR_INSTANCE_KEY)
-				break;
-			auto iterMail = lpIMAP->lstFolderMailEIDs.begin();
-			for (; iterMail != lpIMAP->lstFolderMailEIDs.cend(); ++iterMail)
-				if (iterMail->sInstanceKey == lpNotif[i].info.tab.propIndex.Value.bin)
-					break;
-			if (iterMail == lpIMAP->lstFolderMailEIDs.cend())
-				break;
-			ulMailNr = iterMail - lpIMAP->lstFolderMailEIDs.cbegin();
-			// remove mail from list
-			lpIMAP->HrResponse(RESP_UNTAGGED, stringify(ulMailNr + 1) + " EXPUNGE");
-			lpIMAP->lstFolderMailEIDs.erase(iterMail);
-			break;
 		}
-		case TABLE_ROW_MODIFIED: {
-			// find number and print N FETCH (FLAGS (flags...))
-			strFlags.clear();
-			if (lpNotif[i].info.tab.row.lpProps[IMAPID].ulPropTag != PR_EC_IMAP_ID)
-				break;
-			auto iterMail = std::find(lpIMAP->lstFolderMailEIDs.cbegin(), lpIMAP->lstFolderMailEIDs.cend(), lpNotif[i].info.tab.row.lpProps[IMAPID].Value.ul);
-			// not found probably means the client needs to sync
-			if (iterMail == lpIMAP->lstFolderMailEIDs.cend())
+		case TABLE_ROW_DELETED: {
+			auto ullKey = InstanceKeyId(tab.propIndex);
+			if (ullKey == 0) {
+				bReload = true;
 				break;
-			ulMailNr = iterMail - lpIMAP->lstFolderMailEIDs.cbegin();
-			strFlags = lpIMAP->PropsToFlags(lpNotif[i].info.tab.row.lpProps, lpNotif[i].info.tab.row.cValues, iterMail->bRecent, false);
-			lpIMAP->HrResponse(RESP_UNTAGGED, stringify(ulMailNr+1) + " FETCH (FLAGS (" + strFlags + "))");
+			}
+			auto iterMail = std::find_if(lstMails.cbegin(), lstMails.cend(),
+				[&](const SMail &m) { return m.ullInstanceKey == ullKey; });
+			if (iterMail != lstMails.cend())
+				lpIMAP->ExpungeMails({static_cast<size_t>(iterMail - lstMails.cbegin())},
+					lpIMAP->m_sync.ulHighestModSeq, true, true);
 			break;
 		}
 		case TABLE_RELOAD:
-			// TABLE_RELOAD is unused in Kopano
 		case TABLE_CHANGED:
-            lpIMAP->HrRefreshFolderMails(false, !lpIMAP->bCurrentFolderReadOnly, NULL);
-		    break;
-		};
+			bReload = true;
+			break;
+		}
 	}
 
-	if (ulRecent == 0)
-		return S_OK;
-	lpIMAP->HrResponse(RESP_UNTAGGED, stringify(ulRecent) + " RECENT");
-	lpIMAP->HrResponse(RESP_UNTAGGED, stringify(lpIMAP->lstFolderMailEIDs.size()) + " EXISTS");
+	if (ulRecent != 0) {
+		lpIMAP->HrResponse(RESP_UNTAGGED, stringify(ulRecent) + " RECENT");
+		lpIMAP->HrResponse(RESP_UNTAGGED, stringify(lstMails.size()) + " EXISTS");
+	}
+	/* The table changed as a whole, or a row could not be placed */
+	if (bReload)
+		lpIMAP->HrRefreshFolderMails(false, !lpIMAP->bCurrentFolderReadOnly, NULL);
 	return S_OK;
 }
 
@@ -2189,11 +2720,6 @@ int IMAP::IdleAdviseCallback(void *ctx, unsigned int z, NOTIFICATION *nt)
 HRESULT IMAP::HrCmdIdle(const std::string &strTag)
 {
 	object_ptr<IMAPIFolder> lpFolder;
-	enum { EID, IKEY, IMAPID, MESSAGE_FLAGS, FLAG_STATUS, MSG_STATUS, LAST_VERB, NUM_COLS };
-	static constexpr SizedSPropTagArray(NUM_COLS, spt) =
-		{NUM_COLS, {PR_ENTRYID, PR_INSTANCE_KEY, PR_EC_IMAP_ID,
-		PR_MESSAGE_FLAGS, PR_FLAG_STATUS, PR_MSG_STATUS,
-		PR_LAST_VERB_EXECUTED}};
 	ulock_normal l_idle(m_mIdleLock, std::defer_lock_t());
 
 	// Outlook (express) IDLEs without selecting a folder.
@@ -2212,7 +2738,8 @@ HRESULT IMAP::HrCmdIdle(const std::string &strTag)
 		HrResponse(RESP_CONTINUE, "Can't open selected contents table to idle in");
 		goto exit;
 	}
-	hr = m_lpIdleTable->SetColumns(spt, 0);
+	/* Without ICS, the callback applies the rows in the notifications */
+	hr = m_lpIdleTable->SetColumns(sptaMailListCols, 0);
 	if (hr != hrSuccess) {
 		HrResponse(RESP_CONTINUE, "Cannot select columns on selected contents table for idle information");
 		goto exit;
@@ -2736,27 +3263,36 @@ bool IMAP::IsSpecialFolder(ULONG cbEntryID, ENTRYID *lpEntryID,
 	return true;
 }
 
+/* Change number of an ICS state: syncid, then changeid */
+static ULONG StateChangeId(const std::string &state)
+{
+	uint32_t id = 0;
+	if (state.size() >= 2 * sizeof(id))
+		memcpy(&id, state.data() + sizeof(id), sizeof(id));
+	return id;
+}
+
 /**
- * Make a list of all mails in the current selected folder.
+ * Make a list of all mails in the current selected folder. The list is
+ * kept up to date with ICS when possible, else by reading the whole folder.
  *
  * @param[in] bInitialLoad Create a new clean list of mails (false to append only)
  * @param[in] bResetRecent Update the value of PR_EC_IMAP_MAX_ID for this folder
  * @param[out] lpulUnseen The number of unread emails in this folder
  * @param[out] lpulUIDValidity The UIDVALIDITY value for this folder (optional)
+ * @param[in] bExpunge EXPUNGE responses may be sent; else messages that are gone stay in the list until they may
  *
  * @return MAPI Error code
  */
-HRESULT IMAP::HrRefreshFolderMails(bool bInitialLoad, bool bResetRecent, unsigned int *lpulUnseen, ULONG *lpulUIDValidity) {
+HRESULT IMAP::HrRefreshFolderMails(bool bInitialLoad, bool bResetRecent,
+    unsigned int *lpulUnseen, ULONG *lpulUIDValidity, bool bExpunge)
+{
 	object_ptr<IMAPIFolder> folder;
-	int n = 0;
-	SMail sMail;
 	bool bNewMail = false;
-	enum { EID, IKEY, IMAPID, MFLAGS, FLAGSTATUS, MSGSTATUS, LAST_VERB, NUM_COLS };
-	std::map<unsigned int, unsigned int> mapUIDs; // Map UID -> ID
 	SPropValue sPropMax;
-	unsigned int ulMailnr = 0, ulRecent = 0, ulUnseen = 0;
-	static constexpr SizedSPropTagArray(2, sPropsFolderIDs) =
-		{2, {PR_EC_IMAP_MAX_ID, PR_EC_HIERARCHYID}};
+	unsigned int ulRecent = 0, ulUnseen = 0;
+	static constexpr SizedSPropTagArray(3, sPropsFolderIDs) =
+		{3, {PR_EC_IMAP_MAX_ID, PR_EC_HIERARCHYID, PR_SOURCE_KEY}};
 	memory_ptr<SPropValue> lpFolderIDs;
 	ULONG cValues;
 
@@ -2769,120 +3305,572 @@ HRESULT IMAP::HrRefreshFolderMails(bool bInitialLoad, bool bResetRecent, unsigne
 
 	unsigned int ulMaxUID = lpFolderIDs[0].ulPropTag == PR_EC_IMAP_MAX_ID ?
 		lpFolderIDs[0].Value.ul : 0;
+	ULONG ulUIDValidity = lpFolderIDs[1].ulPropTag == PR_EC_HIERARCHYID ?
+		lpFolderIDs[1].Value.ul : 0;
+	if (bInitialLoad)
+		TakeFolderState(lpFolderIDs[2], ulUIDValidity, ulMaxUID);
 	if (lpulUIDValidity && lpFolderIDs[1].ulPropTag == PR_EC_HIERARCHYID)
-		*lpulUIDValidity = lpFolderIDs[1].Value.ul;
+		*lpulUIDValidity = ulUIDValidity;
+
+	if (bExpunge && !m_sync.lstPendingExpunge.empty()) {
+		std::vector<size_t> gone;
+		ULONG ulModSeq = 0;
+		for (const auto &p : m_sync.lstPendingExpunge) {
+			auto i = std::lower_bound(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), p.second);
+			if (i != lstFolderMailEIDs.cend() && i->ulUid == p.second)
+				gone.emplace_back(i - lstFolderMailEIDs.cbegin());
+			ulModSeq = std::max(ulModSeq, p.first);
+		}
+		m_sync.lstPendingExpunge.clear();
+		ExpungeMails(std::move(gone), ulModSeq, true);
+	}
 
-	static constexpr SizedSPropTagArray(7, cols) =
-		{7, {PR_ENTRYID, PR_INSTANCE_KEY, PR_EC_IMAP_ID,
-		PR_MESSAGE_FLAGS, PR_FLAG_STATUS, PR_MSG_STATUS,
-		PR_LAST_VERB_EXECUTED}};
+	hr = MAPI_E_NOT_FOUND;
+	if (m_sync.bLoaded && !m_sync.strState.empty())
+		hr = HrSyncFolderMails(folder, ulMaxUID, !bInitialLoad, bExpunge, bNewMail);
+	if (hr != hrSuccess) {
+		hr = HrScanFolderMails(folder, ulMaxUID, !bInitialLoad, bExpunge, bNewMail);
+		if (hr != hrSuccess)
+			return hr;
+	}
+
+	for (const auto &mail : lstFolderMailEIDs) {
+		if (mail.bRecent)
+			++ulRecent;
+		if (ulUnseen == 0 && !(mail.ulFlags & IMAP_FLAG_SEEN))
+			ulUnseen = &mail - lstFolderMailEIDs.data() + 1; // mail ID = position + 1
+	}
+	if (bNewMail || bInitialLoad) {
+		HrResponse(RESP_UNTAGGED, stringify(lstFolderMailEIDs.size()) + " EXISTS");
+		HrResponse(RESP_UNTAGGED, stringify(ulRecent) + " RECENT");
+	}
+
+    // Save the max UID so that other session will not see the items as \Recent
+    if(bResetRecent && ulRecent && ulMaxUID != m_ulLastUid) {
+    	sPropMax.ulPropTag = PR_EC_IMAP_MAX_ID;
+    	sPropMax.Value.ul = m_ulLastUid;
+		HrSetOneProp(folder, &sPropMax);
+    }
+	if (lpulUnseen)
+		*lpulUnseen = ulUnseen;
+	return hrSuccess;
+}
+
+/**
+ * Reads the whole folder and brings lstFolderMailEIDs in line with it.
+ * When ICS is used, the ICS state is moved up to now first, so that
+ * later refreshes only need what changed after the read.
+ *
+ * @param[in] lpFolder The selected folder
+ * @param[in] ulMaxUID PR_EC_IMAP_MAX_ID of the folder, for \Recent
+ * @param[in] bNotify Tell the client about changed and expunged messages
+ * @param[in] bExpunge EXPUNGE responses may be sent
+ * @param[out] bNewMail Set when messages were added to the list
+ *
+ * @return MAPI Error code
+ */
+HRESULT IMAP::HrScanFolderMails(IMAPIFolder *lpFolder, ULONG ulMaxUID,
+    bool bNotify, bool bExpunge, bool &bNewMail)
+{
 	static constexpr SizedSSortOrderSet(1, sortuid) =
 		{1, 0, 0, {{PR_EC_IMAP_ID, TABLE_SORT_ASCEND}}};
 	object_ptr<IMAPITable> table;
-	hr = folder->GetContentsTable(MAPI_DEFERRED_ERRORS, &~table);
+	ULONG ulModSeq = 0;
+
+	if (UseICS()) {
+		auto hr = HrExportChanges(lpFolder, SYNC_CATCHUP, nullptr, 0, m_sync.strState);
+		if (hr != hrSuccess) {
+			kc_perror("Unable to get the ICS state of the folder", hr);
+			m_sync.strState.clear();
+		}
+		ulModSeq = StateChangeId(m_sync.strState);
+	}
+	if (!m_sync.bLoaded) {
+		lstFolderMailEIDs.clear();
+		m_sync.mapForeignKeys.clear();
+		m_sync.lstVanished.clear();
+		m_sync.lstPendingExpunge.clear();
+		m_sync.ulBaseModSeq = ulModSeq;
+		m_ulLastUid = 0;
+	}
+
+	auto hr = lpFolder->GetContentsTable(MAPI_DEFERRED_ERRORS, &~table);
 	if (hr != hrSuccess)
 		return kc_perror("K-2396", hr);
-	hr = table->SetColumns(cols, TBL_BATCH);
+	hr = table->SetColumns(sptaMailListCols, TBL_BATCH);
 	if (hr != hrSuccess)
 		return kc_perror("K-2387", hr);
 	hr = table->SortTable(sortuid, TBL_BATCH);
 	if (hr != hrSuccess)
 		return kc_perror("K-2388", hr);
-    // Remember UIDs if needed
-    if(!bInitialLoad)
-		for (const auto &mail : lstFolderMailEIDs)
-			mapUIDs[mail.ulUid] = n++;
-
-    if(bInitialLoad) {
-        lstFolderMailEIDs.clear();
-		m_ulLastUid = 0;
-    }
 
-	auto iterMail = lstFolderMailEIDs.cbegin();
-    // Scan MAPI for new and existing messages
-	while(1) {
+	std::vector<bool> seen(lstFolderMailEIDs.size());
+	std::vector<SMail> lstNew;
+	while (true) {
 		rowset_ptr lpRows;
 		hr = table->QueryRows(ROWS_PER_REQUEST_BIG, 0, &~lpRows);
 		if (hr != hrSuccess)
 			return hr;
-        if(lpRows->cRows == 0)
-            break;
+		if (lpRows->cRows == 0)
+			break;
 
-		for (ulMailnr = 0; ulMailnr < lpRows->cRows; ++ulMailnr) {
-            if (lpRows[ulMailnr].lpProps[EID].ulPropTag != PR_ENTRYID ||
-                lpRows[ulMailnr].lpProps[IKEY].ulPropTag != PR_INSTANCE_KEY ||
-                lpRows[ulMailnr].lpProps[IMAPID].ulPropTag != PR_EC_IMAP_ID)
-                continue;
-
-            auto iterUID = mapUIDs.find(lpRows[ulMailnr].lpProps[IMAPID].Value.ul);
-		    if(iterUID == mapUIDs.end()) {
-		        // There is a new message
-                sMail.sEntryID = lpRows[ulMailnr].lpProps[EID].Value.bin;
-                sMail.sInstanceKey = lpRows[ulMailnr].lpProps[IKEY].Value.bin;
-                sMail.ulUid = lpRows[ulMailnr].lpProps[IMAPID].Value.ul;
-
-                // Mark as recent if the message has a UID higher than the last highest read UID
-                // in this folder. This means that this session is the only one to see the message
-                // as recent.
-                sMail.bRecent = sMail.ulUid > ulMaxUID;
-                // Remember flags
-                sMail.strFlags = PropsToFlags(lpRows[ulMailnr].lpProps, lpRows[ulMailnr].cValues, sMail.bRecent, false);
-                // Put message on the end of our message
-				lstFolderMailEIDs.emplace_back(sMail);
+		for (ULONG i = 0; i < lpRows->cRows; ++i) {
+			const auto &row = lpRows->aRow[i];
+			if (row.lpProps[ML_EID].ulPropTag != PR_ENTRYID ||
+			    row.lpProps[ML_IMAPID].ulPropTag != PR_EC_IMAP_ID)
+				continue;
+			auto ulUid = row.lpProps[ML_IMAPID].Value.ul;
+			auto iterMail = std::lower_bound(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), ulUid);
+			if (iterMail == lstFolderMailEIDs.cend() || iterMail->ulUid != ulUid) {
+				// There is a new message
+				SMail sMail;
+				MailFromRow(row, sMail);
+				sMail.ulModSeq = ulModSeq;
+				// Mark as recent if the message has a UID higher than the last highest read UID
+				// in this folder. This means that this session is the only one to see the message
+				// as recent.
+				sMail.bRecent = sMail.ulUid > ulMaxUID;
 				m_ulLastUid = std::max(sMail.ulUid, m_ulLastUid);
-                bNewMail = true;
-
-                // Remember the first unseen message
-				if (ulUnseen == 0 &&
-				    lpRows[ulMailnr].lpProps[MFLAGS].ulPropTag == PR_MESSAGE_FLAGS &&
-				    (lpRows[ulMailnr].lpProps[MFLAGS].Value.ul & MSGFLAG_READ) == 0)
-                        ulUnseen = lstFolderMailEIDs.size()-1+1; // size()-1 = last offset, mail ID = position + 1
+				lstNew.emplace_back(std::move(sMail));
 				continue;
-            }
-            // Check flags
-            std::string strFlags = PropsToFlags(lpRows->aRow[ulMailnr].lpProps, lpRows->aRow[ulMailnr].cValues, lstFolderMailEIDs[iterUID->second].bRecent, false);
-			if (lstFolderMailEIDs[iterUID->second].strFlags != strFlags) {
-				// Flags have changed, notify it
-				HrResponse(RESP_UNTAGGED, stringify(iterUID->second+1) + " FETCH (FLAGS (" + strFlags + "))");
-				lstFolderMailEIDs[iterUID->second].strFlags = strFlags;
 			}
-			// We already had this message, remove it from setUIDs
-			mapUIDs.erase(iterUID);
+			size_t n = iterMail - lstFolderMailEIDs.cbegin();
+			seen[n] = true;
+			lstFolderMailEIDs[n].ullInstanceKey = InstanceKeyId(row.lpProps[ML_IKEY]);
+			auto ulFlags = PropsToFlagBits(row.lpProps, row.cValues, false);
+			if (iterMail->ulFlags != ulFlags)
+				MailChanged(n, ulFlags, ulModSeq, bNotify);
+			else if (iterMail->ulModSeq == 0)
+				lstFolderMailEIDs[n].ulModSeq = ulModSeq;
 		}
-    }
+	}
 
-    // All messages left in mapUIDs have been deleted, so loop through the current list so we can
-    // send the correct EXPUNGE calls; At the same time, count RECENT messages.
-    ulMailnr = 0;
-    while(ulMailnr < lstFolderMailEIDs.size()) {
-        if (mapUIDs.find(lstFolderMailEIDs[ulMailnr].ulUid) != mapUIDs.cend()) {
-            HrResponse(RESP_UNTAGGED, stringify(ulMailnr+1) + " EXPUNGE");
-            lstFolderMailEIDs.erase(lstFolderMailEIDs.begin() + ulMailnr);
-            continue;
-        }
-        if (lstFolderMailEIDs[ulMailnr].bRecent)
-            ++ulRecent;
-        ++iterMail;
-        ++ulMailnr;
-    }
+	// All messages not seen in the table have been deleted
+	std::vector<size_t> gone;
+	for (size_t n = 0; n < seen.size(); ++n)
+		if (!seen[n])
+			gone.emplace_back(n);
+	ExpungeMails(std::move(gone), ulModSeq, bExpunge || !bNotify, bNotify);
+	if (!lstNew.empty()) {
+		bNewMail = true;
+		lstFolderMailEIDs.insert(lstFolderMailEIDs.end(),
+			std::make_move_iterator(lstNew.begin()), std::make_move_iterator(lstNew.end()));
+		std::sort(lstFolderMailEIDs.begin(), lstFolderMailEIDs.end());
+	}
+	m_sync.bLoaded = true;
+	if (!m_sync.strState.empty())
+		m_sync.ulHighestModSeq = std::max({m_sync.ulHighestModSeq, ulModSeq, 1U});
+	return hrSuccess;
+}
 
-    if (bNewMail || bInitialLoad) {
-		HrResponse(RESP_UNTAGGED, stringify(lstFolderMailEIDs.size()) + " EXISTS");
-		HrResponse(RESP_UNTAGGED, stringify(ulRecent) + " RECENT");
-    }
+/**
+ * Brings lstFolderMailEIDs up to date with what ICS reports changed since
+ * the last refresh. Fails, without changing the list, when there is too
+ * much to read back message by message; the caller then reads the
+ * whole folder with HrScanFolderMails.
+ *
+ * @param[in] lpFolder The selected folder
+ * @param[in] ulMaxUID PR_EC_IMAP_MAX_ID of the folder, for \Recent
+ * @param[in] bNotify Tell the client about changed and expunged messages
+ * @param[in] bExpunge EXPUNGE responses may be sent
+ * @param[out] bNewMail Set when messages were added to the list
+ *
+ * @return MAPI Error code
+ */
+HRESULT IMAP::HrSyncFolderMails(IMAPIFolder *lpFolder, ULONG ulMaxUID,
+    bool bNotify, bool bExpunge, bool &bNewMail)
+{
+	object_ptr<ICSChangeCollector> coll;
+	auto strState = m_sync.strState;
 
-	sort(lstFolderMailEIDs.begin(), lstFolderMailEIDs.end());
-    // Save the max UID so that other session will not see the items as \Recent
-    if(bResetRecent && ulRecent && ulMaxUID != m_ulLastUid) {
-    	sPropMax.ulPropTag = PR_EC_IMAP_MAX_ID;
-    	sPropMax.Value.ul = m_ulLastUid;
-		HrSetOneProp(folder, &sPropMax);
-    }
-	if (lpulUnseen)
-		*lpulUnseen = ulUnseen;
+	auto hr = alloc_wrap<ICSChangeCollector>().put<ICSChangeCollector>(&~coll);
+	if (hr != hrSuccess)
+		return hr;
+	hr = HrExportChanges(lpFolder, SYNC_NORMAL | SYNC_READ_STATE, coll,
+	     std::max(ICS_MAX_CHANGES, lstFolderMailEIDs.size() / 32), strState);
+	if (hr != hrSuccess)
+		return hr;
+	auto ulModSeq = StateChangeId(strState);
+
+	/*
+	 * Read the changed messages before touching the list. They are opened
+	 * by entryid: finding each of them in the contents table would scan
+	 * the whole table for every message.
+	 */
+	std::vector<std::pair<memory_ptr<SPropValue>, ULONG>> lstRows;
+	for (const auto &eid : coll->changed) {
+		object_ptr<IMessage> lpMessage;
+		memory_ptr<SPropValue> lpProps;
+		ULONG ulObjType = 0, cValues = 0;
+		hr = lpFolder->OpenEntry(eid.cb, reinterpret_cast<ENTRYID *>(eid.lpb),
+		     &IID_IMessage, MAPI_DEFERRED_ERRORS, &ulObjType, &~lpMessage);
+		if (hr == MAPI_E_NOT_FOUND)
+			/* Gone again; the deletion comes with the next sync */
+			continue;
+		if (hr != hrSuccess)
+			return hr;
+		hr = lpMessage->GetProps(sptaMailListCols, 0, &cValues, &~lpProps);
+		if (FAILED(hr))
+			return hr;
+		if (cValues == ML_NUM_COLS &&
+		    lpProps[ML_EID].ulPropTag == PR_ENTRYID &&
+		    lpProps[ML_IMAPID].ulPropTag == PR_EC_IMAP_ID)
+			lstRows.emplace_back(std::move(lpProps), cValues);
+	}
+
+	/* Finds a message of the list by PR_SOURCE_KEY */
+	std::unordered_map<uint64_t, size_t> mapKeys;
+	if (!coll->read.empty() || !coll->deleted.empty())
+		for (size_t n = 0; n < lstFolderMailEIDs.size(); ++n)
+			if (lstFolderMailEIDs[n].ullSourceKey != 0)
+				mapKeys.emplace(lstFolderMailEIDs[n].ullSourceKey, n);
+	auto find_mail = [&](const std::string &sk) -> size_t {
+		auto id = SourceKeyId(sk.data(), sk.size());
+		if (id != 0) {
+			auto i = mapKeys.find(id);
+			return i != mapKeys.cend() ? i->second : SIZE_MAX;
+		}
+		auto i = m_sync.mapForeignKeys.find(sk);
+		if (i == m_sync.mapForeignKeys.cend())
+			return SIZE_MAX;
+		auto m = std::lower_bound(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), i->second);
+		if (m == lstFolderMailEIDs.cend() || m->ulUid != i->second)
+			return SIZE_MAX;
+		return m - lstFolderMailEIDs.cbegin();
+	};
+
+	for (const auto &rs : coll->read) {
+		auto n = find_mail(rs.first);
+		if (n == SIZE_MAX)
+			continue;
+		auto ulFlags = lstFolderMailEIDs[n].ulFlags;
+		ulFlags = rs.second ? ulFlags | IMAP_FLAG_SEEN : ulFlags & ~IMAP_FLAG_SEEN;
+		MailChanged(n, ulFlags, ulModSeq, bNotify);
+	}
+
+	std::vector<SMail> lstNew;
+	for (auto &props : lstRows) {
+		SRow row;
+		row.ulAdrEntryPad = 0;
+		row.cValues = props.second;
+		row.lpProps = props.first;
+		auto ulUid = row.lpProps[ML_IMAPID].Value.ul;
+		auto iterMail = std::lower_bound(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), ulUid);
+		if (iterMail != lstFolderMailEIDs.cend() && iterMail->ulUid == ulUid) {
+			MailChanged(iterMail - lstFolderMailEIDs.cbegin(),
+				PropsToFlagBits(row.lpProps, row.cValues, false), ulModSeq, bNotify);
+			continue;
+		}
+		SMail sMail;
+		MailFromRow(row, sMail);
+		sMail.ulModSeq = ulModSeq;
+		sMail.bRecent = sMail.ulUid > ulMaxUID;
+		m_ulLastUid = std::max(sMail.ulUid, m_ulLastUid);
+		lstNew.emplace_back(std::move(sMail));
+	}
+
+	std::vector<size_t> gone;
+	for (const auto &sk : coll->deleted) {
+		auto n = find_mail(sk);
+		if (n != SIZE_MAX)
+			gone.emplace_back(n);
+	}
+	ExpungeMails(std::move(gone), ulModSeq, bExpunge || !bNotify, bNotify);
+
+	if (!lstNew.empty()) {
+		bNewMail = true;
+		lstFolderMailEIDs.insert(lstFolderMailEIDs.end(),
+			std::make_move_iterator(lstNew.begin()), std::make_move_iterator(lstNew.end()));
+		std::sort(lstFolderMailEIDs.begin(), lstFolderMailEIDs.end());
+	}
+	m_sync.strState = std::move(strState);
+	m_sync.ulHighestModSeq = std::max({m_sync.ulHighestModSeq, ulModSeq, 1U});
 	return hrSuccess;
 }
 
+/**
+ * Runs the ICS exporter of a folder from an ICS state, which is updated.
+ *
+ * @param[in] lpFolder Folder to synchronize
+ * @param[in] ulFlags SYNC_* flags for the exporter
+ * @param[in] lpCollector Importer to report changes to; none for SYNC_CATCHUP
+ * @param[in] ulMaxChanges Fail with MAPI_E_TOO_BIG, exporting nothing, on more changes than this (0: no limit)
+ * @param[in,out] strState ICS state; empty for a new sync
+ *
+ * @return MAPI Error code
+ */
+HRESULT IMAP::HrExportChanges(IMAPIFolder *lpFolder, ULONG ulFlags,
+    IUnknown *lpCollector, size_t ulMaxChanges, std::string &strState)
+{
+	object_ptr<IECExportChanges> lpExporter;
+	object_ptr<IStream> lpStream;
+	ULONG ulWritten = 0, ulChanges = 0, ulSteps = 0, ulProgress = 0;
+	std::string strNewState;
+
+	auto hr = lpFolder->OpenProperty(PR_CONTENTS_SYNCHRONIZER, &IID_IECExportChanges, 0, 0, &~lpExporter);
+	if (hr != hrSuccess)
+		return hr;
+	hr = CreateStreamOnHGlobal(nullptr, true, &~lpStream);
+	if (hr != hrSuccess)
+		return hr;
+	/* syncid and changeid 0 start a new sync */
+	auto strInitial = strState.size() >= 8 ? strState : std::string(8, '\0');
+	hr = lpStream->Write(strInitial.data(), strInitial.size(), &ulWritten);
+	if (hr != hrSuccess)
+		return hr;
+	hr = lpStream->Seek(large_int_zero, STREAM_SEEK_SET, nullptr);
+	if (hr != hrSuccess)
+		return hr;
+	hr = lpExporter->Config(lpStream, ulFlags, lpCollector, nullptr, nullptr, nullptr, 0);
+	if (hr != hrSuccess)
+		return hr;
+	if (ulMaxChanges != 0 && lpExporter->GetChangeCount(&ulChanges) == hrSuccess &&
+	    ulChanges > ulMaxChanges)
+		return MAPI_E_TOO_BIG;
+	do {
+		hr = lpExporter->Synchronize(&ulSteps, &ulProgress);
+	} while (hr == SYNC_W_PROGRESS);
+	if (hr != hrSuccess)
+		return hr;
+	hr = lpExporter->UpdateState(lpStream);
+	if (hr != hrSuccess)
+		return hr;
+	hr = Util::HrStreamToString(lpStream, strNewState);
+	if (hr != hrSuccess)
+		return hr;
+	strState = std::move(strNewState);
+	return hrSuccess;
+}
+
+/**
+ * Starts on the folder about to be selected where another session of the
+ * user left it, if it is in the folder cache.
+ *
+ * @param[in] sk PR_SOURCE_KEY of the folder
+ * @param[in] ulUIDValidity UIDVALIDITY of the folder
+ * @param[in] ulMaxUID PR_EC_IMAP_MAX_ID of the folder
+ */
+void IMAP::TakeFolderState(const SPropValue &sk, ULONG ulUIDValidity, ULONG ulMaxUID)
+{
+	ReleaseFolderState();
+	if (sk.ulPropTag == PR_SOURCE_KEY) {
+		m_strFolderKey = convert_to<std::string>("UTF-8", m_strwUsername, rawsize(m_strwUsername), CHARSET_WCHAR) +
+		                 ":" + bin2hex(sk.Value.bin);
+		if (m_bFolderCache &&
+		    imap_folder_cache.take(m_strFolderKey, m_sync, lstFolderMailEIDs, m_ulLastUid)) {
+			if (m_sync.ulUIDValidity != ulUIDValidity) {
+				m_sync = SFolderSync();
+				lstFolderMailEIDs.clear();
+				m_ulLastUid = 0;
+			}
+			/* \Recent is for the session that first saw the message */
+			for (auto &mail : lstFolderMailEIDs)
+				mail.bRecent = mail.ulUid > ulMaxUID;
+		}
+		m_sync.strKeyPrefix.assign(reinterpret_cast<const char *>(sk.Value.bin.lpb),
+			std::min(sk.Value.bin.cb, 16U));
+	}
+	m_sync.ulUIDValidity = ulUIDValidity;
+}
+
+/**
+ * Leaves the message list of the selected folder, with its ICS state, in
+ * the folder cache for the next session that selects the folder.
+ */
+void IMAP::ReleaseFolderState()
+{
+	if (!m_strFolderKey.empty() && m_bFolderCache && !m_sync.strState.empty()) {
+		/* Nobody is left to tell about these */
+		std::set<ULONG> gone;
+		for (const auto &p : m_sync.lstPendingExpunge) {
+			gone.emplace(p.second);
+			m_sync.lstVanished.emplace_back(p);
+		}
+		m_sync.lstPendingExpunge.clear();
+		if (!gone.empty())
+			lstFolderMailEIDs.erase(std::remove_if(lstFolderMailEIDs.begin(), lstFolderMailEIDs.end(),
+				[&](const SMail &m) { return gone.find(m.ulUid) != gone.cend(); }),
+				lstFolderMailEIDs.end());
+		for (auto &mail : lstFolderMailEIDs)
+			mail.bStored = false;
+		imap_folder_cache.put(m_strFolderKey, std::move(m_sync), std::move(lstFolderMailEIDs),
+			m_ulLastUid, atoui(lpConfig->GetSetting("imap_folder_cache_size")));
+	}
+	m_strFolderKey.clear();
+	m_sync = SFolderSync();
+	lstFolderMailEIDs.clear();
+	m_ulLastUid = 0;
+}
+
+/*
+ * ICS makes refreshes cheap, and is needed for MODSEQ, but each ICS state
+ * is a sync registered on the server. Without a folder cache to keep the
+ * state in, that is only worth it for clients using CONDSTORE.
+ */
+bool IMAP::UseICS() const
+{
+	return m_bCondstore ||
+	       (m_bFolderCache && atoui(lpConfig->GetSetting("imap_folder_cache_size")) > 0);
+}
+
+/**
+ * Turns on CONDSTORE for the session, as a CONDSTORE command or parameter
+ * does (RFC 7162 3.1), and tells the client the HIGHESTMODSEQ of the
+ * selected folder.
+ */
+void IMAP::EnableCondstore()
+{
+	if (m_bCondstore)
+		return;
+	m_bCondstore = true;
+	if (strCurrentFolder.empty())
+		return;
+	if (m_sync.strState.empty())
+		HrRefreshFolderMails(false, false, nullptr, nullptr, false);
+	if (m_sync.strState.empty())
+		HrResponse(RESP_UNTAGGED, "OK [NOMODSEQ] Sorry, mod-sequences have not been enabled on this mailbox");
+	else
+		HrResponse(RESP_UNTAGGED, "OK [HIGHESTMODSEQ " + stringify(m_sync.ulHighestModSeq) + "] Highest");
+}
+
+/*
+ * Kopano source keys are the GUID of the store, followed by a 48-bit
+ * counter. Returns the counter when the GUID is that of the folder's own
+ * key, 0 when the key does not fit in an SMail.
+ */
+uint64_t IMAP::SourceKeyId(const void *sk, size_t size) const
+{
+	auto p = static_cast<const unsigned char *>(sk);
+	if (size != 22 || m_sync.strKeyPrefix.size() != 16 ||
+	    memcmp(p, m_sync.strKeyPrefix.data(), 16) != 0)
+		return 0;
+	uint64_t id = 0;
+	for (size_t i = 0; i < 6; ++i)
+		id |= static_cast<uint64_t>(p[16+i]) << (8 * i);
+	return id;
+}
+
+/* Fills in a new SMail from a row read with sptaMailListCols */
+void IMAP::MailFromRow(const SRow &row, SMail &sMail)
+{
+	const auto &sk = row.lpProps[ML_SK];
+	sMail.sEntryID = row.lpProps[ML_EID].Value.bin;
+	sMail.ulUid = row.lpProps[ML_IMAPID].Value.ul;
+	sMail.ulFlags = PropsToFlagBits(row.lpProps, row.cValues, false);
+	sMail.ullInstanceKey = InstanceKeyId(row.lpProps[ML_IKEY]);
+	sMail.ullSourceKey = 0;
+	if (sk.ulPropTag != PR_SOURCE_KEY)
+		return;
+	sMail.ullSourceKey = SourceKeyId(sk.Value.bin.lpb, sk.Value.bin.cb);
+	if (sMail.ullSourceKey == 0)
+		m_sync.mapForeignKeys[std::string(reinterpret_cast<const char *>(sk.Value.bin.lpb), sk.Value.bin.cb)] = sMail.ulUid;
+}
+
+/**
+ * Sets new flags and MODSEQ for a message in the list, and tells the
+ * client what changed, unless it was its own STORE that did it.
+ *
+ * @param[in] n Index of the message in lstFolderMailEIDs
+ * @param[in] ulFlags IMAP_FLAG_* bits
+ * @param[in] ulModSeq MODSEQ of the change
+ * @param[in] bNotify The client may be told
+ */
+void IMAP::MailChanged(size_t n, unsigned int ulFlags, ULONG ulModSeq, bool bNotify)
+{
+	auto &mail = lstFolderMailEIDs[n];
+	bool bReport = bNotify && !mail.bStored &&
+	               (mail.ulFlags != ulFlags || (m_bCondstore && mail.ulModSeq != ulModSeq));
+	mail.ulFlags = ulFlags;
+	mail.ulModSeq = ulModSeq;
+	mail.bStored = false;
+	if (!bReport)
+		return;
+	std::string strResponse = stringify(n + 1) + " FETCH (";
+	if (m_bQresync)
+		strResponse += "UID " + stringify(mail.ulUid) + " ";
+	strResponse += "FLAGS (" + FlagBitsToString(ulFlags, mail.bRecent) + ")";
+	if (m_bCondstore)
+		strResponse += " MODSEQ (" + stringify(ulModSeq) + ")";
+	HrResponse(RESP_UNTAGGED, strResponse + ")");
+}
+
+/**
+ * Takes messages that are gone from the folder out of the list, and tells
+ * the client. When it may not be told now, they stay until it may.
+ *
+ * @param[in] mails Indexes of the messages in lstFolderMailEIDs
+ * @param[in] ulModSeq MODSEQ at which the messages were found gone
+ * @param[in] bExpunge The messages may be taken out now
+ * @param[in] bNotify The client is to be told
+ */
+void IMAP::ExpungeMails(std::vector<size_t> &&mails, ULONG ulModSeq,
+    bool bExpunge, bool bNotify)
+{
+	if (mails.empty())
+		return;
+	std::sort(mails.begin(), mails.end());
+	mails.erase(std::unique(mails.begin(), mails.end()), mails.end());
+	if (!bExpunge) {
+		for (auto n : mails) {
+			auto ulUid = lstFolderMailEIDs[n].ulUid;
+			if (std::find_if(m_sync.lstPendingExpunge.cbegin(), m_sync.lstPendingExpunge.cend(),
+			    [&](const std::pair<ULONG, ULONG> &p) { return p.second == ulUid; }) == m_sync.lstPendingExpunge.cend())
+				m_sync.lstPendingExpunge.emplace_back(ulModSeq, ulUid);
+		}
+		return;
+	}
+
+	std::vector<std::pair<ULONG, ULONG>> lstUids;
+	for (auto i = mails.crbegin(); i != mails.crend(); ++i) {
+		auto &mail = lstFolderMailEIDs[*i];
+		// Descending, so the message numbers of the next ones stay valid
+		if (bNotify && !m_bQresync)
+			HrResponse(RESP_UNTAGGED, stringify(*i + 1) + " EXPUNGE");
+		lstUids.emplace_back(mail.ulUid, mail.ulUid);
+		m_sync.lstVanished.emplace_back(ulModSeq, mail.ulUid);
+		if (mail.ullSourceKey == 0)
+			for (auto k = m_sync.mapForeignKeys.begin(); k != m_sync.mapForeignKeys.end(); ++k)
+				if (k->second == mail.ulUid) {
+					m_sync.mapForeignKeys.erase(k);
+					break;
+				}
+		mail.ulUid = 0;
+	}
+	if (bNotify && m_bQresync) {
+		std::reverse(lstUids.begin(), lstUids.end());
+		HrResponse(RESP_UNTAGGED, "VANISHED " + imap_seq_ranges(lstUids));
+	}
+	lstFolderMailEIDs.erase(std::remove(lstFolderMailEIDs.begin(), lstFolderMailEIDs.end(), 0U),
+		lstFolderMailEIDs.end());
+
+	if (m_sync.lstVanished.size() > MAX_VANISHED) {
+		/* Forget the oldest half; VanishedSince falls back to the gaps for those */
+		std::sort(m_sync.lstVanished.begin(), m_sync.lstVanished.end());
+		auto drop = m_sync.lstVanished.size() - MAX_VANISHED / 2;
+		m_sync.ulBaseModSeq = std::max(m_sync.ulBaseModSeq, m_sync.lstVanished[drop-1].first);
+		m_sync.lstVanished.erase(m_sync.lstVanished.begin(), m_sync.lstVanished.begin() + drop);
+	}
+}
+
+/**
+ * UIDs of messages expunged after a MODSEQ, for VANISHED (EARLIER). For
+ * changes older than what is remembered, all UIDs below UIDNEXT that are
+ * not in the folder are reported, as RFC 7162 3.2.5.1 allows.
+ *
+ * @param[in] ulModSeq MODSEQ the client knows
+ * @param[in] strUidSet Only report UIDs in this set; empty for all
+ *
+ * @return Sorted UID ranges
+ */
+std::vector<std::pair<ULONG, ULONG>> IMAP::VanishedSince(ULONG ulModSeq,
+    const std::string &strUidSet)
+{
+	auto gone = ulModSeq >= m_sync.ulBaseModSeq ?
+	            imap_vanished_after(ulModSeq, m_sync.lstVanished) :
+	            imap_uid_gaps(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), m_ulLastUid);
+	return imap_uid_set_filter(gone, strUidSet, m_ulLastUid);
+}
+
 /**
  * Return the IMAP Path for a given folder. Recursively recreates the
  * path using the parent iterator in the SFolder struct.
@@ -3077,7 +4065,9 @@ HRESULT IMAP::HrGetDataItems(std::string strMsgDataItemNames, std::vector<std::s
 /**
  * Do a FETCH based on table data for a specific list of
  * messages. Replies directly to the IMAP client with the result for
- * each mail given.
+ * each mail given. Rows are read in bulk, restricted to the requested
+ * UIDs; messages that have to be opened are converted on the fetch pool,
+ * up to imap_fetch_threads at a time.
  *
  * @param[in] lstMails a full sorted list of emails to process
  * @param[in] lstDataItems vector of IMAP data items to send to the client
@@ -3090,16 +4080,17 @@ HRESULT IMAP::HrPropertyFetch(std::list<ULONG> &lstMails, std::vector<std::strin
 	rowset_ptr lpRows;
 	LPSRow lpRow = NULL;
 	LONG nRow = -1;
+	ULONG ulFindUid = 0; /* UID last looked up with FindRow */
 	SPropValue sPropVal;
-	std::string strResponse;
 	memory_ptr<SPropTagArray> lpPropTags;
 	std::set<ULONG> setProps;
     LPSPropValue lpProps;
     ULONG cValues;
 	static constexpr SizedSSortOrderSet(1, sSortUID) =
 		{1, 0, 0, {{PR_EC_IMAP_ID, TABLE_SORT_ASCEND}}};
-	bool bMarkAsRead = false;
+	bool bMarkAsRead = false, bRestricted = false;
 	memory_ptr<ENTRYLIST> lpEntryList;
+	std::vector<ULONG> lstMarked;
 
 	if (strCurrentFolder.empty() || lpSession == nullptr)
 		return MAPI_E_CALL_FAILED;
@@ -3167,22 +4158,23 @@ HRESULT IMAP::HrPropertyFetch(std::list<ULONG> &lstMails, std::vector<std::strin
 	}
 
 	auto ulReadAhead = std::min(lstMails.size(), big_payload ? ROWS_PER_REQUEST_SMALL : ROWS_PER_REQUEST_BIG);
-	if(!setProps.empty() && m_vTableDataColumns != lstDataItems) {
-		ReleaseContentsCache();
-
+	if (!setProps.empty()) {
         // Build an LPSPropTagArray
 		auto hr = MAPIAllocateBuffer(CbNewSPropTagArray(setProps.size() + 1), &~lpPropTags);
         if(hr != hrSuccess)
 			return hr;
         // Always get UID
-        lpPropTags->aulPropTag[0] = PR_INSTANCE_KEY;
+        lpPropTags->aulPropTag[0] = PR_ENTRYID;
 		unsigned int n = 1;
 		for (auto prop : setProps)
 			lpPropTags->aulPropTag[n++] = prop;
         lpPropTags->cValues = setProps.size()+1;
+	}
+	if(!setProps.empty() && m_vTableDataColumns != lstDataItems) {
+		ReleaseContentsCache();
 
         // Open the folder in question
-        hr = HrGetCurrentFolder(lpFolder);
+        auto hr = HrGetCurrentFolder(lpFolder);
         if (hr != hrSuccess)
 			return hr;
         // Don't let the server cap the contents to 255 bytes, so our PR_TRANSPORT_MESSAGE_HEADERS is complete in the table
@@ -3206,21 +4198,88 @@ HRESULT IMAP::HrPropertyFetch(std::list<ULONG> &lstMails, std::vector<std::strin
 			return hr;
     }
 
-	if (m_lpTable) {
+	/*
+	 * A large part of the folder is read from a table of its own,
+	 * restricted to the requested rows, so that they come in order, in
+	 * bulk. Smaller sets find their rows in m_lpTable, which stays
+	 * unrestricted: restricting it would reload it for this FETCH and
+	 * again for the next, and take it out of table sharing.
+	 */
+	object_ptr<IMAPITable> lpRstTable;
+	IMAPITable *lpTable = m_lpTable;
+	std::unique_ptr<ECRestriction> lpUidRst;
+	if (m_lpTable != nullptr && lpPropTags != nullptr &&
+	    lstMails.size() >= MIN_FETCH_RESTRICT &&
+	    lstMails.size() < lstFolderMailEIDs.size()) {
+		auto strUidSet = MailsToUidSet(lstMails);
+		bRestricted = !strUidSet.empty() &&
+		              HrSeqUidSetToRestriction(strUidSet, lpUidRst) == hrSuccess &&
+		              lpUidRst != nullptr;
+	}
+	if (bRestricted) {
+		auto hr = lpFolder != nullptr ? hrSuccess : HrGetCurrentFolder(lpFolder);
+		if (hr != hrSuccess)
+			return hr;
+		hr = lpFolder->GetContentsTable(EC_TABLE_NOCAP | MAPI_DEFERRED_ERRORS, &~lpRstTable);
+		if (hr != hrSuccess)
+			return hr;
+		hr = lpRstTable->SetColumns(lpPropTags, TBL_BATCH);
+		if (hr != hrSuccess)
+			return hr;
+		hr = lpUidRst->RestrictTable(lpRstTable, TBL_BATCH);
+		if (hr != hrSuccess)
+			return hr;
+		hr = lpRstTable->SortTable(sSortUID, TBL_BATCH);
+		if (hr != hrSuccess)
+			return hr;
+		lpTable = lpRstTable;
+	} else if (m_lpTable != nullptr) {
 		auto hr = m_lpTable->SeekRow(BOOKMARK_BEGINNING, 0, nullptr);
 		if(hr != hrSuccess)
 			return hr;
 	}
 
 	// Setup a find restriction that we modify for each row
-	sPropVal.ulPropTag = PR_INSTANCE_KEY;
-	ECPropertyRestriction sRestriction(RELOP_EQ, PR_INSTANCE_KEY, &sPropVal, ECRestriction::Cheap);
+	sPropVal.ulPropTag = PR_ENTRYID;
+	ECPropertyRestriction sRestriction(RELOP_EQ, PR_ENTRYID, &sPropVal, ECRestriction::Cheap);
 
-	// Loop through all requested rows, and get the data for each (FIXME: slow for large requests)
+	/*
+	 * Messages that have to be opened are done on the fetch pool, a few at
+	 * a time; responses are still sent in order, so the ones after an
+	 * outstanding message wait in lstPending.
+	 */
+	auto ulThreads = lstMails.size() > 1 ? atoui(lpConfig->GetSetting("imap_fetch_threads")) : 0;
+	auto lpPool = ulThreads > 0 ? imap_fetch_pool(ulThreads) : nullptr;
+	size_t ulWindow = 4 * ulThreads;
+	std::deque<fetch_slot> lstPending;
+	auto laters = make_scope_exit([&]() {
+		for (auto &slot : lstPending)
+			if (slot.task != nullptr)
+				slot.task->wait();
+	});
+	auto emit = [&](size_t keep) {
+		while (!lstPending.empty()) {
+			auto &slot = lstPending.front();
+			if (slot.task != nullptr) {
+				if (lstPending.size() <= keep && !slot.task->done())
+					break;
+				slot.task->wait();
+				slot.hr = slot.task->m_hr;
+				slot.response = std::move(slot.task->m_response);
+			}
+			if (slot.hr != hrSuccess)
+				ec_log_warn("{?} Error fetching mail");
+			else
+				HrResponse(RESP_UNTAGGED, slot.response);
+			lstPending.pop_front();
+		}
+	};
+
+	// Loop through all requested rows, and get the data for each
 	for (auto mail_idx : lstMails) {
 		const SPropValue *lpProp = NULL; // non-free // by default: no need to mark-as-read
 
-		sPropVal.Value.bin = lstFolderMailEIDs[mail_idx].sInstanceKey;
+		sPropVal.Value.bin = lstFolderMailEIDs[mail_idx].sEntryID;
         // We use a read-ahead mechanism here, reading 50 rows at a time.
 		if (m_lpTable) {
             // First, see if the next row is somewhere in our already-read data
@@ -3228,24 +4287,53 @@ HRESULT IMAP::HrPropertyFetch(std::list<ULONG> &lstMails, std::vector<std::strin
             if (lpRows != nullptr)
 				// use nRow to start checking where we left off
                 for (unsigned int i = nRow + 1; i < lpRows->cRows; ++i)
-					if (lpRows->aRow[i].lpProps[0].ulPropTag == PR_INSTANCE_KEY &&
+					if (lpRows->aRow[i].lpProps[0].ulPropTag == PR_ENTRYID &&
 					    lpRows->aRow[i].lpProps[0].Value.bin == sPropVal.Value.bin) {
                         lpRow = &lpRows->aRow[i];
 						nRow = i;
 						break;
                     }
 
-            if(lpRow == NULL) {
+			/*
+			 * Restricted to the requested rows, in the same order: the
+			 * row is in the next batch, or the message is gone.
+			 */
+			if (lpRow == nullptr && bRestricted) {
+				if (lpRows == nullptr || nRow + 1 >= static_cast<LONG>(lpRows->cRows)) {
+					lpRows.reset();
+					nRow = -1;
+					if (lpTable->QueryRows(ulReadAhead, 0, &~lpRows) == hrSuccess)
+						for (unsigned int i = 0; i < lpRows->cRows; ++i)
+							if (lpRows->aRow[i].lpProps[0].ulPropTag == PR_ENTRYID &&
+							    lpRows->aRow[i].lpProps[0].Value.bin == sPropVal.Value.bin) {
+								lpRow = &lpRows->aRow[i];
+								nRow = i;
+								break;
+							}
+				}
+			} else if (lpRow == nullptr) {
 				lpRows.reset();
 
                 // Row was not found in our current data, request new data
-				if (sRestriction.FindRowIn(m_lpTable, BOOKMARK_CURRENT, 0) == hrSuccess &&
+				/*
+				 * The table is in UID order and rows are usually
+				 * requested in that order, so look onwards from the
+				 * current row; only a row requested out of order, or
+				 * not found onwards, needs a search from the start.
+				 */
+				auto ulUid = lstFolderMailEIDs[mail_idx].ulUid;
+				auto hr = sRestriction.FindRowIn(m_lpTable, ulUid < ulFindUid ?
+				          BOOKMARK_BEGINNING : BOOKMARK_CURRENT, 0);
+				if (hr != hrSuccess && ulUid >= ulFindUid)
+					hr = sRestriction.FindRowIn(m_lpTable, BOOKMARK_BEGINNING, 0);
+				if (hr == hrSuccess &&
 				    m_lpTable->QueryRows(ulReadAhead, 0, &~lpRows) == hrSuccess &&
 				    lpRows->cRows != 0) {
 					// The row we want is the first returned row
 					lpRow = &lpRows->aRow[0];
 					nRow = 0;
 				}
+				ulFindUid = ulUid;
             }
 
 		    // Pass the row data for conversion
@@ -3253,8 +4341,10 @@ HRESULT IMAP::HrPropertyFetch(std::list<ULONG> &lstMails, std::vector<std::strin
 				/* Possibly add message to mark-as-read */
 				if (bMarkAsRead) {
 					lpProp = lpRow->cfind(PR_MESSAGE_FLAGS);
-					if (lpProp == nullptr || (lpProp->Value.ul & MSGFLAG_READ) == 0)
+					if (lpProp == nullptr || (lpProp->Value.ul & MSGFLAG_READ) == 0) {
 						lpEntryList->lpbin[lpEntryList->cValues++] = lstFolderMailEIDs[mail_idx].sEntryID;
+						lstMarked.emplace_back(mail_idx);
+					}
 				}
     		    cValues = lpRow->cValues;
 	    	    lpProps = lpRow->lpProps;
@@ -3268,22 +4358,63 @@ HRESULT IMAP::HrPropertyFetch(std::list<ULONG> &lstMails, std::vector<std::strin
             lpProps = NULL;
         }
 
+		fetch_slot slot;
+		if (lpPool != nullptr && FetchNeedsMessage(lpProps, cValues, lstDataItems)) {
+			// Row data has to outlive lpRows
+			memory_ptr<SPropValue> lpCopy;
+			ULONG cCopy = 0;
+			if (cValues == 0 ||
+			    Util::HrCopyPropertyArray(lpProps, cValues, &~lpCopy, &cCopy) == hrSuccess) {
+				slot.task.reset(new IMAPFetchTask(*this, mail_idx, lpProp != nullptr,
+					lstDataItems, std::move(lpCopy), cCopy));
+				if (!lpPool->enqueue(slot.task.get()))
+					slot.task->execute();
+				lstPending.emplace_back(std::move(slot));
+				emit(ulWindow);
+				continue;
+			}
+		}
+
         // Fetch the row data
-		if (HrPropertyFetchRow(lpProps, cValues, strResponse, mail_idx, lpProp != nullptr, lstDataItems) != hrSuccess)
-			ec_log_warn("{?} Error fetching mail");
-		else
-			HrResponse(RESP_UNTAGGED, strResponse);
+		slot.hr = HrPropertyFetchRow(lpProps, cValues, slot.response, mail_idx, lpProp != nullptr, lstDataItems);
+		if (lstPending.empty()) {
+			if (slot.hr != hrSuccess)
+				ec_log_warn("{?} Error fetching mail");
+			else
+				HrResponse(RESP_UNTAGGED, slot.response);
+			continue;
+		}
+		lstPending.emplace_back(std::move(slot));
+		emit(ulWindow);
 	}
+	emit(0);
 
 	if (lpEntryList && lpEntryList->cValues) {
 		// mark unread messages as read
 		auto hr = lpFolder->SetReadFlags(lpEntryList, 0, NULL, SUPPRESS_RECEIPT);
 		if (FAILED(hr))
 			return hr;
+		// the FETCH responses had \Seen already
+		for (auto mail_idx : lstMarked)
+			lstFolderMailEIDs[mail_idx].ulFlags |= IMAP_FLAG_SEEN;
 	}
 	return hrSuccess;
 }
 
+/*
+ * IMToINet, from the fetch pool too. The tasks of a connection share its
+ * session and address book, which mapi4linux does not lock (the session
+ * walks its open stores unlocked in OpenEntry), so they take turns with
+ * them. Everything else HrPropertyFetchRow uses is either its own message,
+ * read-only during a FETCH, or m_strCache.
+ */
+HRESULT IMAP::MessageToINet(IMessage *message, std::ostream &os,
+    const sending_options &sopt)
+{
+	scoped_lock lk(m_session_lock);
+	return IMToINet(lpSession, lpAddrBook, message, os, sopt);
+}
+
 HRESULT IMAP::save_generated_properties(const std::string &text, IMessage *message)
 {
 	auto hr = createIMAPBody(text, message, true);
@@ -3299,6 +4430,52 @@ HRESULT IMAP::save_generated_properties(const std::string &text, IMessage *messa
 	return hrSuccess;
 }
 
+/**
+ * Tells whether the FETCH data items need more of a message than its
+ * row in the contents table has.
+ *
+ * Rules to open the message:
+ * 1. BODY requested and not present in table (generate)
+ * 2. BODYSTRUCTURE requested and not present in table (generate)
+ * 3. ENVELOPE requested and not present in table
+ * 4. BODY* or body part requested
+ * 5. RFC822* requested
+ * (and not cached, which HrPropertyFetchRow checks)
+ *
+ * @param[in] lpProps Array of MAPI properties of a message
+ * @param[in] cValues Number of properties in lpProps
+ * @param[in] lstDataItems IMAP data items requested
+ */
+bool IMAP::FetchNeedsMessage(const SPropValue *lpProps, unsigned int cValues,
+    const std::vector<std::string> &lstDataItems) const
+{
+	for (const auto &item : lstDataItems) {
+		if (item == "BODY") {
+			if (PCpropFindProp(lpProps, cValues, PR_EC_IMAP_BODY) == nullptr)
+				return true;
+		} else if (item == "BODYSTRUCTURE") {
+			if (PCpropFindProp(lpProps, cValues, PR_EC_IMAP_BODYSTRUCTURE) == nullptr)
+				return true;
+		} else if (item == "ENVELOPE") {
+			if (PCpropFindProp(lpProps, cValues, m_lpsIMAPTags->aulPropTag[0]) == nullptr)
+				return true;
+		} else if (item == "RFC822.SIZE") {
+			if (PCpropFindProp(lpProps, cValues, PR_EC_IMAP_EMAIL_SIZE) == nullptr)
+				return true;
+		} else if (strstr(item.c_str(), "HEADER") != NULL) {
+			// we can only use PR_TRANSPORT_MESSAGE_HEADERS when we have the full email.
+			auto headers = PCpropFindProp(lpProps, cValues, PR_TRANSPORT_MESSAGE_HEADERS_A);
+			auto size = PCpropFindProp(lpProps, cValues, PR_EC_IMAP_EMAIL_SIZE);
+			if (headers == nullptr || *headers->Value.lpszA == '\0' || size == nullptr)
+				return true;
+		}
+		// full/partial body fetches, or size
+		else if (kc_starts_with(item, "BODY") || kc_starts_with(item, "RFC822"))
+			return true;
+	}
+	return false;
+}
+
 /**
  * Does a FETCH based on row-data from a MAPI table. If the table data
  * is not sufficient, the PR_EC_IMAP_EMAIL property may be fetched
@@ -3318,7 +4495,7 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
     const std::vector<std::string> &lstDataItems)
 {
 	HRESULT hr = hrSuccess;
-	std::string strItem, strParts, strMessage, strMessagePart, strFlags;
+	std::string strItem, strParts, strMessage, strMessagePart, strFlags, strCached;
 	char szBuffer[HXSIZEOF_Z64+8];
 	object_ptr<IMessage> lpMessage;
 	ULONG ulObjType = 0;
@@ -3330,47 +4507,24 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 	sopt.use_tnef = -1;
 	unsigned int ulCount = 0;
 	std::ostringstream oss;
-	bool bSkipOpen = true;
 	std::vector<std::string> vProps;
 
 	// Response always starts with "<id> FETCH ("
 	snprintf(szBuffer, sizeof(szBuffer), "%u FETCH (", ulMailnr + 1);
 	strResponse = szBuffer;
 
-	// rules to open the message:
-	// 1. BODY requested and not present in table (generate)
-	// 2. BODYSTRUCTURE requested and not present in table (generate)
-	// 3. ENVELOPE requested and not present in table
-	// 4. BODY* or body part requested
-	// 5. RFC822* requested
-	// and ! cached
-	for (auto iFetch = lstDataItems.cbegin();
-	     bSkipOpen && iFetch != lstDataItems.cend(); ++iFetch)
-	{
-		if (iFetch->compare("BODY") == 0) {
-			if (PCpropFindProp(lpProps, cValues, PR_EC_IMAP_BODY) == nullptr)
-				bSkipOpen = false;
-		} else if (iFetch->compare("BODYSTRUCTURE") == 0) {
-			if (PCpropFindProp(lpProps, cValues, PR_EC_IMAP_BODYSTRUCTURE) == nullptr)
-				bSkipOpen = false;
-		} else if (iFetch->compare("ENVELOPE") == 0) {
-			if (PCpropFindProp(lpProps, cValues, m_lpsIMAPTags->aulPropTag[0]) == nullptr)
-				bSkipOpen = false;
-		} else if (iFetch->compare("RFC822.SIZE") == 0) {
-			if (PCpropFindProp(lpProps, cValues, PR_EC_IMAP_EMAIL_SIZE) == nullptr)
-				bSkipOpen = false;
-		} else if (strstr(iFetch->c_str(), "HEADER") != NULL) {
-			// we can only use PR_TRANSPORT_MESSAGE_HEADERS when we have the full email.
-			auto headers = PCpropFindProp(lpProps, cValues, PR_TRANSPORT_MESSAGE_HEADERS_A);
-			auto size = PCpropFindProp(lpProps, cValues, PR_EC_IMAP_EMAIL_SIZE);
-			if (headers == nullptr || *headers->Value.lpszA == '\0' || size == nullptr)
-				bSkipOpen = false;
+	bool bSkipOpen = !FetchNeedsMessage(lpProps, cValues, lstDataItems);
+	bool bCached = false;
+	if (!bSkipOpen) {
+		scoped_lock lk(m_cache_lock);
+		if (m_ulCacheUID == lstFolderMailEIDs[ulMailnr].ulUid) {
+			/* Another fetch task may replace the cache meanwhile */
+			bCached = true;
+			strCached = m_strCache;
 		}
-		// full/partial body fetches, or size
-		else if (kc_starts_with(*iFetch, "BODY") || kc_starts_with(*iFetch, "RFC822"))
-			bSkipOpen = false;
 	}
-	if (!bSkipOpen && m_ulCacheUID != lstFolderMailEIDs[ulMailnr].ulUid) {
+	if (!bSkipOpen && !bCached) {
+		scoped_lock lk(m_session_lock);
 		// ignore error, we can't print an error halfway to the imap client
 		hr = lpSession->OpenEntry(lstFolderMailEIDs[ulMailnr].sEntryID.cb, (LPENTRYID) lstFolderMailEIDs[ulMailnr].sEntryID.lpb,
 							 &IID_IMessage, MAPI_DEFERRED_ERRORS | MAPI_BEST_ACCESS, &ulObjType, &~lpMessage);
@@ -3406,6 +4560,9 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 		} else if (item == "UID") {
 			vProps.emplace_back(item);
 			vProps.emplace_back(stringify(lstFolderMailEIDs[ulMailnr].ulUid));
+		} else if (item == "MODSEQ") {
+			vProps.emplace_back(item);
+			vProps.emplace_back("(" + stringify(lstFolderMailEIDs[ulMailnr].ulModSeq) + ")");
 		} else if (item == "ENVELOPE") {
 			auto lpProp = PCpropFindProp(lpProps, cValues, m_lpsIMAPTags->aulPropTag[0]);
 			if (lpProp) {
@@ -3416,7 +4573,7 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 				/* Autogenerate envelope on the fly */
 				memory_ptr<SPropValue> prop;
 				sopt.headers_only = false;
-				hr = IMToINet(lpSession, lpAddrBook, lpMessage, oss, sopt);
+				hr = MessageToINet(lpMessage, oss, sopt);
 				if (hr != hrSuccess)
 					return hr;
 				strMessage = oss.str();
@@ -3483,9 +4640,9 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 
 			strMessage.clear();
 			sopt.headers_only = strstr(strItem.c_str(), "HEADER") != NULL;
-			if (m_ulCacheUID == lstFolderMailEIDs[ulMailnr].ulUid) {
+			if (bCached) {
 				// Get message from cache
-				strMessage = m_strCache;
+				strMessage = strCached;
 			} else {
 				// We need to send headers or a body(part) to the client.
 				// For some clients, we need to make sure that headers match the bodies,
@@ -3525,7 +4682,7 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 								m_strwUsername.c_str(), strCurrentFolder.c_str(), ulMailnr + 1);
 							continue;
 						}
-						hr = IMToINet(lpSession, lpAddrBook, lpMessage, oss, sopt);
+						hr = MessageToINet(lpMessage, oss, sopt);
 						if (hr != hrSuccess) {
 							vProps.emplace_back(item);
 							vProps.emplace_back("NIL");
@@ -3546,6 +4703,7 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 
 				// Cache the generated message
 				if(!sopt.headers_only) {
+					scoped_lock lk(m_cache_lock);
 					m_ulCacheUID = lstFolderMailEIDs[ulMailnr].ulUid;
 					m_strCache = strMessage;
 				}
@@ -3662,13 +4820,12 @@ HRESULT IMAP::HrPropertyFetchRow(SPropValue *lpProps, unsigned int cValues,
 /**
  * Returns IMAP flags for a given message
  *
- * @param[out] strResponse the FLAGS reply for the given message
  * @param[in] lpMessage the MAPI message to get the IMAP flags for
- * @param[in] bRecent mark this message as recent
+ * @param[out] ulFlags IMAP_FLAG_* bits of the message
  *
  * @return MAPI Error code
  */
-HRESULT IMAP::HrGetMessageFlags(std::string &strResponse, IMessage *lpMessage, bool bRecent)
+HRESULT IMAP::HrGetMessageFlags(IMessage *lpMessage, unsigned int &ulFlags)
 {
 	memory_ptr<SPropValue> lpProps;
 	ULONG cValues;
@@ -3681,7 +4838,7 @@ HRESULT IMAP::HrGetMessageFlags(std::string &strResponse, IMessage *lpMessage, b
 	auto hr = lpMessage->GetProps(sptaFlagProps, 0, &cValues, &~lpProps);
 	if (FAILED(hr))
 		return hr;
-	strResponse += "FLAGS (" + PropsToFlags(lpProps, cValues, bRecent, false) + ")";
+	ulFlags = PropsToFlagBits(lpProps, cValues, false);
 	return hrSuccess;
 }
 
@@ -3923,6 +5080,29 @@ ULONG IMAP::LastOrNumber(const char *szNr, bool bUID)
 		return lstFolderMailEIDs.back().ulUid;
 }
 
+/**
+ * UID set of messages in the list, one range per run of consecutive
+ * message numbers. Empty when that takes more than MAX_FETCH_RANGES
+ * ranges, or when all messages are in it.
+ *
+ * @param[in] lstMails sorted list of email numbers
+ */
+std::string IMAP::MailsToUidSet(const std::list<ULONG> &lstMails) const
+{
+	std::vector<std::pair<ULONG, ULONG>> ranges;
+	if (lstMails.size() >= lstFolderMailEIDs.size())
+		return {};
+	for (auto i = lstMails.cbegin(); i != lstMails.cend(); ) {
+		auto first = *i, last = *i;
+		for (++i; i != lstMails.cend() && *i == last + 1; ++i)
+			last = *i;
+		if (ranges.size() == MAX_FETCH_RANGES)
+			return {};
+		ranges.emplace_back(lstFolderMailEIDs[first].ulUid, lstFolderMailEIDs[last].ulUid);
+	}
+	return imap_seq_ranges(ranges);
+}
+
 /**
  * Convert a UID sequence set into a MAPI restriction.
  *
@@ -3990,8 +5170,8 @@ HRESULT IMAP::HrParseSeqUidSet(const std::string &strSeqSet, std::list<ULONG> &l
 		if (ulPos == vSequences[i].npos) {
 			// single number
 			ulMailnr = LastOrNumber(vSequences[i].c_str(), true);
-			auto j = std::find(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), ulMailnr);
-			if (j != lstFolderMailEIDs.cend())
+			auto j = std::lower_bound(lstFolderMailEIDs.cbegin(), lstFolderMailEIDs.cend(), ulMailnr);
+			if (j != lstFolderMailEIDs.cend() && j->ulUid == ulMailnr)
 				lstMails.emplace_back(std::distance(lstFolderMailEIDs.cbegin(), j));
 			continue;
 		}
@@ -4295,7 +5475,6 @@ HRESULT IMAP::HrStore(const std::list<ULONG> &lstMails, std::string strMsgDataIt
     std::string strMsgDataItemValue, bool *lpbDoDelete)
 {
 	std::vector<std::string> lstFlags;
-	std::string strNewFlags;
 	bool bDelete = false;
 
 	if (strCurrentFolder.empty() || lpSession == nullptr)
@@ -4336,11 +5515,13 @@ HRESULT IMAP::HrStore(const std::list<ULONG> &lstMails, std::string strMsgDataIt
 		}
 
 		/* Get the newly updated flags */
-		hr = HrGetMessageFlags(strNewFlags, lpMessage, lstFolderMailEIDs[mail_idx].bRecent);
+		unsigned int ulNewFlags = 0;
+		hr = HrGetMessageFlags(lpMessage, ulNewFlags);
 		if (hr != hrSuccess)
 			return hr;
-		/* Update our internal flag status */
-		lstFolderMailEIDs[mail_idx].strFlags = strNewFlags;
+		/* Update our internal flag status; the STORE response tells the client */
+		lstFolderMailEIDs[mail_idx].ulFlags = ulNewFlags;
+		lstFolderMailEIDs[mail_idx].bStored = m_bCondstore;
 	} // loop on mails
 
 	HRESULT hr = hrSuccess;
@@ -4439,7 +5620,7 @@ HRESULT IMAP::HrSearch(std::vector<std::string> &&lstSearchCriteria,
 			return hrSuccess;
 		} else if (strSearchCriterium == "NEW") {
 			for (unsigned int ulMailnr = 0; ulMailnr < lstFolderMailEIDs.size(); ++ulMailnr)
-			    if(lstFolderMailEIDs[ulMailnr].bRecent && lstFolderMailEIDs[ulMailnr].strFlags.find("Seen") == std::string::npos)
+			    if (lstFolderMailEIDs[ulMailnr].bRecent && !(lstFolderMailEIDs[ulMailnr].ulFlags & IMAP_FLAG_SEEN))
 					lstMailnr.emplace_back(ulMailnr);
 			return hrSuccess;
 		} else if (strSearchCriterium == "OLD") {
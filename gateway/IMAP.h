@@ -10,6 +10,7 @@
 #include <utility>
 #include <vector>
 #include <list>
+#include <cstdint>
 #include <cstring>
 #include <kopano/ECChannel.h>
 #include <kopano/memory.hpp>
@@ -136,6 +137,8 @@ public:
 	virtual HRESULT HrProcessCommand(const std::string &input) override;
 	virtual HRESULT HrProcessContinue(const std::string &input) override;
 	virtual HRESULT HrDone(bool send_response) override;
+	virtual frame_t frame(const std::string &in) override;
+	virtual HRESULT HrSendContinuation() override;
 
 private:
 	void CleanupObject();
@@ -175,6 +178,7 @@ private:
 	template <bool uid> HRESULT HrCmdCopy(const std::string &strTag, const std::vector<std::string> &args) { return HrCmdCopy(strTag, args, uid); }
 	HRESULT HrCmdUidXaolMove(const std::string &tag, const std::vector<std::string> &args);
 	HRESULT HrCmdIdle(const std::string &tag);
+	HRESULT HrCmdEnable(const std::string &tag, const std::vector<std::string> &args);
 	HRESULT HrCmdNamespace(const std::string &tag);
 	HRESULT HrCmdGetQuotaRoot(const std::string &tag, const std::vector<std::string> &args);
 	HRESULT HrCmdGetQuota(const std::string &tag, const std::vector<std::string> &args);
@@ -201,15 +205,25 @@ private:
 		std::list<SFolder>::const_iterator lpParentFolder;
 	};
 
+	/* IMAP flags of a message, as kept in SMail::ulFlags */
+	enum {
+		IMAP_FLAG_SEEN = 1 << 0, IMAP_FLAG_FLAGGED = 1 << 1,
+		IMAP_FLAG_ANSWERED = 1 << 2, IMAP_FLAG_FORWARDED = 1 << 3,
+		IMAP_FLAG_DRAFT = 1 << 4, IMAP_FLAG_DELETED = 1 << 5,
+	};
+
 	// All data to be mapped per mail in the current folder
 	// Used class to be able to use sort
 	class SMail {
     public:
         BinaryArray sEntryID;		// EntryID of message
-        BinaryArray sInstanceKey;	// Instance key of message
-		ULONG ulUid;				// PR_EC_IMAP_UID of message
-		bool bRecent;				// \Recent flag
-		std::string strFlags;		// String of all flags, including \Recent
+		uint64_t ullSourceKey = 0;	// counter part of PR_SOURCE_KEY, 0 for foreign keys (see SFolderSync)
+		uint64_t ullInstanceKey = 0;	// PR_INSTANCE_KEY in the contents table, 0 if unknown
+		ULONG ulUid = 0;			// PR_EC_IMAP_UID of message
+		ULONG ulModSeq = 0;			// MODSEQ: ICS change number at which the last change was seen
+		unsigned char ulFlags = 0;	// IMAP_FLAG_* bits, \Recent excluded
+		bool bRecent = false;		// \Recent flag
+		bool bStored = false;		// changed by our STORE, which reports it already
 
 		bool operator<(const SMail &sMail) const noexcept { return ulUid < sMail.ulUid; }
 		bool operator<(ULONG uid) const noexcept { return ulUid < uid; }
@@ -217,6 +231,25 @@ private:
 		bool operator==(ULONG uid) const noexcept { return ulUid == uid; }
 	};
 
+	/*
+	 * What keeps lstFolderMailEIDs up to date without reading the whole
+	 * folder: the ICS state as of the last refresh, and what is needed
+	 * to map ICS deletions back to UIDs. Goes into the folder cache with
+	 * the message list when the folder is no longer selected.
+	 */
+	struct SFolderSync {
+		std::string strState;		// ICS state; empty when ICS is not used
+		std::string strKeyPrefix;	// first 16 bytes of the folder's PR_SOURCE_KEY, shared by its own messages
+		std::map<std::string, ULONG> mapForeignKeys; // PR_SOURCE_KEY -> UID for the other messages
+		std::vector<std::pair<ULONG, ULONG>> lstVanished; // (MODSEQ, UID) of expunged messages
+		std::vector<std::pair<ULONG, ULONG>> lstPendingExpunge; // (MODSEQ, UID) gone, not yet reported
+		ULONG ulUIDValidity = 0, ulHighestModSeq = 0;
+		ULONG ulBaseModSeq = 0;		// lstVanished is complete for changes after this one
+		bool bLoaded = false;		// lstFolderMailEIDs matches the folder as of strState
+	};
+	friend class IMAPFolderCache;
+	friend class IMAPFetchTask;
+
 	KC::object_ptr<IMAPISession> lpSession;
 	KC::object_ptr<IAddrBook> lpAddrBook;
 	KC::memory_ptr<SPropTagArray> m_lpsIMAPTags;
@@ -233,6 +266,11 @@ private:
 
 	// vector of mails in the current folder. The index is used for mail number.
 	std::vector<SMail> lstFolderMailEIDs;
+	SFolderSync m_sync;
+	std::string m_strFolderKey; /* of the current folder in the folder cache */
+	bool m_bFolderCache = false; /* process model shares the folder cache between sessions */
+	/* RFC 7162 extensions enabled by the client */
+	bool m_bCondstore = false, m_bQresync = false;
 	KC::object_ptr<IMsgStore> lpStore, lpPublicStore;
 
 	enum { PR_IPM_FAKEJUNK_ENTRYID = PR_ADDITIONAL_REN_ENTRYIDS };
@@ -242,6 +280,8 @@ private:
 	// Message cache
 	std::string m_strCache;
 	ULONG m_ulCacheUID = 0;
+	std::mutex m_cache_lock; /* m_strCache, for the fetch pool */
+	std::mutex m_session_lock; /* lpSession and lpAddrBook, for the fetch pool */
 
 	/* A command has sent a continuation response, and requires more
 	 * data from the client. This is currently only used in the
@@ -250,6 +290,9 @@ private:
 	bool m_bContinue = false;
 	std::string m_strContinueTag;
 
+	/* frame(): start of the current line, literal bytes still to come */
+	size_t m_frame_line = 0, m_frame_literal = 0;
+
 	// Idle mode variables
 	bool m_bIdleMode = false;
 	KC::object_ptr<IMAPIAdviseSink> m_lpIdleAdviseSink;
@@ -278,7 +321,19 @@ private:
 	HRESULT HrSetSubscribedList();
 	HRESULT ChangeSubscribeList(bool bSubscribe, ULONG eid_size, const ENTRYID *);
 	HRESULT HrMakeSpecialsList();
-	HRESULT HrRefreshFolderMails(bool bInitialLoad, bool bResetRecent, unsigned int *lpulUnseen, ULONG *lpulUIDValidity = NULL);
+	HRESULT HrRefreshFolderMails(bool bInitialLoad, bool bResetRecent, unsigned int *lpulUnseen, ULONG *lpulUIDValidity = NULL, bool bExpunge = true);
+	HRESULT HrSyncFolderMails(IMAPIFolder *, ULONG max_uid, bool notify, bool expunge, bool &new_mail);
+	HRESULT HrScanFolderMails(IMAPIFolder *, ULONG max_uid, bool notify, bool expunge, bool &new_mail);
+	HRESULT HrExportChanges(IMAPIFolder *, ULONG flags, IUnknown *collector, size_t max_changes, std::string &state);
+	void TakeFolderState(const SPropValue &sourcekey, ULONG uidvalidity, ULONG max_uid);
+	void ReleaseFolderState();
+	bool UseICS() const;
+	void EnableCondstore();
+	uint64_t SourceKeyId(const void *sk, size_t size) const;
+	void MailFromRow(const SRow &, SMail &);
+	void MailChanged(size_t mail_idx, unsigned int flags, ULONG modseq, bool notify);
+	void ExpungeMails(std::vector<size_t> &&mails, ULONG modseq, bool expunge, bool notify = true);
+	std::vector<std::pair<ULONG, ULONG>> VanishedSince(ULONG modseq, const std::string &uid_set);
 	HRESULT HrGetSubTree(std::list<SFolder> &folders, bool public_folders, std::list<SFolder>::const_iterator parent_folder);
 	HRESULT HrGetFolderPath(std::list<SFolder>::const_iterator lpFolder, const std::list<SFolder> &lstFolder, std::wstring &path);
 	HRESULT HrGetDataItems(std::string msgdata_itemnames, std::vector<std::string> &data_items);
@@ -286,12 +341,15 @@ private:
 	// fetch calls another fetch depending on the data items requested
 	HRESULT HrPropertyFetch(std::list<ULONG> &mails, std::vector<std::string> &data_items);
 	HRESULT save_generated_properties(const std::string &text, IMessage *message);
+	HRESULT MessageToINet(IMessage *, std::ostream &, const KC::sending_options &);
+	bool FetchNeedsMessage(const SPropValue *props, unsigned int nprops, const std::vector<std::string> &data_items) const;
 	HRESULT HrPropertyFetchRow(LPSPropValue props, ULONG nprops, std::string &response, ULONG mail_nr, bool bounce_flags, const std::vector<std::string> &data_items);
-	HRESULT HrGetMessageFlags(std::string &response, LPMESSAGE msg, bool recent);
+	HRESULT HrGetMessageFlags(IMessage *, unsigned int &flags);
 	HRESULT HrGetMessagePart(std::string &message_part, std::string &msg, const std::string &part_name);
 	ULONG LastOrNumber(const char *szNr, bool bUID);
 	HRESULT HrParseSeqSet(const std::string &seq, std::list<ULONG> &mails);
 	HRESULT HrParseSeqUidSet(const std::string &seq, std::list<ULONG> &mails);
+	std::string MailsToUidSet(const std::list<ULONG> &mails) const;
 	HRESULT HrSeqUidSetToRestriction(const std::string &seq, std::unique_ptr<KC::Restriction> &);
 	HRESULT HrStore(const std::list<ULONG> &mails, std::string msgdata_itemname, std::string msgdata_itemvalue, bool *do_del);
 	HRESULT HrStore_flags(const std::string &dataitemvalue, IMessage *, bool &xdelete);
@@ -315,6 +373,8 @@ private:
 	bool MatchFolderPath(const std::wstring &folder, const std::wstring &pattern);
 	// Various conversion functions
 	std::string PropsToFlags(LPSPropValue props, unsigned int nprops, bool recent, bool read);
+	static unsigned int PropsToFlagBits(const SPropValue *props, unsigned int nprops, bool read);
+	static std::string FlagBitsToString(unsigned int flags, bool recent);
 	void HrParseHeaders(const std::string &, std::list<std::pair<std::string, std::string> > &);
 	void HrGetSubString(std::string &output, const std::string &input, const std::string &begin, const std::string &end);
 	HRESULT HrExpungeDeleted(const std::string &tag, const std::string &cmd, std::unique_ptr<KC::Restriction> &&);
@@ -0,0 +1,163 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdlib>
+#include <kopano/stringutil.h>
+#include "IMAPModSeq.h"
+
+using namespace KC;
+
+void imap_split(const std::string &strInput, std::vector<std::string> &vWords)
+{
+	unsigned int uSpecialCount = 0;
+	size_t beginPos = 0, currentPos = 0, specialPos = std::string::npos;
+	auto findPos = strInput.find_first_of("\"()[] ", currentPos);
+
+	while (findPos != strInput.npos) {
+		if (uSpecialCount == 0 && strInput[findPos] == '"') {
+			// find corresponding " and add the string
+			specialPos = findPos;
+			do {
+				specialPos = strInput.find_first_of("\"", specialPos + 1);
+			} while (specialPos != strInput.npos && strInput[specialPos-1] == '\\');
+
+			if (specialPos != strInput.npos) {
+				vWords.emplace_back(strInput.substr(findPos + 1, specialPos - findPos - 1));
+				findPos = specialPos;
+				beginPos = findPos + 1;
+			}
+		} else if (strInput[findPos] == '(' || strInput[findPos] == '[') {
+			++uSpecialCount;
+		} else if (strInput[findPos] == ')' || strInput[findPos] == ']') {
+			if (uSpecialCount > 0)
+				--uSpecialCount;
+		} else if (uSpecialCount == 0) {
+			if (findPos > beginPos)
+				vWords.emplace_back(strInput.substr(beginPos, findPos - beginPos));
+			beginPos = findPos + 1;
+		}
+		currentPos = findPos + 1;
+		findPos = strInput.find_first_of("\"()[] ", currentPos);
+	}
+
+	if (beginPos < strInput.size())
+		vWords.emplace_back(strInput.substr(beginPos));
+}
+
+/* The words of a parenthesized list; false if @s is not one */
+static bool split_list(const std::string &s, std::vector<std::string> &words)
+{
+	if (s.size() < 2 || s.front() != '(' || s.back() != ')')
+		return false;
+	imap_split(s.substr(1, s.size() - 2), words);
+	return true;
+}
+
+bool imap_parse_select_params(const std::string &arg, bool qresync_enabled,
+    imap_select_params &sp)
+{
+	std::vector<std::string> params;
+	if (!split_list(arg, params) || params.empty())
+		return false;
+	for (size_t i = 0; i < params.size(); ++i) {
+		auto name = strToUpper(params[i]);
+		if (name == "CONDSTORE") {
+			sp.condstore = true;
+			continue;
+		}
+		std::vector<std::string> qr;
+		if (name != "QRESYNC" || !qresync_enabled || i + 1 >= params.size() ||
+		    !split_list(params[++i], qr) || qr.size() < 2)
+			return false;
+		sp.uidvalidity = strtoul(qr[0].c_str(), nullptr, 10);
+		sp.modseq = strtoul(qr[1].c_str(), nullptr, 10);
+		/* The optional seq-match-data is a list, the known UIDs are not */
+		if (qr.size() > 2 && qr[2][0] != '(')
+			sp.known_uids = qr[2];
+		sp.qresync = true;
+	}
+	return true;
+}
+
+bool imap_parse_fetch_modifiers(const std::vector<std::string> &mods,
+    bool uid_mode, bool qresync_enabled, imap_fetch_modifiers &fm,
+    std::string &error)
+{
+	for (size_t i = 0; i < mods.size(); ++i) {
+		if (mods[i] == "CHANGEDSINCE" && i + 1 < mods.size()) {
+			fm.modseq = strtoul(mods[++i].c_str(), nullptr, 10);
+			fm.changedsince = true;
+		} else if (mods[i] == "VANISHED" && uid_mode && qresync_enabled) {
+			fm.vanished = true;
+		} else {
+			error = "invalid modifier " + mods[i];
+			return false;
+		}
+	}
+	if (fm.vanished && !fm.changedsince) {
+		error = "VANISHED requires CHANGEDSINCE";
+		return false;
+	}
+	return true;
+}
+
+std::string imap_seq_ranges(const imap_uid_ranges &ranges)
+{
+	std::string s;
+	for (size_t i = 0; i < ranges.size(); ) {
+		auto lo = ranges[i].first, hi = ranges[i].second;
+		for (++i; i < ranges.size() && ranges[i].first <= hi + 1ULL; ++i)
+			hi = std::max(hi, ranges[i].second);
+		if (!s.empty())
+			s += ',';
+		s += stringify(lo);
+		if (hi != lo)
+			s += ":" + stringify(hi);
+	}
+	return s;
+}
+
+imap_uid_ranges imap_vanished_after(ULONG modseq,
+    const std::vector<std::pair<ULONG, ULONG>> &vanished)
+{
+	imap_uid_ranges gone;
+	for (const auto &v : vanished)
+		if (v.first > modseq)
+			gone.emplace_back(v.second, v.second);
+	std::sort(gone.begin(), gone.end());
+	return gone;
+}
+
+imap_uid_ranges imap_uid_set_filter(const imap_uid_ranges &ranges,
+    const std::string &uid_set, ULONG last_uid)
+{
+	if (uid_set.empty())
+		return ranges;
+
+	imap_uid_ranges known, ret;
+	auto number = [=](const char *s) -> ULONG {
+		return *s == '*' ? last_uid : strtoul(s, nullptr, 10);
+	};
+	for (const auto &seq : tokenize(uid_set, ',')) {
+		auto pos = seq.find(':');
+		ULONG lo = number(seq.c_str());
+		ULONG hi = pos == std::string::npos ? lo : number(seq.c_str() + pos + 1);
+		if (lo > hi)
+			std::swap(lo, hi);
+		known.emplace_back(lo, hi);
+	}
+	for (const auto &k : known)
+		for (const auto &g : ranges) {
+			auto lo = std::max(k.first, g.first), hi = std::min(k.second, g.second);
+			if (lo <= hi)
+				ret.emplace_back(lo, hi);
+		}
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
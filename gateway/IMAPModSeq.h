@@ -0,0 +1,82 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+#include <kopano/platform.h>
+
+/**
+ * @ingroup gateway_imap
+ * @{
+ */
+
+/*
+ * The parts of CONDSTORE and QRESYNC (RFC 7162) that do not need a MAPI
+ * session: parsing of the command parameters, and the UID range
+ * arithmetic for VANISHED. UID ranges are (first, last) pairs.
+ */
+
+typedef std::vector<std::pair<ULONG, ULONG>> imap_uid_ranges;
+
+/* Parameters of SELECT/EXAMINE */
+struct imap_select_params {
+	bool condstore = false, qresync = false;
+	ULONG uidvalidity = 0, modseq = 0;
+	std::string known_uids; /* empty for all */
+};
+
+/* Modifiers of FETCH */
+struct imap_fetch_modifiers {
+	bool changedsince = false, vanished = false;
+	ULONG modseq = 0;
+};
+
+/* Splits IMAP list input into words, keeping parenthesized and quoted parts together */
+extern void imap_split(const std::string &input, std::vector<std::string> &words);
+
+/*
+ * Parses "(CONDSTORE)" or "(QRESYNC (uidvalidity modseq [known-uids
+ * [seq-match-data]]))". QRESYNC is only accepted when the client enabled
+ * it. Returns false on anything else.
+ */
+extern bool imap_parse_select_params(const std::string &arg, bool qresync_enabled, imap_select_params &);
+
+/*
+ * Parses the (uppercased, split) FETCH modifiers: CHANGEDSINCE modseq,
+ * and VANISHED, which needs UID FETCH, QRESYNC and CHANGEDSINCE. Fails
+ * with a text for the BAD response in @error.
+ */
+extern bool imap_parse_fetch_modifiers(const std::vector<std::string> &mods, bool uid_mode, bool qresync_enabled, imap_fetch_modifiers &, std::string &error);
+
+/* Sorted ranges as an IMAP sequence set, joining adjacent and overlapping ones */
+extern std::string imap_seq_ranges(const imap_uid_ranges &);
+
+/* UIDs expunged after @modseq, from the remembered (MODSEQ, UID) pairs, sorted */
+extern imap_uid_ranges imap_vanished_after(ULONG modseq, const std::vector<std::pair<ULONG, ULONG>> &vanished);
+
+/* The UIDs below @last_uid that are not among the sorted UIDs [first, last) */
+template<typename Iter> imap_uid_ranges imap_uid_gaps(Iter first, Iter last, ULONG last_uid)
+{
+	imap_uid_ranges gaps;
+	ULONG next = 1;
+	for (; first != last; ++first) {
+		ULONG uid = *first;
+		if (uid > next)
+			gaps.emplace_back(next, uid - 1);
+		next = uid + 1;
+	}
+	if (last_uid >= next)
+		gaps.emplace_back(next, last_uid);
+	return gaps;
+}
+
+/*
+ * The parts of the sorted @ranges that are in the UID set @uid_set; "*"
+ * in the set stands for @last_uid. All of @ranges for an empty set.
+ */
+extern imap_uid_ranges imap_uid_set_filter(const imap_uid_ranges &ranges, const std::string &uid_set, ULONG last_uid);
+
+/** @} */
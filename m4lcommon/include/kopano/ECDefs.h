@@ -201,6 +201,16 @@ struct ECSERVERLIST {
 
 #define EC_SUBMIT_DOSENTMAIL	0x00000002
 
+// IECSpooler::DeliverCopies, one per copy
+struct ECDELIVERCOPY {
+	SBinary sFolderId;		// folder to create the copy in
+	ULONG cValues;			// properties to set on the copy
+	SPropValue *lpProps;
+	const SPropTagArray *lpDelProps; // properties not to copy, may be NULL
+	HRESULT hResult;		// out: result for this copy
+	SBinary sEntryId;		// out: entryid of the copy
+};
+
 // GetServerDetails
 #define EC_SERVERDETAIL_NO_NAME			0x00000001
 #define EC_SERVERDETAIL_FILEPATH		0x00000002
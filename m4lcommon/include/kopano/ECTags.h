@@ -112,6 +112,12 @@
 #define PR_EC_STATS_SESSION_CLIENT_APPLICATION_VERSION	PROP_TAG(PT_STRING8, 0x6754)
 #define PR_EC_STATS_SESSION_CLIENT_APPLICATION_MISC	PROP_TAG(PT_STRING8, 0x6755)
 
+/* Client-side object cache of the session group (EC_PROFILE_FLAGS_CLIENT_CACHE) */
+#define PR_EC_STATS_CLIENT_CACHE_HITS		PROP_TAG(PT_LONGLONG, 0x6756)
+#define PR_EC_STATS_CLIENT_CACHE_MISSES		PROP_TAG(PT_LONGLONG, 0x6757)
+#define PR_EC_STATS_CLIENT_CACHE_SAVED_CALLS	PROP_TAG(PT_LONGLONG, 0x6758)
+#define PR_EC_STATS_CLIENT_CACHE_BYTES		PROP_TAG(PT_LONGLONG, 0x6759)
+
 #define PR_EC_OUTOFOFFICE			PROP_TAG(PT_BOOLEAN, 0x6760)
 #define PR_EC_OUTOFOFFICE_MSG			PROP_TAG(PT_TSTRING, 0x6761)
 #define PR_EC_OUTOFOFFICE_MSG_A			PROP_TAG(PT_STRING8, 0x6761)
@@ -243,6 +249,10 @@
 #define EC_PROFILE_FLAGS_TRUNCATE_SOURCEKEY		0x0000800		// Truncate PR_SOURCE_KEY to 22 bytes (from 24 bytes)
 #define EC_PROFILE_FLAGS_NO_UID_AUTH			0x0001000		// Don't grant access based on the uid of the connecting process (Unix socket only)
 #define EC_PROFILE_FLAGS_OIDC                   0x0004000
+#define EC_PROFILE_FLAGS_NO_BINARY_RPC			0x0008000		// Make all calls as SOAP, even if the server offers binary RPC
+#define EC_PROFILE_FLAGS_NO_COMPOUND_RPC		0x0010000		// Make every call on its own, even if the server offers compound calls
+#define EC_PROFILE_FLAGS_CLIENT_CACHE			0x0020000		// Keep loaded folders and small messages per session group, invalidated by notifications
+#define EC_PROFILE_FLAGS_NO_NOTIFY_MUX			0x0040000		// One notification thread and connection per session group, even if the server can serve them together
 
 // Kopano internal flags
 #define EC_PROVIDER_OFFLINE				0x0F00000
@@ -204,6 +204,9 @@ class IECSpooler : public virtual IUnknown {
 
 	// Removes a message from the master outgoing table
 	virtual HRESULT DeleteFromMasterOutgoingTable(ULONG cbEntryID, const ENTRYID *lpEntryID, ULONG ulFlags) = 0;
+
+	// Copies a delivered message into other folders on the same server; lpCopies is allocated with MAPIAllocateBuffer
+	virtual HRESULT DeliverCopies(ULONG cbTemplateID, const ENTRYID *lpTemplateID, ULONG cCopies, ECDELIVERCOPY *lpCopies) = 0;
 };
 
 class IECTestProtocol : public virtual IUnknown {
@@ -76,6 +76,17 @@ enum mapibuf_ident {
 	MAPIBUF_MORE,
 };
 
+/*
+ * A MAPIAllocateBuffer buffer is the head of an arena. The first
+ * MAPIAllocateMore chains a block to it, and later ones carve from that
+ * block until it is used up and the next, twice as big, is chained (big
+ * requests get a block of their own). Buffers that never see a
+ * MAPIAllocateMore cost no more than the caller asked for.
+ * MAPIFreeBuffer then frees the handful of blocks at once.
+ */
+#define MAPIBUF_BLOCK_MIN 256
+#define MAPIBUF_BLOCK_MAX 65536
+
 struct alignas(::max_align_t) mapiext_head {
 	struct mapiext_head *child;
 	alignas(::max_align_t) char data[];
@@ -83,13 +94,20 @@ struct alignas(::max_align_t) mapiext_head {
 
 struct alignas(::max_align_t) mapibuf_head {
 	std::mutex mtx;
-	struct mapiext_head *child; /* singly-linked list */
+	struct mapiext_head *child; /* singly-linked list of chained blocks */
+	char *cur, *end; /* free part of the current block */
+	size_t next_block; /* size of the next chained block */
 #if MAPI_MEM_MORE_DEBUG
 	enum mapibuf_ident ident;
 #endif
 	alignas(::max_align_t) char data[];
 };
 
+static inline size_t mapibuf_align(size_t z)
+{
+	return (z + alignof(::max_align_t) - 1) & ~(alignof(::max_align_t) - 1);
+}
+
 /* Some required globals */
 std::unique_ptr<MAPISVC> m4l_lpMAPISVC;
 
@@ -1810,18 +1828,19 @@ SCODE MAPIAllocateBuffer(ULONG cbSize, LPVOID *lppBuffer)
 {
 	if (lppBuffer == NULL)
 		return MAPI_E_INVALID_PARAMETER;
-	cbSize += sizeof(struct mapibuf_head);
-	auto bfr = static_cast<struct mapibuf_head *>(malloc(cbSize));
+	auto bfr = static_cast<struct mapibuf_head *>(malloc(sizeof(struct mapibuf_head) + cbSize));
 	if (bfr == nullptr)
 		return MAKE_MAPI_E(1);
 	try {
 		new(bfr) struct mapibuf_head; /* init mutex */
-		bfr->child = nullptr;
 	} catch (const std::exception &e) {
 		fprintf(stderr, "MAPIAllocateBuffer: %s\n", e.what());
 		free(bfr);
 		return MAKE_MAPI_E(1);
 	}
+	bfr->child = nullptr;
+	bfr->cur = bfr->end = nullptr;
+	bfr->next_block = MAPIBUF_BLOCK_MIN;
 	*lppBuffer = bfr->data;
 	return hrSuccess;
 }
@@ -1842,22 +1861,39 @@ SCODE MAPIAllocateMore(ULONG cbSize, LPVOID lpObject, LPVOID *lppBuffer)
 		return MAPI_E_INVALID_PARAMETER;
 	if (!lpObject)
 		return MAPIAllocateBuffer(cbSize, lppBuffer);
-	cbSize += sizeof(struct mapiext_head);
-	auto bfr = static_cast<struct mapiext_head *>(malloc(cbSize));
-	if (bfr == nullptr) {
-		ec_log_crit("MAPIAllocateMore(): %s", strerror(errno));
-		return MAKE_MAPI_E(1);
-	}
 
 	auto head = container_of(lpObject, struct mapibuf_head, data);
 #if MAPI_MEM_MORE_DEBUG
 	if (head->ident != MAPIBUF_BASE)
 		assert("AllocateMore on something that was not allocated with MAPIAllocateBuffer!\n" == nullptr);
 #endif
+	auto size = mapibuf_align(cbSize);
 	scoped_lock lock(head->mtx);
+	if (head->cur != nullptr && size <= static_cast<size_t>(head->end - head->cur)) {
+		*lppBuffer = head->cur;
+		head->cur += size;
+		return hrSuccess;
+	}
+	/*
+	 * Requests bigger than a quarter of the next block get a block of
+	 * their own, and the current block stays in use.
+	 */
+	auto own = size > head->next_block / 4;
+	auto bsize = own ? size : head->next_block;
+	auto bfr = static_cast<struct mapiext_head *>(malloc(sizeof(struct mapiext_head) + bsize));
+	if (bfr == nullptr) {
+		ec_log_crit("MAPIAllocateMore(): %s", strerror(errno));
+		return MAKE_MAPI_E(1);
+	}
 	bfr->child = head->child;
 	head->child = bfr;
 	*lppBuffer = bfr->data;
+	if (!own) {
+		head->cur = bfr->data + size;
+		head->end = bfr->data + bsize;
+		if (head->next_block < MAPIBUF_BLOCK_MAX)
+			head->next_block *= 2;
+	}
 #if MAPI_MEM_DEBUG
 	fprintf(stderr, "Extra buffer: %p on %p\n", *lppBuffer, lpObject);
 #endif
@@ -1887,7 +1923,7 @@ ULONG MAPIFreeBuffer(LPVOID lpBuffer)
 	while (p != nullptr) {
 		auto q = p->child;
 #if MAPI_MEM_DEBUG
-		fprintf(stderr, "  Freeing: %p\n", i);
+		fprintf(stderr, "  Freeing: %p\n", p);
 #endif
 		free(p);
 		p = q;
@@ -1895,7 +1931,7 @@ ULONG MAPIFreeBuffer(LPVOID lpBuffer)
 	head->~mapibuf_head();
 	free(head);
 	return 0;
- }
+}
 
 // ---
 // Entry
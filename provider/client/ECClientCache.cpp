@@ -0,0 +1,112 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <cstddef>
+#include <mapidefs.h>
+#include "kcore.hpp"
+#include "ECClientCache.h"
+
+using namespace KC;
+
+/* Messages larger than this (without their large properties) are not kept */
+static constexpr size_t MAX_CACHED_MESSAGE = 32768;
+
+static size_t object_size(const MAPIOBJECT &o)
+{
+	size_t s = sizeof(o) + o.cbInstanceID +
+	           (o.lstDeleted.size() + o.lstAvailable.size()) * (sizeof(ULONG) + 2 * sizeof(void *));
+	for (const auto &p : o.lstProperties)
+		s += sizeof(p) + 2 * sizeof(void *) + p.GetSize();
+	for (const auto &p : o.lstModified)
+		s += sizeof(p) + 2 * sizeof(void *) + p.GetSize();
+	for (const auto c : o.lstChildren)
+		s += object_size(*c);
+	return s;
+}
+
+ECClientCache::ECClientCache(size_t maxsize) :
+	m_cache("client_objects", maxsize, 0)
+{}
+
+std::string ECClientCache::key(unsigned int eid_size, const void *eid)
+{
+	/* Only v1 entryids name the object independently of the server */
+	if (eid == nullptr || eid_size < offsetof(EID, szServer))
+		return {};
+	auto e = static_cast<const EID *>(eid);
+	if (e->ulVersion != 1)
+		return {};
+	std::string k(reinterpret_cast<const char *>(&e->guid), sizeof(e->guid));
+	k.append(reinterpret_cast<const char *>(&e->uniqueId), sizeof(e->uniqueId));
+	return k;
+}
+
+bool ECClientCache::contains(const std::string &k)
+{
+	ECCachedObject *v = nullptr;
+	std::lock_guard<std::mutex> lk(m_lock);
+	return !k.empty() && m_cache.GetCacheItem(k, &v) == erSuccess;
+}
+
+MAPIOBJECT *ECClientCache::get(const std::string &k)
+{
+	if (k.empty())
+		return nullptr;
+	std::shared_ptr<const MAPIOBJECT> obj;
+	{
+		ECCachedObject *v = nullptr;
+		std::lock_guard<std::mutex> lk(m_lock);
+		if (m_cache.GetCacheItem(k, &v) != erSuccess) {
+			++m_misses;
+			return nullptr;
+		}
+		obj = v->obj;
+	}
+	++m_hits;
+	/* The caller owns (and modifies) what HrLoadObject returns */
+	return new MAPIOBJECT(*obj);
+}
+
+void ECClientCache::put(const std::string &k, const MAPIOBJECT &obj, uint64_t gen)
+{
+	if (k.empty() || (obj.ulObjType != MAPI_FOLDER && obj.ulObjType != MAPI_MESSAGE))
+		return;
+	ECCachedObject v;
+	v.size = object_size(obj);
+	if (obj.ulObjType == MAPI_MESSAGE && v.size > MAX_CACHED_MESSAGE)
+		return;
+	v.obj = std::make_shared<MAPIOBJECT>(obj);
+	std::lock_guard<std::mutex> lk(m_lock);
+	if (gen != m_generation)
+		return;
+	m_cache.AddCacheItem(k, std::move(v));
+}
+
+void ECClientCache::invalidate(const std::string &k)
+{
+	if (k.empty())
+		return;
+	std::lock_guard<std::mutex> lk(m_lock);
+	++m_generation;
+	m_cache.RemoveCacheItem(k);
+}
+
+void ECClientCache::clear()
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	++m_generation;
+	m_cache.ClearCache();
+}
+
+ECClientCache::stats ECClientCache::get_stats()
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	stats s;
+	s.hits = m_hits;
+	s.misses = m_misses;
+	s.saved_calls = m_saved_calls;
+	s.bytes = m_cache.Size();
+	return s;
+}
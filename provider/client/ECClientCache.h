@@ -0,0 +1,72 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <kopano/zcdefs.h>
+#include <ECCache.h>
+#include "IECPropStorage.h"
+
+class ECCachedObject final : public KC::CacheEntry {
+	public:
+	std::shared_ptr<const MAPIOBJECT> obj;
+	size_t size = 0;
+};
+
+namespace KC {
+template<> inline size_t GetCacheAdditionalSize(const ECCachedObject &v)
+{
+	return v.size;
+}
+}
+
+/**
+ * Objects as returned by loadObject, kept per session group when the
+ * profile has EC_PROFILE_FLAGS_CLIENT_CACHE, so that reopening a folder or
+ * message in the same process only needs a checkExistObject for the
+ * access check instead of the full loadObject.
+ *
+ * The cache is only coherent because ECMsgStore subscribes to all object
+ * notifications of its store and drops the entries they name; it is
+ * cleared whenever the notification channel was interrupted. Rights
+ * changes send no notification, which is why the server keeps checking
+ * access for every open.
+ */
+class ECClientCache final {
+	public:
+	struct stats {
+		uint64_t hits, misses, saved_calls, bytes;
+	};
+
+	ECClientCache(size_t maxsize);
+	/* Cache key of an entryid, empty if it cannot be cached */
+	static std::string key(unsigned int eid_size, const void *eid);
+	/* Marks the start of a server load; see put() */
+	uint64_t generation() const { return m_generation; }
+	/* Lookup that does not count as a hit or miss */
+	bool contains(const std::string &);
+	/* Copy of the cached object, or nullptr */
+	MAPIOBJECT *get(const std::string &);
+	/*
+	 * Caches @obj unless something was invalidated since @gen, in which
+	 * case the object might already be stale.
+	 */
+	void put(const std::string &, const MAPIOBJECT &obj, uint64_t gen);
+	void invalidate(const std::string &);
+	void clear();
+	/* A loadObject answered from the cache */
+	void saved_call() { ++m_saved_calls; }
+	stats get_stats();
+
+	private:
+	std::mutex m_lock;
+	KC::ECCache<std::unordered_map<std::string, ECCachedObject>> m_cache;
+	std::atomic<uint64_t> m_generation{0}, m_hits{0}, m_misses{0};
+	std::atomic<uint64_t> m_saved_calls{0};
+};
@@ -18,6 +18,8 @@
 #include "ECMAPIFolder.h"
 #include "ECMAPIProp.h"
 #include "WSTransport.h"
+#include "WSCompound.h"
+#include "ECClientCache.h"
 #include <kopano/ECTags.h>
 #include <kopano/ECGuid.h>
 #include <kopano/ECABEntryID.h>
@@ -95,6 +97,10 @@ ECMsgStore::ECMsgStore(const char *lpszProfname, IMAPISupport *sup,
 	HrAddPropHandlers(PR_EC_STATSTABLE_USERS, GetPropHandler, DefaultSetPropComputed, this, false, true);
 	HrAddPropHandlers(PR_EC_STATSTABLE_COMPANY, GetPropHandler, DefaultSetPropComputed, this, false, true);
 	HrAddPropHandlers(PR_EC_STATSTABLE_SERVERS, GetPropHandler, DefaultSetPropComputed, this, false, true);
+	HrAddPropHandlers(PR_EC_STATS_CLIENT_CACHE_HITS, GetPropHandler, DefaultSetPropComputed, this, false, true);
+	HrAddPropHandlers(PR_EC_STATS_CLIENT_CACHE_MISSES, GetPropHandler, DefaultSetPropComputed, this, false, true);
+	HrAddPropHandlers(PR_EC_STATS_CLIENT_CACHE_SAVED_CALLS, GetPropHandler, DefaultSetPropComputed, this, false, true);
+	HrAddPropHandlers(PR_EC_STATS_CLIENT_CACHE_BYTES, GetPropHandler, DefaultSetPropComputed, this, false, true);
 	HrAddPropHandlers(PR_TEST_LINE_SPEED, GetPropHandler, DefaultSetPropComputed, this, false, true);
 	HrAddPropHandlers(PR_EMSMDB_SECTION_UID, GetPropHandler, DefaultSetPropComputed, this, false, true);
 	HrAddPropHandlers(PR_ACL_DATA, GetPropHandler, SetPropHandler, this, false, true);
@@ -499,6 +505,13 @@ HRESULT ECMsgStore::OpenEntry(ULONG cbEntryID, const ENTRYID *lpEntryID,
 	object_ptr<IECPropStorage> lpPropStorage;
 	object_ptr<WSMAPIFolderOps> lpFolderOps;
 	unsigned int objtype = 0;
+	entryId sEntryId; // Do not free
+	/*
+	 * Without MAPI_DEFERRED_ERRORS, the existence check and the load of
+	 * the object go to the server in one round trip.
+	 */
+	WSCompound batch(lpTransport);
+	WSCompound *preload = nullptr;
 
 	if(ulFlags & MAPI_MODIFY) {
 		if (!fModify)
@@ -523,7 +536,14 @@ HRESULT ECMsgStore::OpenEntry(ULONG cbEntryID, const ENTRYID *lpEntryID,
 		hr = HrCompareEntryIdWithStoreGuid(cbEntryID, lpEntryID, &g);
 		if(hr != hrSuccess)
 			return hr;
-		if(!(ulFlags & MAPI_DEFERRED_ERRORS)) {
+		if (!(ulFlags & MAPI_DEFERRED_ERRORS) && batch.batched()) {
+			hr = CopyMAPIEntryIdToSOAPEntryId(cbEntryID, lpEntryID, &sEntryId, true);
+			if (hr != hrSuccess)
+				return hr;
+			batch.check_exist(sEntryId, ulFlags & SHOW_SOFT_DELETES,
+				[](const struct compound_result &r) { return kcerr_to_mapierr(r.er, MAPI_E_NOT_FOUND); });
+			preload = &batch;
+		} else if (!(ulFlags & MAPI_DEFERRED_ERRORS)) {
 			hr = lpTransport->HrCheckExistObject(cbEntryID, lpEntryID, (ulFlags & (SHOW_SOFT_DELETES)));
 			if (hr != hrSuccess)
 				return hr;
@@ -544,9 +564,12 @@ HRESULT ECMsgStore::OpenEntry(ULONG cbEntryID, const ENTRYID *lpEntryID,
 			return hr;
 		if (m_transact)
 			lpMAPIFolder->enable_transaction(true);
-		hr = lpTransport->HrOpenPropStorage(m_cbEntryId, m_lpEntryId, cbEntryID, lpEntryID, (ulFlags & SHOW_SOFT_DELETES) ? MSGFLAG_DELETED : 0, &~lpPropStorage);
+		hr = lpTransport->HrOpenPropStorage(m_cbEntryId, m_lpEntryId, cbEntryID, lpEntryID, (ulFlags & SHOW_SOFT_DELETES) ? MSGFLAG_DELETED : 0, &~lpPropStorage, preload);
 		if(hr != hrSuccess)
 			return hr;
+		hr = batch.execute();
+		if (hr != hrSuccess)
+			return hr;
 		hr = lpMAPIFolder->HrSetPropStorage(lpPropStorage, !(ulFlags & MAPI_DEFERRED_ERRORS));
 		if(hr != hrSuccess)
 			return hr;
@@ -565,9 +588,12 @@ HRESULT ECMsgStore::OpenEntry(ULONG cbEntryID, const ENTRYID *lpEntryID,
 
 		// SC: TODO: null or my entryid ?? (this is OpenEntry(), so we don't need it?)
 		// parent only needed on create new item .. ohwell
-		hr = lpTransport->HrOpenPropStorage(m_cbEntryId, m_lpEntryId, cbEntryID, lpEntryID, (ulFlags & SHOW_SOFT_DELETES) ? MSGFLAG_DELETED : 0, &~lpPropStorage);
+		hr = lpTransport->HrOpenPropStorage(m_cbEntryId, m_lpEntryId, cbEntryID, lpEntryID, (ulFlags & SHOW_SOFT_DELETES) ? MSGFLAG_DELETED : 0, &~lpPropStorage, preload);
 		if(hr != hrSuccess)
 			return hr;
+		hr = batch.execute();
+		if (hr != hrSuccess)
+			return hr;
 		hr = lpMessage->SetEntryId(cbEntryID, lpEntryID);
 		if(hr != hrSuccess)
 			return hr;
@@ -580,7 +606,8 @@ HRESULT ECMsgStore::OpenEntry(ULONG cbEntryID, const ENTRYID *lpEntryID,
 			*lpulObjType = MAPI_MESSAGE;
 		break;
 	default:
-		return MAPI_E_NOT_FOUND;
+		hr = batch.execute();
+		return hr != hrSuccess ? hr : MAPI_E_NOT_FOUND;
 	}
 	return hr;
 }
@@ -984,6 +1011,21 @@ HRESULT ECMsgStore::GetPropHandler(unsigned int ulPropTag, void *lpProvider,
 		wcscpy(lpsPropValue->Value.lpszW, tmp.c_str());
 		break;
 	}
+	case PROP_ID(PR_EC_STATS_CLIENT_CACHE_HITS):
+	case PROP_ID(PR_EC_STATS_CLIENT_CACHE_MISSES):
+	case PROP_ID(PR_EC_STATS_CLIENT_CACHE_SAVED_CALLS):
+	case PROP_ID(PR_EC_STATS_CLIENT_CACHE_BYTES): {
+		auto cache = lpStore->lpTransport->client_cache();
+		if (cache == nullptr)
+			return MAPI_E_NOT_FOUND;
+		auto st = cache->get_stats();
+		lpsPropValue->ulPropTag = ulPropTag;
+		lpsPropValue->Value.li.QuadPart =
+			PROP_ID(ulPropTag) == PROP_ID(PR_EC_STATS_CLIENT_CACHE_HITS) ? st.hits :
+			PROP_ID(ulPropTag) == PROP_ID(PR_EC_STATS_CLIENT_CACHE_MISSES) ? st.misses :
+			PROP_ID(ulPropTag) == PROP_ID(PR_EC_STATS_CLIENT_CACHE_SAVED_CALLS) ? st.saved_calls : st.bytes;
+		break;
+	}
 	case 0x8380: {
 		lpsPropValue->ulPropTag = ulPropTag;
 		auto &ver = lpStore->lpTransport->m_licjson;
@@ -1016,6 +1058,23 @@ HRESULT ECMsgStore::SetPropHandler(unsigned int ulPropTag, void *lpProvider,
 	return MAPI_E_NOT_FOUND;
 }
 
+/* Drops the objects named in store notifications from the client cache */
+static LONG ClientCacheCallback(void *lpContext, ULONG cNotif,
+    LPNOTIFICATION lpNotif)
+{
+	auto cache = static_cast<ECClientCache *>(lpContext);
+	if (cache == nullptr)
+		return S_OK;
+	for (ULONG i = 0; i < cNotif; ++i) {
+		const auto &obj = lpNotif[i].info.obj;
+		cache->invalidate(ECClientCache::key(obj.cbEntryID, obj.lpEntryID));
+		cache->invalidate(ECClientCache::key(obj.cbParentID, obj.lpParentID));
+		cache->invalidate(ECClientCache::key(obj.cbOldID, obj.lpOldID));
+		cache->invalidate(ECClientCache::key(obj.cbOldParentID, obj.lpOldParentID));
+	}
+	return S_OK;
+}
+
 HRESULT ECMsgStore::SetEntryId(ULONG cbEntryId, const ENTRYID *lpEntryId)
 {
 	assert(m_lpNotifyClient == NULL);
@@ -1027,7 +1086,27 @@ HRESULT ECMsgStore::SetEntryId(ULONG cbEntryId, const ENTRYID *lpEntryId)
 	// Create Notifyclient
 	hr = ECNotifyClient::Create(MAPI_STORE, this, m_ulProfileFlags, lpSupport, &~m_lpNotifyClient);
 	assert(m_lpNotifyClient != NULL);
-	return hr;
+	if (hr != hrSuccess || !(m_ulProfileFlags & EC_PROFILE_FLAGS_CLIENT_CACHE))
+		return hr;
+
+	/*
+	 * Objects of this store may only be cached once every change to them
+	 * comes back as a notification that drops them.
+	 */
+	auto cache = m_lpNotifyClient->client_cache();
+	object_ptr<IMAPIAdviseSink> sink;
+	ULONG conn = 0;
+	hr = HrAllocAdviseSink(ClientCacheCallback, cache.get(), &~sink);
+	if (hr == hrSuccess)
+		hr = InternalAdvise(0, nullptr, fnevObjectCreated | fnevObjectDeleted |
+		     fnevObjectModified | fnevObjectMoved | fnevObjectCopied,
+		     sink, &conn);
+	if (hr != hrSuccess) {
+		kc_perror("Client cache disabled: store advise failed", hr);
+		return hrSuccess;
+	}
+	lpTransport->set_client_cache(std::move(cache));
+	return hrSuccess;
 }
 
 HRESULT ECMsgStore::get_store_guid(GUID &g) const
@@ -2419,6 +2498,16 @@ HRESULT ECMsgStore::DeleteFromMasterOutgoingTable(ULONG cbEntryId,
 	return lpTransport->HrFinishedMessage(cbEntryId, lpEntryId, EC_SUBMIT_MASTER | ulFlags);
 }
 
+HRESULT ECMsgStore::DeliverCopies(ULONG cbTemplateID,
+    const ENTRYID *lpTemplateID, ULONG cCopies, ECDELIVERCOPY *lpCopies)
+{
+	if (lpTemplateID == nullptr || (cCopies > 0 && lpCopies == nullptr))
+		return MAPI_E_INVALID_PARAMETER;
+	if (cCopies == 0)
+		return hrSuccess;
+	return lpTransport->HrDeliverCopies(cbTemplateID, lpTemplateID, cCopies, lpCopies);
+}
+
 HRESULT ECMsgStore::TestPerform(const char *szCommand, unsigned int ulArgs,
     char **lpszArgs)
 {
@@ -74,6 +74,7 @@ public:
 	// IECSpooler
 	virtual HRESULT GetMasterOutgoingTable(ULONG flags, IMAPITable **) override;
 	virtual HRESULT DeleteFromMasterOutgoingTable(ULONG eid_size, const ENTRYID *eid, ULONG flags) override;
+	virtual HRESULT DeliverCopies(ULONG tmpl_size, const ENTRYID *tmpl, ULONG count, ECDELIVERCOPY *copies) override;
 
 	// IECServiceAdmin
 	virtual HRESULT CreateStore(ULONG store_type, ULONG user_size, const ENTRYID *user_eid, ULONG *newstore_size, ENTRYID **newstore_eid, ULONG *root_size, ENTRYID **root_eid) override;
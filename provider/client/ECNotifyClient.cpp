@@ -14,9 +14,11 @@
 #include <mapispi.h>
 #include <mapix.h>
 #include <kopano/ECLogger.h>
+#include "ECClientCache.h"
 #include "ECMsgStore.h"
 #include "ECNotifyClient.h"
 #include "ECSessionGroupManager.h"
+#include "SessionGroupData.h"
 #include <kopano/ECGuid.h>
 #include "SOAPUtils.h"
 #include "WSUtil.h"
@@ -523,3 +525,8 @@ HRESULT ECNotifyClient::UpdateSyncStates(const ECLISTSYNCID &lstSyncId, ECLISTSY
 {
 	return m_lpTransport->HrGetSyncStates(lstSyncId, lplstSyncState);
 }
+
+std::shared_ptr<ECClientCache> ECNotifyClient::client_cache()
+{
+	return m_lpSessionGroup->get_client_cache();
+}
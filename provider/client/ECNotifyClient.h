@@ -21,6 +21,7 @@ struct ECADVISE;
 struct ECCHANGEADVISE;
 typedef std::list<std::pair<syncid_t,connection_t> > ECLISTCONNECTION;
 
+class ECClientCache;
 class SessionGroupData;
 
 class ECNotifyClient KC_FINAL_OPG : public KC::ECUnknown {
@@ -47,6 +48,8 @@ public:
 	virtual HRESULT RegisterChangeAdvise(ULONG sync_id, ULONG change_id, KC::IECChangeAdviseSink *, ULONG *conn);
 	virtual HRESULT UnRegisterAdvise(ULONG ulConnection);
 	virtual HRESULT UpdateSyncStates(const ECLISTSYNCID &lstSyncID, ECLISTSYNCSTATE *lplstSyncState);
+	/* The object cache of the session group */
+	std::shared_ptr<ECClientCache> client_cache();
 
 private:
 	std::map<int, std::unique_ptr<ECADVISE>> m_mapAdvise; // Map of all advise request from the client (Outlook)
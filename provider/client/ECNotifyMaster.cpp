@@ -9,9 +9,12 @@
 #include <mutex>
 #include <kopano/memory.hpp>
 #include <kopano/ECLogger.h>
+#include <kopano/ECTags.h>
 #include <mapidefs.h>
+#include "kcore.hpp"
 #include "ECNotifyClient.h"
 #include "ECNotifyMaster.h"
+#include "ECNotifyMux.h"
 #include "ECSessionGroupManager.h"
 #include <kopano/stringutil.h>
 #include "SOAPUtils.h"
@@ -140,15 +143,41 @@ HRESULT ECNotifyMaster::DropConnection(ULONG ulConnection)
 	return hrSuccess;
 }
 
+/*
+ * Whether the notifications of this session group can come through the
+ * connection that the whole process shares with the server.
+ */
+bool ECNotifyMaster::use_mux()
+{
+	bool multi = false;
+	return m_lpTransport->HrCheckCapabilityFlags(KOPANO_CAP_NOTIFY_MULTI, &multi) == hrSuccess &&
+	       multi && !(m_lpTransport->GetProfileProps().ulProfileFlags & EC_PROFILE_FLAGS_NO_NOTIFY_MUX);
+}
+
 HRESULT ECNotifyMaster::StartNotifyWatch()
 {
 	/* Thread is already running */
-	if (m_bThreadRunning)
+	if (m_bThreadRunning || m_mux != nullptr)
 		return hrSuccess;
 	auto hr = ConnectToSession();
 	if (hr != hrSuccess)
 		return hr;
 
+	if (use_mux()) {
+		ECNotifyMux *mux = nullptr;
+		hr = ECNotifyMux::get(m_lpTransport, &mux);
+		if (hr == hrSuccess)
+			hr = mux->add(this);
+		if (hr == hrSuccess) {
+			m_mux = mux;
+			/* Only needed again for relogon and logoff */
+			m_lpTransport->close_socket();
+			return hrSuccess;
+		}
+		kc_perror("ECNotifyMux", hr);
+		/* Fall back to a thread of our own */
+	}
+
 	/* Make thread joinable which we need during shutdown */
 	pthread_attr_t m_hAttrib;
 	if (pthread_attr_init(&m_hAttrib) != 0)
@@ -179,6 +208,20 @@ HRESULT ECNotifyMaster::StopNotifyWatch()
 	object_ptr<WSTransport> lpTransport;
 	ulock_rec biglock(m_hMutex, std::defer_lock_t());
 
+	if (m_mux != nullptr) {
+		biglock.lock();
+		m_bThreadExit = true;
+		biglock.unlock();
+		/* Not under m_hMutex, the mux takes that during dispatch */
+		m_mux->remove(this);
+		m_mux = nullptr;
+		/* Nothing is waiting on m_lpTransport */
+		biglock.lock();
+		if (m_lpTransport)
+			m_lpTransport->HrLogOff();
+		return hrSuccess;
+	}
+
 	/* Thread was already halted, or connection is broken */
 	if (!m_bThreadRunning)
 		return hrSuccess;
@@ -210,20 +253,114 @@ HRESULT ECNotifyMaster::StopNotifyWatch()
 	return hrSuccess;
 }
 
+/*
+ * Session was killed by server, try to start a new login.
+ * This is not a foolproof recovery because 3 things might have happened:
+ *  1) WSTransport has been logged off during StopNotifyWatch().
+ *	2) Notification Session on server has died
+ *  3) SessionGroup on server has died
+ * If (1) m_bThreadExit will be set to TRUE, which means this thread is no longer desired. No
+ * need to make a big deal out of it.
+ * If (2) it is not a disaster (but it is a bad situation), the simple logon should do the trick
+ * of restoring the notification retrieval for all sessions for this group. Some notifications
+ * might have arrived later than we might want, but that should not be a total loss (the notificataions
+ * themselves will not have disappeared since they have been queued on the server).
+ * If (3) the problem is that _all_ sessions attached to the server has died and we have lost some
+ * notifications. The main issue however is that a new login for the notification session will not
+ * reanimate the other sessions belonging to this group and neither can we inform all ECNotifyClients
+ * that they now belong to a dead session. A new login is important however, when new sessions are
+ * attached to this group we must ensure that they will get notifications as expected.
+ *
+ * With @wait, keeps trying until the logon works or the watch is stopped;
+ * ECNotifyMux cannot hold up the other session groups for that.
+ */
+HRESULT ECNotifyMaster::Reconnect(bool wait)
+{
+	if (m_bThreadExit)
+		return MAPI_E_END_OF_SESSION;
+	auto hr = ConnectToSession();
+	while (hr != hrSuccess && wait && !m_bThreadExit) {
+		// On Windows, the ConnectToSession() takes a while .. the windows kernel does 3 connect tries
+		// But on linux, this immediately returns a connection error when the server socket is closed
+		// so we wait before we try again
+		Sleep(1000);
+		hr = ConnectToSession();
+	}
+	if (m_bThreadExit)
+		return MAPI_E_END_OF_SESSION;
+	if (hr != hrSuccess)
+		return hr;
+	// We have a new session ID, notify reload
+	lost_notifications();
+	scoped_rlock lock(m_hMutex);
+	if (m_mux != nullptr)
+		m_lpTransport->close_socket();
+	for (auto ptr : m_listNotifyClients)
+		ptr->NotifyReload();
+	return hrSuccess;
+}
+
+/* The session that the server queues the notifications of the group for */
+ECSESSIONID ECNotifyMaster::notify_session()
+{
+	ECSESSIONID sid = 0;
+	scoped_rlock lock(m_hMutex);
+	if (m_lpTransport != nullptr)
+		m_lpTransport->HrGetSessionId(&sid, nullptr);
+	return sid;
+}
+
+void ECNotifyMaster::lost_notifications()
+{
+	/* Invalidations may get lost while we are not listening */
+	m_lpSessionGroupData->clear_client_cache();
+}
+
+void ECNotifyMaster::Dispatch(notificationArray &notify)
+{
+	std::map<ULONG, NOTIFYLIST> mapNotifications;
+
+	/*
+	 * Loop through all notifications and sort them by connection number
+	 * with these mappings we can later send all notifications per connection to the appropriate client.
+	 */
+	for (gsoap_size_t item = 0; item < notify.__size; ++item) {
+		ULONG ulConnection = notify.__ptr[item].ulConnection;
+
+		// No need to do a find before an insert with a default object.
+		auto iterNotifications = mapNotifications.emplace(ulConnection, NOTIFYLIST()).first;
+		iterNotifications->second.emplace_back(&notify.__ptr[item]);
+	}
+
+	for (const auto &p : mapNotifications) {
+		/*
+		 * Check if we have a client registered for this connection
+		 * Be careful when locking this, Client->m_hMutex has priority over Master->m_hMutex
+		 * which means we should NEVER call a Client function while holding the Master->m_hMutex!
+		 */
+		scoped_rlock lock(m_hMutex);
+		auto iterClient = m_mapConnections.find(p.first);
+		if (iterClient == m_mapConnections.cend())
+			continue;
+		iterClient->second.Notify(p.first, p.second);
+		/*
+		 * All access to map completed, mutex is unlocked (end
+		 * of scope), and send notification to client.
+		 */
+	}
+}
+
 void* ECNotifyMaster::NotifyWatch(void *pTmpNotifyMaster)
 {
 	kcsrv_blocksigs();
 	auto pNotifyMaster = static_cast<ECNotifyMaster *>(pTmpNotifyMaster);
 	assert(pNotifyMaster != NULL);
-	std::map<ULONG, NOTIFYLIST> mapNotifications;
-	notifyResponse					notifications;
 	bool							bReconnect = false;
 
 	/* Ignore SIGPIPE which may be caused by HrGetNotify writing to the closed socket */
 	signal(SIGPIPE, SIG_IGN);
 
 	while (!pNotifyMaster->m_bThreadExit) {
-		notifications = notifyResponse();
 		if (pNotifyMaster->m_bThreadExit)
 			return nullptr;
 
@@ -246,41 +383,12 @@ void* ECNotifyMaster::NotifyWatch(void *pTmpNotifyMaster)
 				bReconnect = false;
 			continue;
 		} else if (hr == MAPI_E_NETWORK_ERROR) {
+			pNotifyMaster->lost_notifications();
 			bReconnect = true;
 			continue;
 		} else if (hr != hrSuccess) {
-			/*
-			 * Session was killed by server, try to start a new login.
-			 * This is not a foolproof recovery because 3 things might have happened:
-			 *  1) WSTransport has been logged off during StopNotifyWatch().
-			 *	2) Notification Session on server has died
-			 *  3) SessionGroup on server has died
-			 * If (1) m_bThreadExit will be set to TRUE, which means this thread is no longer desired. No
-			 * need to make a big deal out of it.
-			 * If (2) it is not a disaster (but it is a bad situation), the simple logon should do the trick
-			 * of restoring the notification retrieval for all sessions for this group. Some notifications
-			 * might have arrived later than we might want, but that should not be a total loss (the notificataions
-			 * themselves will not have disappeared since they have been queued on the server).
-			 * If (3) the problem is that _all_ sessions attached to the server has died and we have lost some
-			 * notifications. The main issue however is that a new login for the notification session will not
-			 * reanimate the other sessions belonging to this group and neither can we inform all ECNotifyClients
-			 * that they now belong to a dead session. A new login is important however, when new sessions are
-			 * attached to this group we must ensure that they will get notifications as expected.
-			 */
-			if (!pNotifyMaster->m_bThreadExit)
-				while (pNotifyMaster->ConnectToSession() != hrSuccess &&
-				    !pNotifyMaster->m_bThreadExit)
-					// On Windows, the ConnectToSession() takes a while .. the windows kernel does 3 connect tries
-					// But on linux, this immediately returns a connection error when the server socket is closed
-					// so we wait before we try again
-					Sleep(1000);
-
-			if (pNotifyMaster->m_bThreadExit)
+			if (pNotifyMaster->Reconnect(true) != hrSuccess)
 				return nullptr;
-			// We have a new session ID, notify reload
-			scoped_rlock lock(pNotifyMaster->m_hMutex);
-			for (auto ptr : pNotifyMaster->m_listNotifyClients)
-				ptr->NotifyReload();
 			continue;
 		}
 
@@ -289,44 +397,8 @@ void* ECNotifyMaster::NotifyWatch(void *pTmpNotifyMaster)
 		/* This is when the connection is interrupted */
 		if (pNotifyArray == NULL)
 			continue;
-
-		/*
-		 * Loop through all notifications and sort them by connection number
-		 * with these mappings we can later send all notifications per connection to the appropriate client.
-		 */
-		for (gsoap_size_t item = 0; item < pNotifyArray->__size; ++item) {
-			ULONG ulConnection = pNotifyArray->__ptr[item].ulConnection;
-
-			// No need to do a find before an insert with a default object.
-			auto iterNotifications = mapNotifications.emplace(ulConnection, NOTIFYLIST()).first;
-			iterNotifications->second.emplace_back(&pNotifyArray->__ptr[item]);
-		}
-
-		for (const auto &p : mapNotifications) {
-			/*
-			 * Check if we have a client registered for this connection
-			 * Be careful when locking this, Client->m_hMutex has priority over Master->m_hMutex
-			 * which means we should NEVER call a Client function while holding the Master->m_hMutex!
-			 */
-			scoped_rlock lock(pNotifyMaster->m_hMutex);
-			auto iterClient = pNotifyMaster->m_mapConnections.find(p.first);
-			if (iterClient == pNotifyMaster->m_mapConnections.cend())
-				continue;
-			iterClient->second.Notify(p.first, p.second);
-			/*
-			 * All access to map completed, mutex is unlocked (end
-			 * of scope), and send notification to client.
-			 */
-		}
-
-		/* We're done, clean the map for next round */
-		mapNotifications.clear();
-
-		/* Cleanup */
-		if (pNotifyArray != NULL) {
-			soap_del_PointerTonotificationArray(&pNotifyArray);
-			pNotifyArray = NULL;
-		}
+		pNotifyMaster->Dispatch(*pNotifyArray);
+		soap_del_PointerTonotificationArray(&pNotifyArray);
 	}
 	return NULL;
 }
@@ -17,6 +17,7 @@
 
 class ECNotifyClient;
 class ECNotifyMaster;
+class ECNotifyMux;
 class WSTransport;
 struct notification;
 
@@ -51,11 +52,18 @@ public:
 	virtual HRESULT ClaimConnection(ECNotifyClient* lpClient, NOTIFYCALLBACK fnCallback, ULONG ulConnection);
 	virtual HRESULT DropConnection(ULONG ulConnection);
 
+	/* Used by NotifyWatch and ECNotifyMux */
+	void Dispatch(struct notificationArray &);
+	HRESULT Reconnect(bool wait);
+	KC::ECSESSIONID notify_session();
+	void lost_notifications();
+
 private:
 	/* Threading functions */
 	virtual HRESULT StartNotifyWatch();
 	virtual HRESULT StopNotifyWatch();
 	static void* NotifyWatch(void *pTmpNotifyClient);
+	bool use_mux();
 
 	/* List of Clients attached to this master. */
 	std::list<ECNotifyClient *> m_listNotifyClients;
@@ -73,5 +81,7 @@ private:
 	std::recursive_mutex m_hMutex;
 	pthread_t					m_hThread;
 	BOOL m_bThreadRunning = false, m_bThreadExit = false;
+	/* Set instead of m_hThread when the notifications come from the shared channel */
+	ECNotifyMux *m_mux = nullptr;
 	ALLOC_WRAP_FRIEND;
 };
@@ -0,0 +1,297 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <mapicode.h>
+#include <kopano/ECLogger.h>
+#include <kopano/MAPIErrors.h>
+#include <kopano/ECTags.h>
+#include <kopano/kcodes.h>
+#include <kopano/stringutil.h>
+#include "kcore.hpp"
+#include "soapH.h"
+#include "ECNotifyMaster.h"
+#include "ECNotifyMux.h"
+
+using namespace KC;
+
+namespace {
+
+/* All muxes of the process, by connection settings */
+class mux_registry final {
+	public:
+	std::mutex lock;
+	std::map<std::string, std::unique_ptr<ECNotifyMux>> muxes;
+};
+
+}
+
+static mux_registry g_notify_muxes;
+
+static std::string mux_key(const sGlobalProfileProps &p)
+{
+	return p.strServerPath + '\n' + p.strSSLKeyFile + '\n' + p.strProxyHost +
+	       ':' + stringify(p.ulProxyPort) + '\n' +
+	       stringify(p.ulProfileFlags & EC_PROFILE_FLAGS_NO_COMPRESSION);
+}
+
+/*
+ * Done with a connection of the mux: make sure that the logoff in
+ * ~WSTransport does not go out, it would only block on a dead server.
+ */
+static void drop(object_ptr<WSTransport> &t)
+{
+	if (t == nullptr)
+		return;
+	t->HrCancelIO();
+	t.reset();
+}
+
+ECNotifyMux::ECNotifyMux(object_ptr<WSTransport> &&t) :
+	m_template(std::move(t))
+{
+	/* The connections of the mux belong to no session */
+	m_template->m_ecSessionId = 0;
+	m_template->m_ecSessionGroupId = 0;
+	m_template->set_client_cache(nullptr);
+	memset(&m_thread, 0, sizeof(m_thread));
+}
+
+ECNotifyMux::~ECNotifyMux()
+{
+	ulock_normal lk(m_lock);
+	m_exit = true;
+	if (m_transport != nullptr)
+		m_transport->HrCancelIO();
+	m_cond.notify_all();
+	lk.unlock();
+	if (m_running && pthread_join(m_thread, nullptr) != 0)
+		ec_log_debug("ECNotifyMux: Invalid thread join");
+	drop(m_transport);
+	drop(m_template);
+}
+
+HRESULT ECNotifyMux::get(WSTransport *transport, ECNotifyMux **lppMux)
+{
+	auto key = mux_key(transport->GetProfileProps());
+	scoped_lock lk(g_notify_muxes.lock);
+	auto i = g_notify_muxes.muxes.find(key);
+	if (i == g_notify_muxes.muxes.cend()) {
+		object_ptr<WSTransport> tpl;
+		auto hr = transport->HrClone(&~tpl);
+		if (hr != hrSuccess)
+			return hr;
+		i = g_notify_muxes.muxes.emplace(key, std::make_unique<ECNotifyMux>(std::move(tpl))).first;
+	}
+	*lppMux = i->second.get();
+	return hrSuccess;
+}
+
+HRESULT ECNotifyMux::add(ECNotifyMaster *master)
+{
+	scoped_lock lk(m_lock);
+	if (m_members.size() >= KOPANO_MAX_NOTIFY_SESSIONS)
+		return MAPI_E_TOO_BIG;
+	if (!m_running) {
+		pthread_attr_t attr;
+		if (pthread_attr_init(&attr) != 0)
+			return MAPI_E_NOT_ENOUGH_MEMORY;
+		/* 1Mb of stack space, as for the thread of an ECNotifyMaster */
+		if (pthread_attr_setstacksize(&attr, 1024 * 1024)) {
+			pthread_attr_destroy(&attr);
+			return MAPI_E_CALL_FAILED;
+		}
+		auto ret = pthread_create(&m_thread, &attr, thread_main, this);
+		pthread_attr_destroy(&attr);
+		if (ret != 0) {
+			ec_log_err("Could not create ECNotifyMux thread: %s", strerror(ret));
+			return MAPI_E_CALL_FAILED;
+		}
+		set_thread_name(m_thread, "notify_mux");
+		m_running = true;
+	}
+	m_members.emplace(master);
+	/* Restart a pending poll so that it includes the new session */
+	m_interrupt = true;
+	if (m_transport != nullptr) {
+		m_transport->HrCancelIO();
+		m_transport.reset();
+	}
+	m_cond.notify_all();
+	return hrSuccess;
+}
+
+void ECNotifyMux::remove(ECNotifyMaster *master)
+{
+	/* Waits for a dispatch to that master to finish */
+	std::lock_guard<std::recursive_mutex> dl(m_dispatch);
+	m_stale.erase(master);
+	scoped_lock lk(m_lock);
+	m_members.erase(master);
+	/*
+	 * The pending poll may still name the session of @master; its
+	 * reply is dropped, and the next poll is without it.
+	 */
+}
+
+bool ECNotifyMux::is_member(ECNotifyMaster *master)
+{
+	scoped_lock lk(m_lock);
+	return m_members.find(master) != m_members.cend();
+}
+
+void ECNotifyMux::sleep(unsigned int seconds)
+{
+	ulock_normal lk(m_lock);
+	m_cond.wait_for(lk, std::chrono::seconds(seconds), [this]() { return m_exit; });
+}
+
+void *ECNotifyMux::thread_main(void *arg)
+{
+	kcsrv_blocksigs();
+	/* Ignore SIGPIPE which may be caused by HrGetNotifyMulti writing to the closed socket */
+	signal(SIGPIPE, SIG_IGN);
+	static_cast<ECNotifyMux *>(arg)->run();
+	return nullptr;
+}
+
+/*
+ * Collects the notification sessions to poll on, giving masters whose
+ * session died another chance to get a new one.
+ */
+bool ECNotifyMux::snapshot(std::vector<ECSESSIONID> &sessions,
+    std::map<ECSESSIONID, ECNotifyMaster *> &owner)
+{
+	std::lock_guard<std::recursive_mutex> dl(m_dispatch);
+	std::vector<ECNotifyMaster *> members;
+	{
+		scoped_lock lk(m_lock);
+		m_interrupt = false;
+		members.assign(m_members.cbegin(), m_members.cend());
+	}
+	sessions.clear();
+	owner.clear();
+	for (auto m : members) {
+		/* NotifyReload callbacks may have released other masters */
+		if (!is_member(m))
+			continue;
+		if (m_stale.find(m) != m_stale.cend()) {
+			if (m->Reconnect(false) != hrSuccess)
+				continue;
+			m_stale.erase(m);
+		}
+		auto sid = m->notify_session();
+		if (sid == 0) {
+			m_stale.emplace(m);
+			continue;
+		}
+		sessions.emplace_back(sid);
+		owner.emplace(sid, m);
+	}
+	return !sessions.empty();
+}
+
+void ECNotifyMux::dispatch(std::vector<notify_group_result> &results,
+    const std::map<ECSESSIONID, ECNotifyMaster *> &owner)
+{
+	std::lock_guard<std::recursive_mutex> dl(m_dispatch);
+	for (auto &r : results) {
+		auto i = owner.find(r.session);
+		/* The master may be gone, also by callbacks of an earlier one */
+		auto m = i != owner.cend() && is_member(i->second) ? i->second : nullptr;
+		if (m == nullptr) {
+			/* nothing to do */
+		} else if (r.hr == MAPI_E_END_OF_SESSION) {
+			/* Unless it already has a new session */
+			if (m->notify_session() == r.session &&
+			    m->Reconnect(false) != hrSuccess)
+				m_stale.emplace(m);
+		} else if (r.hr != hrSuccess) {
+			ec_log_debug("ECNotifyMux: session %llu: %s (%x)",
+				static_cast<unsigned long long>(r.session),
+				GetMAPIErrorMessage(r.hr), r.hr);
+		} else if (r.items != nullptr) {
+			m->Dispatch(*r.items);
+		}
+		if (r.items != nullptr)
+			soap_del_PointerTonotificationArray(&r.items);
+	}
+	results.clear();
+}
+
+void ECNotifyMux::run()
+{
+	std::vector<ECSESSIONID> sessions;
+	std::map<ECSESSIONID, ECNotifyMaster *> owner;
+	std::vector<notify_group_result> results;
+
+	while (true) {
+		{
+			ulock_normal lk(m_lock);
+			m_cond.wait(lk, [this]() { return m_exit || !m_members.empty(); });
+			if (m_exit)
+				break;
+		}
+		if (!snapshot(sessions, owner)) {
+			/* Nothing but sessions that could not be replaced (yet) */
+			sleep(1);
+			continue;
+		}
+
+		object_ptr<WSTransport> transport;
+		ulock_normal lk(m_lock);
+		if (m_exit)
+			break;
+		if (m_transport == nullptr) {
+			auto hr = m_template->HrClone(&~m_transport);
+			if (hr != hrSuccess) {
+				lk.unlock();
+				kc_perror("ECNotifyMux: HrClone", hr);
+				sleep(1);
+				continue;
+			}
+			// Like a notification transport, the request takes up to EC_SESSION_KEEPALIVE_TIME
+			m_transport->HrSetRecvTimeout(EC_SESSION_KEEPALIVE_TIME + 10);
+		}
+		transport = m_transport;
+		lk.unlock();
+
+		/* Blocking call */
+		auto hr = transport->HrGetNotifyMulti(sessions, results);
+		lk.lock();
+		if (m_exit)
+			break;
+		auto interrupted = m_interrupt;
+		if (hr != hrSuccess && !interrupted && m_transport == transport)
+			m_transport.reset();
+		auto keep = m_transport == transport;
+		lk.unlock();
+		if (!keep)
+			drop(transport);
+
+		if (hr == hrSuccess) {
+			dispatch(results, owner);
+			continue;
+		}
+		/* Restarted for a new master, or replaced by a newer poll */
+		if (interrupted || hr == MAPI_E_NOT_FOUND)
+			continue;
+
+		/* Invalidations may get lost while we are not listening */
+		{
+			std::lock_guard<std::recursive_mutex> dl(m_dispatch);
+			for (const auto &p : owner)
+				if (is_member(p.second))
+					p.second->lost_notifications();
+		}
+		sleep(1);
+	}
+	for (auto &r : results)
+		if (r.items != nullptr)
+			soap_del_PointerTonotificationArray(&r.items);
+}
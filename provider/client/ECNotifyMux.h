@@ -0,0 +1,62 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <kopano/zcdefs.h>
+#include <kopano/memory.hpp>
+#include "WSTransport.h"
+
+class ECNotifyMaster;
+
+/**
+ * One long poll (notifyGetItemsMulti) that collects the notifications of
+ * all session groups of the process that talk to the same server, instead
+ * of one thread and one connection per ECNotifyMaster.
+ *
+ * Each master keeps its own notification session; the poll names all of
+ * them, and the reply is handed out by session id, which identifies the
+ * session group. A master joining restarts the poll so that it is included
+ * right away. Muxes live until the library is unloaded.
+ */
+class ECNotifyMux final {
+	public:
+	ECNotifyMux(KC::object_ptr<WSTransport> &&);
+	~ECNotifyMux();
+	/* The mux for the server (and connection settings) of @transport */
+	static HRESULT get(WSTransport *transport, ECNotifyMux **);
+	HRESULT add(ECNotifyMaster *);
+	/* After this returns, the master is not called anymore */
+	void remove(ECNotifyMaster *);
+
+	private:
+	static void *thread_main(void *);
+	void run();
+	bool snapshot(std::vector<KC::ECSESSIONID> &, std::map<KC::ECSESSIONID, ECNotifyMaster *> &);
+	void dispatch(std::vector<notify_group_result> &, const std::map<KC::ECSESSIONID, ECNotifyMaster *> &);
+	bool is_member(ECNotifyMaster *);
+	void sleep(unsigned int seconds);
+
+	/* m_template is never used for calls, just cloned for each connection */
+	KC::object_ptr<WSTransport> m_template, m_transport;
+	std::set<ECNotifyMaster *> m_members;
+	bool m_interrupt = false, m_exit = false, m_running = false;
+	pthread_t m_thread;
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+
+	/*
+	 * Held while masters are called. Masters whose notification session
+	 * is gone and could not be replaced yet are in m_stale; they are left
+	 * out of the poll and retried before the next one.
+	 */
+	std::recursive_mutex m_dispatch;
+	std::set<ECNotifyMaster *> m_stale;
+};
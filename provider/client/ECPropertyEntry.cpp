@@ -9,7 +9,9 @@
 #include <utility>
 #include <mapix.h>
 #include "ECPropertyEntry.h"
+#include "IECPropStorage.h"
 #include <kopano/charset/convert.h>
+#include <kopano/Util.h>
 
 using namespace KC;
 
@@ -902,3 +904,24 @@ SPropValue ECProperty::GetMAPIPropValRef() const
 	ret.Value = Value;
 	return ret;
 }
+
+MAPIOBJECT::MAPIOBJECT(const MAPIOBJECT &s) :
+	lstDeleted(s.lstDeleted), lstAvailable(s.lstAvailable),
+	lstModified(s.lstModified), lstProperties(s.lstProperties),
+	bChangedInstance(s.bChangedInstance), bChanged(s.bChanged),
+	bDelete(s.bDelete), ulUniqueId(s.ulUniqueId), ulObjId(s.ulObjId),
+	ulObjType(s.ulObjType)
+{
+	KC::Util::HrCopyEntryId(s.cbInstanceID, reinterpret_cast<const ENTRYID *>(s.lpInstanceID),
+		&cbInstanceID, reinterpret_cast<ENTRYID **>(&lpInstanceID));
+	for (const auto &i : s.lstChildren)
+		lstChildren.emplace(new MAPIOBJECT(*i));
+}
+
+MAPIOBJECT::~MAPIOBJECT()
+{
+	for (auto &obj : lstChildren)
+		delete obj;
+	if (lpInstanceID != nullptr)
+		MAPIFreeBuffer(lpInstanceID);
+}
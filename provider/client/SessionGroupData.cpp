@@ -3,9 +3,12 @@
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
 #include <kopano/platform.h>
+#include <memory>
 #include <mapicode.h>
 #include <mapix.h>
+#include <kopano/stringutil.h>
 #include "ClientUtil.h"
+#include "ECClientCache.h"
 #include "ECNotifyMaster.h"
 #include "ECSessionGroupManager.h"
 #include "SessionGroupData.h"
@@ -55,6 +58,26 @@ HRESULT SessionGroupData::create_transport(WSTransport **lppTransport)
 	return hrSuccess;
 }
 
+std::shared_ptr<ECClientCache> SessionGroupData::get_client_cache()
+{
+	scoped_rlock lock(m_hMutex);
+	if (m_client_cache != nullptr)
+		return m_client_cache;
+	size_t size = 8 << 20;
+	auto s = getenv("KOPANO_CLIENT_CACHE_SIZE");
+	if (s != nullptr)
+		size = atoui(s);
+	m_client_cache = std::make_shared<ECClientCache>(size);
+	return m_client_cache;
+}
+
+void SessionGroupData::clear_client_cache()
+{
+	scoped_rlock lock(m_hMutex);
+	if (m_client_cache != nullptr)
+		m_client_cache->clear();
+}
+
 ECSESSIONGROUPID SessionGroupData::GetSessionGroupId()
 {
 	return m_ecSessionGroupId;
@@ -5,6 +5,7 @@
 #pragma once
 #include <kopano/zcdefs.h>
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <tuple>
@@ -14,6 +15,7 @@
 #include <kopano/memory.hpp>
 #include "SOAPSock.h"
 
+class ECClientCache;
 class ECNotifyMaster;
 class WSTransport;
 
@@ -46,6 +48,7 @@ private:
 
 	/* Notification information */
 	KC::object_ptr<ECNotifyMaster> m_lpNotifyMaster;
+	std::shared_ptr<ECClientCache> m_client_cache;
 
 	/* Mutex */
 	std::recursive_mutex m_hMutex;
@@ -59,6 +62,9 @@ public:
 	static HRESULT Create(KC::ECSESSIONGROUPID, ECSessionGroupInfo *, const sGlobalProfileProps &, SessionGroupData **out);
 	HRESULT GetOrCreateNotifyMaster(ECNotifyMaster **lppMaster);
 	HRESULT create_transport(WSTransport **);
+	std::shared_ptr<ECClientCache> get_client_cache();
+	/* Forgets all cached objects, e.g. when notifications may have been lost */
+	void clear_client_cache();
 	ULONG AddRef();
 	ULONG Release();
 	BOOL IsOrphan();
@@ -0,0 +1,162 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <utility>
+#include <mapicode.h>
+#include <kopano/ECTags.h>
+#include <kopano/kcodes.h>
+#include "kcore.hpp"
+#include "soapH.h"
+#include "SOAPSock.h"
+#include "ClientUtil.h"
+#include "WSCompound.h"
+
+using namespace KC;
+
+WSCompound::WSCompound(WSTransport *t) :
+	m_transport(t)
+{}
+
+bool WSCompound::batched() const
+{
+	return (m_transport->m_ulServerCapabilities & KOPANO_CAP_COMPOUND_RPC) &&
+	       !(m_transport->m_sProfileProps.ulProfileFlags & EC_PROFILE_FLAGS_NO_COMPOUND_RPC);
+}
+
+void WSCompound::add(const struct compound_op &op, handler_t &&h)
+{
+	m_ops.emplace_back(op);
+	m_handlers.emplace_back(std::move(h));
+}
+
+void WSCompound::check_exist(const entryId &eid, unsigned int flags, handler_t &&h)
+{
+	struct compound_op op;
+	op.op    = COMPOUND_OP_CHECKEXISTOBJECT;
+	op.flags = flags;
+	op.eid   = eid;
+	add(op, std::move(h));
+}
+
+void WSCompound::load_object(const entryId &eid, struct notifySubscribe *ns,
+    unsigned int flags, handler_t &&h)
+{
+	struct compound_op op;
+	op.op        = COMPOUND_OP_LOADOBJECT;
+	op.flags     = flags;
+	op.eid       = eid;
+	op.subscribe = ns;
+	add(op, std::move(h));
+}
+
+void WSCompound::get_ids_from_names(struct namedPropArray *names,
+    unsigned int flags, handler_t &&h)
+{
+	struct compound_op op;
+	op.op    = COMPOUND_OP_GETIDSFROMNAMES;
+	op.flags = flags;
+	op.names = names;
+	add(op, std::move(h));
+}
+
+void WSCompound::table_multi(struct tableMultiRequest *req, handler_t &&h)
+{
+	struct compound_op op;
+	op.op    = COMPOUND_OP_TABLEMULTI;
+	op.table = req;
+	add(op, std::move(h));
+}
+
+/* The fallback for servers without ns__compound: the plain call for @op */
+ECRESULT WSCompound::call_one(const struct compound_op &op, struct compound_result &res)
+{
+	auto &cmd = m_transport->m_lpCmd;
+	auto sid = m_transport->m_ecSessionId;
+	int ret = SOAP_OK;
+
+	switch (op.op) {
+	case COMPOUND_OP_CHECKEXISTOBJECT:
+		ret = cmd->checkExistObject(sid, op.eid, op.flags, &res.er);
+		break;
+	case COMPOUND_OP_LOADOBJECT: {
+		struct loadObjectResponse r;
+		ret = cmd->loadObject(sid, op.eid, op.subscribe, op.flags, &r);
+		res.er = r.er;
+		res.object = soap_new_saveObject(cmd->soap);
+		*res.object = r.sSaveObject;
+		break;
+	}
+	case COMPOUND_OP_GETIDSFROMNAMES: {
+		struct getIDsFromNamesResponse r;
+		ret = cmd->getIDsFromNames(sid, op.names, op.flags, &r);
+		res.er = r.er;
+		res.tags = soap_new_propTagArray(cmd->soap);
+		*res.tags = r.lpsPropTags;
+		break;
+	}
+	case COMPOUND_OP_TABLEMULTI: {
+		struct tableMultiResponse r;
+		ret = cmd->tableMulti(sid, *op.table, &r);
+		res.er = r.er;
+		res.table_id = r.ulTableId;
+		res.rows = soap_new_rowSet(cmd->soap);
+		*res.rows = r.sRowSet;
+		break;
+	}
+	default:
+		return KCERR_INVALID_PARAMETER;
+	}
+	return ret != SOAP_OK ? KCERR_NETWORK_ERROR : res.er;
+}
+
+HRESULT WSCompound::execute()
+{
+	if (m_ops.empty())
+		return hrSuccess;
+
+	ECRESULT er = erSuccess;
+	std::vector<struct compound_result> single;
+	struct compound_response rsp;
+	const struct compound_result *results = nullptr;
+	soap_lock_guard spg(*m_transport);
+
+ retry:
+	if (m_transport->m_lpCmd == nullptr)
+		return MAPI_E_NETWORK_ERROR;
+	if (m_ops.size() > 1 && batched()) {
+		struct compound_op_set set;
+		set.__size = m_ops.size();
+		set.__ptr  = m_ops.data();
+		if (m_transport->m_lpCmd->compound(m_transport->m_ecSessionId, set, &rsp) != SOAP_OK)
+			er = KCERR_NETWORK_ERROR;
+		else
+			er = rsp.er;
+		if (er == erSuccess && rsp.results.__size != static_cast<int>(m_ops.size()))
+			er = KCERR_NETWORK_ERROR;
+		results = rsp.results.__ptr;
+	} else {
+		/* Errors of the calls go to the handlers, except for the session */
+		single.assign(m_ops.size(), compound_result());
+		for (size_t i = 0; i < m_ops.size(); ++i) {
+			er = call_one(m_ops[i], single[i]);
+			if (er == KCERR_END_OF_SESSION || er == KCERR_NETWORK_ERROR)
+				break;
+			er = erSuccess;
+		}
+		results = single.data();
+	}
+	if (er == KCERR_END_OF_SESSION && m_transport->HrReLogon() == hrSuccess)
+		goto retry;
+	auto hr = kcerr_to_mapierr(er, MAPI_E_NOT_FOUND);
+	if (hr != hrSuccess)
+		return hr;
+
+	for (size_t i = 0; i < m_ops.size(); ++i) {
+		hr = m_handlers[i](results[i]);
+		if (hr != hrSuccess)
+			return hr;
+	}
+	return hrSuccess;
+}
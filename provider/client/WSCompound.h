@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <functional>
+#include <vector>
+#include <kopano/memory.hpp>
+#include <kopano/zcdefs.h>
+#include <mapidefs.h>
+#include "soapStub.h"
+#include "WSTransport.h"
+
+/**
+ * Queues independent calls and makes them in one round trip (ns__compound)
+ * when the server has KOPANO_CAP_COMPOUND_RPC, and one by one otherwise.
+ *
+ * The entryids and other arguments are only referenced, so they have to
+ * live until execute() returns. Each handler gets the result of its call;
+ * that data is freed when execute() returns.
+ */
+class WSCompound final {
+	public:
+	typedef std::function<HRESULT(const struct compound_result &)> handler_t;
+
+	WSCompound(WSTransport *);
+	/* Whether the calls go to the server together */
+	bool batched() const;
+	void check_exist(const entryId &, unsigned int flags, handler_t &&);
+	void load_object(const entryId &, struct notifySubscribe *, unsigned int flags, handler_t &&);
+	void get_ids_from_names(struct namedPropArray *, unsigned int flags, handler_t &&);
+	void table_multi(struct tableMultiRequest *, handler_t &&);
+	/* Makes the calls and runs the handlers in order, up to the first failing one */
+	HRESULT execute();
+
+	private:
+	void add(const struct compound_op &, handler_t &&);
+	KC::ECRESULT call_one(const struct compound_op &, struct compound_result &);
+
+	KC::object_ptr<WSTransport> m_transport;
+	std::vector<struct compound_op> m_ops;
+	std::vector<handler_t> m_handlers;
+};
@@ -8,6 +8,7 @@
 #include <kopano/memory.hpp>
 #include <kopano/scope.hpp>
 #include "WSMAPIFolderOps.h"
+#include "ECClientCache.h"
 #include <kopano/ECGuid.h>
 #include "SOAPSock.h"
 #include "SOAPUtils.h"
@@ -29,6 +30,18 @@
  */
 using namespace KC;
 
+/*
+ * Folder operations change more objects than they name (counters of both
+ * folders, all messages of an empty folder), so they drop the whole cache
+ * rather than wait for the notifications.
+ */
+static void forget_cached(WSTransport *t)
+{
+	auto cache = t->client_cache();
+	if (cache != nullptr)
+		cache->clear();
+}
+
 WSMAPIFolderOps::WSMAPIFolderOps(ECSESSIONID sid, ULONG cbEntryId,
     const ENTRYID *lpEntryId, WSTransport *lpTransport) :
 	ecSessionId(sid), m_lpTransport(lpTransport)
@@ -99,6 +112,7 @@ HRESULT WSMAPIFolderOps::HrCreateFolder(ULONG ulFolderType,
 			er = sResponse.er;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 
 	if(lpcbEntryId != NULL && lppEntryId != NULL)
 		hr = CopySOAPEntryIdToMAPIEntryId(&sResponse.sEntryId, lpcbEntryId, lppEntryId);
@@ -131,6 +145,7 @@ HRESULT WSMAPIFolderOps::create_folders(std::vector<WSFolder> &batch)
 			er = rsp.er;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 	if (rsp.entryids == nullptr || rsp.entryids->__size != batch.size())
 		return MAPI_E_CALL_FAILED;
 	return convert_soapfolders_to_wsfolder(rsp, batch);
@@ -155,6 +170,7 @@ HRESULT WSMAPIFolderOps::HrDeleteFolder(ULONG cbEntryId,
 			er = KCERR_NETWORK_ERROR;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 	return hrSuccess;
 }
 
@@ -171,6 +187,7 @@ HRESULT WSMAPIFolderOps::HrEmptyFolder(ULONG ulFlags, ULONG ulSyncId)
 			er = KCERR_NETWORK_ERROR;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 	return hrSuccess;
 }
 
@@ -198,6 +215,7 @@ HRESULT WSMAPIFolderOps::HrSetReadFlags(ENTRYLIST *lpMsgList, ULONG ulFlags, ULO
 			er = KCERR_NETWORK_ERROR;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 	return hrSuccess;
 }
 
@@ -300,6 +318,7 @@ HRESULT WSMAPIFolderOps::HrCopyFolder(ULONG cbEntryFrom,
 			er = KCERR_NETWORK_ERROR;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 	return hrSuccess;
 }
 
@@ -329,6 +348,7 @@ HRESULT WSMAPIFolderOps::HrCopyMessage(ENTRYLIST *lpMsgList, ULONG cbEntryDest,
 			er = KCERR_NETWORK_ERROR;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 	return hrSuccess;
 }
 
@@ -384,6 +404,7 @@ HRESULT WSMAPIFolderOps::HrSetMessageStatus(ULONG cbEntryID,
 			er = sMessageStatus.er;
 	}
 	END_SOAP_CALL
+	forget_cached(m_lpTransport);
 
 	if(lpulOldStatus)
 		*lpulOldStatus = sMessageStatus.ulMessageStatus;
@@ -8,6 +8,8 @@
 #include <kopano/platform.h>
 #include <kopano/scope.hpp>
 #include "WSMAPIPropStorage.h"
+#include "WSCompound.h"
+#include "ECClientCache.h"
 #include <kopano/ECGuid.h>
 #include "SOAPSock.h"
 #include "SOAPUtils.h"
@@ -493,6 +495,11 @@ HRESULT WSMAPIPropStorage::HrSaveObject(ULONG ulFlags, MAPIOBJECT *lpsMapiObject
 	}
 	END_SOAP_CALL
 
+	auto cache = m_lpTransport->client_cache();
+	if (cache != nullptr) {
+		cache->invalidate(ECClientCache::key(m_sEntryId.__size, m_sEntryId.__ptr));
+		cache->invalidate(ECClientCache::key(m_sParentEntryId.__size, m_sParentEntryId.__ptr));
+	}
 	// Update our copy of the object with the IDs and mod props from the server
 	return HrUpdateMapiObject(lpsMapiObject, &sResponse.sSaveObject);
 	// HrUpdateMapiObject() has now moved the modified properties of all objects recursively
@@ -590,6 +597,43 @@ HRESULT WSMAPIPropStorage::HrLoadObject(MAPIOBJECT **lppsMapiObject)
 		assert(false);
 		return MAPI_E_INVALID_PARAMETER;
 	}
+	auto cache = m_ulFlags == 0 ? m_lpTransport->client_cache() : nullptr;
+	std::string cache_key;
+	uint64_t cache_gen = 0;
+	if (cache != nullptr) {
+		cache_key = ECClientCache::key(m_sEntryId.__size, m_sEntryId.__ptr);
+		cache_gen = cache->generation();
+	}
+	std::unique_ptr<MAPIOBJECT> mo(std::move(m_preload));
+	bool cached = m_preload_cached;
+	m_preload_cached = false;
+	if (mo != nullptr && cache != nullptr && !cached) {
+		cache->put(cache_key, *mo, m_preload_gen);
+	} else if (mo == nullptr && cache != nullptr && cache->contains(cache_key)) {
+		/*
+		 * Rights can change without a notification, so the server
+		 * still checks access; only the object data is saved.
+		 */
+		hr = m_lpTransport->HrCheckExistObject(m_sEntryId.__size,
+		     reinterpret_cast<const ENTRYID *>(m_sEntryId.__ptr), CHECKEXIST_ACCESS);
+		if (hr != hrSuccess)
+			return hr;
+		mo.reset(cache->get(cache_key));
+		cached = mo != nullptr;
+	}
+	if (mo != nullptr) {
+		if (cached)
+			cache->saved_call();
+		/* Preloads and cached objects come without subscription; an Advise since then needs one */
+		if (m_ulConnection != 0 && !m_bSubscribed) {
+			hr = m_lpTransport->HrSubscribe(m_sEntryId.__size, m_sEntryId.__ptr, m_ulConnection, m_ulEventMask);
+			if (hr != hrSuccess)
+				return hr;
+			m_bSubscribed = true;
+		}
+		*lppsMapiObject = mo.release();
+		return hrSuccess;
+	}
 
 	soap_lock_guard spg(*m_lpTransport);
 	struct loadObjectResponse sResponse;
@@ -613,11 +657,53 @@ HRESULT WSMAPIPropStorage::HrLoadObject(MAPIOBJECT **lppsMapiObject)
 		return hr;
 	lpsMapiObject = new MAPIOBJECT; /* ulObjType, ulObjId and ulUniqueId are unknown here */
 	ECSoapObjectToMapiObject(&sResponse.sSaveObject, lpsMapiObject);
+	if (cache != nullptr)
+		cache->put(cache_key, *lpsMapiObject, cache_gen);
 	*lppsMapiObject = lpsMapiObject;
 	m_bSubscribed = m_ulConnection != 0;
 	return hrSuccess;
 }
 
+/*
+ * Queues the loadObject that HrLoadObject would make on @c, so that it
+ * can share the round trip with other calls (e.g. the checkExistObject of
+ * OpenEntry). The next HrLoadObject returns the result.
+ */
+HRESULT WSMAPIPropStorage::HrPreload(WSCompound &c)
+{
+	auto cache = m_ulFlags == 0 ? m_lpTransport->client_cache() : nullptr;
+	if (cache != nullptr)
+		m_preload_gen = cache->generation();
+	auto cache_key = cache != nullptr ? ECClientCache::key(m_sEntryId.__size, m_sEntryId.__ptr) : std::string();
+	if (cache != nullptr && cache->contains(cache_key)) {
+		/* Cached: only the access check goes to the server */
+		c.check_exist(m_sEntryId, CHECKEXIST_ACCESS,
+			[this, cache, cache_key](const struct compound_result &r) {
+				auto hr = kcerr_to_mapierr(r.er, MAPI_E_NOT_FOUND);
+				if (hr != hrSuccess)
+					return hr;
+				m_preload.reset(cache->get(cache_key));
+				m_preload_cached = m_preload != nullptr;
+				return hrSuccess;
+			});
+		return hrSuccess;
+	}
+	c.load_object(m_sEntryId, nullptr, m_ulFlags | 0x80000000,
+		[this](const struct compound_result &r) {
+			auto hr = kcerr_to_mapierr(r.er, MAPI_E_NOT_FOUND);
+			if (hr == MAPI_E_UNABLE_TO_COMPLETE) /* Store does not exist on this server */
+				hr = MAPI_E_UNCONFIGURED;
+			if (hr != hrSuccess)
+				return hr;
+			if (r.object == nullptr)
+				return MAPI_E_CALL_FAILED;
+			m_preload.reset(new MAPIOBJECT);
+			ECSoapObjectToMapiObject(r.object, m_preload.get());
+			return hrSuccess;
+		});
+	return hrSuccess;
+}
+
 HRESULT WSMAPIPropStorage::HrSetSyncId(ULONG ulSyncId) {
 	m_ulSyncId = ulSyncId;
 	return hrSuccess;
@@ -628,24 +714,3 @@ HRESULT WSMAPIPropStorage::Reload(void *lpParam, ECSESSIONID sessionId) {
 	static_cast<WSMAPIPropStorage *>(lpParam)->ecSessionId = sessionId;
 	return hrSuccess;
 }
-
-MAPIOBJECT::MAPIOBJECT(const MAPIOBJECT &s) :
-	lstDeleted(s.lstDeleted), lstAvailable(s.lstAvailable),
-	lstModified(s.lstModified), lstProperties(s.lstProperties),
-	bChangedInstance(s.bChangedInstance), bChanged(s.bChanged),
-	bDelete(s.bDelete), ulUniqueId(s.ulUniqueId), ulObjId(s.ulObjId),
-	ulObjType(s.ulObjType)
-{
-	KC::Util::HrCopyEntryId(s.cbInstanceID, reinterpret_cast<const ENTRYID *>(s.lpInstanceID),
-		&cbInstanceID, reinterpret_cast<ENTRYID **>(&lpInstanceID));
-	for (const auto &i : s.lstChildren)
-		lstChildren.emplace(new MAPIOBJECT(*i));
-}
-
-MAPIOBJECT::~MAPIOBJECT()
-{
-	for (auto &obj : lstChildren)
-		delete obj;
-	if (lpInstanceID != nullptr)
-		MAPIFreeBuffer(lpInstanceID);
-}
@@ -3,6 +3,7 @@
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
 #pragma once
+#include <memory>
 #include <kopano/ECUnknown.h>
 #include <kopano/Util.h>
 #include "IECPropStorage.h"
@@ -15,6 +16,8 @@
 #include "ECABContainer.h"
 #include "WSTableView.h"
 
+class WSCompound;
+
 class WSABPropStorage KC_FINAL_OPG :
     public KC::ECUnknown, public IECPropStorage {
 	protected:
@@ -69,6 +72,9 @@ public:
 
 	virtual HRESULT GetEntryIDByRef(ULONG *lpcbEntryID, LPENTRYID *lppEntryID);
 
+	// Queue the loadObject of HrLoadObject on a compound call
+	HRESULT HrPreload(WSCompound &);
+
 private:
 	// Get a single (large) property
 	virtual HRESULT HrLoadProp(ULONG obj_id, ULONG proptag, SPropValue **) override;
@@ -100,5 +106,8 @@ private:
 	unsigned int m_ulFlags, m_ulSessionReloadCallback;
 	KC::object_ptr<WSTransport> m_lpTransport;
 	bool m_bSubscribed = false;
+	std::unique_ptr<MAPIOBJECT> m_preload; /* from HrPreload, for the next HrLoadObject */
+	uint64_t m_preload_gen = 0; /* ECClientCache::generation() before the preload */
+	bool m_preload_cached = false; /* m_preload is a copy from the cache */
 	ALLOC_WRAP_FRIEND;
 };
@@ -18,6 +18,7 @@
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 #include <cerrno>
 #include <json/reader.h>
 #include <kopano/ECLogger.h>
@@ -119,6 +120,7 @@ HRESULT WSTransport::HrClone(WSTransport **lppTransport)
 		return hr;
 	lpTransport->m_ecSessionId = m_ecSessionId;
 	lpTransport->m_ecSessionGroupId = m_ecSessionGroupId;
+	lpTransport->m_client_cache = m_client_cache;
 	*lppTransport = lpTransport;
 	return hrSuccess;
 }
@@ -196,6 +198,8 @@ HRESULT WSTransport::HrLogon2(const struct sGlobalProfileProps &sProfileProps)
 
 	if (sizeof(ECSESSIONID) == 8)
 		ulCapabilities |= KOPANO_CAP_LARGE_SESSIONID;
+	if (!(sProfileProps.ulProfileFlags & EC_PROFILE_FLAGS_NO_BINARY_RPC))
+		ulCapabilities |= KOPANO_CAP_BINARY_RPC;
 	if (!bPipeConnection) {
 		/*
 		 * All connections except pipes request compression. The server
@@ -308,6 +312,8 @@ HRESULT WSTransport::PostAuth(KCmdProxy *lpCmd, std::unique_ptr<KCmdProxy2> &&ne
 	m_has_session = true;
 	if (new_cmd != nullptr)
 		m_lpCmd = std::move(new_cmd);
+	if (m_lpCmd != nullptr)
+		m_lpCmd->binary_rpc = ulServerCapabilities & KOPANO_CAP_BINARY_RPC;
 	return hrSuccess;
 }
 
@@ -727,7 +733,7 @@ HRESULT WSTransport::HrCheckExistObject(ULONG cbEntryID,
 
 HRESULT WSTransport::HrOpenPropStorage(ULONG cbParentEntryID,
     const ENTRYID *lpParentEntryID, ULONG cbEntryID, const ENTRYID *lpEntryID,
-    ULONG ulFlags, IECPropStorage **lppPropStorage)
+    ULONG ulFlags, IECPropStorage **lppPropStorage, WSCompound *lpPreload)
 {
 	object_ptr<WSMAPIPropStorage> lpPropStorage;
 	memory_ptr<ENTRYID> lpUnWrapParentID, lpUnWrapEntryID;
@@ -746,6 +752,9 @@ HRESULT WSTransport::HrOpenPropStorage(ULONG cbParentEntryID,
 	     m_ulServerCapabilities, this, &~lpPropStorage);
 	if(hr != hrSuccess)
 		return hr;
+	/* The object gets loaded by @lpPreload's execute, together with other calls */
+	if (lpPreload != nullptr)
+		lpPropStorage->HrPreload(*lpPreload);
 	return lpPropStorage->QueryInterface(IID_IECPropStorage, reinterpret_cast<void **>(lppPropStorage));
 }
 
@@ -1476,6 +1485,83 @@ HRESULT WSTransport::HrAbortSubmit(ULONG cbEntryID, const ENTRYID *lpEntryID)
 	return hrSuccess;
 }
 
+/**
+ * Has the server copy the message @lpTemplateID into the folders given in
+ * @lpCopies, in one call. Every copy gets its own result in hResult; the
+ * entryids of the copies are allocated onto @lpCopies.
+ */
+HRESULT WSTransport::HrDeliverCopies(unsigned int cbTemplateID,
+    const ENTRYID *lpTemplateID, unsigned int cCopies, ECDELIVERCOPY *lpCopies)
+{
+	ECRESULT er = erSuccess;
+	entryId sTemplateId; // Do not free
+	struct rowSet *lpsRows = nullptr;
+	std::vector<deliver_copy> copies(cCopies);
+	struct deliver_copies_response sResponse;
+	auto cleanup = make_scope_exit([&]() { soap_del_PointerTorowSet(&lpsRows); });
+
+	auto hr = CopyMAPIEntryIdToSOAPEntryId(cbTemplateID, lpTemplateID, &sTemplateId, true);
+	if (hr != hrSuccess)
+		return hr;
+	/* The properties of the copies are converted as the rows of a rowset */
+	/* The rows only borrow the properties; plain buffer, no FreeProws */
+	memory_ptr<SRowSet> lpRows;
+	hr = MAPIAllocateBuffer(CbNewSRowSet(cCopies), &~lpRows);
+	if (hr != hrSuccess)
+		return hr;
+	for (unsigned int i = 0; i < cCopies; ++i) {
+		lpRows->aRow[i].cValues = lpCopies[i].cValues;
+		lpRows->aRow[i].lpProps = lpCopies[i].lpProps;
+	}
+	lpRows->cRows = cCopies;
+	hr = CopyMAPIRowSetToSOAPRowSet(lpRows, &lpsRows);
+	if (hr != hrSuccess)
+		return hr;
+
+	for (unsigned int i = 0; i < cCopies; ++i) {
+		auto &c = copies[i];
+		hr = CopyMAPIEntryIdToSOAPEntryId(lpCopies[i].sFolderId.cb,
+		     reinterpret_cast<const ENTRYID *>(lpCopies[i].sFolderId.lpb), &c.folder_eid, true);
+		if (hr != hrSuccess)
+			return hr;
+		c.props = lpsRows->__ptr[i];
+		if (lpCopies[i].lpDelProps != nullptr) {
+			c.del_props.__ptr  = const_cast<unsigned int *>(reinterpret_cast<const unsigned int *>(lpCopies[i].lpDelProps->aulPropTag)); // just a reference
+			c.del_props.__size = lpCopies[i].lpDelProps->cValues;
+		}
+	}
+	struct deliver_copy_set batch;
+	batch.__size = copies.size();
+	batch.__ptr  = copies.data();
+
+	soap_lock_guard spg(*this);
+	START_SOAP_CALL
+	{
+		if (m_lpCmd->deliver_copies(m_ecSessionId, sTemplateId, batch, &sResponse) != SOAP_OK)
+			er = KCERR_NETWORK_ERROR;
+		else
+			er = sResponse.er;
+	}
+	END_SOAP_CALL
+	if (sResponse.results.__size != static_cast<int>(cCopies) ||
+	    sResponse.entryids == nullptr || sResponse.entryids->__size != static_cast<int>(cCopies))
+		return MAPI_E_CALL_FAILED;
+
+	for (unsigned int i = 0; i < cCopies; ++i) {
+		auto &c = lpCopies[i];
+		c.sEntryId.cb  = 0;
+		c.sEntryId.lpb = nullptr;
+		c.hResult = kcerr_to_mapierr(sResponse.results.__ptr[i], MAPI_E_CALL_FAILED);
+		if (c.hResult != hrSuccess)
+			continue;
+		hr = CopySOAPEntryIdToMAPIEntryId(&sResponse.entryids->__ptr[i],
+		     &c.sEntryId.cb, reinterpret_cast<ENTRYID **>(&c.sEntryId.lpb), lpCopies);
+		if (hr != hrSuccess)
+			return hr;
+	}
+	return hrSuccess;
+}
+
 HRESULT WSTransport::HrResolveUserStore(const utf8string &strUserName, ULONG ulFlags, ULONG *lpulUserID, ULONG* lpcbStoreID, LPENTRYID* lppStoreID, std::string *lpstrRedirServer)
 {
 	if (strUserName.empty())
@@ -3815,6 +3901,52 @@ exit:
 	return hr;
 }
 
+/*
+ * One long poll for the session groups of several sessions (of the same
+ * server). Only the sessions that had something to say are in @out.
+ */
+HRESULT WSTransport::HrGetNotifyMulti(const std::vector<ECSESSIONID> &sessions,
+    std::vector<notify_group_result> &out)
+{
+	soap_lock_guard spg(*this);
+	std::vector<ULONG64> ids(sessions.cbegin(), sessions.cend());
+	struct notifySessionArray req;
+	struct notifyMultiResponse rsp;
+	ECRESULT er = erSuccess;
+
+	if (m_lpCmd == nullptr)
+		return MAPI_E_NETWORK_ERROR;
+	req.__size = ids.size();
+	req.__ptr  = ids.data();
+	if (m_lpCmd->notifyGetItemsMulti(req, &rsp) != SOAP_OK)
+		er = KCERR_NETWORK_ERROR;
+	else
+		er = rsp.er;
+	auto hr = kcerr_to_mapierr(er);
+	if (hr != hrSuccess)
+		return hr;
+
+	out.clear();
+	out.reserve(rsp.sGroups.__size);
+	for (gsoap_size_t i = 0; i < rsp.sGroups.__size; ++i) {
+		const auto &g = rsp.sGroups.__ptr[i];
+		notify_group_result r = {g.ulSessionId, kcerr_to_mapierr(g.er), nullptr};
+		if (g.pNotificationArray != nullptr) {
+			r.items = soap_new_notificationArray(nullptr);
+			CopyNotificationArrayStruct(g.pNotificationArray, r.items);
+		}
+		out.emplace_back(r);
+	}
+	return hrSuccess;
+}
+
+void WSTransport::close_socket()
+{
+	soap_lock_guard spg(*this);
+	if (m_lpCmd != nullptr && m_lpCmd->soap != nullptr)
+		soap_force_closesock(m_lpCmd->soap);
+}
+
 std::string WSTransport::GetAppName()
 {
 	if (!m_strAppName.empty())
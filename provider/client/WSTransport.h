@@ -6,9 +6,11 @@
 #include <mapi.h>
 #include <mapispi.h>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 #include "kcore.hpp"
 #include "ECMAPIProp.h"
 #include <kopano/kcodes.h>
@@ -26,12 +28,23 @@ namespace KC {
 class utf8string;
 }
 
+class ECClientCache;
+class ECNotifyMux;
 class KCmdProxy2;
+class WSCompound;
 class WSMessageStreamExporter;
 class WSMessageStreamImporter;
 
 typedef HRESULT (*SESSIONRELOADCALLBACK)(void *parm, KC::ECSESSIONID new_id);
 
+/* What HrGetNotifyMulti got for one of the sessions */
+struct notify_group_result {
+	KC::ECSESSIONID session;
+	HRESULT hr;
+	/* as from HrGetNotify; freed by the caller */
+	struct notificationArray *items;
+};
+
 class ResolveResult final : public KC::CacheEntry {
 public:
 	HRESULT	hr;
@@ -77,7 +90,7 @@ public:
 	HRESULT HrCheckExistObject(unsigned int eid_size, const ENTRYID *eid, unsigned int flags);
 
 	// Interface to get/set properties
-	HRESULT HrOpenPropStorage(unsigned int parent_eid_size, const ENTRYID *parent, unsigned int eid_size, const ENTRYID *eid, unsigned int flags, IECPropStorage **);
+	HRESULT HrOpenPropStorage(unsigned int parent_eid_size, const ENTRYID *parent, unsigned int eid_size, const ENTRYID *eid, unsigned int flags, IECPropStorage **, WSCompound *preload = nullptr);
 	HRESULT HrOpenParentStorage(ECGenericProp *parent, unsigned int unique_id, unsigned int obj_id, IECPropStorage *srv_storage, IECPropStorage **prop_storage);
 	HRESULT HrOpenABPropStorage(unsigned int eid_size, const ENTRYID *eid, IECPropStorage **);
 
@@ -123,6 +136,7 @@ public:
 	// Outgoing Queue Finished message
 	HRESULT HrFinishedMessage(unsigned int eid_size, const ENTRYID *, unsigned int flags);
 	HRESULT HrAbortSubmit(unsigned int eid_size, const ENTRYID *);
+	HRESULT HrDeliverCopies(unsigned int tmpl_size, const ENTRYID *tmpl, unsigned int count, ECDELIVERCOPY *copies);
 
 	// Get user information
 	HRESULT HrResolveUserStore(const KC::utf8string &username, unsigned int flags, unsigned int *user_id, unsigned int *eid_size, ENTRYID **store_eid, std::string *redir_srv = nullptr);
@@ -229,6 +243,10 @@ public:
 	/* Get profile properties (connect info) */
 	const sGlobalProfileProps &GetProfileProps() const;
 
+	/* Object cache of the session group, if the profile enables it */
+	void set_client_cache(std::shared_ptr<ECClientCache> c) { m_client_cache = std::move(c); }
+	ECClientCache *client_cache() const { return m_client_cache.get(); }
+
 	/* Get the server GUID obtained at logon */
 	HRESULT GetServerGUID(GUID *) const;
 
@@ -238,7 +256,10 @@ public:
 
 	/* notifications */
 	HRESULT HrGetNotify(struct notificationArray **out);
+	HRESULT HrGetNotifyMulti(const std::vector<KC::ECSESSIONID> &, std::vector<notify_group_result> &out);
 	HRESULT HrCancelIO();
+	/* Drops the idle connection; the next call opens a new one */
+	void close_socket();
 
 	HRESULT HrResetFolderCount(unsigned int eid_size, const ENTRYID *eid, unsigned int *nupdates);
 
@@ -262,6 +283,7 @@ protected:
 	sGlobalProfileProps m_sProfileProps;
 	std::string		m_strAppName;
 	GUID			m_sServerGuid;
+	std::shared_ptr<ECClientCache> m_client_cache;
 
 private:
 	std::recursive_mutex m_ResolveResultCacheMutex;
@@ -270,5 +292,7 @@ private:
 
 friend class WSMessageStreamExporter;
 friend class WSMessageStreamImporter;
+friend class WSCompound;
+friend class ECNotifyMux;
 	ALLOC_WRAP_FRIEND;
 };
@@ -0,0 +1,550 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <arpa/inet.h>
+#include <kopano/scope.hpp>
+#include <mapidefs.h>
+#include <edkmdb.h>
+#include "BinaryRPC.h"
+#include "SOAPUtils.h"
+
+namespace KC {
+
+ECRESULT ECBinarySerializer::SetBuffer(void *lpBuffer)
+{
+	m_out = static_cast<std::string *>(lpBuffer);
+	return erSuccess;
+}
+
+void ECBinarySerializer::SetInput(const void *data, size_t len)
+{
+	m_in = static_cast<const unsigned char *>(data);
+	m_end = m_in + len;
+}
+
+ECRESULT ECBinarySerializer::Write(const void *ptr, size_t size, size_t nmemb)
+{
+	if (ptr == nullptr || m_out == nullptr)
+		return KCERR_INVALID_PARAMETER;
+	auto p = static_cast<const char *>(ptr);
+	switch (size) {
+	case 1:
+		m_out->append(p, nmemb);
+		break;
+	case 2:
+		for (size_t x = 0; x < nmemb; ++x) {
+			uint16_t v;
+			memcpy(&v, p + 2 * x, sizeof(v));
+			v = htons(v);
+			m_out->append(reinterpret_cast<const char *>(&v), sizeof(v));
+		}
+		break;
+	case 4:
+		for (size_t x = 0; x < nmemb; ++x) {
+			uint32_t v;
+			memcpy(&v, p + 4 * x, sizeof(v));
+			v = cpu_to_be32(v);
+			m_out->append(reinterpret_cast<const char *>(&v), sizeof(v));
+		}
+		break;
+	case 8:
+		for (size_t x = 0; x < nmemb; ++x) {
+			uint64_t v;
+			memcpy(&v, p + 8 * x, sizeof(v));
+			v = cpu_to_be64(v);
+			m_out->append(reinterpret_cast<const char *>(&v), sizeof(v));
+		}
+		break;
+	default:
+		return KCERR_INVALID_PARAMETER;
+	}
+	m_written += size * nmemb;
+	return erSuccess;
+}
+
+ECRESULT ECBinarySerializer::Read(void *ptr, size_t size, size_t nmemb)
+{
+	if (ptr == nullptr)
+		return KCERR_INVALID_PARAMETER;
+	if (size != 1 && size != 2 && size != 4 && size != 8)
+		return KCERR_INVALID_PARAMETER;
+	if (nmemb > remaining() / size)
+		return KCERR_CALL_FAILED;
+	auto p = static_cast<char *>(ptr);
+	memcpy(p, m_in, size * nmemb);
+	m_in += size * nmemb;
+	m_read += size * nmemb;
+	for (size_t x = 0; x < nmemb && size > 1; ++x) {
+		if (size == 2) {
+			uint16_t v;
+			memcpy(&v, p + 2 * x, sizeof(v));
+			v = ntohs(v);
+			memcpy(p + 2 * x, &v, sizeof(v));
+		} else if (size == 4) {
+			uint32_t v;
+			memcpy(&v, p + 4 * x, sizeof(v));
+			v = be32_to_cpu(v);
+			memcpy(p + 4 * x, &v, sizeof(v));
+		} else {
+			uint64_t v;
+			memcpy(&v, p + 8 * x, sizeof(v));
+			v = be64_to_cpu(v);
+			memcpy(p + 8 * x, &v, sizeof(v));
+		}
+	}
+	return erSuccess;
+}
+
+ECRESULT ECBinarySerializer::Skip(size_t size, size_t nmemb)
+{
+	if (size != 0 && nmemb > remaining() / size)
+		return KCERR_CALL_FAILED;
+	m_in += size * nmemb;
+	m_read += size * nmemb;
+	return erSuccess;
+}
+
+ECRESULT ECBinarySerializer::Stat(unsigned int *have_read, unsigned int *have_written)
+{
+	if (have_read != nullptr)
+		*have_read = m_read;
+	if (have_written != nullptr)
+		*have_written = m_written;
+	return erSuccess;
+}
+
+/*
+ * Counts and lengths come from the peer; an element takes at least one
+ * byte, so a count larger than what is left is bogus and must not be
+ * allocated for.
+ */
+static ECRESULT read_count(ECBinarySerializer *src, unsigned int *count)
+{
+	auto er = src->Read(count, sizeof(*count), 1);
+	if (er != erSuccess)
+		return er;
+	return *count > src->remaining() ? KCERR_CALL_FAILED : erSuccess;
+}
+
+static ECRESULT read_flag(ECBinarySerializer *src, bool *flag)
+{
+	unsigned char b = 0;
+	auto er = src->Read(&b, sizeof(b), 1);
+	if (er != erSuccess)
+		return er;
+	*flag = b != 0;
+	return erSuccess;
+}
+
+static ECRESULT write_flag(ECSerializer *sink, bool flag)
+{
+	unsigned char b = flag;
+	return sink->Write(&b, sizeof(b), 1);
+}
+
+/*
+ * Restrictions and rule actions, which only show up in a few properties
+ * of rules and search folders, are passed as the XML that gSOAP would have
+ * sent for them.
+ */
+static ECRESULT write_xml_prop(ECSerializer *sink, const struct propVal &pv)
+{
+	auto xmlsoap = std::make_unique<struct soap>();
+	auto laters = make_scope_success([&]() {
+		soap_destroy(xmlsoap.get());
+		soap_end(xmlsoap.get());
+	});
+	std::ostringstream xml;
+
+	soap_set_omode(xmlsoap.get(), SOAP_C_UTFSTRING);
+	soap_begin(xmlsoap.get());
+	xmlsoap->os = &xml;
+	soap_serialize_propVal(xmlsoap.get(), &pv);
+	if (soap_begin_send(xmlsoap.get()) != 0 ||
+	    soap_put_propVal(xmlsoap.get(), &pv, "propVal", nullptr) != 0 ||
+	    soap_end_send(xmlsoap.get()) != 0)
+		return KCERR_INVALID_PARAMETER;
+	auto s = xml.str();
+	unsigned int len = s.size();
+	auto er = sink->Write(&len, sizeof(len), 1);
+	if (er == erSuccess)
+		er = sink->Write(s.data(), 1, len);
+	return er;
+}
+
+static ECRESULT read_xml_prop(struct soap *soap, ECBinarySerializer *src, struct propVal *pv)
+{
+	unsigned int len;
+	auto er = read_count(src, &len);
+	if (er != erSuccess)
+		return er;
+	std::string s(len, '\0');
+	er = src->Read(&s[0], 1, len);
+	if (er != erSuccess)
+		return er;
+
+	std::istringstream xml(s);
+	auto xmlsoap = std::make_unique<struct soap>();
+	auto laters = make_scope_success([&]() {
+		soap_destroy(xmlsoap.get());
+		soap_end(xmlsoap.get());
+	});
+	struct propVal tmp;
+
+	xmlsoap->is = &xml;
+	soap_set_imode(xmlsoap.get(), SOAP_C_UTFSTRING);
+	soap_begin(xmlsoap.get());
+	if (soap_begin_recv(xmlsoap.get()) != 0 ||
+	    soap_get_propVal(xmlsoap.get(), &tmp, "propVal", nullptr) == nullptr ||
+	    soap_end_recv(xmlsoap.get()) != 0)
+		return KCERR_INVALID_PARAMETER;
+	/* into @soap, as xmlsoap's memory goes away */
+	return CopyPropVal(&tmp, pv, soap);
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct propVal &pv)
+{
+	auto er = sink->Write(&pv.ulPropTag, sizeof(pv.ulPropTag), 1);
+	if (er != erSuccess)
+		return er;
+	switch (PROP_TYPE(pv.ulPropTag)) {
+	case PT_NULL:
+	case PT_ERROR:
+		return sink->Write(&pv.Value.ul, sizeof(pv.Value.ul), 1);
+	case PT_SRESTRICTION:
+	case PT_ACTIONS:
+		return write_xml_prop(sink, pv);
+	default:
+		return SerializePropValData(pv, sink);
+	}
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct propVal *pv)
+{
+	auto er = src->Read(&pv->ulPropTag, sizeof(pv->ulPropTag), 1);
+	if (er != erSuccess)
+		return er;
+	switch (PROP_TYPE(pv->ulPropTag)) {
+	case PT_NULL:
+	case PT_ERROR:
+		pv->__union = SOAP_UNION_propValData_ul;
+		return src->Read(&pv->Value.ul, sizeof(pv->Value.ul), 1);
+	case PT_SRESTRICTION:
+	case PT_ACTIONS:
+		return read_xml_prop(soap, src, pv);
+	default:
+		return DeserializePropValData(soap, pv, src);
+	}
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct propValArray &a)
+{
+	auto er = sink->Write(&a.__size, sizeof(a.__size), 1);
+	for (gsoap_size_t i = 0; er == erSuccess && i < a.__size; ++i)
+		er = BinSerialize(sink, a.__ptr[i]);
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct propValArray *a)
+{
+	unsigned int n;
+	auto er = read_count(src, &n);
+	if (er != erSuccess)
+		return er;
+	a->__size = n;
+	a->__ptr = soap_new_propVal(soap, n);
+	for (unsigned int i = 0; er == erSuccess && i < n; ++i)
+		er = BinDeserialize(soap, src, &a->__ptr[i]);
+	return er;
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct propTagArray &a)
+{
+	auto er = sink->Write(&a.__size, sizeof(a.__size), 1);
+	if (er == erSuccess && a.__size > 0)
+		er = sink->Write(a.__ptr, sizeof(*a.__ptr), a.__size);
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct propTagArray *a)
+{
+	unsigned int n;
+	auto er = read_count(src, &n);
+	if (er != erSuccess)
+		return er;
+	a->__size = n;
+	a->__ptr = soap_new_unsignedInt(soap, n);
+	return n == 0 ? erSuccess : src->Read(a->__ptr, sizeof(*a->__ptr), n);
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct rowSet &rs)
+{
+	auto er = sink->Write(&rs.__size, sizeof(rs.__size), 1);
+	for (gsoap_size_t i = 0; er == erSuccess && i < rs.__size; ++i)
+		er = BinSerialize(sink, rs.__ptr[i]);
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct rowSet *rs)
+{
+	unsigned int n;
+	auto er = read_count(src, &n);
+	if (er != erSuccess)
+		return er;
+	rs->__size = n;
+	rs->__ptr = soap_new_propValArray(soap, n);
+	for (unsigned int i = 0; er == erSuccess && i < n; ++i)
+		er = BinDeserialize(soap, src, &rs->__ptr[i]);
+	return er;
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct xsd__base64Binary &b)
+{
+	auto er = sink->Write(&b.__size, sizeof(b.__size), 1);
+	if (er == erSuccess && b.__size > 0)
+		er = sink->Write(b.__ptr, 1, b.__size);
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct xsd__base64Binary *b)
+{
+	unsigned int n;
+	auto er = read_count(src, &n);
+	if (er != erSuccess)
+		return er;
+	b->__size = n;
+	b->__ptr = n == 0 ? nullptr : soap_new_unsignedByte(soap, n);
+	return n == 0 ? erSuccess : src->Read(b->__ptr, 1, n);
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct saveObject &so)
+{
+	auto er = sink->Write(&so.__size, sizeof(so.__size), 1);
+	if (er == erSuccess)
+		er = BinSerialize(sink, so.delProps);
+	if (er == erSuccess)
+		er = BinSerialize(sink, so.modProps);
+	if (er == erSuccess)
+		er = write_flag(sink, so.bDelete);
+	if (er == erSuccess)
+		er = sink->Write(&so.ulClientId, sizeof(so.ulClientId), 1);
+	if (er == erSuccess)
+		er = sink->Write(&so.ulServerId, sizeof(so.ulServerId), 1);
+	if (er == erSuccess)
+		er = sink->Write(&so.ulObjType, sizeof(so.ulObjType), 1);
+	if (er == erSuccess)
+		er = write_flag(sink, so.lpInstanceIds != nullptr);
+	if (er == erSuccess && so.lpInstanceIds != nullptr) {
+		er = sink->Write(&so.lpInstanceIds->__size, sizeof(so.lpInstanceIds->__size), 1);
+		for (gsoap_size_t i = 0; er == erSuccess && i < so.lpInstanceIds->__size; ++i)
+			er = BinSerialize(sink, so.lpInstanceIds->__ptr[i]);
+	}
+	for (gsoap_size_t i = 0; er == erSuccess && i < so.__size; ++i)
+		er = BinSerialize(sink, so.__ptr[i]);
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct saveObject *so)
+{
+	unsigned int nchildren, n;
+	bool has_ids = false;
+	auto er = read_count(src, &nchildren);
+	if (er == erSuccess)
+		er = BinDeserialize(soap, src, &so->delProps);
+	if (er == erSuccess)
+		er = BinDeserialize(soap, src, &so->modProps);
+	if (er == erSuccess)
+		er = read_flag(src, &so->bDelete);
+	if (er == erSuccess)
+		er = src->Read(&so->ulClientId, sizeof(so->ulClientId), 1);
+	if (er == erSuccess)
+		er = src->Read(&so->ulServerId, sizeof(so->ulServerId), 1);
+	if (er == erSuccess)
+		er = src->Read(&so->ulObjType, sizeof(so->ulObjType), 1);
+	if (er == erSuccess)
+		er = read_flag(src, &has_ids);
+	so->lpInstanceIds = nullptr;
+	if (er == erSuccess && has_ids) {
+		er = read_count(src, &n);
+		if (er != erSuccess)
+			return er;
+		so->lpInstanceIds = soap_new_entryList(soap);
+		so->lpInstanceIds->__size = n;
+		so->lpInstanceIds->__ptr = soap_new_entryId(soap, n);
+		for (unsigned int i = 0; er == erSuccess && i < n; ++i)
+			er = BinDeserialize(soap, src, &so->lpInstanceIds->__ptr[i]);
+	}
+	if (er != erSuccess)
+		return er;
+	so->__size = nchildren;
+	so->__ptr = nchildren == 0 ? nullptr : soap_new_saveObject(soap, nchildren);
+	for (unsigned int i = 0; er == erSuccess && i < nchildren; ++i)
+		er = BinDeserialize(soap, src, &so->__ptr[i]);
+	return er;
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct namedPropArray &a)
+{
+	auto er = sink->Write(&a.__size, sizeof(a.__size), 1);
+	for (gsoap_size_t i = 0; er == erSuccess && i < a.__size; ++i) {
+		const auto &np = a.__ptr[i];
+		unsigned char fields = (np.lpId != nullptr ? 1 : 0) |
+			(np.lpString != nullptr ? 2 : 0) | (np.lpguid != nullptr ? 4 : 0);
+		er = sink->Write(&fields, sizeof(fields), 1);
+		if (er == erSuccess && np.lpId != nullptr)
+			er = sink->Write(np.lpId, sizeof(*np.lpId), 1);
+		if (er == erSuccess && np.lpString != nullptr) {
+			unsigned int len = strlen(np.lpString);
+			er = sink->Write(&len, sizeof(len), 1);
+			if (er == erSuccess)
+				er = sink->Write(np.lpString, 1, len);
+		}
+		if (er == erSuccess && np.lpguid != nullptr)
+			er = BinSerialize(sink, *np.lpguid);
+	}
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct namedPropArray *a)
+{
+	unsigned int n, len;
+	auto er = read_count(src, &n);
+	if (er != erSuccess)
+		return er;
+	a->__size = n;
+	a->__ptr = soap_new_namedProp(soap, n);
+	for (unsigned int i = 0; er == erSuccess && i < n; ++i) {
+		auto &np = a->__ptr[i];
+		unsigned char fields;
+		np.lpId = nullptr;
+		np.lpString = nullptr;
+		np.lpguid = nullptr;
+		er = src->Read(&fields, sizeof(fields), 1);
+		if (er == erSuccess && (fields & 1)) {
+			np.lpId = soap_new_unsignedInt(soap);
+			er = src->Read(np.lpId, sizeof(*np.lpId), 1);
+		}
+		if (er == erSuccess && (fields & 2)) {
+			er = read_count(src, &len);
+			if (er != erSuccess)
+				break;
+			np.lpString = soap_new_byte(soap, len + 1);
+			er = src->Read(np.lpString, 1, len);
+		}
+		if (er == erSuccess && (fields & 4)) {
+			np.lpguid = soap_new_xsd__base64Binary(soap);
+			er = BinDeserialize(soap, src, np.lpguid);
+		}
+	}
+	return er;
+}
+
+ECRESULT BinSerialize(ECSerializer *sink, const struct notifySubscribe *ns)
+{
+	auto er = write_flag(sink, ns != nullptr);
+	if (er != erSuccess || ns == nullptr)
+		return er;
+	er = sink->Write(&ns->ulConnection, sizeof(ns->ulConnection), 1);
+	if (er == erSuccess)
+		er = BinSerialize(sink, ns->sKey);
+	if (er == erSuccess)
+		er = sink->Write(&ns->ulEventMask, sizeof(ns->ulEventMask), 1);
+	if (er == erSuccess)
+		er = sink->Write(&ns->sSyncState.ulSyncId, sizeof(ns->sSyncState.ulSyncId), 1);
+	if (er == erSuccess)
+		er = sink->Write(&ns->sSyncState.ulChangeId, sizeof(ns->sSyncState.ulChangeId), 1);
+	return er;
+}
+
+ECRESULT BinDeserialize(struct soap *soap, ECBinarySerializer *src, struct notifySubscribe **pns)
+{
+	bool present = false;
+	auto er = read_flag(src, &present);
+	*pns = nullptr;
+	if (er != erSuccess || !present)
+		return er;
+	auto ns = soap_new_notifySubscribe(soap);
+	er = src->Read(&ns->ulConnection, sizeof(ns->ulConnection), 1);
+	if (er == erSuccess)
+		er = BinDeserialize(soap, src, &ns->sKey);
+	if (er == erSuccess)
+		er = src->Read(&ns->ulEventMask, sizeof(ns->ulEventMask), 1);
+	if (er == erSuccess)
+		er = src->Read(&ns->sSyncState.ulSyncId, sizeof(ns->sSyncState.ulSyncId), 1);
+	if (er == erSuccess)
+		er = src->Read(&ns->sSyncState.ulChangeId, sizeof(ns->sSyncState.ulChangeId), 1);
+	*pns = ns;
+	return er;
+}
+
+/*
+ * The body goes out in one piece with a Content-Length (SOAP_IO_STORE),
+ * never compressed: the encoding is compact already, and zlib would cost
+ * more CPU than the XML it replaces. Nor as MIME, which enhanced ICS may
+ * have turned on for the connection.
+ */
+static inline soap_mode binrpc_omode(soap_mode omode)
+{
+	return (omode & ~(SOAP_IO | SOAP_ENC_ZLIB | SOAP_ENC_MTOM |
+	       SOAP_ENC_MIME | SOAP_ENC_DIME)) | SOAP_IO_STORE;
+}
+
+int BinRPCCall(struct soap *soap, const char *endpoint, const std::string &req,
+    ECBinarySerializer &rsp)
+{
+	auto omode = soap->omode;
+	soap_begin(soap);
+	soap->omode = binrpc_omode(omode);
+	soap->http_content = KC_BINRPC_CONTENT_TYPE;
+	auto err = soap_connect_command(soap, SOAP_POST_FILE, endpoint, nullptr);
+	if (err == SOAP_OK)
+		err = soap_send_raw(soap, req.data(), req.size());
+	if (err == SOAP_OK)
+		err = soap_end_send(soap);
+	soap->omode = omode;
+	soap->http_content = nullptr;
+	if (err != SOAP_OK)
+		return soap_closesock(soap);
+
+	size_t len = 0;
+	if (soap_begin_recv(soap) != SOAP_OK)
+		return soap_closesock(soap);
+	auto body = soap_http_get_body(soap, &len);
+	if (body == nullptr || soap_end_recv(soap) != SOAP_OK)
+		return soap_closesock(soap);
+	rsp.SetInput(body, len);
+	return soap_closesock(soap);
+}
+
+int BinRPCRecv(struct soap *soap, ECBinarySerializer &req)
+{
+	size_t len = 0;
+	auto body = soap_http_get_body(soap, &len);
+	if (body == nullptr || soap_end_recv(soap) != SOAP_OK)
+		return soap->error != SOAP_OK ? soap->error : (soap->error = SOAP_EOF);
+	req.SetInput(body, len);
+	return SOAP_OK;
+}
+
+int BinRPCReply(struct soap *soap, const std::string &rsp)
+{
+	auto omode = soap->omode;
+	soap->omode = binrpc_omode(omode);
+	soap->http_content = KC_BINRPC_CONTENT_TYPE;
+	auto err = soap_response(soap, SOAP_FILE);
+	if (err == SOAP_OK)
+		err = soap_send_raw(soap, rsp.data(), rsp.size());
+	if (err == SOAP_OK)
+		err = soap_end_send(soap);
+	soap->omode = omode;
+	soap->http_content = nullptr;
+	return soap_closesock(soap);
+}
+
+} /* namespace */
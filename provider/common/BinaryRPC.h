@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <string>
+#include <cstdint>
+#include <kopano/zcdefs.h>
+#include <kopano/kcodes.h>
+#include <ECSerializer.h>
+#include "soapH.h"
+
+/*
+ * Binary RPC
+ *
+ * A client and server that both announce KOPANO_CAP_BINARY_RPC at logon
+ * make the hottest calls (tableQueryRows, loadObject, getIDsFromNames)
+ * without XML. The call is still an HTTP POST on the same connection, only
+ * with a body of KC_BINRPC_CONTENT_TYPE instead of a SOAP envelope:
+ *
+ *	request:  <magic>:32 <op>:32 <session>:64 <arguments>
+ *	response: <magic>:32 <er>:32 <results>
+ *
+ * The arguments and results are the fields of the SOAP structs in order,
+ * with integers in network byte order, strings and binaries prefixed by
+ * their length, arrays by their count, optional fields by a byte that says
+ * if they are there. Properties are encoded as in ICS streams (StreamUtil),
+ * except that tags are passed as they are. The server runs the very same
+ * KCmdService handler as for SOAP, so only the (de)serialization differs.
+ */
+
+#define KC_BINRPC_CONTENT_TYPE "application/x-kopano-binrpc"
+#define KC_BINRPC_MAGIC 0x4B425231 /* "KBR1" */
+
+namespace KC {
+
+enum binrpc_op {
+	BINRPC_TABLEQUERYROWS = 1,
+	BINRPC_LOADOBJECT,
+	BINRPC_GETIDSFROMNAMES,
+};
+
+/*
+ * Serializer that appends to a string or reads from memory, in network
+ * byte order like ECStreamSerializer.
+ */
+class ECBinarySerializer final : public ECSerializer {
+	public:
+	ECBinarySerializer(std::string *out = nullptr) : m_out(out) {}
+	/* @lpBuffer is a std::string * to write to */
+	virtual ECRESULT SetBuffer(void *lpBuffer) override;
+	/* Reads from [@data, @data+@len) */
+	void SetInput(const void *data, size_t len);
+	virtual ECRESULT Write(const void *ptr, size_t size, size_t nmemb) override;
+	virtual ECRESULT Read(void *ptr, size_t size, size_t nmemb) override;
+	virtual ECRESULT Skip(size_t size, size_t nmemb) override;
+	virtual ECRESULT Flush() override { return erSuccess; }
+	virtual ECRESULT Stat(unsigned int *have_read, unsigned int *have_written) override;
+	size_t remaining() const { return m_end - m_in; }
+
+	private:
+	std::string *m_out;
+	const unsigned char *m_in = nullptr, *m_end = nullptr;
+	size_t m_read = 0, m_written = 0;
+};
+
+extern ECRESULT BinSerialize(ECSerializer *, const struct propVal &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct propValArray &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct propTagArray &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct rowSet &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct xsd__base64Binary &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct saveObject &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct namedPropArray &);
+extern ECRESULT BinSerialize(ECSerializer *, const struct notifySubscribe *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct propVal *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct propValArray *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct propTagArray *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct rowSet *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct xsd__base64Binary *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct saveObject *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct namedPropArray *);
+extern ECRESULT BinDeserialize(struct soap *, ECBinarySerializer *, struct notifySubscribe **);
+
+/*
+ * Client side: POSTs @req to @endpoint and points @rsp at the response
+ * body, which lives in @soap until soap_end(). Returns a SOAP error code.
+ */
+extern int BinRPCCall(struct soap *, const char *endpoint, const std::string &req, ECBinarySerializer &rsp);
+/* Server side: the body of a request whose headers soap_begin_recv read */
+extern int BinRPCRecv(struct soap *, ECBinarySerializer &req);
+extern int BinRPCReply(struct soap *, const std::string &rsp);
+
+} /* namespace */
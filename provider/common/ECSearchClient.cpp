@@ -2,7 +2,9 @@
  * SPDX-License-Identifier: AGPL-3.0-only
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
+#include <chrono>
 #include <list>
+#include <new>
 #include <set>
 #include <string>
 #include <utility>
@@ -40,85 +42,21 @@ ECRESULT ECSearchClient::GetProperties(setindexprops_t &setProps)
 	return erSuccess;
 }
 
-/**
- * Output SCOPE command
- *
- * Specifies the scope of the search.
- *
- * @param strServer[in] Server GUID to search in
- * @param strStore[in] Store GUID to search in
- * @param lstFolders[in] List of folders to search in. As a special case, no folders means 'all folders'
- * @return result
- */
-ECRESULT ECSearchClient::Scope(const std::string &strServer,
-    const std::string &strStore, const std::list<unsigned int> &lstFolders)
-{
-	std::vector<std::string> lstResponse;
-	auto er = Connect();
-	if (er != erSuccess)
-		return er;
-	auto strScope = "SCOPE " + strServer + " " + strStore + " " + kc_join(lstFolders, " ", stringify);
-	er = DoCmd(strScope, lstResponse);
-	if (er != erSuccess)
-		return er;
-	if (!lstResponse.empty())
-		return KCERR_BAD_VALUE;
-	return erSuccess;
-}
-
-/**
- * Output FIND command
- *
- * The FIND command specifies which term to look for in which fields. When multiple
- * FIND commands are issued, items must match ALL of the terms.
- *
- * @param setFields[in] Fields to match (may match any of these fields)
- * @param strTerm[in] Term to match (utf-8 encoded)
- * @return result
- */
-ECRESULT ECSearchClient::Find(const std::set<unsigned int> &setFields,
-    const std::string &strTerm)
-{
-	std::vector<std::string> lstResponse;
-	auto strFind = "FIND " + kc_join(setFields, " ", stringify) + ":" + strTerm;
-	auto er = DoCmd(strFind, lstResponse);
-	if (er != erSuccess)
-		return er;
-	if (!lstResponse.empty())
-		return KCERR_BAD_VALUE;
-	return erSuccess;
-}
-
-/**
- * Run the search query
- *
- * @param lstMatches[out] List of matches as hierarchy IDs
- * @return result
- */
-ECRESULT ECSearchClient::Query(std::list<unsigned int> &lstMatches)
-{
-	std::vector<std::string> lstResponse;
-	lstMatches.clear();
-	auto er = DoCmd("QUERY", lstResponse);
-	if (er != erSuccess)
-		return er;
-	if (lstResponse.empty())
-		return erSuccess; /* no matches */
-	for (const auto &i : tokenize(lstResponse[0], " "))
-		lstMatches.emplace_back(atoui(i.c_str()));
-	return erSuccess;
-}
-
 /**
  * Do a full search query
  *
- * This function actually executes a number of commands:
+ * This function sends a number of commands, without waiting for the
+ * response to each before sending the next:
  *
  * SCOPE <serverid> <storeid> <folder1> ... <folderN>
  * FIND <field1> ... <fieldN> : <term>
  * SUGGEST
  * QUERY
  *
+ * SCOPE specifies the scope of the search; no folders means "all folders".
+ * FIND specifies which term (utf-8 encoded) to look for in which fields;
+ * items must match all FIND terms. QUERY returns the matching hierarchy IDs.
+ *
  * @param lpServerGuid[in] Server GUID to search in
  * @param lpStoreGuid[in] Store GUID to search in
  * @param lstFolders[in] List of folders to search in
@@ -126,38 +64,114 @@ ECRESULT ECSearchClient::Query(std::list<unsigned int> &lstMatches)
  * @param lstMatches[out] Output of matching items
  * @return result
  */
-
 ECRESULT ECSearchClient::Query(const GUID *lpServerGuid, const GUID *lpStoreGuid,
     const std::list<unsigned int> &lstFolders, const std::list<SIndexedTerm> &lstSearches,
     std::list<unsigned int> &lstMatches, std::string &suggestion)
 {
-	auto strServer = bin2hex(sizeof(GUID), lpServerGuid);
-	auto strStore = bin2hex(sizeof(GUID), lpStoreGuid);
-	auto er = Scope(strServer, strStore, lstFolders);
-	if (er != erSuccess)
-		return er;
+	std::vector<std::string> cmds;
+	std::vector<std::vector<std::string>> rsp;
+	std::vector<ECRESULT> status;
+
+	lstMatches.clear();
+	cmds.reserve(lstSearches.size() + 3);
+	cmds.emplace_back("SCOPE " + bin2hex(sizeof(GUID), lpServerGuid) + " " +
+		bin2hex(sizeof(GUID), lpStoreGuid) + " " +
+		kc_join(lstFolders, " ", stringify));
 	for (const auto &i : lstSearches)
-		Find(i.setFields, i.strTerm);
-	er = Suggest(suggestion);
+		cmds.emplace_back("FIND " + kc_join(i.setFields, " ", stringify) + ":" + i.strTerm);
+	cmds.emplace_back("SUGGEST");
+	cmds.emplace_back("QUERY");
+	auto er = DoCmds(cmds, rsp, status);
 	if (er != erSuccess)
 		return er;
-	return Query(lstMatches);
-}
 
-ECRESULT ECSearchClient::Suggest(std::string &suggestion)
-{
-	std::vector<std::string> resp;
-	auto er = DoCmd("SUGGEST", resp);
-	if (er != erSuccess)
-		return er;
-	if (resp.size() < 1)
+	if (status[0] != erSuccess)
+		return status[0];
+	if (!rsp[0].empty())
+		return KCERR_BAD_VALUE;
+	/* A FIND that was not understood is skipped, as it always was */
+	auto &sugg = rsp[cmds.size()-2];
+	if (status[cmds.size()-2] != erSuccess)
+		return status[cmds.size()-2];
+	if (sugg.size() < 1)
 		return KCERR_CALL_FAILED;
-	suggestion = std::move(resp[0]);
+	suggestion = std::move(sugg[0]);
 	if (suggestion[0] == ' ')
 		suggestion.erase(0, 1);
+
+	auto &query = rsp[cmds.size()-1];
+	if (status[cmds.size()-1] != erSuccess)
+		return status[cmds.size()-1];
+	if (query.empty())
+		return erSuccess; /* no matches */
+	for (const auto &i : tokenize(query[0], " "))
+		lstMatches.emplace_back(atoui(i.c_str()));
 	return erSuccess;
 }
 
+/**
+ * Sends the commands one after the other, for clients that cannot pipeline.
+ */
+ECRESULT ECSearchClient::DoCmds(const std::vector<std::string> &cmds,
+    std::vector<std::vector<std::string>> &rsp, std::vector<ECRESULT> &status)
+{
+	rsp.assign(cmds.size(), {});
+	status.assign(cmds.size(), erSuccess);
+	for (size_t i = 0; i < cmds.size(); ++i) {
+		status[i] = DoCmd(cmds[i], rsp[i]);
+		if (status[i] != erSuccess && status[i] != KCERR_CALL_FAILED)
+			return status[i];
+	}
+	return erSuccess;
+}
+
+ECSearchClientPool::lease ECSearchClientPool::get(const char *path,
+    unsigned int timeout, unsigned int max)
+{
+	lease l;
+	std::unique_lock<std::mutex> lk(m_mtx);
+	if (m_path != path) {
+		/* search_socket was changed */
+		m_idle.clear();
+		m_path = path;
+	}
+	if (max == 0)
+		max = 1;
+	if (m_busy >= max) {
+		l.waited = true;
+		if (!m_cv.wait_for(lk, std::chrono::seconds(timeout),
+		    [&]() { return m_busy < max; }))
+			return l;
+	}
+	++m_busy;
+	l.m_pool = this;
+	if (!m_idle.empty()) {
+		l.m_client = std::move(m_idle.back());
+		m_idle.pop_back();
+		lk.unlock();
+	} else {
+		lk.unlock();
+		l.fresh = true;
+		l.m_client.reset(new(std::nothrow) ECSearchClientNET(path, timeout));
+	}
+	if (l.m_client != nullptr)
+		l.m_client->SetTimeout(timeout);
+	return l;
+}
+
+void ECSearchClientPool::put(std::unique_ptr<ECSearchClientNET> &&c)
+{
+	std::unique_lock<std::mutex> lk(m_mtx);
+	--m_busy;
+	if (c != nullptr && c->Connected())
+		m_idle.emplace_back(std::move(c));
+	else if (c != nullptr)
+		m_props_stale = true;
+	lk.unlock();
+	m_cv.notify_one();
+	/* @c, if not kept, is closed outside the lock */
+}
+
 ECRESULT ECSearchClient::SyncRun()
 {
 	std::vector<std::string> lstVoid;
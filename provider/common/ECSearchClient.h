@@ -4,8 +4,11 @@
  */
 #pragma once
 #include <kopano/zcdefs.h>
+#include <atomic>
+#include <condition_variable>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -31,20 +34,75 @@ public:
 	
 private:
 	virtual ECRESULT DoCmd(const std::string &command, std::vector<std::string> &response) = 0;
-	virtual ECRESULT Connect() { return erSuccess; }
-	ECRESULT Scope(const std::string &strServer, const std::string &strStore, const std::list<unsigned int> &ulFolders);
-	ECRESULT Find(const std::set<unsigned int> &setFields, const std::string &strTerm);
-	ECRESULT Query(std::list<unsigned int> &lstMatches);
-	ECRESULT Suggest(std::string &suggestion);
+	virtual ECRESULT DoCmds(const std::vector<std::string> &cmds, std::vector<std::vector<std::string>> &rsp, std::vector<ECRESULT> &status);
 };
 
 class ECSearchClientNET final :
     public ECSearchClient, private ECChannelClient {
 	public:
 	ECSearchClientNET(const char *szIndexerPath, unsigned int ulTimeOut);
+	using ECChannelClient::Connected;
+	void SetTimeout(unsigned int t) { m_ulTimeout = t; }
+
 	private:
 	virtual ECRESULT DoCmd(const std::string &c, std::vector<std::string> &r) { return ECChannelClient::DoCmd(c, r); }
-	virtual ECRESULT Connect() { return ECChannelClient::Connect(); }
+	virtual ECRESULT DoCmds(const std::vector<std::string> &c, std::vector<std::vector<std::string>> &r, std::vector<ECRESULT> &s) { return ECChannelClient::DoCmds(c, r, s); }
+};
+
+/**
+ * Connections to the indexer, kept open from one search to the next. No
+ * more than @max searches talk to the indexer at the same time; others
+ * wait for a connection to come free.
+ */
+class ECSearchClientPool final {
+	public:
+	class lease final {
+		public:
+		lease() = default;
+		lease(lease &&o) :
+			fresh(o.fresh), waited(o.waited), m_pool(o.m_pool),
+			m_client(std::move(o.m_client))
+		{
+			o.m_pool = nullptr;
+		}
+		lease &operator=(lease &&o)
+		{
+			if (this == &o)
+				return *this;
+			if (m_pool != nullptr)
+				m_pool->put(std::move(m_client));
+			fresh = o.fresh;
+			waited = o.waited;
+			m_pool = o.m_pool;
+			m_client = std::move(o.m_client);
+			o.m_pool = nullptr;
+			return *this;
+		}
+		~lease() { if (m_pool != nullptr) m_pool->put(std::move(m_client)); }
+		ECSearchClientNET *operator->() const { return m_client.get(); }
+		explicit operator bool() const { return m_client != nullptr; }
+		bool fresh = false; /* newly connected */
+		bool waited = false; /* had to wait for a connection */
+
+		private:
+		ECSearchClientPool *m_pool = nullptr;
+		std::unique_ptr<ECSearchClientNET> m_client;
+		friend class ECSearchClientPool;
+	};
+
+	lease get(const char *path, unsigned int timeout, unsigned int max);
+	/* True (once) after a connection broke, as the indexer may have restarted */
+	bool props_stale() { return m_props_stale.exchange(false); }
+
+	private:
+	void put(std::unique_ptr<ECSearchClientNET> &&);
+
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::string m_path;
+	std::vector<std::unique_ptr<ECSearchClientNET>> m_idle;
+	unsigned int m_busy = 0;
+	std::atomic<bool> m_props_stale{false};
 };
 
 } /* namespace */
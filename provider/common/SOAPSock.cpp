@@ -10,6 +10,7 @@
 #include <libHX/string.h>
 #include "SOAPSock.h"
 #include "SOAPUtils.h"
+#include "BinaryRPC.h"
 #include <kopano/ECLogger.h>
 #include <kopano/stringutil.h>
 #include <kopano/CommonUtil.h>
@@ -43,7 +44,8 @@ http_post(struct soap *soap, const char *endpoint, const char *host, int port, c
 	err = soap->fposthdr(soap, "User-Agent", "gSOAP/2.8");
 	if (err != 0)
 		return err;
-	err = soap_puthttphdr(soap, SOAP_OK, count);
+	/* SOAP_FILE makes all gsoap versions send http_content (binary RPC) */
+	err = soap_puthttphdr(soap, soap->http_content != nullptr ? SOAP_FILE : SOAP_OK, count);
 	if (err != 0)
 		return err;
 #ifdef WITH_ZLIB
@@ -119,6 +121,96 @@ static int gsoap_connect_pipe(struct soap *soap, const char *endpoint,
    	return SOAP_OK;
 }
 
+/*
+ * Starts a binary RPC request for @op: the magic, the op and the session.
+ */
+static void binrpc_begin(ECBinarySerializer &req, unsigned int op, ULONG64 sid)
+{
+	uint32_t magic = KC_BINRPC_MAGIC;
+	req.Write(&magic, sizeof(magic), 1);
+	req.Write(&op, sizeof(op), 1);
+	req.Write(&sid, sizeof(sid), 1);
+}
+
+/*
+ * Sends @req and reads the response header. On SOAP_OK, @er is set and
+ * @rsp is positioned at the results.
+ */
+static int binrpc_call(KCmdProxy *cmd, const std::string &req,
+    ECBinarySerializer &rsp, unsigned int *er)
+{
+	auto soap = cmd->soap;
+	auto err = BinRPCCall(soap, cmd->soap_endpoint, req, rsp);
+	if (err != SOAP_OK)
+		return err;
+	uint32_t magic = 0;
+	if (rsp.Read(&magic, sizeof(magic), 1) != erSuccess ||
+	    magic != KC_BINRPC_MAGIC ||
+	    rsp.Read(er, sizeof(*er), 1) != erSuccess)
+		return soap->error = SOAP_TYPE;
+	return SOAP_OK;
+}
+
+int KCmdProxy2::tableQueryRows(ULONG64 sid, unsigned int table,
+    unsigned int count, unsigned int flags, struct tableQueryRowsResponse *r)
+{
+	if (!binary_rpc)
+		return KCmdProxy::tableQueryRows(sid, table, count, flags, r);
+	std::string out;
+	ECBinarySerializer req(&out), rsp;
+	binrpc_begin(req, BINRPC_TABLEQUERYROWS, sid);
+	req.Write(&table, sizeof(table), 1);
+	req.Write(&count, sizeof(count), 1);
+	req.Write(&flags, sizeof(flags), 1);
+	soap_default_tableQueryRowsResponse(soap, r);
+	auto err = binrpc_call(this, out, rsp, &r->er);
+	if (err != SOAP_OK || r->er != erSuccess)
+		return err;
+	if (BinDeserialize(soap, &rsp, &r->sRowSet) != erSuccess)
+		return soap->error = SOAP_TYPE;
+	return SOAP_OK;
+}
+
+int KCmdProxy2::loadObject(ULONG64 sid, entryId eid,
+    struct notifySubscribe *ns, unsigned int flags,
+    struct loadObjectResponse *r)
+{
+	if (!binary_rpc)
+		return KCmdProxy::loadObject(sid, eid, ns, flags, r);
+	std::string out;
+	ECBinarySerializer req(&out), rsp;
+	binrpc_begin(req, BINRPC_LOADOBJECT, sid);
+	BinSerialize(&req, eid);
+	BinSerialize(&req, ns);
+	req.Write(&flags, sizeof(flags), 1);
+	soap_default_loadObjectResponse(soap, r);
+	auto err = binrpc_call(this, out, rsp, &r->er);
+	if (err != SOAP_OK || r->er != erSuccess)
+		return err;
+	if (BinDeserialize(soap, &rsp, &r->sSaveObject) != erSuccess)
+		return soap->error = SOAP_TYPE;
+	return SOAP_OK;
+}
+
+int KCmdProxy2::getIDsFromNames(ULONG64 sid, struct namedPropArray *names,
+    unsigned int flags, struct getIDsFromNamesResponse *r)
+{
+	if (!binary_rpc)
+		return KCmdProxy::getIDsFromNames(sid, names, flags, r);
+	std::string out;
+	ECBinarySerializer req(&out), rsp;
+	binrpc_begin(req, BINRPC_GETIDSFROMNAMES, sid);
+	BinSerialize(&req, *names);
+	req.Write(&flags, sizeof(flags), 1);
+	soap_default_getIDsFromNamesResponse(soap, r);
+	auto err = binrpc_call(this, out, rsp, &r->er);
+	if (err != SOAP_OK || r->er != erSuccess)
+		return err;
+	if (BinDeserialize(soap, &rsp, &r->lpsPropTags) != erSuccess)
+		return soap->error = SOAP_TYPE;
+	return SOAP_OK;
+}
+
 HRESULT CreateSoapTransport(const sGlobalProfileProps &prof, KCmdProxy2 **lppCmd)
 {
 	if (prof.strServerPath.size() == 0 || lppCmd == nullptr)
@@ -10,7 +10,20 @@
 class KCmdProxy2 final : public KCmdProxy {
 	public:
 	using KCmdProxy::KCmdProxy;
+	using KCmdProxy::tableQueryRows;
+	using KCmdProxy::loadObject;
+	using KCmdProxy::getIDsFromNames;
 	virtual ~KCmdProxy2();
+
+	/*
+	 * These go out in the encoding of BinaryRPC.h when the server agreed
+	 * to it at logon (binary_rpc), and as SOAP otherwise.
+	 */
+	int tableQueryRows(ULONG64 sid, unsigned int table, unsigned int count, unsigned int flags, struct tableQueryRowsResponse *);
+	int loadObject(ULONG64 sid, entryId eid, struct notifySubscribe *, unsigned int flags, struct loadObjectResponse *);
+	int getIDsFromNames(ULONG64 sid, struct namedPropArray *, unsigned int flags, struct getIDsFromNamesResponse *);
+
+	bool binary_rpc = false;
 };
 
 /* A simpler form of profile props (which are stashed in SPropValues) */
@@ -13,6 +13,7 @@
 #include "kcore.hpp"
 #include "SOAPUtils.h"
 #include "SOAPAlloc.h"
+#include <ECSerializer.h>
 #include <kopano/stringutil.h>
 #include <kopano/ustringutil.h>
 
@@ -843,6 +844,282 @@ ECRESULT CopyPropVal(const struct propVal *lpSrc, struct propVal **lppDst,
 	return erSuccess;
 }
 
+/*
+ * The value part of a property, as ICS streams carry it: fixed-size types
+ * as they are, strings and binaries prefixed by their length, MV types by
+ * their count. The serializer takes care of byte order.
+ */
+ECRESULT SerializePropValData(const struct propVal &sPropVal, ECSerializer *lpSink)
+{
+	ECRESULT er = erSuccess;
+
+	switch (PROP_TYPE(sPropVal.ulPropTag)) {
+	case PT_I2:
+		er = lpSink->Write(&sPropVal.Value.i, sizeof(sPropVal.Value.i), 1);
+		break;
+	case PT_LONG:
+		er = lpSink->Write(&sPropVal.Value.ul, sizeof(sPropVal.Value.ul), 1);
+		break;
+	case PT_R4:
+		er = lpSink->Write(&sPropVal.Value.flt, sizeof(sPropVal.Value.flt), 1);
+		break;
+	case PT_BOOLEAN: {
+		unsigned char b = sPropVal.Value.b ? 1 : 0;
+		er = lpSink->Write(&b, sizeof(b), 1);
+		break;
+	}
+	case PT_DOUBLE:
+	case PT_APPTIME:
+		er = lpSink->Write(&sPropVal.Value.dbl, sizeof(sPropVal.Value.dbl), 1);
+		break;
+	case PT_CURRENCY:
+	case PT_SYSTIME:
+		er = lpSink->Write(&sPropVal.Value.hilo->hi, sizeof(sPropVal.Value.hilo->hi), 1);
+		if (er == erSuccess)
+			er = lpSink->Write(&sPropVal.Value.hilo->lo, sizeof(sPropVal.Value.hilo->lo), 1);
+		break;
+	case PT_I8:
+		er = lpSink->Write(&sPropVal.Value.li, sizeof(sPropVal.Value.li), 1);
+		break;
+	case PT_STRING8:
+	case PT_UNICODE: {
+		unsigned int ulLen = strlen(sPropVal.Value.lpszA);
+		er = lpSink->Write(&ulLen, sizeof(ulLen), 1);
+		if (er == erSuccess)
+			er = lpSink->Write(sPropVal.Value.lpszA, 1, ulLen);
+		break;
+	}
+	case PT_CLSID:
+	case PT_BINARY:
+		er = lpSink->Write(&sPropVal.Value.bin->__size, sizeof(sPropVal.Value.bin->__size), 1);
+		if (er == erSuccess)
+			er = lpSink->Write(sPropVal.Value.bin->__ptr, 1, sPropVal.Value.bin->__size);
+		break;
+	case PT_MV_I2:
+		er = lpSink->Write(&sPropVal.Value.mvi.__size, sizeof(sPropVal.Value.mvi.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvi.__size; ++x)
+			er = lpSink->Write(&sPropVal.Value.mvi.__ptr[x], sizeof(sPropVal.Value.mvi.__ptr[x]), 1);
+		break;
+	case PT_MV_LONG:
+		er = lpSink->Write(&sPropVal.Value.mvl.__size, sizeof(sPropVal.Value.mvl.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvl.__size; ++x)
+			er = lpSink->Write(&sPropVal.Value.mvl.__ptr[x], sizeof(sPropVal.Value.mvl.__ptr[x]), 1);
+		break;
+	case PT_MV_R4:
+		er = lpSink->Write(&sPropVal.Value.mvflt.__size, sizeof(sPropVal.Value.mvflt.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvflt.__size; ++x)
+			er = lpSink->Write(&sPropVal.Value.mvflt.__ptr[x], sizeof(sPropVal.Value.mvflt.__ptr[x]), 1);
+		break;
+	case PT_MV_DOUBLE:
+	case PT_MV_APPTIME:
+		er = lpSink->Write(&sPropVal.Value.mvdbl.__size, sizeof(sPropVal.Value.mvdbl.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvdbl.__size; ++x)
+			er = lpSink->Write(&sPropVal.Value.mvdbl.__ptr[x], sizeof(sPropVal.Value.mvdbl.__ptr[x]), 1);
+		break;
+	case PT_MV_CURRENCY:
+	case PT_MV_SYSTIME:
+		er = lpSink->Write(&sPropVal.Value.mvhilo.__size, sizeof(sPropVal.Value.mvhilo.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvhilo.__size; ++x) {
+			er = lpSink->Write(&sPropVal.Value.mvhilo.__ptr[x].hi, sizeof(sPropVal.Value.mvhilo.__ptr[x].hi), 1);
+			if (er == erSuccess)
+				er = lpSink->Write(&sPropVal.Value.mvhilo.__ptr[x].lo, sizeof(sPropVal.Value.mvhilo.__ptr[x].lo), 1);
+		}
+		break;
+	case PT_MV_BINARY:
+	case PT_MV_CLSID:
+		er = lpSink->Write(&sPropVal.Value.mvbin.__size, sizeof(sPropVal.Value.mvbin.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvbin.__size; ++x) {
+			er = lpSink->Write(&sPropVal.Value.mvbin.__ptr[x].__size, sizeof(sPropVal.Value.mvbin.__ptr[x].__size), 1);
+			if (er == erSuccess)
+				er = lpSink->Write(sPropVal.Value.mvbin.__ptr[x].__ptr, 1, sPropVal.Value.mvbin.__ptr[x].__size);
+		}
+		break;
+	case PT_MV_STRING8:
+	case PT_MV_UNICODE:
+		er = lpSink->Write(&sPropVal.Value.mvszA.__size, sizeof(sPropVal.Value.mvszA.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvszA.__size; ++x) {
+			unsigned int ulLen = strlen(sPropVal.Value.mvszA.__ptr[x]);
+			er = lpSink->Write(&ulLen, sizeof(ulLen), 1);
+			if (er == erSuccess)
+				er = lpSink->Write(sPropVal.Value.mvszA.__ptr[x], 1, ulLen);
+		}
+		break;
+	case PT_MV_I8:
+		er = lpSink->Write(&sPropVal.Value.mvli.__size, sizeof(sPropVal.Value.mvli.__size), 1);
+		for (gsoap_size_t x = 0; er == erSuccess && x < sPropVal.Value.mvli.__size; ++x)
+			er = lpSink->Write(&sPropVal.Value.mvli.__ptr[x], sizeof(sPropVal.Value.mvli.__ptr[x]), 1);
+		break;
+
+	default:
+		er = KCERR_INVALID_TYPE;
+	}
+	return er;
+}
+
+/* Reads the value for the tag that is already in @lpsPropval */
+ECRESULT DeserializePropValData(struct soap *soap, struct propVal *lpsPropval,
+    ECSerializer *lpSource)
+{
+	ECRESULT er = erSuccess;
+	gsoap_size_t ulCount;
+	unsigned int ulLen;
+	unsigned char b;
+
+	switch (PROP_TYPE(lpsPropval->ulPropTag)) {
+	case PT_I2:
+		lpsPropval->__union = SOAP_UNION_propValData_i;
+		er = lpSource->Read(&lpsPropval->Value.i, sizeof(lpsPropval->Value.i), 1);
+		break;
+	case PT_LONG:
+		lpsPropval->__union = SOAP_UNION_propValData_ul;
+		er = lpSource->Read(&lpsPropval->Value.ul, sizeof(lpsPropval->Value.ul), 1);
+		break;
+	case PT_R4:
+		lpsPropval->__union = SOAP_UNION_propValData_flt;
+		er = lpSource->Read(&lpsPropval->Value.flt, sizeof(lpsPropval->Value.flt), 1);
+		break;
+	case PT_BOOLEAN:
+		lpsPropval->__union = SOAP_UNION_propValData_b;
+		er = lpSource->Read(&b, sizeof(b), 1);
+		lpsPropval->Value.b = (b != 0);
+		break;
+	case PT_DOUBLE:
+	case PT_APPTIME:
+		lpsPropval->__union = SOAP_UNION_propValData_dbl;
+		er = lpSource->Read(&lpsPropval->Value.dbl, sizeof(lpsPropval->Value.dbl), 1);
+		break;
+	case PT_CURRENCY:
+	case PT_SYSTIME:
+		lpsPropval->__union = SOAP_UNION_propValData_hilo;
+		lpsPropval->Value.hilo = soap_new_hiloLong(soap);
+		er = lpSource->Read(&lpsPropval->Value.hilo->hi, sizeof(lpsPropval->Value.hilo->hi), 1);
+		if (er == erSuccess)
+			er = lpSource->Read(&lpsPropval->Value.hilo->lo, sizeof(lpsPropval->Value.hilo->lo), 1);
+		break;
+	case PT_I8:
+		lpsPropval->__union = SOAP_UNION_propValData_li;
+		er = lpSource->Read(&lpsPropval->Value.li, sizeof(lpsPropval->Value.li), 1);
+		break;
+	case PT_STRING8:
+	case PT_UNICODE:
+		lpsPropval->__union = SOAP_UNION_propValData_lpszA;
+		er = lpSource->Read(&ulLen, sizeof(ulLen), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.lpszA = soap_new_byte(soap, ulLen + 1);
+		er = lpSource->Read(lpsPropval->Value.lpszA, 1, ulLen);
+		break;
+	case PT_CLSID:
+	case PT_BINARY:
+		lpsPropval->__union = SOAP_UNION_propValData_bin;
+		er = lpSource->Read(&ulLen, sizeof(ulLen), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.bin = soap_new_xsd__base64Binary(soap);
+		lpsPropval->Value.bin->__size = ulLen;
+		lpsPropval->Value.bin->__ptr  = soap_new_unsignedByte(soap, ulLen);
+		er = lpSource->Read(lpsPropval->Value.bin->__ptr, 1, ulLen);
+		break;
+	case PT_MV_I2:
+		lpsPropval->__union = SOAP_UNION_propValData_mvi;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvi.__size = ulCount;
+		lpsPropval->Value.mvi.__ptr  = soap_new_short(soap, ulCount);
+		er = lpSource->Read(lpsPropval->Value.mvi.__ptr, sizeof *lpsPropval->Value.mvi.__ptr, ulCount);
+		break;
+	case PT_MV_LONG:
+		lpsPropval->__union = SOAP_UNION_propValData_mvl;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvl.__size = ulCount;
+		lpsPropval->Value.mvl.__ptr  = soap_new_unsignedInt(soap, ulCount);
+		er = lpSource->Read(lpsPropval->Value.mvl.__ptr, sizeof *lpsPropval->Value.mvl.__ptr, ulCount);
+		break;
+	case PT_MV_R4:
+		lpsPropval->__union = SOAP_UNION_propValData_mvflt;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvflt.__size = ulCount;
+		lpsPropval->Value.mvflt.__ptr  = soap_new_float(soap, ulCount);
+		er = lpSource->Read(lpsPropval->Value.mvflt.__ptr, sizeof *lpsPropval->Value.mvflt.__ptr, ulCount);
+		break;
+	case PT_MV_DOUBLE:
+	case PT_MV_APPTIME:
+		lpsPropval->__union = SOAP_UNION_propValData_mvdbl;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvdbl.__size = ulCount;
+		lpsPropval->Value.mvdbl.__ptr  = soap_new_double(soap, ulCount);
+		er = lpSource->Read(lpsPropval->Value.mvdbl.__ptr, sizeof *lpsPropval->Value.mvdbl.__ptr, ulCount);
+		break;
+	case PT_MV_CURRENCY:
+	case PT_MV_SYSTIME:
+		lpsPropval->__union = SOAP_UNION_propValData_mvhilo;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvhilo.__size = ulCount;
+		lpsPropval->Value.mvhilo.__ptr  = soap_new_hiloLong(soap, ulCount);
+		for (gsoap_size_t x = 0; er == erSuccess && x < ulCount; ++x) {
+			er = lpSource->Read(&lpsPropval->Value.mvhilo.__ptr[x].hi, sizeof(lpsPropval->Value.mvhilo.__ptr[x].hi), 1);
+			if (er != erSuccess)
+				continue;
+			er = lpSource->Read(&lpsPropval->Value.mvhilo.__ptr[x].lo, sizeof(lpsPropval->Value.mvhilo.__ptr[x].lo), 1);
+		}
+		break;
+	case PT_MV_BINARY:
+	case PT_MV_CLSID:
+		lpsPropval->__union = SOAP_UNION_propValData_mvbin;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvbin.__size = ulCount;
+		lpsPropval->Value.mvbin.__ptr  = soap_new_xsd__base64Binary(soap, ulCount);
+		for (gsoap_size_t x = 0; er == erSuccess && x < ulCount; ++x) {
+			er = lpSource->Read(&ulLen, sizeof(ulLen), 1);
+			if (er != erSuccess)
+				continue;
+			lpsPropval->Value.mvbin.__ptr[x].__size = ulLen;
+			lpsPropval->Value.mvbin.__ptr[x].__ptr  = soap_new_unsignedByte(soap, ulLen);
+			er = lpSource->Read(lpsPropval->Value.mvbin.__ptr[x].__ptr, 1, ulLen);
+		}
+		break;
+	case PT_MV_STRING8:
+	case PT_MV_UNICODE:
+		lpsPropval->__union = SOAP_UNION_propValData_mvszA;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvszA.__size = ulCount;
+		lpsPropval->Value.mvszA.__ptr  = soap_new_string(soap, ulCount);
+		for (gsoap_size_t x = 0; er == erSuccess && x < ulCount; ++x) {
+			er = lpSource->Read(&ulLen, sizeof(ulLen), 1);
+			if (er != erSuccess)
+				continue;
+			lpsPropval->Value.mvszA.__ptr[x] = soap_new_byte(soap, ulLen + 1);
+			er = lpSource->Read(lpsPropval->Value.mvszA.__ptr[x], 1, ulLen);
+		}
+		break;
+	case PT_MV_I8:
+		lpsPropval->__union = SOAP_UNION_propValData_mvli;
+		er = lpSource->Read(&ulCount, sizeof(ulCount), 1);
+		if (er != erSuccess)
+			break;
+		lpsPropval->Value.mvli.__size = ulCount;
+		lpsPropval->Value.mvli.__ptr  = soap_new_LONG64(soap, ulCount);
+		er = lpSource->Read(lpsPropval->Value.mvli.__ptr, sizeof *lpsPropval->Value.mvli.__ptr, ulCount);
+		break;
+	default:
+		return KCERR_INVALID_TYPE;
+	}
+	return er;
+}
+
 ECRESULT CopyPropValArray(const struct propValArray *lpSrc,
     struct propValArray **lppDst, struct soap *soap)
 {
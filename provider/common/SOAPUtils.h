@@ -17,6 +17,8 @@
 
 namespace KC {
 
+class ECSerializer;
+
 extern std::string FilterBMP(const std::string &strToFilter);
 // SortOrderSets
 extern int CompareSortOrderArray(const struct sortOrderArray *lpsSortOrder1, const struct sortOrderArray *lpsSortOrder2);
@@ -43,6 +45,8 @@ extern ECRESULT CompareMVPropWithProp(struct propVal *lpMVProp1, const struct pr
 size_t PropSize(const struct propVal *);
 extern ECRESULT CopyPropVal(const struct propVal *src, struct propVal *dst, struct soap * = nullptr, bool truncate = false);
 extern ECRESULT CopyPropVal(const struct propVal *src, struct propVal **dst, struct soap * = nullptr, bool truncate = false); /* allocates new lpDst and calls other version */
+extern ECRESULT SerializePropValData(const struct propVal &, ECSerializer *);
+extern ECRESULT DeserializePropValData(struct soap *, struct propVal *, ECSerializer *);
 
 // EntryList
 ECRESULT			CopyEntryList(struct soap *soap, struct entryList *lpSrc, struct entryList **lppDst);
@@ -111,6 +115,7 @@ struct SOAPINFO {
 	CONNECTION_TYPE ulConnectionType;
 	int (*fparsehdr)(struct soap *soap, const char *key, const char *val);
 	bool bProxy;
+	bool binrpc; /* current request is binary RPC (BinaryRPC.h) */
 	void (*fdone)(struct soap *soap, void *param);
 	void *fdoneparam;
 	ECSESSIONID ulLastSessionId; // Session ID of the last processed request
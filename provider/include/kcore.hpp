@@ -318,9 +318,20 @@ enum
  * returned from the getIDsForNames RPC.
  */
 #define KOPANO_CAP_GIFN32 0x8000
+/*
+ * Client can make the calls of BinaryRPC.h in binary encoding. The server
+ * only returns this when the client sent it and enable_binary_rpc is set.
+ */
+#define KOPANO_CAP_BINARY_RPC 0x10000
+/* Server has ns__compound */
+#define KOPANO_CAP_COMPOUND_RPC 0x20000
+/* Server has ns__notifyGetItemsMulti */
+#define KOPANO_CAP_NOTIFY_MULTI 0x40000
+/* Most sessions one notifyGetItemsMulti may wait on */
+#define KOPANO_MAX_NOTIFY_SESSIONS 4096
 
 // Do *not* use this from a client. This is just what the latest server supports.
-#define KOPANO_LATEST_CAPABILITIES (KOPANO_CAP_CRYPT | KOPANO_CAP_LICENSE_SERVER | KOPANO_CAP_LOADPROP_ENTRYID | KOPANO_CAP_EXPORT_PROPTAG | KOPANO_CAP_IMPERSONATION | KOPANO_CAP_GIFN32)
+#define KOPANO_LATEST_CAPABILITIES (KOPANO_CAP_CRYPT | KOPANO_CAP_LICENSE_SERVER | KOPANO_CAP_LOADPROP_ENTRYID | KOPANO_CAP_EXPORT_PROPTAG | KOPANO_CAP_IMPERSONATION | KOPANO_CAP_GIFN32 | KOPANO_CAP_COMPOUND_RPC | KOPANO_CAP_NOTIFY_MULTI)
 
 //
 // Logon flags, sent with ns__logon()
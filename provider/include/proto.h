@@ -368,6 +368,27 @@ struct ns:notifyResponse {
 	unsigned int er;
 };
 
+struct notifySessionArray {
+	int __size;
+	ULONG64 *__ptr;
+};
+
+struct notifyGroupItems {
+	ULONG64 ulSessionId; /* as in the request */
+	unsigned int er;
+	struct notificationArray *pNotificationArray;
+};
+
+struct notifyGroupArray {
+	int __size;
+	struct notifyGroupItems *__ptr;
+};
+
+struct ns:notifyMultiResponse {
+	unsigned int er;
+	struct notifyGroupArray sGroups; /* only the sessions that had something to say */
+};
+
 struct notifySyncState {
 	unsigned int ulSyncId;
 	unsigned int ulChangeId;
@@ -933,6 +954,56 @@ struct ns:create_folders_response {
 	struct entryList *entryids;
 };
 
+struct deliver_copy {
+	entryId folder_eid;
+	struct propValArray props; /* set on the copy */
+	struct propTagArray del_props; /* not copied from the template */
+};
+
+struct deliver_copy_set {
+	int __size;
+	struct deliver_copy *__ptr;
+};
+
+struct ns:deliver_copies_response {
+	unsigned int er;
+	struct mv_long results; /* per copy */
+	struct entryList *entryids;
+};
+
+/* One call of a compound request; which fields count depends on op */
+struct compound_op {
+	unsigned int op; /* COMPOUND_OP_* */
+	unsigned int flags;
+	entryId eid; /* checkExistObject, loadObject */
+	struct notifySubscribe *subscribe; /* loadObject */
+	struct namedPropArray *names; /* getIDsFromNames */
+	struct tableMultiRequest *table; /* tableMulti */
+};
+
+struct compound_op_set {
+	int __size;
+	struct compound_op *__ptr;
+};
+
+struct compound_result {
+	unsigned int er;
+	struct saveObject *object; /* loadObject */
+	struct propTagArray *tags; /* getIDsFromNames */
+	unsigned int table_id; /* tableMulti */
+	struct rowSet *rows; /* tableMulti */
+};
+
+struct compound_result_set {
+	int __size;
+	struct compound_result *__ptr;
+};
+
+struct ns:compound_response {
+	unsigned int er;
+	struct compound_result_set results; /* per op */
+};
+
 //TableType flags for function ns__tableOpen
 #define TABLETYPE_MS				1	// MessageStore tables
 #define TABLETYPE_AB				2	// Addressbook tables
@@ -949,6 +1020,15 @@ struct ns:create_folders_response {
 // Flags for struct tableMultiRequest
 #define TABLE_MULTI_CLEAR_RESTRICTION	0x1	// Clear table restriction
 
+// Flags for checkExistObject (besides SHOW_SOFT_DELETES)
+#define CHECKEXIST_ACCESS	0x40000000	// Also check the read access that loadObject checks
+
+// Calls for struct compound_op
+#define COMPOUND_OP_CHECKEXISTOBJECT	1
+#define COMPOUND_OP_LOADOBJECT			2
+#define COMPOUND_OP_GETIDSFROMNAMES		3
+#define COMPOUND_OP_TABLEMULTI			4
+
 #define fnevKopanoIcsChange			(fnevExtended | 0x00000001)
 
 int ns__logon(const char *szUsername, const char *szPassword, const char *szImpersonateUser, const char *szVersion, unsigned int ulCapabilities, unsigned int ulFlags, struct xsd__base64Binary sLicenseReq, ULONG64 ullSessionGroup, const char *szClientApp, const char *szClientAppVersion, const char *szClientAppMisc, struct ns:logonResponse *lpsLogonResponse);
@@ -992,6 +1072,7 @@ int ns__notifySubscribeMulti(ULONG64 ulSessionId, struct notifySubscribeArray *n
 int ns__notifyUnSubscribe(ULONG64 ulSessionId, unsigned int ulConnection, unsigned int *result);
 int ns__notifyUnSubscribeMulti(ULONG64 ulSessionId, struct mv_long *ulConnectionArray, unsigned int *result);
 int ns__notifyGetItems(ULONG64 ulSessionId, struct ns:notifyResponse *notifications);
+int ns__notifyGetItemsMulti(struct notifySessionArray sessions, struct ns:notifyMultiResponse *response);
 
 int ns__tableOpen(ULONG64 ulSessionId, entryId sEntryId, unsigned int ulTableType, unsigned int ulType, unsigned int ulFlags, struct ns:tableOpenResponse *lpsTableOpenResponse);
 int ns__tableClose(ULONG64 ulSessionId, unsigned int ulTableId, unsigned int *result);
@@ -1016,6 +1097,8 @@ int ns__tableMulti(ULONG64 ulSessionId, struct tableMultiRequest sRequest, struc
 int ns__submitMessage(ULONG64 ulSessionId, entryId sEntryId, unsigned int ulFlags, unsigned int *result);
 int ns__finishedMessage(ULONG64 ulSessionId, entryId sEntryId, unsigned int ulFlags, unsigned int *result);
 int ns__abortSubmit(ULONG64 ulSessionId, entryId sEntryId, unsigned int *result);
+int ns__deliver_copies(ULONG64 session_id, entryId template_eid, struct deliver_copy_set batch, struct ns:deliver_copies_response *response);
+int ns__compound(ULONG64 session_id, struct compound_op_set ops, struct ns:compound_response *response);
 
 // Get user ID / store for username (username == NULL for current user)
 int ns__resolveStore(ULONG64 ulSessionId, struct xsd__base64Binary sStoreGuid, struct ns:resolveUserStoreResponse *lpsResponse);
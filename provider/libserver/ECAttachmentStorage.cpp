@@ -18,7 +18,6 @@
 #include <cerrno>
 #include <algorithm>
 #include <fcntl.h>
-#include <zlib.h>
 #include <ECSerializer.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -29,10 +28,12 @@
 #include "SOAPUtils.h"
 #include <kopano/ECLogger.h>
 #include <kopano/MAPIErrors.h>
+#include <kopano/cdc.hpp>
 #include <kopano/fileutil.hpp>
 #include <mapitags.h>
 #include <kopano/scope.hpp>
 #include <kopano/stringutil.h>
+#include <kopano/zcodec.hpp>
 #include <openssl/sha.h>
 #include "StreamUtil.h"
 #include "ECS3Attachment.h"
@@ -41,30 +42,6 @@ using namespace std::string_literals;
 
 namespace KC {
 
-class gz_ptr {
-	public:
-	gz_ptr(int &fd, const char *file) : m_fd(fd), m_fp(gzdopen(fd, file)) {}
-	~gz_ptr() {
-		if (m_fp != nullptr)
-			close();
-	}
-	operator gzFile() const { return m_fp; }
-	int close() {
-		if (m_fp == nullptr)
-			return Z_OK;
-		auto ret = gzclose(m_fp);
-		if (ret != Z_OK)
-			ec_log_err("gzclose: %s", ret == Z_ERRNO ? strerror(errno) : "buffer error");
-		m_fd = -1;
-		m_fp = nullptr;
-		return ret;
-	}
-
-	private:
-	int &m_fd;
-	gzFile m_fp = nullptr;
-};
-
 class ECDatabaseAttachmentConfig final : public ECAttachmentConfig {
 	public:
 	virtual ECAttachmentStorage *new_handle(ECDatabase *) override;
@@ -77,13 +54,14 @@ class ECFileAttachmentConfig : public ECAttachmentConfig {
 
 	protected:
 	std::string m_dir;
-	unsigned int m_complvl = 0, m_l1 = 0, m_l2 = 0;
+	unsigned int m_complvl = 0, m_comp_threads = 1, m_l1 = 0, m_l2 = 0;
+	zcodec m_codec = zcodec::gzip;
 	bool m_sync_files;
 };
 
 class ECFileAttachment : public ECAttachmentStorage {
 	public:
-	ECFileAttachment(ECDatabase *, const std::string &basepath, unsigned int compr_lvl, unsigned int l1, unsigned int l2, bool sync);
+	ECFileAttachment(ECDatabase *, const std::string &basepath, unsigned int compr_lvl, unsigned int l1, unsigned int l2, bool sync, zcodec = zcodec::gzip, unsigned int compr_threads = 1);
 
 	protected:
 	virtual ~ECFileAttachment();
@@ -96,10 +74,12 @@ class ECFileAttachment : public ECAttachmentStorage {
 	virtual ECRESULT DeleteAttachmentInstances(const std::list<ext_siid> &, bool replace) override;
 	virtual ECRESULT DeleteAttachmentInstance(const ext_siid &, bool replace) override;
 	virtual ECRESULT GetSizeInstance(const ext_siid &, size_t *size, bool *compr = nullptr) override;
+	virtual ECRESULT GetExactSizeInstance(const ext_siid &, size_t *size, bool *exact) override;
 	virtual kd_trans Begin(ECRESULT &) override;
 	virtual ECRESULT Commit() override;
 	virtual ECRESULT Rollback() override;
-	ECRESULT load_instance_z(struct soap *, const ext_siid &instance_id, int &fd, const std::string &filename, size_t *size, unsigned char **data);
+	ECRESULT size_instance(const ext_siid &, size_t *size, bool *compr, bool *exact);
+	ECRESULT load_instance_z(struct soap *, const ext_siid &instance_id, int fd, const std::string &filename, size_t *size, unsigned char **data);
 	ECRESULT load_instance_u(struct soap *, int &fd, const std::string &filename, size_t *size, unsigned char **data);
 	ECRESULT save_instance_data(const std::string &filename, int fd, unsigned int propid, size_t z, unsigned char *data, bool comp);
 
@@ -112,6 +92,9 @@ class ECFileAttachment : public ECAttachmentStorage {
 	void my_readahead(int fd);
 
 	std::string m_basepath;
+	/* Codec for new compressed instances; reading detects it */
+	zcodec m_codec;
+	unsigned int m_comp_threads;
 
 	private:
 	std::string CreateAttachmentFilename(const ext_siid &, bool compressed);
@@ -128,10 +111,14 @@ class ECFileAttachment : public ECAttachmentStorage {
 class ECFileAttachmentConfig2 final : public ECFileAttachmentConfig {
 	public:
 	ECFileAttachmentConfig2(const GUID &);
+	virtual ECRESULT init(std::shared_ptr<ECConfig>) override;
 	virtual ECAttachmentStorage *new_handle(ECDatabase *) override;
 
 	protected:
 	std::string m_server_guid;
+	/* Store larger attachments as content-defined chunks */
+	bool m_chunking = false;
+	cdc_chunker m_chunker;
 
 	friend class ECFileAttachment2;
 };
@@ -144,10 +131,18 @@ class ECFileAttachment2 final : public ECFileAttachment {
 	virtual ECRESULT SaveAttachmentInstance(ext_siid &, ULONG propid, size_t, unsigned char *) override;
 	virtual ECRESULT SaveAttachmentInstance(ext_siid &, ULONG propid, size_t, ECSerializer *) override;
 	virtual ECRESULT GetSizeInstance(const ext_siid &, size_t *, bool *) override;
+	/* Content files are stored uncompressed, the size is always exact */
+	virtual ECRESULT GetExactSizeInstance(const ext_siid &i, size_t *z, bool *exact) override { return ECAttachmentStorage::GetExactSizeInstance(i, z, exact); }
 	virtual ECRESULT DeleteAttachmentInstance(const ext_siid &, bool replace) override;
 	virtual ECRESULT LoadAttachmentInstance(struct soap *, const ext_siid &, size_t *, unsigned char **) override;
 	virtual ECRESULT LoadAttachmentInstance(const ext_siid &, size_t *, ECSerializer *) override;
+	bool use_chunks(size_t) const;
+	std::string holder_name(const ext_siid &) const;
+	ECRESULT load_manifest(const std::string &dir, cdc_manifest *) const;
+	ECRESULT save_manifest(const std::string &dir, const cdc_manifest &);
+	void discard_upload(const std::string &dir);
 	ECFileAttachmentConfig2 &m_config;
+	cdc_store m_chunks;
 };
 
 struct at2_layout {
@@ -160,9 +155,6 @@ static const char fa_hex[] = "0123456789abcdef";
 // chunk size for attachment blobs, must be equal or larger than MAX, MAX may never shrink below 384*1024.
 #define CHUNK_SIZE (384 * 1024)
 
-// as advised by http://www.zlib.net/manual.html we use a 128KB buffer; default is only 8KB
-#define ZLIB_BUFFER_SIZE std::max(CHUNK_SIZE, 128 * 1024)
-
 /*
  * Locking requirements of ECAttachmentStorage:
  * In the case of ECAttachmentStorage, locking to protect against concurrent access is futile.
@@ -258,13 +250,10 @@ static std::string uas_data_to_ident(const void *data, size_t dsize)
 
 // Generic Attachment storage
 ECAttachmentStorage::ECAttachmentStorage(ECDatabase *lpDatabase, unsigned int ulCompressionLevel) :
-	m_lpDatabase(lpDatabase), m_bFileCompression(ulCompressionLevel != 0)
-{
-	if (ulCompressionLevel > Z_BEST_COMPRESSION)
-		ulCompressionLevel = Z_BEST_COMPRESSION;
-
-	m_CompressionLevel = stringify(ulCompressionLevel);
-}
+	m_lpDatabase(lpDatabase), m_bFileCompression(ulCompressionLevel != 0),
+	/* Each codec clamps the level to its own range */
+	m_CompressionLevel(ulCompressionLevel)
+{}
 
 static bool filesv1_extract_fanout(const char *s, unsigned int *x, unsigned int *y)
 {
@@ -323,12 +312,23 @@ ECRESULT ECFileAttachmentConfig::init(std::shared_ptr<ECConfig> config)
 	m_dir = dir;
 	m_complvl = (comp == nullptr) ? 0 : strtoul(comp, nullptr, 0);
 	m_sync_files = parseBool(config->GetSetting("attachment_files_fsync"));
+	auto codec = config->GetSetting("attachment_compression_codec");
+	if (!zcodec_parse(codec, &m_codec)) {
+		ec_log_err("K-1543: Unrecognized attachment_compression_codec=\"%s\"", codec);
+		return KCERR_CALL_FAILED;
+	} else if (!zcodec_available(m_codec)) {
+		ec_log_warn("K-1544: Server not built with %s support; compressing attachments with gzip instead.", codec);
+		m_codec = zcodec::gzip;
+	}
+	auto thr = config->GetSetting("attachment_compression_threads");
+	m_comp_threads = std::max(1UL, thr == nullptr ? 1UL : strtoul(thr, nullptr, 0));
 	return erSuccess;
 }
 
 ECAttachmentStorage *ECFileAttachmentConfig::new_handle(ECDatabase *db)
 {
-	return new(std::nothrow) ECFileAttachment(db, m_dir, m_complvl, m_l1, m_l2, m_sync_files);
+	return new(std::nothrow) ECFileAttachment(db, m_dir, m_complvl, m_l1, m_l2,
+	       m_sync_files, m_codec, m_comp_threads);
 }
 
 /**
@@ -584,6 +584,89 @@ ECRESULT ECAttachmentStorage::LoadAttachment(ULONG ulObjId, ULONG ulPropId, size
 	return LoadAttachmentInstance(ulInstanceId, lpiSize, lpSink);
 }
 
+/**
+ * Retrieve a byte range of a large property from the storage, return data in
+ * a serializer. At most @length bytes starting at @offset are written; less
+ * if the property is shorter.
+ *
+ * @param[in] ulObjId HierarchyID to load property for
+ * @param[in] ulPropId property id to load
+ * @param[in] offset first byte to load
+ * @param[in] length number of bytes to load
+ * @param[out] written number of bytes written into lpSink
+ * @param[in] lpSink Write in this serializer
+ *
+ * @return Kopano error code
+ */
+ECRESULT ECAttachmentStorage::LoadAttachmentRange(ULONG ulObjId,
+    ULONG ulPropId, size_t offset, size_t length, size_t *written,
+    ECSerializer *lpSink)
+{
+	ext_siid ulInstanceId;
+	*written = 0;
+	auto er = GetSingleInstanceId(ulObjId, ulPropId, &ulInstanceId);
+	if (er != erSuccess)
+		return er;
+	if (length == 0)
+		return erSuccess;
+	return LoadAttachmentInstanceRange(ulInstanceId, offset, length, written, lpSink);
+}
+
+/**
+ * Serializer which passes on only the bytes within [offset, offset+length)
+ * of everything written into it. Used to implement range reads on top of
+ * a sequential LoadAttachmentInstance.
+ */
+class range_serializer final : public ECSerializer {
+	public:
+	range_serializer(ECSerializer *sink, size_t offset, size_t length) :
+		m_sink(sink), m_skip(offset), m_left(length)
+	{}
+	virtual ECRESULT SetBuffer(void *) override { return KCERR_NO_SUPPORT; }
+	virtual ECRESULT Read(void *, size_t, size_t) override { return KCERR_NO_SUPPORT; }
+	virtual ECRESULT Skip(size_t, size_t) override { return KCERR_NO_SUPPORT; }
+	virtual ECRESULT Flush() override { return m_sink->Flush(); }
+	virtual ECRESULT Stat(ULONG *rd, ULONG *wr) override { return m_sink->Stat(rd, wr); }
+	virtual ECRESULT Write(const void *ptr, size_t size, size_t nmemb) override
+	{
+		auto buf = static_cast<const char *>(ptr);
+		size_t len = size * nmemb;
+		auto sk = std::min(len, m_skip);
+		m_skip -= sk;
+		buf += sk;
+		len = std::min(len - sk, m_left);
+		if (len == 0)
+			return erSuccess;
+		auto er = m_sink->Write(buf, 1, len);
+		if (er != erSuccess)
+			return er;
+		m_left -= len;
+		m_written += len;
+		return erSuccess;
+	}
+	size_t written() const { return m_written; }
+
+	private:
+	ECSerializer *m_sink;
+	size_t m_skip, m_left, m_written = 0;
+};
+
+/**
+ * Load a byte range of an instance into a serializer. Storage backends which
+ * can seek (or issue ranged requests) should override this; the generic
+ * version streams the whole instance and discards what lies outside the
+ * range, so memory use stays at the backend's own chunk size.
+ */
+ECRESULT ECAttachmentStorage::LoadAttachmentInstanceRange(const ext_siid &ins,
+    size_t offset, size_t length, size_t *written, ECSerializer *sink)
+{
+	range_serializer rs(sink, offset, length);
+	size_t total = 0;
+	auto er = LoadAttachmentInstance(ins, &total, &rs);
+	*written = rs.written();
+	return er;
+}
+
 /**
  * Save a property of a specific object from a given blob, optionally remove previous data.
  *
@@ -849,10 +932,12 @@ ECRESULT ECAttachmentStorage::DeleteAttachment(ULONG ulObjId, ULONG ulPropId)
  * @param[in] ulObjId HierarchyID of object
  * @param[in] ulPropId PropertyID of object
  * @param[out] lpulSize size of property
+ * @param[out] exact (optional) the size is exact, not just an estimate
  *
  * @return Kopano error code
  */
-ECRESULT ECAttachmentStorage::GetSize(ULONG ulObjId, ULONG ulPropId, size_t *lpulSize)
+ECRESULT ECAttachmentStorage::GetSize(ULONG ulObjId, ULONG ulPropId,
+    size_t *lpulSize, bool *exact)
 {
 	ext_siid ulInstanceId;
 	/*
@@ -861,13 +946,25 @@ ECRESULT ECAttachmentStorage::GetSize(ULONG ulObjId, ULONG ulPropId, size_t *lpu
 	auto er = GetSingleInstanceId(ulObjId, ulPropId, &ulInstanceId);
 	if (er == KCERR_NOT_FOUND) {
 		*lpulSize = 0;
+		if (exact != nullptr)
+			*exact = true;
 		return erSuccess;
 	} else if (er != erSuccess) {
 		return er;
 	}
+	if (exact != nullptr)
+		return GetExactSizeInstance(ulInstanceId, lpulSize, exact);
 	return GetSizeInstance(ulInstanceId, lpulSize);
 }
 
+/* Backends whose GetSizeInstance is always exact need not override this */
+ECRESULT ECAttachmentStorage::GetExactSizeInstance(const ext_siid &ins,
+    size_t *size, bool *exact)
+{
+	*exact = true;
+	return GetSizeInstance(ins, size);
+}
+
 // Attachment storage is in database
 ECDatabaseAttachment::ECDatabaseAttachment(ECDatabase *lpDatabase) :
 	ECAttachmentStorage(lpDatabase, 0)
@@ -1121,9 +1218,11 @@ ECRESULT ECDatabaseAttachment::Rollback()
 // Attachment storage is in separate files
 ECFileAttachment::ECFileAttachment(ECDatabase *lpDatabase,
     const std::string &basepath, unsigned int ulCompressionLevel,
-    unsigned int l1, unsigned int l2, bool sync_to_disk) :
+    unsigned int l1, unsigned int l2, bool sync_to_disk, zcodec codec,
+    unsigned int compr_threads) :
 	ECAttachmentStorage(lpDatabase, ulCompressionLevel),
-	m_basepath(basepath), m_l1(l1), m_l2(l2)
+	m_basepath(basepath), m_codec(codec), m_comp_threads(compr_threads),
+	m_l1(l1), m_l2(l2)
 {
 	if (m_basepath.empty()) {
 		m_basepath = "/var/lib/kopano";
@@ -1148,97 +1247,6 @@ ECFileAttachment::~ECFileAttachment()
 	assert(!m_bTransaction);
 }
 
-/**
- * @uclen:	number of uncompressed bytes that is requested
- */
-static ssize_t gzread_retry(gzFile fp, void *data, size_t uclen)
-{
-	ssize_t read_total = 0;
-	auto buf = static_cast<char *>(data);
-
-	if (uclen == 0)
-		/* Avoid useless churn. */
-		return 0;
-
-	while (uclen > 0) {
-		auto chunk_size = std::min(uclen, static_cast<size_t>(INT_MAX));
-		int ret = gzread(fp, buf, chunk_size);
-
-		/*
-		 * Save @errno now, since gzerror() code looks prone to
-		 * reset it.
-		 */
-		int saved_errno = errno, zerror;
-		const char *zerrstr = gzerror(fp, &zerror);
-
-		if (ret < 0 && zerror == Z_ERRNO &&
-		    (saved_errno == EINTR || saved_errno == EAGAIN))
-			/* Server delay (cf. gzread_write) */
-			continue;
-		if (ret < 0 && zerror == Z_ERRNO) {
-			ec_log_err("gzread: %s (%d): %s",
-			         zerrstr, zerror, strerror(saved_errno));
-			return ret;
-		}
-		if (ret < 0) {
-			ec_log_err("gzread: %s (%d)", zerrstr, zerror);
-			return ret;
-		}
-		if (ret == 0)
-			/*
-			 * EOF (since we already excluded chunk_size==0
-			 * requests).
-			 */
-			break;
-		buf += ret;
-		read_total += ret;
-		uclen -= ret;
-	}
-	return read_total;
-}
-
-static ssize_t gzwrite_retry(gzFile fp, const void *data, size_t uclen)
-{
-	size_t wrote_total = 0;
-	auto buf = static_cast<const char *>(data);
-
-	if (uclen == 0)
-		/* Avoid useless churn. */
-		return 0;
-
-	while (uclen > 0) {
-		auto chunk_size = std::min(uclen, static_cast<size_t>(INT_MAX));
-		int ret = gzwrite(fp, buf, chunk_size);
-		int saved_errno = errno, zerror;
-		const char *zerrstr = gzerror(fp, &zerror);
-
-		if (ret < 0 && zerror == Z_ERRNO &&
-		    (saved_errno == EINTR || saved_errno == EAGAIN))
-			/*
-			 * Choosing to continue reading can delay server
-			 * shutdown... but we are in a soap handler, so
-			 * whatelse could we do.
-			 */
-			continue;
-		if (ret < 0 && zerror == Z_ERRNO) {
-			ec_log_err("gzwrite: %s (%d): %s",
-			         zerrstr, zerror, strerror(saved_errno));
-			return ret;
-		}
-		if (ret < 0) {
-			ec_log_err("gzwrite: %s (%d)", zerrstr, zerror);
-			return ret;
-		}
-		if (ret == 0)
-			/* ??? - could happen if the file is not open for write */
-			break;
-		buf += ret;
-		wrote_total += ret;
-		uclen -= ret;
-	}
-	return wrote_total;
-}
-
 bool ECFileAttachment::VerifyInstanceSize(const ext_siid &instanceId,
     const size_t expectedSize, const std::string &filename)
 {
@@ -1260,23 +1268,18 @@ bool ECFileAttachment::VerifyInstanceSize(const ext_siid &instanceId,
 }
 
 ECRESULT ECFileAttachment::load_instance_z(struct soap *soap,
-    const ext_siid &ulInstanceId, int &fd, const std::string &filename,
+    const ext_siid &ulInstanceId, int fd, const std::string &filename,
     size_t *lpiSize, unsigned char **lppData)
 {
 	std::unique_ptr<unsigned char[]> temp;
-	gz_ptr gzfp(fd, "rb");
-	if (!gzfp) {
+	auto zr = zreader::open(fd);
+	if (zr == nullptr) {
 		// do not use KCERR_NOT_FOUND: the file is already open so it exists
 		// so something else is going wrong here
-		ec_log_err("ECFileAttachment::LoadAttachmentInstance(SOAP): cannot gzopen attachment \"%s\": %s", filename.c_str(), strerror(errno));
+		ec_log_err("ECFileAttachment::LoadAttachmentInstance(SOAP): cannot decompress attachment \"%s\"", filename.c_str());
 		return KCERR_UNKNOWN;
 	}
 
-#if ZLIB_VERNUM >= 0x1240
-	if (gzbuffer(gzfp, ZLIB_BUFFER_SIZE) == -1)
-		ec_log_warn("gzbuffer failed");
-#endif
-
 	size_t memory_block_size = 0;
 
 	for (;;)
@@ -1300,10 +1303,10 @@ ECRESULT ECFileAttachment::load_instance_z(struct soap *soap,
 			temp.reset(new_temp);
 		}
 
-		ret = gzread_retry(gzfp, &temp[*lpiSize], memory_block_size - *lpiSize);
+		ret = zr->read(&temp[*lpiSize], memory_block_size - *lpiSize);
 
 		if (ret < 0) {
-			ec_log_err("ECFileAttachment::LoadAttachmentInstance(SOAP): Error while gzreading attachment data from \"%s\"", filename.c_str());
+			ec_log_err("ECFileAttachment::LoadAttachmentInstance(SOAP): Error while decompressing attachment data from \"%s\"", filename.c_str());
 			//return KCERR_DATABASE_ERROR;
 			*lpiSize = 0;
 			break;
@@ -1456,21 +1459,16 @@ ECRESULT ECFileAttachment::LoadAttachmentInstance(const ext_siid &ulInstanceId,
 
 	if (bCompressed) {
 		/* Compressed attachment */
-		gz_ptr gzfp(fd, "rb");
-		if (!gzfp) {
+		auto zr = zreader::open(fd);
+		if (zr == nullptr) {
 			er = KCERR_UNKNOWN;
 			goto exit;
 		}
 
-#if ZLIB_VERNUM >= 0x1240
-		if (gzbuffer(gzfp, ZLIB_BUFFER_SIZE) == -1)
-			ec_log_warn("gzbuffer failed");
-#endif
-
 		for(;;) {
-			ssize_t lReadNow = gzread_retry(gzfp, buffer.get(), CHUNK_SIZE);
+			ssize_t lReadNow = zr->read(buffer.get(), CHUNK_SIZE);
 			if (lReadNow < 0) {
-				ec_log_err("ECFileAttachment::LoadAttachmentInstance(): Error while gzreading attachment data from \"%s\".", filename.c_str());
+				ec_log_err("ECFileAttachment::LoadAttachmentInstance(): Error while decompressing attachment data from \"%s\".", filename.c_str());
 				er = KCERR_DATABASE_ERROR;
 				goto exit;
 			}
@@ -1598,23 +1596,19 @@ ECRESULT ECFileAttachment::save_instance_data(const std::string &filename, int f
 
 	// no need to remove the file, just overwrite it
 	if (compressAttachment) {
-		gz_ptr gzfp(fd, ("wb" + m_CompressionLevel).c_str());
-		if (!gzfp) {
-			ec_log_err("Unable to gzopen attachment \"%s\" for writing: %s", filename.c_str(), strerror(errno));
+		auto zw = zwriter::create(fd, m_codec, m_CompressionLevel, m_comp_threads);
+		if (zw == nullptr) {
 			er = KCERR_DATABASE_ERROR;
 			goto exit;
 		}
-
-		ssize_t iWritten = gzwrite_retry(gzfp, lpData, iSize);
-		if (iWritten != static_cast<ssize_t>(iSize)) {
-			ec_log_err("Unable to gzwrite %zu bytes to attachment \"%s\", returned %zd.",
-				iSize, filename.c_str(), iWritten);
-			er = KCERR_DATABASE_ERROR;
+		er = zw->write(lpData, iSize);
+		if (er == erSuccess)
+			er = zw->finish();
+		if (er != erSuccess) {
+			ec_log_err("Unable to write %zu bytes (%s) to attachment \"%s\".",
+				iSize, zcodec_name(m_codec), filename.c_str());
 			goto exit;
 		}
-		auto ret = gzfp.close();
-		if (ret != Z_OK)
-			er = KCERR_DATABASE_ERROR;
 	}
 	else {
 		give_filesize_hint(fd, iSize);
@@ -1677,10 +1671,8 @@ ECRESULT ECFileAttachment::SaveAttachmentInstance(ext_siid &ulInstanceId,
 
 	//no need to remove the file, just overwrite it
 	if (m_bFileCompression) {
-		gz_ptr gzfp(fd, ("wb" + m_CompressionLevel).c_str());
-		if (!gzfp) {
-			ec_log_err("Unable to gzdopen attachment \"%s\" for writing: %s",
-				filename.c_str(), strerror(errno));
+		auto zw = zwriter::create(fd, m_codec, m_CompressionLevel, m_comp_threads);
+		if (zw == nullptr) {
 			er = KCERR_DATABASE_ERROR;
 			goto exit;
 		}
@@ -1699,11 +1691,10 @@ ECRESULT ECFileAttachment::SaveAttachmentInstance(ext_siid &ulInstanceId,
 				break;
 			}
 
-			ssize_t iWritten = gzwrite_retry(gzfp, szBuffer.get(), iChunkSize);
-			if (iWritten != static_cast<ssize_t>(iChunkSize)) {
-				ec_log_err("Unable to gzwrite %zu bytes to attachment \"%s\", returned %zd",
-					iChunkSize, filename.c_str(), iWritten);
-				er = KCERR_DATABASE_ERROR;
+			er = zw->write(szBuffer.get(), iChunkSize);
+			if (er != erSuccess) {
+				ec_log_err("Unable to write %zu bytes (%s) to attachment \"%s\"",
+					iChunkSize, zcodec_name(m_codec), filename.c_str());
 				break;
 			}
 
@@ -1711,23 +1702,14 @@ ECRESULT ECFileAttachment::SaveAttachmentInstance(ext_siid &ulInstanceId,
 		}
 
 		if (er == erSuccess) {
-			if (gzflush(gzfp, 0)) {
-				int saved_errno = errno, zerror;
-				const char *zstrerr = gzerror(gzfp, &zerror);
-				ec_log_err("gzflush failed: %s (%d)", zstrerr, zerror);
-				if (zerror == Z_ERRNO)
-					ec_log_err("gzflush failed: stdio says: %s", strerror(saved_errno));
-				er = KCERR_DATABASE_ERROR;
-			}
-
-			if (force_changes_to_disk && !force_buffers_to_disk(fd)) {
+			er = zw->finish();
+			if (er != erSuccess)
+				ec_log_err("Unable to finish writing attachment \"%s\"", filename.c_str());
+			else if (force_changes_to_disk && !force_buffers_to_disk(fd)) {
 				ec_log_warn("Problem syncing file \"%s\": %s", filename.c_str(), strerror(errno));
 				er = KCERR_DATABASE_ERROR;
 			}
 		}
-		auto ret = gzfp.close();
-		if (ret != Z_OK)
-			er = KCERR_DATABASE_ERROR;
 	}
 	else {
 		give_filesize_hint(fd, iSize);
@@ -1931,7 +1913,8 @@ ECRESULT ECFileAttachment::DeleteAttachmentInstance(const ext_siid &ulInstanceId
  * Return a filename for an instance id
  *
  * @param[in] ulInstanceId instance id to convert to a filename
- * @param[in] bCompressed add compression marker to filename
+ * @param[in] bCompressed add compression marker to filename (".gz"
+ * regardless of the codec; readers go by the file contents)
  *
  * @return Kopano error code
  */
@@ -1957,6 +1940,18 @@ std::string ECFileAttachment::CreateAttachmentFilename(const ext_siid &esid, boo
  */
 ECRESULT ECFileAttachment::GetSizeInstance(const ext_siid &ulInstanceId,
     size_t *lpulSize, bool *lpbCompressed)
+{
+	return size_instance(ulInstanceId, lpulSize, lpbCompressed, nullptr);
+}
+
+ECRESULT ECFileAttachment::GetExactSizeInstance(const ext_siid &ulInstanceId,
+    size_t *lpulSize, bool *exact)
+{
+	return size_instance(ulInstanceId, lpulSize, nullptr, exact);
+}
+
+ECRESULT ECFileAttachment::size_instance(const ext_siid &ulInstanceId,
+    size_t *lpulSize, bool *lpbCompressed, bool *exact)
 {
 	ECRESULT er = erSuccess;
 	auto filename = CreateAttachmentFilename(ulInstanceId, m_bFileCompression);
@@ -1964,15 +1959,16 @@ ECRESULT ECFileAttachment::GetSizeInstance(const ext_siid &ulInstanceId,
 	struct stat st;
 
 	/*
-	 * We are always going to use the normal FILE handler for determining the file size,
-	 * the gzFile handler is broken since it doesn't support SEEK_END and gzseek itself
-	 * is very slow. When the attachment has been zipped, we are going to read the
-	 * last 4 bytes of the file, which contain the uncompressed filesize
-	 * (provided that there is a single gzip stream).
+	 * Compressed files carry their uncompressed size in a trailer: the
+	 * last 4 bytes of a (single-stream) gzip file, or the size frame that
+	 * zwriter appends to zstd/lz4 files. zcodec_size only decompresses
+	 * files without one (such as KC-104 multi-stream gzip files).
 	 *
 	 * For uncompressed files we use fstat() which is the fastest as the inode is already
 	 * in memory due to the earlier open().
 	 */
+	if (exact != nullptr)
+		*exact = false;
 	int fd = open(filename.c_str(), O_RDONLY);
 	if (fd == -1) {
 		filename = CreateAttachmentFilename(ulInstanceId, !m_bFileCompression);
@@ -1995,27 +1991,16 @@ ECRESULT ECFileAttachment::GetSizeInstance(const ext_siid &ulInstanceId,
 
 	if (!bCompressed) {
 		*lpulSize = st.st_size;
+		if (exact != nullptr)
+			*exact = true;
 	} else if (st.st_size >= 4) {
 		/* Compressed attachment */
-		// a compressed file of only 4 bytes does not exist so we could
-		// make this minimum size bigger
-		if (lseek(fd, -4, SEEK_END) == -1) {
-			ec_log_err("ECFileAttachment::GetSizeInstance(): file \"%s\" fseek (compressed file) failed: %s", filename.c_str(), strerror(errno));
+		uint64_t atsize = 0;
+		if (zcodec_size(fd, &atsize, exact) != erSuccess) {
+			ec_log_err("ECFileAttachment::GetSizeInstance(): cannot determine size of \"%s\"", filename.c_str());
 			// FIXME er = KCERR_DATABASE_ERROR;
 			goto exit;
 		}
-		// FIXME endianness
-		uint32_t atsize;
-		if (read_retry(fd, &atsize, 4) != 4) {
-			ec_log_err("ECFileAttachment::GetSizeInstance(): file \"%s\" fread failed: %s", filename.c_str(), strerror(errno));
-			// FIXME er = KCERR_DATABASE_ERROR;
-			goto exit;
-		}
-		if (st.st_size >= 40 && atsize == 0) {
-			ec_log_warn("ECFileAttachment: %s seems to be an unsupported multi-stream gzip file (KC-104).", filename.c_str());
-			//er = KCERR_DATABASE_ERROR;
-			goto exit;
-		}
 		*lpulSize = atsize;
 	} else {
 		*lpulSize = 0;
@@ -2117,6 +2102,15 @@ ECFileAttachmentConfig2::ECFileAttachmentConfig2(const GUID &g) :
 	m_server_guid(strToLower(bin2hex(sizeof(g), &g)))
 {}
 
+ECRESULT ECFileAttachmentConfig2::init(std::shared_ptr<ECConfig> config)
+{
+	auto ret = ECFileAttachmentConfig::init(config);
+	if (ret != erSuccess)
+		return ret;
+	m_chunking = parseBool(config->GetSetting("attachment_files_chunking"));
+	return erSuccess;
+}
+
 ECAttachmentStorage *ECFileAttachmentConfig2::new_handle(ECDatabase *db)
 {
 	return new(std::nothrow) ECFileAttachment2(*this, db, m_dir, m_sync_files);
@@ -2124,9 +2118,77 @@ ECAttachmentStorage *ECFileAttachmentConfig2::new_handle(ECDatabase *db)
 
 ECFileAttachment2::ECFileAttachment2(ECFileAttachmentConfig2 &acf,
     ECDatabase *db, const std::string &basepath, bool sync) :
-	ECFileAttachment(db, basepath, 0, 0, 0, sync), m_config(acf)
+	ECFileAttachment(db, basepath, 0, 0, 0, sync), m_config(acf),
+	m_chunks(basepath + "/chunks", sync)
 {}
 
+/*
+ * Chunked instances:
+ *
+ * With attachment_files_chunking, an instance directory holds a "manifest"
+ * instead of "content": the list of content-defined chunks the data
+ * consists of. Chunks are kept in a cdc_store under <basepath>/chunks, and
+ * the instance holds one reference on each of them, named after the S-type
+ * ident of the upload. That name is unique even when two uploads of the
+ * same data race, so the loser can drop its references without touching
+ * the winner's. Small attachments (at most one chunk) are always stored
+ * whole; both formats can be read regardless of the setting.
+ */
+bool ECFileAttachment2::use_chunks(size_t dsize) const
+{
+	return m_config.m_chunking && dsize > m_config.m_chunker.max_size();
+}
+
+std::string ECFileAttachment2::holder_name(const ext_siid &i) const
+{
+	return "s" + m_config.m_server_guid + "i" + stringify(i.siid);
+}
+
+ECRESULT ECFileAttachment2::load_manifest(const std::string &dir,
+    cdc_manifest *m) const
+{
+	auto file = dir + "/manifest";
+	std::unique_ptr<FILE, file_deleter> fp(fopen(file.c_str(), "r"));
+	if (fp == nullptr)
+		return errno == ENOENT ? KCERR_NOT_FOUND : KCERR_NO_ACCESS;
+	std::string buf;
+	if (HrMapFileToString(fp.get(), &buf) != hrSuccess || !m->parse(buf)) {
+		ec_log_err("K-1299: \"%s\": invalid manifest", file.c_str());
+		return KCERR_DATABASE_ERROR;
+	}
+	return erSuccess;
+}
+
+ECRESULT ECFileAttachment2::save_manifest(const std::string &dir,
+    const cdc_manifest &m)
+{
+	auto file = dir + "/manifest";
+	auto buf = m.format();
+	int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWUG);
+	if (fd < 0) {
+		ec_log_err("K-1278: open \"%s\": %s", file.c_str(), strerror(errno));
+		return KCERR_DATABASE_ERROR;
+	}
+	if (write_retry(fd, buf.c_str(), buf.size()) != static_cast<ssize_t>(buf.size()) ||
+	    (force_changes_to_disk && !force_buffers_to_disk(fd))) {
+		ec_log_err("K-1277: write \"%s\": %s", file.c_str(), strerror(errno));
+		close(fd);
+		unlink(file.c_str());
+		return KCERR_DATABASE_ERROR;
+	}
+	close(fd);
+	return erSuccess;
+}
+
+/* Remove an upload directory that did not make it into place */
+void ECFileAttachment2::discard_upload(const std::string &dir)
+{
+	cdc_manifest m;
+	if (load_manifest(dir, &m) == erSuccess)
+		m_chunks.release(m);
+	HX_rrmdir(dir.c_str());
+}
+
 ECRESULT ECFileAttachment2::SaveAttachmentInstance(ext_siid &instance,
     ULONG propid, size_t dsize, unsigned char *data)
 {
@@ -2137,7 +2199,7 @@ ECRESULT ECFileAttachment2::SaveAttachmentInstance(ext_siid &instance,
 	int retries  = 3;
 	auto cleanup = make_scope_success([&]() {
 		if (uploaded)
-			HX_rrmdir(sl.base_dir.c_str());
+			discard_upload(sl.base_dir);
 	});
 
 	do {
@@ -2167,16 +2229,30 @@ ECRESULT ECFileAttachment2::SaveAttachmentInstance(ext_siid &instance,
 				ec_log_err("K-1298: mkdir -p \"%s\": %s", sl.holder_dir.c_str(), GetMAPIErrorMessage(ret));
 				return KCERR_DATABASE_ERROR;
 			}
-			int fd = open(sl.content_file.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
-			if (fd < 0) {
-				ec_log_err("K-1297: open \"%s\": %s", sl.content_file.c_str(), strerror(errno));
-				return KCERR_DATABASE_ERROR;
-			}
-			ret = save_instance_data(sl.content_file, fd, propid, dsize, data, false); /* closes fd */
-			if (ret != erSuccess) {
-				ec_log_err("K-1296: save_instance_data \"%s\": %s", sl.content_file.c_str(), GetMAPIErrorMessage(ret));
-				close(fd);
-				return ret;
+			int fd;
+			if (use_chunks(dsize)) {
+				cdc_writer wr(m_chunks, m_config.m_chunker, holder_name(instance));
+				ret = wr.write(data, dsize);
+				if (ret == erSuccess)
+					ret = wr.finish();
+				if (ret == erSuccess)
+					ret = save_manifest(sl.base_dir, wr.manifest());
+				if (ret != erSuccess) {
+					wr.abort();
+					return ret;
+				}
+			} else {
+				fd = open(sl.content_file.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
+				if (fd < 0) {
+					ec_log_err("K-1297: open \"%s\": %s", sl.content_file.c_str(), strerror(errno));
+					return KCERR_DATABASE_ERROR;
+				}
+				ret = save_instance_data(sl.content_file, fd, propid, dsize, data, false); /* closes fd */
+				if (ret != erSuccess) {
+					ec_log_err("K-1296: save_instance_data \"%s\": %s", sl.content_file.c_str(), GetMAPIErrorMessage(ret));
+					close(fd);
+					return ret;
+				}
 			}
 			fd = open(sl.holder_ref.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
 			if (fd < 0) {
@@ -2226,8 +2302,9 @@ ECRESULT ECFileAttachment2::SaveAttachmentInstance(ext_siid &instance,
 	decltype(sl) hl;
 
 	/*
-	 * Data is just arriving. It is put into a file (lest it would have to
-	 * be held in memory) while the hash is being computed.
+	 * Data is just arriving. It is put into a file or the chunk store
+	 * (lest it would have to be held in memory) while the hash is being
+	 * computed.
 	 */
 	SHA256_CTX shactx;
 	SHA256_Init(&shactx);
@@ -2235,45 +2312,69 @@ ECRESULT ECFileAttachment2::SaveAttachmentInstance(ext_siid &instance,
 	bool uploaded = true;
 	auto cleanup = make_scope_success([&]() {
 		if (uploaded)
-			HX_rrmdir(sl.base_dir.c_str());
+			discard_upload(sl.base_dir);
 	});
 	auto ret = CreatePath(sl.holder_dir.c_str(), S_IRWXUG);
 	if (ret != 0 && errno != EEXIST) {
 		ec_log_err("K-1291: mkdir \"%s\": %s", sl.holder_dir.c_str(), strerror(errno));
 		return KCERR_DATABASE_ERROR;
 	}
-	int fd = open(sl.content_file.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
-	if (fd < 0) {
-		ec_log_err("K-1290: open \"%s\": %s", sl.content_file.c_str(), strerror(errno));
-		return KCERR_DATABASE_ERROR;
+
+	int cfd = -1;
+	std::unique_ptr<cdc_writer> cdw;
+	if (use_chunks(dsize)) {
+		cdw.reset(new cdc_writer(m_chunks, m_config.m_chunker, holder_name(instance)));
+	} else {
+		cfd = open(sl.content_file.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
+		if (cfd < 0) {
+			ec_log_err("K-1290: open \"%s\": %s", sl.content_file.c_str(), strerror(errno));
+			return KCERR_DATABASE_ERROR;
+		}
+		give_filesize_hint(cfd, dsize);
 	}
+	auto fdclose = make_scope_success([&]() {
+		if (cfd >= 0)
+			close(cfd);
+		if (cdw != nullptr)
+			cdw->abort();
+	});
 
-	give_filesize_hint(fd, dsize);
 	auto buffer = std::make_unique<char[]>(CHUNK_SIZE);
 	while (dsize > 0) {
 		size_t chunk_size = std::min(static_cast<size_t>(CHUNK_SIZE), dsize);
 		ret = src->Read(buffer.get(), 1, chunk_size);
-		if (ret != erSuccess) {
-			close(fd);
+		if (ret != erSuccess)
 			return ret;
-		}
 		SHA256_Update(&shactx, buffer.get(), chunk_size);
-		ssize_t did_write = write_retry(fd, buffer.get(), chunk_size);
-		if (did_write != static_cast<ssize_t>(chunk_size)) {
+		if (cdw != nullptr) {
+			ret = cdw->write(buffer.get(), chunk_size);
+			if (ret != erSuccess)
+				return ret;
+		} else if (write_retry(cfd, buffer.get(), chunk_size) != static_cast<ssize_t>(chunk_size)) {
 			ec_log_err("K-1289: Unable to write bytes to attachment \"%s\": %s.",
 				sl.content_file.c_str(), strerror(errno));
-			close(fd);
 			return KCERR_DATABASE_ERROR;
 		}
 		dsize -= chunk_size;
 	}
 
-	close(fd);
+	if (cdw != nullptr) {
+		ret = cdw->finish();
+		if (ret == erSuccess)
+			ret = save_manifest(sl.base_dir, cdw->manifest());
+		if (ret != erSuccess)
+			return ret;
+		/* From here on, the manifest owns the references */
+		cdw.reset();
+	} else {
+		close(cfd);
+		cfd = -1;
+	}
 	unsigned char shasum[SHA256_DIGEST_LENGTH];
 	SHA256_Final(shasum, &shactx);
 	instance.filename = uas_md_to_ident(std::string(reinterpret_cast<char *>(shasum), sizeof(shasum)));
 	hl = uas_hash_layout(m_basepath, m_config.m_server_guid, instance);
-	fd = open(sl.holder_ref.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
+	int fd = open(sl.holder_ref.c_str(), O_WRONLY | O_CREAT, S_IRWUG);
 	if (fd < 0) {
 		ec_log_err("K-1288: open \"%s\": %s", sl.holder_ref.c_str(), strerror(errno));
 		return KCERR_DATABASE_ERROR;
@@ -2327,8 +2428,12 @@ ECRESULT ECFileAttachment2::GetSizeInstance(const ext_siid &inst,
 	auto content_file = m_basepath + "/" + inst.filename + "/content";
 	struct stat sb;
 	auto ret = stat(content_file.c_str(), &sb);
-	if (ret != 0)
-		return KCERR_DATABASE_ERROR;
+	if (ret != 0) {
+		cdc_manifest m;
+		if (errno != ENOENT || load_manifest(m_basepath + "/" + inst.filename, &m) != erSuccess)
+			return KCERR_DATABASE_ERROR;
+		sb.st_size = m.size;
+	}
 	if (size != nullptr)
 		*size = sb.st_size;
 	if (comp != nullptr)
@@ -2356,6 +2461,9 @@ ECRESULT ECFileAttachment2::DeleteAttachmentInstance(const ext_siid &i, bool rep
 			ec_log_err("K-1288: rmdir \"%s\": %s", hl.holder_dir.c_str(), strerror(errno));
 		return erSuccess;
 	}
+	cdc_manifest m;
+	if (load_manifest(hl.base_dir, &m) == erSuccess)
+		m_chunks.release(m);
 	HX_rrmdir(hl.base_dir.c_str());
 	return erSuccess;
 }
@@ -2366,7 +2474,24 @@ ECRESULT ECFileAttachment2::LoadAttachmentInstance(struct soap *soap,
 	*dsize = 0;
 	auto ctf = m_basepath + "/" + instance.filename.c_str() + "/content";
 	int fd = open(ctf.c_str(), O_RDONLY);
-	if (fd < 0) {
+	if (fd < 0 && errno == ENOENT) {
+		cdc_manifest m;
+		auto ret = load_manifest(m_basepath + "/" + instance.filename, &m);
+		if (ret != erSuccess)
+			return ret == KCERR_NOT_FOUND ? KCERR_NO_ACCESS : ret;
+		*data = soap_new_unsignedByte(soap, m.size);
+		if (*data == nullptr)
+			return KCERR_NOT_ENOUGH_MEMORY;
+		size_t off = 0;
+		for (const auto &c : m.chunks) {
+			ret = m_chunks.get(c.md, *data + off, c.size);
+			if (ret != erSuccess)
+				return ret;
+			off += c.size;
+		}
+		*dsize = off;
+		return erSuccess;
+	} else if (fd < 0) {
 		ec_log_err("K-1286: open \"%s\": %s", ctf.c_str(), strerror(errno));
 		return KCERR_NO_ACCESS;
 	}
@@ -2403,7 +2528,23 @@ ECRESULT ECFileAttachment2::LoadAttachmentInstance(const ext_siid &instance,
 	auto ctf = m_basepath + "/" + instance.filename.c_str() + "/content";
 	int fd = open(ctf.c_str(), O_RDONLY);
 	if (fd < 0 && errno == ENOENT) {
-		return KCERR_NOT_FOUND;
+		cdc_manifest m;
+		auto ret = load_manifest(m_basepath + "/" + instance.filename, &m);
+		if (ret != erSuccess)
+			return ret;
+		size_t bufsize = 0;
+		for (const auto &c : m.chunks)
+			bufsize = std::max(bufsize, c.size);
+		auto buffer = std::make_unique<char[]>(bufsize);
+		for (const auto &c : m.chunks) {
+			ret = m_chunks.get(c.md, buffer.get(), c.size);
+			if (ret == erSuccess)
+				ret = sink->Write(buffer.get(), 1, c.size);
+			if (ret != erSuccess)
+				return ret;
+			*dsize += c.size;
+		}
+		return erSuccess;
 	} else if (fd < 0) {
 		/* Access problems */
 		ec_log_err("K-1286: open \"%s\": %s", ctf.c_str(), strerror(errno));
@@ -47,12 +47,13 @@ public:
 	bool ExistAttachmentInstance(unsigned int ins_id, ext_siid &out);
 	ECRESULT LoadAttachment(struct soap *soap, ULONG ulObjId, ULONG ulPropId, size_t *lpiSize, unsigned char **lppData);
 	ECRESULT LoadAttachment(ULONG ulObjId, ULONG ulPropId, size_t *lpiSize, ECSerializer *lpSink);
+	ECRESULT LoadAttachmentRange(ULONG ulObjId, ULONG ulPropId, size_t offset, size_t length, size_t *written, ECSerializer *lpSink);
 	ECRESULT SaveAttachment(ULONG ulObjId, ULONG ulPropId, bool bDeleteOld, size_t iSize, unsigned char *lpData, ULONG *lpulInstanceId);
 	ECRESULT SaveAttachment(ULONG ulObjId, ULONG ulPropId, bool bDeleteOld, size_t iSize, ECSerializer *lpSource, ULONG *lpulInstanceId);
 	ECRESULT SaveAttachment(ULONG ulObjId, ULONG ulPropId, bool bDeleteOld, ULONG ulInstanceId, ULONG *lpulInstanceId);
 	ECRESULT CopyAttachment(ULONG ulObjId, ULONG ulNewObjId);
 	ECRESULT DeleteAttachments(const std::list<ULONG> &lstDeleteObjects);
-	ECRESULT GetSize(ULONG ulObjId, ULONG ulPropId, size_t *lpulSize);
+	ECRESULT GetSize(ULONG ulObjId, ULONG ulPropId, size_t *lpulSize, bool *exact = nullptr);
 
 	/* Convert ObjectId (hierarchyid) into Instance Id */
 	ECRESULT GetSingleInstanceId(ULONG ulObjId, ULONG ulPropId, ext_siid *);
@@ -67,11 +68,15 @@ protected:
 	/* Single Instance Attachment handlers (must be overridden by subclasses) */
 	virtual ECRESULT LoadAttachmentInstance(struct soap *, const ext_siid &, size_t *size, unsigned char **data) = 0;
 	virtual ECRESULT LoadAttachmentInstance(const ext_siid &, size_t *size, ECSerializer *sink) = 0;
+	/* Optional: the default implementation filters a full sequential load */
+	virtual ECRESULT LoadAttachmentInstanceRange(const ext_siid &, size_t offset, size_t length, size_t *written, ECSerializer *sink);
 	virtual ECRESULT SaveAttachmentInstance(ext_siid &, ULONG propid, size_t, unsigned char *) = 0;
 	virtual ECRESULT SaveAttachmentInstance(ext_siid &, ULONG propid, size_t, ECSerializer *) = 0;
 	virtual ECRESULT DeleteAttachmentInstances(const std::list<ext_siid> &, bool replace) = 0;
 	virtual ECRESULT DeleteAttachmentInstance(const ext_siid &, bool replace) = 0;
 	virtual ECRESULT GetSizeInstance(const ext_siid &, size_t *size, bool *comp = nullptr) = 0;
+	/* Like GetSizeInstance; @exact is false if the size may be off (and must not be trusted for streaming) */
+	virtual ECRESULT GetExactSizeInstance(const ext_siid &, size_t *size, bool *exact);
 
 private:
 	/* Count the number of times an attachment is referenced */
@@ -82,7 +87,7 @@ private:
 protected:
 	ECDatabase *m_lpDatabase;
 	bool m_bFileCompression;
-	std::string m_CompressionLevel;
+	unsigned int m_CompressionLevel;
 };
 
 class KC_EXPORT_DYCAST ECDatabaseAttachment final :
@@ -0,0 +1,131 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <string>
+#include <cstdint>
+#include <kopano/kcodes.h>
+#include <kopano/stringutil.h>
+#include "soapH.h"
+#include "soapKCmdService.h"
+#include "BinaryRPC.h"
+#include "ECServerEntrypoint.h"
+#include "ECSessionManager.h"
+
+namespace KC {
+
+static int binrpc_tablequeryrows(KCmdService &svc, ULONG64 sid,
+    ECBinarySerializer &req, ECBinarySerializer &rsp)
+{
+	unsigned int table, count, flags;
+	if (req.Read(&table, sizeof(table), 1) != erSuccess ||
+	    req.Read(&count, sizeof(count), 1) != erSuccess ||
+	    req.Read(&flags, sizeof(flags), 1) != erSuccess)
+		return SOAP_TYPE;
+
+	struct tableQueryRowsResponse r;
+	soap_default_tableQueryRowsResponse(svc.soap, &r);
+	auto err = svc.tableQueryRows(sid, table, count, flags, &r);
+	if (err != SOAP_OK)
+		return err;
+	rsp.Write(&r.er, sizeof(r.er), 1);
+	if (r.er == erSuccess)
+		BinSerialize(&rsp, r.sRowSet);
+	return SOAP_OK;
+}
+
+static int binrpc_loadobject(KCmdService &svc, ULONG64 sid,
+    ECBinarySerializer &req, ECBinarySerializer &rsp)
+{
+	entryId eid;
+	struct notifySubscribe *ns = nullptr;
+	unsigned int flags;
+	if (BinDeserialize(svc.soap, &req, &eid) != erSuccess ||
+	    BinDeserialize(svc.soap, &req, &ns) != erSuccess ||
+	    req.Read(&flags, sizeof(flags), 1) != erSuccess)
+		return SOAP_TYPE;
+
+	struct loadObjectResponse r;
+	soap_default_loadObjectResponse(svc.soap, &r);
+	auto err = svc.loadObject(sid, eid, ns, flags, &r);
+	if (err != SOAP_OK)
+		return err;
+	rsp.Write(&r.er, sizeof(r.er), 1);
+	if (r.er == erSuccess)
+		BinSerialize(&rsp, r.sSaveObject);
+	return SOAP_OK;
+}
+
+static int binrpc_getidsfromnames(KCmdService &svc, ULONG64 sid,
+    ECBinarySerializer &req, ECBinarySerializer &rsp)
+{
+	struct namedPropArray names;
+	unsigned int flags;
+	if (BinDeserialize(svc.soap, &req, &names) != erSuccess ||
+	    req.Read(&flags, sizeof(flags), 1) != erSuccess)
+		return SOAP_TYPE;
+
+	struct getIDsFromNamesResponse r;
+	soap_default_getIDsFromNamesResponse(svc.soap, &r);
+	auto err = svc.getIDsFromNames(sid, &names, flags, &r);
+	if (err != SOAP_OK)
+		return err;
+	rsp.Write(&r.er, sizeof(r.er), 1);
+	if (r.er == erSuccess)
+		BinSerialize(&rsp, r.lpsPropTags);
+	return SOAP_OK;
+}
+
+/**
+ * Serves one binary RPC request (BinaryRPC.h) whose HTTP headers
+ * soap_begin_recv has read. The calls go to the same KCmdService methods
+ * that dispatch() would use for the SOAP encoding. Everything they
+ * allocate lives in @soap, like for SOAP requests. With enable_binary_rpc
+ * off, no request is run, also not from a client that got the capability
+ * before a reload.
+ *
+ * @return SOAP_OK or a soap error, for which the caller sends a fault
+ */
+int kopano_binrpc_serve(struct soap *soap)
+{
+	ECBinarySerializer req;
+	auto err = BinRPCRecv(soap, req);
+	if (err != SOAP_OK)
+		return err;
+	if (!parseBool(g_lpSessionManager->GetConfig()->GetSetting("enable_binary_rpc")))
+		return soap->error = SOAP_NO_METHOD;
+
+	uint32_t magic = 0, op = 0;
+	ULONG64 sid = 0;
+	if (req.Read(&magic, sizeof(magic), 1) != erSuccess ||
+	    magic != KC_BINRPC_MAGIC ||
+	    req.Read(&op, sizeof(op), 1) != erSuccess ||
+	    req.Read(&sid, sizeof(sid), 1) != erSuccess)
+		return soap->error = SOAP_TYPE;
+
+	KCmdService svc(soap);
+	std::string out;
+	ECBinarySerializer rsp(&out);
+	magic = KC_BINRPC_MAGIC;
+	rsp.Write(&magic, sizeof(magic), 1);
+	switch (op) {
+	case BINRPC_TABLEQUERYROWS:
+		err = binrpc_tablequeryrows(svc, sid, req, rsp);
+		break;
+	case BINRPC_LOADOBJECT:
+		err = binrpc_loadobject(svc, sid, req, rsp);
+		break;
+	case BINRPC_GETIDSFROMNAMES:
+		err = binrpc_getidsfromnames(svc, sid, req, rsp);
+		break;
+	default:
+		err = SOAP_NO_METHOD;
+		break;
+	}
+	if (err != SOAP_OK)
+		return soap->error = err;
+	return BinRPCReply(soap, out);
+}
+
+} /* namespace */
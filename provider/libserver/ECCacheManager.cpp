@@ -4,17 +4,25 @@
  */
 #include <kopano/platform.h>
 #include <chrono>
+#include <cerrno>
+#include <cstring>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <mapidefs.h>
 #include <mapitags.h>
 #include <kopano/MAPIErrors.h>
+#include <kopano/fileutil.hpp>
 #include "ECDatabase.h"
 #include "ECSessionManager.h"
 #include "ECDatabaseUtils.h"
@@ -38,6 +46,8 @@ using ECsUEIdKey = UEIdKey;
 using ECsUEIdObject = UEIdObject;
 using ECsUserObject = UserObject;
 using ECsUserObjectDetails = UserObjectDetails;
+using ECSharedLock = std::shared_lock<KC::shared_mutex>;
+using ECUniqueLock = std::unique_lock<KC::shared_mutex>;
 
 #define LOG_CACHE_DEBUG(msg, ...) \
 	ec_log(EC_LOGLEVEL_DEBUG | EC_LOGLEVEL_CACHE, "cache: " msg, ##__VA_ARGS__)
@@ -109,16 +119,18 @@ ECCacheManager::ECCacheManager(std::shared_ptr<ECConfig> lpConfig,
 	m_lpDatabaseFactory(lpDatabaseFactory),
 	m_QuotaCache("quota", atoi(lpConfig->GetSetting("cache_quota_size")), atoi(lpConfig->GetSetting("cache_quota_lifetime")) * 60)
 , m_QuotaUserDefaultCache("uquota", atoi(lpConfig->GetSetting("cache_quota_size")), atoi(lpConfig->GetSetting("cache_quota_lifetime")) * 60)
-, m_ObjectsCache("obj", atoll(lpConfig->GetSetting("cache_object_size")), 0)
-, m_StoresCache("store", atoi(lpConfig->GetSetting("cache_store_size")), 0)
+, m_ObjectsCache("obj", atoll(lpConfig->GetSetting("cache_object_size")), 0, atoui(lpConfig->GetSetting("cache_shards")))
+, m_StoresCache("store", atoi(lpConfig->GetSetting("cache_store_size")), 0, atoui(lpConfig->GetSetting("cache_shards")))
 , m_UserObjectCache("userid", atoi(lpConfig->GetSetting("cache_user_size")), atoi(lpConfig->GetSetting("cache_userdetails_lifetime")) * 60)
 , m_UEIdObjectCache("extern", atoi(lpConfig->GetSetting("cache_user_size")), atoi(lpConfig->GetSetting("cache_userdetails_lifetime")) * 60)
 , m_UserObjectDetailsCache("abinfo", atoi(lpConfig->GetSetting("cache_userdetails_size")), atoi(lpConfig->GetSetting("cache_userdetails_lifetime")) * 60)
-, m_AclCache("acl", atoi(lpConfig->GetSetting("cache_acl_size")), 0)
-, m_CellCache("cell", atoll(lpConfig->GetSetting("cache_cell_size")), 0)
+, m_AclCache("acl", atoi(lpConfig->GetSetting("cache_acl_size")), 0, atoui(lpConfig->GetSetting("cache_shards")))
+, m_CellCache("cell", atoll(lpConfig->GetSetting("cache_cell_size")), 0, atoui(lpConfig->GetSetting("cache_shards")))
+, m_ColumnCache(atoll(lpConfig->GetSetting("cache_column_size")))
 , m_ServerDetailsCache("server", atoi(lpConfig->GetSetting("cache_server_size")), atoi(lpConfig->GetSetting("cache_server_lifetime")) * 60)
 , m_PropToObjectCache("index1", atoll(lpConfig->GetSetting("cache_indexedobject_size")), 0)
 , m_ObjectToPropCache("index2", atoll(lpConfig->GetSetting("cache_indexedobject_size")), 0)
+, m_strSnapshotFile(lpConfig->GetSetting("cache_snapshot_file"))
 {
 	if (atoll(lpConfig->GetSetting("cache_cell_size")) == 0) {
 		#if defined(LINUX) || defined(OPENBSD)
@@ -179,28 +191,22 @@ ECRESULT ECCacheManager::PurgeCache(unsigned int ulFlags)
 		m_QuotaCache.ClearCache();
 	if (ulFlags & PURGE_CACHE_QUOTADEFAULT)
 		m_QuotaUserDefaultCache.ClearCache();
-	if (ulFlags & PURGE_CACHE_ACL)
-		m_AclCache.ClearCache();
 	l_cache.unlock();
 
-	ulock_rec l_object(m_hCacheObjectMutex);
+	/* Sharded caches lock each of their shards themselves */
+	if (ulFlags & PURGE_CACHE_ACL)
+		m_AclCache.ClearCache();
 	if (ulFlags & PURGE_CACHE_OBJECTS)
 		m_ObjectsCache.ClearCache();
-	l_object.unlock();
-
-	ulock_rec l_store(m_hCacheStoreMutex);
 	if (ulFlags & PURGE_CACHE_STORES)
 		m_StoresCache.ClearCache();
-	l_store.unlock();
-
-	// Cell cache mutex
-	ulock_rec l_cells(m_hCacheCellsMutex);
-	if(ulFlags & PURGE_CACHE_CELL)
+	if (ulFlags & PURGE_CACHE_CELL) {
 		m_CellCache.ClearCache();
-	l_cells.unlock();
+		m_ColumnCache.Clear();
+	}
 
 	// Indexed properties mutex
-	ulock_rec l_prop(m_hCacheIndPropMutex);
+	ECUniqueLock l_prop(m_hCacheIndPropMutex);
 	if (ulFlags & PURGE_CACHE_INDEX1)
 		m_PropToObjectCache.ClearCache();
 	if (ulFlags & PURGE_CACHE_INDEX2)
@@ -280,10 +286,11 @@ ECRESULT ECCacheManager::I_GetObject(unsigned int ulObjId,
     unsigned int *ulParent, unsigned int *ulOwner, unsigned int *ulFlags,
     unsigned int *ulType)
 {
-	ECsObjects	*sObject;
-	scoped_rlock lock(m_hCacheObjectMutex);
+	const ECsObjects *sObject;
+	auto &shard = m_ObjectsCache.get(ulObjId);
+	auto lock = m_ObjectsCache.read_lock(shard);
 
-	auto er = m_ObjectsCache.GetCacheItem(ulObjId, &sObject);
+	auto er = shard.cache.PeekCacheItem(ulObjId, &sObject);
 	if(er != erSuccess)
 		return er;
 	assert(sObject->ulType == MAPI_FOLDER || (sObject->ulFlags & ~(MSGFLAG_ASSOCIATED | MSGFLAG_DELETED)) == 0);
@@ -313,25 +320,28 @@ ECRESULT ECCacheManager::SetObject(unsigned int ulObjId, unsigned int ulParent,
 	sObjects.ulFlags	= ulFlags;
 	sObjects.ulType		= ulType;
 
-	scoped_rlock lock(m_hCacheObjectMutex);
-	auto er = m_ObjectsCache.AddCacheItem(ulObjId, std::move(sObjects));
+	auto &shard = m_ObjectsCache.get(ulObjId);
+	auto lock = m_ObjectsCache.write_lock(shard);
+	auto er = shard.cache.AddCacheItem(ulObjId, std::move(sObjects));
 	LOG_CACHE_DEBUG("Set cache object id %d, parent %d, owner %d, flags %d, type %d", ulObjId, ulParent, ulOwner, ulFlags, ulType);
 	return er;
 }
 
 void ECCacheManager::I_DelObject(unsigned int ulObjId)
 {
-	scoped_rlock lock(m_hCacheObjectMutex);
-	m_ObjectsCache.RemoveCacheItem(ulObjId);
+	auto &shard = m_ObjectsCache.get(ulObjId);
+	auto lock = m_ObjectsCache.write_lock(shard);
+	shard.cache.RemoveCacheItem(ulObjId);
 }
 
 ECRESULT ECCacheManager::I_GetStore(unsigned int ulObjId, unsigned int *ulStore,
     GUID *lpGuid, unsigned int *lpulType)
 {
-	ECsStores	*sStores;
-	scoped_rlock lock(m_hCacheStoreMutex);
+	const ECsStores *sStores;
+	auto &shard = m_StoresCache.get(ulObjId);
+	auto lock = m_StoresCache.read_lock(shard);
 
-	auto er = m_StoresCache.GetCacheItem(ulObjId, &sStores);
+	auto er = shard.cache.PeekCacheItem(ulObjId, &sStores);
 	if(er != erSuccess)
 		return er;
 	if(ulStore)
@@ -351,16 +361,18 @@ ECRESULT ECCacheManager::SetStore(unsigned int ulObjId, unsigned int ulStore,
 	sStores.guidStore = *lpGuid;
 	sStores.ulType = ulType;
 
-	scoped_rlock lock(m_hCacheStoreMutex);
-	auto er = m_StoresCache.AddCacheItem(ulObjId, std::move(sStores));
+	auto &shard = m_StoresCache.get(ulObjId);
+	auto lock = m_StoresCache.write_lock(shard);
+	auto er = shard.cache.AddCacheItem(ulObjId, std::move(sStores));
 	LOG_CACHE_DEBUG("Set store cache id %d, store %d, type %d, guid %s", ulObjId, ulStore, ulType, (lpGuid != nullptr ? bin2hex(sizeof(GUID), lpGuid).c_str() : "NULL"));
 	return er;
 }
 
 void ECCacheManager::I_DelStore(unsigned int ulObjId)
 {
-	scoped_rlock lock(m_hCacheStoreMutex);
-	m_StoresCache.RemoveCacheItem(ulObjId);
+	auto &shard = m_StoresCache.get(ulObjId);
+	auto lock = m_StoresCache.write_lock(shard);
+	shard.cache.RemoveCacheItem(ulObjId);
 }
 
 ECRESULT ECCacheManager::GetOwner(unsigned int ulObjId, unsigned int *ulOwner)
@@ -396,9 +408,7 @@ ECRESULT ECCacheManager::QueryParent(unsigned int ulObjId, unsigned int *lpulPar
 // Get the parent of the specified object
 ECRESULT ECCacheManager::GetObject(unsigned int ulObjId, unsigned int *lpulParent, unsigned int *lpulOwner, unsigned int *lpulFlags, unsigned int *lpulType)
 {
-	DB_RESULT lpDBResult;
-	DB_ROW		lpDBRow = NULL;
-	std::string strQuery;
+	DB_STMT_RESULT lpDBResult;
 	ECDatabase	*lpDatabase = NULL;
 	unsigned int	ulParent = 0, ulOwner = 0, ulFlags = 0, ulType = 0;
 	bool bCacheResult = false;
@@ -422,27 +432,26 @@ ECRESULT ECCacheManager::GetObject(unsigned int ulObjId, unsigned int *lpulParen
 		goto exit;
 	}
 
-	strQuery = "SELECT hierarchy.parent, hierarchy.owner, hierarchy.flags, hierarchy.type FROM hierarchy WHERE hierarchy.id = " + stringify(ulObjId) + " LIMIT 1";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	er = lpDatabase->DoSelectPrepared("SELECT hierarchy.parent, hierarchy.owner, hierarchy.flags, hierarchy.type FROM hierarchy WHERE hierarchy.id = ? LIMIT 1",
+	     {ulObjId}, &lpDBResult);
 	if(er != erSuccess)
 		goto exit;
-	lpDBRow = lpDBResult.fetch_row();
-	if(lpDBRow == NULL) {
+	if (!lpDBResult.fetch_row()) {
 		er = KCERR_NOT_FOUND;
 		goto exit;
 	}
 
-	if(lpDBRow[1] == NULL || lpDBRow[2] == NULL || lpDBRow[3] == NULL) {
+	if (lpDBResult.is_null(1) || lpDBResult.is_null(2) || lpDBResult.is_null(3)) {
 		// owner or flags should not be NULL
 		er = KCERR_DATABASE_ERROR;
 		ec_log_err("ECCacheManager::GetObject(): NULL in columns");
 		goto exit;
 	}
 
-	ulParent = lpDBRow[0] == NULL ? CACHE_NO_PARENT : atoui(lpDBRow[0]);
-	ulOwner = atoui(lpDBRow[1]);
-	ulFlags = atoui(lpDBRow[2]);
-	ulType = atoui(lpDBRow[3]);
+	ulParent = lpDBResult.is_null(0) ? CACHE_NO_PARENT : lpDBResult.get_uint(0);
+	ulOwner = lpDBResult.get_uint(1);
+	ulFlags = lpDBResult.get_uint(2);
+	ulType = lpDBResult.get_uint(3);
 
 	if(lpulParent)
 		*lpulParent = ulParent;
@@ -466,59 +475,173 @@ exit:
 ECRESULT ECCacheManager::GetObjects(const std::list<sObjectTableKey> &lstObjects,
     std::map<sObjectTableKey, ECsObjects> &mapObjects)
 {
-	DB_RESULT lpDBResult;
-	DB_ROW		lpDBRow = NULL;
-	ECDatabase	*lpDatabase = NULL;
-	ECsObjects sObject, *lpsObject = nullptr;
-	std::set<sObjectTableKey> setUncached;
+	std::vector<unsigned int> ids;
+	std::unordered_map<unsigned int, ECsObjects> objs;
+
+	ids.reserve(lstObjects.size());
+	for (const auto &key : lstObjects)
+		ids.emplace_back(key.ulObjId);
+	auto er = GetObjects(ids, objs);
+	if (er != erSuccess)
+		return er;
+	for (const auto &key : lstObjects) {
+		auto i = objs.find(key.ulObjId);
+		if (i != objs.cend())
+			mapObjects[key] = i->second;
+	}
+	return erSuccess;
+}
+
+static std::string chunk_idlist(const std::vector<unsigned int> &ids, size_t pos)
+{
+	auto end = std::min(ids.size(), pos + CACHE_QUERY_CHUNK);
+	std::string s;
+	for (auto i = pos; i < end; ++i) {
+		if (i != pos)
+			s += ",";
+		s += stringify(ids[i]);
+	}
+	return s;
+}
+
+ECRESULT ECCacheManager::GetObjects(const std::vector<unsigned int> &ids,
+    std::unordered_map<unsigned int, ECsObjects> &out)
+{
+	std::vector<unsigned int> uncached;
+	std::vector<std::pair<unsigned int, ECsObjects>> fresh;
+	ECDatabase *lpDatabase = nullptr;
+
+	for (auto id : ids) {
+		const ECsObjects *obj;
+		auto &shard = m_ObjectsCache.get(id);
+		auto lock = m_ObjectsCache.read_lock(shard);
+		if (shard.cache.PeekCacheItem(id, &obj) == erSuccess)
+			out[id] = *obj;
+		else
+			uncached.emplace_back(id);
+	}
+	if (uncached.empty()) {
+		LOG_CACHE_DEBUG("Get objects: %zu ids, all cached", ids.size());
+		return erSuccess;
+	}
+	std::sort(uncached.begin(), uncached.end());
+	uncached.erase(std::unique(uncached.begin(), uncached.end()), uncached.end());
 
 	auto er = m_lpDatabaseFactory->get_tls_db(&lpDatabase);
-	if(er != erSuccess)
-		goto exit;
+	if (er != erSuccess)
+		return er;
+	for (size_t pos = 0; pos < uncached.size(); pos += CACHE_QUERY_CHUNK) {
+		DB_RESULT result;
+		DB_ROW row;
+		er = lpDatabase->DoSelect("SELECT id, parent, owner, flags, type FROM hierarchy WHERE id IN(" +
+		     chunk_idlist(uncached, pos) + ")", &result);
+		if (er != erSuccess)
+			return er;
+		while ((row = result.fetch_row()) != nullptr) {
+			if (row[0] == nullptr || row[2] == nullptr || row[3] == nullptr || row[4] == nullptr)
+				continue;
+			ECsObjects obj;
+			obj.ulParent = row[1] == nullptr ? CACHE_NO_PARENT : atoui(row[1]);
+			obj.ulOwner  = atoui(row[2]);
+			obj.ulFlags  = atoui(row[3]);
+			obj.ulType   = atoui(row[4]);
+			out[atoui(row[0])] = obj;
+			fresh.emplace_back(atoui(row[0]), std::move(obj));
+		}
+	}
+	LOG_CACHE_DEBUG("Get objects: %zu ids, %zu from disk, %zu found there",
+		ids.size(), uncached.size(), fresh.size());
+	m_ObjectsCache.AddCacheItems(std::move(fresh));
+	return erSuccess;
+}
 
-    {
-        // Get everything from the cache that we can
-       scoped_rlock lock(m_hCacheObjectMutex);
+/**
+ * Batched version of GetStore. Objects whose store cannot be determined are
+ * absent from @out. Misses are resolved a hierarchy level at a time: one
+ * query for the objects themselves, one for those that are store roots, and
+ * a recursive call for the (usually very few) distinct parents of the rest.
+ */
+ECRESULT ECCacheManager::GetStores(const std::vector<unsigned int> &ids,
+    std::unordered_map<unsigned int, ECsStores> &out, unsigned int maxdepth)
+{
+	std::vector<unsigned int> uncached, roots, parents;
+	std::unordered_map<unsigned int, ECsObjects> objs;
+	std::unordered_map<unsigned int, ECsStores> pstores;
+	std::vector<std::pair<unsigned int, ECsStores>> fresh;
+	ECDatabase *lpDatabase = nullptr;
 
-	for (const auto &key : lstObjects)
-		if (m_ObjectsCache.GetCacheItem(key.ulObjId, &lpsObject) == erSuccess)
-			mapObjects[key] = *lpsObject;
+	if (maxdepth == 0)
+		return KCERR_NOT_FOUND;
+	for (auto id : ids) {
+		const ECsStores *st;
+		auto &shard = m_StoresCache.get(id);
+		auto lock = m_StoresCache.read_lock(shard);
+		if (shard.cache.PeekCacheItem(id, &st) == erSuccess)
+			out[id] = *st;
 		else
-			setUncached.emplace(key);
-    }
-    if(!setUncached.empty()) {
-        // Get uncached items from SQL
-		auto strQuery = "SELECT id, parent, owner, flags, type FROM hierarchy WHERE id IN(" +
-			kc_join(setUncached, ",", [](const auto &key) { return stringify(key.ulObjId); }) + ")";
-        er = lpDatabase->DoSelect(strQuery, &lpDBResult);
-        if (er != erSuccess)
-            goto exit;
-
-        while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
-            if(!lpDBRow[0] || !lpDBRow[1] || !lpDBRow[2] || !lpDBRow[3])
-                continue;
-			auto ulObjId = atoui(lpDBRow[0]);
-            sObject.ulParent = atoui(lpDBRow[1]);
-            sObject.ulOwner = atoui(lpDBRow[2]);
-            sObject.ulFlags = atoui(lpDBRow[3]);
-            sObject.ulType = atoui(lpDBRow[4]);
-
-			sObjectTableKey key;
-            key.ulObjId = ulObjId;
-            key.ulOrderId = 0;
-            mapObjects[key] = sObject;
-        }
-    }
-	if (mapObjects.size() < lstObjects.size())
-		LOG_CACHE_DEBUG("Get objects ids warning %zu objects not found",
-			lstObjects.size() - mapObjects.size());
-exit:
+			uncached.emplace_back(id);
+	}
+	if (uncached.empty())
+		return erSuccess;
+	std::sort(uncached.begin(), uncached.end());
+	uncached.erase(std::unique(uncached.begin(), uncached.end()), uncached.end());
+
+	auto er = GetObjects(uncached, objs);
 	if (er != erSuccess)
-		LOG_CACHE_DEBUG("Get object ids error 0x%08x", er);
-	else
-		LOG_CACHE_DEBUG("Get object ids total ids %zu from disk %zu",
-			lstObjects.size(), setUncached.size());
-	return er;
+		return er;
+	for (auto id : uncached) {
+		auto i = objs.find(id);
+		if (i == objs.cend() || i->second.ulParent == CACHE_NO_PARENT)
+			roots.emplace_back(id);
+		else
+			parents.emplace_back(i->second.ulParent);
+	}
+
+	if (!roots.empty()) {
+		er = m_lpDatabaseFactory->get_tls_db(&lpDatabase);
+		if (er != erSuccess)
+			return er;
+	}
+	for (size_t pos = 0; pos < roots.size(); pos += CACHE_QUERY_CHUNK) {
+		DB_RESULT result;
+		DB_ROW row;
+		er = lpDatabase->DoSelect("SELECT hierarchy_id, guid, type FROM stores WHERE hierarchy_id IN(" +
+		     chunk_idlist(roots, pos) + ")", &result);
+		if (er != erSuccess)
+			return er;
+		while ((row = result.fetch_row()) != nullptr) {
+			auto lengths = result.fetch_row_lengths();
+			if (row[0] == nullptr || row[1] == nullptr || row[2] == nullptr ||
+			    lengths[1] != sizeof(GUID))
+				continue;
+			ECsStores st;
+			st.ulStore = atoui(row[0]);
+			memcpy(&st.guidStore, row[1], sizeof(GUID));
+			st.ulType = atoui(row[2]);
+			out[st.ulStore] = st;
+			fresh.emplace_back(st.ulStore, st);
+		}
+	}
+
+	if (!parents.empty()) {
+		er = GetStores(parents, pstores, maxdepth - 1);
+		if (er != erSuccess && er != KCERR_NOT_FOUND)
+			return er;
+		for (auto id : uncached) {
+			auto o = objs.find(id);
+			if (o == objs.cend() || o->second.ulParent == CACHE_NO_PARENT)
+				continue;
+			auto p = pstores.find(o->second.ulParent);
+			if (p == pstores.cend())
+				continue;
+			out[id] = p->second;
+			fresh.emplace_back(id, p->second);
+		}
+	}
+	LOG_CACHE_DEBUG("Get stores: %zu ids, %zu uncached, %zu roots, %zu resolved",
+		ids.size(), uncached.size(), roots.size(), fresh.size());
+	m_StoresCache.AddCacheItems(std::move(fresh));
+	return erSuccess;
 }
 
 ECRESULT ECCacheManager::GetObjectsFromProp(unsigned int ulTag,
@@ -546,16 +669,31 @@ ECRESULT ECCacheManager::GetObjectsFromProp(unsigned int ulTag,
 		er = m_lpDatabaseFactory->get_tls_db(&lpDatabase);
 		if (er != erSuccess)
 			goto exit;
+	}
+	for (size_t pos = 0; pos < uncached.size(); pos += CACHE_QUERY_CHUNK) {
+		std::vector<size_t> chunk(uncached.begin() + pos,
+			uncached.begin() + std::min(uncached.size(), pos + CACHE_QUERY_CHUNK));
 		auto strQuery = "SELECT hierarchyid, val_binary FROM indexedproperties WHERE tag=" + stringify(ulTag) + " AND val_binary IN(" +
-			kc_join(uncached, ",", [&](const auto &j) { return lpDatabase->EscapeBinary(lpdata[j], cbdata[j]); }) + ")";
+			kc_join(chunk, ",", [&](const auto &j) { return lpDatabase->EscapeBinary(lpdata[j], cbdata[j]); }) + ")";
 		er = lpDatabase->DoSelect(strQuery, &lpDBResult);
 		if (er != erSuccess)
 			goto exit;
 
+		/* Populate both index caches in one go */
+		ECUniqueLock lock(m_hCacheIndPropMutex);
 		while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
 			auto lpDBLen = lpDBResult.fetch_row_lengths();
+			if (lpDBRow[0] == nullptr || lpDBRow[1] == nullptr)
+				continue;
 			ECsIndexProp p(ulTag, reinterpret_cast<unsigned char *>(lpDBRow[1]), lpDBLen[1]);
-			mapObjects[std::move(p)] = atoui(lpDBRow[0]);
+			ECsIndexObject o;
+			o.ulObjId = atoui(lpDBRow[0]);
+			o.ulTag = ulTag;
+			I_RemoveIndexData(PROP_TAG(PT_UNSPECIFIED, o.ulTag), o.ulObjId);
+			I_RemoveIndexData(PROP_TAG(PT_UNSPECIFIED, p.ulTag), p.cbData, p.lpData);
+			m_PropToObjectCache.AddCacheItem(p, o);
+			m_ObjectToPropCache.AddCacheItem(o, p);
+			mapObjects[std::move(p)] = o.ulObjId;
 		}
 	}
 	if (mapObjects.size() < lpdata.size())
@@ -579,7 +717,6 @@ ECRESULT ECCacheManager::GetStore(unsigned int ulObjId, unsigned int *lpulStore,
 // Get the store that the specified object belongs to
 ECRESULT ECCacheManager::GetStoreAndType(unsigned int ulObjId, unsigned int *lpulStore, GUID *lpGuid, unsigned int *lpulType, unsigned int maxdepth)
 {
-	DB_RESULT lpDBResult;
 	ECDatabase	*lpDatabase = NULL;
 	unsigned int ulSubObjId = 0, ulStore = 0, ulType = 0;
 	GUID guid;
@@ -600,23 +737,26 @@ ECRESULT ECCacheManager::GetStoreAndType(unsigned int ulObjId, unsigned int *lpu
     // Get our parent folder
 	if(GetParent(ulObjId, &ulSubObjId) != erSuccess) {
 	    // No parent, this must be the top-level item, get the store data from here
-		auto strQuery = "SELECT hierarchy_id, guid, type FROM stores WHERE hierarchy_id = " + stringify(ulObjId) + " LIMIT 1";
-    	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+		DB_STMT_RESULT lpDBResult;
+		er = lpDatabase->DoSelectPrepared("SELECT hierarchy_id, guid, type FROM stores WHERE hierarchy_id = ? LIMIT 1",
+		     {ulObjId}, &lpDBResult);
     	if(er != erSuccess)
 			goto exit;
 		if (lpDBResult.get_num_rows() < 1) {
     		er = KCERR_NOT_FOUND;
     		goto exit;
     	}
-		auto lpDBRow = lpDBResult.fetch_row();
-    	if(lpDBRow == NULL || lpDBRow[0] == NULL || lpDBRow[1] == NULL || lpDBRow[2] == NULL) {
+		size_t glen = 0;
+		const char *gdata = lpDBResult.fetch_row() ? lpDBResult.get_data(1, &glen) : nullptr;
+		if (gdata == nullptr || glen != sizeof(GUID) ||
+		    lpDBResult.is_null(0) || lpDBResult.is_null(2)) {
     		er = KCERR_DATABASE_ERROR;
 		ec_log_err("ECCacheManager::GetStoreAndType(): NULL in columns");
     		goto exit;
     	}
-    	ulStore = atoi(lpDBRow[0]);
-        memcpy(&guid, lpDBRow[1], sizeof(GUID));
-        ulType = atoi(lpDBRow[2]);
+		ulStore = lpDBResult.get_uint(0);
+        memcpy(&guid, gdata, sizeof(GUID));
+		ulType = lpDBResult.get_uint(2);
 	} else {
 	    // We have a parent, get the store for our parent by recursively calling ourselves
 	    er = GetStoreAndType(ulSubObjId, &ulStore, &guid, &ulType, maxdepth-1);
@@ -644,9 +784,7 @@ exit:
 ECRESULT ECCacheManager::GetUserObject(unsigned int ulUserId, objectid_t *lpExternId, unsigned int *lpulCompanyId, std::string *lpstrSignature)
 {
 	ECRESULT	er = erSuccess;
-	DB_RESULT lpDBResult;
-	DB_ROW		lpDBRow = NULL;
-	DB_LENGTHS	lpDBLen = NULL;
+	DB_STMT_RESULT lpDBResult;
 	ECDatabase	*lpDatabase = NULL;
 	objectclass_t ulClass;
 	unsigned int ulCompanyId;
@@ -667,26 +805,24 @@ ECRESULT ECCacheManager::GetUserObject(unsigned int ulUserId, objectid_t *lpExte
 	if (er != erSuccess)
 		goto exit;
 
-	er = lpDatabase->DoSelect("SELECT externid, objectclass, signature, company FROM users "
-							  "WHERE id=" + stringify(ulUserId) + " LIMIT 1", &lpDBResult);
+	er = lpDatabase->DoSelectPrepared("SELECT externid, objectclass, signature, company FROM users "
+	     "WHERE id=? LIMIT 1", {ulUserId}, &lpDBResult);
 	if (er != erSuccess) {
 		er = KCERR_DATABASE_ERROR;
 		ec_log_err("ECCacheManager::GetUserObject(): NULL in columns");
 		goto exit;
 	}
-
-	lpDBRow = lpDBResult.fetch_row();
-	lpDBLen = lpDBResult.fetch_row_lengths();
-	if(lpDBRow == NULL || lpDBRow[0] == NULL || lpDBRow[1] == NULL || lpDBRow[2] == NULL || lpDBRow[3] == NULL) {
+	if (!lpDBResult.fetch_row() || lpDBResult.is_null(0) || lpDBResult.is_null(1) ||
+	    lpDBResult.is_null(2) || lpDBResult.is_null(3)) {
 		er = KCERR_NOT_FOUND;
 		goto exit;
 	}
 
-	ulClass = static_cast<objectclass_t>(atoui(lpDBRow[1]));
-	ulCompanyId = atoui(lpDBRow[3]);
+	ulClass = static_cast<objectclass_t>(lpDBResult.get_uint(1));
+	ulCompanyId = lpDBResult.get_uint(3);
 
-	externid.assign(lpDBRow[0], lpDBLen[0]);
-	signature.assign(lpDBRow[2], lpDBLen[2]);
+	externid = lpDBResult.get_string(0);
+	signature = lpDBResult.get_string(2);
 
 	// insert the item into the cache
 	I_AddUserObject(ulUserId, ulClass, ulCompanyId, externid, signature);
@@ -776,10 +912,7 @@ ECRESULT ECCacheManager::SetUserDetails(unsigned int ulUserId,
 ECRESULT ECCacheManager::GetUserObject(const objectid_t &sExternId, unsigned int *lpulUserId, unsigned int *lpulCompanyId, std::string *lpstrSignature)
 {
 	ECRESULT	er = erSuccess;
-	DB_RESULT lpDBResult;
-	DB_ROW		lpDBRow = NULL;
-	DB_LENGTHS	lpDBLen = NULL;
-	std::string	strQuery;
+	DB_STMT_RESULT lpDBResult;
 	ECDatabase	*lpDatabase = NULL;
 	unsigned int ulCompanyId, ulUserId;
 	std::string signature;
@@ -801,11 +934,18 @@ ECRESULT ECCacheManager::GetUserObject(const objectid_t &sExternId, unsigned int
 	if (er != erSuccess)
 		goto exit;
 
-	strQuery =
-		"SELECT id, signature, company, objectclass FROM users "
-		"WHERE externid=" + lpDatabase->EscapeBinary(sExternId.id) + " "
-			"AND " + OBJECTCLASS_COMPARE_SQL("objectclass", sExternId.objclass) + " LIMIT 1";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	/* One template for each of the shapes of OBJECTCLASS_COMPARE_SQL */
+	if (sExternId.objclass == 0)
+		er = lpDatabase->DoSelectPrepared("SELECT id, signature, company, objectclass FROM users "
+		     "WHERE externid=? LIMIT 1", {sExternId.id}, &lpDBResult);
+	else if (OBJECTCLASS_ISTYPE(sExternId.objclass))
+		er = lpDatabase->DoSelectPrepared("SELECT id, signature, company, objectclass FROM users "
+		     "WHERE externid=? AND (objectclass & 4294901760)=? LIMIT 1",
+		     {sExternId.id, OBJECTCLASS_CLASSTYPE(sExternId.objclass)}, &lpDBResult);
+	else
+		er = lpDatabase->DoSelectPrepared("SELECT id, signature, company, objectclass FROM users "
+		     "WHERE externid=? AND objectclass=? LIMIT 1",
+		     {sExternId.id, static_cast<unsigned int>(sExternId.objclass)}, &lpDBResult);
 	if (er != erSuccess) {
 		er = KCERR_DATABASE_ERROR;
 		ec_perror("ECCacheManager::GetUserObject(): query failed", er);
@@ -813,20 +953,19 @@ ECRESULT ECCacheManager::GetUserObject(const objectid_t &sExternId, unsigned int
 	}
 
 	// TODO: check, should return 1 answer
-	lpDBRow = lpDBResult.fetch_row();
-	lpDBLen = lpDBResult.fetch_row_lengths();
-	if(lpDBRow == NULL || lpDBRow[0] == NULL || lpDBRow[1] == NULL || lpDBRow[2] == NULL) {
+	if (!lpDBResult.fetch_row() || lpDBResult.is_null(0) ||
+	    lpDBResult.is_null(1) || lpDBResult.is_null(2)) {
 		er = KCERR_NOT_FOUND;
 		goto exit;
 	}
 
-	ulUserId = atoui(lpDBRow[0]);
-	signature.assign(lpDBRow[1], lpDBLen[1]);
-	ulCompanyId = atoui(lpDBRow[2]);
+	ulUserId = lpDBResult.get_uint(0);
+	signature = lpDBResult.get_string(1);
+	ulCompanyId = lpDBResult.get_uint(2);
 
 	// possibly update objectclass from database, to add the correct info in the cache
 	if (OBJECTCLASS_ISTYPE(sExternId.objclass))
-		objclass = static_cast<objectclass_t>(atoi(lpDBRow[3]));
+		objclass = static_cast<objectclass_t>(lpDBResult.get_uint(3));
 
 	// insert the item into the cache
 	I_AddUEIdObject(sExternId.id, objclass, ulCompanyId, ulUserId, signature);
@@ -1072,7 +1211,7 @@ void ECCacheManager::I_DelUEIdObject(const std::string &strExternId,
 
 ECRESULT ECCacheManager::GetACLs(unsigned int ulObjId, struct rightsArray **lppRights)
 {
-	DB_RESULT lpResult;
+	DB_STMT_RESULT lpResult;
     ECDatabase *lpDatabase = NULL;
 	LOG_USERCACHE_DEBUG("Get ACLs for objectid %d", ulObjId);
 
@@ -1084,8 +1223,8 @@ ECRESULT ECCacheManager::GetACLs(unsigned int ulObjId, struct rightsArray **lppR
 	auto er = m_lpDatabaseFactory->get_tls_db(&lpDatabase);
 	if(er != erSuccess)
 		return er;
-	auto strQuery = "SELECT id, type, rights FROM acl WHERE hierarchy_id=" + stringify(ulObjId);
-    er = lpDatabase->DoSelect(strQuery, &lpResult);
+	er = lpDatabase->DoSelectPrepared("SELECT id, type, rights FROM acl WHERE hierarchy_id=?",
+	     {ulObjId}, &lpResult);
     if(er != erSuccess)
 		return er;
 
@@ -1097,16 +1236,16 @@ ECRESULT ECCacheManager::GetACLs(unsigned int ulObjId, struct rightsArray **lppR
 		lpRights->__ptr  = soap_new_rights(nullptr, ulRows);
 
 		for (unsigned int i = 0; i < ulRows; ++i) {
-			auto lpRow = lpResult.fetch_row();
-			if(lpRow == NULL || lpRow[0] == NULL || lpRow[1] == NULL || lpRow[2] == NULL) {
+			if (!lpResult.fetch_row() || lpResult.is_null(0) ||
+			    lpResult.is_null(1) || lpResult.is_null(2)) {
 				soap_del_PointerTorightsArray(&lpRights);
 				ec_perror("ECCacheManager::GetACLs(): ROW or COLUMNS null", er);
 				return KCERR_DATABASE_ERROR;
 			}
 
-			lpRights->__ptr[i].ulUserid = atoi(lpRow[0]);
-			lpRights->__ptr[i].ulType = atoi(lpRow[1]);
-			lpRights->__ptr[i].ulRights = atoi(lpRow[2]);
+			lpRights->__ptr[i].ulUserid = lpResult.get_uint(0);
+			lpRights->__ptr[i].ulType = lpResult.get_uint(1);
+			lpRights->__ptr[i].ulRights = lpResult.get_uint(2);
 
 			LOG_USERCACHE_DEBUG("Get ACLs result for objectid %d: userid %d, type %d, permissions %d", ulObjId, lpRights->__ptr[i].ulUserid, lpRights->__ptr[i].ulType, lpRights->__ptr[i].ulRights);
 		}
@@ -1119,10 +1258,11 @@ ECRESULT ECCacheManager::GetACLs(unsigned int ulObjId, struct rightsArray **lppR
 
 ECRESULT ECCacheManager::I_GetACLs(unsigned int ulObjId, struct rightsArray **lppRights)
 {
-    ECsACLs *sACL;
-	scoped_rlock lock(m_hCacheMutex);
+	const ECsACLs *sACL;
+	auto &shard = m_AclCache.get(ulObjId);
+	auto lock = m_AclCache.read_lock(shard);
 
-	auto er = m_AclCache.GetCacheItem(ulObjId, &sACL);
+	auto er = shard.cache.PeekCacheItem(ulObjId, &sACL);
 	if(er != erSuccess)
 		return er;
 
@@ -1162,15 +1302,17 @@ ECRESULT ECCacheManager::SetACLs(unsigned int ulObjId,
 			lpRights.__ptr[i].ulType, lpRights.__ptr[i].ulRights);
     }
 
-	scoped_rlock lock(m_hCacheMutex);
-	return m_AclCache.AddCacheItem(ulObjId, std::move(sACLs));
+	auto &shard = m_AclCache.get(ulObjId);
+	auto lock = m_AclCache.write_lock(shard);
+	return shard.cache.AddCacheItem(ulObjId, std::move(sACLs));
 }
 
 void ECCacheManager::I_DelACLs(unsigned int ulObjId)
 {
-	scoped_rlock lock(m_hCacheMutex);
+	auto &shard = m_AclCache.get(ulObjId);
+	auto lock = m_AclCache.write_lock(shard);
 	LOG_USERCACHE_DEBUG("Remove ACLs for objectid %d", ulObjId);
-	m_AclCache.RemoveCacheItem(ulObjId);
+	shard.cache.RemoveCacheItem(ulObjId);
 }
 
 ECRESULT ECCacheManager::GetQuota(unsigned int ulUserId, bool bIsDefaultQuota, quotadetails_t *quota)
@@ -1229,7 +1371,6 @@ void ECCacheManager::update_extra_stats(ECStatsCollector &sc)
 		sc.setg("cache_" + s.name + "_hit", "Cache " + s.name + " hits", s.hit);
 	};
 	ulock_rec l_cache(m_hCacheMutex);
-	f(m_AclCache.get_stats());
 	f(m_QuotaCache.get_stats());
 	f(m_QuotaUserDefaultCache.get_stats());
 	f(m_UEIdObjectCache.get_stats());
@@ -1238,22 +1379,26 @@ void ECCacheManager::update_extra_stats(ECStatsCollector &sc)
 	f(m_ServerDetailsCache.get_stats());
 	l_cache.unlock();
 
-	ulock_rec l_store(m_hCacheStoreMutex);
+	f(m_AclCache.get_stats());
 	f(m_StoresCache.get_stats());
-	l_store.unlock();
-
-	ulock_rec l_object(m_hCacheObjectMutex);
 	f(m_ObjectsCache.get_stats());
-	l_object.unlock();
-
-	ulock_rec l_cell(m_hCacheCellsMutex);
 	f(m_CellCache.get_stats());
-	l_cell.unlock();
-
-	ulock_rec l_prop(m_hCacheIndPropMutex);
+	f(m_ColumnCache.get_stats());
+	sc.setg("cache_column_folders", "Cache column folders", m_ColumnCache.folders());
+	sc.setg("cache_column_strings", "Cache column dictionary strings", m_ColumnCache.strings());
+	m_AclCache.update_lock_stats(sc);
+	m_StoresCache.update_lock_stats(sc);
+	m_ObjectsCache.update_lock_stats(sc);
+	m_CellCache.update_lock_stats(sc);
+
+	ECSharedLock l_prop(m_hCacheIndPropMutex);
 	f(m_PropToObjectCache.get_stats());
 	f(m_ObjectToPropCache.get_stats());
 	l_prop.unlock();
+
+	sc.setg("cache_snapshot_loaded", "Cache entries restored from snapshot", m_snap_loaded);
+	sc.setg("cache_snapshot_skipped", "Snapshot entries discarded as stale", m_snap_skipped);
+	sc.setg("cache_snapshot_load_ms", "Snapshot load time (ms)", m_snap_load_ms);
 }
 
 ECRESULT ECCacheManager::GetObjectFlags(unsigned int ulObjId, unsigned int *ulFlags)
@@ -1266,15 +1411,16 @@ ECRESULT ECCacheManager::GetCell(const sObjectTableKey *lpsRowItem,
     unsigned int flags)
 {
     ECRESULT er = erSuccess;
-    ECsCells *sCell;
-	scoped_rlock lock(m_hCacheCellsMutex);
+	const ECsCells *sCell;
+	auto &shard = m_CellCache.get(lpsRowItem->ulObjId);
+	auto lock = m_CellCache.read_lock(shard);
 
     if (m_bCellCacheDisabled) {
         er = KCERR_NOT_FOUND;
         goto exit;
     }
 	/* ignoring orderId for now */
-	er = m_CellCache.GetCacheItem(lpsRowItem->ulObjId, &sCell);
+	er = shard.cache.PeekCacheItem(lpsRowItem->ulObjId, &sCell);
 	if(er != erSuccess)
 	    goto exit;
 
@@ -1285,7 +1431,7 @@ ECRESULT ECCacheManager::GetCell(const sObjectTableKey *lpsRowItem,
 			// the item, so return NOT_FOUND.
 			// Or, proptaglist is complete, but propval is not in cache,
 			// and the caller did not want to know about this special case.
-			m_CellCache.DecrementValidCount();
+			shard.cache.DecrementValidCount();
             er = KCERR_NOT_FOUND;
         } else {
             // Object is complete and property is not found; we know that the property does not exist
@@ -1309,20 +1455,22 @@ ECRESULT ECCacheManager::SetCell(const sObjectTableKey *lpsRowItem,
     ECRESULT er = erSuccess;
     ECsCells *sCell;
 	/* ignoring orderId for now */
-	scoped_rlock lock(m_hCacheCellsMutex);
+	auto &shard = m_CellCache.get(lpsRowItem->ulObjId);
+	auto lock = m_CellCache.write_lock(shard);
 
-	if (m_CellCache.GetCacheItem(lpsRowItem->ulObjId, &sCell) == erSuccess) {
+	if (shard.cache.GetCacheItem(lpsRowItem->ulObjId, &sCell) == erSuccess) {
         long long ulSize = sCell->GetSize();
         sCell->AddPropVal(ulPropTag, lpSrc);
         ulSize -= sCell->GetSize();
         // ulSize is positive if the cache shrank
         //m_ulCellSize -= ulSize;
-		m_CellCache.AddToSize(-ulSize);
+		shard.cache.AddToSize(-ulSize);
     } else {
         ECsCells sNewCell;
         sNewCell.AddPropVal(ulPropTag, lpSrc);
-		er = m_CellCache.AddCacheItem(lpsRowItem->ulObjId, std::move(sNewCell));
+		er = shard.cache.AddCacheItem(lpsRowItem->ulObjId, std::move(sNewCell));
     }
+	m_ColumnCache.Set(lpsRowItem->ulObjId, ulPropTag, lpSrc);
 	if (er != erSuccess)
 		LOG_CELLCACHE_DEBUG("Set cell object %d tag 0x%08X error 0x%08X", lpsRowItem->ulObjId, ulPropTag, er);
 	else
@@ -1334,9 +1482,10 @@ ECRESULT ECCacheManager::SetComplete(unsigned int ulObjId)
 {
     ECRESULT er = erSuccess;
     ECsCells *sCell;
-	scoped_rlock lock(m_hCacheCellsMutex);
+	auto &shard = m_CellCache.get(ulObjId);
+	auto lock = m_CellCache.write_lock(shard);
 
-	if (m_CellCache.GetCacheItem(ulObjId, &sCell) == erSuccess)
+	if (shard.cache.GetCacheItem(ulObjId, &sCell) == erSuccess)
 		sCell->SetComplete(true);
 	else
 		er = KCERR_NOT_FOUND;
@@ -1350,10 +1499,11 @@ ECRESULT ECCacheManager::SetComplete(unsigned int ulObjId)
 ECRESULT ECCacheManager::GetComplete(unsigned int ulObjId, bool &complete)
 {
 	ECRESULT er = erSuccess;
-	ECsCells *sCell;
-	scoped_rlock lock(m_hCacheCellsMutex);
+	const ECsCells *sCell;
+	auto &shard = m_CellCache.get(ulObjId);
+	auto lock = m_CellCache.read_lock(shard);
 
-	if (m_CellCache.GetCacheItem(ulObjId, &sCell) == erSuccess)
+	if (shard.cache.PeekCacheItem(ulObjId, &sCell) == erSuccess)
 		complete = sCell->GetComplete();
 	else
 		er = KCERR_NOT_FOUND;
@@ -1367,10 +1517,11 @@ ECRESULT ECCacheManager::GetComplete(unsigned int ulObjId, bool &complete)
 ECRESULT ECCacheManager::GetPropTags(unsigned int ulObjId, std::vector<unsigned int> &proptags)
 {
 	ECRESULT er = erSuccess;
-	ECsCells *sCell;
-	scoped_rlock lock(m_hCacheCellsMutex);
+	const ECsCells *sCell;
+	auto &shard = m_CellCache.get(ulObjId);
+	auto lock = m_CellCache.read_lock(shard);
 
-	if (m_CellCache.GetCacheItem(ulObjId, &sCell) == erSuccess)
+	if (shard.cache.PeekCacheItem(ulObjId, &sCell) == erSuccess)
 		proptags = sCell->GetPropTags();
 	else
 		er = KCERR_NOT_FOUND;
@@ -1385,12 +1536,14 @@ ECRESULT ECCacheManager::UpdateCell(unsigned int ulObjId, unsigned int ulPropTag
 {
     ECRESULT er = erSuccess;
     ECsCells *sCell;
-	scoped_rlock lock(m_hCacheCellsMutex);
+	auto &shard = m_CellCache.get(ulObjId);
+	auto lock = m_CellCache.write_lock(shard);
 
-	if (m_CellCache.GetCacheItem(ulObjId, &sCell) == erSuccess)
+	if (shard.cache.GetCacheItem(ulObjId, &sCell) == erSuccess)
 		sCell->UpdatePropVal(ulPropTag, lDelta);
 	else
 		er = KCERR_NOT_FOUND;
+	m_ColumnCache.Update(ulObjId, ulPropTag, lDelta);
 	if (er != erSuccess)
 		LOG_CELLCACHE_DEBUG("Update cell object %d tag 0x%08X, delta %d failed cell not found", ulObjId, ulPropTag, lDelta);
 	else
@@ -1402,12 +1555,14 @@ ECRESULT ECCacheManager::UpdateCell(unsigned int ulObjId, unsigned int ulPropTag
 {
     ECRESULT er = erSuccess;
     ECsCells *sCell;
-	scoped_rlock lock(m_hCacheCellsMutex);
+	auto &shard = m_CellCache.get(ulObjId);
+	auto lock = m_CellCache.write_lock(shard);
 
-	if (m_CellCache.GetCacheItem(ulObjId, &sCell) == erSuccess)
+	if (shard.cache.GetCacheItem(ulObjId, &sCell) == erSuccess)
 		sCell->UpdatePropVal(ulPropTag, ulMask, ulValue);
 	else
 		er = KCERR_NOT_FOUND;
+	m_ColumnCache.Update(ulObjId, ulPropTag, ulMask, ulValue);
 	if (er != erSuccess)
 		LOG_CELLCACHE_DEBUG("Update cell object %d tag 0x%08X, mask 0x%08X, value %d failed cell not found", ulObjId, ulPropTag, ulMask, ulValue);
 	else
@@ -1417,8 +1572,28 @@ ECRESULT ECCacheManager::UpdateCell(unsigned int ulObjId, unsigned int ulPropTag
 
 void ECCacheManager::I_DelCell(unsigned int ulObjId)
 {
-	scoped_rlock lock(m_hCacheCellsMutex);
-	m_CellCache.RemoveCacheItem(ulObjId);
+	auto &shard = m_CellCache.get(ulObjId);
+	auto lock = m_CellCache.write_lock(shard);
+	shard.cache.RemoveCacheItem(ulObjId);
+	m_ColumnCache.Remove(ulObjId);
+}
+
+void ECCacheManager::GetColumns(unsigned int folder,
+    const ECObjectTableList &rows, const struct propTagArray *tags,
+    const std::vector<unsigned int> &cols, struct soap *soap,
+    struct rowSet *rs, std::vector<bool> &done)
+{
+	if (!m_bCellCacheDisabled)
+		m_ColumnCache.Gather(folder, rows, tags, cols, soap, rs, done);
+}
+
+void ECCacheManager::SetColumns(unsigned int folder,
+    const ECObjectTableList &rows, const struct propTagArray *tags,
+    const std::vector<unsigned int> &cols, const struct rowSet *rs,
+    const std::vector<bool> &skip)
+{
+	if (!m_bCellCacheDisabled)
+		m_ColumnCache.Store(folder, rows, tags, cols, rs, skip);
 }
 
 ECRESULT ECCacheManager::GetServerDetails(const std::string &strServerId, serverdetails_t *lpsDetails)
@@ -1453,7 +1628,7 @@ ECRESULT ECCacheManager::RemoveIndexData(unsigned int ulObjId)
 	sObjectKeyUpper.ulObjId = ulObjId;
 	sObjectKeyUpper.ulTag = 0xffffffff;
 
-	scoped_rlock lock(m_hCacheIndPropMutex);
+	ECUniqueLock lock(m_hCacheIndPropMutex);
 	auto er = m_ObjectToPropCache.GetCacheRange(sObjectKeyLower, sObjectKeyUpper, &lstItems);
 	for (const auto &p : lstItems) {
 		m_ObjectToPropCache.RemoveCacheItem(p.first);
@@ -1465,52 +1640,65 @@ ECRESULT ECCacheManager::RemoveIndexData(unsigned int ulObjId)
 ECRESULT ECCacheManager::RemoveIndexData(unsigned int ulPropTag,
     unsigned int cbData, const unsigned char *lpData)
 {
-	ECsIndexProp	sObject;
-	ECsIndexObject	*sObjectId;
-
 	if (lpData == NULL || cbData == 0)
 		return KCERR_INVALID_PARAMETER;
 
 	LOG_CACHE_DEBUG("Remove indexdata proptag 0x%08X, data %s", ulPropTag, bin2hex(cbData, lpData).c_str());
+	ECUniqueLock lock(m_hCacheIndPropMutex);
+	I_RemoveIndexData(ulPropTag, cbData, lpData);
+	return erSuccess;
+}
+
+ECRESULT ECCacheManager::RemoveIndexData(unsigned int ulPropTag, unsigned int ulObjId)
+{
+	LOG_CACHE_DEBUG("Remove index data proptag 0x%08X, objectid %d", ulPropTag, ulObjId);
+	ECUniqueLock lock(m_hCacheIndPropMutex);
+	I_RemoveIndexData(ulPropTag, ulObjId);
+	return erSuccess;
+}
+
+/* Caller must hold m_hCacheIndPropMutex exclusively */
+void ECCacheManager::I_RemoveIndexData(unsigned int ulPropTag,
+    unsigned int cbData, const unsigned char *lpData)
+{
+	ECsIndexProp	sObject;
+	ECsIndexObject	*sObjectId;
+
+	if (lpData == nullptr || cbData == 0)
+		return;
 	sObject.ulTag = PROP_ID(ulPropTag);
 	sObject.cbData = cbData;
 	sObject.lpData = const_cast<unsigned char *>(lpData); /* Cheap copy, set this item to nullptr before exiting */
-
-	scoped_rlock lock(m_hCacheIndPropMutex);
-        if(m_PropToObjectCache.GetCacheItem(sObject, &sObjectId) == erSuccess) {
-            m_ObjectToPropCache.RemoveCacheItem(*sObjectId);
-            m_PropToObjectCache.RemoveCacheItem(sObject);
-        }
+	if (m_PropToObjectCache.GetCacheItem(sObject, &sObjectId) == erSuccess) {
+		m_ObjectToPropCache.RemoveCacheItem(*sObjectId);
+		m_PropToObjectCache.RemoveCacheItem(sObject);
+	}
 	// Make sure there's no delete when it goes out of scope
 	sObject.lpData = NULL;
-	return erSuccess;
 }
 
-ECRESULT ECCacheManager::RemoveIndexData(unsigned int ulPropTag, unsigned int ulObjId)
+/* Caller must hold m_hCacheIndPropMutex exclusively */
+void ECCacheManager::I_RemoveIndexData(unsigned int ulPropTag, unsigned int ulObjId)
 {
 	ECsIndexObject	sObject;
 	ECsIndexProp	*sObjectId;
 
 	sObject.ulTag = PROP_ID(ulPropTag);
 	sObject.ulObjId = ulObjId;
-
-	LOG_CACHE_DEBUG("Remove index data proptag 0x%08X, objectid %d", ulPropTag, ulObjId);
-	scoped_rlock lock(m_hCacheIndPropMutex);
-       if(m_ObjectToPropCache.GetCacheItem(sObject, &sObjectId) == erSuccess) {
-            m_PropToObjectCache.RemoveCacheItem(*sObjectId);
-            m_ObjectToPropCache.RemoveCacheItem(sObject);
-        }
-	return erSuccess;
+	if (m_ObjectToPropCache.GetCacheItem(sObject, &sObjectId) == erSuccess) {
+		m_PropToObjectCache.RemoveCacheItem(*sObjectId);
+		m_ObjectToPropCache.RemoveCacheItem(sObject);
+	}
 }
 
 ECRESULT ECCacheManager::I_AddIndexData(const ECsIndexObject &lpObject,
     const ECsIndexProp &lpProp)
 {
-	scoped_rlock lock(m_hCacheIndPropMutex);
+	ECUniqueLock lock(m_hCacheIndPropMutex);
 
     // Remove any pre-existing references to this data
-	RemoveIndexData(PROP_TAG(PT_UNSPECIFIED, lpObject.ulTag), lpObject.ulObjId);
-	RemoveIndexData(PROP_TAG(PT_UNSPECIFIED, lpProp.ulTag), lpProp.cbData, lpProp.lpData);
+	I_RemoveIndexData(PROP_TAG(PT_UNSPECIFIED, lpObject.ulTag), lpObject.ulObjId);
+	I_RemoveIndexData(PROP_TAG(PT_UNSPECIFIED, lpProp.ulTag), lpProp.cbData, lpProp.lpData);
 	auto er = m_PropToObjectCache.AddCacheItem(lpProp, lpObject);
 	if(er != erSuccess)
 		return er;
@@ -1520,12 +1708,11 @@ ECRESULT ECCacheManager::I_AddIndexData(const ECsIndexObject &lpObject,
 ECRESULT ECCacheManager::GetPropFromObject(unsigned int ulTag, unsigned int ulObjId, struct soap *soap, unsigned int* lpcbData, unsigned char** lppData)
 {
 	ECRESULT		er = erSuccess;
-	DB_RESULT lpDBResult;
-	DB_ROW			lpDBRow = NULL;
-	DB_LENGTHS		lpDBLenths = NULL;
-	std::string		strQuery;
+	DB_STMT_RESULT lpDBResult;
+	const char *lpData = nullptr;
+	size_t cbData = 0;
 	ECDatabase*		lpDatabase = NULL;
-	ECsIndexProp *sObject = NULL;
+	const ECsIndexProp *sObject = nullptr;
 	ECsIndexObject	sObjectKey;
     ECsIndexProp sNewObject;
 
@@ -1535,8 +1722,8 @@ ECRESULT ECCacheManager::GetPropFromObject(unsigned int ulTag, unsigned int ulOb
 	LOG_CACHE_DEBUG("Get Prop From Object tag=0x%04X, objectid %d", ulTag, ulObjId);
 
 	{
-		scoped_rlock lock(m_hCacheIndPropMutex);
-		er = m_ObjectToPropCache.GetCacheItem(sObjectKey, &sObject);
+		ECSharedLock lock(m_hCacheIndPropMutex);
+		er = m_ObjectToPropCache.PeekCacheItem(sObjectKey, &sObject);
 
 		if(er == erSuccess) {
 			*lppData  = soap_new_unsignedByte(soap, sObject->cbData);
@@ -1555,18 +1742,17 @@ ECRESULT ECCacheManager::GetPropFromObject(unsigned int ulTag, unsigned int ulOb
 	if(er != erSuccess)
 		goto exit;
 	// Get them from the database
-	strQuery = "SELECT val_binary FROM indexedproperties WHERE tag="+stringify(ulTag)+" AND hierarchyid="+stringify(ulObjId) + " LIMIT 1";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	er = lpDatabase->DoSelectPrepared("SELECT val_binary FROM indexedproperties WHERE tag=? AND hierarchyid=? LIMIT 1",
+	     {ulTag, ulObjId}, &lpDBResult);
 	if(er != erSuccess)
 		goto exit;
-	lpDBRow = lpDBResult.fetch_row();
-	lpDBLenths = lpDBResult.fetch_row_lengths();
-	if(lpDBRow == NULL || lpDBRow[0] == NULL || lpDBLenths == NULL) {
+	lpData = lpDBResult.fetch_row() ? lpDBResult.get_data(0, &cbData) : nullptr;
+	if (lpData == nullptr) {
 		er = KCERR_NOT_FOUND;
 		goto exit;
 	}
 
-	sNewObject.SetValue(ulTag, (unsigned char*) lpDBRow[0], (unsigned int) lpDBLenths[0]);
+	sNewObject.SetValue(ulTag, reinterpret_cast<const unsigned char *>(lpData), cbData);
 	er = I_AddIndexData(sObjectKey, sNewObject);
 	if(er != erSuccess)
 		goto exit;
@@ -1586,9 +1772,7 @@ ECRESULT ECCacheManager::GetObjectFromProp(unsigned int ulTag, unsigned int cbDa
     const unsigned char *lpData, unsigned int *lpulObjId)
 {
 	ECRESULT		er = erSuccess;
-	DB_RESULT lpDBResult;
-	DB_ROW			lpDBRow = NULL;
-	std::string		strQuery;
+	DB_STMT_RESULT lpDBResult;
 	ECDatabase*		lpDatabase = NULL;
     ECsIndexObject sNewIndexObject;
 	ECsIndexProp	sObject;
@@ -1608,18 +1792,17 @@ ECRESULT ECCacheManager::GetObjectFromProp(unsigned int ulTag, unsigned int cbDa
     if(er != erSuccess)
         goto exit;
     // Get them from the database
-    strQuery = "SELECT hierarchyid FROM indexedproperties WHERE tag="+stringify(ulTag)+" AND val_binary="+ lpDatabase->EscapeBinary(lpData, cbData) + " LIMIT 1";
-    er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	er = lpDatabase->DoSelectPrepared("SELECT hierarchyid FROM indexedproperties WHERE tag=? AND val_binary=? LIMIT 1",
+	     {ulTag, DB_PARAM(lpData, cbData)}, &lpDBResult);
     if(er != erSuccess)
 		goto exit;
-	lpDBRow = lpDBResult.fetch_row();
-    if(lpDBRow == NULL || lpDBRow[0] == NULL) {
+	if (!lpDBResult.fetch_row() || lpDBResult.is_null(0)) {
         er = KCERR_NOT_FOUND;
         goto exit;
     }
 
     sNewIndexObject.ulTag = ulTag;
-    sNewIndexObject.ulObjId = atoui(lpDBRow[0]);
+	sNewIndexObject.ulObjId = lpDBResult.get_uint(0);
 	sObject.ulTag = ulTag;
 	sObject.cbData = cbData;
 	sObject.lpData = const_cast<unsigned char *>(lpData); /* Cheap copy, set this item to nullptr before exiting */
@@ -1640,7 +1823,7 @@ ECRESULT ECCacheManager::QueryObjectFromProp(unsigned int ulTag, unsigned int cb
     const unsigned char *lpData, unsigned int *lpulObjId)
 {
 	ECsIndexProp	sObject;
-	ECsIndexObject	*sIndexObject;
+	const ECsIndexObject *sIndexObject;
 
 	if (lpData == nullptr || lpulObjId == nullptr || cbData == 0)
 		return KCERR_INVALID_PARAMETER;
@@ -1649,8 +1832,8 @@ ECRESULT ECCacheManager::QueryObjectFromProp(unsigned int ulTag, unsigned int cb
 	sObject.cbData = cbData;
 	sObject.lpData = const_cast<unsigned char *>(lpData); /* Cheap copy, set this item to nullptr before exiting */
 
-	scoped_rlock lock(m_hCacheIndPropMutex);
-	auto er = m_PropToObjectCache.GetCacheItem(sObject, &sIndexObject);
+	ECSharedLock lock(m_hCacheIndPropMutex);
+	auto er = m_PropToObjectCache.PeekCacheItem(sObject, &sIndexObject);
 	if (er == erSuccess)
 		*lpulObjId = sIndexObject->ulObjId;
 	sObject.lpData = NULL;
@@ -1993,4 +2176,397 @@ void ECsIndexProp::Copy(const ECsIndexProp &src, ECsIndexProp &dst)
 	dst.ulTag = src.ulTag;
 }
 
+/*
+ * Warm-start snapshot
+ *
+ * On a clean shutdown, the object, store, user object and PropToObject
+ * caches are written to cache_snapshot_file, and read back
+ * in bulk on the next start. The file is laid out for mmap: a header, a
+ * section table and the section payloads, all in host byte order and
+ * with every record a multiple of 4 bytes.
+ *
+ * The header carries the highest changes.id and hierarchy.id at the time
+ * of writing, and the hierarchy_deletes counter from the settings table,
+ * which DeleteObjectHard bumps before removing any rows. On load,
+ * entries are only checked against what happened in between: objects
+ * named in changes rows newer than the snapshot (by their own or their
+ * parent's source key) are dropped, everything else is taken as-is. That
+ * join cannot find objects which are gone from the database (hard
+ * deletes, purges), so if the deletion counter moved, the object and index
+ * sections are not loaded at all. If any counter went backwards, the database is not the one the snapshot was
+ * taken from and the whole file is ignored.
+ * The file is removed once mapped, so that an unclean shutdown never
+ * leaves an old snapshot behind for the following start.
+ *
+ * ACLs are not part of the snapshot: changing them leaves no trace in the
+ * changes table, so there would be no way to tell stale ones apart.
+ */
+namespace {
+
+enum {
+	SNAP_OBJECTS = 1, SNAP_STORES, SNAP_USEROBJECTS, SNAP_INDEX,
+	SNAP_SECTIONS = SNAP_INDEX,
+};
+
+static const char snap_magic[8] = {'K', 'C', 'C', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t SNAP_VERSION = 3, SNAP_BOM = 0x01020304;
+
+struct snap_header {
+	char magic[8];
+	uint32_t version, bom, nsect, pad;
+	GUID server_guid;
+	uint64_t changes_mark, hier_mark, delete_mark;
+	int64_t created;
+};
+
+struct snap_section {
+	uint32_t type, count;
+	uint64_t offset, length;
+};
+
+struct snap_object { uint32_t id, parent, owner, flags, type; };
+struct snap_store { uint32_t id, store, type; GUID guid; };
+/* followed by the extern id and signature bytes, padded to 4 */
+struct snap_user { uint32_t id, oclass, company, extern_len, sig_len; };
+/* followed by the property data, padded to 4 */
+struct snap_index { uint32_t obj_id, obj_tag, prop_tag, len; };
+
+static void snap_put(std::string &buf, const void *data, size_t z)
+{
+	buf.append(static_cast<const char *>(data), z);
+	buf.append((4 - z % 4) % 4, '\0');
+}
+
+/* Bounds-checked reader over one mapped section */
+class snap_reader final {
+	public:
+	snap_reader(const char *p, size_t z) : m_ptr(p), m_end(p + z) {}
+
+	template<typename T> bool get(T &out)
+	{
+		if (static_cast<size_t>(m_end - m_ptr) < sizeof(T))
+			return false;
+		memcpy(&out, m_ptr, sizeof(T));
+		m_ptr += sizeof(T);
+		return true;
+	}
+
+	const char *get_bytes(size_t z)
+	{
+		size_t padded = z + (4 - z % 4) % 4;
+		if (padded < z || static_cast<size_t>(m_end - m_ptr) < padded)
+			return nullptr;
+		auto p = m_ptr;
+		m_ptr += padded;
+		return p;
+	}
+
+	private:
+	const char *m_ptr, *m_end;
+};
+
+class snap_mapping final {
+	public:
+	~snap_mapping()
+	{
+		if (m_base != MAP_FAILED)
+			munmap(m_base, m_size);
+	}
+
+	void *m_base = MAP_FAILED;
+	size_t m_size = 0;
+};
+
+}
+
+ECRESULT ECCacheManager::I_GetChangeMarks(uint64_t *changes,
+    uint64_t *hierarchy, uint64_t *deletes)
+{
+	ECDatabase *db = nullptr;
+	DB_RESULT result;
+	auto er = m_lpDatabaseFactory->get_tls_db(&db);
+	if (er != erSuccess)
+		return er;
+	er = db->DoSelect("SELECT (SELECT MAX(id) FROM changes), (SELECT MAX(id) FROM hierarchy), "
+	     "(SELECT `value` FROM `settings` WHERE `name`='hierarchy_deletes')", &result);
+	if (er != erSuccess)
+		return er;
+	auto row = result.fetch_row();
+	if (row == nullptr)
+		return KCERR_DATABASE_ERROR;
+	*changes = row[0] != nullptr ? strtoull(row[0], nullptr, 0) : 0;
+	*hierarchy = row[1] != nullptr ? strtoull(row[1], nullptr, 0) : 0;
+	*deletes = row[2] != nullptr ? strtoull(row[2], nullptr, 0) : 0;
+	return erSuccess;
+}
+
+ECRESULT ECCacheManager::SaveSnapshot(const GUID &server_guid)
+{
+	if (m_strSnapshotFile.empty())
+		return erSuccess;
+
+	snap_header hdr{};
+	memcpy(hdr.magic, snap_magic, sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.bom = SNAP_BOM;
+	hdr.nsect = SNAP_SECTIONS;
+	hdr.server_guid = server_guid;
+	hdr.created = time(nullptr);
+	auto er = I_GetChangeMarks(&hdr.changes_mark, &hdr.hier_mark, &hdr.delete_mark);
+	if (er != erSuccess) {
+		ec_log_warn("Cache snapshot not written: unable to read change counters: %s", GetMAPIErrorMessage(kcerr_to_mapierr(er)));
+		return er;
+	}
+
+	std::string data[SNAP_SECTIONS];
+	snap_section sect[SNAP_SECTIONS]{};
+	for (unsigned int i = 0; i < SNAP_SECTIONS; ++i)
+		sect[i].type = i + 1;
+
+	m_ObjectsCache.Walk([&](unsigned int id, const ECsObjects &o) {
+		snap_object r{id, o.ulParent, o.ulOwner, o.ulFlags, o.ulType};
+		snap_put(data[SNAP_OBJECTS-1], &r, sizeof(r));
+		++sect[SNAP_OBJECTS-1].count;
+	});
+	m_StoresCache.Walk([&](unsigned int id, const ECsStores &o) {
+		snap_store r{id, o.ulStore, o.ulType, o.guidStore};
+		snap_put(data[SNAP_STORES-1], &r, sizeof(r));
+		++sect[SNAP_STORES-1].count;
+	});
+	{
+		scoped_rlock lock(m_hCacheMutex);
+		m_UserObjectCache.Walk([&](unsigned int id, const ECsUserObject &o) {
+			snap_user r{id, static_cast<uint32_t>(o.ulClass), o.ulCompanyId,
+				static_cast<uint32_t>(o.strExternId.size()),
+				static_cast<uint32_t>(o.strSignature.size())};
+			snap_put(data[SNAP_USEROBJECTS-1], &r, sizeof(r));
+			snap_put(data[SNAP_USEROBJECTS-1], o.strExternId.data(), o.strExternId.size());
+			snap_put(data[SNAP_USEROBJECTS-1], o.strSignature.data(), o.strSignature.size());
+			++sect[SNAP_USEROBJECTS-1].count;
+		});
+	}
+	{
+		ECSharedLock lock(m_hCacheIndPropMutex);
+		m_PropToObjectCache.Walk([&](const ECsIndexProp &k, const ECsIndexObject &o) {
+			snap_index r{o.ulObjId, o.ulTag, k.ulTag, k.cbData};
+			snap_put(data[SNAP_INDEX-1], &r, sizeof(r));
+			snap_put(data[SNAP_INDEX-1], k.lpData, k.cbData);
+			++sect[SNAP_INDEX-1].count;
+		});
+	}
+
+	uint64_t offset = sizeof(hdr) + sizeof(sect);
+	for (unsigned int i = 0; i < SNAP_SECTIONS; ++i) {
+		offset = (offset + 7) & ~7ULL;
+		sect[i].offset = offset;
+		sect[i].length = data[i].size();
+		offset += data[i].size();
+	}
+
+	auto tmpfile = m_strSnapshotFile + ".tmp";
+	auto fd = open(tmpfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		ec_log_warn("Cache snapshot not written: open %s: %s", tmpfile.c_str(), strerror(errno));
+		return KCERR_NO_ACCESS;
+	}
+	static const char zeroes[8]{};
+	bool ok = write_retry(fd, &hdr, sizeof(hdr)) == static_cast<ssize_t>(sizeof(hdr)) &&
+	          write_retry(fd, sect, sizeof(sect)) == static_cast<ssize_t>(sizeof(sect));
+	uint64_t pos = sizeof(hdr) + sizeof(sect);
+	for (unsigned int i = 0; ok && i < SNAP_SECTIONS; ++i) {
+		auto pad = sect[i].offset - pos;
+		ok = write_retry(fd, zeroes, pad) == static_cast<ssize_t>(pad) &&
+		     write_retry(fd, data[i].data(), data[i].size()) == static_cast<ssize_t>(data[i].size());
+		pos = sect[i].offset + sect[i].length;
+	}
+	ok = ok && force_buffers_to_disk(fd);
+	close(fd);
+	if (!ok || rename(tmpfile.c_str(), m_strSnapshotFile.c_str()) < 0) {
+		ec_log_warn("Cache snapshot not written to %s: %s", m_strSnapshotFile.c_str(), strerror(errno));
+		unlink(tmpfile.c_str());
+		return KCERR_CALL_FAILED;
+	}
+	ec_log_info("Cache snapshot written to %s: %u objects, %u stores, %u users, %u index entries (%llu bytes)",
+		m_strSnapshotFile.c_str(), sect[0].count, sect[1].count, sect[2].count,
+		sect[3].count, static_cast<unsigned long long>(pos));
+	return erSuccess;
+}
+
+ECRESULT ECCacheManager::LoadSnapshot(const GUID &server_guid)
+{
+	if (m_strSnapshotFile.empty())
+		return erSuccess;
+	auto start = std::chrono::steady_clock::now();
+	auto fd = open(m_strSnapshotFile.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			ec_log_warn("Cache snapshot %s not loaded: %s", m_strSnapshotFile.c_str(), strerror(errno));
+		return erSuccess;
+	}
+	struct stat sb;
+	snap_mapping map;
+	if (fstat(fd, &sb) == 0 && static_cast<size_t>(sb.st_size) >= sizeof(snap_header)) {
+		map.m_size = sb.st_size;
+		map.m_base = mmap(nullptr, map.m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	/* Consumed either way; it must not be reused after a crash. */
+	unlink(m_strSnapshotFile.c_str());
+	if (map.m_base == MAP_FAILED) {
+		ec_log_warn("Cache snapshot %s not loaded: unreadable", m_strSnapshotFile.c_str());
+		return erSuccess;
+	}
+
+	auto base = static_cast<const char *>(map.m_base);
+	snap_header hdr;
+	memcpy(&hdr, base, sizeof(hdr));
+	if (memcmp(hdr.magic, snap_magic, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != SNAP_VERSION || hdr.bom != SNAP_BOM ||
+	    hdr.nsect > 64 ||
+	    sizeof(hdr) + hdr.nsect * sizeof(snap_section) > map.m_size) {
+		ec_log_warn("Cache snapshot %s ignored: unknown format", m_strSnapshotFile.c_str());
+		return erSuccess;
+	}
+	if (hdr.server_guid != server_guid) {
+		ec_log_warn("Cache snapshot %s ignored: taken from another server", m_strSnapshotFile.c_str());
+		return erSuccess;
+	}
+	uint64_t changes = 0, hier = 0, deletes = 0;
+	auto er = I_GetChangeMarks(&changes, &hier, &deletes);
+	if (er != erSuccess)
+		return er;
+	if (changes < hdr.changes_mark || hier < hdr.hier_mark ||
+	    deletes < hdr.delete_mark) {
+		ec_log_warn("Cache snapshot %s ignored: database is older than the snapshot", m_strSnapshotFile.c_str());
+		return erSuccess;
+	}
+
+	/* Objects may have been removed since the snapshot was taken */
+	bool deletions = deletes != hdr.delete_mark;
+
+	/* Objects touched since the snapshot was taken */
+	std::unordered_set<unsigned int> stale;
+	if (changes > hdr.changes_mark && !deletions) {
+		ECDatabase *db = nullptr;
+		DB_RESULT result;
+		er = m_lpDatabaseFactory->get_tls_db(&db);
+		if (er != erSuccess)
+			return er;
+		auto mark = stringify_int64(hdr.changes_mark);
+		auto tag = stringify(PROP_ID(PR_SOURCE_KEY));
+		er = db->DoSelect("SELECT ip.hierarchyid FROM changes AS c "
+		     "JOIN indexedproperties AS ip ON ip.tag=" + tag + " AND ip.val_binary=c.sourcekey "
+		     "WHERE c.id > " + mark + " UNION "
+		     "SELECT ip.hierarchyid FROM changes AS c "
+		     "JOIN indexedproperties AS ip ON ip.tag=" + tag + " AND ip.val_binary=c.parentsourcekey "
+		     "WHERE c.id > " + mark, &result);
+		if (er != erSuccess)
+			return er;
+		for (auto row = result.fetch_row(); row != nullptr; row = result.fetch_row())
+			if (row[0] != nullptr)
+				stale.emplace(atoui(row[0]));
+	}
+
+	uint64_t total = 0, loaded = 0;
+	auto now = time(nullptr);
+	auto sect = reinterpret_cast<const snap_section *>(base + sizeof(hdr));
+	for (unsigned int s = 0; s < hdr.nsect; ++s) {
+		snap_section sc;
+		memcpy(&sc, &sect[s], sizeof(sc));
+		if (sc.offset > map.m_size || sc.length > map.m_size - sc.offset) {
+			ec_log_warn("Cache snapshot %s: section %u truncated", m_strSnapshotFile.c_str(), sc.type);
+			break;
+		}
+		snap_reader rd(base + sc.offset, sc.length);
+		total += sc.count;
+
+		switch (sc.type) {
+		case SNAP_OBJECTS: {
+			if (deletions)
+				break;
+			std::vector<std::pair<unsigned int, ECsObjects>> items;
+			snap_object r;
+			for (unsigned int i = 0; i < sc.count && rd.get(r); ++i) {
+				if (stale.find(r.id) != stale.cend())
+					continue;
+				ECsObjects o;
+				o.ulParent = r.parent;
+				o.ulOwner = r.owner;
+				o.ulFlags = r.flags;
+				o.ulType = r.type;
+				items.emplace_back(r.id, std::move(o));
+			}
+			loaded += items.size();
+			m_ObjectsCache.AddCacheItems(std::move(items));
+			break;
+		}
+		case SNAP_STORES: {
+			/* The store of an object never changes */
+			std::vector<std::pair<unsigned int, ECsStores>> items;
+			snap_store r;
+			for (unsigned int i = 0; i < sc.count && rd.get(r); ++i) {
+				ECsStores o;
+				o.ulStore = r.store;
+				o.ulType = r.type;
+				o.guidStore = r.guid;
+				items.emplace_back(r.id, std::move(o));
+			}
+			loaded += items.size();
+			m_StoresCache.AddCacheItems(std::move(items));
+			break;
+		}
+		case SNAP_USEROBJECTS: {
+			/* User data comes from the plugin; only age applies. */
+			auto maxage = m_UserObjectCache.MaxAge();
+			if (maxage != 0 && now - hdr.created >= maxage)
+				break;
+			snap_user r;
+			for (unsigned int i = 0; i < sc.count && rd.get(r); ++i) {
+				auto ext = rd.get_bytes(r.extern_len);
+				auto sig = ext != nullptr ? rd.get_bytes(r.sig_len) : nullptr;
+				if (sig == nullptr)
+					break;
+				if (I_AddUserObject(r.id, static_cast<objectclass_t>(r.oclass), r.company,
+				    std::string(ext, r.extern_len), std::string(sig, r.sig_len)) == erSuccess)
+					++loaded;
+			}
+			break;
+		}
+		case SNAP_INDEX: {
+			if (deletions)
+				break;
+			snap_index r;
+			for (unsigned int i = 0; i < sc.count && rd.get(r); ++i) {
+				auto d = rd.get_bytes(r.len);
+				if (d == nullptr)
+					break;
+				if (r.len == 0 || stale.find(r.obj_id) != stale.cend())
+					continue;
+				ECsIndexObject o;
+				o.ulObjId = r.obj_id;
+				o.ulTag = r.obj_tag;
+				if (I_AddIndexData(o, ECsIndexProp(r.prop_tag, reinterpret_cast<const unsigned char *>(d), r.len)) == erSuccess)
+					++loaded;
+			}
+			break;
+		}
+		default:
+			/* Sections from a later minor revision */
+			break;
+		}
+	}
+
+	m_snap_loaded = loaded;
+	m_snap_skipped = total - loaded;
+	m_snap_load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	if (deletions)
+		ec_log_info("Cache snapshot %s: objects were deleted since, object and index entries not restored", m_strSnapshotFile.c_str());
+	ec_log_notice("Cache snapshot loaded from %s: %llu of %llu entries restored (%.1f%%), %zu objects changed since, %llu ms",
+		m_strSnapshotFile.c_str(), static_cast<unsigned long long>(loaded),
+		static_cast<unsigned long long>(total),
+		total > 0 ? 100.0 * loaded / total : 0.0, stale.size(),
+		static_cast<unsigned long long>(m_snap_load_ms));
+	return erSuccess;
+}
+
 } /* namespace */
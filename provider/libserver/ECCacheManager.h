@@ -4,20 +4,25 @@
  */
 #pragma once
 #include <kopano/zcdefs.h>
+#include <atomic>
+#include <chrono>
 #include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <string>
 #include <tuple>
 #include <vector>
+#include "ECColumnCache.h"
 #include "ECDatabaseFactory.h"
 #include "ECDatabaseUtils.h"
 #include "ECGenericObjectTable.h"	// ECListInt
 #include <kopano/ECConfig.h>
 #include <kopano/ECLogger.h>
 #include "SOAPUtils.h"
+#include "StatsClient.h"
 #include "cmdutil.hpp"
 #include <mapidefs.h>
 #include <ECCache.h>
@@ -232,13 +237,154 @@ namespace KC {
 
 #define CACHE_NO_PARENT 0xFFFFFFFF
 
+/*
+ * Upper bound for the number of ids placed in one "IN()" clause, to keep
+ * statements well below max_allowed_packet.
+ */
+static const size_t CACHE_QUERY_CHUNK = 1000;
+
 enum {
 	KC_GETCELL_TRUNCATE = 1 << 0,
 	KC_GETCELL_NOTRUNC  = 0,
 	KC_GETCELL_NEGATIVES = 1 << 1,
 };
 
-class ECCacheManager final {
+/**
+ * A cache split by key hash into a number of independent ECCache shards,
+ * each guarded by its own reader/writer lock, so that worker threads
+ * looking up unrelated objects do not serialize on one mutex. The time
+ * spent waiting for a contended shard lock is accounted per shard.
+ */
+template<typename MapType> class ECShardedCache final {
+	public:
+	typedef typename MapType::key_type key_type;
+	typedef typename MapType::mapped_type mapped_type;
+
+	struct shard {
+		shard(const std::string &name, size_t size, long age) :
+			cache(name, size, age)
+		{}
+
+		KC::shared_mutex lock;
+		ECCache<MapType> cache;
+		std::atomic<uint64_t> lock_waits{0}, lock_wait_ns{0};
+	};
+
+	ECShardedCache(const std::string &name, size_t size, long age, unsigned int nshards) :
+		m_name(name)
+	{
+		if (nshards == 0)
+			nshards = 1;
+		for (unsigned int i = 0; i < nshards; ++i)
+			m_shards.emplace_back(new shard(name, size / nshards, age));
+	}
+
+	shard &get(const key_type &key)
+	{
+		return *m_shards[index(key)];
+	}
+
+	std::shared_lock<KC::shared_mutex> read_lock(shard &s) { return timed_lock<std::shared_lock<KC::shared_mutex>>(s); }
+	std::unique_lock<KC::shared_mutex> write_lock(shard &s) { return timed_lock<std::unique_lock<KC::shared_mutex>>(s); }
+
+	/* Insert a batch of items, taking each shard's write lock only once. */
+	void AddCacheItems(std::vector<std::pair<key_type, mapped_type>> &&items)
+	{
+		std::vector<std::vector<std::pair<key_type, mapped_type> *>> buckets(m_shards.size());
+		for (auto &e : items)
+			buckets[index(e.first)].push_back(&e);
+		for (size_t i = 0; i < buckets.size(); ++i) {
+			if (buckets[i].empty())
+				continue;
+			auto lk = write_lock(*m_shards[i]);
+			for (auto e : buckets[i])
+				m_shards[i]->cache.AddCacheItem(e->first, std::move(e->second));
+		}
+	}
+
+	/* Cache<>::Walk over all shards, one shard lock at a time */
+	template<typename F> void Walk(F &&f)
+	{
+		for (auto &s : m_shards) {
+			std::shared_lock<KC::shared_mutex> lk(s->lock);
+			s->cache.Walk(f);
+		}
+	}
+
+	void ClearCache()
+	{
+		for (auto &s : m_shards) {
+			std::lock_guard<KC::shared_mutex> lk(s->lock);
+			s->cache.ClearCache();
+		}
+	}
+
+	void SetMaxSize(size_t size)
+	{
+		for (auto &s : m_shards) {
+			std::lock_guard<KC::shared_mutex> lk(s->lock);
+			s->cache.SetMaxSize(size / m_shards.size());
+		}
+	}
+
+	size_t MaxSize() const
+	{
+		size_t z = 0;
+		for (const auto &s : m_shards)
+			z += s->cache.MaxSize();
+		return z;
+	}
+
+	/* Sum of all shards, so the stats keep their pre-sharding meaning. */
+	ECCacheStat get_stats()
+	{
+		ECCacheStat t{m_name, 0, 0, 0, 0, 0};
+		for (auto &s : m_shards) {
+			std::shared_lock<KC::shared_mutex> lk(s->lock);
+			auto st = s->cache.get_stats();
+			t.items += st.items;
+			t.size += st.size;
+			t.maxsize += st.maxsize;
+			t.req += st.req;
+			t.hit += st.hit;
+		}
+		return t;
+	}
+
+	void update_lock_stats(ECStatsCollector &sc) const
+	{
+		for (size_t i = 0; i < m_shards.size(); ++i) {
+			auto pfx = "cache_" + m_name + "_shard" + std::to_string(i);
+			auto dsc = "Cache " + m_name + " shard " + std::to_string(i);
+			sc.set(pfx + "_waits", dsc + " contended lock acquisitions", m_shards[i]->lock_waits.load());
+			sc.set(pfx + "_waitus", dsc + " lock wait time (us)", m_shards[i]->lock_wait_ns.load() / 1000);
+		}
+	}
+
+	private:
+	size_t index(const key_type &key) const
+	{
+		return typename MapType::hasher()(key) % m_shards.size();
+	}
+
+	template<typename L> L timed_lock(shard &s)
+	{
+		L lk(s.lock, std::try_to_lock);
+		if (lk.owns_lock())
+			return lk;
+		auto start = std::chrono::steady_clock::now();
+		lk.lock();
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		s.lock_wait_ns.fetch_add(ns.count(), std::memory_order_relaxed);
+		s.lock_waits.fetch_add(1, std::memory_order_relaxed);
+		return lk;
+	}
+
+	std::string m_name;
+	std::vector<std::unique_ptr<shard>> m_shards;
+};
+
+class KC_EXPORT ECCacheManager final {
 public:
 	ECCacheManager(std::shared_ptr<ECConfig>, ECDatabaseFactory *lpDatabase);
 	virtual ~ECCacheManager();
@@ -253,6 +399,9 @@ public:
 	ECRESULT QueryParent(unsigned int ulObjId, unsigned int *ulParent);
 
 	ECRESULT GetObjects(const std::list<sObjectTableKey> &lstObjects, std::map<sObjectTableKey, Objects> &mapObjects);
+	// Batched read-through: cache hits first, then one IN() query per chunk of misses
+	ECRESULT GetObjects(const std::vector<unsigned int> &ids, std::unordered_map<unsigned int, Objects> &out);
+	ECRESULT GetStores(const std::vector<unsigned int> &ids, std::unordered_map<unsigned int, Stores> &out, unsigned int maxdepth = 100);
 	ECRESULT GetObjectsFromProp(unsigned int ulTag, const std::vector<unsigned int> &cbdata, const std::vector<unsigned char *> &lpdata, std::map<IndexProp, unsigned int> &mapObjects);
 	ECRESULT GetStore(unsigned int ulObjId, unsigned int *ulStore, GUID *lpGuid, unsigned int maxdepth = 100);
 	ECRESULT GetStoreAndType(unsigned int ulObjId, unsigned int *ulStore, GUID *lpGuid, unsigned int *ulType, unsigned int maxdepth = 100);
@@ -292,6 +441,10 @@ public:
 	ECRESULT SetComplete(unsigned int ulObjId);
 	ECRESULT GetComplete(unsigned int ulObjId, bool &complete);
 	ECRESULT GetPropTags(unsigned int ulObjId, std::vector<unsigned int> &proptags);
+	// Columnar view of the same data, per folder (see ECColumnCache)
+	bool ColumnCacheEnabled() const { return !m_bCellCacheDisabled && m_ColumnCache.Enabled(); }
+	void GetColumns(unsigned int folder, const ECObjectTableList &, const struct propTagArray *, const std::vector<unsigned int> &cols, struct soap *, struct rowSet *, std::vector<bool> &done);
+	void SetColumns(unsigned int folder, const ECObjectTableList &, const struct propTagArray *, const std::vector<unsigned int> &cols, const struct rowSet *, const std::vector<bool> &skip);
 	// Cache Index properties
 
 	// Read-through
@@ -312,6 +465,10 @@ public:
 	ECRESULT GetExcludedIndexProperties(std::set<unsigned int>& set);
 	ECRESULT SetExcludedIndexProperties(const std::set<unsigned int> &);
 
+	// Warm-start snapshot of the hot caches (cache_snapshot_file)
+	ECRESULT SaveSnapshot(const GUID &server_guid);
+	ECRESULT LoadSnapshot(const GUID &server_guid);
+
 	// Test
 	void DisableCellCache();
 	void EnableCellCache();
@@ -344,13 +501,13 @@ private:
 
 	// Cache Index properties
 	ECRESULT I_AddIndexData(const IndexObject &, const IndexProp &);
+	void I_RemoveIndexData(unsigned int tag, unsigned int dsize, const unsigned char *data);
+	void I_RemoveIndexData(unsigned int tag, unsigned int obj_id);
+	ECRESULT I_GetChangeMarks(uint64_t *changes, uint64_t *hierarchy, uint64_t *deletes);
 
 	ECDatabaseFactory*	m_lpDatabaseFactory;
-	std::recursive_mutex m_hCacheMutex; /* User, ACL, server cache */
-	std::recursive_mutex m_hCacheStoreMutex;
-	std::recursive_mutex m_hCacheObjectMutex;
-	std::recursive_mutex m_hCacheCellsMutex; /* Cell cache */
-	std::recursive_mutex m_hCacheIndPropMutex; /* Indexed properties cache */
+	std::recursive_mutex m_hCacheMutex; /* User, quota, server cache */
+	KC::shared_mutex m_hCacheIndPropMutex; /* Indexed properties cache */
 	// Quota cache, to reduce the impact of the user plugin
 	// m_mapQuota contains user and company cache, except when it's the company user default quota
 	// m_mapQuotaUserDefault contains company user default quota
@@ -358,17 +515,19 @@ private:
 	ECCache<ECMapQuota>			m_QuotaCache;
 	ECCache<ECMapQuota>			m_QuotaUserDefaultCache;
 	// "hierarchy" table
-	ECCache<std::unordered_map<unsigned int, Objects>> m_ObjectsCache;
+	ECShardedCache<std::unordered_map<unsigned int, Objects>> m_ObjectsCache;
 	// Store cache (objid -> storeid/guid)
-	ECCache<std::unordered_map<unsigned int, Stores>> m_StoresCache;
+	ECShardedCache<std::unordered_map<unsigned int, Stores>> m_StoresCache;
 	// User cache
 	ECCache<std::unordered_map<unsigned int, UserObject>> m_UserObjectCache; /* userid to user object */
 	ECCache<std::map<UEIdKey, UEIdObject>> m_UEIdObjectCache; /* user type + externid to user object */
 	ECCache<std::unordered_map<unsigned int, UserObjectDetails>>	m_UserObjectDetailsCache; /* userid to user object data */
 	// ACL cache
-	ECCache<std::unordered_map<unsigned int, ACLs>> m_AclCache;
+	ECShardedCache<std::unordered_map<unsigned int, ACLs>> m_AclCache;
 	// properties and tproperties
-	ECCache<std::unordered_map<unsigned int, Cells>> m_CellCache;
+	ECShardedCache<std::unordered_map<unsigned int, Cells>> m_CellCache;
+	// contents table columns, by folder
+	ECColumnCache m_ColumnCache;
 	// Server cache
 	ECCache<std::map<std::string, ServerDetails>> m_ServerDetailsCache;
 	// "indexedproperties" index2: {tag, data(entryid or sourcekey)} -> {objid,tag}
@@ -378,6 +537,9 @@ private:
 	// Properties from kopano-search
 	std::set<unsigned int> 		m_setExcludedIndexProperties;
 	std::mutex m_hExcludedIndexPropertiesMutex;
+	// Warm-start snapshot
+	std::string m_strSnapshotFile;
+	uint64_t m_snap_loaded = 0, m_snap_skipped = 0, m_snap_load_ms = 0;
 };
 
 } /* namespace */
@@ -0,0 +1,524 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <kopano/mapiext.h>
+#include <kopano/ustringutil.h>
+#include "kcore.hpp"
+#include "soapH.h"
+#include "ECColumnCache.h"
+#include "ECDatabaseUtils.h"
+
+namespace KC {
+
+enum cc_kind { CC_LONG, CC_BOOL, CC_TIME, CC_STRING };
+
+enum cc_state : uint8_t {
+	CC_UNKNOWN = 0,
+	CC_VALUE,
+	CC_ABSENT, /* PT_ERROR/KCERR_NOT_FOUND */
+};
+
+/*
+ * The columns that message list views ask for on every page. String tags
+ * are in their database (PT_STRING8) form, see NormalizeDBPropTag.
+ */
+static const struct {
+	unsigned int tag;
+	enum cc_kind kind;
+} cc_columns[] = {
+	{PR_MESSAGE_DELIVERY_TIME, CC_TIME},
+	{PR_CLIENT_SUBMIT_TIME, CC_TIME},
+	{PR_LAST_MODIFICATION_TIME, CC_TIME},
+	{PR_MESSAGE_FLAGS, CC_LONG},
+	{PR_MESSAGE_SIZE, CC_LONG},
+	{PR_MSG_STATUS, CC_LONG},
+	{PR_IMPORTANCE, CC_LONG},
+	{PR_SENSITIVITY, CC_LONG},
+	{PR_FLAG_STATUS, CC_LONG},
+	{PR_ICON_INDEX, CC_LONG},
+	{PR_HASATTACH, CC_BOOL},
+	{PR_MESSAGE_CLASS_A, CC_STRING},
+	{PR_SUBJECT_A, CC_STRING},
+	{PR_SENDER_NAME_A, CC_STRING},
+	{PR_SENT_REPRESENTING_NAME_A, CC_STRING},
+	{PR_DISPLAY_TO_A, CC_STRING},
+};
+
+static constexpr unsigned int cc_ncolumns = ARRAY_SIZE(cc_columns);
+
+static int cc_column(unsigned int tag)
+{
+	tag = NormalizeDBPropTag(tag);
+	for (unsigned int c = 0; c < cc_ncolumns; ++c)
+		if (cc_columns[c].tag == tag)
+			return c;
+	return -1;
+}
+
+/* Reference-counted string table; codes of unused strings are reused */
+struct cc_dictionary {
+	std::unordered_map<std::string, unsigned int> index;
+	std::vector<const std::string *> str;
+	std::vector<unsigned int> refs, unused;
+	size_t bytes = 0;
+
+	unsigned int add(const char *s)
+	{
+		auto res = index.emplace(s, 0);
+		if (!res.second) {
+			++refs[res.first->second];
+			return res.first->second;
+		}
+		unsigned int code;
+		if (!unused.empty()) {
+			code = unused.back();
+			unused.pop_back();
+			str[code] = &res.first->first;
+			refs[code] = 1;
+		} else {
+			code = str.size();
+			str.push_back(&res.first->first);
+			refs.push_back(1);
+		}
+		res.first->second = code;
+		/* node, hash bucket and the std::string itself */
+		bytes += res.first->first.capacity() + 64;
+		return code;
+	}
+
+	void release(unsigned int code)
+	{
+		if (--refs[code] != 0)
+			return;
+		bytes -= str[code]->capacity() + 64;
+		index.erase(index.find(*str[code]));
+		str[code] = nullptr;
+		unused.push_back(code);
+	}
+
+	size_t size() const { return index.size(); }
+};
+
+struct cc_column_data {
+	std::vector<uint8_t> state;
+	std::vector<uint32_t> v32; /* CC_LONG, CC_BOOL, CC_STRING (code) */
+	std::vector<uint64_t> v64; /* CC_TIME */
+	cc_dictionary dict;
+};
+
+struct ECColumnCache::folder {
+	std::unordered_map<unsigned int, unsigned int> slots; /* objid -> slot */
+	std::vector<unsigned int> objids; /* slot -> objid, 0 if free */
+	std::vector<unsigned int> unused;
+	cc_column_data cols[cc_ncolumns];
+	mutable std::atomic<uint64_t> last_use{0};
+
+	unsigned int add_row(unsigned int objid);
+	void remove_row(unsigned int slot);
+	void clear(unsigned int slot, unsigned int c);
+	void set(unsigned int slot, unsigned int c, const struct propVal *);
+	void get(unsigned int slot, unsigned int c, unsigned int tag, struct soap *, struct propVal *) const;
+	size_t size() const;
+};
+
+unsigned int ECColumnCache::folder::add_row(unsigned int objid)
+{
+	unsigned int slot;
+	if (!unused.empty()) {
+		slot = unused.back();
+		unused.pop_back();
+		objids[slot] = objid;
+	} else {
+		slot = objids.size();
+		objids.push_back(objid);
+		for (unsigned int c = 0; c < cc_ncolumns; ++c) {
+			auto &col = cols[c];
+			col.state.push_back(CC_UNKNOWN);
+			if (cc_columns[c].kind == CC_TIME)
+				col.v64.push_back(0);
+			else
+				col.v32.push_back(0);
+		}
+	}
+	slots.emplace(objid, slot);
+	return slot;
+}
+
+void ECColumnCache::folder::remove_row(unsigned int slot)
+{
+	for (unsigned int c = 0; c < cc_ncolumns; ++c)
+		clear(slot, c);
+	slots.erase(objids[slot]);
+	objids[slot] = 0;
+	unused.push_back(slot);
+}
+
+void ECColumnCache::folder::clear(unsigned int slot, unsigned int c)
+{
+	auto &col = cols[c];
+	if (cc_columns[c].kind == CC_STRING && col.state[slot] == CC_VALUE)
+		col.dict.release(col.v32[slot]);
+	col.state[slot] = CC_UNKNOWN;
+}
+
+void ECColumnCache::folder::set(unsigned int slot, unsigned int c,
+    const struct propVal *pv)
+{
+	auto &col = cols[c];
+	auto kind = cc_columns[c].kind;
+	clear(slot, c);
+	if (PROP_TYPE(pv->ulPropTag) == PT_ERROR) {
+		if (pv->__union == SOAP_UNION_propValData_ul &&
+		    pv->Value.ul == KCERR_NOT_FOUND)
+			col.state[slot] = CC_ABSENT;
+		return;
+	}
+	switch (kind) {
+	case CC_LONG:
+		if (PROP_TYPE(pv->ulPropTag) != PT_LONG ||
+		    pv->__union != SOAP_UNION_propValData_ul)
+			return;
+		col.v32[slot] = pv->Value.ul;
+		break;
+	case CC_BOOL:
+		if (PROP_TYPE(pv->ulPropTag) != PT_BOOLEAN ||
+		    pv->__union != SOAP_UNION_propValData_b)
+			return;
+		col.v32[slot] = pv->Value.b;
+		break;
+	case CC_TIME:
+		if (PROP_TYPE(pv->ulPropTag) != PT_SYSTIME ||
+		    pv->__union != SOAP_UNION_propValData_hilo ||
+		    pv->Value.hilo == nullptr)
+			return;
+		col.v64[slot] = (static_cast<uint64_t>(pv->Value.hilo->hi) << 32) | pv->Value.hilo->lo;
+		break;
+	case CC_STRING:
+		if ((PROP_TYPE(pv->ulPropTag) != PT_STRING8 && PROP_TYPE(pv->ulPropTag) != PT_UNICODE) ||
+		    pv->__union != SOAP_UNION_propValData_lpszA ||
+		    pv->Value.lpszA == nullptr)
+			return;
+		/* Only what truncation would leave as it is */
+		if (u8_len(pv->Value.lpszA, TABLE_CAP_STRING) >= TABLE_CAP_STRING)
+			return;
+		col.v32[slot] = col.dict.add(pv->Value.lpszA);
+		break;
+	}
+	col.state[slot] = CC_VALUE;
+}
+
+/* Produce the cell the way ECCacheManager::GetCell would */
+void ECColumnCache::folder::get(unsigned int slot, unsigned int c,
+    unsigned int tag, struct soap *soap, struct propVal *pv) const
+{
+	auto &col = cols[c];
+	if (col.state[slot] == CC_ABSENT) {
+		pv->ulPropTag = CHANGE_PROP_TYPE(tag, PT_ERROR);
+		pv->__union = SOAP_UNION_propValData_ul;
+		pv->Value.ul = KCERR_NOT_FOUND;
+		return;
+	}
+	pv->ulPropTag = tag;
+	switch (cc_columns[c].kind) {
+	case CC_LONG:
+		pv->__union = SOAP_UNION_propValData_ul;
+		pv->Value.ul = col.v32[slot];
+		break;
+	case CC_BOOL:
+		pv->__union = SOAP_UNION_propValData_b;
+		pv->Value.b = col.v32[slot];
+		break;
+	case CC_TIME:
+		pv->__union = SOAP_UNION_propValData_hilo;
+		pv->Value.hilo = soap_new_hiloLong(soap);
+		pv->Value.hilo->hi = col.v64[slot] >> 32;
+		pv->Value.hilo->lo = col.v64[slot] & 0xffffffff;
+		break;
+	case CC_STRING: {
+		auto &s = *col.dict.str[col.v32[slot]];
+		pv->__union = SOAP_UNION_propValData_lpszA;
+		pv->Value.lpszA = soap_new_byte(soap, s.size() + 1);
+		memcpy(pv->Value.lpszA, s.c_str(), s.size() + 1);
+		break;
+	}
+	}
+}
+
+size_t ECColumnCache::folder::size() const
+{
+	/* two hash nodes per row: here and in m_objfolder */
+	size_t z = sizeof(*this) + slots.size() * 2 * 32 +
+	           (objids.capacity() + unused.capacity()) * sizeof(unsigned int);
+	for (const auto &col : cols)
+		z += col.state.capacity() + col.v32.capacity() * sizeof(uint32_t) +
+		     col.v64.capacity() * sizeof(uint64_t) + col.dict.bytes +
+		     (col.dict.str.capacity() + col.dict.refs.capacity()) * sizeof(void *);
+	return z;
+}
+
+ECColumnCache::ECColumnCache(size_t maxsize) :
+	m_maxsize(maxsize)
+{}
+
+ECColumnCache::~ECColumnCache()
+{}
+
+bool ECColumnCache::IsCachedColumn(unsigned int tag)
+{
+	return cc_column(tag) >= 0;
+}
+
+ECColumnCache::folder *ECColumnCache::Folder(unsigned int objid,
+    unsigned int *slot) const
+{
+	auto of = m_objfolder.find(objid);
+	if (of == m_objfolder.cend())
+		return nullptr;
+	auto fi = m_folders.find(of->second);
+	if (fi == m_folders.cend())
+		return nullptr;
+	auto si = fi->second->slots.find(objid);
+	if (si == fi->second->slots.cend())
+		return nullptr;
+	*slot = si->second;
+	return fi->second.get();
+}
+
+void ECColumnCache::Gather(unsigned int folder_id, const ECObjectTableList &rows,
+    const struct propTagArray *tags, const std::vector<unsigned int> &cols,
+    struct soap *soap, struct rowSet *rs, std::vector<bool> &done)
+{
+	if (!Enabled() || cols.empty())
+		return;
+	std::vector<int> slot;
+	slot.reserve(rows.size());
+	uint64_t req = 0, hit = 0;
+
+	std::shared_lock<KC::shared_mutex> lock(m_lock);
+	auto fi = m_folders.find(folder_id);
+	const folder *f = fi != m_folders.cend() ? fi->second.get() : nullptr;
+	if (f != nullptr)
+		f->last_use = ++m_clock;
+	for (const auto &row : rows) {
+		if (row.ulObjId == 0 || f == nullptr) {
+			req += row.ulObjId != 0;
+			slot.push_back(-1);
+			continue;
+		}
+		++req;
+		auto si = f->slots.find(row.ulObjId);
+		slot.push_back(si != f->slots.cend() ? si->second : -1);
+	}
+	req *= cols.size();
+	if (f != nullptr) {
+		/* One column at a time: the state and value arrays are contiguous */
+		for (auto k : cols) {
+			auto c = cc_column(tags->__ptr[k]);
+			if (c < 0)
+				continue;
+			const auto &state = f->cols[c].state;
+			for (size_t i = 0; i < slot.size(); ++i) {
+				if (slot[i] < 0 || state[slot[i]] == CC_UNKNOWN)
+					continue;
+				f->get(slot[i], c, tags->__ptr[k], soap, &rs->__ptr[i].__ptr[k]);
+				done[i * tags->__size + k] = true;
+				++hit;
+			}
+		}
+	}
+	lock.unlock();
+	m_req += req;
+	m_hit += hit;
+}
+
+void ECColumnCache::Store(unsigned int folder_id, const ECObjectTableList &rows,
+    const struct propTagArray *tags, const std::vector<unsigned int> &cols,
+    const struct rowSet *rs, const std::vector<bool> &skip)
+{
+	if (!Enabled() || cols.empty())
+		return;
+	std::unique_lock<KC::shared_mutex> lock(m_lock);
+	auto &fp = m_folders[folder_id];
+	size_t before = 0;
+	if (fp == nullptr)
+		fp.reset(new folder);
+	else
+		before = fp->size();
+	auto &f = *fp;
+	f.last_use = ++m_clock;
+	size_t i = 0;
+
+	for (const auto &row : rows) {
+		if (row.ulObjId == 0) {
+			++i;
+			continue;
+		}
+		unsigned int slot;
+		auto of = m_objfolder.emplace(row.ulObjId, folder_id);
+		if (!of.second && of.first->second != folder_id) {
+			/* An object is in one folder at a time; it has moved. */
+			auto old = m_folders.find(of.first->second);
+			if (old != m_folders.cend()) {
+				auto si = old->second->slots.find(row.ulObjId);
+				if (si != old->second->slots.cend()) {
+					auto z = old->second->size();
+					old->second->remove_row(si->second);
+					m_size -= z - old->second->size();
+				}
+			}
+			of.first->second = folder_id;
+		}
+		auto si = f.slots.find(row.ulObjId);
+		slot = si != f.slots.cend() ? si->second : f.add_row(row.ulObjId);
+		for (auto k : cols) {
+			if (skip[i * tags->__size + k])
+				continue;
+			auto c = cc_column(tags->__ptr[k]);
+			if (c >= 0)
+				f.set(slot, c, &rs->__ptr[i].__ptr[k]);
+		}
+		++i;
+	}
+	m_size += f.size() - before;
+	if (m_size > m_maxsize)
+		Evict(&f);
+	if (m_size > m_maxsize)
+		/* This one folder does not fit */
+		Evict(nullptr);
+}
+
+/* Drop least recently used folders until below 90% of the limit */
+void ECColumnCache::Evict(const folder *keep)
+{
+	std::vector<std::pair<uint64_t, unsigned int>> lru;
+	lru.reserve(m_folders.size());
+	for (const auto &p : m_folders)
+		if (p.second.get() != keep)
+			lru.emplace_back(p.second->last_use.load(), p.first);
+	std::sort(lru.begin(), lru.end());
+	for (const auto &e : lru) {
+		if (m_size <= m_maxsize / 10 * 9)
+			break;
+		auto fi = m_folders.find(e.second);
+		for (auto objid : fi->second->objids)
+			if (objid != 0)
+				m_objfolder.erase(objid);
+		m_size -= std::min(m_size, fi->second->size());
+		m_folders.erase(fi);
+	}
+}
+
+void ECColumnCache::Set(unsigned int objid, unsigned int tag,
+    const struct propVal *pv)
+{
+	if (!Enabled())
+		return;
+	auto c = cc_column(tag);
+	unsigned int slot;
+	if (c < 0)
+		return;
+	{
+		std::shared_lock<KC::shared_mutex> lock(m_lock);
+		if (m_objfolder.find(objid) == m_objfolder.cend())
+			return;
+	}
+	std::unique_lock<KC::shared_mutex> lock(m_lock);
+	auto f = Folder(objid, &slot);
+	if (f == nullptr)
+		return;
+	auto before = f->size();
+	f->set(slot, c, pv);
+	m_size += f->size() - before;
+}
+
+void ECColumnCache::Update(unsigned int objid, unsigned int tag, int delta)
+{
+	if (!Enabled())
+		return;
+	auto c = cc_column(tag);
+	unsigned int slot;
+	if (c < 0 || cc_columns[c].kind != CC_LONG)
+		return;
+	std::unique_lock<KC::shared_mutex> lock(m_lock);
+	auto f = Folder(objid, &slot);
+	if (f != nullptr && f->cols[c].state[slot] == CC_VALUE)
+		f->cols[c].v32[slot] += delta;
+}
+
+void ECColumnCache::Update(unsigned int objid, unsigned int tag,
+    unsigned int mask, unsigned int value)
+{
+	if (!Enabled())
+		return;
+	auto c = cc_column(tag);
+	unsigned int slot;
+	if (c < 0 || cc_columns[c].kind != CC_LONG)
+		return;
+	std::unique_lock<KC::shared_mutex> lock(m_lock);
+	auto f = Folder(objid, &slot);
+	if (f == nullptr || f->cols[c].state[slot] != CC_VALUE)
+		return;
+	auto &v = f->cols[c].v32[slot];
+	v = (v & ~mask) | (value & mask);
+}
+
+void ECColumnCache::Remove(unsigned int objid)
+{
+	if (!Enabled())
+		return;
+	unsigned int slot;
+	{
+		std::shared_lock<KC::shared_mutex> lock(m_lock);
+		if (m_objfolder.find(objid) == m_objfolder.cend())
+			return;
+	}
+	std::unique_lock<KC::shared_mutex> lock(m_lock);
+	auto f = Folder(objid, &slot);
+	if (f != nullptr) {
+		auto before = f->size();
+		f->remove_row(slot);
+		m_size -= before - f->size();
+	}
+	m_objfolder.erase(objid);
+}
+
+void ECColumnCache::Clear()
+{
+	std::unique_lock<KC::shared_mutex> lock(m_lock);
+	m_folders.clear();
+	m_objfolder.clear();
+	m_size = 0;
+}
+
+ECCacheStat ECColumnCache::get_stats() const
+{
+	std::shared_lock<KC::shared_mutex> lock(m_lock);
+	return ECCacheStat{"column", m_objfolder.size(), m_size, m_maxsize, m_req.load(), m_hit.load()};
+}
+
+size_t ECColumnCache::folders() const
+{
+	std::shared_lock<KC::shared_mutex> lock(m_lock);
+	return m_folders.size();
+}
+
+size_t ECColumnCache::strings() const
+{
+	std::shared_lock<KC::shared_mutex> lock(m_lock);
+	size_t n = 0;
+	for (const auto &f : m_folders)
+		for (const auto &col : f.second->cols)
+			n += col.dict.size();
+	return n;
+}
+
+} /* namespace */
@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <kopano/zcdefs.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <kopano/platform.h>
+#include <kopano/ECKeyTable.h>
+#include "soapH.h"
+#include <ECCache.h>
+
+struct soap;
+
+namespace KC {
+
+/*
+ * Columnar cache of the most frequently requested contents table columns.
+ *
+ * The cell cache keeps one property map per object, which is fine for
+ * single rows, but for a page of a large contents table it means a map
+ * lookup and a propVal copy per cell, from objects spread all over the
+ * heap. This cache keeps, per folder, one slot per message and one packed
+ * array per column:
+ *
+ * - fixed-width columns (times, flags, sizes) as plain 32- or 64-bit
+ *   values;
+ * - string columns as codes into a per-folder dictionary, since subjects,
+ *   sender names and message classes repeat a lot within a folder.
+ *
+ * A page is then served a column at a time by gathering the slots of its
+ * rows. Each cell also has a state: unknown (not cached), a value, or
+ * known to be absent (a PT_ERROR/KCERR_NOT_FOUND cell, like the cell cache
+ * keeps for complete objects).
+ *
+ * Only values that table truncation leaves alone are kept, so a cached
+ * cell is the same whatever the table limit is.
+ *
+ * The cache only learns about rows through Store(), which the table code
+ * calls with the folder the rows were read from. Afterwards it is kept in
+ * step by the same calls that maintain the cell cache (Set, Update,
+ * Remove), which is why ECCacheManager owns it. When over its size limit,
+ * whole folders are dropped, least recently used first.
+ */
+class ECColumnCache final {
+	public:
+	ECColumnCache(size_t maxsize);
+	~ECColumnCache();
+
+	/* Whether @tag is one of the cached columns */
+	static bool IsCachedColumn(unsigned int tag);
+	bool Enabled() const { return m_maxsize != 0; }
+
+	/*
+	 * Fill in the cells of the columns @cols (indexes into @tags) for
+	 * those @rows of @folder that are in the cache, and flag them in
+	 * @done (row-major, rows × tags->__size).
+	 */
+	void Gather(unsigned int folder, const ECObjectTableList &rows, const struct propTagArray *tags, const std::vector<unsigned int> &cols, struct soap *, struct rowSet *, std::vector<bool> &done);
+	/* Remember the cells of the columns @cols of @rows, except those in @skip */
+	void Store(unsigned int folder, const ECObjectTableList &rows, const struct propTagArray *tags, const std::vector<unsigned int> &cols, const struct rowSet *, const std::vector<bool> &skip);
+
+	/* Write-through from the cell cache; only affects rows already cached */
+	void Set(unsigned int objid, unsigned int tag, const struct propVal *);
+	void Update(unsigned int objid, unsigned int tag, int delta);
+	void Update(unsigned int objid, unsigned int tag, unsigned int mask, unsigned int value);
+	void Remove(unsigned int objid);
+	void Clear();
+
+	ECCacheStat get_stats() const;
+	size_t folders() const;
+	size_t strings() const;
+
+	private:
+	struct folder;
+
+	folder *Folder(unsigned int objid, unsigned int *slot) const;
+	void Evict(const folder *keep);
+
+	mutable KC::shared_mutex m_lock;
+	std::unordered_map<unsigned int, std::unique_ptr<folder>> m_folders;
+	std::unordered_map<unsigned int, unsigned int> m_objfolder; /* objid -> folder */
+	size_t m_size = 0, m_maxsize;
+	mutable std::atomic<uint64_t> m_req{0}, m_hit{0}, m_clock{0};
+};
+
+} /* namespace */
@@ -27,6 +27,10 @@ public:
 	virtual ECRESULT DoInsert(const std::string &query, unsigned int *insert_id = nullptr, unsigned int *affected_rows = nullptr) override;
 	virtual ECRESULT DoSequence(const std::string &seqname, unsigned int ulCount, unsigned long long *first_id) override;
 	virtual ECRESULT DoUpdate(const std::string &query, unsigned int *affected_rows = nullptr) override;
+	using KDatabase::DoSelectPrepared;
+	using KDatabase::DoUpdatePrepared;
+	virtual ECRESULT DoSelectPrepared(const char *tmpl, const DB_PARAM *, size_t nparam, DB_STMT_RESULT *) override;
+	virtual ECRESULT DoUpdatePrepared(const char *tmpl, const DB_PARAM *, size_t nparam, unsigned int *affected_rows = nullptr, unsigned int *insert_id = nullptr) override;
 	ECRESULT FinalizeMulti();
 	ECRESULT GetNextResult(DB_RESULT *);
 	ECRESULT InitializeDBState();
@@ -43,6 +47,7 @@ public:
 	ECRESULT GetFirstUpdate(unsigned int *lpulDatabaseRevision);
 	ECRESULT UpdateDatabaseVersion(unsigned int ulDatabaseRevision);
 	virtual ECRESULT Query(const std::string &q) override;
+	virtual ECRESULT Reconnect() override;
 
 	std::string error, m_dbname;
 	bool m_bForceUpdate = false, m_bFirstResult = false;
@@ -469,10 +469,7 @@ ECRESULT ECDatabase::Query(const std::string &strQuery)
 
 	if (err != 0 && should_reconnect(sqlerr)) {
 		ec_log_warn("SQL [%08lu] info: %s. Reconnecting.", m_lpMySQL.thread_id, mysql_error(&m_lpMySQL));
-		er = Close();
-		if(er != erSuccess)
-			return er;
-		er = Connect();
+		er = Reconnect();
 		if(er != erSuccess)
 			return er;
 		// Try again
@@ -498,6 +495,42 @@ ECRESULT ECDatabase::DoSelect(const std::string &strQuery,
 	return er;
 }
 
+/**
+ * Drop the current connection and establish a new one. Prepared statements
+ * are discarded along with the old session.
+ */
+ECRESULT ECDatabase::Reconnect()
+{
+	auto er = Close();
+	if (er != erSuccess)
+		return er;
+	return Connect();
+}
+
+ECRESULT ECDatabase::DoSelectPrepared(const char *tmpl, const DB_PARAM *param,
+    size_t nparam, DB_STMT_RESULT *res)
+{
+	auto er = KDatabase::DoSelectPrepared(tmpl, param, nparam, res);
+	m_stats->inc(SCN_DATABASE_SELECTS);
+	if (er != erSuccess) {
+		m_stats->inc(SCN_DATABASE_FAILED_SELECTS);
+		m_stats->SetTime(SCN_DATABASE_LAST_FAILED, time(nullptr));
+	}
+	return er;
+}
+
+ECRESULT ECDatabase::DoUpdatePrepared(const char *tmpl, const DB_PARAM *param,
+    size_t nparam, unsigned int *aff, unsigned int *idp)
+{
+	auto er = KDatabase::DoUpdatePrepared(tmpl, param, nparam, aff, idp);
+	m_stats->inc(SCN_DATABASE_UPDATES);
+	if (er != erSuccess) {
+		m_stats->inc(SCN_DATABASE_FAILED_UPDATES);
+		m_stats->SetTime(SCN_DATABASE_LAST_FAILED, time(nullptr));
+	}
+	return er;
+}
+
 ECRESULT ECDatabase::DoSelectMulti(const std::string &strQuery)
 {
 	ECRESULT er = erSuccess;
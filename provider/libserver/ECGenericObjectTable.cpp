@@ -116,6 +116,7 @@ ECGenericObjectTable::~ECGenericObjectTable()
 {
 	soap_del_PointerTopropTagArray(&lpsPropTagArray);
 	soap_del_PointerTosortOrderArray(&lpsSortOrderArray);
+	m_lpRestrictProgram.reset();
 	soap_del_PointerTorestrictTable(&lpsRestrict);
 	for (const auto &p : m_mapCategories)
 		delete p.second;
@@ -227,6 +228,11 @@ ECRESULT ECGenericObjectTable::FindRow(struct restrictTable *rt,
 	er = GetRestrictPropTags(rt, nullptr, &lpPropTags);
 	if(er != erSuccess)
 		return er;
+	std::shared_ptr<const ECRestrictionProgram> prog;
+	er = ECRestrictionProgram::Compile(rt, m_locale, &prog);
+	if (er != erSuccess)
+		return er;
+	auto cols = prog->Bind(lpPropTags);
 
 	// Loop through the rows, matching it with the search criteria
 	while(1) {
@@ -252,7 +258,7 @@ ECRESULT ECGenericObjectTable::FindRow(struct restrictTable *rt,
 		assert(lpRowSet->__size == static_cast<gsoap_size_t>(ecRowList.size()));
 		for (gsoap_size_t i = 0; i < lpRowSet->__size; ++i) {
 			// Match the row
-			er = MatchRowRestrict(cache, &lpRowSet->__ptr[i], rt, &sub_results, m_locale, &fMatch);
+			er = prog->Match(cache, &lpRowSet->__ptr[i], &sub_results, &fMatch, &cols);
 			if(er != erSuccess)
 				return er;
 			if(fMatch)
@@ -697,6 +703,7 @@ ECRESULT ECGenericObjectTable::Restrict(struct restrictTable *rt)
 	if (lpsRestrict == nullptr && rt == nullptr)
 		return er;
 	// Copy the restriction so we can remember it
+	m_lpRestrictProgram.reset();
 	soap_del_PointerTorestrictTable(&lpsRestrict);
 	lpsRestrict = nullptr;
 	if (rt != nullptr) {
@@ -743,6 +750,8 @@ ECRESULT ECGenericObjectTable::AddRowKey(ECObjectTableList* lpRows, unsigned int
 	struct rowSet		*lpRowSet = NULL;
 	struct propTagArray	*lpsRestrictPropTagArray = NULL;
 	struct restrictTable *rt = nullptr;
+	std::shared_ptr<const ECRestrictionProgram> prog;
+	ECRestrictionProgram::columns cols;
 	sObjectTableKey					sRowItem;
 	ECCategory		*lpCategory = NULL;
 	ulock_rec biglock(m_hLock);
@@ -765,6 +774,16 @@ ECRESULT ECGenericObjectTable::AddRowKey(ECObjectTableList* lpRows, unsigned int
 		if(er != erSuccess)
 			goto exit;
 		sPropTagArray.__size += lpsRestrictPropTagArray->__size; // restrict columns
+		// The stored restriction is compiled once, an override for each call
+		if (!bOverride)
+			prog = m_lpRestrictProgram;
+		if (prog == nullptr) {
+			er = ECRestrictionProgram::Compile(rt, m_locale, &prog);
+			if (er != erSuccess)
+				goto exit;
+			if (!bOverride)
+				m_lpRestrictProgram = prog;
+		}
 	}
 
 	++sPropTagArray.__size;	// for PR_INSTANCE_KEY
@@ -795,6 +814,8 @@ ECRESULT ECGenericObjectTable::AddRowKey(ECObjectTableList* lpRows, unsigned int
 	}
 
 	sPropTagArray.__size = n;
+	if (prog != nullptr)
+		cols = prog->Bind(&sPropTagArray);
 
 	for (auto iterRows = lpRows->cbegin(); iterRows != lpRows->cend(); ) {
 		sQueryRows.clear();
@@ -829,7 +850,7 @@ ECRESULT ECGenericObjectTable::AddRowKey(ECObjectTableList* lpRows, unsigned int
 
 			// Match the row with the restriction, if any
 			if (rt != nullptr) {
-				MatchRowRestrict(cache, &lpRowSet->__ptr[i], rt, &sub_results, m_locale, &fMatch);
+				prog->Match(cache, &lpRowSet->__ptr[i], &sub_results, &fMatch, &cols);
 				if (!fMatch) {
 					// this row isn't in the table, as it does not match the restrict criteria. Remove it as if it had
 					// been deleted if it was already in the table.
@@ -1393,6 +1414,23 @@ ECRESULT ECGenericObjectTable::UpdateRows(unsigned int ulType,
 	return er;
 }
 
+/**
+ * Update rows for a change notification
+ *
+ * Tables that share their rows with other sessions override this to apply
+ * each change of a folder only once; others just update their rows.
+ *
+ * @param seq Number of this change and of the one before it for the folder,
+ *            or zeroes if the change was not numbered or not passed on
+ *            unfiltered
+ */
+ECRESULT ECGenericObjectTable::UpdateSharedRows(unsigned int ulType,
+    const std::vector<unsigned int> &lstObjId, unsigned int ulFlags,
+    const sTableChangeSeq &seq)
+{
+	return UpdateRows(ulType, lstObjId, ulFlags, false);
+}
+
 ECRESULT ECGenericObjectTable::GetRestrictPropTagsRecursive(const struct restrictTable *lpsRestrict,
     std::list<ULONG> *lpPropTags, ULONG ulLevel)
 {
@@ -2419,8 +2457,7 @@ ECRESULT ECGenericObjectTable::RemoveCategoryAfterRemoveRow(sObjectTableKey sObj
 			continue;
 		}
 		// The category row is empty and must be removed
-		ECTableRow *lpRow = NULL; // reference to the row in the keytable
-		er = lpKeyTable->GetRow(&sCatRow, &lpRow);
+		er = lpKeyTable->GetRow(&sCatRow, nullptr);
 		if (er != erSuccess) {
 			assert(false);
 			goto exit;
@@ -2531,6 +2568,8 @@ size_t ECGenericObjectTable::GetObjectSize()
 	ulSize += SortOrderArraySize(lpsSortOrderArray);
 	ulSize += PropTagArraySize(lpsPropTagArray);
 	ulSize += RestrictTableSize(lpsRestrict);
+	if (m_lpRestrictProgram != nullptr)
+		ulSize += m_lpRestrictProgram->GetObjectSize();
 	ulSize += MEMORY_USAGE_LIST(m_listMVSortCols.size(), ECListInt);
 
 	ulSize += MEMORY_USAGE_MAP(mapObjects.size(), ECObjectTableMap);
@@ -12,6 +12,8 @@
 #include <list>
 #include <map>
 #include "ECSubRestriction.h"
+#include "ECRestrictionProgram.h"
+#include "ECSharedTables.h"
 #include <kopano/ECKeyTable.h>
 #include "ECDatabase.h"
 #include <kopano/ustringutil.h>
@@ -136,10 +138,12 @@ public:
 	virtual ECRESULT	Populate();
 	virtual ECRESULT	UpdateRow(unsigned int ulType, unsigned int ulObjId, unsigned int ulFlags);
 	virtual ECRESULT UpdateRows(unsigned int type, const std::vector<unsigned int> &objids, unsigned int flags, bool initial_load);
+	/* UpdateRows for change @seq of the folder (see ECSharedTables) */
+	virtual ECRESULT UpdateSharedRows(unsigned int type, const std::vector<unsigned int> &objids, unsigned int flags, const sTableChangeSeq &seq);
 	virtual ECRESULT LoadRows(const std::vector<unsigned int> &objids, unsigned int flags);
 	static ECRESULT	GetRestrictPropTagsRecursive(const struct restrictTable *, std::list<ULONG> *tags, ULONG level);
 	static ECRESULT	GetRestrictPropTags(const struct restrictTable *, std::list<ULONG> *tags, struct propTagArray **);
-	static ECRESULT	MatchRowRestrict(ECCacheManager *, struct propValArray *, const struct restrictTable *, const SUBRESTRICTIONRESULTS *, const ECLocale &, bool *match, unsigned int *nsubr = nullptr);
+	KC_EXPORT static ECRESULT MatchRowRestrict(ECCacheManager *, struct propValArray *, const struct restrictTable *, const SUBRESTRICTIONRESULTS *, const ECLocale &, bool *match, unsigned int *nsubr = nullptr);
 	virtual ECRESULT GetComputedDepth(struct soap *soap, ECSession *lpSession, unsigned int ulObjId, struct propVal *lpProp);
 
 	bool IsMVSet();
@@ -180,6 +184,7 @@ protected:
 	struct sortOrderArray *lpsSortOrderArray = nullptr; /* Stored sort order */
 	struct propTagArray *lpsPropTagArray = nullptr; /* Stored column set */
 	struct restrictTable *lpsRestrict = nullptr; /* Stored restriction */
+	std::shared_ptr<const ECRestrictionProgram> m_lpRestrictProgram; /* lpsRestrict, compiled on first use */
 	ECObjectTableMap			mapObjects;			// Map of all objects in this table
 	ECListInt					m_listMVSortCols;	// List of MV sort columns
 	bool m_bMVCols = false; /* Are there MV props in the column list */
@@ -3,11 +3,13 @@
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
 #include <kopano/platform.h>
+#include <algorithm>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <kopano/MAPIErrors.h>
@@ -674,69 +676,91 @@ static ECRESULT getchanges_hier(struct soap *soap, ECSession *lpSession,
 	 * folder above will be deleted correctly.
 	 */
 	std::list<unsigned int> lstFolderIds, lstChanges;
-	lstFolderIds.emplace_back(ulFolderId);
+	std::vector<unsigned int> level{ulFolderId};
+
+	/* Breadth-first loop through all folders, one hierarchy level at a time */
+	while (!level.empty()) {
+		std::vector<unsigned int> expand;
+		std::unordered_map<unsigned int, Objects> objs;
+
+		/* Prime the object cache for the permission checks in one query */
+		gcache->GetObjects(level, objs);
+		for (auto folder_id : level) {
+			lstFolderIds.emplace_back(folder_id);
+			if (folder_id == 0) {
+				if (lpSession->GetSecurity()->GetAdminLevel() != ADMIN_LEVEL_SYSADMIN)
+					return KCERR_NO_ACCESS;
+			} else if (lpSession->GetSecurity()->CheckPermission(folder_id, ecSecurityFolderVisible) != erSuccess) {
+				/*
+				 * We cannot traverse folders that we have no
+				 * permission to. This means that changes under the
+				 * inaccessible folder will disappear — this will cause
+				 * the sync peer to go out-of-sync. A fix would be to
+				 * remember changes in security as deletes and adds.
+				 */
+				continue;
+			}
+			if (ulChangeId != 0) {
+				std::unique_ptr<unsigned char[], sfree_delete> lpSourceKeyData;
+				ULONG cbSourceKeyData;
+				if (folder_id != 0 && gcache->GetPropFromObject(PROP_ID(PR_SOURCE_KEY), folder_id, nullptr, &cbSourceKeyData, &unique_tie(lpSourceKeyData)) != erSuccess)
+					continue; /* Item is hard deleted? */
+
+				/* Search folder changed folders */
+				auto strQuery = "SELECT changes.id FROM changes WHERE "
+							"  changes.id > " + stringify(ulChangeId) + 									// Change ID is N or later
+							"  AND changes.change_type >= " + stringify(ICS_FOLDER) +						// query optimizer
+							"  AND changes.change_type & " + stringify(ICS_FOLDER) + " != 0" +				// Change is a folder change
+							"  AND changes.sourcesync != " + stringify(ulSyncId);
+				if (folder_id != 0)
+					strQuery += "  AND parentsourcekey=" + lpDatabase->EscapeBinary(lpSourceKeyData.get(), cbSourceKeyData);
+				DB_RESULT lpDBResult;
+				DB_ROW lpDBRow;
+				auto er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+				if (er != erSuccess)
+					return er;
+				while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
+					if (lpDBRow[0] == nullptr) {
+						ec_log_err("K-1207: Received NULL values from SQL");
+						return KCERR_DATABASE_ERROR; /* this should never happen */
+					}
+					lstChanges.emplace_back(atoui(lpDBRow[0]));
+				}
+			}
 
-	/* Recursive loop through all folders */
-	for (auto folder_id : lstFolderIds) {
-		if (folder_id == 0) {
-			if (lpSession->GetSecurity()->GetAdminLevel() != ADMIN_LEVEL_SYSADMIN)
-				return KCERR_NO_ACCESS;
-		} else if (lpSession->GetSecurity()->CheckPermission(folder_id, ecSecurityFolderVisible) != erSuccess) {
-			/*
-			 * We cannot traverse folders that we have no
-			 * permission to. This means that changes under the
-			 * inaccessible folder will disappear — this will cause
-			 * the sync peer to go out-of-sync. A fix would be to
-			 * remember changes in security as deletes and adds.
-			 */
-			continue;
+			if (folder_id != 0)
+				expand.emplace_back(folder_id);
 		}
 
-		if (ulChangeId != 0) {
-			std::unique_ptr<unsigned char[], sfree_delete> lpSourceKeyData;
-			ULONG cbSourceKeyData;
-			if (folder_id != 0 && gcache->GetPropFromObject(PROP_ID(PR_SOURCE_KEY), folder_id, nullptr, &cbSourceKeyData, &unique_tie(lpSourceKeyData)) != erSuccess)
-				continue; /* Item is hard deleted? */
-
-			/* Search folder changed folders */
-			auto strQuery = "SELECT changes.id FROM changes WHERE "
-						"  changes.id > " + stringify(ulChangeId) + 									// Change ID is N or later
-						"  AND changes.change_type >= " + stringify(ICS_FOLDER) +						// query optimizer
-						"  AND changes.change_type & " + stringify(ICS_FOLDER) + " != 0" +				// Change is a folder change
-						"  AND changes.sourcesync != " + stringify(ulSyncId);
-			if (folder_id != 0)
-				strQuery += "  AND parentsourcekey=" + lpDatabase->EscapeBinary(lpSourceKeyData.get(), cbSourceKeyData);
+		/* Get subfolders for recursion, for the whole level at once */
+		std::unordered_map<unsigned int, std::vector<unsigned int>> children;
+		for (size_t pos = 0; pos < expand.size(); pos += CACHE_QUERY_CHUNK) {
+			std::vector<unsigned int> chunk(expand.begin() + pos,
+				expand.begin() + std::min(expand.size(), pos + CACHE_QUERY_CHUNK));
+			auto strQuery = "SELECT id, parent FROM hierarchy WHERE parent IN (" +
+				kc_join(chunk, ",", [](unsigned int id) { return stringify(id); }) +
+				") AND type = " + stringify(MAPI_FOLDER) + " AND flags = " + stringify(FOLDER_GENERIC);
+			if (ulFlags & SYNC_NO_SOFT_DELETIONS)
+				strQuery += " AND hierarchy.flags & 1024 = 0";
 			DB_RESULT lpDBResult;
 			DB_ROW lpDBRow;
 			auto er = lpDatabase->DoSelect(strQuery, &lpDBResult);
 			if (er != erSuccess)
 				return er;
 			while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
-				if (lpDBRow[0] == nullptr) {
-					ec_log_err("K-1207: Received NULL values from SQL");
+				if (lpDBRow[0] == nullptr || lpDBRow[1] == nullptr) {
+					ec_log_err("K-1208: Received NULL values from SQL");
 					return KCERR_DATABASE_ERROR; /* this should never happen */
 				}
-				lstChanges.emplace_back(atoui(lpDBRow[0]));
+				children[atoui(lpDBRow[1])].emplace_back(atoui(lpDBRow[0]));
 			}
 		}
-
-		if (folder_id == 0)
-			continue;
-		/* Get subfolders for recursion */
-		auto strQuery = "SELECT id FROM hierarchy WHERE parent = " + stringify(folder_id) + " AND type = " + stringify(MAPI_FOLDER) + " AND flags = " + stringify(FOLDER_GENERIC);
-		if (ulFlags & SYNC_NO_SOFT_DELETIONS)
-			strQuery += " AND hierarchy.flags & 1024 = 0";
-		DB_RESULT lpDBResult;
-		DB_ROW lpDBRow;
-		auto er = lpDatabase->DoSelect(strQuery, &lpDBResult);
-		if (er != erSuccess)
-			return er;
-		while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
-			if (lpDBRow[0] == nullptr) {
-				ec_log_err("K-1208: Received NULL values from SQL");
-				return KCERR_DATABASE_ERROR; /* this should never happen */
-			}
-			lstFolderIds.emplace_back(atoui(lpDBRow[0]));
+		/* Keep parents ahead of their children, in the same order as before */
+		level.clear();
+		for (auto folder_id : expand) {
+			auto c = children.find(folder_id);
+			if (c != children.cend())
+				level.insert(level.end(), c->second.cbegin(), c->second.cend());
 		}
 	}
 
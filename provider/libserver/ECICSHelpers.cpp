@@ -893,6 +893,8 @@ ECRESULT ECGetContentChangesHelper::MatchRestrictions(const std::vector<DB_ROW>
 	struct rowSet *lpRowSet = NULL;
 	std::set<SOURCEKEY> matches;
 	std::vector<unsigned int> cbdata;
+	std::shared_ptr<const ECRestrictionProgram> prog;
+	ECRestrictionProgram::columns cols;
 	std::vector<unsigned char *> lpdata;
 
 	memset(&sODStore, 0, sizeof(sODStore));
@@ -921,6 +923,11 @@ ECRESULT ECGetContentChangesHelper::MatchRestrictions(const std::vector<DB_ROW>
 	er = ECGenericObjectTable::GetRestrictPropTags(restrict, NULL, &lpPropTags);
 	if (er != erSuccess)
 		goto exit;
+	// @todo: Get a proper locale for the case insensitive comparisons
+	er = ECRestrictionProgram::Compile(restrict, createLocaleFromName(""), &prog);
+	if (er != erSuccess)
+		goto exit;
+	cols = prog->Bind(lpPropTags);
 	sODStore.lpGuid = new GUID;
 	er = gcache->GetStore(ulObjId, &sODStore.ulStoreId, sODStore.lpGuid);
 	if (er != erSuccess)
@@ -939,8 +946,7 @@ ECRESULT ECGetContentChangesHelper::MatchRestrictions(const std::vector<DB_ROW>
 	}
 
 	for (gsoap_size_t j = 0; j < lpRowSet->__size; ++j) {
-		// @todo: Get a proper locale for the case insensitive comparisons inside MatchRowRestrict
-		er = ECGenericObjectTable::MatchRowRestrict(gcache, &lpRowSet->__ptr[j], restrict, nullptr, createLocaleFromName(""), &fMatch);
+		er = prog->Match(gcache, &lpRowSet->__ptr[j], nullptr, &fMatch, &cols);
 		if(er != erSuccess)
 			goto exit;
 		if (fMatch)
@@ -9,6 +9,7 @@
 #include <kopano/stringutil.h>
 #include <kopano/scope.hpp>
 #include "ECSearchClient.h"
+#include "ECNativeIndex.h"
 #include "ECCacheManager.h"
 #include "cmdutil.hpp"
 #include <kopano/Util.h>
@@ -27,6 +28,8 @@
 
 namespace KC {
 
+static ECSearchClientPool g_search_pool;
+
 /**
  * Returns TRUE if the restriction is always FALSE.
  *
@@ -297,12 +300,12 @@ ECRESULT GetIndexerResults(ECDatabase *lpDatabase, ECConfig *lpConfig,
     std::string &suggestion)
 {
     ECRESULT er = erSuccess;
-	std::unique_ptr<ECSearchClient> lpSearchClient;
 	std::set<unsigned int> setExcludePropTags;
 	KC::time_point tstart;
 	LONGLONG llelapsedtime;
 	struct restrictTable *lpOptimizedRestrict = NULL;
 	std::list<SIndexedTerm> lstMultiSearches;
+	ECSearchClientPool::lease lpSearchClient;
 	const char* szSocket = lpConfig->GetSetting("search_socket");
 
 	auto laters = make_scope_success([&]() {
@@ -319,14 +322,34 @@ ECRESULT GetIndexerResults(ECDatabase *lpDatabase, ECConfig *lpConfig,
 	}
 	lstMatches.clear();
 	auto stype = lpConfig->GetSetting("search_enabled");
-	if (!parseBool(stype) || szSocket[0] == '\0')
+	auto native = g_lpSessionManager->GetNativeIndexer();
+	if (!parseBool(stype) || (native == nullptr && szSocket[0] == '\0'))
 		return er = KCERR_NOT_FOUND;
-	else
-		lpSearchClient.reset(new(std::nothrow) ECSearchClientNET(szSocket, atoui(lpConfig->GetSetting("search_timeout"))));
-	if (!lpSearchClient)
-		return er = KCERR_NOT_ENOUGH_MEMORY;
+	if (native != nullptr) {
+		/* Until the initial scan is done, the database knows better */
+		if (!native->ready())
+			return er = KCERR_NOT_FOUND;
+		setExcludePropTags = native->excluded();
+	} else {
+		auto timeout = atoui(lpConfig->GetSetting("search_timeout"));
+		lpSearchClient = g_search_pool.get(szSocket, timeout,
+		                 atoui(lpConfig->GetSetting("search_connections")));
+		if (lpSearchClient.waited)
+			g_lpSessionManager->m_stats->inc(SCN_INDEXER_POOL_WAITS);
+		if (lpSearchClient.fresh)
+			g_lpSessionManager->m_stats->inc(SCN_INDEXER_CONNECTS);
+		if (!lpSearchClient) {
+			ec_log_err("No free connection to search on \"%s\" within %u seconds", szSocket, timeout);
+			return er = lpSearchClient.waited ? KCERR_TIMEOUT : KCERR_NOT_ENOUGH_MEMORY;
+		}
+	}
 
-	if (lpCacheManager->GetExcludedIndexProperties(setExcludePropTags) != erSuccess) {
+	/*
+	 * kopano-search may have been restarted with a different set of
+	 * excluded properties when one of our connections broke.
+	 */
+	if (native == nullptr && (g_search_pool.props_stale() ||
+	    lpCacheManager->GetExcludedIndexProperties(setExcludePropTags) != erSuccess)) {
 		er = lpSearchClient->GetProperties(setExcludePropTags);
 		if (er == KCERR_NETWORK_ERROR)
 			ec_log_err("Error while connecting to search on \"%s\"", szSocket);
@@ -353,16 +376,29 @@ ECRESULT GetIndexerResults(ECDatabase *lpDatabase, ECConfig *lpConfig,
 
 	ec_log_debug("Using index, %zu index queries", lstMultiSearches.size());
 	tstart = decltype(tstart)::clock::now();
-	er = lpSearchClient->Query(guidServer, guidStore, lstFolders, lstMultiSearches, lstMatches, suggestion);
+	if (native != nullptr) {
+		suggestion.clear();
+		er = native->query(lpDatabase, *guidStore, lstFolders, lstMultiSearches, lstMatches);
+	} else {
+		er = lpSearchClient->Query(guidServer, guidStore, lstFolders, lstMultiSearches, lstMatches, suggestion);
+	}
 	llelapsedtime = std::chrono::duration_cast<std::chrono::microseconds>(decltype(tstart)::clock::now() - tstart).count();
 	g_lpSessionManager->m_stats->Max(SCN_INDEXER_SEARCH_MAX, llelapsedtime);
 	g_lpSessionManager->m_stats->avg(SCN_INDEXER_SEARCH_AVG, llelapsedtime);
+	g_lpSessionManager->m_stats->inc(llelapsedtime < 1000 ? SCN_INDEXER_SEARCH_LT1MS :
+		llelapsedtime < 10000 ? SCN_INDEXER_SEARCH_LT10MS :
+		llelapsedtime < 100000 ? SCN_INDEXER_SEARCH_LT100MS :
+		llelapsedtime < 1000000 ? SCN_INDEXER_SEARCH_LT1S : SCN_INDEXER_SEARCH_GE1S);
 
-	if (er != erSuccess) {
+	/*
+	 * The native index returns NOT_FOUND for terms without any words, and
+	 * for stores it dropped, where the database is searched instead.
+	 */
+	if (er != erSuccess && (native == nullptr || er != KCERR_NOT_FOUND)) {
 		g_lpSessionManager->m_stats->inc(SCN_INDEXER_SEARCH_ERRORS);
 		ec_log_err("Error while querying search on \"%s\": %s (%x)",
 			szSocket, GetMAPIErrorMessage(kcerr_to_mapierr(er)), er);
-	} else
+	} else if (er == erSuccess)
 		ec_log_debug("Indexed query results found in %u ms", static_cast<unsigned int>(llelapsedtime));
 
 	ec_log_debug("%zu indexed matches found", lstMatches.size());
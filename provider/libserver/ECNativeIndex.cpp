@@ -0,0 +1,871 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <unicode/uchar.h>
+#include <unicode/unistr.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <kopano/ECConfig.h>
+#include <kopano/ECLogger.h>
+#include <kopano/MAPIErrors.h>
+#include <kopano/stringutil.h>
+#include "ics.h"
+#include "ECMAPI.h"
+#include "ECCacheManager.h"
+#include "ECDatabase.h"
+#include "ECDatabaseFactory.h"
+#include "StatsClient.h"
+#include "ECNativeIndex.h"
+
+using namespace std::chrono_literals;
+
+namespace KC {
+
+/* Longer words (base64, URLs) are not worth indexing */
+static constexpr int32_t NI_MAX_WORD = 64;
+/* Text of a property past this is not indexed */
+static constexpr size_t NI_MAX_TEXT = 1 << 20;
+/* Messages read from the database at a time */
+static constexpr size_t NI_BATCH = 500;
+/* Buffered messages before the buffer is sealed into a segment */
+static constexpr size_t NI_FLUSH_DOCS = 1000;
+static constexpr size_t NI_MAX_SEGMENTS = 8;
+/* Change IDs that were skipped are looked for again this long */
+static constexpr auto NI_GAP_TIME = 60s;
+static constexpr size_t NI_MAX_GAPS = 10000;
+/* Deleted hits queued for the thread; more are left to the sweep */
+static constexpr size_t NI_MAX_STALE = 10000;
+
+/* Keys start with the property ID, so that a key prefix is a word prefix */
+static inline std::string ni_field(unsigned int propid)
+{
+	return {static_cast<char>((propid >> 8) & 0xFF), static_cast<char>(propid & 0xFF)};
+}
+
+static inline size_t ni_strbytes(const std::string &s)
+{
+	/* SSO strings live inside std::string itself */
+	return sizeof(std::string) + (s.size() >= sizeof(std::string) ? s.size() + 1 : 0);
+}
+
+/* Sorts @docs and codes the gaps between them as varints */
+static std::string ni_encode(std::vector<unsigned int> &docs)
+{
+	std::string out;
+	unsigned int prev = 0;
+
+	std::sort(docs.begin(), docs.end());
+	docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+	out.reserve(docs.size() * 2);
+	for (auto d : docs) {
+		auto v = d - prev;
+		prev = d;
+		for (; v >= 0x80; v >>= 7)
+			out += static_cast<char>(v | 0x80);
+		out += static_cast<char>(v);
+	}
+	return out;
+}
+
+template<typename F> static void ni_decode(const std::string &p, F &&f)
+{
+	unsigned int doc = 0;
+	for (size_t i = 0; i < p.size(); ) {
+		unsigned int v = 0, shift = 0;
+		uint8_t c;
+		do {
+			c = p[i++];
+			v |= (c & 0x7F) << shift;
+			shift += 7;
+		} while ((c & 0x80) && i < p.size());
+		doc += v;
+		f(doc);
+	}
+}
+
+void ECNativeIndex::words(const std::string &text, std::vector<std::string> &out)
+{
+	auto u = icu::UnicodeString::fromUTF8(text).foldCase();
+	int32_t len = u.length(), start = -1;
+
+	for (int32_t i = 0; ; i = u.moveIndex32(i, 1)) {
+		bool alnum = i < len && u_isalnum(u.char32At(i));
+		if (alnum && start < 0) {
+			start = i;
+		} else if (!alnum && start >= 0) {
+			if (i - start <= NI_MAX_WORD) {
+				std::string w;
+				u.tempSubStringBetween(start, i).toUTF8String(w);
+				out.emplace_back(std::move(w));
+			}
+			start = -1;
+		}
+		if (i >= len)
+			break;
+	}
+}
+
+bool ECNativeIndex::live(unsigned int doc, unsigned int seq) const
+{
+	auto i = m_docs.find(doc);
+	return i != m_docs.cend() && i->second.seq == seq;
+}
+
+void ECNativeIndex::update(unsigned int doc, unsigned int folder,
+    const fields_t &fields)
+{
+	std::set<std::string> keys;
+	std::vector<std::string> w;
+
+	for (const auto &f : fields) {
+		w.clear();
+		words(f.second, w);
+		auto field = ni_field(f.first);
+		for (const auto &x : w)
+			keys.emplace(field + x);
+	}
+
+	std::lock_guard<KC::shared_mutex> lk(m_lock);
+	auto i = m_docs.find(doc);
+	if (i != m_docs.cend() && (i->second.seq == m_bufseq || i->second.seq == 0))
+		/* The buffer already has postings of an older version */
+		seal();
+	for (const auto &k : keys) {
+		auto &p = m_buffer[k];
+		if (p.empty())
+			m_bufbytes += ni_strbytes(k) + sizeof(p) + 32;
+		p.emplace_back(doc);
+		m_bufbytes += sizeof(doc);
+	}
+	m_docs[doc] = {folder, m_bufseq};
+	++m_nbuffered;
+}
+
+void ECNativeIndex::remove(unsigned int doc)
+{
+	std::lock_guard<KC::shared_mutex> lk(m_lock);
+	auto i = m_docs.find(doc);
+	if (i == m_docs.cend())
+		return;
+	if (i->second.seq != m_bufseq) {
+		m_docs.erase(i);
+		return;
+	}
+	/* Keep a tombstone, so that a new version does not join the old postings */
+	i->second.seq = 0;
+	m_buftombs.emplace_back(doc);
+}
+
+void ECNativeIndex::flush()
+{
+	std::lock_guard<KC::shared_mutex> lk(m_lock);
+	seal();
+}
+
+void ECNativeIndex::seal()
+{
+	if (!m_buffer.empty()) {
+		auto seg = std::make_shared<segment>();
+		seg->seq = m_bufseq;
+		seg->bytes = sizeof(*seg);
+		seg->terms.reserve(m_buffer.size());
+		for (auto &e : m_buffer) {
+			auto p = ni_encode(e.second);
+			seg->bytes += ni_strbytes(e.first) + ni_strbytes(p);
+			seg->terms.emplace_back(e.first, std::move(p));
+		}
+		m_segments.emplace_back(std::move(seg));
+		m_buffer.clear();
+	}
+	for (auto d : m_buftombs) {
+		auto i = m_docs.find(d);
+		if (i != m_docs.cend() && i->second.seq == 0)
+			m_docs.erase(i);
+	}
+	m_buftombs.clear();
+	m_bufseq = m_nextseq++;
+	m_nbuffered = m_bufbytes = 0;
+}
+
+bool ECNativeIndex::merge(size_t max)
+{
+	std::vector<std::shared_ptr<const segment>> pick;
+	auto out = std::make_shared<segment>();
+	std::vector<unsigned int> docs;
+
+	if (max == 0)
+		max = 1;
+	std::shared_lock<KC::shared_mutex> rlk(m_lock);
+	if (m_segments.size() <= max)
+		return false;
+	/* The smallest ones, which are mostly the newest */
+	pick = m_segments;
+	std::sort(pick.begin(), pick.end(),
+		[](const auto &a, const auto &b) { return a->bytes < b->bytes; });
+	pick.resize(m_segments.size() - max + 1);
+
+	/*
+	 * Only this thread changes the index, so everything but queries can
+	 * wait until the merge is done; queries carry on meanwhile.
+	 */
+	std::vector<size_t> pos(pick.size());
+	out->bytes = sizeof(*out);
+	while (true) {
+		const std::string *key = nullptr;
+		for (size_t i = 0; i < pick.size(); ++i)
+			if (pos[i] < pick[i]->terms.size() &&
+			    (key == nullptr || pick[i]->terms[pos[i]].first < *key))
+				key = &pick[i]->terms[pos[i]].first;
+		if (key == nullptr)
+			break;
+		auto k = *key;
+		docs.clear();
+		for (size_t i = 0; i < pick.size(); ++i) {
+			if (pos[i] >= pick[i]->terms.size() || pick[i]->terms[pos[i]].first != k)
+				continue;
+			auto seq = pick[i]->seq;
+			ni_decode(pick[i]->terms[pos[i]].second, [&](unsigned int d) {
+				if (live(d, seq))
+					docs.emplace_back(d);
+			});
+			++pos[i];
+		}
+		if (docs.empty())
+			continue;
+		auto p = ni_encode(docs);
+		out->bytes += ni_strbytes(k) + ni_strbytes(p);
+		out->terms.emplace_back(std::move(k), std::move(p));
+	}
+	rlk.unlock();
+
+	std::unordered_set<unsigned int> seqs;
+	for (const auto &s : pick)
+		seqs.emplace(s->seq);
+	std::lock_guard<KC::shared_mutex> lk(m_lock);
+	out->seq = m_nextseq++;
+	for (auto &d : m_docs)
+		if (seqs.count(d.second.seq) > 0)
+			d.second.seq = out->seq;
+	m_segments.erase(std::remove_if(m_segments.begin(), m_segments.end(),
+		[&](const auto &s) { return seqs.count(s->seq) > 0; }),
+		m_segments.end());
+	if (!out->terms.empty())
+		m_segments.emplace_back(std::move(out));
+	return true;
+}
+
+void ECNativeIndex::lookup(const std::string &prefix,
+    std::vector<unsigned int> &out) const
+{
+	auto match = [&](const std::string &k) { return k.compare(0, prefix.size(), prefix) == 0; };
+
+	for (const auto &s : m_segments) {
+		auto i = std::lower_bound(s->terms.cbegin(), s->terms.cend(), prefix,
+		         [](const auto &t, const std::string &p) { return t.first < p; });
+		for (; i != s->terms.cend() && match(i->first); ++i)
+			ni_decode(i->second, [&](unsigned int d) {
+				if (live(d, s->seq))
+					out.emplace_back(d);
+			});
+	}
+	for (auto i = m_buffer.lower_bound(prefix); i != m_buffer.cend() && match(i->first); ++i)
+		for (auto d : i->second)
+			if (live(d, m_bufseq))
+				out.emplace_back(d);
+}
+
+ECRESULT ECNativeIndex::query(const std::list<unsigned int> &folders,
+    const std::list<SIndexedTerm> &terms, std::list<unsigned int> &matches) const
+{
+	std::vector<std::pair<const std::set<unsigned int> *, std::string>> lookfor;
+	std::vector<unsigned int> result, hits, both;
+	std::vector<std::string> w;
+
+	matches.clear();
+	m_used = time(nullptr);
+	for (const auto &t : terms) {
+		w.clear();
+		words(t.strTerm, w);
+		for (auto &x : w)
+			lookfor.emplace_back(&t.setFields, std::move(x));
+	}
+	if (lookfor.empty())
+		return KCERR_NOT_FOUND;
+
+	std::shared_lock<KC::shared_mutex> lk(m_lock);
+	for (size_t n = 0; n < lookfor.size(); ++n) {
+		hits.clear();
+		for (auto f : *lookfor[n].first)
+			lookup(ni_field(f) + lookfor[n].second, hits);
+		std::sort(hits.begin(), hits.end());
+		hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+		if (n == 0) {
+			result.swap(hits);
+		} else {
+			both.clear();
+			std::set_intersection(result.cbegin(), result.cend(),
+				hits.cbegin(), hits.cend(), std::back_inserter(both));
+			result.swap(both);
+		}
+		if (result.empty())
+			return erSuccess;
+	}
+
+	std::unordered_set<unsigned int> scope(folders.cbegin(), folders.cend());
+	for (auto d : result)
+		if (scope.empty() || scope.count(m_docs.at(d).folder) > 0)
+			matches.emplace_back(d);
+	return erSuccess;
+}
+
+std::vector<unsigned int> ECNativeIndex::docs() const
+{
+	std::vector<unsigned int> v;
+	std::shared_lock<KC::shared_mutex> lk(m_lock);
+	v.reserve(m_docs.size());
+	for (const auto &d : m_docs)
+		if (d.second.seq != 0)
+			v.emplace_back(d.first);
+	return v;
+}
+
+size_t ECNativeIndex::ndocs() const
+{
+	std::shared_lock<KC::shared_mutex> lk(m_lock);
+	return m_docs.size() - m_buftombs.size();
+}
+
+size_t ECNativeIndex::nsegments() const
+{
+	std::shared_lock<KC::shared_mutex> lk(m_lock);
+	return m_segments.size();
+}
+
+size_t ECNativeIndex::size() const
+{
+	std::shared_lock<KC::shared_mutex> lk(m_lock);
+	/* a node of the unordered_map costs about two pointers besides the pair */
+	size_t z = m_bufbytes + m_docs.size() * (sizeof(unsigned int) + sizeof(docinfo) + 2 * sizeof(void *));
+	for (const auto &s : m_segments)
+		z += s->bytes;
+	return z;
+}
+
+ECNativeIndexer::ECNativeIndexer(std::shared_ptr<Config> cfg,
+    std::shared_ptr<ECStatsCollector> stats, ECDatabaseFactory *dbf,
+    ECCacheManager *cache) :
+	m_config(std::move(cfg)), m_stats(std::move(stats)),
+	m_dbfactory(dbf), m_cache(cache)
+{
+	for (const auto &s : tokenize(m_config->GetSetting("search_native_exclude_properties"), " \t,"))
+		m_exclude.emplace(strtoul(s.c_str(), nullptr, 16));
+	auto ret = pthread_create(&m_thread, nullptr, Thread, this);
+	if (ret != 0) {
+		ec_log_err("Could not create native index thread: %s", strerror(ret));
+		return;
+	}
+	m_thread_active = true;
+	set_thread_name(m_thread, "nativeindex");
+}
+
+ECNativeIndexer::~ECNativeIndexer()
+{
+	ulock_normal l_exit(m_exit_lock);
+	m_exit = true;
+	m_exit_cond.notify_all();
+	l_exit.unlock();
+	if (m_thread_active)
+		pthread_join(m_thread, nullptr);
+}
+
+void *ECNativeIndexer::Thread(void *param)
+{
+	kcsrv_blocksigs();
+	static_cast<ECNativeIndexer *>(param)->Run();
+	return nullptr;
+}
+
+bool ECNativeIndexer::Exiting()
+{
+	std::lock_guard<std::mutex> lk(m_exit_lock);
+	return m_exit;
+}
+
+void ECNativeIndexer::Run()
+{
+	ECDatabase *db = nullptr;
+	auto last_flush = std::chrono::steady_clock::now(), last_sweep = last_flush;
+
+	while (true) {
+		auto wait = 1s;
+		if (db == nullptr && m_dbfactory->get_tls_db(&db) != erSuccess) {
+			ec_log_crit("Unable to get database connection for the native index");
+			db = nullptr;
+			wait = 60s;
+		} else if (!m_ready) {
+			auto start = std::chrono::steady_clock::now();
+			auto er = Build(db);
+			if (er != erSuccess) {
+				ec_log_err("Native index: scan of all messages failed: %s (%x)",
+					GetMAPIErrorMessage(kcerr_to_mapierr(er)), er);
+				wait = 60s;
+			} else if (!Exiting()) {
+				Maintain(true);
+				m_ready = true;
+				last_flush = last_sweep = std::chrono::steady_clock::now();
+				ec_log_info("Native index: %zu messages indexed in %lld s",
+					m_docstore.size(), static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(last_flush - start).count()));
+			}
+		} else {
+			DropStale();
+			auto er = Follow(db);
+			if (er != erSuccess)
+				ec_log_warn("Native index: reading changes failed: %s (%x)",
+					GetMAPIErrorMessage(kcerr_to_mapierr(er)), er);
+			auto now = std::chrono::steady_clock::now();
+			/* Idle buffers are sealed too, as segments are more compact */
+			Maintain(now - last_flush >= 5min);
+			if (now - last_flush >= 5min)
+				last_flush = now;
+			if (now - last_sweep >= 1h) {
+				Sweep(db);
+				last_sweep = now;
+			}
+		}
+
+		ulock_normal l_exit(m_exit_lock);
+		if (m_exit)
+			break;
+		m_exit_cond.wait_for(l_exit, wait);
+		if (m_exit)
+			break;
+	}
+	m_dbfactory->thread_end();
+}
+
+/* The index of @store, nullptr if it was dropped */
+ECNativeIndex *ECNativeIndexer::StoreIndex(const GUID &store)
+{
+	std::string key(reinterpret_cast<const char *>(&store), sizeof(store));
+	std::lock_guard<std::mutex> lk(m_stores_lock);
+	if (m_dropped.find(key) != m_dropped.cend())
+		return nullptr;
+	auto &idx = m_stores[key];
+	if (idx == nullptr)
+		idx = std::make_shared<ECNativeIndex>();
+	return idx.get();
+}
+
+/**
+ * Indexes all messages, in batches of ascending hierarchy ID. Changes that
+ * happen meanwhile are picked up from the change log afterwards.
+ */
+ECRESULT ECNativeIndexer::Build(ECDatabase *db)
+{
+	DB_RESULT res;
+	DB_ROW row;
+	std::vector<std::pair<unsigned int, unsigned int>> docs;
+	unsigned int last = 0;
+
+	std::unique_lock<std::mutex> lk(m_stores_lock);
+	m_stores.clear();
+	m_dropped.clear();
+	lk.unlock();
+	m_docstore.clear();
+	m_gaps.clear();
+
+	auto er = db->DoSelect("SELECT MAX(id) FROM changes", &res);
+	if (er != erSuccess)
+		return er;
+	row = res.fetch_row();
+	m_last_change = row != nullptr && row[0] != nullptr ? atoui(row[0]) : 0;
+
+	do {
+		if (Exiting())
+			return erSuccess;
+		docs.clear();
+		er = db->DoSelect("SELECT h.id, h.parent FROM hierarchy AS h "
+		     "JOIN hierarchy AS p ON p.id=h.parent AND p.type=" + stringify(MAPI_FOLDER) +
+		     " WHERE h.id > " + stringify(last) +
+		     " AND h.type=" + stringify(MAPI_MESSAGE) +
+		     " AND h.flags & " + stringify(MSGFLAG_DELETED | MSGFLAG_ASSOCIATED) + "=0"
+		     " ORDER BY h.id LIMIT " + stringify(NI_BATCH), &res);
+		if (er != erSuccess)
+			return er;
+		while ((row = res.fetch_row()) != nullptr)
+			if (row[0] != nullptr && row[1] != nullptr)
+				docs.emplace_back(atoui(row[0]), atoui(row[1]));
+		if (docs.empty())
+			break;
+		last = docs.back().first;
+		er = Index(db, docs);
+		if (er != erSuccess)
+			return er;
+		Maintain(false);
+	} while (docs.size() == NI_BATCH);
+	return erSuccess;
+}
+
+/**
+ * Reads the text of @docs, (message, folder) pairs, and files it in the
+ * index of the folder's store.
+ */
+ECRESULT ECNativeIndexer::Index(ECDatabase *db,
+    const std::vector<std::pair<unsigned int, unsigned int>> &docs)
+{
+	std::vector<unsigned int> folders;
+	std::unordered_map<unsigned int, Stores> stores;
+	std::unordered_map<unsigned int, ECNativeIndex::fields_t> text;
+	std::string in;
+	DB_RESULT res;
+	DB_ROW row;
+
+	if (docs.empty())
+		return erSuccess;
+	for (const auto &d : docs) {
+		folders.emplace_back(d.second);
+		if (!in.empty())
+			in += ',';
+		in += stringify(d.first);
+	}
+	auto er = m_cache->GetStores(folders, stores);
+	if (er != erSuccess)
+		return er;
+	er = db->DoSelect("SELECT hierarchyid, tag, val_string FROM properties "
+	     "WHERE hierarchyid IN (" + in + ") AND type IN (" +
+	     stringify(PT_STRING8) + "," + stringify(PT_UNICODE) + ")", &res);
+	if (er != erSuccess)
+		return er;
+	while ((row = res.fetch_row()) != nullptr) {
+		auto len = res.fetch_row_lengths();
+		if (row[0] == nullptr || row[1] == nullptr || row[2] == nullptr)
+			continue;
+		auto tag = atoui(row[1]);
+		if (m_exclude.find(tag) != m_exclude.cend())
+			continue;
+		text[atoui(row[0])].emplace_back(tag, std::string(row[2], std::min<size_t>(len[2], NI_MAX_TEXT)));
+	}
+
+	for (const auto &d : docs) {
+		auto st = stores.find(d.second);
+		if (st == stores.cend())
+			continue;
+		auto idx = StoreIndex(st->second.guidStore);
+		if (idx == nullptr)
+			continue;
+		auto &where = m_docstore[d.first];
+		if (where != nullptr && where != idx)
+			where->remove(d.first);
+		where = idx;
+		idx->update(d.first, d.second, text[d.first]);
+	}
+	return erSuccess;
+}
+
+/**
+ * Brings @docs up to date: indexes them again, or drops those that were
+ * deleted.
+ */
+ECRESULT ECNativeIndexer::Reindex(ECDatabase *db, const std::set<unsigned int> &docs)
+{
+	std::vector<std::pair<unsigned int, unsigned int>> index;
+	std::unordered_set<unsigned int> keep;
+	DB_RESULT res;
+	DB_ROW row;
+
+	for (auto i = docs.cbegin(); i != docs.cend(); ) {
+		std::string in;
+		for (size_t n = 0; i != docs.cend() && n < NI_BATCH; ++i, ++n) {
+			if (!in.empty())
+				in += ',';
+			in += stringify(*i);
+		}
+		index.clear();
+		auto er = db->DoSelect("SELECT id, parent, type, flags FROM hierarchy WHERE id IN (" + in + ")", &res);
+		if (er != erSuccess)
+			return er;
+		while ((row = res.fetch_row()) != nullptr) {
+			if (row[0] == nullptr || row[1] == nullptr || row[2] == nullptr || row[3] == nullptr)
+				continue;
+			if (atoui(row[2]) != MAPI_MESSAGE ||
+			    (atoui(row[3]) & (MSGFLAG_DELETED | MSGFLAG_ASSOCIATED)) != 0)
+				continue;
+			index.emplace_back(atoui(row[0]), atoui(row[1]));
+			keep.emplace(atoui(row[0]));
+		}
+		er = Index(db, index);
+		if (er != erSuccess)
+			return er;
+	}
+	for (auto d : docs) {
+		if (keep.find(d) != keep.cend())
+			continue;
+		auto i = m_docstore.find(d);
+		if (i == m_docstore.cend())
+			continue;
+		i->second->remove(d);
+		m_docstore.erase(i);
+	}
+	return erSuccess;
+}
+
+/**
+ * Reindexes the messages named in the change log since the last call.
+ *
+ * A change is logged in the transaction that makes it, so one that was
+ * still in flight may become visible after changes with a higher ID. IDs
+ * that were skipped are therefore looked for again for a while.
+ */
+ECRESULT ECNativeIndexer::Follow(ECDatabase *db)
+{
+	std::set<unsigned int> docs;
+	DB_RESULT res;
+	DB_ROW row;
+	auto now = std::chrono::steady_clock::now();
+
+	auto resolve = [&](DB_ROW r, DB_LENGTHS len) {
+		if (r[1] == nullptr || r[2] == nullptr)
+			return;
+		auto type = atoui(r[1]);
+		if (!(type & ICS_MESSAGE) || (type & ICS_ACTION_MASK) == ICS_FLAG)
+			return;
+		unsigned int obj = 0;
+		if (m_cache->GetObjectFromProp(PROP_ID(PR_SOURCE_KEY), len[2],
+		    reinterpret_cast<const unsigned char *>(r[2]), &obj) == erSuccess)
+			docs.emplace(obj);
+	};
+
+	std::string in;
+	for (auto i = m_gaps.begin(); i != m_gaps.end(); ) {
+		if (now - i->second > NI_GAP_TIME) {
+			i = m_gaps.erase(i);
+			continue;
+		}
+		if (!in.empty())
+			in += ',';
+		in += stringify(i->first);
+		++i;
+	}
+	if (!in.empty()) {
+		auto er = db->DoSelect("SELECT id, change_type, sourcekey FROM changes WHERE id IN (" + in + ")", &res);
+		if (er != erSuccess)
+			return er;
+		while ((row = res.fetch_row()) != nullptr) {
+			if (row[0] == nullptr)
+				continue;
+			m_gaps.erase(atoui(row[0]));
+			resolve(row, res.fetch_row_lengths());
+		}
+	}
+
+	size_t n;
+	do {
+		auto er = db->DoSelect("SELECT id, change_type, sourcekey FROM changes WHERE id > " +
+		          stringify(m_last_change) + " ORDER BY id LIMIT " + stringify(NI_BATCH), &res);
+		if (er != erSuccess)
+			return er;
+		for (n = 0; (row = res.fetch_row()) != nullptr; ++n) {
+			if (row[0] == nullptr)
+				continue;
+			auto id = atoui(row[0]);
+			for (auto g = m_last_change + 1; g < id && m_gaps.size() < NI_MAX_GAPS; ++g)
+				m_gaps.emplace(g, now);
+			m_last_change = id;
+			resolve(row, res.fetch_row_lengths());
+		}
+		if (docs.size() >= NI_BATCH || n < NI_BATCH) {
+			er = Reindex(db, docs);
+			if (er != erSuccess)
+				return er;
+			docs.clear();
+		}
+	} while (n == NI_BATCH && !Exiting());
+	return erSuccess;
+}
+
+/**
+ * Drops messages whose hard deletion went by unnoticed, because their
+ * source key could no longer be resolved by the time the change was read.
+ */
+ECRESULT ECNativeIndexer::Sweep(ECDatabase *db)
+{
+	std::vector<std::shared_ptr<ECNativeIndex>> all;
+	std::unordered_set<unsigned int> alive;
+	DB_RESULT res;
+	DB_ROW row;
+	size_t dropped = 0;
+
+	std::unique_lock<std::mutex> lk(m_stores_lock);
+	for (const auto &s : m_stores)
+		all.emplace_back(s.second);
+	lk.unlock();
+	for (const auto &idx : all) {
+		auto docs = idx->docs();
+		for (size_t i = 0; i < docs.size() && !Exiting(); ) {
+			std::string in;
+			size_t first = i;
+			for (size_t n = 0; i < docs.size() && n < NI_BATCH; ++i, ++n) {
+				if (!in.empty())
+					in += ',';
+				in += stringify(docs[i]);
+			}
+			auto er = db->DoSelect("SELECT id FROM hierarchy WHERE id IN (" + in +
+			          ") AND flags & " + stringify(MSGFLAG_DELETED) + "=0", &res);
+			if (er != erSuccess)
+				return er;
+			alive.clear();
+			while ((row = res.fetch_row()) != nullptr)
+				if (row[0] != nullptr)
+					alive.emplace(atoui(row[0]));
+			for (size_t j = first; j < i; ++j) {
+				if (alive.find(docs[j]) != alive.cend())
+					continue;
+				idx->remove(docs[j]);
+				m_docstore.erase(docs[j]);
+				++dropped;
+			}
+		}
+	}
+	if (dropped > 0)
+		ec_log_debug("Native index: dropped %zu deleted messages", dropped);
+	return erSuccess;
+}
+
+/* Drops the hits that query() found to be gone from the hierarchy */
+void ECNativeIndexer::DropStale()
+{
+	std::vector<unsigned int> stale;
+	std::unique_lock<std::mutex> lk(m_stale_lock);
+	stale.swap(m_stale);
+	lk.unlock();
+	for (auto d : stale) {
+		auto i = m_docstore.find(d);
+		if (i == m_docstore.cend())
+			continue;
+		i->second->remove(d);
+		m_docstore.erase(i);
+	}
+}
+
+/**
+ * Seals full buffers, merges segments, and keeps the indexes within
+ * search_native_max_size by dropping those of the stores that were
+ * searched least recently.
+ */
+void ECNativeIndexer::Maintain(bool force)
+{
+	std::vector<std::pair<std::string, std::shared_ptr<ECNativeIndex>>> all;
+	size_t docs = 0, bytes = 0;
+	size_t max = atoll(m_config->GetSetting("search_native_max_size"));
+
+	std::unique_lock<std::mutex> lk(m_stores_lock);
+	for (const auto &s : m_stores)
+		all.emplace_back(s.first, s.second);
+	lk.unlock();
+	for (const auto &s : all) {
+		auto &idx = s.second;
+		if (idx->nbuffered() >= NI_FLUSH_DOCS || (force && idx->nbuffered() > 0))
+			idx->flush();
+		idx->merge(NI_MAX_SEGMENTS);
+		docs += idx->ndocs();
+		bytes += idx->size();
+	}
+	if (max > 0 && bytes > max) {
+		std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) {
+			return a.second->last_used() < b.second->last_used();
+		});
+		std::unordered_set<const ECNativeIndex *> gone;
+		lk.lock();
+		for (const auto &s : all) {
+			if (bytes <= max)
+				break;
+			bytes -= std::min(bytes, s.second->size());
+			docs -= std::min(docs, s.second->ndocs());
+			m_stores.erase(s.first);
+			m_dropped.emplace(s.first);
+			gone.emplace(s.second.get());
+		}
+		lk.unlock();
+		for (auto i = m_docstore.begin(); i != m_docstore.end(); )
+			if (gone.find(i->second) != gone.cend())
+				i = m_docstore.erase(i);
+			else
+				++i;
+		ec_log_warn("Native index: over search_native_max_size, dropped the index of %zu stores; searches in them use the database until restart",
+			gone.size());
+	}
+	m_stats->set(SCN_INDEXER_NATIVE_DOCS, static_cast<LONGLONG>(docs));
+	m_stats->set(SCN_INDEXER_NATIVE_SIZE, static_cast<LONGLONG>(bytes));
+}
+
+/**
+ * Searches the index of @store. Hits that have been hard-deleted since
+ * they were indexed are left out, and handed to the thread to drop.
+ */
+ECRESULT ECNativeIndexer::query(ECDatabase *db, const GUID &store,
+    const std::list<unsigned int> &folders, const std::list<SIndexedTerm> &terms,
+    std::list<unsigned int> &matches)
+{
+	std::string key(reinterpret_cast<const char *>(&store), sizeof(store));
+	std::shared_ptr<ECNativeIndex> idx;
+	std::unique_lock<std::mutex> lk(m_stores_lock);
+	auto i = m_stores.find(key);
+	if (i != m_stores.cend())
+		idx = i->second;
+	else if (m_dropped.find(key) != m_dropped.cend())
+		return KCERR_NOT_FOUND;
+	lk.unlock();
+	matches.clear();
+	if (idx == nullptr)
+		/* No message of this store has been indexed */
+		return erSuccess;
+	auto er = idx->query(folders, terms, matches);
+	if (er != erSuccess || matches.empty())
+		return er;
+
+	std::unordered_set<unsigned int> alive;
+	DB_RESULT res;
+	DB_ROW row;
+	for (auto m = matches.cbegin(); m != matches.cend(); ) {
+		std::string in;
+		for (size_t n = 0; m != matches.cend() && n < NI_BATCH; ++m, ++n) {
+			if (!in.empty())
+				in += ',';
+			in += stringify(*m);
+		}
+		er = db->DoSelect("SELECT id FROM hierarchy WHERE id IN (" + in + ")", &res);
+		if (er != erSuccess)
+			return er;
+		while ((row = res.fetch_row()) != nullptr)
+			if (row[0] != nullptr)
+				alive.emplace(atoui(row[0]));
+	}
+	std::unique_lock<std::mutex> slk(m_stale_lock);
+	for (auto m = matches.begin(); m != matches.end(); ) {
+		if (alive.find(*m) != alive.cend()) {
+			++m;
+			continue;
+		}
+		if (m_stale.size() < NI_MAX_STALE)
+			m_stale.emplace_back(*m);
+		m = matches.erase(m);
+	}
+	return erSuccess;
+}
+
+} /* namespace */
@@ -0,0 +1,171 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <kopano/zcdefs.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <ctime>
+#include <pthread.h>
+#include <kopano/platform.h>
+#include <kopano/kcodes.h>
+#include "ECSearchClient.h"
+
+namespace KC {
+
+class Config;
+class ECCacheManager;
+class ECDatabase;
+class ECDatabaseFactory;
+class ECStatsCollector;
+
+/*
+ * In-process full-text index of the messages of one store, answering the
+ * same multi-field searches (SIndexedTerm) that kopano-search does.
+ *
+ * Every string property of a message, except the excluded ones, is split
+ * into case-folded words, and the message's hierarchy ID is filed under
+ * (property ID, word). A word of a search term matches every indexed word
+ * it is a prefix of, in any of the term's fields; a message matches when
+ * all words of all terms match.
+ *
+ * New text goes to an in-memory buffer. flush() seals the buffer into an
+ * immutable segment: the sorted terms, each with a posting list of
+ * delta-coded varints. merge() folds segments together so that queries
+ * look in only a few of them. Segments are never modified. Instead, each
+ * document records the sequence number of the segment (or buffer) holding
+ * its current text; postings found in any other segment are stale, are
+ * skipped by queries and are dropped when that segment is merged.
+ *
+ * update(), remove(), flush() and merge() must all be called from one
+ * thread (ECNativeIndexer's); query() may run concurrently from any thread.
+ */
+class KC_EXPORT ECNativeIndex final {
+	public:
+	/* (property ID, utf-8 text) */
+	typedef std::vector<std::pair<unsigned int, std::string>> fields_t;
+
+	/* Replaces the text of @doc, which lives in @folder */
+	void update(unsigned int doc, unsigned int folder, const fields_t &);
+	void remove(unsigned int doc);
+	/*
+	 * Matching documents in @folders (all folders if empty), in
+	 * ascending order. KCERR_NOT_FOUND if there is no word to look for.
+	 */
+	ECRESULT query(const std::list<unsigned int> &folders, const std::list<SIndexedTerm> &, std::list<unsigned int> &matches) const;
+	void flush();
+	/* Merges segments until there are no more than @max; false if none were */
+	bool merge(size_t max);
+
+	std::vector<unsigned int> docs() const;
+	size_t ndocs() const;
+	size_t nbuffered() const { return m_nbuffered; }
+	size_t nsegments() const;
+	/* Approximate memory use in bytes */
+	size_t size() const;
+	/* When the index was made or last queried */
+	time_t last_used() const { return m_used; }
+
+	/* Case-folded words of @text, as the index files them */
+	static void words(const std::string &text, std::vector<std::string> &);
+
+	private:
+	struct segment {
+		std::vector<std::pair<std::string, std::string>> terms; /* key, postings */
+		unsigned int seq;
+		size_t bytes;
+	};
+	struct docinfo {
+		unsigned int folder, seq;
+	};
+
+	void seal();
+	void lookup(const std::string &prefix, std::vector<unsigned int> &) const;
+	bool live(unsigned int doc, unsigned int seq) const;
+
+	mutable KC::shared_mutex m_lock;
+	std::unordered_map<unsigned int, docinfo> m_docs;
+	std::map<std::string, std::vector<unsigned int>> m_buffer;
+	std::vector<unsigned int> m_buftombs; /* removed while in the buffer */
+	std::vector<std::shared_ptr<const segment>> m_segments;
+	unsigned int m_bufseq = 1, m_nextseq = 2;
+	size_t m_nbuffered = 0, m_bufbytes = 0;
+	mutable std::atomic<time_t> m_used{time(nullptr)};
+};
+
+/*
+ * Keeps an ECNativeIndex of every store up to date with the database.
+ *
+ * At startup, all messages are indexed by one scan of the hierarchy
+ * table. From then on, the thread follows the ICS change log (the changes
+ * table) and reindexes every message that was created, changed, moved or
+ * deleted. The log records source keys, and the source key of a message
+ * that was hard-deleted no longer resolves; those are found by a sweep
+ * that runs every hour. Meanwhile query() leaves out hits that are no
+ * longer in the hierarchy table, and has the thread drop them.
+ *
+ * The index lives in memory only, and is rebuilt at every start. Until
+ * the initial scan finished, ready() is false and searches fall back to
+ * the database. When all indexes together grow over
+ * search_native_max_size, those of the stores searched least recently are
+ * dropped; searches in those stores use the database until the next start.
+ */
+class ECNativeIndexer final {
+	public:
+	ECNativeIndexer(std::shared_ptr<Config>, std::shared_ptr<ECStatsCollector>, ECDatabaseFactory *, ECCacheManager *);
+	~ECNativeIndexer();
+
+	bool ready() const { return m_ready; }
+	const std::set<unsigned int> &excluded() const { return m_exclude; }
+	/* KCERR_NOT_FOUND when the store's index was dropped */
+	ECRESULT query(ECDatabase *, const GUID &store, const std::list<unsigned int> &folders, const std::list<SIndexedTerm> &, std::list<unsigned int> &matches);
+
+	private:
+	static void *Thread(void *);
+	void Run();
+	ECRESULT Build(ECDatabase *);
+	ECRESULT Follow(ECDatabase *);
+	ECRESULT Sweep(ECDatabase *);
+	ECRESULT Reindex(ECDatabase *, const std::set<unsigned int> &docs);
+	ECRESULT Index(ECDatabase *, const std::vector<std::pair<unsigned int, unsigned int>> &docs);
+	ECNativeIndex *StoreIndex(const GUID &);
+	void Maintain(bool force);
+	void DropStale();
+	bool Exiting();
+
+	std::shared_ptr<Config> m_config;
+	std::shared_ptr<ECStatsCollector> m_stats;
+	ECDatabaseFactory *m_dbfactory;
+	ECCacheManager *m_cache;
+	std::set<unsigned int> m_exclude;
+
+	mutable std::mutex m_stores_lock;
+	std::unordered_map<std::string, std::shared_ptr<ECNativeIndex>> m_stores; /* by store GUID */
+	std::unordered_set<std::string> m_dropped; /* over search_native_max_size */
+	std::mutex m_stale_lock;
+	std::vector<unsigned int> m_stale; /* gone from the hierarchy, seen by query() */
+	/* Only used by the thread */
+	std::unordered_map<unsigned int, ECNativeIndex *> m_docstore;
+	std::map<unsigned int, std::chrono::steady_clock::time_point> m_gaps;
+	unsigned int m_last_change = 0;
+
+	std::mutex m_exit_lock;
+	std::condition_variable m_exit_cond;
+	pthread_t m_thread;
+	bool m_thread_active = false, m_exit = false;
+	std::atomic<bool> m_ready{false};
+};
+
+} /* namespace */
@@ -3,6 +3,7 @@
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
 #pragma once
+#include <string>
 #include <kopano/zcdefs.h>
 #include "soapH.h"
 
@@ -21,6 +22,7 @@ public:
 	void SetConnection(unsigned int ulConnection);
 	void GetCopy(struct soap *, notification &) const;
 	size_t GetObjectSize() const;
+	bool CoalesceKey(std::string &) const;
 
 protected:
 	void Init();
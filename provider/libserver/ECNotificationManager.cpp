@@ -7,6 +7,8 @@
 #include <cstring>
 #include <set>
 #include <pthread.h>
+#include <mapidefs.h>
+#include <mapitags.h>
 #include "ECMAPI.h"
 #include "ECNotification.h"
 #include "ECNotificationManager.h"
@@ -79,18 +81,71 @@ size_t ECNotification::GetObjectSize() const
 	return NotificationStructSize(m_lpsNotification);
 }
 
+/**
+ * Gives the key under which a later notification supersedes this one when
+ * both are delivered in the same batch: a TABLE_ROW_MODIFIED event for the
+ * same row, or an fnevObjectModified event for the same object, on the same
+ * advise connection. The last one carries the current state anyway.
+ *
+ * @return whether the notification can be coalesced at all
+ */
+bool ECNotification::CoalesceKey(std::string &key) const
+{
+	auto n = m_lpsNotification;
+	const xsd__base64Binary *id = nullptr;
+	char type;
+
+	if (n->ulEventType == fnevTableModified && n->tab != nullptr &&
+	    n->tab->ulTableEvent == TABLE_ROW_MODIFIED &&
+	    n->tab->propIndex.ulPropTag == PR_INSTANCE_KEY &&
+	    n->tab->propIndex.__union == SOAP_UNION_propValData_bin) {
+		id = n->tab->propIndex.Value.bin;
+		type = 't';
+	} else if (n->ulEventType == fnevObjectModified && n->obj != nullptr &&
+	    n->obj->pPropTagArray == nullptr) {
+		id = n->obj->pEntryId;
+		type = 'o';
+	}
+	if (id == nullptr || id->__ptr == nullptr)
+		return false;
+	key.assign(reinterpret_cast<const char *>(&n->ulConnection), sizeof(n->ulConnection));
+	key += type;
+	key.append(reinterpret_cast<const char *>(id->__ptr), id->__size);
+	return true;
+}
+
+static inline void soap_serialize_rsp(struct soap *soap, const struct notifyResponse *r)
+{
+	soap_serialize_notifyResponse(soap, r);
+}
+
+static inline int soap_put_rsp(struct soap *soap, const struct notifyResponse *r)
+{
+	return soap_put_notifyResponse(soap, r, "ns:notifyResponse", nullptr);
+}
+
+static inline void soap_serialize_rsp(struct soap *soap, const struct notifyMultiResponse *r)
+{
+	soap_serialize_notifyMultiResponse(soap, r);
+}
+
+static inline int soap_put_rsp(struct soap *soap, const struct notifyMultiResponse *r)
+{
+	return soap_put_notifyMultiResponse(soap, r, "ns:notifyMultiResponse", nullptr);
+}
+
 // Copied from generated soapServer.cpp
-static int soapresponse(struct notifyResponse notifications, struct soap *soap)
+template<typename T> static int soapresponse(T notifications, struct soap *soap)
 {
     soap_serializeheader(soap);
-    soap_serialize_notifyResponse(soap, &notifications);
+    soap_serialize_rsp(soap, &notifications);
     if (soap_begin_count(soap))
         return soap->error;
     if (soap->mode & SOAP_IO_LENGTH)
     {	if (soap_envelope_begin_out(soap)
          || soap_putheader(soap)
          || soap_body_begin_out(soap)
-         || soap_put_notifyResponse(soap, &notifications, "ns:notifyResponse", NULL)
+         || soap_put_rsp(soap, &notifications)
          || soap_body_end_out(soap)
          || soap_envelope_end_out(soap))
             return soap->error;
@@ -100,7 +155,7 @@ static int soapresponse(struct notifyResponse notifications, struct soap *soap)
      || soap_envelope_begin_out(soap)
      || soap_putheader(soap)
      || soap_body_begin_out(soap)
-     || soap_put_notifyResponse(soap, &notifications, "ns:notifyResponse", NULL)
+     || soap_put_rsp(soap, &notifications)
      || soap_body_end_out(soap)
      || soap_envelope_end_out(soap)
      || soap_end_send(soap))
@@ -133,19 +188,64 @@ ECNotificationManager::~ECNotificationManager()
 		pthread_join(m_thread, nullptr);
 
     // Close and free any pending requests (clients will receive EOF)
+	std::set<struct soap *> done;
 	for (const auto &p : m_mapRequests) {
+		/* A multi request is in here once for each of its sessions */
+		if (!done.emplace(p.second->soap).second)
+			continue;
 		// we can't call kopano_notify_done here, race condition on shutdown in ECSessionManager vs ECDispatcher
-		kopano_end_soap_connection(p.second.soap);
-		soap_destroy(p.second.soap);
-		soap_end(p.second.soap);
-		soap_free(p.second.soap);
+		kopano_end_soap_connection(p.second->soap);
+		soap_destroy(p.second->soap);
+		soap_end(p.second->soap);
+		soap_free(p.second->soap);
     }
 }
 
+/*
+ * Answers @req without notifications and forgets it. Called with
+ * m_mutexRequests held.
+ */
+void ECNotificationManager::Interrupt(std::shared_ptr<NOTIFREQUEST> req)
+{
+	auto soap = req->soap;
+	int ret;
+
+	// Return the previous request as an error
+	if (req->multi) {
+		struct notifyMultiResponse rsp;
+		soap_default_notifyMultiResponse(soap, &rsp);
+		rsp.er = KCERR_NOT_FOUND;
+		ret = soapresponse(rsp, soap);
+	} else {
+		struct notifyResponse notifications;
+		soap_default_notifyResponse(soap, &notifications);
+		notifications.er = KCERR_NOT_FOUND; // Should be something like 'INTERRUPTED' or something
+		ret = soapresponse(notifications, soap);
+	}
+	if (ret)
+		// Handle error on the response
+		soap_send_fault(soap);
+	soap_destroy(soap);
+	soap_end(soap);
+	Remove(req);
+	// Pass the socket back to the socket manager (which will probably close it since the client should not be holding two notification sockets)
+	if (kopano_notify_done != nullptr)
+		kopano_notify_done(soap);
+}
+
+/* Drops all references to @req from m_mapRequests; m_mutexRequests is held */
+void ECNotificationManager::Remove(const std::shared_ptr<NOTIFREQUEST> &req)
+{
+	for (auto ses : req->sessions) {
+		auto i = m_mapRequests.find(ses);
+		if (i != m_mapRequests.cend() && i->second == req)
+			m_mapRequests.erase(i);
+	}
+}
+
 // Called by the SOAP handler
 HRESULT ECNotificationManager::AddRequest(ECSESSIONID ecSessionId, struct soap *soap)
 {
-    struct soap *lpItem = NULL;
 	ulock_normal l_req(m_mutexRequests);
 	auto iterRequest = m_mapRequests.find(ecSessionId);
 	if (iterRequest != m_mapRequests.cend()) {
@@ -155,26 +255,14 @@ HRESULT ECNotificationManager::AddRequest(ECSESSIONID ecSessionId, struct soap *
 
 		ec_log_warn("Replacing notification request for ID %llu",
 			static_cast<unsigned long long>(ecSessionId));
-
-        // Return the previous request as an error
-        struct notifyResponse notifications;
-        soap_default_notifyResponse(iterRequest->second.soap, &notifications);
-        notifications.er = KCERR_NOT_FOUND; // Should be something like 'INTERRUPTED' or something
-		if (soapresponse(notifications, iterRequest->second.soap))
-			// Handle error on the response
-			soap_send_fault(iterRequest->second.soap);
-		soap_destroy(iterRequest->second.soap);
-		soap_end(iterRequest->second.soap);
-        lpItem = iterRequest->second.soap;
-        // Pass the socket back to the socket manager (which will probably close it since the client should not be holding two notification sockets)
-		if (kopano_notify_done != nullptr)
-			kopano_notify_done(lpItem);
+		Interrupt(iterRequest->second);
     }
 
-    NOTIFREQUEST req;
-    req.soap = soap;
-    time(&req.ulRequestTime);
-    m_mapRequests[ecSessionId] = req;
+	auto req = std::make_shared<NOTIFREQUEST>();
+	req->soap = soap;
+	time(&req->ulRequestTime);
+	req->sessions.emplace_back(ecSessionId);
+	m_mapRequests[ecSessionId] = std::move(req);
 	l_req.unlock();
     // There may already be notifications waiting for this session, so post a change on this session so that the
     // thread will attempt to get notifications on this session
@@ -182,6 +270,87 @@ HRESULT ECNotificationManager::AddRequest(ECSESSIONID ecSessionId, struct soap *
     return hrSuccess;
 }
 
+/*
+ * Called by the SOAP handler of notifyGetItemsMulti. The multiplexing
+ * client restarts its request whenever the set of sessions changes, so
+ * replacing an older multi request is the normal case here.
+ */
+HRESULT ECNotificationManager::AddRequest(std::vector<ECSESSIONID> &&sessions,
+    struct soap *soap)
+{
+	auto req = std::make_shared<NOTIFREQUEST>();
+	req->soap = soap;
+	time(&req->ulRequestTime);
+	req->multi = true;
+	req->sessions = std::move(sessions);
+
+	ulock_normal l_req(m_mutexRequests);
+	for (auto ses : req->sessions) {
+		auto i = m_mapRequests.find(ses);
+		if (i == m_mapRequests.cend())
+			continue;
+		if (i->second->multi)
+			ec_log_debug("Replacing multiplexed notification request for ID %llu",
+				static_cast<unsigned long long>(ses));
+		else
+			ec_log_warn("Replacing notification request for ID %llu",
+				static_cast<unsigned long long>(ses));
+		Interrupt(i->second);
+	}
+	for (auto ses : req->sessions)
+		m_mapRequests[ses] = req;
+	l_req.unlock();
+	for (auto ses : req->sessions)
+		NotifyChange(ses);
+	return hrSuccess;
+}
+
+/*
+ * Collects the notifications of all sessions of a multi request and answers
+ * it if there were any, or if the request has waited long enough. Returns
+ * whether the request was answered. m_mutexRequests is held.
+ */
+bool ECNotificationManager::ProcessMulti(NOTIFREQUEST &req)
+{
+	auto soap = req.soap;
+	struct notifyMultiResponse rsp;
+	std::vector<struct notifyGroupItems> groups;
+
+	soap_default_notifyMultiResponse(soap, &rsp);
+	for (auto ses : req.sessions) {
+		ECSession *lpecSession = nullptr;
+		struct notifyGroupItems g;
+
+		soap_default_notifyGroupItems(soap, &g);
+		g.ulSessionId = ses;
+		if (g_lpSessionManager->ValidateSession(soap, ses, &lpecSession) != erSuccess) {
+			g.er = KCERR_END_OF_SESSION;
+			groups.emplace_back(g);
+			continue;
+		}
+		struct notifyResponse notifications;
+		soap_default_notifyResponse(soap, &notifications);
+		auto er = lpecSession->GetNotifyItems(soap, &notifications);
+		lpecSession->unlock();
+		if (er == KCERR_NOT_FOUND)
+			continue;
+		g.er = er;
+		g.pNotificationArray = notifications.pNotificationArray;
+		groups.emplace_back(g);
+	}
+	if (groups.empty() && time(nullptr) - req.ulRequestTime < m_ulTimeout)
+		return false;
+
+	rsp.er = erSuccess;
+	rsp.sGroups.__size = groups.size();
+	rsp.sGroups.__ptr  = groups.data();
+	if (soapresponse(rsp, soap))
+		soap_send_fault(soap);
+	soap_destroy(soap);
+	soap_end(soap);
+	return true;
+}
+
 // Called by a session when it has a notification to send
 HRESULT ECNotificationManager::NotifyChange(ECSESSIONID ecSessionId)
 {
@@ -225,15 +394,23 @@ void *ECNotificationManager::Work() {
 
             // Find the request for the session that had something to say
             auto iterRequest = m_mapRequests.find(ses);
-            if (iterRequest != m_mapRequests.cend()) {
+            if (iterRequest != m_mapRequests.cend() && iterRequest->second->multi) {
+				auto req = iterRequest->second;
+				if (!ProcessMulti(*req)) {
+					l_req.unlock();
+					continue;
+				}
+				lpItem = req->soap;
+				Remove(req);
+            } else if (iterRequest != m_mapRequests.cend()) {
                 // Reset notification response to default values
-                soap_default_notifyResponse(iterRequest->second.soap, &notifications);
-                if (g_lpSessionManager->ValidateSession(iterRequest->second.soap, ses, &lpecSession) == erSuccess) {
+                soap_default_notifyResponse(iterRequest->second->soap, &notifications);
+                if (g_lpSessionManager->ValidateSession(iterRequest->second->soap, ses, &lpecSession) == erSuccess) {
                     // Get the notifications from the session
-					auto er = lpecSession->GetNotifyItems(iterRequest->second.soap, &notifications);
+					auto er = lpecSession->GetNotifyItems(iterRequest->second->soap, &notifications);
 
                     if(er == KCERR_NOT_FOUND) {
-                        if(time(NULL) - iterRequest->second.ulRequestTime < m_ulTimeout) {
+                        if(time(NULL) - iterRequest->second->ulRequestTime < m_ulTimeout) {
                             // No notifications - this means we have to wait. This can happen if the session was marked active since
                             // the request was just made, and there may have been notifications still waiting for us
 							l_req.unlock();
@@ -242,8 +419,8 @@ void *ECNotificationManager::Work() {
                         } else {
                             // No notifications and we're out of time, just respond OK with 0 notifications
                             er = erSuccess;
-							notifications.pNotificationArray = soap_new_notificationArray(iterRequest->second.soap);
-                            soap_default_notificationArray(iterRequest->second.soap, notifications.pNotificationArray);
+							notifications.pNotificationArray = soap_new_notificationArray(iterRequest->second->soap);
+                            soap_default_notificationArray(iterRequest->second->soap, notifications.pNotificationArray);
                         }
                     }
 
@@ -255,16 +432,16 @@ void *ECNotificationManager::Work() {
                 }
 
                 // Send the SOAP data
-				if (soapresponse(notifications, iterRequest->second.soap))
+				if (soapresponse(notifications, iterRequest->second->soap))
 					// Handle error on the response
-					soap_send_fault(iterRequest->second.soap);
+					soap_send_fault(iterRequest->second->soap);
 				// Free allocated SOAP data (in GetNotifyItems())
-				soap_destroy(iterRequest->second.soap);
-				soap_end(iterRequest->second.soap);
+				soap_destroy(iterRequest->second->soap);
+				soap_end(iterRequest->second->soap);
 
                 // Since we have responded, remove the item from our request list and pass it back to the active socket list so
                 // that the next SOAP call can be handled (probably another notification request)
-                lpItem = iterRequest->second.soap;
+                lpItem = iterRequest->second->soap;
                 m_mapRequests.erase(iterRequest);
             } else {
                 // Nobody was listening to this session, just ignore it
@@ -282,7 +459,7 @@ void *ECNotificationManager::Work() {
 		ulock_normal l_req(m_mutexRequests);
         time(&ulNow);
         for (const auto &req : m_mapRequests)
-            if (ulNow - req.second.ulRequestTime > m_ulTimeout)
+            if (ulNow - req.second->ulRequestTime > m_ulTimeout)
                 // Mark the session as active so it will be processed in the next loop
                 NotifyChange(req.first);
     }
@@ -11,7 +11,9 @@
 #include <kopano/ECLogger.h>
 #include <kopano/ECConfig.h>
 #include <map>
+#include <memory>
 #include <set>
+#include <vector>
 
 struct soap;
 
@@ -26,9 +28,16 @@ namespace KC {
  * So, basically we only handle the SOAP-reply part of the soap request.
  */
 
+/*
+ * A request from notifyGetItemsMulti waits on several sessions; it is
+ * registered in m_mapRequests under each of them and answered as soon as
+ * any has notifications.
+ */
 struct NOTIFREQUEST {
     struct soap *soap;
     time_t ulRequestTime;
+	bool multi = false;
+	std::vector<ECSESSIONID> sessions;
 };
 
 class ECNotificationManager final {
@@ -38,6 +47,7 @@ public:
 
     // Called by the SOAP handler
     HRESULT AddRequest(ECSESSIONID ecSessionId, struct soap *soap);
+	HRESULT AddRequest(std::vector<ECSESSIONID> &&, struct soap *);
     // Called by a session when it has a notification to send
     HRESULT NotifyChange(ECSESSIONID ecSessionId);
 
@@ -45,13 +55,16 @@ private:
     // Just a wrapper to Work()
     static void * Thread(void *lpParam);
     void * Work();
+	void Interrupt(std::shared_ptr<NOTIFREQUEST>);
+	bool ProcessMulti(NOTIFREQUEST &);
+	void Remove(const std::shared_ptr<NOTIFREQUEST> &);
 
 	bool m_thread_active = false, m_bExit = false;
     pthread_t 	m_thread;
 	unsigned int m_ulTimeout = 60; /* Currently hardcoded at 60s, see comment in Work() */
 
     // A map of all sessions that are waiting for a SOAP response to be sent (an item can be in here for up to 60 seconds)
-    std::map<ECSESSIONID, NOTIFREQUEST> 	m_mapRequests;
+    std::map<ECSESSIONID, std::shared_ptr<NOTIFREQUEST>> m_mapRequests;
     // A set of all sessions that have reported notification activity, but are yet to be processed.
     // (a session is in here for only very short periods of time, and contains only a few sessions even if the load is high)
     std::set<ECSESSIONID> 					m_setActiveSessions;
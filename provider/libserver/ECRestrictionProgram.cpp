@@ -0,0 +1,722 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include <regex.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <edkmdb.h>
+#include <kopano/mapiext.h>
+#include <kopano/stringutil.h>
+#include "soapH.h"
+#include "ECCacheManager.h"
+#include "ECGenericObjectTable.h"
+#include "ECRestrictionProgram.h"
+#include "SOAPUtils.h"
+
+namespace KC {
+
+enum rp_op {
+	RP_CONST,		/* fixed outcome */
+	RP_ERROR,		/* fixed error */
+	RP_AND, RP_OR, RP_NOT,
+	RP_EXIST, RP_BITMASK, RP_SIZE, RP_CONTENT, RP_PROPERTY, RP_REGEX,
+	RP_SUBRESTRICTION,
+	RP_INTERP,		/* leaf left to MatchRowRestrict */
+};
+
+struct ECRestrictionProgram::node {
+	enum rp_op op;
+	unsigned int end = 0; /* index past the last node of this subtree */
+	unsigned int slot = 0;
+	unsigned int proptype = 0;
+	unsigned int relop = 0; /* relop, fuzzy level or bitmask type */
+	unsigned int arg = 0; /* bitmask, size or subrestriction number */
+	bool value = false, icase = false;
+	ECRESULT err = erSuccess;
+	const struct restrictTable *src = nullptr;
+	const struct propVal *prop = nullptr;
+	std::string needle;
+	std::unique_ptr<u8_matcher> matcher;
+	std::unique_ptr<u8_icomparer> comparer;
+	std::shared_ptr<regex_t> regex;
+	/* Estimates used for ordering the children of AND and OR */
+	double cost = 1, prob = 0.5;
+	bool pure = true; /* cannot fail and has no side effects */
+	std::vector<node> kids; /* only during compilation */
+
+	node(enum rp_op o) : op(o) {}
+};
+
+typedef ECRestrictionProgram::node rp_node;
+
+/* Same normalization MatchRowRestrict applies before comparing */
+static unsigned int rp_tstring(unsigned int tag)
+{
+	if ((PROP_TYPE(tag) & PT_MV_STRING8) == PT_STRING8)
+		return CHANGE_PROP_TYPE(tag, PT_TSTRING);
+	else if ((PROP_TYPE(tag) & PT_MV_STRING8) == PT_MV_STRING8)
+		return CHANGE_PROP_TYPE(tag, PT_MV_TSTRING);
+	return tag;
+}
+
+static inline bool rp_match(unsigned int relop, int cmp)
+{
+	switch (relop) {
+	case RELOP_GE: return cmp >= 0;
+	case RELOP_GT: return cmp > 0;
+	case RELOP_LE: return cmp <= 0;
+	case RELOP_LT: return cmp < 0;
+	case RELOP_NE: return cmp != 0;
+	case RELOP_EQ: return cmp == 0;
+	default: return false;
+	}
+}
+
+template<typename T> static inline int rp_cmp(const T &a, const T &b)
+{
+	return a == b ? 0 : a < b ? -1 : 1;
+}
+
+static double rp_relop_prob(unsigned int relop)
+{
+	return relop == RELOP_EQ ? 0.1 : relop == RELOP_NE ? 0.9 : 0.5;
+}
+
+class ECRestrictionCompiler final {
+	public:
+	ECRestrictionCompiler(ECRestrictionProgram &p) : m_prog(p) {}
+	rp_node compile(const struct restrictTable *, bool comment, unsigned int level);
+	void flatten(rp_node &&);
+	bool m_too_complex = false;
+
+	private:
+	rp_node error(ECRESULT er = KCERR_INVALID_TYPE);
+	rp_node constant(bool);
+	rp_node interp(const struct restrictTable *, bool pure);
+	rp_node content(const struct restrictTable *);
+	rp_node property(const struct restrictTable *);
+	void order(rp_node &);
+
+	ECRestrictionProgram &m_prog;
+	unsigned int m_subres = 0;
+};
+
+rp_node ECRestrictionCompiler::error(ECRESULT er)
+{
+	rp_node n(RP_ERROR);
+	n.err = er;
+	n.pure = false;
+	n.cost = 0;
+	return n;
+}
+
+rp_node ECRestrictionCompiler::constant(bool value)
+{
+	rp_node n(RP_CONST);
+	n.value = value;
+	n.cost = 0;
+	n.prob = value;
+	return n;
+}
+
+rp_node ECRestrictionCompiler::interp(const struct restrictTable *rt, bool pure)
+{
+	rp_node n(RP_INTERP);
+	n.src = rt;
+	n.pure = pure;
+	n.cost = 50;
+	return n;
+}
+
+rp_node ECRestrictionCompiler::content(const struct restrictTable *rt)
+{
+	auto c = rt->lpContent;
+	if (c == nullptr || c->lpProp == nullptr)
+		return error();
+	auto tag = rp_tstring(c->ulPropTag);
+	auto vtag = rp_tstring(c->lpProp->ulPropTag);
+	auto type = PROP_TYPE(tag);
+	if (type != PT_TSTRING && type != PT_BINARY &&
+	    type != PT_MV_TSTRING && type != PT_MV_BINARY)
+		return constant(false);
+	/* Only single-valued PT_TSTRING is compared as text */
+	bool text = (type & ~MVI_FLAG) == PT_TSTRING;
+	auto level = c->ulFuzzyLevel & 0xFFFF;
+	if (level != FL_FULLSTRING && level != FL_PREFIX && level != FL_SUBSTRING)
+		return constant(false);
+
+	rp_node n(RP_CONTENT);
+	if (PROP_TYPE(vtag) == PT_TSTRING) {
+		if (c->lpProp->Value.lpszA != nullptr)
+			n.needle = c->lpProp->Value.lpszA;
+	} else if (!text && PROP_TYPE(vtag) == PT_BINARY && c->lpProp->Value.bin != nullptr) {
+		auto b = c->lpProp->Value.bin;
+		if (b->__ptr != nullptr)
+			n.needle.assign(reinterpret_cast<const char *>(b->__ptr), b->__size);
+	} else {
+		return interp(rt, false);
+	}
+	n.slot = m_prog.Slot(c->ulPropTag);
+	n.proptype = type;
+	n.relop = level;
+	n.icase = c->ulFuzzyLevel & FL_IGNORECASE;
+	n.cost = 4;
+	n.prob = level == FL_FULLSTRING ? 0.1 : 0.2;
+	if (text) {
+		auto mode = level == FL_FULLSTRING ? u8_matcher::EQUALS :
+		            level == FL_PREFIX ? u8_matcher::STARTSWITH : u8_matcher::CONTAINS;
+		n.matcher.reset(new u8_matcher(n.needle.c_str(), mode, n.icase));
+		n.cost = 10;
+	}
+	return n;
+}
+
+rp_node ECRestrictionCompiler::property(const struct restrictTable *rt)
+{
+	auto r = rt->lpProp;
+	if (r == nullptr || r->lpProp == nullptr)
+		return error();
+	auto tag = rp_tstring(r->ulPropTag);
+	auto vtag = r->lpProp->ulPropTag;
+	if (PROP_TYPE(vtag) == PT_STRING8)
+		vtag = CHANGE_PROP_TYPE(vtag, PT_TSTRING);
+	if ((PROP_TYPE(tag) & ~MV_FLAG) != PROP_TYPE(vtag))
+		/* cannot compare two different types, except mvprop -> prop */
+		return error();
+
+	if (r->ulType == RELOP_RE) {
+		rp_node n(RP_REGEX);
+		n.slot = m_prog.Slot(r->ulPropTag);
+		n.cost = 60;
+		n.prob = 0.2;
+		if (PROP_TYPE(vtag) != PT_TSTRING || PROP_TYPE(tag) != PT_TSTRING) {
+			/* only raised when the property is present */
+			n.err = KCERR_INVALID_TYPE;
+			n.pure = false;
+			return n;
+		}
+		std::unique_ptr<regex_t> reg(new regex_t);
+		if (regcomp(reg.get(), r->lpProp->Value.lpszA, REG_NOSUB | REG_NEWLINE | REG_ICASE) == 0)
+			n.regex.reset(reg.release(), [](regex_t *x) { regfree(x); delete x; });
+		return n;
+	}
+	/* PR_ANR rewrites the row and looks at several properties */
+	if (PROP_ID(tag) == PROP_ID(PR_ANR)) {
+		m_prog.m_mutates = true;
+		return interp(rt, false);
+	}
+	if (tag & MV_FLAG)
+		return interp(rt, true);
+
+	/*
+	 * Comparisons that CompareProp performs in a type-specific way, and
+	 * for which the value is known to pass its checks, are done inline.
+	 */
+	auto v = r->lpProp;
+	bool fast = r->ulPropTag != PR_ADDRESS_BOOK_ENTRYID &&
+	            v->ulPropTag != PR_ADDRESS_BOOK_ENTRYID &&
+	            PROP_ID(v->ulPropTag) != PROP_ID(PR_ANR);
+	switch (PROP_TYPE(r->ulPropTag)) {
+	case PT_I2: fast &= v->__union == SOAP_UNION_propValData_i; break;
+	case PT_LONG: fast &= v->__union == SOAP_UNION_propValData_ul; break;
+	case PT_R4: fast &= v->__union == SOAP_UNION_propValData_flt; break;
+	case PT_BOOLEAN: fast &= v->__union == SOAP_UNION_propValData_b; break;
+	case PT_DOUBLE:
+	case PT_APPTIME: fast &= v->__union == SOAP_UNION_propValData_dbl; break;
+	case PT_I8: fast &= v->__union == SOAP_UNION_propValData_li; break;
+	case PT_SYSTIME:
+	case PT_CURRENCY:
+		fast &= v->__union == SOAP_UNION_propValData_hilo && v->Value.hilo != nullptr;
+		break;
+	case PT_STRING8:
+	case PT_UNICODE:
+		fast &= v->__union == SOAP_UNION_propValData_lpszA && v->Value.lpszA != nullptr;
+		break;
+	case PT_BINARY:
+		fast &= v->__union == SOAP_UNION_propValData_bin && v->Value.bin != nullptr &&
+		        (v->Value.bin->__size == 0 || v->Value.bin->__ptr != nullptr);
+		break;
+	default:
+		fast = false;
+		break;
+	}
+	if (!fast)
+		return interp(rt, true);
+
+	rp_node n(RP_PROPERTY);
+	n.src = rt;
+	n.prop = v;
+	n.slot = m_prog.Slot(r->ulPropTag);
+	n.proptype = PROP_TYPE(r->ulPropTag);
+	n.relop = r->ulType;
+	n.prob = rp_relop_prob(n.relop);
+	n.cost = 2;
+	if (n.proptype == PT_STRING8 || n.proptype == PT_UNICODE) {
+		n.comparer.reset(new u8_icomparer(v->Value.lpszA, m_prog.m_locale));
+		n.cost = 30;
+	}
+	return n;
+}
+
+rp_node ECRestrictionCompiler::compile(const struct restrictTable *rt,
+    bool comment, unsigned int level)
+{
+	if (level > RESTRICT_MAX_DEPTH) {
+		m_too_complex = true;
+		return error(KCERR_TOO_COMPLEX);
+	}
+	if (rt == nullptr)
+		return error();
+
+	switch (rt->ulType) {
+	case RES_COMMENT:
+		if (rt->lpComment == nullptr)
+			return error();
+		/* RunSubRestrictions does not look inside comments */
+		return compile(rt->lpComment->lpResTable, true, level + 1);
+	case RES_AND:
+	case RES_OR: {
+		bool is_and = rt->ulType == RES_AND;
+		if ((is_and && rt->lpAnd == nullptr) || (!is_and && rt->lpOr == nullptr))
+			return error();
+		auto count = is_and ? rt->lpAnd->__size : rt->lpOr->__size;
+		auto list = is_and ? rt->lpAnd->__ptr : rt->lpOr->__ptr;
+		rp_node n(is_and ? RP_AND : RP_OR);
+		for (gsoap_size_t i = 0; i < count; ++i)
+			n.kids.emplace_back(compile(list[i], comment, level + 1));
+		order(n);
+		return n;
+	}
+	case RES_NOT: {
+		if (rt->lpNot == nullptr)
+			return error();
+		rp_node n(RP_NOT);
+		n.kids.emplace_back(compile(rt->lpNot->lpNot, comment, level + 1));
+		n.cost = n.kids[0].cost;
+		n.prob = 1 - n.kids[0].prob;
+		n.pure = n.kids[0].pure;
+		return n;
+	}
+	case RES_CONTENT:
+		return content(rt);
+	case RES_PROPERTY:
+		return property(rt);
+	case RES_COMPAREPROPS: {
+		auto c = rt->lpCompare;
+		if (c == nullptr)
+			return error();
+		if (PROP_TYPE(rp_tstring(c->ulPropTag1)) != PROP_TYPE(rp_tstring(c->ulPropTag2)))
+			return error();
+		return interp(rt, true);
+	}
+	case RES_BITMASK: {
+		if (rt->lpBitmask == nullptr)
+			return error();
+		/* We can only bitmask 32-bit LONG values (aka ULONG) */
+		if (PROP_TYPE(rt->lpBitmask->ulPropTag) != PT_LONG)
+			return error();
+		rp_node n(RP_BITMASK);
+		n.slot = m_prog.Slot(rt->lpBitmask->ulPropTag);
+		n.arg = rt->lpBitmask->ulMask;
+		n.relop = rt->lpBitmask->ulType;
+		return n;
+	}
+	case RES_SIZE: {
+		if (rt->lpSize == nullptr)
+			return error();
+		rp_node n(RP_SIZE);
+		n.slot = m_prog.Slot(rt->lpSize->ulPropTag);
+		n.relop = rt->lpSize->ulType;
+		n.arg = rt->lpSize->cb;
+		n.pure = false; /* fails on a missing property */
+		return n;
+	}
+	case RES_EXIST: {
+		if (rt->lpExist == nullptr)
+			return error();
+		rp_node n(RP_EXIST);
+		n.slot = m_prog.Slot(rt->lpExist->ulPropTag);
+		n.prob = 0.7;
+		return n;
+	}
+	case RES_SUBRESTRICTION: {
+		rp_node n(RP_SUBRESTRICTION);
+		n.slot = m_prog.Slot(PR_ENTRYID);
+		n.arg = comment ? UINT_MAX : m_subres++;
+		n.pure = false; /* fails without PR_ENTRYID */
+		n.cost = 10;
+		return n;
+	}
+	default:
+		return error();
+	}
+}
+
+/*
+ * Order the children of an AND (OR) such that the ones that are cheap and
+ * likely to decide the outcome, i.e. likely to be false (true), go first.
+ * For independent tests, sorting on cost / P(decisive) minimizes the
+ * expected cost. Children that can fail or change the row act as
+ * barriers: whether they are reached, and what precedes them, stays the
+ * same, so the result (and error) of the whole is unaffected.
+ */
+void ECRestrictionCompiler::order(rp_node &n)
+{
+	bool is_and = n.op == RP_AND;
+	auto rank = [=](const rp_node &k) {
+		auto p = std::min(std::max(is_and ? 1 - k.prob : k.prob, 0.01), 1.0);
+		return k.cost / p;
+	};
+	auto first = n.kids.begin();
+	while (first != n.kids.end()) {
+		auto last = std::find_if(first, n.kids.end(), [](const rp_node &k) { return !k.pure; });
+		std::stable_sort(first, last, [&](const rp_node &a, const rp_node &b) { return rank(a) < rank(b); });
+		first = last == n.kids.end() ? last : last + 1;
+	}
+
+	double reach = 1, cost = 0;
+	n.pure = true;
+	for (const auto &k : n.kids) {
+		cost += reach * k.cost;
+		reach *= is_and ? k.prob : 1 - k.prob;
+		n.pure &= k.pure;
+	}
+	n.cost = cost;
+	n.prob = is_and ? reach : 1 - reach;
+}
+
+void ECRestrictionCompiler::flatten(rp_node &&n)
+{
+	auto kids = std::move(n.kids);
+	auto self = m_prog.m_nodes.size();
+	m_prog.m_nodes.emplace_back(std::move(n));
+	for (auto &k : kids)
+		flatten(std::move(k));
+	m_prog.m_nodes[self].end = m_prog.m_nodes.size();
+}
+
+ECRestrictionProgram::ECRestrictionProgram(const ECLocale &locale) :
+	m_locale(locale)
+{}
+
+ECRestrictionProgram::~ECRestrictionProgram() = default;
+
+unsigned int ECRestrictionProgram::Slot(unsigned int tag)
+{
+	auto i = std::find(m_tags.cbegin(), m_tags.cend(), tag);
+	if (i != m_tags.cend())
+		return i - m_tags.cbegin();
+	m_tags.push_back(tag);
+	return m_tags.size() - 1;
+}
+
+/**
+ * Compile @rt for use with @locale. The restriction must remain valid for
+ * as long as the program is in use.
+ */
+ECRESULT ECRestrictionProgram::Compile(const struct restrictTable *rt,
+    const ECLocale &locale, std::shared_ptr<const ECRestrictionProgram> *lppProgram)
+{
+	if (rt == nullptr || lppProgram == nullptr)
+		return KCERR_INVALID_PARAMETER;
+	std::shared_ptr<ECRestrictionProgram> prog(new(std::nothrow) ECRestrictionProgram(locale));
+	if (prog == nullptr)
+		return KCERR_NOT_ENOUGH_MEMORY;
+	ECRestrictionCompiler c(*prog);
+	auto root = c.compile(rt, false, 0);
+	/* Same limit as GetRestrictPropTags */
+	if (c.m_too_complex)
+		return KCERR_TOO_COMPLEX;
+	c.flatten(std::move(root));
+	*lppProgram = std::move(prog);
+	return erSuccess;
+}
+
+/**
+ * Resolve the property slots of the program to positions in @cols, the
+ * column set of the rows that will be passed to Match.
+ */
+ECRestrictionProgram::columns ECRestrictionProgram::Bind(const struct propTagArray *cols) const
+{
+	columns c;
+	if (cols == nullptr || m_mutates)
+		return c;
+	c.width = cols->__size;
+	c.pos.assign(m_tags.size(), -1);
+	for (size_t s = 0; s < m_tags.size(); ++s) {
+		auto tag = m_tags[s];
+		for (gsoap_size_t i = 0; i < cols->__size; ++i) {
+			if (PROP_ID(cols->__ptr[i]) != PROP_ID(tag))
+				continue;
+			/*
+			 * Only the first column with this id can be used: the
+			 * type in a row may differ from the one in the column
+			 * (MVI, PT_UNSPECIFIED, PT_ERROR), and FindProp returns
+			 * the first hit.
+			 */
+			if (cols->__ptr[i] == tag || PROP_TYPE(tag) == PT_UNSPECIFIED)
+				c.pos[s] = i;
+			break;
+		}
+	}
+	return c;
+}
+
+/*
+ * Look up the property of @slot in @row, with the result of FindProp. In
+ * a row of the bound column set, nothing before the column position can
+ * match.
+ */
+struct propVal *ECRestrictionProgram::Prop(struct propValArray *row,
+    unsigned int slot, const columns *cols) const
+{
+	auto tag = m_tags[slot];
+	if (cols == nullptr || cols->width != row->__size || cols->pos[slot] < 0)
+		return FindProp(row, tag);
+	for (gsoap_size_t i = cols->pos[slot]; i < row->__size; ++i) {
+		auto p = &row->__ptr[i];
+		if (p->ulPropTag == tag ||
+		    (PROP_TYPE(tag) == PT_UNSPECIFIED && PROP_ID(p->ulPropTag) == PROP_ID(tag)))
+			return p;
+	}
+	return nullptr;
+}
+
+/**
+ * Match one row. Pass the result of Bind() as @cols when @row is laid out
+ * in that column set.
+ */
+ECRESULT ECRestrictionProgram::Match(ECCacheManager *cache,
+    struct propValArray *row, const SUBRESTRICTIONRESULTS *subres,
+    bool *lpfMatch, const columns *cols) const
+{
+	if (row == nullptr || lpfMatch == nullptr)
+		return KCERR_INVALID_PARAMETER;
+	return Eval(0, cache, row, subres, cols, lpfMatch);
+}
+
+ECRESULT ECRestrictionProgram::Eval(unsigned int idx, ECCacheManager *cache,
+    struct propValArray *row, const SUBRESTRICTIONRESULTS *subres,
+    const columns *cols, bool *lpfMatch) const
+{
+	const auto &n = m_nodes[idx];
+	ECRESULT er = erSuccess;
+	bool fMatch = false;
+	struct propVal *p = nullptr;
+
+	switch (n.op) {
+	case RP_CONST:
+		fMatch = n.value;
+		break;
+	case RP_ERROR:
+		return n.err;
+	case RP_AND:
+	case RP_OR:
+		fMatch = n.op == RP_AND;
+		for (auto i = idx + 1; i < n.end; i = m_nodes[i].end) {
+			er = Eval(i, cache, row, subres, cols, &fMatch);
+			if (er != erSuccess)
+				return er;
+			if (fMatch != (n.op == RP_AND))
+				break;
+		}
+		break;
+	case RP_NOT:
+		er = Eval(idx + 1, cache, row, subres, cols, &fMatch);
+		if (er != erSuccess)
+			return er;
+		fMatch = !fMatch;
+		break;
+	case RP_EXIST:
+		fMatch = Prop(row, n.slot, cols) != nullptr;
+		break;
+	case RP_BITMASK:
+		p = Prop(row, n.slot, cols);
+		if (p == nullptr)
+			break;
+		fMatch = (p->Value.ul & n.arg) > 0;
+		if (n.relop == BMR_EQZ)
+			fMatch = !fMatch;
+		break;
+	case RP_SIZE: {
+		p = Prop(row, n.slot, cols);
+		if (p == nullptr)
+			return KCERR_INVALID_TYPE;
+		auto size = PropSize(p);
+		switch (n.relop) {
+		case RELOP_GE: fMatch = size >= n.arg; break;
+		case RELOP_GT: fMatch = size > n.arg; break;
+		case RELOP_LE: fMatch = size <= n.arg; break;
+		case RELOP_LT: fMatch = size < n.arg; break;
+		case RELOP_NE: fMatch = size != n.arg; break;
+		case RELOP_EQ: fMatch = size == n.arg; break;
+		}
+		break;
+	}
+	case RP_CONTENT: {
+		p = Prop(row, n.slot, cols);
+		if (p == nullptr)
+			break;
+		unsigned int scan = 1;
+		bool mv = n.proptype & MV_FLAG;
+		if (mv)
+			scan = n.proptype == PT_MV_TSTRING ? p->Value.mvszA.__size : p->Value.mvbin.__size;
+		for (unsigned int i = 0; i < scan && !fMatch; ++i) {
+			const char *data;
+			size_t size;
+			if (mv && n.proptype == PT_MV_TSTRING) {
+				data = p->Value.mvszA.__ptr[i];
+				size = data != nullptr ? strlen(data) : 0;
+			} else if (mv) {
+				data = reinterpret_cast<const char *>(p->Value.mvbin.__ptr[i].__ptr);
+				size = p->Value.mvbin.__ptr[i].__size;
+			} else if (n.proptype == PT_TSTRING) {
+				data = p->Value.lpszA;
+				size = data != nullptr ? strlen(data) : 0;
+			} else {
+				data = reinterpret_cast<const char *>(p->Value.bin->__ptr);
+				size = p->Value.bin->__size;
+			}
+			if (data == nullptr)
+				data = "";
+			if (n.relop == FL_FULLSTRING && size != n.needle.size())
+				continue;
+			if (n.relop == FL_PREFIX && size < n.needle.size())
+				continue;
+			if (n.matcher != nullptr)
+				fMatch = (*n.matcher)(data, size);
+			else if (n.relop == FL_SUBSTRING)
+				/* memsubstr never finds an empty needle (and overreads) */
+				fMatch = !n.needle.empty() &&
+				         memsubstr(data, size, n.needle.data(), n.needle.size()) == 0;
+			else
+				fMatch = memcmp(data, n.needle.data(), n.needle.size()) == 0;
+		}
+		break;
+	}
+	case RP_PROPERTY: {
+		p = Prop(row, n.slot, cols);
+		if (p == nullptr) {
+			fMatch = n.relop == RELOP_NE;
+			break;
+		}
+		auto v = n.prop;
+		int cmp = 0;
+		bool ok = p->ulPropTag == m_tags[n.slot];
+		switch (n.proptype) {
+		case PT_I2:
+			ok &= p->__union == SOAP_UNION_propValData_i;
+			cmp = rp_cmp(p->Value.i, v->Value.i);
+			break;
+		case PT_LONG:
+			ok &= p->__union == SOAP_UNION_propValData_ul;
+			cmp = rp_cmp(p->Value.ul, v->Value.ul);
+			break;
+		case PT_R4:
+			ok &= p->__union == SOAP_UNION_propValData_flt;
+			cmp = rp_cmp(p->Value.flt, v->Value.flt);
+			break;
+		case PT_BOOLEAN:
+			ok &= p->__union == SOAP_UNION_propValData_b;
+			cmp = rp_cmp(p->Value.b, v->Value.b);
+			break;
+		case PT_DOUBLE:
+		case PT_APPTIME:
+			ok &= p->__union == SOAP_UNION_propValData_dbl;
+			cmp = rp_cmp(p->Value.dbl, v->Value.dbl);
+			break;
+		case PT_I8:
+			ok &= p->__union == SOAP_UNION_propValData_li;
+			cmp = rp_cmp(p->Value.li, v->Value.li);
+			break;
+		case PT_SYSTIME:
+		case PT_CURRENCY:
+			ok &= p->__union == SOAP_UNION_propValData_hilo;
+			if (!ok)
+				break;
+			cmp = p->Value.hilo->hi != v->Value.hilo->hi ?
+			      rp_cmp(p->Value.hilo->hi, v->Value.hilo->hi) :
+			      rp_cmp(p->Value.hilo->lo, v->Value.hilo->lo);
+			break;
+		case PT_STRING8:
+		case PT_UNICODE:
+			ok &= p->__union == SOAP_UNION_propValData_lpszA &&
+			      (n.proptype != PT_STRING8 || p->Value.lpszA != nullptr);
+			if (!ok)
+				break;
+			cmp = p->Value.lpszA == nullptr ? 1 : (*n.comparer)(p->Value.lpszA);
+			break;
+		case PT_BINARY: {
+			ok &= p->__union == SOAP_UNION_propValData_bin;
+			if (!ok)
+				break;
+			auto a = p->Value.bin, b = v->Value.bin;
+			if (a->__size > 0 && a->__ptr == nullptr)
+				ok = false;
+			else if (a->__ptr != nullptr && b->__ptr != nullptr &&
+			    a->__size != 0 && a->__size == b->__size)
+				cmp = memcmp(a->__ptr, b->__ptr, a->__size);
+			else
+				cmp = rp_cmp(a->__size, b->__size);
+			break;
+		}
+		}
+		if (!ok)
+			/* Let CompareProp sort out what is wrong with the data */
+			return ECGenericObjectTable::MatchRowRestrict(cache, row, n.src, subres, m_locale, lpfMatch);
+		fMatch = rp_match(n.relop, cmp);
+		break;
+	}
+	case RP_REGEX:
+		p = Prop(row, n.slot, cols);
+		if (p == nullptr)
+			break;
+		if (n.err != erSuccess)
+			return n.err;
+		fMatch = n.regex != nullptr && regexec(n.regex.get(), p->Value.lpszA, 0, nullptr, 0) == 0;
+		break;
+	case RP_SUBRESTRICTION: {
+		p = Prop(row, n.slot, cols);
+		if (p == nullptr)
+			return KCERR_INVALID_TYPE;
+		/* Find out if this object matches the subrestriction results */
+		if (subres == nullptr || subres->size() <= n.arg)
+			break;
+		entryId sEntryId;
+		sEntryId.__ptr = p->Value.bin->__ptr;
+		sEntryId.__size = p->Value.bin->__size;
+		unsigned int ulResId = 0;
+		if (cache->GetObjectFromEntryId(&sEntryId, &ulResId) != erSuccess)
+			break;
+		const auto &res = (*subres)[n.arg];
+		fMatch = res.find(ulResId) != res.cend();
+		break;
+	}
+	case RP_INTERP:
+		return ECGenericObjectTable::MatchRowRestrict(cache, row, n.src, subres, m_locale, lpfMatch);
+	}
+	*lpfMatch = fMatch;
+	return er;
+}
+
+size_t ECRestrictionProgram::GetObjectSize() const
+{
+	size_t size = sizeof(*this) + m_nodes.capacity() * sizeof(node) +
+	              m_tags.capacity() * sizeof(unsigned int);
+	for (const auto &n : m_nodes)
+		size += n.needle.capacity() + (n.matcher != nullptr ? sizeof(u8_matcher) : 0) +
+		        (n.comparer != nullptr ? sizeof(u8_icomparer) : 0);
+	return size;
+}
+
+} /* namespace */
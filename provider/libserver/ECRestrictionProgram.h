@@ -0,0 +1,72 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <kopano/zcdefs.h>
+#include <memory>
+#include <vector>
+#include <kopano/kcodes.h>
+#include <kopano/ustringutil.h>
+#include "soapH.h"
+#include "ECSubRestriction.h"
+
+namespace KC {
+
+class ECCacheManager;
+
+/*
+ * A restriction compiled for evaluation against many rows.
+ *
+ * ECGenericObjectTable::MatchRowRestrict walks the restrictTable for every
+ * row it is given. A program is the result of doing that walk only once:
+ *
+ * - the tree is flattened into an array in pre-order, each node knowing
+ *   where its subtree ends;
+ * - every property a node refers to becomes a slot, which Bind() resolves
+ *   to a column position for a given column set; rows that are laid out
+ *   in that column set then need no FindProp scan;
+ * - string needles are prepared once (u8_matcher, u8_icomparer), regular
+ *   expressions are compiled once;
+ * - children of RES_AND/RES_OR are evaluated cheapest-and-most-decisive
+ *   first, as far as that cannot change the outcome (see Compile).
+ *
+ * Results, including errors, are those of MatchRowRestrict, with one
+ * exception: subrestrictions are numbered depth-first like
+ * RunSubRestrictions numbers them, where MatchRowRestrict always looked at
+ * the results of the first one.
+ *
+ * A program refers to the restrictTable it was compiled from, which must
+ * outlive it. It is immutable once compiled, so one program can be used
+ * from multiple threads.
+ */
+class KC_EXPORT ECRestrictionProgram final {
+	public:
+	/* Column positions of each slot, as produced by Bind() */
+	struct columns {
+		int width = -1;
+		std::vector<int> pos;
+	};
+	struct node; /* opaque */
+
+	~ECRestrictionProgram();
+	static ECRESULT Compile(const struct restrictTable *, const ECLocale &, std::shared_ptr<const ECRestrictionProgram> *);
+	columns Bind(const struct propTagArray *) const;
+	ECRESULT Match(ECCacheManager *, struct propValArray *, const SUBRESTRICTIONRESULTS *, bool *match, const columns * = nullptr) const;
+	const ECLocale &GetLocale() const { return m_locale; }
+	size_t GetObjectSize() const;
+
+	private:
+	ECRestrictionProgram(const ECLocale &);
+	unsigned int Slot(unsigned int proptag);
+	struct propVal *Prop(struct propValArray *, unsigned int slot, const columns *) const;
+	ECRESULT Eval(unsigned int, ECCacheManager *, struct propValArray *, const SUBRESTRICTIONRESULTS *, const columns *, bool *) const;
+
+	ECLocale m_locale;
+	std::vector<node> m_nodes;
+	std::vector<unsigned int> m_tags; /* proptag per slot */
+	bool m_mutates = false; /* PR_ANR renames row properties */
+	friend class ECRestrictionCompiler;
+};
+
+} /* namespace */
@@ -9,11 +9,14 @@
 #include <kopano/platform.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
+#include <future>
 #include <list>
 #include <memory>
 #include <new>
 #include <set>
 #include <string>
+#include <vector>
 #include <unistd.h>
 #include <zlib.h>
 #include <mapidefs.h>
@@ -40,6 +43,9 @@ namespace KC {
 #define now_positive() (steady_clock::now() + 600s)
 #define now_negative() (steady_clock::now() + 60s)
 
+/* Smallest part S3 accepts in a multipart upload (except for the last) */
+#define S3_MIN_PART_SIZE (5 << 20)
+
 class ECS3Attachment final : public ECAttachmentStorage {
 	public:
 	ECS3Attachment(ECS3Config &, ECDatabase *);
@@ -50,6 +56,7 @@ class ECS3Attachment final : public ECAttachmentStorage {
 	/* Single Instance Attachment handlers */
 	virtual ECRESULT LoadAttachmentInstance(struct soap *, const ext_siid &, size_t *, unsigned char **) override;
 	virtual ECRESULT LoadAttachmentInstance(const ext_siid &, size_t *, ECSerializer *) override;
+	virtual ECRESULT LoadAttachmentInstanceRange(const ext_siid &, size_t offset, size_t length, size_t *written, ECSerializer *) override;
 	virtual ECRESULT SaveAttachmentInstance(ext_siid &, ULONG, size_t, unsigned char *) override;
 	virtual ECRESULT SaveAttachmentInstance(ext_siid &, ULONG, size_t, ECSerializer *) override;
 	virtual ECRESULT DeleteAttachmentInstances(const std::list<ext_siid> &, bool replace) override;
@@ -62,6 +69,10 @@ class ECS3Attachment final : public ECAttachmentStorage {
 	static void response_complete_cb(S3Status, const S3ErrorDetails *, void *);
 	static S3Status get_obj_cb(int, const char *, void *);
 	static int put_obj_cb(int, char *, void *);
+	static S3Status mp_init_cb(const char *, void *);
+	static S3Status mp_commit_cb(const char *, const char *, void *);
+	static S3Status abort_prop_cb(const S3ResponseProperties *, void *);
+	static void abort_complete_cb(S3Status, const S3ErrorDetails *, void *);
 
 	S3Status response_prop(const S3ResponseProperties *, void *);
 	void response_complete(S3Status, const S3ErrorDetails *, void *);
@@ -75,6 +86,11 @@ class ECS3Attachment final : public ECAttachmentStorage {
 	virtual ECRESULT Rollback() override;
 	ECRESULT s3_get(struct s3_cd &, const char *filename);
 	ECRESULT s3_put(struct s3_cd &, const char *filename);
+	bool in_parts(size_t size, bool upload) const;
+	ECRESULT s3_get_range(struct s3_cd &, const char *filename, size_t offset);
+	ECRESULT s3_get_window(const char *filename, size_t offset, size_t length, unsigned char *data, ECSerializer *sink, size_t *written);
+	ECRESULT s3_put_part(struct s3_cd &, const char *filename, const char *upload_id, int seq);
+	ECRESULT s3_put_multipart(const char *filename, size_t size, unsigned char *data, ECSerializer *source);
 
 	/* Variables: */
 	ECS3Config &m_config;
@@ -90,8 +106,11 @@ struct s3_cd {
 	unsigned char *data = nullptr;
 	ECSerializer *sink = nullptr;
 	bool alloc_data = false;
+	/* size is the caller's buffer length; do not take it from the response */
+	bool fixed_size = false;
 	size_t size = 0, processed = 0;
 	S3Status status = S3StatusOK;
+	std::string etag, upload_id;
 };
 
 /* callback data wrapper */
@@ -134,6 +153,16 @@ ECRESULT ECS3Config::init(std::shared_ptr<ECConfig> cfg)
 	m_get_conditions.ifNotModifiedSince = -1;
 	m_get_conditions.ifMatchETag = nullptr;
 	m_get_conditions.ifNotMatchETag = nullptr;
+	m_mp_init_handler.responseHandler = m_response_handler;
+	m_mp_init_handler.responseXmlCallback = &ECS3Attachment::mp_init_cb;
+	m_mp_commit_handler.responseHandler = m_response_handler;
+	m_mp_commit_handler.putObjectDataCallback = &ECS3Attachment::put_obj_cb;
+	m_mp_commit_handler.responseXmlCallback = &ECS3Attachment::mp_commit_cb;
+	m_mp_abort_handler.responseHandler.propertiesCallback = &ECS3Attachment::abort_prop_cb;
+	m_mp_abort_handler.responseHandler.completeCallback = &ECS3Attachment::abort_complete_cb;
+	m_part_size = std::min(std::max(static_cast<size_t>(strtoull(cfg->GetSetting("attachment_s3_part_size"), nullptr, 0)),
+	              static_cast<size_t>(S3_MIN_PART_SIZE)), static_cast<size_t>(1 << 30));
+	m_window = std::max(static_cast<size_t>(strtoull(cfg->GetSetting("attachment_s3_window"), nullptr, 0)), m_part_size);
 	/*
 	 * Do a dlopen of libs3.so.4 so that the implicit pull-in of
 	 * libldap-2.4.so.2 symbols does not pollute our namespace of
@@ -162,6 +191,17 @@ ECRESULT ECS3Config::init(std::shared_ptr<ECConfig> cfg)
 	W(delete_object);
 	W(get_object);
 #undef W
+#define W(n) DY_ ## n = reinterpret_cast<decltype(DY_ ## n)>(dlsym(m_handle, "S3_" #n))
+	W(initiate_multipart);
+	W(upload_part);
+	W(complete_multipart_upload);
+	W(abort_multipart_upload);
+#undef W
+	if (DY_initiate_multipart == nullptr || DY_upload_part == nullptr ||
+	    DY_complete_multipart_upload == nullptr || DY_abort_multipart_upload == nullptr) {
+		ec_log_info("S3: libs3 has no multipart upload support; large attachments are stored with a single request");
+		DY_initiate_multipart = nullptr;
+	}
 	auto status = DY_initialize("Kopano Mail", S3_INIT_ALL,
 	              cfg->GetSetting("attachment_s3_hostname"));
 	if (status != S3StatusOK) {
@@ -246,6 +286,42 @@ int ECS3Attachment::put_obj_cb(int bufferSize, char *buffer, void *cbdata)
 	return data->caller->put_obj(bufferSize, buffer, data->cbdata);
 }
 
+/**
+ * Receives the upload id of a freshly initiated multipart upload.
+ */
+S3Status ECS3Attachment::mp_init_cb(const char *upload_id, void *cbdata)
+{
+	auto data = static_cast<struct s3_cd *>(static_cast<struct s3_cdw *>(cbdata)->cbdata);
+	if (upload_id != nullptr)
+		data->upload_id = upload_id;
+	return S3StatusOK;
+}
+
+S3Status ECS3Attachment::mp_commit_cb(const char *location, const char *etag,
+    void *cbdata)
+{
+	ec_log_debug("S3: multipart upload completed: %s", location != nullptr ? location : "<none>");
+	return S3StatusOK;
+}
+
+/*
+ * libs3 does not pass callback data to the abort handler, so these cannot be
+ * forwarded to an instance.
+ */
+S3Status ECS3Attachment::abort_prop_cb(const S3ResponseProperties *, void *)
+{
+	return S3StatusOK;
+}
+
+void ECS3Attachment::abort_complete_cb(S3Status status,
+    const S3ErrorDetails *error, void *)
+{
+	if (status != S3StatusOK)
+		ec_log_warn("S3: aborting multipart upload failed (status %d): %s",
+			status, error != nullptr && error->message != nullptr ?
+			error->message : "<unknown>");
+}
+
 /*
  * Locking requirements of ECAttachmentStorage: In the case of
  * ECAttachmentStorage locking to protect against concurrent access is futile.
@@ -311,7 +387,9 @@ S3Status ECS3Attachment::response_prop(const S3ResponseProperties *properties, v
 {
 	auto data = static_cast<struct s3_cd *>(cbdata);
 
-	if (properties->contentLength != 0) {
+	if (properties->eTag != nullptr)
+		data->etag = properties->eTag;
+	if (properties->contentLength != 0 && !data->fixed_size) {
 		data->size = properties->contentLength;
 		ec_log_debug("S3: received the response properties, content length: %zu", data->size);
 	} else {
@@ -478,7 +556,7 @@ ECRESULT ECS3Attachment::s3_get(struct s3_cd &cd, const char *fn)
 	if (cd.size != cd.processed)
 		ec_log_err("S3: load %s: short read %zu/%zu bytes",
 			fn, cd.processed, cd.size);
-	else if (cd.data == nullptr)
+	else if (cd.data == nullptr && cd.sink == nullptr)
 		ret = KCERR_NOT_ENOUGH_MEMORY;
 	else if (cd.status != S3StatusOK)
 		ret = KCERR_NETWORK_ERROR;
@@ -491,6 +569,108 @@ ECRESULT ECS3Attachment::s3_get(struct s3_cd &cd, const char *fn)
 	return ret;
 }
 
+/**
+ * Whether an object of @size bytes is transferred in parts rather than with
+ * a single request.
+ */
+bool ECS3Attachment::in_parts(size_t size, bool upload) const
+{
+	if (upload && m_config.DY_initiate_multipart == nullptr)
+		return false;
+	return size > m_config.m_part_size;
+}
+
+/**
+ * Load cd.size bytes from @offset onwards into the preallocated cd.data.
+ */
+ECRESULT ECS3Attachment::s3_get_range(struct s3_cd &cd, const char *fn,
+    size_t offset)
+{
+	struct s3_cdw cwdata;
+	cwdata.caller = this;
+	cwdata.cbdata = &cd;
+	auto length = cd.size;
+	cd.fixed_size = true;
+	unsigned int tries = S3_RETRIES;
+	do {
+		/* A retry transfers the whole range again */
+		cd.processed = 0;
+		cd.status = S3StatusOK;
+		m_config.DY_get_object(&m_config.m_bkctx, fn, &m_config.m_get_conditions,
+			offset, length, nullptr, 0, &m_config.m_get_obj_handler, &cwdata);
+		if (m_config.DY_status_is_retryable(cd.status))
+			ec_log_debug("S3: load %s@%zu: retryable status: %s",
+				fn, offset, m_config.DY_get_status_name(cd.status));
+	} while (m_config.DY_status_is_retryable(cd.status) && should_retry(tries));
+
+	if (cd.status != S3StatusOK)
+		return KCERR_NETWORK_ERROR;
+	if (cd.processed != length) {
+		ec_log_err("S3: load %s@%zu: short read %zu/%zu bytes",
+			fn, offset, cd.processed, length);
+		return KCERR_DATABASE_ERROR;
+	}
+	return erSuccess;
+}
+
+/**
+ * Load [@offset, @offset+@length) of an object with ranged GETs of
+ * m_part_size bytes each, keeping up to m_window bytes in flight. With
+ * @data, the parts go straight into that buffer; otherwise every part is
+ * staged in its own buffer and written to @sink in order, so that memory
+ * use is bounded by the window.
+ */
+ECRESULT ECS3Attachment::s3_get_window(const char *fn, size_t offset,
+    size_t length, unsigned char *data, ECSerializer *sink, size_t *written)
+{
+	struct part {
+		std::unique_ptr<unsigned char[]> buf;
+		struct s3_cd cd;
+		std::future<ECRESULT> res;
+	};
+	auto psize = m_config.m_part_size;
+	auto depth = std::max(m_config.m_window / psize, static_cast<size_t>(1));
+	std::deque<part> inflight; /* references stay valid on push_back/pop_front */
+	size_t next = 0;
+	ECRESULT ret = erSuccess;
+
+	ec_log_debug("S3: loading %s@%zu, %zu bytes in parts", fn, offset, length);
+	*written = 0;
+	while (next < length || !inflight.empty()) {
+		while (ret == erSuccess && next < length && inflight.size() < depth) {
+			inflight.emplace_back();
+			auto &p = inflight.back();
+			p.cd.size = std::min(psize, length - next);
+			if (data != nullptr) {
+				p.cd.data = data + next;
+			} else {
+				p.buf.reset(new(std::nothrow) unsigned char[p.cd.size]);
+				if (p.buf == nullptr) {
+					inflight.pop_back();
+					ret = KCERR_NOT_ENOUGH_MEMORY;
+					break;
+				}
+				p.cd.data = p.buf.get();
+			}
+			auto off = offset + next;
+			p.res = std::async(std::launch::async, [this, &p, fn, off]() { return s3_get_range(p.cd, fn, off); });
+			next += p.cd.size;
+		}
+		if (inflight.empty())
+			break;
+		auto &p = inflight.front();
+		auto er = p.res.get();
+		if (er == erSuccess && ret == erSuccess && sink != nullptr)
+			er = sink->Write(p.cd.data, 1, p.cd.size);
+		if (er == erSuccess && ret == erSuccess)
+			*written += p.cd.size;
+		if (ret == erSuccess)
+			ret = er;
+		inflight.pop_front();
+	}
+	return ret;
+}
+
 /**
  * Load instance data using soap and return as blob.
  *
@@ -508,10 +688,30 @@ ECRESULT ECS3Attachment::s3_get(struct s3_cd &cd, const char *fn)
 ECRESULT ECS3Attachment::LoadAttachmentInstance(struct soap *soap,
     const ext_siid &ins_id, size_t *size_p, unsigned char **data_p)
 {
+	auto filename = make_att_filename(ins_id);
+	size_t size = 0;
+	if (GetSizeInstance(ins_id, &size) == erSuccess && in_parts(size, false)) {
+		auto data = soap_new_unsignedByte(soap, size);
+		if (data == nullptr) {
+			ec_log_err("S3: cannot allocate %zu bytes", size);
+			return KCERR_NOT_ENOUGH_MEMORY;
+		}
+		size_t written = 0;
+		auto ret = s3_get_window(filename.c_str(), 0, size, data, nullptr, &written);
+		if (ret != erSuccess) {
+			if (soap == nullptr)
+				SOAP_FREE(nullptr, data);
+			return ret;
+		}
+		*size_p = size;
+		*data_p = data;
+		return erSuccess;
+	}
+
 	struct s3_cd cd;
 	cd.alloc_data = true;
 	cd.soap = soap;
-	auto ret = s3_get(cd, make_att_filename(ins_id).c_str());
+	auto ret = s3_get(cd, filename.c_str());
 	if (ret != hrSuccess)
 		return ret;
 	*size_p = cd.size;
@@ -545,9 +745,17 @@ ECRESULT ECS3Attachment::LoadAttachmentInstance(struct soap *soap,
 ECRESULT ECS3Attachment::LoadAttachmentInstance(const ext_siid &ins_id,
     size_t *size_p, ECSerializer *sink)
 {
+	auto filename = make_att_filename(ins_id);
+	size_t size = 0;
+	if (GetSizeInstance(ins_id, &size) == erSuccess && in_parts(size, false)) {
+		auto ret = s3_get_window(filename.c_str(), 0, size, nullptr, sink, size_p);
+		/* See below */
+		return ret == KCERR_NETWORK_ERROR ? erSuccess : ret;
+	}
+
 	struct s3_cd cd;
 	cd.sink = sink;
-	auto ret = s3_get(cd, make_att_filename(ins_id).c_str());
+	auto ret = s3_get(cd, filename.c_str());
 	if (ret == KCERR_NETWORK_ERROR)
 		/* The entire stream would abort if we return non-success. */
 		ret = erSuccess;
@@ -564,6 +772,29 @@ ECRESULT ECS3Attachment::LoadAttachmentInstance(const ext_siid &ins_id,
 	return ret;
 }
 
+/**
+ * Load a byte range of an instance using ranged GETs.
+ *
+ * @param[in] ins_id InstanceID to load
+ * @param[in] offset first byte to load
+ * @param[in] length number of bytes to load
+ * @param[out] written number of bytes written in sink
+ * @param[in] sink serializer to write in
+ */
+ECRESULT ECS3Attachment::LoadAttachmentInstanceRange(const ext_siid &ins_id,
+    size_t offset, size_t length, size_t *written, ECSerializer *sink)
+{
+	size_t size = 0;
+	*written = 0;
+	auto ret = GetSizeInstance(ins_id, &size);
+	if (ret != erSuccess)
+		return ret;
+	if (offset >= size)
+		return erSuccess;
+	return s3_get_window(make_att_filename(ins_id).c_str(), offset,
+	       std::min(length, size - offset), nullptr, sink, written);
+}
+
 ECRESULT ECS3Attachment::s3_put(struct s3_cd &cd, const char *fn)
 {
 	struct s3_cdw cwdata;
@@ -591,6 +822,147 @@ ECRESULT ECS3Attachment::s3_put(struct s3_cd &cd, const char *fn)
 	return KCERR_DATABASE_ERROR;
 }
 
+/**
+ * Upload part @seq of a multipart upload from cd.data.
+ */
+ECRESULT ECS3Attachment::s3_put_part(struct s3_cd &cd, const char *fn,
+    const char *upload_id, int seq)
+{
+	struct s3_cdw cwdata;
+	cwdata.caller = this;
+	cwdata.cbdata = &cd;
+	cd.fixed_size = true;
+	unsigned int tries = S3_RETRIES;
+	do {
+		cd.processed = 0;
+		cd.status = S3StatusOK;
+		cd.etag.clear();
+		m_config.DY_upload_part(&m_config.m_bkctx, fn, nullptr,
+			&m_config.m_put_obj_handler, seq, upload_id, static_cast<int>(cd.size),
+			nullptr, 0, &cwdata);
+		if (m_config.DY_status_is_retryable(cd.status))
+			ec_log_debug("S3: save %s part %d: retryable status: %s",
+				fn, seq, m_config.DY_get_status_name(cd.status));
+	} while (m_config.DY_status_is_retryable(cd.status) && should_retry(tries));
+
+	if (cd.status != S3StatusOK)
+		return KCERR_NETWORK_ERROR;
+	if (cd.processed != cd.size || cd.etag.empty()) {
+		ec_log_err("S3: save %s part %d: processed %zu/%zu bytes%s",
+			fn, seq, cd.processed, cd.size, cd.etag.empty() ? ", no ETag" : "");
+		return KCERR_DATABASE_ERROR;
+	}
+	return erSuccess;
+}
+
+/**
+ * Store an object with a multipart upload, sending parts of m_part_size
+ * bytes in parallel with up to m_window bytes in flight. The data comes
+ * either from @data or from @source; the serializer is only ever read from
+ * the calling thread, one part ahead of the uploads.
+ */
+ECRESULT ECS3Attachment::s3_put_multipart(const char *fn, size_t size,
+    unsigned char *data, ECSerializer *source)
+{
+	struct s3_cd icd;
+	struct s3_cdw cwdata;
+	cwdata.caller = this;
+	cwdata.cbdata = &icd;
+	unsigned int tries = S3_RETRIES;
+	ec_log_debug("S3: saving %s (%zu bytes in parts)", fn, size);
+	do {
+		icd.status = S3StatusOK;
+		m_config.DY_initiate_multipart(&m_config.m_bkctx, fn, nullptr,
+			&m_config.m_mp_init_handler, nullptr, 0, &cwdata);
+	} while (m_config.DY_status_is_retryable(icd.status) && should_retry(tries));
+	if (icd.status != S3StatusOK || icd.upload_id.empty()) {
+		ec_log_err("S3: save %s: cannot initiate multipart upload: %s",
+			fn, m_config.DY_get_status_name(icd.status));
+		return KCERR_NETWORK_ERROR;
+	}
+
+	struct part {
+		std::unique_ptr<unsigned char[]> buf;
+		struct s3_cd cd;
+		std::future<ECRESULT> res;
+	};
+	auto upload_id = icd.upload_id.c_str();
+	auto psize = m_config.m_part_size;
+	auto depth = std::max(m_config.m_window / psize, static_cast<size_t>(1));
+	std::deque<part> inflight;
+	std::vector<std::string> etags;
+	size_t next = 0;
+	int seq = 0;
+	ECRESULT ret = erSuccess;
+
+	while (next < size || !inflight.empty()) {
+		while (ret == erSuccess && next < size && inflight.size() < depth) {
+			inflight.emplace_back();
+			auto &p = inflight.back();
+			p.cd.size = std::min(psize, size - next);
+			if (data != nullptr) {
+				p.cd.data = data + next;
+			} else {
+				p.buf.reset(new(std::nothrow) unsigned char[p.cd.size]);
+				ret = p.buf == nullptr ? KCERR_NOT_ENOUGH_MEMORY :
+				      source->Read(p.buf.get(), 1, p.cd.size);
+				if (ret != erSuccess) {
+					inflight.pop_back();
+					break;
+				}
+				p.cd.data = p.buf.get();
+			}
+			auto n = ++seq;
+			p.res = std::async(std::launch::async, [this, &p, fn, upload_id, n]() { return s3_put_part(p.cd, fn, upload_id, n); });
+			next += p.cd.size;
+		}
+		if (inflight.empty())
+			break;
+		auto &p = inflight.front();
+		auto er = p.res.get();
+		if (er == erSuccess)
+			etags.emplace_back(std::move(p.cd.etag));
+		if (ret == erSuccess)
+			ret = er;
+		inflight.pop_front();
+	}
+
+	if (ret == erSuccess) {
+		std::string xml = "<CompleteMultipartUpload>";
+		for (size_t i = 0; i < etags.size(); ++i)
+			xml += "<Part><PartNumber>" + stringify(i + 1) +
+			       "</PartNumber><ETag>" + etags[i] + "</ETag></Part>";
+		xml += "</CompleteMultipartUpload>";
+
+		struct s3_cd ccd;
+		ccd.data = reinterpret_cast<unsigned char *>(&xml[0]);
+		ccd.size = xml.size();
+		ccd.fixed_size = true;
+		cwdata.cbdata = &ccd;
+		tries = S3_RETRIES;
+		do {
+			ccd.processed = 0;
+			ccd.status = S3StatusOK;
+			m_config.DY_complete_multipart_upload(&m_config.m_bkctx, fn,
+				&m_config.m_mp_commit_handler, upload_id, static_cast<int>(ccd.size),
+				nullptr, 0, &cwdata);
+		} while (m_config.DY_status_is_retryable(ccd.status) && should_retry(tries));
+		if (ccd.status != S3StatusOK) {
+			ec_log_err("S3: save %s: cannot complete multipart upload: %s",
+				fn, m_config.DY_get_status_name(ccd.status));
+			ret = KCERR_NETWORK_ERROR;
+		}
+	}
+	if (ret != erSuccess) {
+		ec_log_debug("S3: save %s: aborting multipart upload", fn);
+		m_config.DY_abort_multipart_upload(&m_config.m_bkctx, fn,
+			upload_id, 0, &m_config.m_mp_abort_handler);
+		return ret;
+	}
+	ec_log_debug("S3: save %s: %zu parts", fn, etags.size());
+	return erSuccess;
+}
+
 /**
  * Save a property in a new instance from a blob
  *
@@ -607,7 +979,10 @@ ECRESULT ECS3Attachment::SaveAttachmentInstance(ext_siid &ins_id,
 	struct s3_cd cd;
 	cd.data = data;
 	cd.size = size;
-	auto ret = s3_put(cd, make_att_filename(ins_id).c_str());
+	auto filename = make_att_filename(ins_id);
+	auto ret = in_parts(size, true) ?
+	           s3_put_multipart(filename.c_str(), size, data, nullptr) :
+	           s3_put(cd, filename.c_str());
 	/* set in transaction before disk full check to remove empty file */
 	if (m_transact)
 		m_new_att.emplace(ins_id);
@@ -635,7 +1010,10 @@ ECRESULT ECS3Attachment::SaveAttachmentInstance(ext_siid &ins_id,
 	struct s3_cd cd;
 	cd.sink = source;
 	cd.size = size;
-	auto ret = s3_put(cd, make_att_filename(ins_id).c_str());
+	auto filename = make_att_filename(ins_id);
+	auto ret = in_parts(size, true) ?
+	           s3_put_multipart(filename.c_str(), size, nullptr, source) :
+	           s3_put(cd, filename.c_str());
 	/* set in transaction before disk full check to remove empty file */
 	if (m_transact)
 		m_new_att.emplace(ins_id);
@@ -33,6 +33,11 @@ class ECS3Config final : public ECAttachmentConfig {
 	private:
 	std::string m_akid, m_sakey, m_bkname, m_region, m_path;
 	unsigned int m_comp;
+	/*
+	 * Objects larger than m_part_size are transferred in parts of that
+	 * size, with at most m_window bytes in flight (and in memory).
+	 */
+	size_t m_part_size = 0, m_window = 0;
 
 	void *m_handle = nullptr;
 #define W(n) decltype(S3_ ## n) *DY_ ## n;
@@ -44,6 +49,11 @@ class ECS3Config final : public ECAttachmentConfig {
 	W(head_object)
 	W(delete_object)
 	W(get_object)
+	/* Optional; without them, large objects are sent with one PUT */
+	W(initiate_multipart)
+	W(upload_part)
+	W(complete_multipart_upload)
+	W(abort_multipart_upload)
 #undef W
 
 	S3BucketContext m_bkctx{};
@@ -55,6 +65,9 @@ class ECS3Config final : public ECAttachmentConfig {
 	S3PutObjectHandler m_put_obj_handler{};
 	S3GetObjectHandler m_get_obj_handler{};
 	S3GetConditions m_get_conditions{};
+	S3MultipartInitialHandler m_mp_init_handler{};
+	S3MultipartCommitHandler m_mp_commit_handler{};
+	S3AbortMultipartUploadHandler m_mp_abort_handler{};
 	std::mutex m_cachelock;
 	std::map<ULONG, s3_cache_entry> m_cache;
 
@@ -449,6 +449,7 @@ ECRESULT ECSearchFolders::ProcessMessageChange(unsigned int ulStoreId, unsigned
 	for (const auto &folder : iterStore->second) {
 		ULONG ulAttempts = 4;	// Random number
 		const auto &scrit = *folder.second->lpSearchCriteria;
+		auto &prog = folder.second->lpProgram;
 
 		do {
 			int lCount = 0; /* Number of messages added, positive means more added, negative means more discarded */
@@ -507,6 +508,13 @@ ECRESULT ECSearchFolders::ProcessMessageChange(unsigned int ulStoreId, unsigned
 						er_lerrf(er, "ECGenericObjectTable::GetRestrictPropTags failed");
 						goto exit;
 					}
+					if (prog == nullptr || prog->GetLocale() != locale) {
+						er = ECRestrictionProgram::Compile(scrit.lpRestrict, locale, &prog);
+						if (er != erSuccess) {
+							er_lerrf(er, "ECRestrictionProgram::Compile failed");
+							goto exit;
+						}
+					}
 					// Get necessary row data for the object
 					er = ECStoreObjectTable::QueryRowData(NULL, NULL, lpSession, lstObjectIDs, lpPropTags, &ecOBStore, &lpRowSet, false, false);
 					if(er != erSuccess) {
@@ -520,13 +528,14 @@ ECRESULT ECSearchFolders::ProcessMessageChange(unsigned int ulStoreId, unsigned
 						goto exit;
 					}
 
+					auto cols = prog->Bind(lpPropTags);
 					auto iterObjectIDs = lstObjectIDs->cbegin();
 					// Check if the item matches for each item
 					for (gsoap_size_t i = 0; i < lpRowSet->__size; ++i, ++iterObjectIDs) {
 						bool fMatch;
 
 						// Match the restriction
-						er = ECGenericObjectTable::MatchRowRestrict(cache, &lpRowSet->__ptr[i], scrit.lpRestrict, &sub_results, locale, &fMatch);
+						er = prog->Match(cache, &lpRowSet->__ptr[i], &sub_results, &fMatch, &cols);
 						if (er != erSuccess)
 							continue;
 						if (fMatch) {
@@ -669,7 +678,8 @@ ECRESULT ECSearchFolders::ProcessMessageChange(unsigned int ulStoreId, unsigned
 }
 
 ECRESULT ECSearchFolders::ProcessCandidateRowsNotify(ECDatabase *lpDatabase,
-    ECSession *lpSession, const struct restrictTable *lpRestrict, bool *lpbCancel,
+    ECSession *lpSession, const struct restrictTable *lpRestrict,
+    const ECRestrictionProgram &prog, bool *lpbCancel,
     unsigned int ulStoreId, unsigned int ulFolderId, ECODStore &lpODStore,
     ECObjectTableList ecRows, struct propTagArray *lpPropTags,
     const ECLocale &locale)
@@ -685,7 +695,7 @@ ECRESULT ECSearchFolders::ProcessCandidateRowsNotify(ECDatabase *lpDatabase,
 		return er_lerrf(er, "SELECT failed");
 
 	std::vector<unsigned int> lst;
-	er = ProcessCandidateRows(lpDatabase, lpSession, lpRestrict, lpbCancel, ulStoreId, ulFolderId, lpODStore, ecRows, lpPropTags, locale, lst);
+	er = ProcessCandidateRows(lpDatabase, lpSession, lpRestrict, prog, lpbCancel, ulStoreId, ulFolderId, lpODStore, ecRows, lpPropTags, locale, lst);
 	if (er != erSuccess)
 		return er;
 	er = dtx.commit();
@@ -702,13 +712,14 @@ ECRESULT ECSearchFolders::ProcessCandidateRowsNotify(ECDatabase *lpDatabase,
 }
 
 ECRESULT ECSearchFolders::ProcessCandidateRows(ECDatabase *lpDatabase,
-    ECSession *lpSession, const struct restrictTable *lpRestrict, bool *lpbCancel,
+    ECSession *lpSession, const struct restrictTable *lpRestrict,
+    const ECRestrictionProgram &prog, bool *lpbCancel,
     unsigned int ulStoreId, unsigned int ulFolderId, ECODStore &lpODStore,
     ECObjectTableList ecRows, struct propTagArray *lpPropTags,
     const ECLocale &locale)
 {
 	std::vector<unsigned int> lst;
-	return ProcessCandidateRows(lpDatabase, lpSession, lpRestrict, lpbCancel, ulStoreId, ulFolderId, lpODStore, ecRows, lpPropTags, locale, lst);
+	return ProcessCandidateRows(lpDatabase, lpSession, lpRestrict, prog, lpbCancel, ulStoreId, ulFolderId, lpODStore, ecRows, lpPropTags, locale, lst);
 }
 
 /**
@@ -722,6 +733,7 @@ ECRESULT ECSearchFolders::ProcessCandidateRows(ECDatabase *lpDatabase,
  * @param[in] lpDatabase Database
  * @param[in] lpSession Session for the user owning the searchfolder
  * @param[in] lpRestrict Restriction to test items against
+ * @param[in] prog lpRestrict, compiled with locale
  * @param[in] lpbCancel Stops processing if it is set to TRUE while running (from another thread)
  * @param[in] ulStoreId Store that the searchfolder is in
  * @param[in] ulFolderId ID of the searchfolder
@@ -733,7 +745,8 @@ ECRESULT ECSearchFolders::ProcessCandidateRows(ECDatabase *lpDatabase,
  * @return result
  */
 ECRESULT ECSearchFolders::ProcessCandidateRows(ECDatabase *lpDatabase,
-    ECSession *lpSession, const struct restrictTable *lpRestrict, bool *lpbCancel,
+    ECSession *lpSession, const struct restrictTable *lpRestrict,
+    const ECRestrictionProgram &prog, bool *lpbCancel,
     unsigned int ulStoreId, unsigned int ulFolderId, ECODStore &lpODStore,
     ECObjectTableList ecRows, struct propTagArray *lpPropTags,
     const ECLocale &locale, std::vector<unsigned int> &lstMatches)
@@ -746,6 +759,7 @@ ECRESULT ECSearchFolders::ProcessCandidateRows(ECDatabase *lpDatabase,
 	assert(lpPropTags->__ptr[0] == PR_MESSAGE_FLAGS);
 	auto iterRows = ecRows.cbegin();
 	auto cache = lpSession->GetSessionManager()->GetCacheManager();
+	auto cols = prog.Bind(lpPropTags);
 
     // Get the row data for the search
 	auto cleanup = make_scope_success([&]() { soap_del_PointerTorowSet(&lpRowSet); });
@@ -761,7 +775,7 @@ ECRESULT ECSearchFolders::ProcessCandidateRows(ECDatabase *lpDatabase,
     // Loop through the results data
 	int lCount = 0, lUnreadCount = 0;
     for (gsoap_size_t j = 0; j< lpRowSet->__size && (!lpbCancel || !*lpbCancel); ++j, ++iterRows) {
-		if (ECGenericObjectTable::MatchRowRestrict(cache, &lpRowSet->__ptr[j], lpRestrict, &sub_results, locale, &fMatch) != erSuccess)
+		if (prog.Match(cache, &lpRowSet->__ptr[j], &sub_results, &fMatch, &cols) != erSuccess)
             continue;
         if(!fMatch)
             continue;
@@ -908,6 +922,11 @@ ECRESULT ECSearchFolders::search_r1(ECDatabase *lpDatabase, ECSession *lpSession
 	er = ECGenericObjectTable::GetRestrictPropTags(lpAdditionalRestrict, &lstPrefix, &lpPropTags);
 	if (er != erSuccess)
 		return er_lerrf(er, "ECGenericObjectTable::GetRestrictPropTags failed");
+	auto locale = m_lpSessionManager->GetSortLocale(ulStoreId);
+	std::shared_ptr<const ECRestrictionProgram> prog;
+	er = ECRestrictionProgram::Compile(lpAdditionalRestrict, locale, &prog);
+	if (er != erSuccess)
+		return er_lerrf(er, "ECRestrictionProgram::Compile failed");
 	// Since an indexed search should be fast, do the entire query as a single transaction, and notify after Commit()
 	auto dtx = lpDatabase->Begin(er);
 	if (er != erSuccess)
@@ -929,8 +948,8 @@ ECRESULT ECSearchFolders::search_r1(ECDatabase *lpDatabase, ECSession *lpSession
 			break; // no more rows
 		// Note that we do not want ProcessCandidateRows to send notifications since we will send a bulk TABLE_CHANGE later, so bNotify == false here
 		er = ProcessCandidateRows(lpDatabase, lpSession, lpAdditionalRestrict,
-		     lpbCancel, ulStoreId, ulFolderId, ecODStore, ecRows, lpPropTags,
-		     m_lpSessionManager->GetSortLocale(ulStoreId));
+		     *prog, lpbCancel, ulStoreId, ulFolderId, ecODStore, ecRows,
+		     lpPropTags, locale);
 		if (er != erSuccess)
 			return er_lerrf(er, "ProcessCandidateRows failed");
 	}
@@ -965,6 +984,11 @@ ECRESULT ECSearchFolders::search_r2(ECDatabase *lpDatabase, ECSession *lpSession
 	auto er = ECGenericObjectTable::GetRestrictPropTags(lpSearchCrit->lpRestrict, &lstPrefix, &lpPropTags);
 	if (er != erSuccess)
 		return er_lerrf(er, "ECGenericObjectTable::GetRestrictPropTags failed");
+	auto locale = m_lpSessionManager->GetSortLocale(ulStoreId);
+	std::shared_ptr<const ECRestrictionProgram> prog;
+	er = ECRestrictionProgram::Compile(lpSearchCrit->lpRestrict, locale, &prog);
+	if (er != erSuccess)
+		return er_lerrf(er, "ECRestrictionProgram::Compile failed");
 	// If we needn't notify, we don't need to commit each message before notifying, so Begin() here
 	kd_trans dtx;
 	if (!bNotify)
@@ -1008,14 +1032,14 @@ ECRESULT ECSearchFolders::search_r2(ECDatabase *lpDatabase, ECSession *lpSession
 				break; // no more rows
 			if (bNotify)
 				er = ProcessCandidateRowsNotify(lpDatabase, lpSession,
-				     lpSearchCrit->lpRestrict, lpbCancel, ulStoreId,
-				     ulFolderId, ecODStore, ecRows, lpPropTags,
-				     m_lpSessionManager->GetSortLocale(ulStoreId));
+				     lpSearchCrit->lpRestrict, *prog, lpbCancel,
+				     ulStoreId, ulFolderId, ecODStore, ecRows,
+				     lpPropTags, locale);
 			else
 				er = ProcessCandidateRows(lpDatabase, lpSession,
-				     lpSearchCrit->lpRestrict, lpbCancel, ulStoreId,
-				     ulFolderId, ecODStore, ecRows, lpPropTags,
-				     m_lpSessionManager->GetSortLocale(ulStoreId));
+				     lpSearchCrit->lpRestrict, *prog, lpbCancel,
+				     ulStoreId, ulFolderId, ecODStore, ecRows,
+				     lpPropTags, locale);
 			if (er != erSuccess)
 				return er_lerrf(er, "ProcessCandidateRows failed");
 		}
@@ -16,6 +16,7 @@
 #include "ECStoreObjectTable.h"
 #include "soapH.h"
 #include "SOAPUtils.h"
+#include "ECRestrictionProgram.h"
 #include <map>
 #include <list>
 #include "cmd.hpp"
@@ -30,10 +31,13 @@ struct SEARCHFOLDER final {
 		ulStoreId(store_id), ulFolderId(folder_id)
 	{}
 	~SEARCHFOLDER() {
+		lpProgram.reset();
 		soap_del_PointerTosearchCriteria(&lpSearchCriteria);
 	}
 
 	struct searchCriteria *lpSearchCriteria = nullptr;
+	/* lpSearchCriteria->lpRestrict, compiled on the first change processed */
+	std::shared_ptr<const ECRestrictionProgram> lpProgram;
 	std::mutex mMutexThreadFree;
 	bool bThreadFree = true, bThreadExit = false;
 	unsigned int ulStoreId, ulFolderId;
@@ -353,6 +357,7 @@ private:
      * @param[in] lpDatabase Database handle
      * @param[in] lpSession Session handle
      * @param[in] lpRestrict Restriction to match the items with
+     * @param[in] prog lpRestrict, compiled with locale
      * @param[in] lpbCancel Pointer to cancellation boolean; processing is stopped when *lpbCancel == true
      * @param[in] ulStoreId Store in which the items in ecRows reside
      * @param[in] ulFolder The hierarchy of the searchfolder to update with the results
@@ -363,9 +368,9 @@ private:
      * @param[in] bNotify TRUE on a live system, FALSE if only the database must be updated.
      * @return result
      */
-	KC_HIDDEN virtual ECRESULT ProcessCandidateRows(ECDatabase *, ECSession *, const struct restrictTable *r, bool *cancel, unsigned int store_id, unsigned int folder_id, ECODStore &, ECObjectTableList rows, struct propTagArray *tags, const ECLocale &, std::vector<unsigned int> &);
-	KC_HIDDEN virtual ECRESULT ProcessCandidateRows(ECDatabase *, ECSession *, const struct restrictTable *r, bool *cancel, unsigned int store_id, unsigned int folder_id, ECODStore &, ECObjectTableList rows, struct propTagArray *tags, const ECLocale &);
-	KC_HIDDEN virtual ECRESULT ProcessCandidateRowsNotify(ECDatabase *, ECSession *, const struct restrictTable *r, bool *cancel, unsigned int store_id, unsigned int folder_id, ECODStore &, ECObjectTableList rows, struct propTagArray *tags, const ECLocale &);
+	KC_HIDDEN virtual ECRESULT ProcessCandidateRows(ECDatabase *, ECSession *, const struct restrictTable *r, const ECRestrictionProgram &, bool *cancel, unsigned int store_id, unsigned int folder_id, ECODStore &, ECObjectTableList rows, struct propTagArray *tags, const ECLocale &, std::vector<unsigned int> &);
+	KC_HIDDEN virtual ECRESULT ProcessCandidateRows(ECDatabase *, ECSession *, const struct restrictTable *r, const ECRestrictionProgram &, bool *cancel, unsigned int store_id, unsigned int folder_id, ECODStore &, ECObjectTableList rows, struct propTagArray *tags, const ECLocale &);
+	KC_HIDDEN virtual ECRESULT ProcessCandidateRowsNotify(ECDatabase *, ECSession *, const struct restrictTable *r, const ECRestrictionProgram &, bool *cancel, unsigned int store_id, unsigned int folder_id, ECODStore &, ECObjectTableList rows, struct propTagArray *tags, const ECLocale &);
 
     // Map StoreID -> SearchFolderId -> SearchCriteria
     // Because searchfolders only work within a store, this allows us to skip 99% of all
@@ -14,6 +14,7 @@
 #include "StatsClient.h"
 #include "ECDatabaseFactory.h"
 #include "ECServerEntrypoint.h"
+#include "BinaryRPC.h"
 #include "ECS3Attachment.h"
 
 namespace KC {
@@ -90,6 +91,8 @@ ECRESULT kopano_exit()
  * of the header is ignored. The special value '*' for proxy_header is
  * not searched for here, but it is used in GetBestServerPath()
  *
+ * It also marks the request as binary RPC if the content-type says so.
+ *
  * We use the soap->user->fparsehdr to daisy chain the request to, which
  * is the original gSoap header parsing code. This is needed to decode
  * normal headers like content-type, etc.
@@ -102,10 +105,15 @@ ECRESULT kopano_exit()
 static int kopano_fparsehdr(struct soap *soap, const char *key,
     const char *val)
 {
+	auto info = soap_info(soap);
 	const char *szProxy = g_lpSessionManager->GetConfig()->GetSetting("proxy_header");
-	if (strlen(szProxy) > 0 && strcasecmp(key, szProxy) == 0)
-		soap_info(soap)->bProxy = true;
-	return soap_info(soap)->fparsehdr(soap, key, val);
+	if (strlen(szProxy) > 0 && strcmp(szProxy, "*") != 0 &&
+	    strcasecmp(key, szProxy) == 0)
+		info->bProxy = true;
+	else if (strcasecmp(key, "Content-Type") == 0 &&
+	    strncasecmp(val, KC_BINRPC_CONTENT_TYPE, strlen(KC_BINRPC_CONTENT_TYPE)) == 0)
+		info->binrpc = true;
+	return info->fparsehdr(soap, key, val);
 }
 
 // Called just after a new soap connection is established
@@ -114,15 +122,10 @@ void kopano_new_soap_connection(CONNECTION_TYPE ulType, struct soap *soap)
 	const char *szProxy = g_lpSessionManager->GetConfig()->GetSetting("proxy_header");
 	auto lpInfo = new SOAPINFO;
 	lpInfo->ulConnectionType = ulType;
-	lpInfo->bProxy = false;
+	// Assume everything is proxied with '*'
+	lpInfo->bProxy = strcmp(szProxy, "*") == 0;
+	lpInfo->binrpc = false;
 	soap->user = lpInfo;
-	if (szProxy[0] == '\0')
-		return;
-	if (strcmp(szProxy, "*") == 0) {
-		// Assume everything is proxied
-		lpInfo->bProxy = true;
-		return;
-	}
 	// Parse headers to determine if the connection is proxied
 	lpInfo->fparsehdr = soap->fparsehdr; // daisy-chain the existing code
 	soap->fparsehdr = kopano_fparsehdr;
@@ -138,6 +141,7 @@ void kopano_new_soap_listener(CONNECTION_TYPE ulType, struct soap *soap)
 	auto lpInfo = new SOAPINFO;
 	lpInfo->ulConnectionType = ulType;
 	lpInfo->bProxy = false;
+	lpInfo->binrpc = false;
 	soap->user = lpInfo;
 }
 
@@ -45,5 +45,7 @@ extern KC_EXPORT void kopano_new_soap_connection(CONNECTION_TYPE, struct soap *)
 extern KC_EXPORT void kopano_end_soap_connection(struct soap *);
 extern KC_EXPORT void kopano_new_soap_listener(CONNECTION_TYPE, struct soap *);
 extern KC_EXPORT void kopano_end_soap_listener(struct soap *);
+/* Handles a request that kopano_fparsehdr marked as binary RPC */
+extern KC_EXPORT int kopano_binrpc_serve(struct soap *);
 
 } /* namespace */
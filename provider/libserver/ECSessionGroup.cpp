@@ -6,9 +6,14 @@
 #include <mapidefs.h>
 #include <mapitags.h>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include "ECSession.h"
 #include "ECSessionGroup.h"
 #include "ECSessionManager.h"
@@ -57,7 +62,7 @@ void ECSessionGroup::ReleaseSession(ECSession *lpSession)
 	m_mapSessions.erase(lpSession->GetSessionId());
 	l_map.unlock();
 
-	scoped_lock l_note(m_hNotificationLock);
+	std::lock_guard<KC::shared_mutex> l_sub(m_hSubscribeLock);
 	for (auto i = m_mapSubscribe.cbegin(); i != m_mapSubscribe.cend(); )
 		if (i->second.ulSession != lpSession->GetSessionId())
 			++i;
@@ -96,7 +101,7 @@ ECRESULT ECSessionGroup::AddAdvise(ECSESSIONID ulSessionId, unsigned int ulConne
 	sSubscribeItem.ulEventMask	= ulEventMask;
 
 	{
-		scoped_lock lock(m_hNotificationLock);
+		std::lock_guard<KC::shared_mutex> lock(m_hSubscribeLock);
 		m_mapSubscribe.emplace(ulConnection, sSubscribeItem);
 	}
 
@@ -120,14 +125,14 @@ ECRESULT ECSessionGroup::AddChangeAdvise(ECSESSIONID ulSessionId, unsigned int u
 	if (lpSyncState == NULL)
 		return KCERR_INVALID_PARAMETER;
 	sSubscribeItem.sSyncState = *lpSyncState;
-	scoped_lock lock(m_hNotificationLock);
+	std::lock_guard<KC::shared_mutex> lock(m_hSubscribeLock);
 	m_mapChangeSubscribe.emplace(lpSyncState->ulSyncId, sSubscribeItem);
 	return erSuccess;
 }
 
 ECRESULT ECSessionGroup::DelAdvise(ECSESSIONID ulSessionId, unsigned int ulConnection)
 {
-	scoped_lock lock(m_hNotificationLock);
+	std::lock_guard<KC::shared_mutex> lock(m_hSubscribeLock);
 	auto iterSubscription = m_mapSubscribe.find(ulConnection);
 	if (iterSubscription == m_mapSubscribe.cend()) {
 		// Apparently the connection was used for change notifications.
@@ -159,7 +164,6 @@ ECRESULT ECSessionGroup::DelAdvise(ECSESSIONID ulSessionId, unsigned int ulConne
 
 ECRESULT ECSessionGroup::AddNotification(notification *notifyItem, unsigned int ulKey, unsigned int ulStore, ECSESSIONID ulSessionId, bool isCounter)
 {
-	ulock_normal l_note(m_hNotificationLock);
 	ECNotification notify(*notifyItem);
 	unsigned int ulParent = 0, ulOldParent = 0;
 	bool check_parent = false, check_old_parent = false;
@@ -178,6 +182,8 @@ ECRESULT ECSessionGroup::AddNotification(notification *notifyItem, unsigned int
 		}
 	}
 
+	bool queued = false;
+	std::shared_lock<KC::shared_mutex> l_sub(m_hSubscribeLock);
 	for (const auto &i : m_mapSubscribe) {
 		auto eventmask = i.second.ulEventMask;
 
@@ -220,15 +226,12 @@ ECRESULT ECSessionGroup::AddNotification(notification *notifyItem, unsigned int
 
 		// send notification
 		notify.SetConnection(i.second.ulConnection);
-		m_listNotification.emplace_back(notify);
+		QueueNotification(std::make_unique<ECNotification>(notify));
+		queued = true;
 	}
-	l_note.unlock();
-
-	// Since we now have a notification ready to send, tell the session manager that we have something to send. Since
-	// a notification can be read from any session in the session group, we have to notify all of the sessions
-	scoped_rlock l_ses(m_hSessionMapLock);
-	for (const auto &p : m_mapSessions)
-		m_lpSessionManager->NotifyNotificationReady(p.second.lpSession->GetSessionId());
+	l_sub.unlock();
+	if (queued)
+		SignalReady();
 	return erSuccess;
 }
 
@@ -308,7 +311,7 @@ ECRESULT ECSessionGroup::AddChangeNotification(const std::set<unsigned int> &syn
 	notifyItem.ics->ulChangeType = ulChangeType;
 
 	std::lock_guard<ECSessionGroup> holder(*this);
-	ulock_normal l_note(m_hNotificationLock);
+	std::shared_lock<KC::shared_mutex> l_sub(m_hSubscribeLock);
 	// Iterate through all sync ids
 	for (auto sync_id : syncIds) {
 		// Iterate through all subscribed clients for the current sync id
@@ -318,20 +321,15 @@ ECRESULT ECSessionGroup::AddChangeNotification(const std::set<unsigned int> &syn
 			// update sync state
 			syncState.ulSyncId = sync_id;
 			// create ECNotification
-			ECNotification notify(notifyItem);
-			notify.SetConnection(iterItem->second.ulConnection);
-			m_listNotification.emplace_back(std::move(notify));
+			auto notify = std::make_unique<ECNotification>(notifyItem);
+			notify->SetConnection(iterItem->second.ulConnection);
+			QueueNotification(std::move(notify));
 			mapInserted[iterItem->second.ulSession]++;
 		}
 	}
-	l_note.unlock();
-
-	// Since we now have a notification ready to send, tell the session manager that we have something to send. Since
-	// a notifications can be read from any session in the session group, we have to notify all of the sessions
-	ulock_rec l_ses(m_hSessionMapLock);
-	for (const auto &p : m_mapSessions)
-		m_lpSessionManager->NotifyNotificationReady(p.second.lpSession->GetSessionId());
-	l_ses.unlock();
+	l_sub.unlock();
+	if (!mapInserted.empty())
+		SignalReady();
 	return erSuccess;
 }
 
@@ -351,20 +349,40 @@ ECRESULT ECSessionGroup::AddChangeNotification(ECSESSIONID ulSessionId, unsigned
 	notifyItem.ics->pSyncState->__ptr = (unsigned char*)&syncState;
 
 	std::lock_guard<ECSessionGroup> holder(*this);
-	ulock_normal l_note(m_hNotificationLock);
 	// create ECNotification
-	ECNotification notify(notifyItem);
-	notify.SetConnection(ulConnection);
-	m_listNotification.emplace_back(std::move(notify));
-	l_note.unlock();
+	auto notify = std::make_unique<ECNotification>(notifyItem);
+	notify->SetConnection(ulConnection);
+	QueueNotification(std::move(notify));
+	SignalReady();
+	return erSuccess;
+}
 
-	// Since we now have a notification ready to send, tell the session manager that we have something to send. Since
-	// a notifications can be read from any session in the session group, we have to notify all of the sessions
-	ulock_rec l_ses(m_hSessionMapLock);
+void ECSessionGroup::QueueNotification(std::unique_ptr<ECNotification> &&n)
+{
+	if (!m_overflow.load(std::memory_order_acquire) && m_ring.push(std::move(n)))
+		return;
+	scoped_lock l_note(m_hNotificationLock);
+	/* The consumer may have drained everything in the meantime */
+	if (!m_overflow.load(std::memory_order_relaxed) && m_ring.push(std::move(n)))
+		return;
+	m_listNotification.emplace_back(std::move(n));
+	m_overflow.store(true, std::memory_order_release);
+	++m_ulOverflowed;
+}
+
+/*
+ * Since we now have a notification ready to send, tell the session manager
+ * that we have something to send. Since a notification can be read from any
+ * session in the session group, we have to notify all of the sessions; but
+ * only once until the next GetNotifyItems() call.
+ */
+void ECSessionGroup::SignalReady()
+{
+	if (m_signalled.exchange(true))
+		return;
+	scoped_rlock l_ses(m_hSessionMapLock);
 	for (const auto &p : m_mapSessions)
 		m_lpSessionManager->NotifyNotificationReady(p.second.lpSession->GetSessionId());
-	l_ses.unlock();
-	return erSuccess;
 }
 
 ECRESULT ECSessionGroup::GetNotifyItems(struct soap *soap, ECSESSIONID ulSessionId, struct notifyResponse *notifications)
@@ -386,24 +404,69 @@ ECRESULT ECSessionGroup::GetNotifyItems(struct soap *soap, ECSESSIONID ulSession
 	 */
 	UpdateSessionTime();
 	soap_default_notifyResponse(soap, notifications);
+
+	/*
+	 * Drain the ring and then the overflow list. Clearing m_signalled
+	 * first means that anything queued after this point produces a new
+	 * wakeup rather than being stranded.
+	 */
+	std::vector<std::unique_ptr<ECNotification>> batch;
+	std::unique_ptr<ECNotification> n;
 	ulock_normal l_note(m_hNotificationLock);
+	m_signalled = false;
+	while (m_ring.pop(n))
+		batch.emplace_back(std::move(n));
+	if (m_overflow.load(std::memory_order_relaxed)) {
+		/* Pushes that beat the overflow flag come first */
+		while (m_ring.pop(n))
+			batch.emplace_back(std::move(n));
+		for (auto &i : m_listNotification)
+			batch.emplace_back(std::move(i));
+		m_listNotification.clear();
+		m_overflow.store(false, std::memory_order_release);
+	}
+	l_note.unlock();
+
+	/*
+	 * Within one batch, a row or object modification supersedes earlier
+	 * modifications of the same row/object; keep only the last one.
+	 */
+	std::unordered_map<std::string, size_t> last;
+	std::string key;
+	size_t coalesced = 0;
+	for (size_t i = 0; i < batch.size(); ++i) {
+		if (!batch[i]->CoalesceKey(key))
+			continue;
+		auto r = last.emplace(std::move(key), i);
+		if (r.second)
+			continue;
+		batch[r.first->second].reset();
+		r.first->second = i;
+		++coalesced;
+	}
 
 	/* May still be nothing in there, as the signal is also fired when we should exit */
-	if (!m_listNotification.empty()) {
-		ULONG ulSize = (ULONG)m_listNotification.size();
+	if (!batch.empty()) {
+		ULONG ulSize = batch.size() - coalesced;
 
 		notifications->pNotificationArray = soap_new_notificationArray(soap);
 		notifications->pNotificationArray->__ptr  = soap_new_notification(soap, ulSize);
 		notifications->pNotificationArray->__size = ulSize;
 
 		size_t nPos = 0;
-		for (auto &i : m_listNotification)
-			i.GetCopy(soap, notifications->pNotificationArray->__ptr[nPos++]);
-		m_listNotification.clear();
+		for (const auto &i : batch)
+			if (i != nullptr)
+				i->GetCopy(soap, notifications->pNotificationArray->__ptr[nPos++]);
+
+		auto &st = *m_lpSessionManager->m_stats;
+		st.inc(SCN_NOTIFY_QUEUED, static_cast<LONGLONG>(batch.size()));
+		st.inc(SCN_NOTIFY_COALESCED, static_cast<LONGLONG>(coalesced));
+		st.inc(SCN_NOTIFY_OVERFLOW, static_cast<int>(m_ulOverflowed.exchange(0)));
+		st.inc(SCN_NOTIFY_BATCHES);
+		st.Max(SCN_NOTIFY_MAX_BATCH, batch.size());
 	} else {
 	    er = KCERR_NOT_FOUND;
     }
-	l_note.unlock();
 
 	/* Reset GetNotifySession */
 	m_getNotifySession = 0;
@@ -426,15 +489,19 @@ ECRESULT ECSessionGroup::releaseListeners()
 size_t ECSessionGroup::GetObjectSize()
 {
 	size_t ulSize = 0;
-	ulock_normal l_note(m_hNotificationLock);
-
+	std::shared_lock<KC::shared_mutex> l_sub(m_hSubscribeLock);
 	ulSize += MEMORY_USAGE_MAP(m_mapSubscribe.size(), decltype(m_mapSubscribe));
 	ulSize += MEMORY_USAGE_MAP(m_mapChangeSubscribe.size(), decltype(m_mapChangeSubscribe));
+	l_sub.unlock();
 
+	/* Queued items in the ring are not visited; estimate them */
+	ulock_normal l_note(m_hNotificationLock);
 	for (const auto &n : m_listNotification)
-		ulSize += n.GetObjectSize();
+		ulSize += n->GetObjectSize() + sizeof(ECNotification);
 	ulSize += MEMORY_USAGE_LIST(m_listNotification.size(), decltype(m_listNotification));
 	l_note.unlock();
+	ulSize += m_ring.capacity() * sizeof(std::unique_ptr<ECNotification>);
+	ulSize += m_ring.size() * (sizeof(ECNotification) + sizeof(notification));
 
 	ulSize += sizeof(*this);
 
@@ -8,9 +8,12 @@
 #include <condition_variable>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <kopano/ECKeyTable.h>
+#include <kopano/mpsc_ring.hpp>
 #include "ECNotification.h"
 #include <kopano/kcodes.h>
 #include <kopano/CommonUtil.h>
@@ -95,6 +98,8 @@ public:
 
 private:
 	ECRESULT releaseListeners();
+	void QueueNotification(std::unique_ptr<ECNotification> &&);
+	void SignalReady();
 
 	/* Personal SessionGroupId */
 	ECSESSIONGROUPID	m_sessionGroupId;
@@ -105,10 +110,21 @@ private:
 	/* List of all items the group is subscribed to */
 	std::map<unsigned int, subscribeItem> m_mapSubscribe;
 	std::multimap<unsigned int, changeSubscribeItem> m_mapChangeSubscribe; // SyncId -> changeSubscribeItem
+	KC::shared_mutex m_hSubscribeLock; /* protects the two maps above */
 	std::recursive_mutex m_hSessionMapLock;
 
-	/* Notifications */
-	std::list<ECNotification> m_listNotification;
+	/*
+	 * Notifications. Producers push into the ring without locking; only
+	 * when it is full do they append to m_listNotification (under
+	 * m_hNotificationLock), and keep doing so until the consumer has
+	 * drained both, so that the delivery order is preserved.
+	 */
+	mpsc_ring<std::unique_ptr<ECNotification>> m_ring{256};
+	std::list<std::unique_ptr<ECNotification>> m_listNotification;
+	std::atomic<bool> m_overflow{false};
+	/* Set when the sessions have been told there is something to fetch */
+	std::atomic<bool> m_signalled{false};
+	std::atomic<unsigned int> m_ulOverflowed{0};
 
 	/* Notifications lock/event */
 	std::mutex m_hNotificationLock;
@@ -28,6 +28,7 @@
 #include "ECSessionManager.h"
 #include "StatsClient.h"
 #include "ECTPropsPurge.h"
+#include "ECNativeIndex.h"
 #include "ECDatabaseUtils.h"
 #include "ECSecurity.h"
 #include "SSLUtil.h"
@@ -58,6 +59,7 @@ ECSessionManager::ECSessionManager(std::shared_ptr<ECConfig> cfg,
 	m_lpDatabaseFactory(new ECDatabaseFactory(m_lpConfig, m_stats)),
 	m_lpSearchFolders(new ECSearchFolders(this, m_lpDatabaseFactory.get())),
 	m_lpECCacheManager(new ECCacheManager(m_lpConfig, m_lpDatabaseFactory.get())),
+	m_lpSharedTables(new ECSharedTables),
 	m_lpTPropsPurge(new ECTPropsPurge(m_lpConfig, m_lpDatabaseFactory.get())),
 	m_ptrLockManager(std::make_shared<ECLockManager>())
 {
@@ -74,6 +76,10 @@ ECSessionManager::ECSessionManager(std::shared_ptr<ECConfig> cfg,
 	}
 
 	m_lpNotificationManager.reset(new ECNotificationManager());
+	m_lpSharedTables->enable(parseBool(m_lpConfig->GetSetting("table_sharing")));
+	if (parseBool(m_lpConfig->GetSetting("search_native")))
+		m_native_index.reset(new ECNativeIndexer(m_lpConfig, m_stats,
+			m_lpDatabaseFactory.get(), m_lpECCacheManager.get()));
 }
 
 void ECSessionManager::shutdown()
@@ -95,6 +101,10 @@ void ECSessionManager::shutdown()
 	m_lpNotificationManager.reset();
 	ec_log_debug("Terminating tpropspurge");
 	m_lpTPropsPurge.reset();
+	ec_log_debug("Terminating native index");
+	m_native_index.reset();
+	if (m_sguid_set)
+		m_lpECCacheManager->SaveSnapshot(m_server_guid);
 	ec_log_debug("Closing database");
 	m_lpDatabase.reset();
 	m_lpDatabaseFactory.reset();
@@ -160,6 +170,10 @@ ECRESULT ECSessionManager::LoadSettings(){
 		ec_log_crit("Could not initialize attachment store: %s", GetMAPIErrorMessage(kcerr_to_mapierr(er)));
 		return er;
 	}
+	/* A missing or stale snapshot only means a cold start */
+	er = m_lpECCacheManager->LoadSnapshot(m_server_guid);
+	if (er != erSuccess)
+		ec_log_warn("Cache snapshot not loaded: %s", GetMAPIErrorMessage(kcerr_to_mapierr(er)));
 	return erSuccess;
 }
 
@@ -700,7 +714,7 @@ ECRESULT ECSessionManager::UpdateOutgoingTables(ECKeyTable::UpdateType ulType, u
 	sSubscription.ulRootObjectId = ulFlags & EC_SUBMIT_MASTER ? 0 : ulStoreId; // in the master queue, use 0 as root object id
 	sSubscription.ulObjectType = ulObjType;
 	sSubscription.ulObjectFlags = ulFlags & EC_SUBMIT_MASTER; // Only use MASTER flag as differentiator
-	return UpdateSubscribedTables(ulType, sSubscription, {ulObjId});
+	return UpdateSubscribedTables(ulType, sSubscription, {ulObjId}, {});
 }
 
 ECRESULT ECSessionManager::UpdateTables(ECKeyTable::UpdateType ulType, unsigned int ulFlags, unsigned ulObjId, unsigned ulChildId, unsigned int ulObjType)
@@ -725,11 +739,16 @@ ECRESULT ECSessionManager::UpdateTables(ECKeyTable::UpdateType ulType,
 	sSubscription.ulRootObjectId = ulObjId;
 	sSubscription.ulObjectType = ulObjType;
 	sSubscription.ulObjectFlags = ulFlags;
-	return UpdateSubscribedTables(ulType, sSubscription, lstChildId);
+	/* Number the change for the shared contents tables of the folder */
+	sTableChangeSeq seq;
+	if (ulObjType == MAPI_MESSAGE)
+		seq = m_lpSharedTables->Advance(ulObjId, ulObjType, ulFlags);
+	return UpdateSubscribedTables(ulType, sSubscription, lstChildId, seq);
 }
 
 ECRESULT ECSessionManager::UpdateSubscribedTables(ECKeyTable::UpdateType ulType,
-    const TABLESUBSCRIPTION &sSubscription, const std::vector<unsigned int> &lstChildId)
+    const TABLESUBSCRIPTION &sSubscription,
+    const std::vector<unsigned int> &lstChildId, const sTableChangeSeq &seq)
 {
 	std::set<ECSESSIONID> setSessions;
 
@@ -759,7 +778,7 @@ ECRESULT ECSessionManager::UpdateSubscribedTables(ECKeyTable::UpdateType ulType,
 			continue;
 		}
 		if (sSubscription.ulType == TABLE_ENTRY::TABLE_TYPE_GENERIC)
-			lpSession->GetTableManager()->UpdateTables(ulType, sSubscription.ulObjectFlags, sSubscription.ulRootObjectId, lstChildId, sSubscription.ulObjectType);
+			lpSession->GetTableManager()->UpdateTables(ulType, sSubscription.ulObjectFlags, sSubscription.ulRootObjectId, lstChildId, sSubscription.ulObjectType, seq);
 		else if (sSubscription.ulType == TABLE_ENTRY::TABLE_TYPE_OUTGOINGQUEUE)
 			lpSession->GetTableManager()->UpdateOutgoingTables(ulType, sSubscription.ulRootObjectId, lstChildId, sSubscription.ulObjectFlags, sSubscription.ulObjectType);
 		lpBTSession->unlock();
@@ -960,6 +979,16 @@ void ECSessionManager::update_extra_stats()
 	s.setg("searchfld_events", "Number of events waiting for searchfolder updates", sSearchStats.ulEvents);
 	s.setg("searchfld_size", "Memory usage of search folders", sSearchStats.ullSize);
 
+	auto sShareStats = m_lpSharedTables->get_stats();
+	s.setg("tables_shared", "Contents tables shared between sessions", sShareStats.ulTables);
+	s.setg("tables_shared_users", "Tables using shared contents tables", sShareStats.ulUsers);
+	s.setg("tables_shared_size", "Memory usage of shared contents tables", sShareStats.ullSize);
+	s.setg("tables_shared_saved", "Memory saved by sharing contents tables", sShareStats.ullSaved);
+	s.setg("tables_shared_hits", "Table loads served from shared contents tables", sShareStats.ullHits);
+	s.setg("tables_shared_misses", "Table loads that found no shared contents table", sShareStats.ullMisses);
+	s.setg("tables_shared_updates", "Table updates taken over from other sessions", sShareStats.ullUpdates);
+	s.setg("tables_shared_load_usec", "Table load time saved by sharing contents tables (usec)", sShareStats.ullLoadSaved);
+
 	auto cm = GetCacheManager();
 	if (cm != nullptr)
 		cm->update_extra_stats(s);
@@ -1169,6 +1198,13 @@ ECRESULT ECSessionManager::DeferNotificationProcessing(ECSESSIONID ecSessionId,
     return m_lpNotificationManager->AddRequest(ecSessionId, soap);
 }
 
+/* One request waiting on the session groups of several sessions */
+ECRESULT ECSessionManager::DeferNotificationProcessing(std::vector<ECSESSIONID> &&sessions,
+    struct soap *soap)
+{
+	return m_lpNotificationManager->AddRequest(std::move(sessions), soap);
+}
+
 // Called when a notification is ready for a session group
 ECRESULT ECSessionManager::NotifyNotificationReady(ECSESSIONID ecSessionId)
 {
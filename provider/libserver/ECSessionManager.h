@@ -18,6 +18,7 @@
 #include "ECAttachmentStorage.h"
 #include "ECUserManagement.h"
 #include "ECSearchFolders.h"
+#include "ECSharedTables.h"
 #include "ECDatabaseFactory.h"
 #include "ECCacheManager.h"
 #include "ECPluginFactory.h"
@@ -34,6 +35,7 @@ namespace KC {
 class Config;
 class Logger;
 class ECTPropsPurge;
+class ECNativeIndexer;
 
 struct TABLESUBSCRIPTION {
      TABLE_ENTRY::TABLE_TYPE ulType;
@@ -162,6 +164,7 @@ public:
 	KC_HIDDEN static void *SessionCleaner(void *tmp_ses_mgr);
 	KC_HIDDEN ECRESULT AddNotification(notification *item, unsigned int key, unsigned int store_id = 0, unsigned int folder_id = 0, unsigned int flags = 0, bool isCounter = false);
 	KC_HIDDEN ECRESULT DeferNotificationProcessing(ECSESSIONID, struct soap *);
+	KC_HIDDEN ECRESULT DeferNotificationProcessing(std::vector<ECSESSIONID> &&, struct soap *);
 	KC_HIDDEN ECRESULT NotifyNotificationReady(ECSESSIONID);
 	KC_HIDDEN void update_extra_stats();
 	KC_HIDDEN sSessionManagerStats get_stats();
@@ -190,6 +193,8 @@ public:
 	KC_HIDDEN ECLocale GetSortLocale(unsigned int store_id);
 	KC_HIDDEN ECCacheManager *GetCacheManager() const { return m_lpECCacheManager.get(); }
 	KC_HIDDEN ECSearchFolders *GetSearchFolders() const { return m_lpSearchFolders.get(); }
+	KC_HIDDEN ECNativeIndexer *GetNativeIndexer() const { return m_native_index.get(); }
+	KC_HIDDEN ECSharedTables *GetSharedTables() const { return m_lpSharedTables.get(); }
 	KC_HIDDEN std::shared_ptr<Config> GetConfig() const { return m_lpConfig; }
 	KC_HIDDEN std::shared_ptr<Logger> GetAudit() const { return m_lpAudit; }
 	KC_HIDDEN ECPluginFactory *GetPluginFactory() const { return m_lpPluginFactory.get(); }
@@ -205,7 +210,7 @@ protected:
 	KC_HIDDEN BTSession *GetSession(ECSESSIONID, bool lock_ses = false);
 	KC_HIDDEN ECRESULT ValidateBTSession(struct soap *, ECSESSIONID, BTSession **);
 	KC_HIDDEN BOOL IsSessionPersistent(ECSESSIONID);
-	KC_HIDDEN ECRESULT UpdateSubscribedTables(ECKeyTable::UpdateType, const TABLESUBSCRIPTION &, const std::vector<unsigned int> &child_id);
+	KC_HIDDEN ECRESULT UpdateSubscribedTables(ECKeyTable::UpdateType, const TABLESUBSCRIPTION &, const std::vector<unsigned int> &child_id, const sTableChangeSeq &);
 	KC_HIDDEN ECRESULT SaveSourceKeyAutoIncrement(unsigned long long new_src_key_autoincr);
 
 	std::unordered_map<ECSESSIONGROUPID, ECSessionGroup *> m_mapSessionGroups; ///< map of all the session groups
@@ -242,7 +247,9 @@ protected:
 	std::unique_ptr<ECDatabaseFactory> m_lpDatabaseFactory;
 	std::unique_ptr<ECSearchFolders> m_lpSearchFolders;
 	std::unique_ptr<ECCacheManager> m_lpECCacheManager;
+	std::unique_ptr<ECSharedTables> m_lpSharedTables;
 	std::unique_ptr<ECTPropsPurge> m_lpTPropsPurge;
+	std::unique_ptr<ECNativeIndexer> m_native_index;
 	std::shared_ptr<ECLockManager> m_ptrLockManager;
 	std::unique_ptr<ECNotificationManager> m_lpNotificationManager;
 	std::unique_ptr<ECDatabase> m_lpDatabase;
@@ -0,0 +1,148 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#include <kopano/platform.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "ECSharedTables.h"
+
+namespace KC {
+
+uint64_t ECSharedTables::Sequence(const key &k)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	/*
+	 * The folder has not had changes numbered yet (or we forgot about
+	 * it): start at the current number, which its changes will exceed.
+	 */
+	return m_folders.emplace(folder_t(k.folder, k.objtype, k.flags), m_seq).first->second;
+}
+
+sTableChangeSeq ECSharedTables::Advance(unsigned int folder,
+    unsigned int objtype, unsigned int flags)
+{
+	sTableChangeSeq seq;
+	std::lock_guard<std::mutex> lk(m_lock);
+	auto i = m_folders.find(folder_t(folder, objtype, flags));
+	if (i == m_folders.cend())
+		return seq;
+	seq.prev = i->second;
+	seq.cur = i->second = ++m_seq;
+	return seq;
+}
+
+bool ECSharedTables::Get(const key &k, uint64_t seq, rows_t *rows)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	auto i = m_entries.find(k);
+	if (i == m_entries.cend() || i->second.seq != seq)
+		return false;
+	*rows = i->second.rows;
+	++m_hits;
+	m_load_saved += i->second.load_usec;
+	return true;
+}
+
+bool ECSharedTables::Put(const key &k, uint64_t seq, rows_t &&rows,
+    uint64_t load_usec)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	++m_misses;
+	/* A change came in while loading: these rows may not reflect it */
+	auto f = m_folders.find(folder_t(k.folder, k.objtype, k.flags));
+	if (f == m_folders.cend() || f->second != seq)
+		return false;
+	/* Do not take published rows away from the tables using them */
+	auto &e = m_entries[k];
+	if (e.rows != nullptr && e.rows.use_count() > 1)
+		return false;
+	e.rows = std::move(rows);
+	e.seq = seq;
+	e.load_usec = load_usec;
+	if (m_entries.size() >= m_prune_at)
+		Prune();
+	return true;
+}
+
+ECSharedTables::claim_t ECSharedTables::Claim(const key &k, const rows_t &rows,
+    const sTableChangeSeq &seq)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	auto i = m_entries.find(k);
+	if (i == m_entries.cend() || i->second.rows != rows)
+		return CLAIM_GONE;
+	auto &e = i->second;
+	if (e.seq == seq.prev) {
+		e.seq = seq.cur;
+		return CLAIM_APPLY;
+	}
+	if (e.seq < seq.cur)
+		/* The previous change was not applied: we cannot tell what is in there */
+		return CLAIM_GONE;
+	++m_updates;
+	return CLAIM_APPLIED;
+}
+
+void ECSharedTables::Withdraw(const key &k, const rows_t &rows)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	auto i = m_entries.find(k);
+	if (i != m_entries.cend() && i->second.rows == rows)
+		m_entries.erase(i);
+}
+
+/* Drops the rows no table uses any more, and folders without any rows */
+void ECSharedTables::Prune()
+{
+	for (auto i = m_entries.begin(); i != m_entries.cend(); )
+		if (i->second.rows.use_count() == 1)
+			i = m_entries.erase(i);
+		else
+			++i;
+	auto e = m_entries.cbegin();
+	for (auto f = m_folders.begin(); f != m_folders.cend(); ) {
+		while (e != m_entries.cend() &&
+		       folder_t(e->first.folder, e->first.objtype, e->first.flags) < f->first)
+			++e;
+		if (e != m_entries.cend() &&
+		    folder_t(e->first.folder, e->first.objtype, e->first.flags) == f->first)
+			++f;
+		else
+			f = m_folders.erase(f);
+	}
+	/* Only come back once the tables in use have doubled */
+	m_prune_at = std::max(static_cast<size_t>(64), m_entries.size() * 2);
+}
+
+sSharedTableStats ECSharedTables::get_stats()
+{
+	sSharedTableStats st;
+	std::vector<rows_t> in_use;
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		Prune();
+		in_use.reserve(m_entries.size());
+		for (const auto &e : m_entries)
+			in_use.emplace_back(e.second.rows);
+		st.ullHits = m_hits;
+		st.ullMisses = m_misses;
+		st.ullUpdates = m_updates;
+		st.ullLoadSaved = m_load_saved;
+	}
+	/* Sized outside our lock; the rows have their own */
+	for (const auto &rows : in_use) {
+		unsigned int users = 0;
+		auto size = ECKeyTable::RowsSize(*rows, &users);
+		if (users == 0)
+			continue;
+		++st.ulTables;
+		st.ulUsers += users;
+		st.ullSize += size;
+		st.ullSaved += size * (users - 1);
+	}
+	return st;
+}
+
+} /* namespace */
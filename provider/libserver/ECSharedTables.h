@@ -0,0 +1,106 @@
+/*
+ * SPDX-License-Identifier: AGPL-3.0-only
+ * Copyright 2026, Kopano and its licensors
+ */
+#pragma once
+#include <kopano/zcdefs.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <kopano/ECKeyTable.h>
+
+namespace KC {
+
+/* Position of a table change among the changes of its folder; 0 if unknown */
+struct sTableChangeSeq {
+	uint64_t prev = 0, cur = 0;
+};
+
+struct sSharedTableStats {
+	unsigned int ulTables = 0, ulUsers = 0;
+	uint64_t ullSize = 0, ullSaved = 0;
+	uint64_t ullHits = 0, ullMisses = 0, ullUpdates = 0, ullLoadSaved = 0;
+};
+
+/*
+ * Contents tables shared between sessions
+ *
+ * Every session has its own ECTableManager, so fifty users looking at the
+ * same shared folder in the same order would have the server load and sort
+ * the same rows fifty times, keep fifty identical key tables around, and
+ * apply every change to the folder fifty times. Tables whose rows only
+ * depend on the folder (see ECStoreObjectTable::ShareKey) publish them
+ * here instead, under a key of the folder and the view: sort order and
+ * locale. A table opening with an equal key adopts the published rows
+ * rather than loading them; its cursor, bookmarks and columns remain its
+ * own (ECKeyTable::Adopt).
+ *
+ * Published rows are as of a certain change of the folder. Every table
+ * notification for a folder with shared tables is numbered (Advance), and
+ * the first table that was in step with the previous change to see the
+ * next one applies it to the shared rows (Claim); the others only send
+ * their notifications. A table that sees anything else (a change filtered
+ * for its session, changes out of order) stops sharing and continues with
+ * a copy of the rows.
+ *
+ * Rows that no table uses any more are dropped.
+ */
+class KC_EXPORT ECSharedTables final {
+	public:
+	typedef std::shared_ptr<ECKeyTable::kt_tree> rows_t;
+	struct key {
+		unsigned int folder, objtype, flags;
+		std::string view;
+
+		bool operator<(const key &o) const noexcept
+		{
+			return std::tie(folder, objtype, flags, view) < std::tie(o.folder, o.objtype, o.flags, o.view);
+		}
+	};
+	enum claim_t { CLAIM_APPLY, CLAIM_APPLIED, CLAIM_GONE };
+
+	/* The table_sharing setting, set at startup and on reload */
+	void enable(bool e) { m_enabled = e; }
+	bool enabled() const { return m_enabled; }
+
+	/* The last change of the folder, for a table that is about to load it */
+	uint64_t Sequence(const key &);
+	/* Numbers a change of a folder; called once per table notification */
+	sTableChangeSeq Advance(unsigned int folder, unsigned int objtype, unsigned int flags);
+	/* The rows for @key, if they are as of change @seq */
+	bool Get(const key &, uint64_t seq, rows_t *);
+	/* Publishes rows that were loaded as of @seq, if that is still the last change of the folder */
+	bool Put(const key &, uint64_t seq, rows_t &&, uint64_t load_usec);
+	/*
+	 * Whether change @seq of @rows is for the caller to apply, has been
+	 * applied, or the rows are no longer published. The caller must have
+	 * the rows locked (ECKeyTable::LockRows) until it has applied it.
+	 */
+	claim_t Claim(const key &, const rows_t &, const sTableChangeSeq &);
+	/* Unpublishes @rows, e.g. after a change could not be applied to them */
+	void Withdraw(const key &, const rows_t &);
+	sSharedTableStats get_stats();
+
+	private:
+	struct entry {
+		rows_t rows;
+		uint64_t seq = 0, load_usec = 0;
+	};
+	typedef std::tuple<unsigned int, unsigned int, unsigned int> folder_t;
+
+	void Prune();
+
+	std::atomic<bool> m_enabled{true};
+	std::mutex m_lock;
+	std::map<key, entry> m_entries;
+	std::map<folder_t, uint64_t> m_folders; /* last change of the folders in m_entries */
+	uint64_t m_seq = 1;
+	size_t m_prune_at = 64;
+	uint64_t m_hits = 0, m_misses = 0, m_updates = 0, m_load_saved = 0;
+};
+
+} /* namespace */
@@ -3,9 +3,11 @@
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
 #include <algorithm>
+#include <chrono>
 #include <list>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <kopano/platform.h>
@@ -42,6 +44,7 @@
 #include "ECDatabaseUtils.h"
 #include <kopano/ECKeyTable.h>
 #include <kopano/Util.h>
+#include "ECColumnCache.h"
 #include "ECGenProps.h"
 #include "ECStoreObjectTable.h"
 #include "StatsClient.h"
@@ -72,6 +75,16 @@ static bool tpropval_is_excluded(unsigned int tag)
 	       PROP_ID(tag) == PROP_ID(PR_HTML);
 }
 
+/* Columns that may come from the column cache: plain stored properties */
+static bool column_is_cached(unsigned int objtype, unsigned int tag)
+{
+	unsigned int subst;
+	return ECColumnCache::IsCachedColumn(tag) &&
+	       ECGenProps::GetPropSubstitute(objtype, tag, &subst) != erSuccess &&
+	       ECGenProps::IsPropComputedUncached(tag, objtype) != erSuccess &&
+	       !tpropval_is_excluded(tag);
+}
+
 bool propVal_is_truncated(const struct propVal *lpsPropVal)
 {
 	switch(PROP_TYPE(lpsPropVal->ulPropTag)) {
@@ -130,9 +143,7 @@ ECRESULT ECStoreObjectTable::Create(ECSession *lpSession, unsigned int ulStoreId
 
 ECRESULT ECStoreObjectTable::GetColumnsAll(ECListInt* lplstProps)
 {
-	DB_RESULT lpDBResult;
-	DB_ROW			lpDBRow = NULL;
-	std::string		strQuery;
+	DB_STMT_RESULT lpDBResult;
 	ECDatabase*		lpDatabase = NULL;
 	auto lpODStore = static_cast<const ECODStore *>(m_lpObjectData);
 	ULONG			ulPropID = 0;
@@ -150,18 +161,17 @@ ECRESULT ECStoreObjectTable::GetColumnsAll(ECListInt* lplstProps)
 
 	if (mo_has_content && lpODStore->ulFolderId != 0) {
 		// Properties
-		strQuery = "SELECT DISTINCT tproperties.tag, tproperties.type FROM tproperties WHERE folderid = " + stringify(lpODStore->ulFolderId);
-
-		er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+		er = lpDatabase->DoSelectPrepared("SELECT DISTINCT tproperties.tag, tproperties.type FROM tproperties WHERE folderid = ?",
+		     {lpODStore->ulFolderId}, &lpDBResult);
 		if(er != erSuccess)
 			return er;
 		// Put the results into a STL list
-		while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
-			if(lpDBRow == NULL || lpDBRow[0] == NULL || lpDBRow[1] == NULL)
+		while (lpDBResult.fetch_row()) {
+			if (lpDBResult.is_null(0) || lpDBResult.is_null(1))
 				continue;
 
-			ulPropID = atoi(lpDBRow[0]);
-			lplstProps->emplace_back(PROP_TAG(atoi(lpDBRow[1]), ulPropID));
+			ulPropID = lpDBResult.get_uint(0);
+			lplstProps->emplace_back(PROP_TAG(lpDBResult.get_uint(1), ulPropID));
 		}
 	}
 
@@ -259,12 +269,15 @@ ECRESULT ECStoreObjectTable::QueryRowData(ECGenericObjectTable *lpThis,
 	std::multimap<unsigned int, unsigned int> mapColumns;
 	std::list<unsigned int> lstDeferred;
 	std::set<unsigned int> setColumnIDs;
-	ECObjectTableList lstRowOrder;
+	ECObjectTableList lstRowOrder, lstColRows;
 	std::map<sObjectTableKey, Objects> mapObjects;
+	std::unordered_map<unsigned int, Stores> mapRowStores;
 
     sObjectTableKey sKey;
 
 	std::set<std::pair<unsigned int, unsigned int> > setCellDone;
+	std::vector<unsigned int> vecColCache;
+	std::vector<bool> vecColDone;
 
 	assert(lpRowList != NULL);
 	auto er = lpSession->GetDatabase(&lpDatabase);
@@ -299,6 +312,41 @@ ECRESULT ECStoreObjectTable::QueryRowData(ECGenericObjectTable *lpThis,
 		lpsRowSet->__ptr[i].__ptr  = soap_new_propVal(soap, lpsPropTagArray->__size);
 	}
 
+	if (lpODStore->lpGuid == nullptr) {
+		/* No store specified; resolve the stores of all rows in one batch */
+		std::vector<unsigned int> ids;
+		ids.reserve(lpRowList->size());
+		for (const auto &row : *lpRowList)
+			if (row.ulObjId != 0)
+				ids.emplace_back(row.ulObjId);
+		cache->GetStores(ids, mapRowStores);
+	}
+
+	// Get the columns of message lists that the column cache has, a column at a time
+	if (!bSubObjects && lpODStore->ulFolderId != 0 &&
+	    lpODStore->ulObjType == MAPI_MESSAGE && cache->ColumnCacheEnabled()) {
+		for (k = 0; k < lpsPropTagArray->__size; ++k)
+			if (column_is_cached(lpODStore->ulObjType, lpsPropTagArray->__ptr[k]))
+				vecColCache.emplace_back(k);
+		if (!vecColCache.empty()) {
+			/*
+			 * The column cache is by folder, so only rows that live in
+			 * ulFolderId may go to or come from it; rows from elsewhere
+			 * (as in a search folder) are blanked like category rows.
+			 */
+			lstColRows = *lpRowList;
+			for (auto &row : lstColRows) {
+				unsigned int ulParent = 0;
+				if (row.ulObjId != 0 &&
+				    (cache->GetParent(row.ulObjId, &ulParent) != erSuccess ||
+				    ulParent != lpODStore->ulFolderId))
+					row.ulObjId = 0;
+			}
+			vecColDone.resize(lpRowList->size() * lpsPropTagArray->__size);
+			cache->GetColumns(lpODStore->ulFolderId, lstColRows, lpsPropTagArray, vecColCache, soap, lpsRowSet, vecColDone);
+		}
+	}
+
 	// Scan cache for anything that we can find, and generate any properties that don't come from normal database queries.
 	i = 0;
 	for (const auto &row : *lpRowList) {
@@ -311,11 +359,16 @@ ECRESULT ECStoreObjectTable::QueryRowData(ECGenericObjectTable *lpThis,
 	    		ulPropTag = lpsPropTagArray->__ptr[k];
 
             // Get StoreId if needed
-            if (lpODStore->lpGuid == NULL)
-                // No store specified, so determine the store ID & guid from the object id
-				cache->GetStore(row.ulObjId, &ulRowStoreId, &sRowGuid);
-            else
+			if (lpODStore->lpGuid == NULL) {
+				// No store specified, so determine the store ID & guid from the object id
+				auto st = mapRowStores.find(row.ulObjId);
+				if (st != mapRowStores.cend()) {
+					ulRowStoreId = st->second.ulStore;
+					sRowGuid = st->second.guidStore;
+				}
+			} else {
                 ulRowStoreId = lpODStore->ulStoreId;
+			}
 
             // Handle category header rows
             if (row.ulObjId == 0) {
@@ -328,6 +381,10 @@ ECRESULT ECStoreObjectTable::QueryRowData(ECGenericObjectTable *lpThis,
 				setCellDone.emplace(i, k);
             	continue;
             }
+			if (!vecColDone.empty() && vecColDone[i * lpsPropTagArray->__size + k]) {
+				setCellDone.emplace(i, k);
+				continue;
+			}
 
 			if (ECGenProps::IsPropComputedUncached(ulPropTag, lpODStore->ulObjType) == erSuccess) {
 				if (ECGenProps::GetPropComputedUncached(soap, lpODStore, lpSession, ulPropTag, row.ulObjId, row.ulOrderId, ulRowStoreId, lpODStore->ulFolderId, lpODStore->ulObjType, &lpsRowSet->__ptr[i].__ptr[k]) != erSuccess)
@@ -485,6 +542,10 @@ ECRESULT ECStoreObjectTable::QueryRowData(ECGenericObjectTable *lpThis,
 			er = QueryRowDataByColumn(lpThis, soap, lpSession, mapColumns, sio.first, sio.second, lpsRowSet);
     }
 
+	// Let the column cache have whatever it did not have yet
+	if (!vecColCache.empty())
+		cache->SetColumns(lpODStore->ulFolderId, lstColRows, lpsPropTagArray, vecColCache, lpsRowSet, vecColDone);
+
     if(!bTableLimit) {
     	/* If no table limit was specified (so entire string requested, not just < 255 bytes), we have to do some more processing:
     	 *
@@ -966,7 +1027,7 @@ ECRESULT ECStoreObjectTable::GetMVRowCount(std::list<unsigned int> &&ids,
 ECRESULT ECStoreObjectTable::Load()
 {
     ECDatabase *lpDatabase = NULL;
-	DB_RESULT lpDBResult;
+	DB_STMT_RESULT lpDBResult;
 	auto lpData = static_cast<const ECODStore *>(m_lpObjectData);
 	unsigned int ulFlags = lpData->ulFlags, ulFolderId = lpData->ulFolderId;
     unsigned int ulObjType = lpData->ulObjType;
@@ -983,52 +1044,63 @@ ECRESULT ECStoreObjectTable::Load()
         // Clear old entries
         Clear();
 
-        // Load the table with all the objects of type ulObjType and flags ulFlags in container ulParent
-	std::string strQuery = "SELECT hierarchy.id, hierarchy.parent, hierarchy.owner, hierarchy.flags, hierarchy.type FROM hierarchy WHERE hierarchy.parent=" + stringify(ulFolderId);
-
-        if(ulObjType == MAPI_MESSAGE)
-        {
-			strQuery += " AND hierarchy.type = " +  stringify(ulObjType);
-
-            if((ulFlags&MSGFLAG_DELETED) == 0)// Normal message and associated message
-                strQuery += " AND hierarchy.flags & "+stringify(MSGFLAG_ASSOCIATED)+" = " + stringify(ulFlags&MSGFLAG_ASSOCIATED) + " AND hierarchy.flags & "+stringify(MSGFLAG_DELETED)+" = 0";
-            else
-                strQuery += " AND hierarchy.flags & "+stringify(MSGFLAG_ASSOCIATED)+" = " + stringify(ulFlags&MSGFLAG_ASSOCIATED) + " AND hierarchy.flags & "+stringify(MSGFLAG_DELETED)+" = " + stringify(MSGFLAG_DELETED);
-        }
-		else if(ulObjType == MAPI_FOLDER) {
-            strQuery += " AND hierarchy.type = " +  stringify(ulObjType);
-			strQuery += " AND hierarchy.flags & "+stringify(MSGFLAG_DELETED)+" = " + stringify(ulFlags&MSGFLAG_DELETED);
-		}else if(ulObjType == MAPI_MAILUSER) { //Read MAPI_MAILUSER and MAPI_DISTLIST
-			strQuery += " AND (hierarchy.type = " +  stringify(ulObjType) + " OR hierarchy.type = " +  stringify(MAPI_DISTLIST) + ")";
-		}else {
-			 strQuery += " AND hierarchy.type = " +  stringify(ulObjType);
-		}
+	/* Another session may have the same rows already */
+	auto shares = lpSession->GetSessionManager()->GetSharedTables();
+	ECSharedTables::key share_key;
+	uint64_t share_seq = 0;
+	if (ShareKey(&share_key)) {
+		share_seq = shares->Sequence(share_key);
+		if (AdoptShared(share_key, share_seq, true))
+			return erSuccess;
+	}
+	auto start = std::chrono::steady_clock::now();
 
-        er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+        // Load the table with all the objects of type ulObjType and flags ulFlags in container ulParent
+	/*
+	 * Load the table with all the objects of type ulObjType and flags
+	 * ulFlags in container ulParent. The flag values are parameters, so
+	 * there is one prepared statement per object type.
+	 */
+#define LOAD_QUERY "SELECT hierarchy.id, hierarchy.parent, hierarchy.owner, hierarchy.flags, hierarchy.type FROM hierarchy WHERE hierarchy.parent=? AND "
+	if (ulObjType == MAPI_MESSAGE)
+		/* Normal message and associated message; or deleted ones */
+		er = lpDatabase->DoSelectPrepared(LOAD_QUERY "hierarchy.type=? AND hierarchy.flags & ? = ? AND hierarchy.flags & ? = ?",
+		     {ulFolderId, ulObjType, MSGFLAG_ASSOCIATED, ulFlags & MSGFLAG_ASSOCIATED,
+		     MSGFLAG_DELETED, ulFlags & MSGFLAG_DELETED}, &lpDBResult);
+	else if (ulObjType == MAPI_FOLDER)
+		er = lpDatabase->DoSelectPrepared(LOAD_QUERY "hierarchy.type=? AND hierarchy.flags & ? = ?",
+		     {ulFolderId, ulObjType, MSGFLAG_DELETED, ulFlags & MSGFLAG_DELETED}, &lpDBResult);
+	else if (ulObjType == MAPI_MAILUSER) /* Read MAPI_MAILUSER and MAPI_DISTLIST */
+		er = lpDatabase->DoSelectPrepared(LOAD_QUERY "(hierarchy.type=? OR hierarchy.type=?)",
+		     {ulFolderId, ulObjType, MAPI_DISTLIST}, &lpDBResult);
+	else
+		er = lpDatabase->DoSelectPrepared(LOAD_QUERY "hierarchy.type=?",
+		     {ulFolderId, ulObjType}, &lpDBResult);
+#undef LOAD_QUERY
         if(er != erSuccess)
 		return er;
 
 	std::vector<unsigned int> lstObjIds;
 	unsigned int i = 0;
-        while(1) {
-		auto lpDBRow = lpDBResult.fetch_row();
-            if(lpDBRow == NULL)
-                break;
-
-			if (lpDBRow[0] == nullptr || lpDBRow[1] == nullptr || lpDBRow[2] == nullptr || lpDBRow[3] == nullptr || lpDBRow[4] == nullptr)
-				continue;
-
-			cache->SetObject(atoui(lpDBRow[0]), atoui(lpDBRow[1]), atoui(lpDBRow[2]), atoui(lpDBRow[3]), atoui(lpDBRow[4]));
+	while (lpDBResult.fetch_row()) {
+		if (lpDBResult.is_null(0) || lpDBResult.is_null(1) || lpDBResult.is_null(2) ||
+		    lpDBResult.is_null(3) || lpDBResult.is_null(4))
+			continue;
+		auto ulObjId = lpDBResult.get_uint(0);
+		cache->SetObject(ulObjId, lpDBResult.get_uint(1), lpDBResult.get_uint(2),
+			lpDBResult.get_uint(3), lpDBResult.get_uint(4));
             // Although we don't want more than ulMaxItems entries, keep looping to get all the results from MySQL. We need to do this
             // because otherwise we can get out of sync with mysql which is still sending us results while we have already stopped
             // reading data.
             if(i > ulMaxItems)
                 continue;
-			lstObjIds.emplace_back(atoi(lpDBRow[0]));
+			lstObjIds.emplace_back(ulObjId);
 			++i;
         }
 
         LoadRows(std::move(lstObjIds), 0);
+	if (share_seq != 0)
+		PublishShared(share_key, share_seq, start);
 	return erSuccess;
 }
 
@@ -1058,6 +1130,202 @@ ECRESULT ECStoreObjectTable::CheckPermissions(unsigned int ulObjId)
 	return sec->CheckPermission(ulParent, ecSecurityRead);
 }
 
+ECRESULT ECStoreObjectTable::Clear()
+{
+	scoped_rlock biglock(m_hLock);
+	m_share_seq = 0;
+	return ECGenericObjectTable::Clear();
+}
+
+/**
+ * Key under which the rows of this table can be shared with other sessions
+ *
+ * Only contents tables whose rows do not depend on who is looking are
+ * shared: no restriction, no categories or multi-valued rows, no sort
+ * columns that are computed per session, and a folder the session can
+ * read completely. The cursor, bookmarks, columns and collapse state are
+ * not part of the rows and remain private.
+ */
+bool ECStoreObjectTable::ShareKey(ECSharedTables::key *key)
+{
+	auto lpData = static_cast<const ECODStore *>(m_lpObjectData);
+
+	if (m_ulObjType != MAPI_MESSAGE || lpData->ulFolderId == 0 ||
+	    lpsRestrict != nullptr || m_ulCategories != 0 || m_bMVCols ||
+	    m_bMVSort ||
+	    !lpSession->GetSessionManager()->GetSharedTables()->enabled() ||
+	    CheckPermissions(lpData->ulFolderId) != erSuccess)
+		return false;
+	std::string view = m_locale.getName();
+	view += '\0';
+	for (gsoap_size_t i = 0; lpsSortOrderArray != nullptr && i < lpsSortOrderArray->__size; ++i) {
+		const auto &so = lpsSortOrderArray->__ptr[i];
+		if (ECGenProps::IsPropComputedUncached(so.ulPropTag, m_ulObjType) == erSuccess)
+			return false;
+		view.append(reinterpret_cast<const char *>(&so.ulPropTag), sizeof(so.ulPropTag));
+		view.append(reinterpret_cast<const char *>(&so.ulOrder), sizeof(so.ulOrder));
+	}
+	key->folder = lpData->ulFolderId;
+	key->objtype = m_ulObjType;
+	key->flags = lpData->ulFlags & (MAPI_ASSOCIATED | MSGFLAG_DELETED);
+	key->view = std::move(view);
+	return true;
+}
+
+/* Takes the rows for @key as of change @seq from another session, if any */
+bool ECStoreObjectTable::AdoptShared(const ECSharedTables::key &key,
+    uint64_t seq, bool fObjects)
+{
+	ECSharedTables::rows_t rows;
+
+	if (!lpSession->GetSessionManager()->GetSharedTables()->Get(key, seq, &rows) ||
+	    lpKeyTable->Adopt(rows) != erSuccess)
+		return false;
+	m_share_key = key;
+	m_share_seq = seq;
+	/* Loading: the table's objects are the rows */
+	if (fObjects && SyncObjects() != erSuccess) {
+		Clear();
+		return false;
+	}
+	return true;
+}
+
+/* Lets other sessions have the rows that were just loaded */
+void ECStoreObjectTable::PublishShared(const ECSharedTables::key &key,
+    uint64_t seq, const std::chrono::steady_clock::time_point &start)
+{
+	auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	if (!lpSession->GetSessionManager()->GetSharedTables()->Put(key, seq, lpKeyTable->Share(), usec))
+		return;
+	m_share_key = key;
+	m_share_seq = seq;
+}
+
+/* Makes the table's objects those in the rows, which others may have changed */
+ECRESULT ECStoreObjectTable::SyncObjects()
+{
+	ECObjectTableList lstRows;
+	unsigned int count = 0, cur = 0;
+	/* QueryRows starts at the cursor: read from the top and come back */
+	auto er = lpKeyTable->GetRowCount(&count, &cur);
+	if (er != erSuccess)
+		return er;
+	lpKeyTable->SeekRow(ECKeyTable::EC_SEEK_SET, 0, nullptr);
+	er = lpKeyTable->QueryRows(UINT_MAX, &lstRows, false, EC_TABLE_NOADVANCE, true);
+	lpKeyTable->SeekRow(ECKeyTable::EC_SEEK_SET, cur, nullptr);
+	if (er != erSuccess)
+		return er;
+	mapObjects.clear();
+	for (const auto &row : lstRows)
+		mapObjects[row] = 1;
+	return erSuccess;
+}
+
+/* Continues with rows of our own */
+void ECStoreObjectTable::LeaveShared()
+{
+	if (m_share_seq == 0)
+		return;
+	m_share_seq = 0;
+	lpKeyTable->Unshare();
+	SyncObjects();
+}
+
+ECRESULT ECStoreObjectTable::ReloadKeyTable()
+{
+	scoped_rlock biglock(m_hLock);
+	ECSharedTables::key key;
+	auto seq = m_share_seq;
+
+	/*
+	 * Sorting differently: the objects are the same as for the rows we
+	 * had, so the other view of them may be shared as well.
+	 */
+	m_share_seq = 0;
+	if (seq == 0 || !ShareKey(&key))
+		return ECGenericObjectTable::ReloadKeyTable();
+	if (AdoptShared(key, seq, false))
+		return erSuccess;
+	auto start = std::chrono::steady_clock::now();
+	auto er = ECGenericObjectTable::ReloadKeyTable();
+	if (er != erSuccess)
+		return er;
+	PublishShared(key, seq, start);
+	return erSuccess;
+}
+
+ECRESULT ECStoreObjectTable::UpdateSharedRows(unsigned int ulType,
+    const std::vector<unsigned int> &lstObjId, unsigned int ulFlags,
+    const sTableChangeSeq &seq)
+{
+	scoped_rlock biglock(m_hLock);
+	auto shares = lpSession->GetSessionManager()->GetSharedTables();
+	bool fInStep = m_share_seq != 0 && seq.prev == m_share_seq &&
+	               (ulType == ECKeyTable::TABLE_ROW_ADD ||
+	               ulType == ECKeyTable::TABLE_ROW_MODIFY ||
+	               ulType == ECKeyTable::TABLE_ROW_DELETE);
+
+	/* Rows this session may not see would not be added; the rows would differ */
+	for (size_t i = 0; fInStep && ulType != ECKeyTable::TABLE_ROW_DELETE && i < lstObjId.size(); ++i)
+		fInStep = CheckPermissions(lstObjId[i]) == erSuccess;
+	if (!fInStep) {
+		LeaveShared();
+		return UpdateRows(ulType, lstObjId, ulFlags, false);
+	}
+
+	/* Nobody changes the rows or reads them for notifications meanwhile */
+	ECRESULT er = erSuccess;
+	lpKeyTable->LockRows();
+	auto rows = lpKeyTable->Share();
+	auto claim = shares->Claim(m_share_key, rows, seq);
+	if (claim == ECSharedTables::CLAIM_APPLY) {
+		/* First to see the change: apply it for everyone */
+		er = UpdateRows(ulType, lstObjId, ulFlags, false);
+		if (er != erSuccess)
+			shares->Withdraw(m_share_key, rows);
+	} else if (claim == ECSharedTables::CLAIM_APPLIED) {
+		er = SharedRowsUpdated(ulType, lstObjId, ulFlags);
+	}
+	lpKeyTable->UnlockRows();
+	if (claim == ECSharedTables::CLAIM_GONE) {
+		LeaveShared();
+		return UpdateRows(ulType, lstObjId, ulFlags, false);
+	}
+	if (er != erSuccess) {
+		LeaveShared();
+		return er;
+	}
+	m_share_seq = seq.cur;
+	return erSuccess;
+}
+
+/**
+ * Takes over a change that another table has applied to the shared rows
+ *
+ * Updates the table's objects and sends the notifications UpdateRows
+ * would have sent, from what the rows look like now.
+ */
+ECRESULT ECStoreObjectTable::SharedRowsUpdated(unsigned int ulType,
+    const std::vector<unsigned int> &lstObjId, unsigned int ulFlags)
+{
+	for (auto id : lstObjId) {
+		sObjectTableKey row(id, 0), prev;
+		bool had = mapObjects.find(row) != mapObjects.cend();
+		if (ulType == ECKeyTable::TABLE_ROW_DELETE)
+			mapObjects.erase(row);
+		else
+			mapObjects[row] = 1;
+		if (!(ulFlags & OBJECTTABLE_NOTIFY))
+			continue;
+		if (lpKeyTable->GetPreviousRow(&row, &prev) == erSuccess)
+			AddTableNotif(had ? ECKeyTable::TABLE_ROW_MODIFY : ECKeyTable::TABLE_ROW_ADD, row, &prev);
+		else if (had)
+			AddTableNotif(ECKeyTable::TABLE_ROW_DELETE, row, nullptr);
+	}
+	return erSuccess;
+}
+
 ECRESULT ECStoreObjectTable::AddRowKey(ECObjectTableList* lpRows, unsigned int *lpulLoaded, unsigned int ulFlags, bool bLoad, bool bOverride, struct restrictTable *lpOverride)
 {
 	auto lpODStore = static_cast<const ECODStore *>(m_lpObjectData);
@@ -1131,17 +1399,15 @@ exit:
  */
 ECRESULT GetDeferredTableUpdates(ECDatabase *lpDatabase, unsigned int ulFolderId, std::list<unsigned int> *lpDeferred)
 {
-	DB_RESULT lpDBResult;
-	DB_ROW lpDBRow = NULL;
+	DB_STMT_RESULT lpDBResult;
 
 	lpDeferred->clear();
-
-	std::string strQuery = "SELECT hierarchyid FROM deferredupdate WHERE folderid = " + stringify(ulFolderId);
-	auto er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	auto er = lpDatabase->DoSelectPrepared("SELECT hierarchyid FROM deferredupdate WHERE folderid = ?",
+	          {ulFolderId}, &lpDBResult);
 	if(er != erSuccess)
 		return er;
-	while ((lpDBRow = lpDBResult.fetch_row()) != nullptr)
-		lpDeferred->emplace_back(atoui(lpDBRow[0]));
+	while (lpDBResult.fetch_row())
+		lpDeferred->emplace_back(lpDBResult.get_uint(0));
 	return erSuccess;
 }
 
@@ -3,6 +3,7 @@
  * Copyright 2005 - 2016 Zarafa and its licensors
  */
 #pragma once
+#include <chrono>
 #include <list>
 #include <map>
 #include <string>
@@ -44,6 +45,8 @@ public:
 
 	//Overrides
 	virtual ECRESULT GetColumnsAll(ECListInt *props) override;
+	virtual ECRESULT Clear() override;
+	virtual ECRESULT UpdateSharedRows(unsigned int type, const std::vector<unsigned int> &objids, unsigned int flags, const sTableChangeSeq &) override;
 
 	// Static database row functions, can be used externally as well .. Obviously these are *not* threadsafe, make sure that
 	// you either lock the passed arguments or all arguments are from the local stack.
@@ -54,6 +57,7 @@ public:
 
 protected:
 	virtual ECRESULT AddRowKey(ECObjectTableList *rows, unsigned int *loaded, unsigned int flags, bool first_load, bool override, struct restrictTable *override_tbl) override;
+	virtual ECRESULT ReloadKeyTable() override;
 	static ECRESULT QueryRowDataByColumn(ECGenericObjectTable *, struct soap *, ECSession *, const std::multimap<unsigned int, unsigned int> &columns, unsigned int folder, const std::map<sObjectTableKey, unsigned int> &objids, struct rowSet *);
 	static ECRESULT QueryRowDataByRow(ECGenericObjectTable *, struct soap *, ECSession *, const sObjectTableKey &, unsigned int rownum, std::multimap<unsigned int, unsigned int> &columns, bool table_limit, struct rowSet *);
 
@@ -62,9 +66,17 @@ private:
 	virtual ECRESULT GetMVRowCount(std::list<unsigned int> &&obj_ids, std::map<unsigned int, unsigned int> &count) override;
 	virtual ECRESULT ReloadTableMVData(ECObjectTableList *rows, ECListInt *mvproptags) override;
 	virtual ECRESULT CheckPermissions(unsigned int obj_id) override;
+	bool ShareKey(ECSharedTables::key *);
+	bool AdoptShared(const ECSharedTables::key &, uint64_t seq, bool objects);
+	void PublishShared(const ECSharedTables::key &, uint64_t seq, const std::chrono::steady_clock::time_point &start);
+	ECRESULT SyncObjects();
+	void LeaveShared();
+	ECRESULT SharedRowsUpdated(unsigned int type, const std::vector<unsigned int> &objids, unsigned int flags);
 
 	unsigned int ulPermission = 0;
 	bool fPermissionRead = false;
+	ECSharedTables::key m_share_key;
+	uint64_t m_share_seq = 0; /* change of the folder our rows are shared as of; 0 if not shared */
 	ALLOC_WRAP_FRIEND;
 };
 
@@ -135,6 +135,8 @@ static ECRESULT RunSubRestriction(ECSession *lpSession, const void *lpECODStore,
     bool fMatch = false;
     sObjectTableKey sKey;
     ECDatabase *lpDatabase = NULL;
+	std::shared_ptr<const ECRestrictionProgram> prog;
+	ECRestrictionProgram::columns cols;
 
 	auto cache = lpSession->GetSessionManager()->GetCacheManager();
 	auto er = lpSession->GetDatabase(&lpDatabase);
@@ -160,6 +162,10 @@ static ECRESULT RunSubRestriction(ECSession *lpSession, const void *lpECODStore,
 	er = ECGenericObjectTable::GetRestrictPropTags(lpRestrict->lpSubObject, NULL, &lpPropTags);
 	if (er != erSuccess)
 		goto exit;
+	er = ECRestrictionProgram::Compile(lpRestrict->lpSubObject, locale, &prog);
+	if (er != erSuccess)
+		goto exit;
+	cols = prog->Bind(lpPropTags);
 
     // Get the subobject IDs we are querying from the database
 	strQuery = "SELECT hierarchy.parent, hierarchy.id FROM hierarchy WHERE hierarchy.type = " +
@@ -202,7 +208,7 @@ static ECRESULT RunSubRestriction(ECSession *lpSession, const void *lpECODStore,
     iterObject = lstSubObjects.cbegin();
     // Loop through all the rows, see if they match
     for (gsoap_size_t i = 0; i < lpRowSet->__size; ++i) {
-		er = ECGenericObjectTable::MatchRowRestrict(cache, &lpRowSet->__ptr[i], lpRestrict->lpSubObject, nullptr, locale, &fMatch);
+		er = prog->Match(cache, &lpRowSet->__ptr[i], nullptr, &fMatch, &cols);
         if(er != erSuccess)
             goto exit;
 
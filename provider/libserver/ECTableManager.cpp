@@ -592,7 +592,8 @@ ECRESULT ECTableManager::UpdateOutgoingTables(ECKeyTable::UpdateType ulType,
 
 ECRESULT ECTableManager::UpdateTables(ECKeyTable::UpdateType ulType,
     unsigned int ulFlags, unsigned int ulObjId,
-    const std::vector<unsigned int> &lstChildId, unsigned int ulObjType)
+    const std::vector<unsigned int> &lstChildId, unsigned int ulObjType,
+    const sTableChangeSeq &seq)
 {
 	scoped_rlock lock(hListMutex);
 	bool filter_private = false;
@@ -638,10 +639,11 @@ ECRESULT ECTableManager::UpdateTables(ECKeyTable::UpdateType ulType,
 		if (!k)
 			continue;
 		// ignore errors from the update
-		if(filter_private)
-			t.second->lpTable->UpdateRows(ulType, std::move(lstChildId2), OBJECTTABLE_NOTIFY, false);
+		if (filter_private && lstChildId2.size() != lstChildId.size())
+			/* Not the change other sessions see: no shared rows for it */
+			t.second->lpTable->UpdateSharedRows(ulType, lstChildId2, OBJECTTABLE_NOTIFY, {});
 		else
-			t.second->lpTable->UpdateRows(ulType, std::move(lstChildId), OBJECTTABLE_NOTIFY, false);
+			t.second->lpTable->UpdateSharedRows(ulType, lstChildId, OBJECTTABLE_NOTIFY, seq);
 	}
 	return erSuccess;
 }
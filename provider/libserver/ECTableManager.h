@@ -65,7 +65,7 @@ public:
 	ECRESULT	GetTable(unsigned int lpulTableId, ECGenericObjectTable **lppTable);
 	ECRESULT	CloseTable(unsigned int lpulTableId);
 	ECRESULT UpdateOutgoingTables(ECKeyTable::UpdateType, unsigned int store_id, const std::vector<unsigned int> &objids, unsigned int flags, unsigned int objtype);
-	ECRESULT UpdateTables(ECKeyTable::UpdateType, unsigned int flags, unsigned int objid, const std::vector<unsigned int> &children, unsigned int objtype);
+	ECRESULT UpdateTables(ECKeyTable::UpdateType, unsigned int flags, unsigned int objid, const std::vector<unsigned int> &children, unsigned int objtype, const sTableChangeSeq &);
 	ECRESULT	GetStats(unsigned int *lpulTables, unsigned int *lpulObjectSize);
 
 private:
@@ -701,6 +701,8 @@ int KCmdService::logon(const char *user, const char *pass,
 		lpsResponse->ulCapabilities |= KOPANO_CAP_UNICODE;
 	if (clientCaps & KOPANO_CAP_MSGLOCK)
 		lpsResponse->ulCapabilities |= KOPANO_CAP_MSGLOCK;
+	if (clientCaps & KOPANO_CAP_BINARY_RPC && parseBool(g_lpSessionManager->GetConfig()->GetSetting("enable_binary_rpc")))
+		lpsResponse->ulCapabilities |= KOPANO_CAP_BINARY_RPC;
 	if (sLicenseRequest.__size > 0) {
 		std::string out;
 		er = ECLicense_Auth(sLicenseRequest.__ptr, sLicenseRequest.__size, out);
@@ -856,6 +858,8 @@ int KCmdService::ssoLogon(ULONG64 ulSessionId, const char *szUsername,
 		lpsResponse->ulCapabilities |= KOPANO_CAP_UNICODE;
 	if (clientCaps & KOPANO_CAP_MSGLOCK)
 		lpsResponse->ulCapabilities |= KOPANO_CAP_MSGLOCK;
+	if (clientCaps & KOPANO_CAP_BINARY_RPC && parseBool(g_lpSessionManager->GetConfig()->GetSetting("enable_binary_rpc")))
+		lpsResponse->ulCapabilities |= KOPANO_CAP_BINARY_RPC;
 
     if(er != KCERR_SSO_CONTINUE) {
         // Don't reset er to erSuccess on SSO_CONTINUE, we don't need the server guid yet
@@ -1600,24 +1604,21 @@ static ECRESULT GetFolderSize(ECDatabase *lpDatabase, unsigned int ulFolderId,
 	else
 		llSize = atoll(lpDBRow[0]);
 
-	// Get the subfolders
-	strQuery = "SELECT id FROM hierarchy WHERE parent=" + stringify(ulFolderId) + " AND type="+stringify(MAPI_FOLDER);
-	// except the deleted items!
-	strQuery += " AND flags & " + stringify(MSGFLAG_DELETED)+ "=0";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	// Get the subfolders, except the deleted items!
+	DB_STMT_RESULT subfolders;
+	er = lpDatabase->DoSelectPrepared("SELECT id FROM hierarchy WHERE parent=? AND type=? AND flags & ?=0",
+	     {ulFolderId, MAPI_FOLDER, MSGFLAG_DELETED}, &subfolders);
 	if(er != erSuccess)
 		return er;
 
-	if (lpDBResult.get_num_rows() > 0) {
-		// Walk through the folder list
-		while ((lpDBRow = lpDBResult.fetch_row()) != nullptr) {
-			if(lpDBRow[0] == NULL)
-				continue; //Skip item
-			er = GetFolderSize(lpDatabase, atoi(lpDBRow[0]), &llSubSize);
-			if(er != erSuccess)
-				return er;
-			llSize += llSubSize;
-		}
+	// Walk through the folder list
+	while (subfolders.fetch_row()) {
+		if (subfolders.is_null(0))
+			continue; //Skip item
+		er = GetFolderSize(lpDatabase, subfolders.get_uint(0), &llSubSize);
+		if(er != erSuccess)
+			return er;
+		llSize += llSubSize;
 	}
 
 	*lpllFolderSize = llSize;
@@ -2285,11 +2286,12 @@ static unsigned int SaveObject(struct soap *soap, ECSession *lpecSession,
 				}
 			if (fGenHasAttach) {
 				// An attachment was added or deleted, check the database to see if any attachments are left.
-				strQuery = "SELECT id FROM hierarchy WHERE parent=" + stringify(lpsReturnObj->ulServerId) + " AND type=" + stringify(MAPI_ATTACH) + " LIMIT 1";
-				er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+				DB_STMT_RESULT attach;
+				er = lpDatabase->DoSelectPrepared("SELECT id FROM hierarchy WHERE parent=? AND type=? LIMIT 1",
+				     {lpsReturnObj->ulServerId, MAPI_ATTACH}, &attach);
 				if (er != erSuccess)
 					return er;
-				fHasAttach = lpDBResult.get_num_rows() > 0;
+				fHasAttach = attach.get_num_rows() > 0;
 			}
 		}
 
@@ -2483,15 +2485,15 @@ SOAP_ENTRY_START(saveObject, lpsLoadObjectResponse->er,
 
             // We also need the old read flags so we can compare the new read flags to see if we need to update the unread counter. Note
             // that the read flags can only be modified through saveObject() when using ICS.
-            strQuery = "SELECT val_ulong FROM properties WHERE hierarchyid = " + stringify(lpsSaveObj->ulServerId) + " AND tag = " + stringify(PROP_ID(PR_MESSAGE_FLAGS)) + " AND type = " + stringify(PROP_TYPE(PR_MESSAGE_FLAGS)) + " LIMIT 1";
-            er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+			DB_STMT_RESULT flags;
+			er = lpDatabase->DoSelectPrepared("SELECT val_ulong FROM properties WHERE hierarchyid = ? AND tag = ? AND type = ? LIMIT 1",
+			     {lpsSaveObj->ulServerId, PROP_ID(PR_MESSAGE_FLAGS), PROP_TYPE(PR_MESSAGE_FLAGS)}, &flags);
             if (er != erSuccess)
 				return er;
-			lpDBRow = lpDBResult.fetch_row();
-            if (lpDBRow == nullptr || lpDBRow[0] == nullptr)
+			if (!flags.fetch_row() || flags.is_null(0))
                 ulPrevReadState = 0;
             else
-                ulPrevReadState = atoui(lpDBRow[0]) & MSGFLAG_READ;
+				ulPrevReadState = flags.get_uint(0) & MSGFLAG_READ;
             ulNewReadState = ulPrevReadState; // Copy read state, may be updated by SaveObject() later
 		}
 
@@ -3929,6 +3931,49 @@ int KCmdService::notifyGetItems(ULONG64 ulSessionId,
     throw SOAP_NULL;
 }
 
+/*
+ * Like notifyGetItems, but waits on the session groups of several sessions
+ * at once, so that a process with many session groups needs only one
+ * pending request. The reply carries the items of every session that had
+ * something, tagged with that session's id; a session that is gone is
+ * reported right away with KCERR_END_OF_SESSION in its own entry.
+ */
+int KCmdService::notifyGetItemsMulti(struct notifySessionArray sessions,
+    struct notifyMultiResponse *response)
+{
+	std::vector<ECSESSIONID> valid, gone;
+
+	if (sessions.__size <= 0 || sessions.__size > KOPANO_MAX_NOTIFY_SESSIONS ||
+	    sessions.__ptr == nullptr) {
+		response->er = KCERR_INVALID_PARAMETER;
+		return SOAP_OK;
+	}
+	valid.reserve(sessions.__size);
+	for (gsoap_size_t i = 0; i < sessions.__size; ++i) {
+		ECSession *lpSession = nullptr;
+		if (g_lpSessionManager->ValidateSession(soap, sessions.__ptr[i], &lpSession) != erSuccess) {
+			gone.emplace_back(sessions.__ptr[i]);
+			continue;
+		}
+		lpSession->unlock();
+		valid.emplace_back(sessions.__ptr[i]);
+	}
+	if (gone.empty()) {
+		g_lpSessionManager->DeferNotificationProcessing(std::move(valid), soap);
+		throw SOAP_NULL;
+	}
+	response->er = erSuccess;
+	response->sGroups.__size = gone.size();
+	response->sGroups.__ptr  = soap_new_notifyGroupItems(soap, gone.size());
+	for (size_t i = 0; i < gone.size(); ++i) {
+		auto &g = response->sGroups.__ptr[i];
+		g.ulSessionId = gone[i];
+		g.er = KCERR_END_OF_SESSION;
+		g.pNotificationArray = nullptr;
+	}
+	return SOAP_OK;
+}
+
 SOAP_ENTRY_START(getRights, lpsRightResponse->er, const entryId &sEntryId,
     int ulType, struct rightsResponse *lpsRightResponse)
 {
@@ -5838,6 +5883,7 @@ SOAP_ENTRY_START(finishedMessage, *result, const entryId &sEntryId,
 		return er;
 
 	//Get storeid
+	DB_STMT_RESULT flags;
 	er = cache->GetStore(ulObjId, &ulStoreId, NULL);
 	switch (er) {
 	case erSuccess:
@@ -5857,17 +5903,16 @@ SOAP_ENTRY_START(finishedMessage, *result, const entryId &sEntryId,
 	er = lpecSession->GetSecurity()->CheckPermission(ulStoreId, ecSecurityOwner);
 	if(er != erSuccess)
 		return er;
-    strQuery = "SELECT val_ulong FROM properties WHERE hierarchyid="+stringify(ulObjId) + " AND tag=" + stringify(PROP_ID(PR_MESSAGE_FLAGS)) + " AND type=" + stringify(PROP_TYPE(PR_MESSAGE_FLAGS)) + " FOR UPDATE";
-    er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	er = lpDatabase->DoSelectPrepared("SELECT val_ulong FROM properties WHERE hierarchyid=? AND tag=? AND type=? FOR UPDATE",
+	     {ulObjId, PROP_ID(PR_MESSAGE_FLAGS), PROP_TYPE(PR_MESSAGE_FLAGS)}, &flags);
     if(er != erSuccess)
 		return er;
-	lpDBRow = lpDBResult.fetch_row();
-    if(lpDBRow == NULL || lpDBRow[0] == NULL) {
+	if (!flags.fetch_row() || flags.is_null(0)) {
 		ec_log_err("finishedMessages(): row/col null");
 		return er = KCERR_DATABASE_ERROR;
     }
 
-    ulPrevFlags = atoui(lpDBRow[0]);
+	ulPrevFlags = flags.get_uint(0);
 	strQuery = "UPDATE properties ";
 	if (!(ulFlags & EC_SUBMIT_MASTER))
         // Removing from local queue; remove submit flag and unsent flag
@@ -5958,21 +6003,21 @@ SOAP_ENTRY_START(abortSubmit, *result, const entryId &sEntryId,
 	if(er != erSuccess)
 		return er;
 	// Get storeid and check if the message into the queue
-	strQuery = "SELECT store_id, flags FROM outgoingqueue WHERE hierarchy_id="+stringify(ulObjId) + " LIMIT 2";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	DB_STMT_RESULT queue;
+	er = lpDatabase->DoSelectPrepared("SELECT store_id, flags FROM outgoingqueue WHERE hierarchy_id=? LIMIT 2",
+	     {ulObjId}, &queue);
 	if(er != erSuccess)
 		return er;
 // FIXME: can be also more than 2??
-	if (lpDBResult.get_num_rows() != 1)
+	if (queue.get_num_rows() != 1)
 		return KCERR_NOT_IN_QUEUE;
-	lpDBRow = lpDBResult.fetch_row();
-	if(lpDBRow == NULL || lpDBRow[0] == NULL || lpDBRow[1] == NULL) {
+	if (!queue.fetch_row() || queue.is_null(0) || queue.is_null(1)) {
 		ec_log_err("abortSubmit(): row/col null");
 		return KCERR_DATABASE_ERROR;
 	}
 
-	ulStoreId = atoui(lpDBRow[0]);
-	auto ulSubmitFlags = atoi(lpDBRow[1]);
+	ulStoreId = queue.get_uint(0);
+	auto ulSubmitFlags = queue.get_uint(1);
 	// delete the message from the outgoing queue
 	strQuery = "DELETE FROM outgoingqueue WHERE hierarchy_id="+stringify(ulObjId);
 	er = lpDatabase->DoDelete(strQuery);
@@ -6137,17 +6182,18 @@ SOAP_ENTRY_START(resolveUserStore, lpsResponse->er, const char *szUserName,
 		}
 	}
 
-	strQuery = "SELECT hierarchy_id, guid FROM stores WHERE user_id = " + stringify(ulObjectId) + " AND (1 << type) & " + stringify(ulStoreTypeMask) + " LIMIT 1";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	DB_STMT_RESULT store;
+	er = lpDatabase->DoSelectPrepared("SELECT hierarchy_id, guid FROM stores WHERE user_id = ? AND (1 << type) & ? LIMIT 1",
+	     {ulObjectId, ulStoreTypeMask}, &store);
 	if (er != erSuccess) {
 		ec_perror("resolveUserStore(): select failed", er);
 		return KCERR_DATABASE_ERROR;
 	}
-	lpDBRow = lpDBResult.fetch_row();
-	lpDBLen = lpDBResult.fetch_row_lengths();
-    if (lpDBRow == nullptr)
+	if (!store.fetch_row())
 		return KCERR_NOT_FOUND;
-    if (lpDBRow[0] == NULL || lpDBRow[1] == NULL || lpDBLen == NULL || lpDBLen[1] == 0) {
+	size_t guid_len = 0;
+	auto guid_data = store.get_data(1, &guid_len);
+	if (store.is_null(0) || guid_data == nullptr || guid_len == 0) {
 		ec_log_err("resolveUserStore(): row/col null");
 		return KCERR_DATABASE_ERROR;
     }
@@ -6156,7 +6202,7 @@ SOAP_ENTRY_START(resolveUserStore, lpsResponse->er, const char *szUserName,
 	std::string strServerName = cfg->GetSetting("server_name", "", "Unknown");
     // Always return the pseudo URL.
 	lpsResponse->lpszServerPath = soap_strdup(soap, ("pseudo://"s + strServerName).c_str());
-    er = g_lpSessionManager->GetCacheManager()->GetEntryIdFromObject(atoui(lpDBRow[0]), soap, ulFlags & OPENSTORE_OVERRIDE_HOME_MDB, &lpsResponse->sStoreId);
+	er = g_lpSessionManager->GetCacheManager()->GetEntryIdFromObject(store.get_uint(0), soap, ulFlags & OPENSTORE_OVERRIDE_HOME_MDB, &lpsResponse->sStoreId);
 	if(er != erSuccess)
 		return er;
 	er = GetABEntryID(ulObjectId, soap, &lpsResponse->sUserId);
@@ -6164,9 +6210,9 @@ SOAP_ENTRY_START(resolveUserStore, lpsResponse->er, const char *szUserName,
 		return er;
 
 	lpsResponse->ulUserId = ulObjectId;
-	lpsResponse->guid.__size = lpDBLen[1];
-	lpsResponse->guid.__ptr  = soap_new_unsignedByte(soap, lpDBLen[1]);
-	memcpy(lpsResponse->guid.__ptr, lpDBRow[1], lpDBLen[1]);
+	lpsResponse->guid.__size = guid_len;
+	lpsResponse->guid.__ptr  = soap_new_unsignedByte(soap, guid_len);
+	memcpy(lpsResponse->guid.__ptr, guid_data, guid_len);
 	return erSuccess;
 }
 SOAP_ENTRY_END()
@@ -6536,6 +6582,55 @@ static ECRESULT MoveObjects(ECSession *lpSession, ECDatabase *lpDatabase,
 	return erSuccess;
 }
 
+/**
+ * Apply the per-copy changes of a deliver_copies request to the freshly
+ * copied message @ulObjId: drop @dc.del_props, then set @dc.props.
+ */
+static ECRESULT WriteDeliveryProps(ECSession *lpecSession,
+    ECDatabase *lpDatabase, ECAttachmentStorage *lpAttachmentStorage,
+    unsigned int ulObjId, const struct deliver_copy &dc)
+{
+	// set up by CopyObject, not by the caller
+	static constexpr unsigned int ulProtected[] = {PR_ENTRYID, PR_PARENT_ENTRYID, PR_SOURCE_KEY, PR_PARENT_SOURCE_KEY, PR_EC_IMAP_ID, PR_MESSAGE_FLAGS, PR_STORE_ENTRYID, PR_RECORD_KEY};
+
+	for (gsoap_size_t i = 0; i < dc.props.__size; ++i) {
+		auto tag = dc.props.__ptr[i].ulPropTag;
+		if ((PROP_TYPE(tag) & MV_FLAG) || PROP_TYPE(tag) == PT_ERROR ||
+		    std::find(std::begin(ulProtected), std::end(ulProtected), tag) != std::end(ulProtected))
+			return KCERR_INVALID_PARAMETER;
+	}
+	if (dc.del_props.__size > 0) {
+		struct propTagArray sDelProps(dc.del_props.__ptr, dc.del_props.__size);
+		auto er = DeleteProps(lpecSession, lpDatabase, ulObjId, &sDelProps, lpAttachmentStorage);
+		if (er != erSuccess)
+			return er;
+	}
+
+	std::string strInsert;
+	sObjectTableKey key(ulObjId, 0);
+	for (gsoap_size_t i = 0; i < dc.props.__size; ++i) {
+		auto sProp = dc.props.__ptr[i];
+		// Make sure string propvals are in UTF8 with tag PT_STRING8
+		if (PROP_TYPE(sProp.ulPropTag) == PT_UNICODE)
+			sProp.ulPropTag = CHANGE_PROP_TYPE(sProp.ulPropTag, PT_STRING8);
+		auto er = WriteSingleProp(lpDatabase, ulObjId, 0, &sProp, false, lpDatabase->GetMaxAllowedPacket(), strInsert);
+		if (er == KCERR_TOO_BIG) {
+			er = lpDatabase->DoInsert(strInsert);
+			if (er == erSuccess) {
+				strInsert.clear();
+				er = WriteSingleProp(lpDatabase, ulObjId, 0, &sProp, false, lpDatabase->GetMaxAllowedPacket(), strInsert);
+			}
+		}
+		if (er != erSuccess)
+			return er;
+		g_lpSessionManager->GetCacheManager()->SetCell(&key, sProp.ulPropTag, &sProp);
+	}
+	// tproperties follow through the deferred update CopyObject adds
+	if (!strInsert.empty())
+		return lpDatabase->DoInsert(strInsert);
+	return erSuccess;
+}
+
 /**
  * Copy one message with his parent data like attachments and recipient
  *
@@ -6548,6 +6643,8 @@ static ECRESULT MoveObjects(ECSession *lpSession, ECDatabase *lpDatabase,
  * @param[in] bDoNotification true if you want to send object notifications.
  * @param[in] bDoTableNotification true if you want to send table notifications.
  * @param[in] ulSyncId Client sync identify.
+ * @param[in] lpOverride Properties to drop and set on the root copy, may be NULL.
+ * @param[out] lpulNewObjId Id of the root copy, may be NULL.
  *
  * @FIXME It is possible to send notifications before a commit, this can give issues with the cache!
  * 			This function should be refactored
@@ -6555,7 +6652,9 @@ static ECRESULT MoveObjects(ECSession *lpSession, ECDatabase *lpDatabase,
 static ECRESULT CopyObject(ECSession *lpecSession,
     ECAttachmentStorage *lpAttachmentStorage, unsigned int ulObjId,
     unsigned int ulDestFolderId, bool bIsRoot, bool bDoNotification,
-    bool bDoTableNotification, unsigned int ulSyncId)
+    bool bDoTableNotification, unsigned int ulSyncId,
+    const struct deliver_copy *lpOverride = nullptr,
+    unsigned int *lpulNewObjId = nullptr)
 {
 	ECDatabase		*lpDatabase = NULL;
 	DB_RESULT lpDBResult;
@@ -6729,6 +6828,11 @@ static ECRESULT CopyObject(ECSession *lpecSession,
 		return er_lerrf(er, "CopyAttachment(%u -> %u) failed", ulObjId, ulNewObjectId);
 	er = erSuccess;
 
+	if (bIsRoot && lpOverride != nullptr) {
+		er = WriteDeliveryProps(lpecSession, lpDatabase, lpAttachmentStorage, ulNewObjectId, *lpOverride);
+		if (er != erSuccess)
+			return er_lerrf(er, "WriteDeliveryProps(%u) failed", ulNewObjectId);
+	}
 	if (bIsRoot) {
 		// Create indexedproperties, Add new PR_SOURCE_KEY
 		er = lpecSession->GetNewSourceKey(&sSourceKey);
@@ -6790,6 +6894,8 @@ static ECRESULT CopyObject(ECSession *lpecSession,
 	}
 
 	g_lpSessionManager->GetCacheManager()->Update(fnevObjectModified, ulDestFolderId);
+	if (lpulNewObjId != nullptr)
+		*lpulNewObjId = ulNewObjectId;
 	if (!bDoNotification)
 		return erSuccess;
 	// Update destination folder
@@ -7056,6 +7162,135 @@ SOAP_ENTRY_START(copyObjects, *result, struct entryList *aMessages,
 }
 SOAP_ENTRY_END()
 
+/**
+ * Copy the delivered message @template_eid once into each folder of @batch,
+ * replacing the properties the batch entry gives for that copy. Used by the
+ * delivery agent to fan one message out to many recipients on this server;
+ * attachments are shared through single instancing.
+ *
+ * Every copy is a transaction of its own and has its own result in
+ * @rsp->results, the call itself only fails on bad input.
+ */
+SOAP_ENTRY_START(deliver_copies, rsp->er, const entryId &template_eid,
+    const deliver_copy_set &batch, struct deliver_copies_response *rsp)
+{
+	unsigned int ulTemplateId = 0;
+	USE_DATABASE_NORESULT();
+
+	if (batch.__size < 0 || (batch.__size > 0 && batch.__ptr == nullptr))
+		return KCERR_INVALID_PARAMETER;
+	er = lpecSession->GetObjectFromEntryId(&template_eid, &ulTemplateId);
+	if (er != erSuccess)
+		return er_lerrf(er, "Failed obtaining object by entry id (%s)",
+		       bin2hex(template_eid.__size, template_eid.__ptr).c_str());
+
+	rsp->results.__size   = batch.__size;
+	rsp->results.__ptr    = soap_new_unsignedInt(soap, batch.__size);
+	rsp->entryids         = soap_new_entryList(soap);
+	rsp->entryids->__size = batch.__size;
+	rsp->entryids->__ptr  = soap_new_entryId(soap, batch.__size);
+
+	auto gcache = g_lpSessionManager->GetCacheManager();
+	for (gsoap_size_t i = 0; i < batch.__size; ++i) {
+		const auto &dc = batch.__ptr[i];
+		unsigned int ulFolderId = 0, ulNewObjId = 0, ulGrandParent = 0;
+
+		er = lpecSession->GetObjectFromEntryId(&dc.folder_eid, &ulFolderId);
+		if (er == erSuccess)
+			er = lpecSession->GetSecurity()->CheckPermission(ulFolderId, ecSecurityCreate);
+		if (er == erSuccess)
+			er = CopyObject(lpecSession, nullptr, ulTemplateId, ulFolderId,
+			     true, true, true, 0, &dc, &ulNewObjId);
+		if (er == erSuccess)
+			er = gcache->GetEntryIdFromObject(ulNewObjId, soap, 0, &rsp->entryids->__ptr[i]);
+		rsp->results.__ptr[i] = er;
+		if (er != erSuccess) {
+			er_lerrf(er, "deliver_copies: copy %d failed", i);
+			continue;
+		}
+		WriteLocalCommitTimeMax(nullptr, lpDatabase, ulFolderId, nullptr);
+		gcache->GetParent(ulFolderId, &ulGrandParent);
+		g_lpSessionManager->UpdateTables(ECKeyTable::TABLE_ROW_MODIFY, 0, ulGrandParent, ulFolderId, MAPI_FOLDER);
+	}
+	er = erSuccess;
+}
+SOAP_ENTRY_END()
+
+/*
+ * Makes independent calls for the client in one request. Every op goes
+ * to the same handler as when it comes alone, and gets its own result;
+ * one failing does not stop the others.
+ */
+SOAP_ENTRY_START(compound, rsp->er, const compound_op_set &ops,
+    struct compound_response *rsp)
+{
+	if (ops.__size < 0 || (ops.__size > 0 && ops.__ptr == nullptr))
+		return KCERR_INVALID_PARAMETER;
+	rsp->results.__size = ops.__size;
+	rsp->results.__ptr  = soap_new_compound_result(soap, ops.__size);
+
+	auto info = soap_info(soap);
+	for (gsoap_size_t i = 0; i < ops.__size; ++i) {
+		const auto &op = ops.__ptr[i];
+		auto &res = rsp->results.__ptr[i];
+		/* The nested handler would take over the timing of this request */
+		auto st = info->st;
+		int ret = SOAP_OK;
+
+		switch (op.op) {
+		case COMPOUND_OP_CHECKEXISTOBJECT:
+			ret = checkExistObject(ulSessionId, op.eid, op.flags, &res.er);
+			break;
+		case COMPOUND_OP_LOADOBJECT: {
+			struct loadObjectResponse r;
+			soap_default_loadObjectResponse(soap, &r);
+			ret = loadObject(ulSessionId, op.eid, op.subscribe, op.flags, &r);
+			res.er = r.er;
+			if (r.er == erSuccess) {
+				res.object = soap_new_saveObject(soap);
+				*res.object = r.sSaveObject;
+			}
+			break;
+		}
+		case COMPOUND_OP_GETIDSFROMNAMES: {
+			struct getIDsFromNamesResponse r;
+			soap_default_getIDsFromNamesResponse(soap, &r);
+			ret = getIDsFromNames(ulSessionId, op.names, op.flags, &r);
+			res.er = r.er;
+			if (r.er == erSuccess) {
+				res.tags = soap_new_propTagArray(soap);
+				*res.tags = r.lpsPropTags;
+			}
+			break;
+		}
+		case COMPOUND_OP_TABLEMULTI: {
+			struct tableMultiResponse r;
+			if (op.table == nullptr) {
+				res.er = KCERR_INVALID_PARAMETER;
+				break;
+			}
+			soap_default_tableMultiResponse(soap, &r);
+			ret = tableMulti(ulSessionId, *op.table, &r);
+			res.er = r.er;
+			res.table_id = r.ulTableId;
+			if (r.er == erSuccess) {
+				res.rows = soap_new_rowSet(soap);
+				*res.rows = r.sRowSet;
+			}
+			break;
+		}
+		default:
+			res.er = KCERR_NO_SUPPORT;
+			break;
+		}
+		info->st = std::move(st);
+		if (ret != SOAP_OK)
+			return KCERR_NETWORK_ERROR;
+	}
+	er = erSuccess;
+}
+SOAP_ENTRY_END()
+
 SOAP_ENTRY_START(copyFolder, *result, const entryId &sEntryId,
     const entryId &sDestFolderId, const char *lpszNewFolderName,
     unsigned int ulFlags, unsigned int ulSyncId, unsigned int *result)
@@ -7676,12 +7911,14 @@ void *SoftDeleteRemover(void *arg)
 SOAP_ENTRY_START(checkExistObject, *result, const entryId &sEntryId,
     unsigned int ulFlags, unsigned int *result)
 {
-	unsigned int ulObjId = 0, ulObjType = 0, ulDBFlags = 0;
+	unsigned int ulObjId = 0, ulObjType = 0, ulDBFlags = 0, ulParentId = 0;
+	unsigned int ulParentObjType = 0;
 
 	er = lpecSession->GetObjectFromEntryId(&sEntryId, &ulObjId);
 	if(er != erSuccess)
 		return er;
-	er = g_lpSessionManager->GetCacheManager()->GetObject(ulObjId, NULL, NULL, &ulDBFlags, &ulObjType);
+	auto cache = g_lpSessionManager->GetCacheManager();
+	er = cache->GetObject(ulObjId, &ulParentId, NULL, &ulDBFlags, &ulObjType);
 	if(er != erSuccess)
 		return er;
 	if(ulFlags & SHOW_SOFT_DELETES) {
@@ -7691,6 +7928,18 @@ SOAP_ENTRY_START(checkExistObject, *result, const entryId &sEntryId,
 		if (ulDBFlags & MSGFLAG_DELETED)
 			return KCERR_NOT_FOUND;
 	}
+	if (!(ulFlags & CHECKEXIST_ACCESS))
+		return erSuccess;
+	/* The same check as LoadObject, for clients that have the object cached */
+	if (ulObjType == MAPI_MESSAGE)
+		return lpecSession->GetSecurity()->CheckPermission(ulObjId, ecSecurityRead);
+	if (ulObjType != MAPI_FOLDER)
+		return erSuccess;
+	er = cache->GetObject(ulParentId, nullptr, nullptr, nullptr, &ulParentObjType);
+	if (er != erSuccess)
+		return er;
+	if (ulParentObjType != MAPI_STORE)
+		er = lpecSession->GetSecurity()->CheckPermission(ulObjId, ecSecurityFolderVisible);
 }
 SOAP_ENTRY_END()
 
@@ -8160,19 +8409,19 @@ SOAP_ENTRY_START(getMessageStatus, lpsStatus->er, const entryId &sEntryId,
 		return er;
 
 	// Get the old flags
-	strQuery = "SELECT val_ulong FROM properties WHERE hierarchyid="+stringify(ulId)+" AND tag=3607 AND type=3 LIMIT 2";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	DB_STMT_RESULT status;
+	er = lpDatabase->DoSelectPrepared("SELECT val_ulong FROM properties WHERE hierarchyid=? AND tag=? AND type=? LIMIT 2",
+	     {ulId, PROP_ID(PR_MSG_STATUS), PROP_TYPE(PR_MSG_STATUS)}, &status);
 	if (er != erSuccess) {
 		ec_perror("getMessageStatus(): select failed", er);
 		return KCERR_DATABASE_ERROR;
 	}
-	if (lpDBResult.get_num_rows() == 1) {
-		lpDBRow = lpDBResult.fetch_row();
-		if(lpDBRow == NULL || lpDBRow[0] == NULL) {
+	if (status.get_num_rows() == 1) {
+		if (!status.fetch_row() || status.is_null(0)) {
 			ec_log_err("getMessageStatus(): row or col null");
 			return KCERR_DATABASE_ERROR;
 		}
-		ulMsgStatus = atoui(lpDBRow[0]);
+		ulMsgStatus = status.get_uint(0);
 	}
 
 	lpsStatus->ulMessageStatus = ulMsgStatus;
@@ -8204,31 +8453,30 @@ SOAP_ENTRY_START(setMessageStatus, lpsOldStatus->er, const entryId &sEntryId,
 		return er;
 
 	// Get the old flags (PR_MSG_STATUS)
-	strQuery = "SELECT val_ulong FROM properties WHERE hierarchyid="+stringify(ulId)+" AND tag=3607 AND type=3 LIMIT 2";
-	er = lpDatabase->DoSelect(strQuery, &lpDBResult);
+	DB_STMT_RESULT status;
+	er = lpDatabase->DoSelectPrepared("SELECT val_ulong FROM properties WHERE hierarchyid=? AND tag=? AND type=? LIMIT 2",
+	     {ulId, PROP_ID(PR_MSG_STATUS), PROP_TYPE(PR_MSG_STATUS)}, &status);
 	if (er != erSuccess) {
 		ec_perror("setMessageStatus(): select failed", er);
 		return er = KCERR_DATABASE_ERROR;
 	}
-	ulRows = lpDBResult.get_num_rows();
+	ulRows = status.get_num_rows();
 	if (ulRows == 1) {
-		lpDBRow = lpDBResult.fetch_row();
-		if(lpDBRow == NULL || lpDBRow[0] == NULL) {
+		if (!status.fetch_row() || status.is_null(0)) {
 			ec_log_err("setMessageStatus(): row or col null");
 			return er = KCERR_DATABASE_ERROR;
 		}
-		ulOldMsgStatus = atoui(lpDBRow[0]);
+		ulOldMsgStatus = status.get_uint(0);
 	}
 
 	// Set the new flags
 	auto ulNewMsgStatus = (ulOldMsgStatus &~ulNewStatusMask) | (ulNewStatusMask & ulNewStatus);
-	if(ulRows > 0){
-		strQuery = "UPDATE properties SET val_ulong="+stringify(ulNewMsgStatus)+" WHERE  hierarchyid="+stringify(ulId)+" AND tag=3607 AND type=3";
-		er = lpDatabase->DoUpdate(strQuery);
-	}else {
-		strQuery = "INSERT INTO properties(hierarchyid, tag, type, val_ulong) VALUES("+stringify(ulId)+", 3607, 3,"+stringify(ulNewMsgStatus)+")";
-		er = lpDatabase->DoInsert(strQuery);
-	}
+	if(ulRows > 0)
+		er = lpDatabase->DoUpdatePrepared("UPDATE properties SET val_ulong=? WHERE hierarchyid=? AND tag=? AND type=?",
+		     {ulNewMsgStatus, ulId, PROP_ID(PR_MSG_STATUS), PROP_TYPE(PR_MSG_STATUS)});
+	else
+		er = lpDatabase->DoUpdatePrepared("INSERT INTO properties(hierarchyid, tag, type, val_ulong) VALUES(?, ?, ?, ?)",
+		     {ulId, PROP_ID(PR_MSG_STATUS), PROP_TYPE(PR_MSG_STATUS), ulNewMsgStatus});
 	if(er != erSuccess) {
 		ec_log_err("setMessageStatus(): query failed");
 		return er = KCERR_DATABASE_ERROR;
@@ -567,6 +567,17 @@ ECRESULT DeleteObjectHard(ECSession *lpSession, ECDatabase *lpDatabase, ECAttach
 		lpAttachmentStorage = lpInternalAttachmentStorage.get();
 	}
 
+	/*
+	 * Bump the deletion counter ahead of the deletes, outside their
+	 * transaction, so that the row is not held locked while they run. The
+	 * cache snapshot compares it to tell whether rows may have gone.
+	 */
+	if (!lstDeleteItems.empty()) {
+		er = lpDatabase->DoUpdate("INSERT INTO `settings` (`name`, `value`) VALUES ('hierarchy_deletes', '1') ON DUPLICATE KEY UPDATE `value`=`value`+1");
+		if (er != erSuccess)
+			return er;
+	}
+
 	for (auto iterDeleteItems = lstDeleteItems.crbegin();
 	     iterDeleteItems != lstDeleteItems.crend(); ) {
 		strInclause.clear();
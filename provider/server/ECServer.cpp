@@ -209,6 +209,11 @@ server_stats::server_stats(std::shared_ptr<ECConfig> cfg) :
 
 	AddStat(SCN_SESSIONGROUPS_CREATED, SCT_INTEGER, "sess_grp_created", "Number of created sessiongroups");
 	AddStat(SCN_SESSIONGROUPS_DELETED, SCT_INTEGER, "sess_grp_deleted", "Number of deleted sessiongroups");
+	AddStat(SCN_NOTIFY_QUEUED, SCT_INTEGER, "notify_queued", "Number of notifications queued for delivery");
+	AddStat(SCN_NOTIFY_COALESCED, SCT_INTEGER, "notify_coalesced", "Number of notifications superseded by a later one in the same batch");
+	AddStat(SCN_NOTIFY_OVERFLOW, SCT_INTEGER, "notify_overflow", "Number of notifications queued while a session group's ring was full");
+	AddStat(SCN_NOTIFY_BATCHES, SCT_INTEGER, "notify_batches", "Number of notification batches delivered");
+	AddStat(SCN_NOTIFY_MAX_BATCH, SCT_INTGAUGE, "notify_max_batch", "Largest number of notifications queued for one delivery");
 
 	AddStat(SCN_LDAP_CONNECTS, SCT_INTEGER, "ldap_connect", "Number of connections made to LDAP server");
 	AddStat(SCN_LDAP_RECONNECTS, SCT_INTEGER, "ldap_reconnect", "Number of re-connections made to LDAP server");
@@ -233,6 +238,15 @@ server_stats::server_stats(std::shared_ptr<ECConfig> cfg) :
 	AddStat(SCN_INDEXER_SEARCH_AVG, SCT_INTGAUGE, "index_search_avg", "Average duration (in µs) of an indexed search query");
 	AddStat(SCN_INDEXED_SEARCHES, SCT_INTEGER, "search_indexed", "Number of indexed searches performed");
 	AddStat(SCN_DATABASE_SEARCHES, SCT_INTEGER, "search_database", "Number of database searches performed");
+	AddStat(SCN_INDEXER_SEARCH_LT1MS, SCT_INTEGER, "index_search_lt1ms", "Indexed search queries that took less than 1 ms");
+	AddStat(SCN_INDEXER_SEARCH_LT10MS, SCT_INTEGER, "index_search_lt10ms", "Indexed search queries that took 1 to 10 ms");
+	AddStat(SCN_INDEXER_SEARCH_LT100MS, SCT_INTEGER, "index_search_lt100ms", "Indexed search queries that took 10 to 100 ms");
+	AddStat(SCN_INDEXER_SEARCH_LT1S, SCT_INTEGER, "index_search_lt1s", "Indexed search queries that took 100 ms to 1 s");
+	AddStat(SCN_INDEXER_SEARCH_GE1S, SCT_INTEGER, "index_search_ge1s", "Indexed search queries that took 1 s or more");
+	AddStat(SCN_INDEXER_POOL_WAITS, SCT_INTEGER, "index_pool_waits", "Indexed searches that waited for a free connection to the indexer");
+	AddStat(SCN_INDEXER_CONNECTS, SCT_INTEGER, "index_connects", "Connections made to the indexer");
+	AddStat(SCN_INDEXER_NATIVE_DOCS, SCT_INTGAUGE, "index_native_docs", "Messages in the native full-text index");
+	AddStat(SCN_INDEXER_NATIVE_SIZE, SCT_INTGAUGE, "index_native_size", "Approximate memory used by the native full-text index (in bytes)");
 
 	AddStat(SCN_SERVER_USERDB_BACKEND, SCT_STRING, "userplugin", "User backend plugin");
 	AddStat(SCN_SERVER_ATTACH_BACKEND, SCT_STRING, "attachment_storage", "Attachment backend type");
@@ -291,6 +305,7 @@ void sv_sighup_sync()
 		ec_log_err("Failed to reload configuration file");
 
 	g_lpSessionManager->GetPluginFactory()->SignalPlugins(SIGHUP);
+	g_lpSessionManager->GetSharedTables()->enable(parseBool(g_lpConfig->GetSetting("table_sharing")));
 	auto ll = g_lpConfig->GetSetting("log_level");
 	auto new_ll = ll ? strtol(ll, NULL, 0) : EC_LOGLEVEL_WARNING;
 	ec_log_get()->SetLoglevel(new_ll);
@@ -1067,9 +1082,13 @@ static int running_server(char *szName, const char *szConfig, bool exp_config,
 		{"attachment_s3_secretaccesskey", ""},
 		{"attachment_s3_bucketname", ""},
 		{"attachment_s3_region", ""},
+		{"attachment_s3_part_size", "16M", CONFIGSETTING_SIZE},
+		{"attachment_s3_window", "64M", CONFIGSETTING_SIZE},
 #endif
 		{"attachment_path", "/var/lib/kopano/attachments"},
 		{ "attachment_compression",		"6" },
+		{"attachment_compression_codec", "gzip"},
+		{"attachment_compression_threads", "2"},
 
 		// Log options
 		{"log_method", "auto", CONFIGSETTING_NONEMPTY},
@@ -1104,6 +1123,7 @@ static int running_server(char *szName, const char *szConfig, bool exp_config,
 		// internal server controls
 		{ "softdelete_lifetime",		"30", CONFIGSETTING_RELOADABLE },	// time expressed in days, 0 == never delete anything
 		{ "cache_cell_size",			"0", CONFIGSETTING_SIZE },
+		{"cache_column_size", "0", CONFIGSETTING_SIZE},
 		{ "cache_object_size",		"0", CONFIGSETTING_SIZE },
 		{ "cache_indexedobject_size",	"0", CONFIGSETTING_SIZE },
 		{ "cache_quota_size",			"0", CONFIGSETTING_SIZE },
@@ -1115,6 +1135,8 @@ static int running_server(char *szName, const char *szConfig, bool exp_config,
 		{ "cache_store_size",			"1M", CONFIGSETTING_SIZE },		// 1Mb, store table cache (storeid, storeguid), 40 bytes
 		{ "cache_server_size",			"1M", CONFIGSETTING_SIZE },		// 1Mb
 		{ "cache_server_lifetime",		"30" },							// 30 minutes
+		{"cache_shards", "16"},
+		{"cache_snapshot_file", ""},
 		/* Default no quotas. Note: quota values are in Mb, and thus have no size flag. */
 		{ "quota_warn",				"0", CONFIGSETTING_RELOADABLE },
 		{ "quota_soft",				"0", CONFIGSETTING_RELOADABLE },
@@ -1132,18 +1154,25 @@ static int running_server(char *szName, const char *szConfig, bool exp_config,
 		{ "enable_gab",				"yes", CONFIGSETTING_RELOADABLE },			// whether the GAB is enabled
 		{"abtable_initially_empty", "no", CONFIGSETTING_RELOADABLE},
         { "enable_enhanced_ics",    "yes", CONFIGSETTING_RELOADABLE },			// (dis)allow enhanced ICS operations (stream and notifications)
+		{ "enable_binary_rpc", "yes", CONFIGSETTING_RELOADABLE },		// (dis)allow binary encoding of the hottest calls
         { "enable_sql_procedures",  "yes" },			// (dis)allow SQL procedures (requires mysql config stack adjustment), not reloadable because in the middle of the streaming flip
 
 		{ "search_enabled",			"yes", CONFIGSETTING_RELOADABLE },
 		{ "search_socket",			"file:///var/run/kopano/search.sock", CONFIGSETTING_RELOADABLE },
 		{ "search_timeout",			"10", CONFIGSETTING_RELOADABLE },
+		{ "search_connections",			"8", CONFIGSETTING_RELOADABLE },
+		{ "search_native",			"no" },
+		{ "search_native_exclude_properties",	"007D 0064 0C1E 0075 001A" },
+		{ "search_native_max_size",		"1G", CONFIGSETTING_RELOADABLE | CONFIGSETTING_SIZE },
 
 		{ "threads",				"8", CONFIGSETTING_RELOADABLE },
 		{"thread_limit", "40", CONFIGSETTING_RELOADABLE},
+		{"server_reactors", "1"},
 		{ "watchdog_max_age",		"500", CONFIGSETTING_RELOADABLE },
 		{ "watchdog_frequency",		"1", CONFIGSETTING_RELOADABLE },
 
 		{ "folder_max_items",		"1000000", CONFIGSETTING_RELOADABLE },
+		{ "table_sharing",			"yes", CONFIGSETTING_RELOADABLE },
 		{ "default_sort_locale_id",		"en_US", CONFIGSETTING_RELOADABLE },
 		{ "sync_gab_realtime",			"yes", CONFIGSETTING_RELOADABLE },
 		{ "max_deferred_records",		"0", CONFIGSETTING_RELOADABLE },
@@ -1156,6 +1185,7 @@ static int running_server(char *szName, const char *szConfig, bool exp_config,
 		{ "proxy_header", "", CONFIGSETTING_RELOADABLE },
 		{ "owner_auto_full_access", "true" },
 		{ "attachment_files_fsync", "yes", 0 },
+		{"attachment_files_chunking", "no"},
 		{ "tmp_path", "/tmp" },
 		{ "shared_reminders", "yes", CONFIGSETTING_RELOADABLE }, // enable/disable reminders for shared stores
 		{"statsclient_url", "unix:/var/run/kopano/statsd.sock", CONFIGSETTING_RELOADABLE},
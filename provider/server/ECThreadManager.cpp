@@ -6,18 +6,26 @@
 #	include "config.h"
 #endif
 #include <kopano/platform.h>
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 #include "ECThreadManager.h"
 #include <cerrno>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
 #include <poll.h>
+#include <sched.h>
 #include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 #include <libHX/defs.h>
 #include <libHX/misc.h>
 #include <libHX/string.h>
@@ -190,6 +198,7 @@ void WORKITEM::run()
 		// session after XML parsing
 		info->st.func = nullptr;
 		info->fdone = NULL;
+		info->binrpc = false;
 
 		// Do processing of work item
 		soap_begin(soap);
@@ -212,12 +221,13 @@ void WORKITEM::run()
 		// by another thread. In this case, soap_serve_request() returns SOAP_NULL. We
 		// can NOT rely on soap->error being this value since the other thread may already
 		// have overwritten the error value.
-		if (soap_envelope_begin_in(soap) || soap_recv_header(soap) ||
-		    soap_body_begin_in(soap)) {
+		if (!info->binrpc && (soap_envelope_begin_in(soap) ||
+		    soap_recv_header(soap) || soap_body_begin_in(soap))) {
 			err = soap->error;
 		} else {
 			try {
-				err = KCmdService(soap).dispatch();
+				err = info->binrpc ? kopano_binrpc_serve(soap) :
+				      KCmdService(soap).dispatch();
 			} catch (const int &) {
 				/* matching part is in cmd.cpp: "throw SOAP_NULL;" (23) */
 				// Reply processing is handled by the callee, totally ignore the rest of processing for this item
@@ -314,6 +324,11 @@ void ECDispatcher::AddListenSocket(std::unique_ptr<struct soap, ec_soap_deleter>
 }
 
 void ECDispatcher::QueueItem(struct soap *soap, time_point sktime)
+{
+	QueueItem(soap, sktime, m_pool);
+}
+
+void ECDispatcher::QueueItem(struct soap *soap, time_point sktime, ksrv_tpool &pool)
 {
 	auto item = new WORKITEM;
 	CONNECTION_TYPE ulType;
@@ -325,7 +340,7 @@ void ECDispatcher::QueueItem(struct soap *soap, time_point sktime)
 	if (ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY)
 		m_prio.enqueue(item, true, &soap_info(soap)->st.enq_wall_start);
 	else
-		m_pool.enqueue(item, true, &soap_info(soap)->st.enq_wall_start);
+		pool.enqueue(item, true, &soap_info(soap)->st.enq_wall_start);
 }
 
 int ECDispatcher::maxlistenfds() const
@@ -350,7 +365,11 @@ void ECDispatcher::NotifyDone(struct soap *soap)
 		soap_free(soap);
 		return;
 	}
+	Requeue(soap);
+}
 
+void ECDispatcher::Requeue(struct soap *soap)
+{
 	SOAP_SOCKET socket = soap->socket;
 	ACTIVESOCKET sActive;
 	sActive.soap = soap;
@@ -418,6 +437,32 @@ static void update_host(unsigned int type, struct soap *soap)
 		HX_strlcat(soap->host, (":pid-" + std::to_string(pid)).c_str(), sizeof(soap->host));
 }
 
+/*
+ * Fill in what gsoap's soap_accept would for a TCP connection that we
+ * accepted ourselves (soap->peer, peerlen and keep_alive already set).
+ */
+static void set_tcp_peer(struct soap *soap)
+{
+	char port[8];
+	if (getnameinfo(&soap->peer.addr, soap->peerlen, soap->host,
+	    sizeof(soap->host), port, sizeof(port),
+	    NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+		soap->port = atoi(port);
+	} else {
+		*soap->host = '\0';
+		soap->port = 0;
+	}
+	soap->ip = 0;
+	if (soap->peer.addr.sa_family == AF_INET)
+		soap->ip = ntohl(reinterpret_cast<const struct sockaddr_in *>(&soap->peer.addr)->sin_addr.s_addr);
+	int set = 1;
+	if (soap->keep_alive &&
+	    setsockopt(soap->socket, SOL_SOCKET, SO_KEEPALIVE, &set, sizeof(set)) < 0)
+		ec_log_debug("setsockopt SO_KEEPALIVE %d: %s", soap->socket, strerror(errno));
+	if (setsockopt(soap->socket, IPPROTO_TCP, TCP_NODELAY, &set, sizeof(set)) < 0)
+		ec_log_debug("setsockopt TCP_NODELAY %d: %s", soap->socket, strerror(errno));
+}
+
 ECDispatcherSelect::ECDispatcherSelect(std::shared_ptr<ECConfig> lpConfig) :
 	ECDispatcher(std::move(lpConfig))
 {
@@ -621,51 +666,231 @@ ECDispatcherEPoll::ECDispatcherEPoll(std::shared_ptr<ECConfig> lpConfig) :
 	m_fdMax = getdtablesize();
 	if (m_fdMax < 0)
 		throw std::runtime_error("getrlimit failed");
-	m_epFD = epoll_create(m_fdMax);
-	if (m_epFD < 0)
-		throw std::runtime_error("epoll_create failed");
+	auto n = atoui(m_lpConfig->GetSetting("server_reactors"));
+	if (n == 0) {
+		auto cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? cpus : 1;
+	}
+	for (unsigned int i = 0; i < n; ++i) {
+		auto r = std::make_unique<reactor>();
+		r->id = i;
+		r->epfd = epoll_create(m_fdMax);
+		if (r->epfd < 0)
+			throw std::runtime_error("epoll_create failed");
+		if (i == 0) {
+			r->pool = &m_pool;
+		} else {
+			r->own_pool = std::make_unique<ksrv_tpool>("net" + std::to_string(i), 0);
+			r->pool = r->own_pool.get();
+		}
+		m_reactors.emplace_back(std::move(r));
+	}
+	if (n > 1)
+		m_pool.m_poolname = "net0";
 }
 
 ECDispatcherEPoll::~ECDispatcherEPoll()
 {
-	if (m_epFD >= 0)
-		close(m_epFD);
+	for (auto &r : m_reactors)
+		if (r->epfd >= 0)
+			close(r->epfd);
 }
 
-ECRESULT ECDispatcherEPoll::MainLoop()
+/*
+ * Split the configured thread counts over the worker groups. With a single
+ * reactor, this is exactly the old behavior.
+ */
+void ECDispatcherEPoll::set_thread_counts()
 {
-	ECRESULT er = erSuccess;
-	time_t now = 0, last = 0;
-	CONNECTION_TYPE ulType;
-	epoll_event epevent;
-	auto epevents = make_unique_nt<epoll_event[]>(m_fdMax);
-	int n;
+	unsigned int n = m_reactors.size();
+	auto spares = (atoui(m_lpConfig->GetSetting("threads")) + n - 1) / n;
+	auto tmax = (atoui(m_lpConfig->GetSetting("thread_limit")) + n - 1) / n;
+	for (auto &r : m_reactors)
+		r->pool->set_thread_count(spares, tmax);
+}
 
-	if (epevents == nullptr)
-		return MAPI_E_NOT_ENOUGH_MEMORY;
-	// setup epoll for listen sockets
-	memset(&epevent, 0, sizeof(epoll_event));
-	epevent.events = EPOLLIN | EPOLLPRI; // wait for input and priority (?) events
-	for (const auto &pair : m_setListenSockets) {
-		epevent.data.fd = pair.second->socket;
-		if (epoll_ctl(m_epFD, EPOLL_CTL_ADD, pair.second->socket, &epevent) != 0)
-			ec_log_err("epoll_ctl ADD %d: %s", epevent.data.fd, strerror(errno));
+ECRESULT ECDispatcherEPoll::DoHUP()
+{
+	auto er = ECDispatcher::DoHUP();
+	if (m_reactors.size() > 1)
+		set_thread_counts();
+	return er;
+}
+
+void ECDispatcherEPoll::GetThreadCount(unsigned int *lpulThreads, unsigned int *lpulIdleThreads)
+{
+	*lpulThreads = *lpulIdleThreads = 0;
+	for (auto &r : m_reactors) {
+		size_t a, i;
+		r->pool->thread_counts(&a, &i);
+		*lpulThreads += a;
+		*lpulIdleThreads += i;
 	}
+}
 
-	// This will start the threads
-	m_pool.set_thread_count(atoui(m_lpConfig->GetSetting("threads")), atoui(m_lpConfig->GetSetting("thread_limit")));
-	m_pool.enable_watchdog(true, m_lpConfig);
-	m_prio.set_thread_count(1);
+time_duration ECDispatcherEPoll::front_item_age()
+{
+	time_duration age(0);
+	for (auto &r : m_reactors)
+		age = std::max(age, r->pool->front_item_age());
+	return age;
+}
+
+size_t ECDispatcherEPoll::queue_length()
+{
+	size_t len = m_prio.queue_length();
+	for (auto &r : m_reactors)
+		len += r->pool->queue_length();
+	return len;
+}
+
+/*
+ * Requests normally run on the worker group of the reactor that owns the
+ * connection. If that group is already backlogged, the request is handed
+ * to the next group that has idle workers, so one busy reactor does not
+ * queue up while others sit idle.
+ */
+void ECDispatcherEPoll::enqueue(reactor &r, struct soap *soap, time_point sktime)
+{
+	++r.requests;
+	auto ulType = SOAP_CONNECTION_TYPE(soap);
+	if (ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY || m_reactors.size() == 1 ||
+	    r.pool->queue_length() == 0) {
+		QueueItem(soap, sktime, *r.pool);
+		return;
+	}
+	for (size_t k = 1; k < m_reactors.size(); ++k) {
+		auto &o = *m_reactors[(r.id + k) % m_reactors.size()];
+		size_t active, idle;
+		o.pool->thread_counts(&active, &idle);
+		if (idle > o.pool->queue_length()) {
+			++r.handoffs;
+			QueueItem(soap, sktime, *o.pool);
+			return;
+		}
+	}
+	QueueItem(soap, sktime, *r.pool);
+}
+
+void ECDispatcherEPoll::update_stats(reactor &r)
+{
+	auto &st = *g_lpSessionManager->m_stats;
+	auto pfx = "reactor" + std::to_string(r.id);
+	auto dsc = "Reactor " + std::to_string(r.id);
+	ulock_normal l_sock(r.mtx);
+	auto nsock = r.sockets.size();
+	l_sock.unlock();
+	st.setg(pfx + "_sockets", dsc + " idle connections", nsock);
+	st.setg(pfx + "_queuelen", dsc + " queue length", r.pool->queue_length());
+	st.setg_dbl(pfx + "_queueage", dsc + " age of the front queue item", dur2dbl(r.pool->front_item_age()));
+	st.set(pfx + "_accepts", dsc + " accepted connections", r.accepts.load());
+	st.set(pfx + "_requests", dsc + " requests dispatched", r.requests.load());
+	st.set(pfx + "_handoffs", dsc + " requests handed to another worker group", r.handoffs.load());
+}
+
+void ECDispatcherEPoll::accept_on(reactor &r, struct soap *listener, time_point sockev_time)
+{
+	ACTIVESOCKET sActive;
+	ulock_normal l_acc(m_mtxAccept, std::defer_lock);
+	if (m_reactors.size() > 1)
+		l_acc.lock();
+	auto newsoap = soap_copy(listener);
+	if (l_acc.owns_lock())
+		l_acc.unlock();
+	if (newsoap == nullptr) {
+		ec_log_crit("Unable to accept new connection: out of memory");
+		return;
+	}
+	kopano_new_soap_connection(SOAP_CONNECTION_TYPE(listener), newsoap);
+	// Record last activity (now)
+	time(&sActive.ulLastActivity);
+	auto ulType = SOAP_CONNECTION_TYPE(listener);
+	auto is_pipe = ulType == CONNECTION_TYPE_NAMED_PIPE || ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY;
+	if (is_pipe || m_reactors.size() > 1) {
+		/*
+		 * soap_accept retries by itself on EAGAIN, so a reactor that
+		 * lost the race for a connection would spin in there until
+		 * the next one comes in.
+		 */
+		socklen_t socklen = sizeof(newsoap->peer.storage);
+		newsoap->socket = accept4(newsoap->master, &newsoap->peer.addr, &socklen,
+		                  is_pipe ? 0 : SOCK_NONBLOCK | SOCK_CLOEXEC);
+		newsoap->peerlen = socklen;
+		if (newsoap->socket == SOAP_INVALID_SOCKET)
+			newsoap->errnum = errno;
+		if (newsoap->socket == SOAP_INVALID_SOCKET ||
+		    socklen > sizeof(newsoap->peer.storage)) {
+			newsoap->peerlen = 0;
+			memset(&newsoap->peer, 0, sizeof(newsoap->peer));
+		}
+		/* Do like gsoap's soap_accept would */
+		newsoap->keep_alive = -(((newsoap->imode | newsoap->omode) & SOAP_IO_KEEPALIVE) != 0);
+		if (newsoap->socket != SOAP_INVALID_SOCKET && !is_pipe)
+			set_tcp_peer(newsoap);
+	} else {
+		soap_accept(newsoap);
+	}
+
+	if (newsoap->socket == SOAP_INVALID_SOCKET) {
+		/* Another reactor was woken for the same connection and won. */
+		if (newsoap->errnum == EAGAIN || newsoap->errnum == EWOULDBLOCK)
+			;
+		else if (ulType == CONNECTION_TYPE_NAMED_PIPE)
+			ec_log_debug("epaccept(%d) on file://%s: %s", newsoap->master, m_lpConfig->GetSetting("server_pipe_name"), *soap_faultstring(newsoap));
+		else if (ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY)
+			ec_log_debug("epaccept(%d) on file://%s: %s", newsoap->master, m_lpConfig->GetSetting("server_pipe_priority"), *soap_faultstring(newsoap));
+		else
+			ec_log_debug("epaccept(%d): %s", newsoap->master, *soap_faultstring(newsoap));
+		kopano_end_soap_connection(newsoap);
+		soap_free(newsoap);
+		return;
+	}
+	update_host(ulType, newsoap);
+	if (ulType == CONNECTION_TYPE_NAMED_PIPE)
+		ec_log_debug("connect on %s from %s", m_lpConfig->GetSetting("server_pipe_name"), newsoap->host);
+	else if (ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY)
+		ec_log_debug("connect on %s from %s", m_lpConfig->GetSetting("server_pipe_priority"), newsoap->host);
+	else
+		ec_log_debug("%sconnect from %s",
+			ulType == CONNECTION_TYPE_SSL ? "SSL " : "",
+			newsoap->host);
+	newsoap->socket = ec_relocate_fd(newsoap->socket);
+	g_lpSessionManager->m_stats->Max(SCN_MAX_SOCKET_NUMBER, static_cast<LONGLONG>(newsoap->socket));
+	g_lpSessionManager->m_stats->inc(SCN_SERVER_CONNECTIONS);
+	++r.accepts;
+	// directly make worker thread active
+	sActive.soap = newsoap;
+	auto &dst = owner(newsoap->socket);
+	ulock_normal l_sock(dst.mtx);
+	dst.sockets.emplace(sActive.soap->socket, sActive);
+	l_sock.unlock();
+	epoll_event eev{};
+	eev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT;
+	eev.data.fd = newsoap->socket;
+	if (epoll_ctl(dst.epfd, EPOLL_CTL_ADD, newsoap->socket, &eev) != 0)
+		ec_log_err("epoll_ctl ADD %d: %s", newsoap->socket, strerror(errno));
+}
+
+void ECDispatcherEPoll::run_reactor(reactor &r, bool main_thread)
+{
+	time_t now = 0, last = 0;
+	CONNECTION_TYPE ulType;
+	auto nev = std::max(1, m_fdMax / static_cast<int>(m_reactors.size()));
+	auto epevents = make_unique_nt<epoll_event[]>(nev);
 
+	if (epevents == nullptr) {
+		ec_log_crit("Reactor %u: out of memory", r.id);
+		return;
+	}
 	while (!m_bExit) {
-		if (sv_sighup_flag)
+		if (main_thread && sv_sighup_flag)
 			sv_sighup_sync();
 		time(&now);
 
 		// find timedout sockets once per second
-		ulock_normal l_sock(m_mutexSockets);
 		if(now > last) {
-			for (const auto &pair : m_setSockets) {
+			ulock_normal l_sock(r.mtx);
+			for (const auto &pair : r.sockets) {
 				ulType = SOAP_CONNECTION_TYPE(pair.second.soap);
 				if (ulType != CONNECTION_TYPE_NAMED_PIPE &&
 				    ulType != CONNECTION_TYPE_NAMED_PIPE_PRIORITY &&
@@ -673,102 +898,150 @@ ECRESULT ECDispatcherEPoll::MainLoop()
 					// Socket has been inactive for more than server_recv_timeout seconds, close the socket
 					shutdown(pair.second.soap->socket, SHUT_RDWR);
             }
+			l_sock.unlock();
+			update_stats(r);
             last = now;
         }
-		l_sock.unlock();
 
-		n = epoll_wait(m_epFD, epevents.get(), m_fdMax, 1000); // timeout -1 is wait indefinitely
+		auto n = epoll_wait(r.epfd, epevents.get(), nev, 1000); // timeout -1 is wait indefinitely
 		auto sockev_time = time_point::clock::now();
-		l_sock.lock();
 		for (int i = 0; i < n; ++i) {
 			auto iterListenSockets = m_setListenSockets.find(epevents[i].data.fd);
-
-			if (iterListenSockets == m_setListenSockets.end()) {
-				// this is a new request from an existing client
-				auto iterSockets = m_setSockets.find(epevents[i].data.fd);
-				if (iterSockets == m_setSockets.cend())
-					continue;
-				// remove from epfd, either close socket, or it will be reactivated later in the epfd
-				epevent.data.fd = iterSockets->second.soap->socket;
-
-				if (epevents[i].events & EPOLLHUP) {
-					kopano_end_soap_connection(iterSockets->second.soap);
-					soap_free(iterSockets->second.soap);
-					m_setSockets.erase(iterSockets);
-					continue;
-				}
-				QueueItem(iterSockets->second.soap, sockev_time);
-				// Remove socket from listen list for now, since we're already handling data there and don't
-				// want to interfere with the thread that is now handling that socket. It will be passed back
-				// to us when the request is done.
-				m_setSockets.erase(iterSockets);
+			if (iterListenSockets != m_setListenSockets.end()) {
+				// this was a listen socket .. accept and continue
+				accept_on(r, iterListenSockets->second.get(), sockev_time);
 				continue;
 			}
 
-			// this was a listen socket .. accept and continue
-			ACTIVESOCKET sActive;
-			auto newsoap = soap_copy(iterListenSockets->second.get());
-			kopano_new_soap_connection(SOAP_CONNECTION_TYPE(iterListenSockets->second), newsoap);
-			// Record last activity (now)
-			time(&sActive.ulLastActivity);
-			ulType = SOAP_CONNECTION_TYPE(iterListenSockets->second);
-			if (ulType == CONNECTION_TYPE_NAMED_PIPE || ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY) {
-				newsoap->socket = accept(newsoap->master, NULL, 0);
-				/* Do like gsoap's soap_accept would */
-				newsoap->keep_alive = -(((newsoap->imode | newsoap->omode) & SOAP_IO_KEEPALIVE) != 0);
-			} else {
-				soap_accept(newsoap);
+			// this is a new request from an existing client
+			ulock_normal l_sock(r.mtx);
+			auto iterSockets = r.sockets.find(epevents[i].data.fd);
+			if (iterSockets == r.sockets.cend())
+				continue;
+			auto soap = iterSockets->second.soap;
+			// Remove socket from listen list for now, since we're already handling data there and don't
+			// want to interfere with the thread that is now handling that socket. It will be passed back
+			// to us when the request is done. On hangup, the socket is closed instead.
+			r.sockets.erase(iterSockets);
+			l_sock.unlock();
+			if (epevents[i].events & EPOLLHUP) {
+				kopano_end_soap_connection(soap);
+				soap_free(soap);
+				continue;
 			}
+			enqueue(r, soap, sockev_time);
+		}
+	}
+}
 
-			if (newsoap->socket == SOAP_INVALID_SOCKET) {
-				if (ulType == CONNECTION_TYPE_NAMED_PIPE)
-					ec_log_debug("epaccept(%d) on file://%s: %s", newsoap->master, m_lpConfig->GetSetting("server_pipe_name"), *soap_faultstring(newsoap));
-				else if (ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY)
-					ec_log_debug("epaccept(%d) on file://%s: %s", newsoap->master, m_lpConfig->GetSetting("server_pipe_priority"), *soap_faultstring(newsoap));
-				else
-					ec_log_debug("epaccept(%d): %s", newsoap->master, *soap_faultstring(newsoap));
-				kopano_end_soap_connection(newsoap);
-				soap_free(newsoap);
-				continue;
+void *ECDispatcherEPoll::reactor_thread(void *arg)
+{
+	auto pair = static_cast<std::pair<ECDispatcherEPoll *, reactor *> *>(arg);
+	auto self = pair->first;
+	auto &r = *pair->second;
+	delete pair;
+	kcsrv_blocksigs();
+	auto cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(r.id % cpus, &set);
+		auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err != 0)
+			ec_log_warn("Reactor %u: could not bind to CPU %ld: %s", r.id, r.id % cpus, strerror(err));
+	}
+	self->run_reactor(r, false);
+	return nullptr;
+}
+
+ECRESULT ECDispatcherEPoll::MainLoop()
+{
+	ECRESULT er = erSuccess;
+	epoll_event epevent;
+
+	// setup epoll for listen sockets
+	memset(&epevent, 0, sizeof(epoll_event));
+	epevent.events = EPOLLIN | EPOLLPRI; // wait for input and priority (?) events
+	if (m_reactors.size() > 1) {
+#ifdef EPOLLEXCLUSIVE
+		epevent.events |= EPOLLEXCLUSIVE;
+#endif
+		/* A reactor that loses the race for a connection must not block in accept. */
+		for (const auto &pair : m_setListenSockets) {
+			auto fl = fcntl(pair.first, F_GETFL);
+			if (fl < 0 || fcntl(pair.first, F_SETFL, fl | O_NONBLOCK) < 0)
+				ec_log_warn("Unable to make listen socket %d non-blocking: %s", pair.first, strerror(errno));
+		}
+	}
+	for (auto &r : m_reactors) {
+		for (const auto &pair : m_setListenSockets) {
+			epevent.data.fd = pair.second->socket;
+			if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, pair.second->socket, &epevent) != 0)
+				ec_log_err("epoll_ctl ADD %d: %s", epevent.data.fd, strerror(errno));
+		}
+	}
+
+	// This will start the threads
+	set_thread_counts();
+	for (auto &r : m_reactors)
+		r->pool->enable_watchdog(true, m_lpConfig);
+	m_prio.set_thread_count(1);
+
+	if (m_reactors.size() == 1) {
+		run_reactor(*m_reactors[0], true);
+	} else {
+		ec_log_info("Using %zu epoll reactors", m_reactors.size());
+		for (auto &r : m_reactors) {
+			auto arg = new std::pair<ECDispatcherEPoll *, reactor *>(this, r.get());
+			auto err = pthread_create(&r->thread, nullptr, reactor_thread, arg);
+			if (err != 0) {
+				delete arg;
+				ec_log_crit("Could not create reactor thread: %s", strerror(err));
+				m_bExit = true;
+				er = KCERR_CALL_FAILED;
+				break;
 			}
-			update_host(ulType, newsoap);
-			if (ulType == CONNECTION_TYPE_NAMED_PIPE)
-				ec_log_debug("connect on %s from %s", m_lpConfig->GetSetting("server_pipe_name"), newsoap->host);
-			else if (ulType == CONNECTION_TYPE_NAMED_PIPE_PRIORITY)
-				ec_log_debug("connect on %s from %s", m_lpConfig->GetSetting("server_pipe_priority"), newsoap->host);
-			else
-				ec_log_debug("%sconnect from %s",
-					ulType == CONNECTION_TYPE_SSL ? "SSL " : "",
-					newsoap->host);
-			newsoap->socket = ec_relocate_fd(newsoap->socket);
-			g_lpSessionManager->m_stats->Max(SCN_MAX_SOCKET_NUMBER, static_cast<LONGLONG>(newsoap->socket));
-			g_lpSessionManager->m_stats->inc(SCN_SERVER_CONNECTIONS);
-			// directly make worker thread active
-			sActive.soap = newsoap;
-			m_setSockets.emplace(sActive.soap->socket, sActive);
-			epoll_event eev{};
-			eev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT;
-			eev.data.fd = newsoap->socket;
-			if (epoll_ctl(m_epFD, EPOLL_CTL_ADD, newsoap->socket, &eev) != 0)
-				ec_log_err("epoll_ctl ADD %d: %s", newsoap->socket, strerror(errno));
+			r->thread_active = true;
+			set_thread_name(r->thread, ("reactor/" + std::to_string(r->id)).c_str());
 		}
-		l_sock.unlock();
+		while (!m_bExit) {
+			if (sv_sighup_flag)
+				sv_sighup_sync();
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+		for (auto &r : m_reactors)
+			if (r->thread_active)
+				pthread_join(r->thread, nullptr);
 	}
 
-	m_pool.set_thread_count(0, 0, true);
+	for (auto &r : m_reactors)
+		r->pool->set_thread_count(0, 0, true);
 	m_prio.set_thread_count(0, 0, true);
 
     // Close all sockets. This will cause all that we were listening on clients to get an EOF
-	ulock_normal l_sock(m_mutexSockets);
-	for (auto &pair : m_setSockets) {
-		kopano_end_soap_connection(pair.second.soap);
-		soap_free(pair.second.soap);
-    }
-	m_setSockets.clear();
-	l_sock.unlock();
+	for (auto &r : m_reactors) {
+		ulock_normal l_sock(r->mtx);
+		for (auto &pair : r->sockets) {
+			kopano_end_soap_connection(pair.second.soap);
+			soap_free(pair.second.soap);
+		}
+		r->sockets.clear();
+	}
 	return er;
 }
 
+void ECDispatcherEPoll::Requeue(struct soap *soap)
+{
+	ACTIVESOCKET sActive;
+	sActive.soap = soap;
+	time(&sActive.ulLastActivity);
+	auto &r = owner(soap->socket);
+	ulock_normal l_sock(r.mtx);
+	r.sockets.emplace(soap->socket, sActive);
+	l_sock.unlock();
+	NotifyRestart(soap->socket);
+}
+
 void ECDispatcherEPoll::NotifyRestart(SOAP_SOCKET s)
 {
 	// add soap socket in epoll fd
@@ -776,7 +1049,7 @@ void ECDispatcherEPoll::NotifyRestart(SOAP_SOCKET s)
 	memset(&epevent, 0, sizeof(epoll_event));
 	epevent.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT;
 	epevent.data.fd = s;
-	if (epoll_ctl(m_epFD, EPOLL_CTL_MOD, s, &epevent) != 0)
+	if (epoll_ctl(owner(s).epfd, EPOLL_CTL_MOD, s, &epevent) != 0)
 		ec_log_err("epoll_ctl MOD %d: %s", s, strerror(errno));
 }
 #endif
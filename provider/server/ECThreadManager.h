@@ -10,6 +10,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <vector>
 #include <pthread.h>
 #include <kopano/ECConfig.h>
 #include <kopano/kcodes.h>
@@ -56,15 +57,15 @@ public:
 	ECDispatcher(std::shared_ptr<KC::ECConfig>);
 	virtual ~ECDispatcher();
 
-	void GetThreadCount(unsigned int *total, unsigned int *idle);
-	KC::time_duration front_item_age();
-	size_t queue_length();
+	virtual void GetThreadCount(unsigned int *total, unsigned int *idle);
+	virtual KC::time_duration front_item_age();
+	virtual size_t queue_length();
 	void AddListenSocket(std::unique_ptr<struct soap, KC::ec_soap_deleter> &&);
 	void QueueItem(struct soap *, KC::time_point);
 	int maxlistenfds() const;
 
     // Reload variables from config
-    ECRESULT DoHUP();
+	virtual ECRESULT DoHUP();
 
     // Called asynchronously during MainLoop() to shutdown the server
 	void ShutDown();
@@ -79,6 +80,10 @@ public:
     virtual ECRESULT MainLoop() = 0;
 
 protected:
+	void QueueItem(struct soap *, KC::time_point, KC::ksrv_tpool &);
+	// Put a socket whose request is done back under watch
+	virtual void Requeue(struct soap *);
+
 	std::shared_ptr<KC::ECConfig> m_lpConfig;
 	KC::ksrv_tpool m_pool{"net", 0}, m_prio{"prio", 0};
 	std::map<int, ACTIVESOCKET> m_setSockets;
@@ -101,15 +106,51 @@ public:
 };
 
 #ifdef HAVE_EPOLL_CREATE
+/*
+ * With server_reactors > 1, the epoll dispatcher runs that many event loops,
+ * each on a thread pinned to one CPU, with its own epoll set, connection list
+ * and worker pool. All loops wait on the listening sockets (with
+ * EPOLLEXCLUSIVE), so that the kernel hands each new connection to just one
+ * of them. A connection is then owned by reactor (fd % n) for its lifetime.
+ */
 class ECDispatcherEPoll final : public ECDispatcher {
 private:
-	int m_fdMax, m_epFD;
+	struct reactor {
+		unsigned int id = 0;
+		int epfd = -1;
+		KC::ksrv_tpool *pool = nullptr;
+		std::unique_ptr<KC::ksrv_tpool> own_pool;
+		std::mutex mtx; /* protects sockets */
+		std::map<int, ACTIVESOCKET> sockets;
+		pthread_t thread;
+		bool thread_active = false;
+		std::atomic<uint64_t> accepts{0}, requests{0}, handoffs{0};
+	};
+
+	int m_fdMax;
+	std::vector<std::unique_ptr<reactor>> m_reactors;
+	std::mutex m_mtxAccept;
+
+	reactor &owner(int fd) { return *m_reactors[fd % m_reactors.size()]; }
+	void run_reactor(reactor &, bool main_thread);
+	void accept_on(reactor &, struct soap *listener, KC::time_point);
+	void enqueue(reactor &, struct soap *, KC::time_point);
+	void set_thread_counts();
+	void update_stats(reactor &);
+	static void *reactor_thread(void *);
+
+protected:
+	virtual void Requeue(struct soap *) override;
 
 public:
 	ECDispatcherEPoll(std::shared_ptr<KC::ECConfig>);
     virtual ~ECDispatcherEPoll();
 	virtual ECRESULT MainLoop() override;
 	virtual void NotifyRestart(SOAP_SOCKET) override;
+	virtual ECRESULT DoHUP() override;
+	virtual void GetThreadCount(unsigned int *total, unsigned int *idle) override;
+	virtual KC::time_duration front_item_age() override;
+	virtual size_t queue_length() override;
 };
 #endif
 
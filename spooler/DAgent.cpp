@@ -1570,18 +1570,13 @@ static HRESULT recip_me_check(IAddrBook *ab, IMAPITable *tbl,
 }
 
 /**
- * Replace To recipient data in message with new recipient
- *
- * @param[in] lpMessage delivery message to set new recipient data in
- * @param[in] lpRecip new recipient to deliver same message for
- *
- * @return MAPI Error code
+ * Determine PR_MESSAGE_RECIP_ME, PR_MESSAGE_TO_ME, PR_MESSAGE_CC_ME and
+ * PR_EC_MESSAGE_BCC_ME of @lpRecip for @lpMessage into @sPropRecip[4].
  */
-static HRESULT HrOverrideRecipProps(IAddrBook *ab,
-    IMessage *lpMessage, ECRecipient *lpRecip)
+static HRESULT HrGetRecipProps(IAddrBook *ab, IMessage *lpMessage,
+    ECRecipient *lpRecip, SPropValue *sPropRecip)
 {
 	object_ptr<IMAPITable> lpRecipTable;
-	SPropValue sPropRecip[4];
 	bool bToMe = false, bCcMe = false, distgrp = false;
 
 	auto hr = lpMessage->GetRecipientTable (0, &~lpRecipTable);
@@ -1598,6 +1593,24 @@ static HRESULT HrOverrideRecipProps(IAddrBook *ab,
 	sPropRecip[3].Value.b = !bToMe && !bCcMe && !distgrp;
 	sPropRecip[0].ulPropTag = PR_MESSAGE_RECIP_ME;
 	sPropRecip[0].Value.b = bToMe || bCcMe || sPropRecip[3].Value.b;
+	return hrSuccess;
+}
+
+/**
+ * Replace To recipient data in message with new recipient
+ *
+ * @param[in] lpMessage delivery message to set new recipient data in
+ * @param[in] lpRecip new recipient to deliver same message for
+ *
+ * @return MAPI Error code
+ */
+static HRESULT HrOverrideRecipProps(IAddrBook *ab,
+    IMessage *lpMessage, ECRecipient *lpRecip)
+{
+	SPropValue sPropRecip[4];
+	auto hr = HrGetRecipProps(ab, lpMessage, lpRecip, sPropRecip);
+	if (hr != hrSuccess)
+		return hr;
 	hr = lpMessage->SetProps(4, sPropRecip, NULL);
 	if (hr != hrSuccess)
 		return kc_perror("SetProps failed", hr);
@@ -1672,18 +1685,10 @@ static HRESULT HrOverrideFallbackProps(IMessage *lpMessage, ECRecipient *r)
 }
 
 /**
- * Set new To recipient data in message
- *
- * @param[in] lpMessage message to update recipient data in
- * @param[in] lpRecip recipient data to use
- *
- * @return MAPI error code
+ * Fill @p[5] with the PR_RECEIVED_BY_* properties of @lpRecip
  */
-static HRESULT HrOverrideReceivedByProps(IMessage *lpMessage,
-    ECRecipient *lpRecip)
+static void received_by_props(ECRecipient *lpRecip, SPropValue *p)
 {
-	SPropValue p[5];
-
 	p[0].ulPropTag   = PR_RECEIVED_BY_ADDRTYPE_A;
 	p[0].Value.lpszA = const_cast<char *>(lpRecip->strAddrType.c_str());
 	p[1].ulPropTag   = PR_RECEIVED_BY_EMAIL_ADDRESS_W;
@@ -1694,6 +1699,22 @@ static HRESULT HrOverrideReceivedByProps(IMessage *lpMessage,
 	p[3].Value.lpszW = const_cast<wchar_t *>(lpRecip->wstrFullname.c_str());
 	p[4].ulPropTag   = PR_RECEIVED_BY_SEARCH_KEY;
 	p[4].Value.bin   = lpRecip->sSearchKey;
+}
+
+/**
+ * Set new To recipient data in message
+ *
+ * @param[in] lpMessage message to update recipient data in
+ * @param[in] lpRecip recipient data to use
+ *
+ * @return MAPI error code
+ */
+static HRESULT HrOverrideReceivedByProps(IMessage *lpMessage,
+    ECRecipient *lpRecip)
+{
+	SPropValue p[5];
+
+	received_by_props(lpRecip, p);
 	auto hr = lpMessage->SetProps(ARRAY_SIZE(p), p, nullptr);
 	if (hr != hrSuccess)
 		return kc_perror("Unable to set RECEIVED_BY properties", hr);
@@ -1790,6 +1811,121 @@ static HRESULT HrCopyMessageForDelivery(IMessage *lpOrigMessage,
 	return hrSuccess;
 }
 
+/* A message the server has already copied for one recipient */
+struct delivery_copy {
+	object_ptr<IMsgStore> store;
+	object_ptr<IMAPIFolder> inbox, folder;
+	object_ptr<IMessage> message;
+};
+
+/* Further recipients on one server, served from the first converted message */
+struct delivery_fanout {
+	recipients_t::const_iterator begin, end;
+	std::map<ECRecipient *, delivery_copy> copies;
+	bool done = false;
+};
+
+/**
+ * Have the server copy the saved message @lpTemplate for every recipient of
+ * @fo in one call. The recipient-specific properties are set by the server,
+ * so body and attachments are not uploaded again for each mailbox; the
+ * attachments of all copies share their single-instance data.
+ *
+ * Recipients that did not get a copy are absent from @fo.copies and take the
+ * normal delivery path.
+ *
+ * @param[in] lpSession admin MAPI session
+ * @param[in] lpStore admin store on the server of the recipients
+ * @param[in] lpTemplate saved message to copy, pristine from conversion
+ * @param[in,out] fo recipients to copy for, and the copies made
+ *
+ * @return MAPI Error code
+ */
+static HRESULT HrDeliverCopies(IMAPISession *lpSession, IMsgStore *lpStore,
+    IAddrBook *lpAdrBook, IMessage *lpTemplate, DeliveryArgs *lpArgs,
+    delivery_fanout &fo)
+{
+	static constexpr SizedSPropTagArray(4, sptaIMAP) =
+		{4, {PR_EC_IMAP_EMAIL_SIZE, PR_EC_IMAP_EMAIL, PR_EC_IMAP_BODY, PR_EC_IMAP_BODYSTRUCTURE}};
+	object_ptr<IECSpooler> lpSpooler;
+	memory_ptr<SPropValue> lpTemplateId;
+	memory_ptr<ECDELIVERCOPY> lpCopies;
+	std::vector<std::pair<ECRecipient *, delivery_copy>> targets;
+	std::vector<memory_ptr<SPropValue>> folder_ids;
+	auto count = std::distance(fo.begin, fo.end);
+
+	if (count == 0)
+		return hrSuccess;
+	auto hr = lpStore->QueryInterface(IID_IECSpooler, &~lpSpooler);
+	if (hr != hrSuccess)
+		return kc_perrorf("QueryInterface:spooler failed", hr);
+	hr = HrGetOneProp(lpTemplate, PR_ENTRYID, &~lpTemplateId);
+	if (hr != hrSuccess)
+		return kc_perrorf("HrGetOneProp failed", hr);
+	hr = MAPIAllocateBuffer(sizeof(ECDELIVERCOPY) * count, &~lpCopies);
+	if (hr != hrSuccess)
+		return kc_perrorf("MAPIAllocateBuffer failed", hr);
+
+	for (auto iter = fo.begin; iter != fo.end; ++iter) {
+		auto recip = *iter;
+		delivery_copy dc;
+		memory_ptr<SPropValue> lpFolderId;
+
+		hr = HrGetDeliveryStoreAndFolder(lpSession, lpStore, recip,
+		     lpArgs, &~dc.store, &~dc.inbox, &~dc.folder);
+		if (hr == hrSuccess)
+			hr = HrGetOneProp(dc.folder, PR_ENTRYID, &~lpFolderId);
+		if (hr != hrSuccess) {
+			hr_lwarn(hr, "No server-side copy for \"%ls\"", recip->wstrUsername.c_str());
+			continue;
+		}
+		auto &c = lpCopies[targets.size()];
+		memset(&c, 0, sizeof(c));
+		c.sFolderId = lpFolderId->Value.bin;
+		c.cValues = 9;
+		hr = MAPIAllocateMore(sizeof(SPropValue) * c.cValues, lpCopies, reinterpret_cast<void **>(&c.lpProps));
+		if (hr != hrSuccess)
+			return kc_perrorf("MAPIAllocateMore failed", hr);
+		hr = HrGetRecipProps(lpAdrBook, lpTemplate, recip, c.lpProps);
+		if (hr != hrSuccess)
+			return hr;
+		received_by_props(recip, c.lpProps + 4);
+		/* make sure the imap data is not set for this user */
+		if (!recip->bHasIMAP)
+			c.lpDelProps = sptaIMAP;
+		folder_ids.emplace_back(std::move(lpFolderId));
+		targets.emplace_back(recip, std::move(dc));
+	}
+	if (targets.empty())
+		return hrSuccess;
+	hr = lpSpooler->DeliverCopies(lpTemplateId->Value.bin.cb,
+	     reinterpret_cast<ENTRYID *>(lpTemplateId->Value.bin.lpb),
+	     targets.size(), lpCopies);
+	if (hr != hrSuccess)
+		return kc_perror("Server-side delivery copies failed", hr);
+
+	for (size_t i = 0; i < targets.size(); ++i) {
+		const auto &c = lpCopies[i];
+		auto &dc = targets[i].second;
+		if (c.hResult != hrSuccess) {
+			hr_lwarn(c.hResult, "No server-side copy for \"%ls\"", targets[i].first->wstrUsername.c_str());
+			continue;
+		}
+		hr = dc.store->OpenEntry(c.sEntryId.cb, reinterpret_cast<ENTRYID *>(c.sEntryId.lpb),
+		     &iid_of(dc.message), MAPI_MODIFY, nullptr, &~dc.message);
+		if (hr != hrSuccess) {
+			/* Unreachable for us, so remove it before delivering normally */
+			ENTRYLIST sEntryList = {1, const_cast<SBinary *>(&c.sEntryId)};
+			hr_lwarn(hr, "Unable to open server-side copy for \"%ls\"", targets[i].first->wstrUsername.c_str());
+			dc.folder->DeleteMessages(&sEntryList, 0, nullptr, DELETE_HARD_DELETE);
+			continue;
+		}
+		fo.copies.emplace(targets[i].first, std::move(dc));
+	}
+	ec_log_debug("Server made %zu of %zu delivery copies", fo.copies.size(), targets.size());
+	return hrSuccess;
+}
+
 /**
  * Make a new MAPI session under a specific username
  *
@@ -1982,6 +2118,9 @@ static HRESULT FindSpamMarker(const std::string &strMail,
  * @param[in] lpArgs delivery options
  * @param[out] lppMessage the newly delivered message
  * @param[out] lpbFallbackDelivery newly delivered message is a fallback message
+ * @param[in,out] lpFanout further recipients to have the server copy the
+ * 	converted message for, may be NULL
+ * @param[in] lpCopy server-side copy to deliver instead of converting, may be NULL
  *
  * @return MAPI Error code
  */
@@ -1989,7 +2128,8 @@ static HRESULT ProcessDeliveryToRecipient(pym_plugin_intf *lppyMapiPlugin,
     IMAPISession *lpSession, IMsgStore *lpStore, bool bIsAdmin,
     LPADRBOOK lpAdrBook, IMessage *lpOrigMessage, bool bFallbackDelivery,
     const std::string &strMail, ECRecipient *lpRecip, DeliveryArgs *lpArgs,
-    IMessage **lppMessage, bool *lpbFallbackDelivery)
+    IMessage **lppMessage, bool *lpbFallbackDelivery,
+    delivery_fanout *lpFanout, delivery_copy *lpCopy)
 {
 	object_ptr<IMsgStore> lpTargetStore;
 	object_ptr<IMAPIFolder> lpTargetFolder, lpFolder, lpInbox;
@@ -1998,8 +2138,16 @@ static HRESULT ProcessDeliveryToRecipient(pym_plugin_intf *lppyMapiPlugin,
 	ULONG ulResult = 0;
 	object_ptr<IECServiceAdmin> lpServiceAdmin;
 	memory_ptr<ECQUOTASTATUS> lpsQuotaStatus;
-	bool over_quota = false;
+	bool over_quota = false, bPresaved = false, bSaved = false;
 	auto dblStart = std::chrono::steady_clock::now();
+	/*
+	 * A message that is already on the server must not stay there
+	 * wherever the normal flow would have discarded the unsaved one.
+	 */
+	auto discard = make_scope_exit([&]() {
+		if (bPresaved && !bSaved)
+			Util::HrDeleteMessage(lpSession, lpDeliveryMessage);
+	});
 
 	// single user deliver did not lookup the user
 	if (lpRecip->strSMTP.empty()) {
@@ -2011,12 +2159,23 @@ static HRESULT ProcessDeliveryToRecipient(pym_plugin_intf *lppyMapiPlugin,
 			return kc_perrorf("ResolveUser failed", hr);
 	}
 
-	auto hr = HrGetDeliveryStoreAndFolder(lpSession, lpStore, lpRecip,
-	          lpArgs, &~lpTargetStore, &~lpInbox, &~lpTargetFolder);
-	if (hr != hrSuccess)
-		return kc_perrorf("HrGetDeliveryStoreAndFolder failed", hr);
+	HRESULT hr = hrSuccess;
+	if (lpCopy != nullptr) {
+		lpTargetStore  = lpCopy->store;
+		lpInbox        = lpCopy->inbox;
+		lpTargetFolder = lpCopy->folder;
+	} else {
+		hr = HrGetDeliveryStoreAndFolder(lpSession, lpStore, lpRecip,
+		     lpArgs, &~lpTargetStore, &~lpInbox, &~lpTargetFolder);
+		if (hr != hrSuccess)
+			return kc_perrorf("HrGetDeliveryStoreAndFolder failed", hr);
+	}
 
-	if (!lpOrigMessage) {
+	if (lpCopy != nullptr) {
+		/* Made by HrDeliverCopies() */
+		lpDeliveryMessage = lpCopy->message;
+		bPresaved = true;
+	} else if (!lpOrigMessage) {
 		/* No message was provided, we have to construct it personally */
 		bool bExpired = false;
 
@@ -2048,18 +2207,34 @@ static HRESULT ProcessDeliveryToRecipient(pym_plugin_intf *lppyMapiPlugin,
 			return kc_perrorf("HrCopyMessageForDelivery failed", hr);
 	}
 
-	hr = HrOverrideRecipProps(lpAdrBook, lpDeliveryMessage, lpRecip);
-	if (hr != hrSuccess)
-		return kc_perrorf("HrOverrideRecipProps failed", hr);
+	/* A server-side copy already has the recipient properties */
+	if (lpCopy == nullptr) {
+		hr = HrOverrideRecipProps(lpAdrBook, lpDeliveryMessage, lpRecip);
+		if (hr != hrSuccess)
+			return kc_perrorf("HrOverrideRecipProps failed", hr);
+		if (bFallbackDelivery)
+			hr = HrOverrideFallbackProps(lpDeliveryMessage, lpRecip);
+		else
+			hr = HrOverrideReceivedByProps(lpDeliveryMessage, lpRecip);
+		if (hr != hrSuccess)
+			return kc_perrorf("Overriding recipient properties failed", hr);
+	}
 
-	if (bFallbackDelivery) {
-		hr = HrOverrideFallbackProps(lpDeliveryMessage, lpRecip);
+	if (lpFanout != nullptr && !lpFanout->done && lpOrigMessage == nullptr &&
+	    !bFallbackDelivery) {
+		/*
+		 * Save the freshly converted message before plugins and rules
+		 * touch it, and let the server copy it for the other recipients.
+		 */
+		hr = lpDeliveryMessage->SaveChanges(KEEP_OPEN_READWRITE);
 		if (hr != hrSuccess)
-			return kc_perrorf("HrOverrideFallbackProps failed", hr);
-	} else {
-		hr = HrOverrideReceivedByProps(lpDeliveryMessage, lpRecip);
+			return kc_perror("Unable to save message for server-side copies", hr);
+		bPresaved = true;
+		lpFanout->done = true;
+		hr = HrDeliverCopies(lpSession, lpStore, lpAdrBook, lpDeliveryMessage, lpArgs, *lpFanout);
 		if (hr != hrSuccess)
-			return kc_perrorf("HrOverrideReceivedByProps failed", hr);
+			kc_pwarn("Delivering the other recipients without server-side copies", hr);
+		hr = hrSuccess;
 	}
 
 	hr = lppyMapiPlugin->MessageProcessing("PreDelivery", lpSession, lpAdrBook, lpTargetStore, lpTargetFolder, lpDeliveryMessage, &ulResult);
@@ -2097,6 +2272,8 @@ static HRESULT ProcessDeliveryToRecipient(pym_plugin_intf *lppyMapiPlugin,
 			// ignore other errors for rules, still want to save the delivered message
 			// Save message changes, message becomes visible for the user
 			hr = lpDeliveryMessage->SaveChanges(KEEP_OPEN_READWRITE);
+		if (hr == hrSuccess)
+			bSaved = true;
 
 		if (hr != hrSuccess) {
 			if (hr == MAPI_E_STORE_FULL)
@@ -2237,9 +2414,32 @@ static HRESULT ProcessDeliveryToServer(pym_plugin_intf *lppyMapiPlugin,
 		return kc_perror("Unable to open default store for system account", hr);
 	}
 
+	/*
+	 * In LMTP mode, the first converted message is copied by the server
+	 * for all other recipients instead of uploading it for every one.
+	 */
+	delivery_fanout fanout;
+	bool bFanout = lpUserSession == nullptr && lpOrigMessage == nullptr &&
+	               listRecipients.size() > 1 &&
+	               parseBool(g_lpConfig->GetSetting("server_side_copies"));
+	auto drop_copies = make_scope_exit([&]() {
+		/* left over when delivery was cut short */
+		for (const auto &c : fanout.copies)
+			Util::HrDeleteMessage(lpSession, c.second.message);
+	});
+
 	for (auto iter = listRecipients.cbegin(); iter != listRecipients.end(); ++iter) {
 		const auto &recip = *iter;
 		object_ptr<IMessage> lpMessageTmp;
+		delivery_copy *lpCopy = nullptr;
+
+		if (bFanout && !fanout.done) {
+			fanout.begin = std::next(iter);
+			fanout.end   = listRecipients.cend();
+		}
+		auto copy_iter = fanout.copies.find(recip);
+		if (copy_iter != fanout.copies.end())
+			lpCopy = &copy_iter->second;
 		/*
 		 * Normal error codes must be ignored, since we want to attempt to deliver the email to all users,
 		 * however when the error code MAPI_W_CANCEL_MESSAGE was provided, the message has expired and it is
@@ -2249,7 +2449,11 @@ static HRESULT ProcessDeliveryToServer(pym_plugin_intf *lppyMapiPlugin,
 		hr = ProcessDeliveryToRecipient(lppyMapiPlugin, lpSession,
 		     lpStore, lpUserSession == NULL, lpAdrBook, lpOrigMessage,
 		     bFallbackDelivery, strMail, recip, lpArgs, &~lpMessageTmp,
-		     &bFallbackDeliveryTmp);
+		     &bFallbackDeliveryTmp, bFanout && !fanout.done ? &fanout : nullptr,
+		     lpCopy);
+		if (lpCopy != nullptr)
+			/* drop the references as soon as the recipient is done */
+			fanout.copies.erase(copy_iter);
 		if (hr == hrSuccess || hr == MAPI_E_CANCEL) {
 			if (hr == hrSuccess) {
 				memory_ptr<SPropValue> lpMessageId, lpSubject;
@@ -3238,6 +3442,7 @@ int main(int argc, char **argv)
 		{ "log_raw_message", "error", CONFIGSETTING_RELOADABLE },
 		{"log_raw_message_path", "/var/lib/kopano", CONFIGSETTING_RELOADABLE},
 		{ "archive_on_delivery", "no", CONFIGSETTING_RELOADABLE },
+		{"server_side_copies", "no", CONFIGSETTING_RELOADABLE},
 		{ "mr_autoaccepter", "/usr/sbin/kopano-mr-accept", CONFIGSETTING_RELOADABLE },
 		{ "mr_autoprocessor", "/usr/sbin/kopano-mr-process", CONFIGSETTING_RELOADABLE },
 		{ "autoresponder", "/usr/sbin/kopano-autorespond", CONFIGSETTING_RELOADABLE },
@@ -1469,6 +1469,10 @@ PR_EC_COMPANY_ADMIN_W =         PROP_TAG(PT_UNICODE,    PR_EC_BASE+0x49)
 
 PR_EC_STATS_SESSION_CLIENT_APPLICATION_VERSION = PROP_TAG(PT_STRING8, PR_EC_BASE+0x54)
 PR_EC_STATS_SESSION_CLIENT_APPLICATION_MISC    = PROP_TAG(PT_STRING8, PR_EC_BASE+0x55)
+PR_EC_STATS_CLIENT_CACHE_HITS                  = PROP_TAG(PT_LONGLONG, PR_EC_BASE+0x56)
+PR_EC_STATS_CLIENT_CACHE_MISSES                = PROP_TAG(PT_LONGLONG, PR_EC_BASE+0x57)
+PR_EC_STATS_CLIENT_CACHE_SAVED_CALLS           = PROP_TAG(PT_LONGLONG, PR_EC_BASE+0x58)
+PR_EC_STATS_CLIENT_CACHE_BYTES                 = PROP_TAG(PT_LONGLONG, PR_EC_BASE+0x59)
 
 PR_EC_OUTOFOFFICE                   = PROP_TAG(PT_BOOLEAN,    PR_EC_BASE+0x60)
 PR_EC_OUTOFOFFICE_MSG               = PROP_TAG(PT_TSTRING,    PR_EC_BASE+0x61)
@@ -1542,6 +1546,8 @@ EC_PROFILE_FLAGS_CACHE_PUBLIC			= 0x0000400
 EC_PROFILE_FLAGS_TRUNCATE_SOURCEKEY		= 0x0000800
 EC_PROFILE_FLAGS_NO_UID_AUTH			= 0x0001000
 EC_PROFILE_FLAGS_OIDC				= 0x0004000
+EC_PROFILE_FLAGS_CLIENT_CACHE			= 0x0020000
+EC_PROFILE_FLAGS_NO_NOTIFY_MUX			= 0x0040000
 
 # WebAccess/WebApp settings
 PR_EC_WEBACCESS_SETTINGS = PROP_TAG(PT_TSTRING, PR_EC_BASE+0x70)
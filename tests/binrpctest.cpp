@@ -0,0 +1,407 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <memory>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <edkmdb.h>
+#include <kopano/platform.h>
+#include "soapH.h"
+#include "BinaryRPC.h"
+
+using namespace KC;
+
+/*
+ * Round trips of the binary RPC encoding (BinaryRPC.h). Every property
+ * type, restrictions and rule actions, and the fields of saveObject (the
+ * instance id entryList included), notifySubscribe and namedPropArray
+ * must decode to the values that were encoded. Values are compared on
+ * the gSOAP XML of both sides, which has every field SOAP would send.
+ * Every shorter input must fail to decode.
+ */
+
+static unsigned int failures;
+
+#define CHECK(c) do { \
+		if (!(c)) { \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); \
+			++failures; \
+		} \
+	} while (false)
+
+template<typename T> static T *alloc(struct soap *soap, size_t n)
+{
+	auto p = static_cast<T *>(soap_malloc(soap, sizeof(T) * n));
+	memset(p, 0, sizeof(T) * n);
+	return p;
+}
+
+static struct xsd__base64Binary make_bin(struct soap *soap, size_t n, unsigned int seed)
+{
+	struct xsd__base64Binary b;
+	b.__size = n;
+	b.__ptr = n == 0 ? nullptr : alloc<unsigned char>(soap, n);
+	for (size_t i = 0; i < n; ++i)
+		b.__ptr[i] = seed * 31 + i;
+	return b;
+}
+
+static struct hiloLong make_hilo(int hi, unsigned int lo)
+{
+	struct hiloLong h;
+	h.hi = hi;
+	h.lo = lo;
+	return h;
+}
+
+/* subject = "x" and a body, as a search folder would restrict on */
+static struct restrictTable *make_restriction(struct soap *soap)
+{
+	auto prop = soap_new_restrictTable(soap);
+	prop->ulType = RES_PROPERTY;
+	prop->lpProp = soap_new_restrictProp(soap);
+	prop->lpProp->ulType = RELOP_EQ;
+	prop->lpProp->ulPropTag = PR_SUBJECT_W;
+	prop->lpProp->lpProp = soap_new_propVal(soap);
+	prop->lpProp->lpProp->ulPropTag = PR_SUBJECT_W;
+	prop->lpProp->lpProp->__union = SOAP_UNION_propValData_lpszA;
+	prop->lpProp->lpProp->Value.lpszA = soap_strdup(soap, "x");
+
+	auto exist = soap_new_restrictTable(soap);
+	exist->ulType = RES_EXIST;
+	exist->lpExist = soap_new_restrictExist(soap);
+	exist->lpExist->ulPropTag = PR_BODY_W;
+
+	auto res = soap_new_restrictTable(soap);
+	res->ulType = RES_AND;
+	res->lpAnd = soap_new_restrictAnd(soap);
+	res->lpAnd->__size = 2;
+	res->lpAnd->__ptr = alloc<struct restrictTable *>(soap, 2);
+	res->lpAnd->__ptr[0] = prop;
+	res->lpAnd->__ptr[1] = exist;
+	return res;
+}
+
+static struct actions *make_actions(struct soap *soap)
+{
+	auto a = soap_new_actions(soap);
+	a->__size = 2;
+	a->__ptr = soap_new_action(soap, 2);
+	a->__ptr[0].acttype = OP_MOVE;
+	a->__ptr[0].__union = SOAP_UNION__act_moveCopy;
+	a->__ptr[0].act.moveCopy.store = make_bin(soap, 44, 3);
+	a->__ptr[0].act.moveCopy.folder = make_bin(soap, 48, 4);
+	a->__ptr[1].acttype = OP_BOUNCE;
+	a->__ptr[1].__union = SOAP_UNION__act_bouncecode;
+	a->__ptr[1].act.bouncecode = BOUNCE_ACCESS_DENIED;
+	return a;
+}
+
+/* One property of every type, some of them empty */
+static void make_props(struct soap *soap, struct propValArray &pa)
+{
+	pa.__size = 0;
+	pa.__ptr = soap_new_propVal(soap, 40);
+	auto add = [&](unsigned int type, int u) -> struct propVal & {
+		auto &pv = pa.__ptr[pa.__size];
+		pv.ulPropTag = PROP_TAG(type, 0x6700 + pa.__size);
+		pv.__union = u;
+		++pa.__size;
+		return pv;
+	};
+
+	add(PT_NULL, SOAP_UNION_propValData_ul).Value.ul = 0;
+	add(PT_ERROR, SOAP_UNION_propValData_ul).Value.ul = KCERR_NOT_FOUND;
+	add(PT_I2, SOAP_UNION_propValData_i).Value.i = -12345;
+	add(PT_LONG, SOAP_UNION_propValData_ul).Value.ul = 0xdeadbeef;
+	add(PT_R4, SOAP_UNION_propValData_flt).Value.flt = -1.5f;
+	add(PT_DOUBLE, SOAP_UNION_propValData_dbl).Value.dbl = 3.141592653589793;
+	add(PT_APPTIME, SOAP_UNION_propValData_dbl).Value.dbl = 45000.25;
+	add(PT_BOOLEAN, SOAP_UNION_propValData_b).Value.b = true;
+	add(PT_BOOLEAN, SOAP_UNION_propValData_b).Value.b = false;
+	add(PT_I8, SOAP_UNION_propValData_li).Value.li = -0x123456789abcLL;
+	add(PT_CURRENCY, SOAP_UNION_propValData_hilo).Value.hilo = alloc<struct hiloLong>(soap, 1);
+	*pa.__ptr[pa.__size-1].Value.hilo = make_hilo(-1, 0x89abcdef);
+	add(PT_SYSTIME, SOAP_UNION_propValData_hilo).Value.hilo = alloc<struct hiloLong>(soap, 1);
+	*pa.__ptr[pa.__size-1].Value.hilo = make_hilo(0x01d5c3a0, 0xfedcba98);
+	add(PT_STRING8, SOAP_UNION_propValData_lpszA).Value.lpszA = soap_strdup(soap, "plain text");
+	add(PT_UNICODE, SOAP_UNION_propValData_lpszA).Value.lpszA = soap_strdup(soap, "Gr\xc3\xbc\xc3\x9f" "e <&>");
+	add(PT_UNICODE, SOAP_UNION_propValData_lpszA).Value.lpszA = soap_strdup(soap, "");
+	add(PT_BINARY, SOAP_UNION_propValData_bin).Value.bin = alloc<struct xsd__base64Binary>(soap, 1);
+	*pa.__ptr[pa.__size-1].Value.bin = make_bin(soap, 300, 1);
+	add(PT_BINARY, SOAP_UNION_propValData_bin).Value.bin = alloc<struct xsd__base64Binary>(soap, 1);
+	add(PT_CLSID, SOAP_UNION_propValData_bin).Value.bin = alloc<struct xsd__base64Binary>(soap, 1);
+	*pa.__ptr[pa.__size-1].Value.bin = make_bin(soap, 16, 2);
+
+	auto &mvi = add(PT_MV_I2, SOAP_UNION_propValData_mvi).Value.mvi;
+	mvi.__size = 3;
+	mvi.__ptr = alloc<short>(soap, 3);
+	mvi.__ptr[0] = -1;
+	mvi.__ptr[1] = 0;
+	mvi.__ptr[2] = 32767;
+	auto &mvl = add(PT_MV_LONG, SOAP_UNION_propValData_mvl).Value.mvl;
+	mvl.__size = 2;
+	mvl.__ptr = alloc<unsigned int>(soap, 2);
+	mvl.__ptr[0] = 1;
+	mvl.__ptr[1] = 0xffffffff;
+	auto &mvflt = add(PT_MV_R4, SOAP_UNION_propValData_mvflt).Value.mvflt;
+	mvflt.__size = 2;
+	mvflt.__ptr = alloc<float>(soap, 2);
+	mvflt.__ptr[0] = 0.25f;
+	mvflt.__ptr[1] = -1e10f;
+	for (auto type : {PT_MV_DOUBLE, PT_MV_APPTIME}) {
+		auto &mvdbl = add(type, SOAP_UNION_propValData_mvdbl).Value.mvdbl;
+		mvdbl.__size = 2;
+		mvdbl.__ptr = alloc<double>(soap, 2);
+		mvdbl.__ptr[0] = 1.0 / 3;
+		mvdbl.__ptr[1] = -2.5e100;
+	}
+	for (auto type : {PT_MV_CURRENCY, PT_MV_SYSTIME}) {
+		auto &mvhilo = add(type, SOAP_UNION_propValData_mvhilo).Value.mvhilo;
+		mvhilo.__size = 3;
+		mvhilo.__ptr = alloc<struct hiloLong>(soap, 3);
+		mvhilo.__ptr[0] = make_hilo(0x01d5c3a0, 1);
+		mvhilo.__ptr[1] = make_hilo(-2, 0x80000000);
+		mvhilo.__ptr[2] = make_hilo(0x7fffffff, 0xffffffff);
+	}
+	/* an empty one, after which the next property must still be found */
+	add(PT_MV_SYSTIME, SOAP_UNION_propValData_mvhilo);
+	auto &mvli = add(PT_MV_I8, SOAP_UNION_propValData_mvli).Value.mvli;
+	mvli.__size = 2;
+	mvli.__ptr = alloc<LONG64>(soap, 2);
+	mvli.__ptr[0] = 1LL << 62;
+	mvli.__ptr[1] = -7;
+	for (auto type : {PT_MV_BINARY, PT_MV_CLSID}) {
+		auto &mvbin = add(type, SOAP_UNION_propValData_mvbin).Value.mvbin;
+		mvbin.__size = 2;
+		mvbin.__ptr = alloc<struct xsd__base64Binary>(soap, 2);
+		mvbin.__ptr[0] = make_bin(soap, 16, 5);
+		mvbin.__ptr[1] = make_bin(soap, type == PT_MV_CLSID ? 16 : 0, 6);
+	}
+	for (auto type : {PT_MV_STRING8, PT_MV_UNICODE}) {
+		auto &mvsz = add(type, SOAP_UNION_propValData_mvszA).Value.mvszA;
+		mvsz.__size = 3;
+		mvsz.__ptr = alloc<char *>(soap, 3);
+		mvsz.__ptr[0] = soap_strdup(soap, "one");
+		mvsz.__ptr[1] = soap_strdup(soap, "");
+		mvsz.__ptr[2] = soap_strdup(soap, "dr\xc3\xa9i");
+	}
+	add(PT_SRESTRICTION, SOAP_UNION_propValData_res).Value.res = make_restriction(soap);
+	add(PT_ACTIONS, SOAP_UNION_propValData_actions).Value.actions = make_actions(soap);
+}
+
+static void make_object(struct soap *soap, struct saveObject &so)
+{
+	make_props(soap, so.modProps);
+	so.delProps.__size = 2;
+	so.delProps.__ptr = alloc<unsigned int>(soap, 2);
+	so.delProps.__ptr[0] = PR_SUBJECT_W;
+	so.delProps.__ptr[1] = PR_BODY_W;
+	so.bDelete = true;
+	so.ulClientId = 7;
+	so.ulServerId = 0x10000001;
+	so.ulObjType = MAPI_MESSAGE;
+	so.lpInstanceIds = soap_new_entryList(soap);
+	so.lpInstanceIds->__size = 2;
+	so.lpInstanceIds->__ptr = soap_new_entryId(soap, 2);
+	so.lpInstanceIds->__ptr[0] = make_bin(soap, 36, 7);
+	so.lpInstanceIds->__ptr[1] = make_bin(soap, 0, 0);
+
+	so.__size = 1;
+	so.__ptr = soap_new_saveObject(soap, 1);
+	auto &att = so.__ptr[0];
+	att.ulClientId = 0;
+	att.ulServerId = 0x10000002;
+	att.ulObjType = MAPI_ATTACH;
+	att.modProps.__size = 1;
+	att.modProps.__ptr = soap_new_propVal(soap, 1);
+	att.modProps.__ptr[0].ulPropTag = PR_ATTACH_SIZE;
+	att.modProps.__ptr[0].__union = SOAP_UNION_propValData_ul;
+	att.modProps.__ptr[0].Value.ul = 1234;
+}
+
+template<typename T> struct xml_codec {
+	void (*serialize)(struct soap *, const T *);
+	int (*put)(struct soap *, const T *, const char *, const char *);
+};
+
+template<typename T> static std::string to_xml(const xml_codec<T> &x, const T &v)
+{
+	auto xsoap = std::make_unique<struct soap>();
+	std::ostringstream os;
+	soap_set_omode(xsoap.get(), SOAP_C_UTFSTRING);
+	soap_begin(xsoap.get());
+	xsoap->os = &os;
+	x.serialize(xsoap.get(), &v);
+	auto ok = soap_begin_send(xsoap.get()) == 0 &&
+	          x.put(xsoap.get(), &v, "data", nullptr) == 0 &&
+	          soap_end_send(xsoap.get()) == 0;
+	soap_destroy(xsoap.get());
+	soap_end(xsoap.get());
+	return ok ? os.str() : std::string();
+}
+
+/* Encodes @in, decodes it into @soap, and checks it and all its prefixes */
+template<typename T> static void roundtrip(struct soap *soap, const char *what,
+    const xml_codec<T> &x, const T &in)
+{
+	std::string s;
+	ECBinarySerializer enc(&s), dec;
+	if (BinSerialize(&enc, in) != erSuccess) {
+		fprintf(stderr, "%s: encoding failed\n", what);
+		++failures;
+		return;
+	}
+	T out{};
+	dec.SetInput(s.data(), s.size());
+	if (BinDeserialize(soap, &dec, &out) != erSuccess || dec.remaining() != 0) {
+		fprintf(stderr, "%s: decoding failed\n", what);
+		++failures;
+		return;
+	}
+	auto want = to_xml(x, in);
+	CHECK(!want.empty());
+	if (to_xml(x, out) != want) {
+		fprintf(stderr, "%s: values differ after the round trip\n", what);
+		++failures;
+	}
+	for (size_t n = 0; n < s.size(); ++n) {
+		T tmp{};
+		dec.SetInput(s.data(), n);
+		if (BinDeserialize(soap, &dec, &tmp) == erSuccess) {
+			fprintf(stderr, "%s: decoded from %zu of %zu bytes\n", what, n, s.size());
+			++failures;
+			break;
+		}
+	}
+}
+
+static void test_props(struct soap *soap)
+{
+	struct propValArray pa{};
+	make_props(soap, pa);
+	xml_codec<struct propVal> xpv{soap_serialize_propVal, soap_put_propVal};
+	for (gsoap_size_t i = 0; i < pa.__size; ++i) {
+		char what[32];
+		snprintf(what, sizeof(what), "propVal %08x", pa.__ptr[i].ulPropTag);
+		roundtrip(soap, what, xpv, pa.__ptr[i]);
+	}
+	roundtrip(soap, "propValArray", {soap_serialize_propValArray, soap_put_propValArray}, pa);
+
+	struct rowSet rows{};
+	rows.__size = 2;
+	rows.__ptr = soap_new_propValArray(soap, 2);
+	rows.__ptr[0] = pa;
+	rows.__ptr[1].__size = 1;
+	rows.__ptr[1].__ptr = &pa.__ptr[3];
+	roundtrip(soap, "rowSet", {soap_serialize_rowSet, soap_put_rowSet}, rows);
+
+	/* A decoded PT_MV_SYSTIME has its values, not just its count */
+	std::string s;
+	ECBinarySerializer enc(&s), dec;
+	struct propVal *mv = nullptr;
+	for (gsoap_size_t i = 0; i < pa.__size && mv == nullptr; ++i)
+		if (PROP_TYPE(pa.__ptr[i].ulPropTag) == PT_MV_SYSTIME)
+			mv = &pa.__ptr[i];
+	CHECK(mv != nullptr);
+	if (mv == nullptr)
+		return;
+	struct propVal out{};
+	CHECK(BinSerialize(&enc, *mv) == erSuccess);
+	dec.SetInput(s.data(), s.size());
+	CHECK(BinDeserialize(soap, &dec, &out) == erSuccess);
+	CHECK(out.__union == SOAP_UNION_propValData_mvhilo);
+	CHECK(out.Value.mvhilo.__size == 3);
+	if (out.Value.mvhilo.__size == 3) {
+		CHECK(out.Value.mvhilo.__ptr[0].hi == 0x01d5c3a0 && out.Value.mvhilo.__ptr[0].lo == 1);
+		CHECK(out.Value.mvhilo.__ptr[1].hi == -2 && out.Value.mvhilo.__ptr[1].lo == 0x80000000);
+		CHECK(out.Value.mvhilo.__ptr[2].hi == 0x7fffffff && out.Value.mvhilo.__ptr[2].lo == 0xffffffff);
+	}
+}
+
+static void test_object(struct soap *soap)
+{
+	struct saveObject so{};
+	make_object(soap, so);
+	xml_codec<struct saveObject> x{soap_serialize_saveObject, soap_put_saveObject};
+	roundtrip(soap, "saveObject", x, so);
+	so.lpInstanceIds = nullptr;
+	roundtrip(soap, "saveObject without instance ids", x, so);
+
+	struct propTagArray tags{};
+	tags.__size = so.delProps.__size;
+	tags.__ptr = so.delProps.__ptr;
+	roundtrip(soap, "propTagArray", {soap_serialize_propTagArray, soap_put_propTagArray}, tags);
+}
+
+static void test_names(struct soap *soap)
+{
+	struct namedPropArray na{};
+	na.__size = 3;
+	na.__ptr = soap_new_namedProp(soap, 3);
+	auto guid = alloc<struct xsd__base64Binary>(soap, 1);
+	*guid = make_bin(soap, 16, 8);
+	na.__ptr[0].lpId = alloc<unsigned int>(soap, 1);
+	*na.__ptr[0].lpId = 0x8501;
+	na.__ptr[0].lpguid = guid;
+	na.__ptr[1].lpString = soap_strdup(soap, "x-custom-header");
+	na.__ptr[1].lpguid = guid;
+	na.__ptr[2].lpId = alloc<unsigned int>(soap, 1);
+	*na.__ptr[2].lpId = 0;
+	roundtrip(soap, "namedPropArray", {soap_serialize_namedPropArray, soap_put_namedPropArray}, na);
+}
+
+static void test_subscribe(struct soap *soap)
+{
+	struct notifySubscribe ns{};
+	ns.ulConnection = 42;
+	ns.sKey = make_bin(soap, 24, 9);
+	ns.ulEventMask = fnevObjectModified | fnevObjectDeleted;
+	ns.sSyncState.ulSyncId = 5;
+	ns.sSyncState.ulChangeId = 0x12345;
+
+	std::string s;
+	ECBinarySerializer enc(&s), dec;
+	CHECK(BinSerialize(&enc, &ns) == erSuccess);
+	struct notifySubscribe *out = nullptr;
+	dec.SetInput(s.data(), s.size());
+	CHECK(BinDeserialize(soap, &dec, &out) == erSuccess && dec.remaining() == 0);
+	CHECK(out != nullptr);
+	if (out != nullptr) {
+		xml_codec<struct notifySubscribe> x{soap_serialize_notifySubscribe, soap_put_notifySubscribe};
+		CHECK(to_xml(x, *out) == to_xml(x, ns));
+	}
+	for (size_t n = 0; n < s.size(); ++n) {
+		dec.SetInput(s.data(), n);
+		CHECK(BinDeserialize(soap, &dec, &out) != erSuccess);
+	}
+
+	s.clear();
+	CHECK(BinSerialize(&enc, static_cast<const struct notifySubscribe *>(nullptr)) == erSuccess);
+	out = &ns;
+	dec.SetInput(s.data(), s.size());
+	CHECK(BinDeserialize(soap, &dec, &out) == erSuccess && dec.remaining() == 0);
+	CHECK(out == nullptr);
+}
+
+int main()
+{
+	auto soap = std::make_unique<struct soap>();
+	soap_begin(soap.get());
+	test_props(soap.get());
+	test_object(soap.get());
+	test_names(soap.get());
+	test_subscribe(soap.get());
+	soap_destroy(soap.get());
+	soap_end(soap.get());
+	if (failures != 0) {
+		fprintf(stderr, "%u checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("ok\n");
+	return EXIT_SUCCESS;
+}
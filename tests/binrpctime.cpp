@@ -0,0 +1,290 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <kopano/platform.h>
+#include "soapH.h"
+#include "BinaryRPC.h"
+
+using namespace KC;
+using clk = std::chrono::steady_clock;
+
+/*
+ * This program compares the SOAP/XML encoding of the hottest calls'
+ * payloads with the binary RPC encoding (BinaryRPC.h): a tableQueryRows
+ * result shaped like a WebApp message list, a loadObject result (a message
+ * with two attachments) and a getIDsFromNames request. For each, it reports
+ * the size and the time to encode plus decode, which is the CPU that client
+ * and server spend on (de)serialization per call together.
+ *
+ * Usage: binrpctime [-n iterations] [-r rows] [-c columns]
+ */
+
+static unsigned char guid[16] = {
+	0x00, 0x20, 0x32, 0x86, 0x00, 0x00, 0x00, 0x00,
+	0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46,
+};
+
+/* Keeps the memory of the synthetic payloads */
+class arena {
+	public:
+	template<typename T> T *alloc(size_t n)
+	{
+		m_blocks.emplace_back(new char[sizeof(T) * n]());
+		return reinterpret_cast<T *>(m_blocks.back().get());
+	}
+	char *str(const std::string &s)
+	{
+		auto p = alloc<char>(s.size() + 1);
+		memcpy(p, s.c_str(), s.size() + 1);
+		return p;
+	}
+	struct xsd__base64Binary bin(size_t n, unsigned int seed)
+	{
+		struct xsd__base64Binary b;
+		b.__ptr = alloc<unsigned char>(n);
+		b.__size = n;
+		for (size_t i = 0; i < n; ++i)
+			b.__ptr[i] = seed * 31 + i;
+		return b;
+	}
+
+	private:
+	std::vector<std::unique_ptr<char[]>> m_blocks;
+};
+
+/* Column c of a message, cycling through the types of a message list */
+static void make_prop(arena &a, struct propVal &pv, unsigned int row, unsigned int c)
+{
+	auto id = 0x6700 + c;
+	switch (c % 6) {
+	case 0:
+		pv.ulPropTag = PROP_TAG(PT_BINARY, id);
+		pv.__union = SOAP_UNION_propValData_bin;
+		pv.Value.bin = a.alloc<struct xsd__base64Binary>(1);
+		*pv.Value.bin = a.bin(48, row + c);
+		break;
+	case 1:
+		pv.ulPropTag = PROP_TAG(PT_UNICODE, id);
+		pv.__union = SOAP_UNION_propValData_lpszA;
+		pv.Value.lpszA = a.str("Re: quarterly figures for row " + std::to_string(row) + " & <co>");
+		break;
+	case 2:
+		pv.ulPropTag = PROP_TAG(PT_LONG, id);
+		pv.__union = SOAP_UNION_propValData_ul;
+		pv.Value.ul = row * 4096 + c;
+		break;
+	case 3:
+		pv.ulPropTag = PROP_TAG(PT_SYSTIME, id);
+		pv.__union = SOAP_UNION_propValData_hilo;
+		pv.Value.hilo = a.alloc<struct hiloLong>(1);
+		pv.Value.hilo->hi = 30000000 + row;
+		pv.Value.hilo->lo = 0x12345678 * c;
+		break;
+	case 4:
+		pv.ulPropTag = PROP_TAG(PT_BOOLEAN, id);
+		pv.__union = SOAP_UNION_propValData_b;
+		pv.Value.b = (row + c) & 1;
+		break;
+	default:
+		pv.ulPropTag = PROP_TAG(PT_I8, id);
+		pv.__union = SOAP_UNION_propValData_li;
+		pv.Value.li = static_cast<LONG64>(row) << 33 | c;
+		break;
+	}
+}
+
+static void make_props(arena &a, struct propValArray &pa, unsigned int row, unsigned int ncols)
+{
+	pa.__size = ncols;
+	pa.__ptr = a.alloc<struct propVal>(ncols);
+	for (unsigned int c = 0; c < ncols; ++c)
+		make_prop(a, pa.__ptr[c], row, c);
+}
+
+static void make_object(arena &a, struct saveObject &so, unsigned int id, unsigned int nprops, unsigned int nchildren)
+{
+	so.__size = nchildren;
+	so.__ptr = nchildren > 0 ? a.alloc<struct saveObject>(nchildren) : nullptr;
+	so.ulClientId = so.ulServerId = id;
+	so.ulObjType = nchildren > 0 ? MAPI_MESSAGE : MAPI_ATTACH;
+	make_props(a, so.modProps, id, nprops);
+	for (unsigned int i = 0; i < nchildren; ++i)
+		make_object(a, so.__ptr[i], id + 1 + i, nprops / 2, 0);
+}
+
+static void make_names(arena &a, struct namedPropArray &na, unsigned int n)
+{
+	na.__size = n;
+	na.__ptr = a.alloc<struct namedProp>(n);
+	for (unsigned int i = 0; i < n; ++i) {
+		auto &np = na.__ptr[i];
+		np.lpguid = a.alloc<struct xsd__base64Binary>(1);
+		np.lpguid->__ptr = guid;
+		np.lpguid->__size = sizeof(guid);
+		if (i % 3 == 0) {
+			np.lpString = a.str("x-custom-header-" + std::to_string(i));
+		} else {
+			np.lpId = a.alloc<unsigned int>(1);
+			*np.lpId = 0x8500 + i;
+		}
+	}
+}
+
+/* The gSOAP functions for one type, as ECExchangeModifyTable uses them */
+template<typename T> struct xml_codec {
+	void (*serialize)(struct soap *, const T *);
+	int (*put)(struct soap *, const T *, const char *, const char *);
+	T *(*get)(struct soap *, T *, const char *, const char *);
+};
+
+struct result {
+	size_t bytes = 0;
+	double us = 0;
+};
+
+template<typename T> static bool time_xml(const xml_codec<T> &x, const T &in,
+    size_t (*count)(const T &), unsigned int iter, result &res)
+{
+	auto xsoap = std::make_unique<struct soap>();
+	auto start = clk::now();
+	for (unsigned int i = 0; i < iter; ++i) {
+		std::ostringstream os;
+		soap_set_omode(xsoap.get(), SOAP_C_UTFSTRING);
+		soap_begin(xsoap.get());
+		xsoap->os = &os;
+		x.serialize(xsoap.get(), &in);
+		if (soap_begin_send(xsoap.get()) != 0 ||
+		    x.put(xsoap.get(), &in, "data", nullptr) != 0 ||
+		    soap_end_send(xsoap.get()) != 0)
+			return false;
+		soap_end(xsoap.get());
+
+		auto s = os.str();
+		std::istringstream is(s);
+		T out{};
+		res.bytes = s.size();
+		xsoap->is = &is;
+		soap_set_imode(xsoap.get(), SOAP_C_UTFSTRING);
+		soap_begin(xsoap.get());
+		if (soap_begin_recv(xsoap.get()) != 0 ||
+		    x.get(xsoap.get(), &out, "data", nullptr) == nullptr ||
+		    soap_end_recv(xsoap.get()) != 0 || count(out) != count(in))
+			return false;
+		soap_destroy(xsoap.get());
+		soap_end(xsoap.get());
+	}
+	res.us = std::chrono::duration<double, std::micro>(clk::now() - start).count() / iter;
+	return true;
+}
+
+template<typename T> static bool time_bin(const T &in, size_t (*count)(const T &),
+    unsigned int iter, result &res)
+{
+	auto xsoap = std::make_unique<struct soap>();
+	auto start = clk::now();
+	for (unsigned int i = 0; i < iter; ++i) {
+		std::string s;
+		ECBinarySerializer enc(&s), dec;
+		if (BinSerialize(&enc, in) != erSuccess)
+			return false;
+		res.bytes = s.size();
+
+		T out{};
+		dec.SetInput(s.data(), s.size());
+		soap_begin(xsoap.get());
+		if (BinDeserialize(xsoap.get(), &dec, &out) != erSuccess ||
+		    dec.remaining() != 0 || count(out) != count(in))
+			return false;
+		soap_destroy(xsoap.get());
+		soap_end(xsoap.get());
+	}
+	res.us = std::chrono::duration<double, std::micro>(clk::now() - start).count() / iter;
+	return true;
+}
+
+static size_t count_rows(const struct rowSet &r)
+{
+	size_t n = 0;
+	for (gsoap_size_t i = 0; i < r.__size; ++i)
+		n += r.__ptr[i].__size;
+	return n;
+}
+
+static size_t count_object(const struct saveObject &so)
+{
+	size_t n = so.modProps.__size;
+	for (gsoap_size_t i = 0; i < so.__size; ++i)
+		n += count_object(so.__ptr[i]);
+	return n;
+}
+
+static size_t count_names(const struct namedPropArray &na)
+{
+	return na.__size;
+}
+
+template<typename T> static int compare(const char *what, const xml_codec<T> &x,
+    const T &in, size_t (*count)(const T &), unsigned int iter)
+{
+	result xml, bin;
+	if (!time_xml(x, in, count, iter, xml) || !time_bin(in, count, iter, bin)) {
+		fprintf(stderr, "%s: round trip failed\n", what);
+		return EXIT_FAILURE;
+	}
+	printf("%-16s  xml %8zu bytes %9.1f µs   binary %8zu bytes %9.1f µs   (%.1fx smaller, %.1fx faster)\n",
+	       what, xml.bytes, xml.us, bin.bytes, bin.us,
+	       static_cast<double>(xml.bytes) / bin.bytes, xml.us / bin.us);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iter = 2000, nrows = 50, ncols = 20;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:n:r:")) != -1) {
+		switch (c) {
+		case 'c': ncols = strtoul(optarg, nullptr, 0); break;
+		case 'n': iter = strtoul(optarg, nullptr, 0); break;
+		case 'r': nrows = strtoul(optarg, nullptr, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-r rows] [-c columns]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (iter == 0 || ncols == 0) {
+		fprintf(stderr, "-n and -c must be at least 1\n");
+		return EXIT_FAILURE;
+	}
+
+	arena a;
+	struct rowSet rows{};
+	rows.__size = nrows;
+	rows.__ptr = a.alloc<struct propValArray>(nrows);
+	for (unsigned int r = 0; r < nrows; ++r)
+		make_props(a, rows.__ptr[r], r, ncols);
+	struct saveObject obj{};
+	make_object(a, obj, 1, 2 * ncols, 2);
+	struct namedPropArray names{};
+	make_names(a, names, 30);
+
+	printf("%u iterations, encode + decode per call\n", iter);
+	if (compare("tableQueryRows", xml_codec<struct rowSet>{soap_serialize_rowSet, soap_put_rowSet, soap_get_rowSet},
+	    rows, count_rows, iter) != EXIT_SUCCESS ||
+	    compare("loadObject", xml_codec<struct saveObject>{soap_serialize_saveObject, soap_put_saveObject, soap_get_saveObject},
+	    obj, count_object, iter) != EXIT_SUCCESS ||
+	    compare("getIDsFromNames", xml_codec<struct namedPropArray>{soap_serialize_namedPropArray, soap_put_namedPropArray, soap_get_namedPropArray},
+	    names, count_names, iter) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include <mapidefs.h>
+#include <kopano/cdc.hpp>
+#include <kopano/fileutil.hpp>
+#include <kopano/stringutil.h>
+
+using namespace KC;
+using clk = std::chrono::steady_clock;
+
+/*
+ * This program measures attachment ingest throughput of the files_v2 store
+ * with and without attachment_files_chunking, and the space each needs.
+ *
+ * Usage: cdctime <empty scratch directory> <file>...
+ *
+ * The files are read into memory first, so only hashing, chunking and
+ * writing are timed. "plain" models files_v2 (SHA-256 over the whole
+ * attachment, one file per distinct attachment); "chunked" runs the same
+ * data through cdc_writer. Feed it e.g. a set of revisions of the same
+ * documents to see the effect of chunk-level deduplication.
+ */
+
+static void report(const char *what, uint64_t bytes, uint64_t stored, clk::duration d)
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	printf("%-8s %12llu bytes in %10lld us, %8.1f MB/s, stored %12llu bytes (ratio %.2f)\n",
+	       what, static_cast<unsigned long long>(bytes), static_cast<long long>(us),
+	       us > 0 ? static_cast<double>(bytes) / us : 0.0,
+	       static_cast<unsigned long long>(stored),
+	       stored > 0 ? static_cast<double>(bytes) / stored : 0.0);
+}
+
+static bool plain_put(const std::string &dir, const std::string &data, uint64_t *stored)
+{
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	SHA256(reinterpret_cast<const unsigned char *>(data.data()), data.size(), md);
+	auto file = dir + "/" + bin2hex(sizeof(md), md);
+	int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0660);
+	if (fd < 0)
+		return errno == EEXIST;
+	auto ok = write_retry(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+	close(fd);
+	*stored += data.size();
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s scratchdir file...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	std::string scratch = argv[1];
+	std::vector<std::string> input;
+	uint64_t total = 0;
+	for (int i = 2; i < argc; ++i) {
+		std::unique_ptr<FILE, file_deleter> fp(fopen(argv[i], "r"));
+		std::string buf;
+		if (fp == nullptr || HrMapFileToString(fp.get(), &buf) != hrSuccess) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+			return EXIT_FAILURE;
+		}
+		total += buf.size();
+		input.emplace_back(std::move(buf));
+	}
+
+	auto plain_dir = scratch + "/plain";
+	if (CreatePath(plain_dir) != 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", plain_dir.c_str(), strerror(errno));
+		return EXIT_FAILURE;
+	}
+	uint64_t stored = 0;
+	auto start = clk::now();
+	for (const auto &data : input)
+		if (!plain_put(plain_dir, data, &stored)) {
+			fprintf(stderr, "plain: write failed: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+	report("plain", total, stored, clk::now() - start);
+
+	cdc_store store(scratch + "/chunks");
+	cdc_chunker chunker;
+	std::set<std::string> seen;
+	stored = 0;
+	start = clk::now();
+	for (size_t i = 0; i < input.size(); ++i) {
+		cdc_writer wr(store, chunker, "bench" + stringify(i));
+		if (wr.write(input[i].data(), input[i].size()) != erSuccess ||
+		    wr.finish() != erSuccess) {
+			fprintf(stderr, "chunked: write failed\n");
+			return EXIT_FAILURE;
+		}
+		for (const auto &c : wr.manifest().chunks)
+			if (seen.emplace(c.md).second)
+				stored += c.size;
+	}
+	report("chunked", total, stored, clk::now() - start);
+	printf("(%zu distinct chunks, average %llu bytes)\n", seen.size(),
+	       static_cast<unsigned long long>(seen.size() > 0 ? stored / seen.size() : 0));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <kopano/platform.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include "../provider/client/ECClientCache.h"
+
+/*
+ * Tests of the client object cache: which entryids make a key, what is
+ * kept, and that a load which raced with an invalidation (put() with an
+ * old generation) does not end up in the cache.
+ */
+
+static unsigned int failures;
+
+#define CHECK(c) do { \
+		if (!(c)) { \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); \
+			++failures; \
+		} \
+	} while (false)
+
+static std::string K(unsigned char id)
+{
+	GUID store{}, unique{};
+	memset(&store, 0x5A, sizeof(store));
+	memset(&unique, id, sizeof(unique));
+	EID_FIXED eid(MAPI_MESSAGE, store, unique);
+	return ECClientCache::key(sizeof(eid), &eid);
+}
+
+static MAPIOBJECT *make(unsigned int type, const wchar_t *subject)
+{
+	auto o = new MAPIOBJECT(0, 0, type);
+	SPropValue pv;
+	pv.ulPropTag = PR_SUBJECT_W;
+	pv.Value.lpszW = const_cast<wchar_t *>(subject);
+	o->lstProperties.emplace_back(&pv);
+	return o;
+}
+
+static void test_key()
+{
+	CHECK(K(1).size() == 2 * sizeof(GUID));
+	CHECK(K(1) != K(2));
+	CHECK(K(1) == K(1));
+
+	/* v0 entryids, short ones and none at all give no key */
+	EID_FIXED v1;
+	char buf[sizeof(v1)];
+	memcpy(buf, &v1, sizeof(v1));
+	reinterpret_cast<EID *>(buf)->ulVersion = 0;
+	CHECK(ECClientCache::key(sizeof(buf), buf).empty());
+	CHECK(ECClientCache::key(8, &v1).empty());
+	CHECK(ECClientCache::key(sizeof(v1), nullptr).empty());
+	CHECK(!ECClientCache::key(sizeof(v1), &v1).empty());
+}
+
+static void test_put_get()
+{
+	ECClientCache c(1 << 20);
+	std::unique_ptr<MAPIOBJECT> msg(make(MAPI_MESSAGE, L"one"));
+	CHECK(c.get(K(1)) == nullptr);
+	c.put(K(1), *msg, c.generation());
+	CHECK(c.contains(K(1)));
+
+	/* get() hands out a copy the caller may change and free */
+	std::unique_ptr<MAPIOBJECT> got(c.get(K(1)));
+	CHECK(got != nullptr && got.get() != msg.get());
+	CHECK(got != nullptr && got->lstProperties.size() == 1 &&
+	      wcscmp(got->lstProperties.front().GetMAPIPropValRef().Value.lpszW, L"one") == 0);
+	got->lstProperties.clear();
+	got.reset(c.get(K(1)));
+	CHECK(got != nullptr && got->lstProperties.size() == 1);
+
+	/* Only folders and messages, and no empty key */
+	std::unique_ptr<MAPIOBJECT> att(make(MAPI_ATTACH, L"att"));
+	c.put(K(2), *att, c.generation());
+	CHECK(!c.contains(K(2)));
+	c.put(std::string(), *msg, c.generation());
+	CHECK(!c.contains(std::string()));
+
+	/* Large messages are not kept, folders of any size are */
+	std::wstring big(40000, L'x');
+	std::unique_ptr<MAPIOBJECT> large(make(MAPI_MESSAGE, big.c_str()));
+	c.put(K(3), *large, c.generation());
+	CHECK(!c.contains(K(3)));
+	std::unique_ptr<MAPIOBJECT> folder(make(MAPI_FOLDER, big.c_str()));
+	c.put(K(4), *folder, c.generation());
+	CHECK(c.contains(K(4)));
+
+	auto st = c.get_stats();
+	CHECK(st.hits == 2 && st.misses == 1);
+	CHECK(st.bytes > big.size());
+}
+
+static void test_generation()
+{
+	ECClientCache c(1 << 20);
+	std::unique_ptr<MAPIOBJECT> msg(make(MAPI_MESSAGE, L"two"));
+	c.put(K(1), *msg, c.generation());
+	c.put(K(2), *msg, c.generation());
+
+	/* invalidate drops the one entry and moves the generation on */
+	auto gen = c.generation();
+	c.invalidate(K(1));
+	CHECK(c.generation() != gen);
+	CHECK(!c.contains(K(1)));
+	CHECK(c.contains(K(2)));
+
+	/* A load started before the invalidation is not cached */
+	c.put(K(1), *msg, gen);
+	CHECK(!c.contains(K(1)));
+	c.put(K(1), *msg, c.generation());
+	CHECK(c.contains(K(1)));
+
+	/* An empty key invalidates nothing */
+	gen = c.generation();
+	c.invalidate(std::string());
+	CHECK(c.generation() == gen);
+
+	c.clear();
+	CHECK(c.generation() != gen);
+	CHECK(!c.contains(K(1)) && !c.contains(K(2)));
+	CHECK(c.get_stats().bytes == ECClientCache(1 << 20).get_stats().bytes);
+}
+
+int main()
+{
+	test_key();
+	test_put_get();
+	test_generation();
+	if (failures != 0) {
+		fprintf(stderr, "%u checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("ok\n");
+	return EXIT_SUCCESS;
+}
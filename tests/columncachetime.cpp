@@ -0,0 +1,244 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <kopano/platform.h>
+#include <kopano/ECConfig.h>
+#include <kopano/ECKeyTable.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <kopano/mapiext.h>
+#include "soapH.h"
+#include "ECCacheManager.h"
+#include "timeutil.hpp"
+
+using namespace KC;
+
+/*
+ * This program compares serving pages of a large contents table from the
+ * cell cache (ECCacheManager::GetCell for every cell, as QueryRowData does)
+ * with serving them from the column cache (ECCacheManager::GetColumns).
+ *
+ * Usage: columncachetime [-n rows] [-q queries] [-b batch]
+ *
+ * Both caches are filled with the same folder; the program exits with a
+ * failure status if they return different cells.
+ */
+
+static const configsetting_t cfg_defaults[] = {
+	{"cache_acl_size", "1M", CONFIGSETTING_SIZE},
+	{"cache_cell_size", "1G", CONFIGSETTING_SIZE},
+	{"cache_column_size", "1G", CONFIGSETTING_SIZE},
+	{"cache_indexedobject_size", "0", CONFIGSETTING_SIZE},
+	{"cache_object_size", "0", CONFIGSETTING_SIZE},
+	{"cache_quota_lifetime", "1"},
+	{"cache_quota_size", "0", CONFIGSETTING_SIZE},
+	{"cache_server_lifetime", "30"},
+	{"cache_server_size", "1M", CONFIGSETTING_SIZE},
+	{"cache_shards", "16"},
+	{"cache_snapshot_file", ""},
+	{"cache_store_size", "1M", CONFIGSETTING_SIZE},
+	{"cache_user_size", "1M", CONFIGSETTING_SIZE},
+	{"cache_userdetails_lifetime", "0"},
+	{"cache_userdetails_size", "0", CONFIGSETTING_SIZE},
+	{nullptr, nullptr},
+};
+
+/* A typical message list view */
+static unsigned int columns[] = {
+	PR_MESSAGE_DELIVERY_TIME, PR_MESSAGE_FLAGS, PR_MESSAGE_SIZE,
+	PR_IMPORTANCE, PR_HASATTACH, PR_FLAG_STATUS, PR_SUBJECT_W,
+	PR_SENDER_NAME_W, PR_DISPLAY_TO_W, PR_MESSAGE_CLASS_W,
+};
+
+static void make_cell(std::mt19937 &rng, struct soap *soap, unsigned int tag,
+    struct propVal &pv)
+{
+	static const char *const subjects[] = {"meeting notes", "Re: quarterly report", "invoice 2026-04", "Fwd: server update", "[kopano-dev] release planning"};
+	static const char *const names[] = {"Alice Smith", "Bob Jones", "Jürgen Schmidt", "Søren Ødegaard", "Carol Miller"};
+	static const char *const classes[] = {"IPM.Note", "IPM.Note", "IPM.Note", "IPM.Schedule.Meeting.Request"};
+
+	pv.ulPropTag = tag;
+	switch (PROP_TYPE(tag)) {
+	case PT_SYSTIME:
+		pv.__union = SOAP_UNION_propValData_hilo;
+		pv.Value.hilo = soap_new_hiloLong(soap);
+		pv.Value.hilo->hi = 30000000 + rng() % 1000;
+		pv.Value.hilo->lo = rng();
+		return;
+	case PT_BOOLEAN:
+		pv.__union = SOAP_UNION_propValData_b;
+		pv.Value.b = rng() % 3 == 0;
+		return;
+	case PT_LONG:
+		if (tag == PR_FLAG_STATUS && rng() % 10 != 0) {
+			/* mostly not set */
+			pv.ulPropTag = CHANGE_PROP_TYPE(tag, PT_ERROR);
+			pv.__union = SOAP_UNION_propValData_ul;
+			pv.Value.ul = KCERR_NOT_FOUND;
+			return;
+		}
+		pv.__union = SOAP_UNION_propValData_ul;
+		pv.Value.ul = tag == PR_MESSAGE_SIZE ? 1000 + rng() % 100000 : rng() % 4;
+		return;
+	}
+	const char *str;
+	if (tag == PR_SUBJECT_W)
+		str = subjects[rng() % ARRAY_SIZE(subjects)];
+	else if (tag == PR_MESSAGE_CLASS_W)
+		str = classes[rng() % ARRAY_SIZE(classes)];
+	else
+		str = names[rng() % ARRAY_SIZE(names)];
+	pv.__union = SOAP_UNION_propValData_lpszA;
+	pv.Value.lpszA = soap_new_byte(soap, strlen(str) + 1);
+	strcpy(pv.Value.lpszA, str);
+}
+
+static bool same_cell(const struct propVal &a, const struct propVal &b)
+{
+	if (a.ulPropTag != b.ulPropTag || a.__union != b.__union)
+		return false;
+	switch (a.__union) {
+	case SOAP_UNION_propValData_ul:
+		return a.Value.ul == b.Value.ul;
+	case SOAP_UNION_propValData_b:
+		return a.Value.b == b.Value.b;
+	case SOAP_UNION_propValData_hilo:
+		return a.Value.hilo->hi == b.Value.hilo->hi && a.Value.hilo->lo == b.Value.hilo->lo;
+	case SOAP_UNION_propValData_lpszA:
+		return strcmp(a.Value.lpszA, b.Value.lpszA) == 0;
+	}
+	return false;
+}
+
+static struct rowSet *new_rowset(struct soap *soap, size_t nrows, size_t ncols)
+{
+	auto rs = soap_new_rowSet(soap);
+	rs->__size = nrows;
+	rs->__ptr = soap_new_propValArray(soap, nrows);
+	for (size_t i = 0; i < nrows; ++i) {
+		rs->__ptr[i].__size = ncols;
+		rs->__ptr[i].__ptr = soap_new_propVal(soap, ncols);
+	}
+	return rs;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nrows = 100000, nqueries = 10000, batch = 50, folder = 1000;
+	int c;
+	while ((c = getopt(argc, argv, "b:n:q:")) != -1) {
+		if (c == 'b')
+			batch = strtoul(optarg, nullptr, 0);
+		else if (c == 'n')
+			nrows = strtoul(optarg, nullptr, 0);
+		else if (c == 'q')
+			nqueries = strtoul(optarg, nullptr, 0);
+		else
+			return EXIT_FAILURE;
+	}
+	if (nrows == 0 || batch == 0 || batch > nrows)
+		return EXIT_FAILURE;
+
+	std::shared_ptr<ECConfig> cfg(ECConfig::Create(cfg_defaults));
+	ECCacheManager cache(cfg, nullptr);
+	unsigned int ncols = ARRAY_SIZE(columns);
+	propTagArray tags(columns, ncols);
+	std::vector<unsigned int> cols;
+	for (unsigned int k = 0; k < ncols; ++k)
+		cols.emplace_back(k);
+
+	/* Fill both caches as a first pass over the folder would */
+	std::mt19937 rng(1);
+	auto soap = std::make_unique<struct soap>();
+	for (unsigned int first = 0; first < nrows; first += batch) {
+		ECObjectTableList rows;
+		for (unsigned int i = first; i < nrows && i < first + batch; ++i)
+			rows.emplace_back(i + 1, 0);
+		auto rs = new_rowset(soap.get(), rows.size(), ncols);
+		unsigned int i = 0;
+		for (const auto &row : rows) {
+			for (unsigned int k = 0; k < ncols; ++k) {
+				auto &pv = rs->__ptr[i].__ptr[k];
+				make_cell(rng, soap.get(), columns[k], pv);
+				cache.SetCell(&row, columns[k], &pv);
+			}
+			++i;
+		}
+		cache.SetColumns(folder, rows, &tags, cols, rs, std::vector<bool>(rows.size() * ncols));
+		soap_destroy(soap.get());
+		soap_end(soap.get());
+	}
+
+	/* Random pages, like a client scrolling the table */
+	std::vector<ECObjectTableList> pages(nqueries);
+	for (auto &p : pages) {
+		auto first = rng() % (nrows - batch + 1);
+		for (unsigned int i = 0; i < batch; ++i)
+			p.emplace_back(first + i + 1, 0);
+	}
+	auto start = clk::now();
+	for (const auto &p : pages) {
+		auto rs = new_rowset(soap.get(), p.size(), ncols);
+		unsigned int i = 0;
+		for (const auto &row : p) {
+			for (unsigned int k = 0; k < ncols; ++k)
+				cache.GetCell(&row, columns[k], &rs->__ptr[i].__ptr[k], soap.get());
+			++i;
+		}
+		soap_destroy(soap.get());
+		soap_end(soap.get());
+	}
+	auto cells = clk::now() - start;
+
+	start = clk::now();
+	std::vector<bool> done(batch * ncols);
+	for (const auto &p : pages) {
+		auto rs = new_rowset(soap.get(), p.size(), ncols);
+		done.assign(done.size(), false);
+		cache.GetColumns(folder, p, &tags, cols, soap.get(), rs, done);
+		soap_destroy(soap.get());
+		soap_end(soap.get());
+	}
+	auto columnar = clk::now() - start;
+
+	/* Both must give the same cells */
+	unsigned int bad = 0, missed = 0;
+	for (const auto &p : pages) {
+		auto a = new_rowset(soap.get(), p.size(), ncols);
+		auto b = new_rowset(soap.get(), p.size(), ncols);
+		done.assign(done.size(), false);
+		cache.GetColumns(folder, p, &tags, cols, soap.get(), b, done);
+		unsigned int i = 0;
+		for (const auto &row : p) {
+			for (unsigned int k = 0; k < ncols; ++k) {
+				cache.GetCell(&row, columns[k], &a->__ptr[i].__ptr[k], soap.get());
+				if (!done[i * ncols + k])
+					++missed;
+				else if (!same_cell(a->__ptr[i].__ptr[k], b->__ptr[i].__ptr[k]))
+					++bad;
+			}
+			++i;
+		}
+		soap_destroy(soap.get());
+		soap_end(soap.get());
+	}
+
+	double n = static_cast<double>(nqueries) * batch;
+	double x = nsec_per(cells, n), y = nsec_per(columnar, n);
+	printf("%u rows, %u columns, %u x QueryRows(%u)\n", nrows, ncols, nqueries, batch);
+	printf("cell cache    %8.1f ns/row\n", x);
+	printf("column cache  %8.1f ns/row (%.1fx)\n", y, y > 0 ? x / y : 0);
+	if (bad != 0 || missed != 0) {
+		fprintf(stderr, "%u cells differ, %u not in the column cache\n", bad, missed);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
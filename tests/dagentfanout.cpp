@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Fan-out benchmark for kopano-dagent: delivers one message over LMTP to
+ * many recipients at once, like a company-wide announcement, and reports
+ * how long the delivery took. With -P and the pid of a dagent on the same
+ * host (process_model=thread), it also reports the bytes the dagent read
+ * and wrote meanwhile, which is mostly its SOAP traffic to the server;
+ * compare runs with server_side_copies on and off.
+ *
+ * Usage: dagentfanout [-h host] [-p port] [-n recipients] [-r pattern]
+ *        [-s attachment-kB] [-P dagent-pid]
+ *
+ * The recipient pattern is a printf format for the recipient number
+ * (default "user%u@localhost", numbered from 1); the users must exist.
+ */
+
+using clk = std::chrono::steady_clock;
+
+struct io_usage {
+	unsigned long long rchar = 0, wchar = 0;
+};
+
+static io_usage io_of(const char *pid)
+{
+	io_usage u;
+	if (pid == nullptr)
+		return u;
+	auto f = fopen(("/proc/" + std::string(pid) + "/io").c_str(), "r");
+	if (f == nullptr)
+		return u;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != nullptr) {
+		if (strncmp(line, "rchar:", 6) == 0)
+			u.rchar = strtoull(line + 6, nullptr, 10);
+		else if (strncmp(line, "wchar:", 6) == 0)
+			u.wchar = strtoull(line + 6, nullptr, 10);
+	}
+	fclose(f);
+	return u;
+}
+
+class lmtp_conn {
+	public:
+	~lmtp_conn()
+	{
+		if (m_fd >= 0)
+			close(m_fd);
+	}
+	bool open(const char *host, const char *port)
+	{
+		struct addrinfo hints{}, *ai = nullptr;
+		hints.ai_socktype = SOCK_STREAM;
+		auto err = getaddrinfo(host, port, &hints, &ai);
+		if (err != 0) {
+			fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(err));
+			return false;
+		}
+		for (auto p = ai; p != nullptr && m_fd < 0; p = p->ai_next) {
+			m_fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+			if (m_fd >= 0 && connect(m_fd, p->ai_addr, p->ai_addrlen) < 0) {
+				close(m_fd);
+				m_fd = -1;
+			}
+		}
+		freeaddrinfo(ai);
+		if (m_fd < 0)
+			perror("connect");
+		return m_fd >= 0;
+	}
+	bool send(const std::string &s)
+	{
+		size_t done = 0;
+		while (done < s.size()) {
+			auto n = ::send(m_fd, s.c_str() + done, s.size() - done, MSG_NOSIGNAL);
+			if (n <= 0)
+				return false;
+			done += n;
+		}
+		return true;
+	}
+	/* Reads one (possibly multiline) reply, returns its code */
+	int reply(std::string *text = nullptr)
+	{
+		for (;;) {
+			auto nl = m_in.find('\n');
+			if (nl == std::string::npos) {
+				char buf[4096];
+				auto n = recv(m_fd, buf, sizeof(buf), 0);
+				if (n <= 0)
+					return -1;
+				m_in.append(buf, n);
+				continue;
+			}
+			auto line = m_in.substr(0, nl);
+			m_in.erase(0, nl + 1);
+			if (line.size() >= 4 && line[3] == '-')
+				continue;
+			if (text != nullptr)
+				*text = line;
+			return atoi(line.c_str());
+		}
+	}
+
+	private:
+	int m_fd = -1;
+	std::string m_in;
+};
+
+/* A plain message with one attachment of @kb kilobytes */
+static std::string make_message(unsigned int kb)
+{
+	std::string m =
+		"From: <fanout@localhost>\r\n"
+		"To: <all@localhost>\r\n"
+		"Subject: dagentfanout\r\n"
+		"Message-ID: <dagentfanout." + std::to_string(getpid()) + "@localhost>\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: multipart/mixed; boundary=\"b\"\r\n\r\n"
+		"--b\r\n"
+		"Content-Type: text/plain; charset=us-ascii\r\n\r\n"
+		"Company-wide announcement.\r\n"
+		"--b\r\n"
+		"Content-Type: application/octet-stream; name=\"data.bin\"\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"Content-Disposition: attachment; filename=\"data.bin\"\r\n\r\n";
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	/* 76 characters a line carry 57 bytes */
+	unsigned int seed = 1;
+	for (size_t bytes = 0; bytes < kb * 1024ULL; bytes += 57) {
+		for (unsigned int i = 0; i < 76; ++i) {
+			seed = seed * 1103515245 + 12345;
+			m += b64[(seed >> 16) & 63];
+		}
+		m += "\r\n";
+	}
+	m += "--b--\r\n";
+	return m;
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = "localhost", *port = "2003", *pid = nullptr;
+	const char *pattern = "user%u@localhost";
+	unsigned int nrcpt = 1000, kb = 512;
+	int c;
+
+	while ((c = getopt(argc, argv, "P:h:n:p:r:s:")) != -1) {
+		switch (c) {
+		case 'P': pid = optarg; break;
+		case 'h': host = optarg; break;
+		case 'n': nrcpt = strtoul(optarg, nullptr, 0); break;
+		case 'p': port = optarg; break;
+		case 'r': pattern = optarg; break;
+		case 's': kb = strtoul(optarg, nullptr, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-h host] [-p port] [-n recipients] [-r pattern] [-s attachment-kB] [-P dagent-pid]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	auto msg = make_message(kb);
+	lmtp_conn lc;
+	std::string text;
+	if (!lc.open(host, port))
+		return EXIT_FAILURE;
+	if (lc.reply(&text) != 220) {
+		fprintf(stderr, "greeting: %s\n", text.c_str());
+		return EXIT_FAILURE;
+	}
+	lc.send("LHLO dagentfanout\r\n");
+	if (lc.reply(&text) != 250) {
+		fprintf(stderr, "LHLO: %s\n", text.c_str());
+		return EXIT_FAILURE;
+	}
+
+	auto before = io_of(pid);
+	auto start = clk::now();
+	lc.send("MAIL FROM:<fanout@localhost>\r\n");
+	if (lc.reply(&text) != 250) {
+		fprintf(stderr, "MAIL FROM: %s\n", text.c_str());
+		return EXIT_FAILURE;
+	}
+	unsigned int accepted = 0;
+	char rcpt[512];
+	for (unsigned int i = 1; i <= nrcpt; ++i) {
+		snprintf(rcpt, sizeof(rcpt), pattern, i);
+		lc.send("RCPT TO:<" + std::string(rcpt) + ">\r\n");
+		if (lc.reply(&text) == 250)
+			++accepted;
+		else
+			fprintf(stderr, "RCPT %s: %s\n", rcpt, text.c_str());
+	}
+	if (accepted == 0)
+		return EXIT_FAILURE;
+	lc.send("DATA\r\n");
+	if (lc.reply(&text) != 354) {
+		fprintf(stderr, "DATA: %s\n", text.c_str());
+		return EXIT_FAILURE;
+	}
+	auto data_start = clk::now();
+	lc.send(msg + ".\r\n");
+	/* LMTP answers once per accepted recipient */
+	unsigned int delivered = 0;
+	for (unsigned int i = 0; i < accepted; ++i) {
+		auto code = lc.reply(&text);
+		if (code < 0)
+			break;
+		if (code == 250)
+			++delivered;
+		else
+			fprintf(stderr, "delivery: %s\n", text.c_str());
+	}
+	auto end = clk::now();
+	auto after = io_of(pid);
+	lc.send("QUIT\r\n");
+	lc.reply();
+
+	auto secs = std::chrono::duration<double>(end - start).count();
+	auto data_secs = std::chrono::duration<double>(end - data_start).count();
+	printf("%u of %u recipients delivered, message %zu bytes\n",
+	       delivered, nrcpt, msg.size());
+	printf("%.2f s total, %.2f s after DATA, %.2f ms per recipient\n",
+	       secs, data_secs, delivered > 0 ? data_secs * 1000 / delivered : 0.0);
+	if (pid != nullptr)
+		printf("dagent: read %llu, wrote %llu bytes (%.1f kB written per recipient)\n",
+		       after.rchar - before.rchar, after.wchar - before.wchar,
+		       delivered > 0 ? (after.wchar - before.wchar) / 1024.0 / delivered : 0.0);
+	return delivered == nrcpt ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+/*
+ * Load generator for kopano-gateway: opens many IMAP connections that log
+ * in, select a folder and then sit in IDLE, like the mail clients of a
+ * large site do. With -P and the pid of a gateway on the same host, it
+ * reports the memory and the threads the gateway takes per idle
+ * connection, which is what process_model=event is about; with -n large
+ * enough, how many connections it manages at all.
+ *
+ * Usage: gwidleload [-h host] [-p port] [-n connections] [-u user]
+ *        [-w password] [-f folder] [-P gateway-pid] [-d seconds]
+ *
+ * All connections use the same user. They stay in IDLE for -d seconds
+ * (default 10) once the last one got there, and then log out.
+ */
+
+using clk = std::chrono::steady_clock;
+
+enum state { S_GREETING, S_LOGIN, S_SELECT, S_IDLE, S_IDLING, S_FAILED };
+
+struct client {
+	int fd = -1;
+	state st = S_GREETING;
+	std::string in;
+};
+
+struct usage {
+	long rss_kb = 0, threads = 0;
+};
+
+static usage usage_of(const char *pid)
+{
+	usage u;
+	if (pid == nullptr)
+		return u;
+	auto f = fopen(("/proc/" + std::string(pid) + "/status").c_str(), "r");
+	if (f == nullptr)
+		return u;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != nullptr) {
+		if (strncmp(line, "VmRSS:", 6) == 0)
+			u.rss_kb = strtol(line + 6, nullptr, 10);
+		else if (strncmp(line, "Threads:", 8) == 0)
+			u.threads = strtol(line + 8, nullptr, 10);
+	}
+	fclose(f);
+	return u;
+}
+
+static int connect_to(const struct addrinfo *ai)
+{
+	int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool send_line(client &c, const std::string &s)
+{
+	auto line = s + "\r\n";
+	if (send(c.fd, line.c_str(), line.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(line.size()))
+		return true;
+	c.st = S_FAILED;
+	return false;
+}
+
+/* Moves the client along as the responses come in */
+static void on_line(client &c, const std::string &line, const std::string &login,
+    const std::string &folder)
+{
+	switch (c.st) {
+	case S_GREETING:
+		if (line.compare(0, 4, "* OK") != 0)
+			break;
+		c.st = S_LOGIN;
+		send_line(c, "a LOGIN " + login);
+		return;
+	case S_LOGIN:
+		if (line.compare(0, 2, "a ") != 0)
+			return;
+		if (line.compare(2, 2, "OK") != 0)
+			break;
+		c.st = S_SELECT;
+		send_line(c, "b SELECT \"" + folder + "\"");
+		return;
+	case S_SELECT:
+		if (line.compare(0, 2, "b ") != 0)
+			return;
+		if (line.compare(2, 2, "OK") != 0)
+			break;
+		c.st = S_IDLE;
+		send_line(c, "c IDLE");
+		return;
+	case S_IDLE:
+		if (line.compare(0, 2, "+ ") == 0)
+			c.st = S_IDLING;
+		else if (line.compare(0, 2, "c ") == 0)
+			break;
+		return;
+	default:
+		return;
+	}
+	fprintf(stderr, "fd %d: unexpected \"%s\"\n", c.fd, line.c_str());
+	c.st = S_FAILED;
+}
+
+/* Processes input on all clients for up to @ms milliseconds */
+static void pump(std::vector<client> &cl, std::vector<struct pollfd> &pfd,
+    const std::string &login, const std::string &folder, int ms)
+{
+	pfd.resize(cl.size());
+	for (size_t i = 0; i < cl.size(); ++i) {
+		pfd[i].fd = cl[i].st == S_FAILED ? -1 : cl[i].fd;
+		pfd[i].events = POLLIN;
+		pfd[i].revents = 0;
+	}
+	if (poll(pfd.data(), pfd.size(), ms) <= 0)
+		return;
+	char buf[4096];
+	for (size_t i = 0; i < cl.size(); ++i) {
+		if (pfd[i].revents == 0)
+			continue;
+		auto &c = cl[i];
+		auto n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n <= 0) {
+			if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+				fprintf(stderr, "fd %d: connection closed\n", c.fd);
+				c.st = S_FAILED;
+			}
+			continue;
+		}
+		c.in.append(buf, n);
+		size_t nl;
+		while (c.st != S_FAILED && (nl = c.in.find('\n')) != std::string::npos) {
+			auto line = c.in.substr(0, nl > 0 && c.in[nl-1] == '\r' ? nl - 1 : nl);
+			c.in.erase(0, nl + 1);
+			on_line(c, line, login, folder);
+		}
+	}
+}
+
+static size_t count(const std::vector<client> &cl, state st)
+{
+	size_t n = 0;
+	for (const auto &c : cl)
+		n += c.st == st;
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = "localhost", *port = "143", *user = "user1";
+	const char *pass = "user1", *folder = "INBOX", *pid = nullptr;
+	unsigned int nconn = 1000, duration = 10, batch = 100;
+	int c;
+
+	while ((c = getopt(argc, argv, "P:d:f:h:n:p:u:w:")) != -1) {
+		switch (c) {
+		case 'P': pid = optarg; break;
+		case 'd': duration = strtoul(optarg, nullptr, 0); break;
+		case 'f': folder = optarg; break;
+		case 'h': host = optarg; break;
+		case 'n': nconn = strtoul(optarg, nullptr, 0); break;
+		case 'p': port = optarg; break;
+		case 'u': user = optarg; break;
+		case 'w': pass = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-h host] [-p port] [-n connections] [-u user] [-w password] [-f folder] [-P gateway-pid] [-d seconds]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < nconn + 64) {
+		rl.rlim_cur = std::min(static_cast<rlim_t>(nconn + 64), rl.rlim_max);
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	struct addrinfo hints{}, *ai = nullptr;
+	hints.ai_socktype = SOCK_STREAM;
+	auto err = getaddrinfo(host, port, &hints, &ai);
+	if (err != 0) {
+		fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(err));
+		return EXIT_FAILURE;
+	}
+
+	auto login = std::string(user) + " \"" + pass + "\"";
+	auto before = usage_of(pid);
+	std::vector<client> cl;
+	std::vector<struct pollfd> pfd;
+	cl.reserve(nconn);
+	auto start = clk::now();
+	while (cl.size() < nconn) {
+		/* A batch at a time, so the gateway is not flooded with logins */
+		for (unsigned int i = 0; i < batch && cl.size() < nconn; ++i) {
+			client n;
+			n.fd = connect_to(ai);
+			if (n.fd < 0) {
+				fprintf(stderr, "connect %zu: %s\n", cl.size(), strerror(errno));
+				nconn = cl.size();
+				break;
+			}
+			cl.emplace_back(std::move(n));
+		}
+		auto until = clk::now() + std::chrono::seconds(30);
+		while (count(cl, S_IDLING) + count(cl, S_FAILED) < cl.size() && clk::now() < until)
+			pump(cl, pfd, login, folder, 100);
+	}
+	auto setup = clk::now() - start;
+	auto idling = count(cl, S_IDLING);
+	auto after = usage_of(pid);
+	freeaddrinfo(ai);
+
+	printf("%zu connections idling, %zu failed, set up in %.1f s\n",
+	       idling, count(cl, S_FAILED),
+	       std::chrono::duration<double>(setup).count());
+	if (pid != nullptr && idling > 0)
+		printf("gateway: RSS %ld -> %ld kB (%.1f kB per connection), threads %ld -> %ld\n",
+		       before.rss_kb, after.rss_kb,
+		       static_cast<double>(after.rss_kb - before.rss_kb) / idling,
+		       before.threads, after.threads);
+
+	/* Keep them idle; notifications for new mail would come in here */
+	auto until = clk::now() + std::chrono::seconds(duration);
+	while (clk::now() < until)
+		pump(cl, pfd, login, folder, 100);
+	for (auto &k : cl) {
+		if (k.st == S_IDLING)
+			send_line(k, "DONE\r\nd LOGOUT");
+		close(k.fd);
+	}
+	return idling == cl.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
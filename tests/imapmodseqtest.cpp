@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <kopano/platform.h>
+#include "../gateway/IMAPModSeq.h"
+
+/*
+ * Tests of the CONDSTORE/QRESYNC helpers of the IMAP gateway: parsing of
+ * the SELECT parameters and FETCH modifiers, sequence sets, and the UIDs
+ * reported in VANISHED.
+ */
+
+static unsigned int failures;
+
+#define CHECK(c) do { \
+		if (!(c)) { \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); \
+			++failures; \
+		} \
+	} while (false)
+
+static imap_uid_ranges R(std::initializer_list<std::pair<ULONG, ULONG>> l)
+{
+	return imap_uid_ranges(l);
+}
+
+static void test_select()
+{
+	imap_select_params sp;
+	CHECK(imap_parse_select_params("(CONDSTORE)", false, sp));
+	CHECK(sp.condstore && !sp.qresync);
+
+	sp = imap_select_params();
+	CHECK(imap_parse_select_params("(condstore)", false, sp));
+	CHECK(sp.condstore);
+
+	sp = imap_select_params();
+	CHECK(imap_parse_select_params("(QRESYNC (67890007 4242 41,43:211,214:541))", true, sp));
+	CHECK(sp.qresync && !sp.condstore);
+	CHECK(sp.uidvalidity == 67890007 && sp.modseq == 4242);
+	CHECK(sp.known_uids == "41,43:211,214:541");
+
+	/* The seq-match-data list is not taken for the known UIDs */
+	sp = imap_select_params();
+	CHECK(imap_parse_select_params("(QRESYNC (1 5 (1:10 100:109)))", true, sp));
+	CHECK(sp.uidvalidity == 1 && sp.modseq == 5 && sp.known_uids.empty());
+	sp = imap_select_params();
+	CHECK(imap_parse_select_params("(QRESYNC (1 5 1:* (1:10 100:109)))", true, sp));
+	CHECK(sp.known_uids == "1:*");
+
+	sp = imap_select_params();
+	CHECK(imap_parse_select_params("(CONDSTORE QRESYNC (3 4))", true, sp));
+	CHECK(sp.condstore && sp.qresync && sp.uidvalidity == 3 && sp.modseq == 4);
+
+	/* QRESYNC needs ENABLE QRESYNC, and at least uidvalidity and modseq */
+	sp = imap_select_params();
+	CHECK(!imap_parse_select_params("(QRESYNC (1 5))", false, sp));
+	CHECK(!imap_parse_select_params("(QRESYNC (1))", true, sp));
+	CHECK(!imap_parse_select_params("(QRESYNC)", true, sp));
+	CHECK(!imap_parse_select_params("(QRESYNC 1 5)", true, sp));
+	CHECK(!imap_parse_select_params("(FOO)", true, sp));
+	CHECK(!imap_parse_select_params("()", true, sp));
+	CHECK(!imap_parse_select_params("CONDSTORE", true, sp));
+}
+
+static void test_fetch()
+{
+	imap_fetch_modifiers fm;
+	std::string err;
+	CHECK(imap_parse_fetch_modifiers({}, false, false, fm, err));
+	CHECK(!fm.changedsince && !fm.vanished);
+
+	fm = imap_fetch_modifiers();
+	CHECK(imap_parse_fetch_modifiers({"CHANGEDSINCE", "12345"}, false, false, fm, err));
+	CHECK(fm.changedsince && fm.modseq == 12345 && !fm.vanished);
+
+	fm = imap_fetch_modifiers();
+	CHECK(imap_parse_fetch_modifiers({"CHANGEDSINCE", "7", "VANISHED"}, true, true, fm, err));
+	CHECK(fm.changedsince && fm.vanished && fm.modseq == 7);
+	fm = imap_fetch_modifiers();
+	CHECK(imap_parse_fetch_modifiers({"VANISHED", "CHANGEDSINCE", "7"}, true, true, fm, err));
+	CHECK(fm.changedsince && fm.vanished);
+
+	/* VANISHED only for UID FETCH after ENABLE QRESYNC, and with CHANGEDSINCE */
+	fm = imap_fetch_modifiers();
+	CHECK(!imap_parse_fetch_modifiers({"CHANGEDSINCE", "7", "VANISHED"}, false, true, fm, err));
+	CHECK(err == "invalid modifier VANISHED");
+	fm = imap_fetch_modifiers();
+	CHECK(!imap_parse_fetch_modifiers({"CHANGEDSINCE", "7", "VANISHED"}, true, false, fm, err));
+	fm = imap_fetch_modifiers();
+	CHECK(!imap_parse_fetch_modifiers({"VANISHED"}, true, true, fm, err));
+	CHECK(err == "VANISHED requires CHANGEDSINCE");
+
+	fm = imap_fetch_modifiers();
+	CHECK(!imap_parse_fetch_modifiers({"CHANGEDSINCE"}, true, true, fm, err));
+	CHECK(err == "invalid modifier CHANGEDSINCE");
+	fm = imap_fetch_modifiers();
+	CHECK(!imap_parse_fetch_modifiers({"FOO"}, true, true, fm, err));
+	CHECK(err == "invalid modifier FOO");
+}
+
+static void test_seq_ranges()
+{
+	CHECK(imap_seq_ranges({}) == "");
+	CHECK(imap_seq_ranges(R({{5, 5}})) == "5");
+	CHECK(imap_seq_ranges(R({{1, 3}})) == "1:3");
+	CHECK(imap_seq_ranges(R({{1, 1}, {2, 2}, {3, 3}, {7, 7}})) == "1:3,7");
+	CHECK(imap_seq_ranges(R({{1, 4}, {3, 9}, {11, 12}})) == "1:9,11:12");
+	CHECK(imap_seq_ranges(R({{1, 10}, {2, 3}, {12, 12}})) == "1:10,12");
+	CHECK(imap_seq_ranges(R({{4294967294U, 4294967295U}})) == "4294967294:4294967295");
+	/* No wraparound when joining at the top of the UID space */
+	CHECK(imap_seq_ranges(R({{1, 4294967295U}})) == "1:4294967295");
+}
+
+static void test_vanished()
+{
+	std::vector<std::pair<ULONG, ULONG>> vanished = {{10, 7}, {12, 3}, {12, 4}, {15, 20}, {9, 1}};
+	CHECK(imap_vanished_after(0, vanished) == R({{1, 1}, {3, 3}, {4, 4}, {7, 7}, {20, 20}}));
+	CHECK(imap_vanished_after(10, vanished) == R({{3, 3}, {4, 4}, {20, 20}}));
+	CHECK(imap_vanished_after(15, vanished).empty());
+	CHECK(imap_seq_ranges(imap_vanished_after(9, vanished)) == "3:4,7,20");
+
+	std::vector<ULONG> uids = {2, 3, 5, 9};
+	CHECK(imap_uid_gaps(uids.cbegin(), uids.cend(), 12) == R({{1, 1}, {4, 4}, {6, 8}, {10, 12}}));
+	CHECK(imap_uid_gaps(uids.cbegin(), uids.cend(), 9) == R({{1, 1}, {4, 4}, {6, 8}}));
+	CHECK(imap_uid_gaps(uids.cbegin(), uids.cend(), 0) == R({{1, 1}, {4, 4}, {6, 8}}));
+	CHECK(imap_uid_gaps(uids.cend(), uids.cend(), 3) == R({{1, 3}}));
+	CHECK(imap_uid_gaps(uids.cend(), uids.cend(), 0).empty());
+
+	auto gone = R({{1, 1}, {4, 4}, {6, 8}, {10, 12}});
+	CHECK(imap_uid_set_filter(gone, "", 12) == gone);
+	CHECK(imap_uid_set_filter(gone, "1:*", 12) == gone);
+	CHECK(imap_uid_set_filter(gone, "5:7", 12) == R({{6, 7}}));
+	CHECK(imap_uid_set_filter(gone, "7:5", 12) == R({{6, 7}}));
+	CHECK(imap_uid_set_filter(gone, "2,4,11:*", 12) == R({{4, 4}, {11, 12}}));
+	CHECK(imap_uid_set_filter(gone, "*", 12) == R({{12, 12}}));
+	CHECK(imap_uid_set_filter(gone, "2:3,5,9", 12).empty());
+	CHECK(imap_seq_ranges(imap_uid_set_filter(gone, "1:4,5:9", 12)) == "1,4,6:8");
+}
+
+int main()
+{
+	test_select();
+	test_fetch();
+	test_seq_ranges();
+	test_vanished();
+	if (failures != 0) {
+		fprintf(stderr, "%u checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("ok\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,793 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <kopano/platform.h>
+#include <kopano/ECKeyTable.h>
+
+using namespace KC;
+
+/*
+ * Randomized differential test of ECKeyTable: every operation is applied
+ * both to an ECKeyTable and to a plain sorted vector that implements the
+ * documented semantics the slow and obvious way, and the results are
+ * compared after every step.
+ *
+ * Usage: keytabletest [-b big_rounds] [-k keys] [-r rounds] [-n ops] [-s seed]
+ *
+ * Row ids are drawn from @keys ids, which bounds the table size. The big
+ * rounds use 100 times as many ids and 16 times as many operations, so that
+ * the tree can get more than two levels.
+ *
+ * Sort keys have one to three binary columns over a tiny alphabet (so that
+ * ties and category prefixes are frequent), with the second column
+ * descending. A sentinel row without columns sorts before all others;
+ * GetRowsBySortPrefix on it lists the whole table, hidden rows included.
+ */
+
+namespace {
+
+static const sObjectTableKey sentinel(0xFFFFFFFF, 0);
+
+struct mrow {
+	sObjectTableKey key;
+	std::vector<ECSortCol> cols;
+	bool hidden = false;
+};
+
+struct mbookmark {
+	unsigned int first;
+	sKeyTablePos pos;
+};
+
+static int colcmp(const ECSortCol &a, const ECSortCol &b)
+{
+	if (a.isnull || b.isnull)
+		return a.isnull == b.isnull ? 0 : a.isnull ? -1 : 1;
+	auto c = a.key.compare(b.key);
+	return c < 0 ? -1 : c > 0;
+}
+
+/* a sorts before b, looking at the first @prefix columns */
+static bool mless(const std::vector<ECSortCol> &a,
+    const std::vector<ECSortCol> &b, size_t prefix = -1)
+{
+	for (size_t i = 0; i < prefix; ++i) {
+		if (i >= a.size() || i >= b.size())
+			return i >= a.size() && i < b.size();
+		auto c = colcmp(a[i], b[i]);
+		if (c != 0)
+			return a[i].flags & TABLEROW_FLAG_DESC ? c > 0 : c < 0;
+	}
+	return false;
+}
+
+/* The reference model */
+class mtable final {
+	public:
+	/* -1 is before the first row, rows.size() after the last */
+	int locate(const sKeyTablePos &p) const
+	{
+		if (p.ulWhere == sKeyTablePos::ON_ROW) {
+			auto i = find(p.sKey);
+			if (i >= 0)
+				return i;
+		}
+		return p.ulWhere == sKeyTablePos::BEFORE_FIRST ? -1 : rows.size();
+	}
+
+	sKeyTablePos store(int i) const
+	{
+		sKeyTablePos p;
+		if (i < 0) {
+			p.ulWhere = sKeyTablePos::BEFORE_FIRST;
+		} else if (static_cast<size_t>(i) >= rows.size()) {
+			p.ulWhere = sKeyTablePos::AFTER_LAST;
+		} else {
+			p.ulWhere = sKeyTablePos::ON_ROW;
+			p.sKey = rows[i].key;
+		}
+		return p;
+	}
+
+	int find(const sObjectTableKey &k) const
+	{
+		for (size_t i = 0; i < rows.size(); ++i)
+			if (rows[i].key == k)
+				return i;
+		return -1;
+	}
+
+	unsigned int visible() const
+	{
+		return std::count_if(rows.cbegin(), rows.cend(), [](const mrow &r) { return !r.hidden; });
+	}
+
+	unsigned int rank(int i) const
+	{
+		return std::count_if(rows.cbegin(), rows.cbegin() + i, [](const mrow &r) { return !r.hidden; });
+	}
+
+	int seek_visible(unsigned int r) const
+	{
+		if (visible() == 0)
+			return -1;
+		for (size_t i = 0; i < rows.size(); ++i)
+			if (!rows[i].hidden && r-- == 0)
+				return i;
+		return rows.size();
+	}
+
+	unsigned int current_row(const sKeyTablePos &p) const
+	{
+		auto i = locate(p);
+		if (i < 0)
+			return 0;
+		if (static_cast<size_t>(i) >= rows.size())
+			return visible();
+		return rank(i);
+	}
+
+	ECRESULT del(const sObjectTableKey &k)
+	{
+		auto i = find(k);
+		if (i < 0)
+			return KCERR_NOT_FOUND;
+		bool on = cur.ulWhere == sKeyTablePos::ON_ROW && cur.sKey == k;
+		auto r = rank(i);
+		rows.erase(rows.begin() + i);
+		for (auto b = bookmarks.begin(); b != bookmarks.end(); )
+			if (b->second.pos.ulWhere == sKeyTablePos::ON_ROW && b->second.pos.sKey == k)
+				b = bookmarks.erase(b);
+			else
+				++b;
+		if (on)
+			cur = store(seek_visible(r));
+		return erSuccess;
+	}
+
+	ECRESULT modify(const sObjectTableKey &k, const std::vector<ECSortCol> &cols,
+	    sObjectTableKey *prev, bool hidden, ECKeyTable::UpdateType *action)
+	{
+		bool relocate = false;
+		auto i = find(k);
+		if (i >= 0) {
+			*action = ECKeyTable::TABLE_ROW_MODIFY;
+			if (!mless(rows[i].cols, cols) && !mless(cols, rows[i].cols)) {
+				*prev = i > 0 ? rows[i-1].key : sObjectTableKey(0, 0);
+				return erSuccess;
+			}
+			relocate = cur.ulWhere == sKeyTablePos::ON_ROW && cur.sKey == k;
+			del(k);
+		} else {
+			*action = ECKeyTable::TABLE_ROW_ADD;
+		}
+		size_t pos = 0;
+		while (pos < rows.size() && !mless(cols, rows[pos].cols))
+			++pos;
+		*prev = pos > 0 ? rows[pos-1].key : sObjectTableKey(0, 0);
+		rows.insert(rows.begin() + pos, mrow{k, cols, hidden});
+		if (relocate)
+			cur = store(pos);
+		return erSuccess;
+	}
+
+	ECRESULT get_bookmark(unsigned int bk, int *row) const
+	{
+		auto i = bookmarks.find(bk);
+		if (i == bookmarks.cend())
+			return KCERR_INVALID_BOOKMARK;
+		*row = current_row(i->second.pos);
+		return i->second.first != static_cast<unsigned int>(*row) ? KCWARN_POSITION_CHANGED : erSuccess;
+	}
+
+	ECRESULT seek(unsigned int origin, int to, int *sought)
+	{
+		auto count = visible();
+		auto current = current_row(cur);
+		int dest = 0;
+		ECRESULT er = erSuccess;
+		if (origin == ECKeyTable::EC_SEEK_SET) {
+			dest = to;
+		} else if (origin == ECKeyTable::EC_SEEK_CUR) {
+			dest = current + to;
+		} else if (origin == ECKeyTable::EC_SEEK_END) {
+			dest = count + to;
+		} else {
+			er = get_bookmark(origin, &dest);
+			if (er != erSuccess && er != KCWARN_POSITION_CHANGED)
+				return er;
+			dest += to;
+		}
+		dest = std::max(dest, 0);
+		if (static_cast<unsigned int>(dest) >= count)
+			dest = count;
+		if (sought != nullptr)
+			*sought = origin == ECKeyTable::EC_SEEK_SET ? dest :
+			          origin == ECKeyTable::EC_SEEK_END ? dest - static_cast<int>(count) :
+			          dest - static_cast<int>(current);
+		cur = store(seek_visible(dest));
+		return er;
+	}
+
+	void query(unsigned int n, ECObjectTableList &out, bool back, bool noadvance, bool show_hidden)
+	{
+		auto orig = cur;
+		if (back && cur.ulWhere == sKeyTablePos::AFTER_LAST)
+			seek(ECKeyTable::EC_SEEK_CUR, -1, nullptr);
+		else if (cur.ulWhere == sKeyTablePos::BEFORE_FIRST && visible() != 0)
+			seek(ECKeyTable::EC_SEEK_SET, 0, nullptr);
+		n = std::min(n, visible());
+		auto i = locate(cur);
+		while (n > 0 && i >= 0 && static_cast<size_t>(i) < rows.size()) {
+			if (!rows[i].hidden || show_hidden) {
+				out.emplace_back(rows[i].key);
+				--n;
+			}
+			i += back ? -1 : 1;
+		}
+		cur = noadvance ? orig : store(i);
+	}
+
+	ECRESULT by_prefix(const sObjectTableKey &k, ECObjectTableList &out) const
+	{
+		auto i = find(k);
+		if (i < 0)
+			return KCERR_NOT_FOUND;
+		const auto &prefix = rows[i].cols;
+		for (; static_cast<size_t>(i) < rows.size() && !mless(prefix, rows[i].cols, prefix.size()); ++i)
+			out.emplace_back(rows[i].key);
+		return erSuccess;
+	}
+
+	ECRESULT hide(const sObjectTableKey &k, ECObjectTableList &out)
+	{
+		auto i = find(k);
+		if (i < 0)
+			return KCERR_NOT_FOUND;
+		auto prefix = rows[i].cols;
+		bool cursor_hidden = false;
+		for (++i; static_cast<size_t>(i) < rows.size() && !mless(prefix, rows[i].cols, prefix.size()); ++i) {
+			out.emplace_back(rows[i].key);
+			rows[i].hidden = true;
+			if (cur.ulWhere == sKeyTablePos::ON_ROW && cur.sKey == rows[i].key)
+				cursor_hidden = true;
+		}
+		if (cursor_hidden) {
+			while (static_cast<size_t>(i) < rows.size() && rows[i].hidden)
+				++i;
+			cur = store(i);
+		}
+		return erSuccess;
+	}
+
+	ECRESULT unhide(const sObjectTableKey &k, ECObjectTableList &out)
+	{
+		auto i = find(k);
+		if (i < 0)
+			return KCERR_NOT_FOUND;
+		cur = store(i);
+		if (rows[i].hidden)
+			return KCERR_NOT_FOUND;
+		auto prefix = rows[i].cols;
+		cur = store(++i);
+		if (static_cast<size_t>(i) >= rows.size())
+			return erSuccess;
+		auto first = rows[i].cols.size();
+		for (; static_cast<size_t>(i) < rows.size() && !mless(prefix, rows[i].cols, prefix.size()); ++i) {
+			if (rows[i].cols.size() != first)
+				continue;
+			out.emplace_back(rows[i].key);
+			rows[i].hidden = false;
+		}
+		cur = store(i);
+		return erSuccess;
+	}
+
+	int lower_bound(const std::vector<ECSortCol> &cols) const
+	{
+		size_t i = 0;
+		while (i < rows.size() && mless(rows[i].cols, cols))
+			++i;
+		return i;
+	}
+
+	std::vector<mrow> rows;
+	sKeyTablePos cur;
+	std::map<unsigned int, mbookmark> bookmarks;
+	unsigned int next_bookmark = 3;
+};
+
+class tester final {
+	public:
+	tester(unsigned int seed, unsigned int keys) :
+		m_rng(seed), m_seed(seed), m_keys(keys)
+	{}
+	bool run(unsigned int nops);
+
+	private:
+	std::vector<ECSortCol> random_cols(size_t ncols = 0);
+	sObjectTableKey random_key(bool existing);
+	bool step();
+	bool verify();
+	bool fail(const char *what);
+	bool same(const ECObjectTableList &, const ECObjectTableList &, const char *what);
+
+	ECKeyTable m_kt;
+	mtable m_model;
+	std::mt19937 m_rng;
+	unsigned int m_seed, m_keys, m_op = 0;
+};
+
+std::vector<ECSortCol> tester::random_cols(size_t ncols)
+{
+	if (ncols == 0)
+		ncols = 1 + m_rng() % 3;
+	std::vector<ECSortCol> cols(ncols);
+	for (size_t i = 0; i < ncols; ++i) {
+		cols[i].flags = i == 1 ? TABLEROW_FLAG_DESC : 0;
+		if (m_rng() % 16 == 0) {
+			cols[i].isnull = true;
+			continue;
+		}
+		auto len = m_rng() % 3;
+		for (size_t j = 0; j < len; ++j)
+			cols[i].key += static_cast<char>('a' + m_rng() % 3);
+	}
+	return cols;
+}
+
+sObjectTableKey tester::random_key(bool existing)
+{
+	if (existing && !m_model.rows.empty() && m_rng() % 8 != 0) {
+		auto &r = m_model.rows[m_rng() % m_model.rows.size()];
+		if (r.key != sentinel)
+			return r.key;
+	}
+	return sObjectTableKey(1 + m_rng() % m_keys, m_rng() % 2);
+}
+
+bool tester::fail(const char *what)
+{
+	fprintf(stderr, "seed %u, operation %u: %s differs from the model\n", m_seed, m_op, what);
+	return false;
+}
+
+bool tester::same(const ECObjectTableList &a, const ECObjectTableList &b, const char *what)
+{
+	return a == b ? true : fail(what);
+}
+
+bool tester::step()
+{
+	ECRESULT er, mer;
+	sObjectTableKey prev, mprev;
+	ECKeyTable::UpdateType action, maction;
+	ECObjectTableList list, mlist;
+
+	switch (m_rng() % 16) {
+	case 0:
+	case 1:
+	case 2:
+	case 3: {
+		/* Add, or modify (also through TABLE_ROW_ADD) */
+		auto k = random_key(m_rng() % 2);
+		auto cols = random_cols();
+		bool hidden = m_rng() % 8 == 0;
+		auto type = m_rng() % 2 ? ECKeyTable::TABLE_ROW_ADD : ECKeyTable::TABLE_ROW_MODIFY;
+		mer = m_model.modify(k, cols, &mprev, hidden, &maction);
+		er = m_kt.UpdateRow(type, &k, std::move(cols), &prev, hidden, &action);
+		if (er != mer || prev != mprev || action != maction)
+			return fail("UpdateRow(add/modify)");
+		break;
+	}
+	case 4: {
+		auto k = random_key(true);
+		if (k == sentinel)
+			break;
+		mer = m_model.del(k);
+		er = m_kt.UpdateRow(ECKeyTable::TABLE_ROW_DELETE, &k, {}, nullptr, false, &action);
+		if (er != mer || (er == erSuccess && action != ECKeyTable::TABLE_ROW_DELETE))
+			return fail("UpdateRow(delete)");
+		break;
+	}
+	case 5: {
+		auto k = random_key(true);
+		size_t col = m_rng() % 3;
+		auto c = random_cols(col + 1)[col];
+		bool hidden = false, mhidden = false;
+		auto i = m_model.find(k);
+		if (i < 0 || k == sentinel) {
+			mer = KCERR_NOT_FOUND;
+		} else if (col >= m_model.rows[i].cols.size()) {
+			mer = KCERR_INVALID_PARAMETER;
+		} else {
+			auto cols = m_model.rows[i].cols;
+			cols[col] = c;
+			mhidden = m_model.rows[i].hidden;
+			mer = m_model.modify(k, cols, &mprev, mhidden, &maction);
+		}
+		if (k == sentinel)
+			break;
+		er = m_kt.UpdatePartialSortKey(&k, col, c, &prev, &hidden, &action);
+		if (er != mer || (er == erSuccess && (prev != mprev || action != maction || hidden != mhidden)))
+			return fail("UpdatePartialSortKey");
+		break;
+	}
+	case 6:
+	case 7: {
+		static const unsigned int origins[] = {ECKeyTable::EC_SEEK_SET, ECKeyTable::EC_SEEK_CUR, ECKeyTable::EC_SEEK_END};
+		unsigned int origin = m_rng() % 4 == 0 ? m_rng() % 12 : origins[m_rng() % 3];
+		int to = static_cast<int>(m_rng() % 41) - 20, sought = 0, msought = 0;
+		mer = m_model.seek(origin, to, &msought);
+		er = m_kt.SeekRow(origin, to, &sought);
+		if (er != mer || (er == erSuccess && sought != msought))
+			return fail("SeekRow");
+		break;
+	}
+	case 8:
+	case 9: {
+		unsigned int n = m_rng() % 30;
+		bool back = m_rng() % 3 == 0, noadv = m_rng() % 4 == 0, show = m_rng() % 4 == 0;
+		m_model.query(n, mlist, back, noadv, show);
+		er = m_kt.QueryRows(n, &list, back, noadv ? EC_TABLE_NOADVANCE : 0, show);
+		if (er != erSuccess)
+			return fail("QueryRows");
+		return same(list, mlist, "QueryRows");
+	}
+	case 10: {
+		if (m_rng() % 2) {
+			unsigned int bk = 0;
+			mer = erSuccess;
+			if (m_model.bookmarks.size() >= BOOKMARK_LIMIT)
+				mer = KCERR_UNABLE_TO_COMPLETE;
+			er = m_kt.CreateBookmark(&bk);
+			if (er != mer)
+				return fail("CreateBookmark");
+			if (er != erSuccess)
+				break;
+			if (bk != m_model.next_bookmark)
+				return fail("bookmark number");
+			m_model.bookmarks[m_model.next_bookmark++] = {m_model.current_row(m_model.cur), m_model.cur};
+		} else {
+			unsigned int bk = m_rng() % (m_model.next_bookmark + 2);
+			mer = m_model.bookmarks.erase(bk) > 0 ? erSuccess : KCERR_INVALID_BOOKMARK;
+			if (m_kt.FreeBookmark(bk) != mer)
+				return fail("FreeBookmark");
+		}
+		break;
+	}
+	case 11: {
+		/* Collapse */
+		auto k = random_key(true);
+		mer = m_model.hide(k, mlist);
+		er = m_kt.HideRows(&k, &list);
+		if (er != mer)
+			return fail("HideRows");
+		return same(list, mlist, "HideRows");
+	}
+	case 12: {
+		/* Expand */
+		auto k = random_key(true);
+		mer = m_model.unhide(k, mlist);
+		er = m_kt.UnhideRows(&k, &list);
+		if (er != mer)
+			return fail("UnhideRows");
+		return same(list, mlist, "UnhideRows");
+	}
+	case 13: {
+		auto k = random_key(true);
+		mer = m_model.by_prefix(k, mlist);
+		er = m_kt.GetRowsBySortPrefix(&k, &list);
+		if (er != mer)
+			return fail("GetRowsBySortPrefix");
+		return same(list, mlist, "GetRowsBySortPrefix");
+	}
+	case 14: {
+		auto cols = random_cols();
+		auto i = m_model.lower_bound(cols);
+		if (m_rng() % 2) {
+			m_model.cur = m_model.store(i);
+			if (m_kt.LowerBound(cols) != erSuccess)
+				return fail("LowerBound");
+			break;
+		}
+		sObjectTableKey k, mk;
+		mer = static_cast<size_t>(i) < m_model.rows.size() &&
+		      !mless(cols, m_model.rows[i].cols) ? erSuccess : KCERR_NOT_FOUND;
+		if (mer == erSuccess)
+			mk = m_model.rows[i].key;
+		er = m_kt.Find(cols, &k);
+		if (er != mer || (er == erSuccess && k != mk))
+			return fail("Find");
+		break;
+	}
+	case 15: {
+		auto k = random_key(true);
+		switch (m_rng() % 4) {
+		case 0: {
+			auto i = m_model.find(k);
+			mer = i < 0 ? KCERR_NOT_FOUND : erSuccess;
+			if (i >= 0)
+				m_model.cur = m_model.store(i);
+			if (m_kt.SeekId(&k) != mer)
+				return fail("SeekId");
+			break;
+		}
+		case 1: {
+			auto i = m_model.find(k);
+			mer = i < 0 ? KCERR_NOT_FOUND : erSuccess;
+			if (i >= 0) {
+				do
+					--i;
+				while (i >= 0 && m_model.rows[i].hidden);
+				mprev = i >= 0 ? m_model.rows[i].key : sObjectTableKey(0, 0);
+			}
+			er = m_kt.GetPreviousRow(&k, &prev);
+			if (er != mer || (er == erSuccess && prev != mprev))
+				return fail("GetPreviousRow");
+			break;
+		}
+		case 2:
+			/* Rarely enough that big tables get to grow */
+			if (m_rng() % (m_keys > 1000 ? 1024 : 64) != 0)
+				break;
+			m_model.rows.clear();
+			m_model.cur = sKeyTablePos();
+			m_model.bookmarks.clear();
+			m_kt.Clear();
+			break;
+		default:
+			if (m_model.find(sentinel) >= 0)
+				break;
+			mer = m_model.modify(sentinel, {}, &mprev, false, &maction);
+			er = m_kt.UpdateRow(ECKeyTable::TABLE_ROW_ADD, &sentinel, {}, &prev, false, &action);
+			if (er != mer || prev != mprev || action != maction)
+				return fail("UpdateRow(sentinel)");
+			break;
+		}
+		break;
+	}
+	}
+	return true;
+}
+
+/* Compares everything observable without moving the cursor */
+bool tester::verify()
+{
+	unsigned int count = 0, current = 0;
+	if (m_kt.GetRowCount(&count, &current) != erSuccess ||
+	    count != m_model.visible() || current != m_model.current_row(m_model.cur))
+		return fail("GetRowCount");
+	/* Large tables only now and then */
+	if (m_model.rows.size() > 256 && m_op % 256 != 0)
+		return true;
+	if (m_model.find(sentinel) >= 0) {
+		ECObjectTableList list, mlist;
+		m_model.by_prefix(sentinel, mlist);
+		m_kt.GetRowsBySortPrefix(const_cast<sObjectTableKey *>(&sentinel), &list);
+		if (!same(list, mlist, "row order"))
+			return false;
+	}
+	for (const auto &r : m_model.rows) {
+		std::vector<ECSortCol> cols;
+		bool hidden = false;
+		if (m_kt.GetRow(&r.key, &cols, &hidden) != erSuccess ||
+		    hidden != r.hidden || cols.size() != r.cols.size())
+			return fail("GetRow");
+		for (size_t i = 0; i < cols.size(); ++i)
+			if (cols[i].flags != r.cols[i].flags ||
+			    cols[i].isnull != r.cols[i].isnull ||
+			    cols[i].key != r.cols[i].key)
+				return fail("GetRow columns");
+	}
+	return true;
+}
+
+bool tester::run(unsigned int nops)
+{
+	for (m_op = 0; m_op < nops; ++m_op) {
+		if (!step())
+			return false;
+		if (!verify())
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Two tables sharing rows (Share/Adopt), each next to a reference table
+ * that gets the same changes without sharing anything. Changes outside
+ * LockRows must go to a copy of the rows, so the other table's rows stay
+ * those of its reference table; changes between LockRows and UnlockRows
+ * go to the shared rows, and show in both.
+ */
+class share_tester final {
+	public:
+	share_tester(unsigned int seed);
+	bool run(unsigned int nops);
+
+	private:
+	bool change(unsigned int t, bool locked);
+	bool rows_of(ECKeyTable &, std::vector<mrow> &);
+	bool compare(unsigned int t, const char *what);
+	bool shared() { return m_kt[0].Share() == m_kt[1].Share(); }
+	bool fail(const char *what);
+
+	ECKeyTable m_kt[2], m_ref[2];
+	std::mt19937 m_rng;
+	unsigned int m_seed, m_op = 0;
+};
+
+/* With the sentinel row, GetRowsBySortPrefix lists the whole table */
+share_tester::share_tester(unsigned int seed) : m_rng(seed), m_seed(seed)
+{
+	for (auto kt : {&m_kt[0], &m_kt[1], &m_ref[0], &m_ref[1]})
+		kt->UpdateRow(ECKeyTable::TABLE_ROW_ADD, &sentinel, {}, nullptr);
+}
+
+bool share_tester::fail(const char *what)
+{
+	fprintf(stderr, "sharing, seed %u, operation %u: %s\n", m_seed, m_op, what);
+	return false;
+}
+
+/* All rows but the sentinel, hidden ones too, in table order */
+bool share_tester::rows_of(ECKeyTable &kt, std::vector<mrow> &rows)
+{
+	ECObjectTableList list;
+	rows.clear();
+	if (kt.GetRowsBySortPrefix(const_cast<sObjectTableKey *>(&sentinel), &list) != erSuccess)
+		return false;
+	list.remove(sentinel);
+	for (const auto &k : list) {
+		mrow r;
+		r.key = k;
+		if (kt.GetRow(&k, &r.cols, &r.hidden) != erSuccess)
+			return false;
+		rows.emplace_back(std::move(r));
+	}
+	return true;
+}
+
+bool share_tester::compare(unsigned int t, const char *what)
+{
+	std::vector<mrow> a, b;
+	if (!rows_of(m_kt[t], a) || !rows_of(m_ref[t], b) || a.size() != b.size())
+		return fail(what);
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].key != b[i].key || a[i].hidden != b[i].hidden ||
+		    a[i].cols.size() != b[i].cols.size())
+			return fail(what);
+		for (size_t j = 0; j < a[i].cols.size(); ++j)
+			if (colcmp(a[i].cols[j], b[i].cols[j]) != 0)
+				return fail(what);
+	}
+	return true;
+}
+
+/* One random add, modify or delete on table @t, and on the reference tables it should show in */
+bool share_tester::change(unsigned int t, bool locked)
+{
+	bool both = locked && shared();
+	sObjectTableKey k(1 + m_rng() % 100, 0), prev;
+	std::vector<ECSortCol> cols(1 + m_rng() % 2);
+	for (auto &c : cols)
+		c.key.assign(1 + m_rng() % 3, 'a' + m_rng() % 4);
+	auto type = m_rng() % 4 == 0 ? ECKeyTable::TABLE_ROW_DELETE : ECKeyTable::TABLE_ROW_ADD;
+	bool hidden = m_rng() % 8 == 0;
+
+	if (locked)
+		m_kt[t].LockRows();
+	auto er = m_kt[t].UpdateRow(type, &k, std::vector<ECSortCol>(cols), &prev, hidden);
+	if (locked)
+		m_kt[t].UnlockRows();
+	for (unsigned int r = 0; r < 2; ++r) {
+		if (r != t && !both)
+			continue;
+		if (m_ref[r].UpdateRow(type, &k, std::vector<ECSortCol>(cols), &prev, hidden) != er)
+			return fail("UpdateRow result");
+	}
+	if (!locked && er == erSuccess && shared())
+		return fail("rows still shared after a change");
+	return true;
+}
+
+bool share_tester::run(unsigned int nops)
+{
+	for (m_op = 0; m_op < nops; ++m_op) {
+		unsigned int t = m_rng() % 2;
+		switch (m_rng() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			if (!change(t, false))
+				return false;
+			break;
+		case 3:
+		case 4:
+			if (!change(t, true))
+				return false;
+			break;
+		case 5: {
+			/* The other table takes over these rows */
+			std::vector<mrow> rows;
+			if (m_kt[!t].Adopt(m_kt[t].Share()) != erSuccess || !shared())
+				return fail("Adopt");
+			if (!rows_of(m_ref[t], rows) || m_ref[!t].Clear() != erSuccess)
+				return fail("reference copy");
+			m_ref[!t].UpdateRow(ECKeyTable::TABLE_ROW_ADD, &sentinel, {}, nullptr);
+			for (auto &r : rows)
+				m_ref[!t].UpdateRow(ECKeyTable::TABLE_ROW_ADD, &r.key,
+					std::move(r.cols), nullptr, r.hidden);
+			break;
+		}
+		case 6:
+			m_kt[t].Unshare();
+			if (shared())
+				return fail("rows still shared after Unshare");
+			break;
+		default: {
+			/* Each table has its own cursor on the shared rows */
+			int to = m_rng() % 20;
+			ECObjectTableList a, b;
+			m_kt[t].SeekRow(ECKeyTable::EC_SEEK_SET, to, nullptr);
+			m_ref[t].SeekRow(ECKeyTable::EC_SEEK_SET, to, nullptr);
+			m_kt[!t].SeekRow(ECKeyTable::EC_SEEK_END, 0, nullptr);
+			if (m_kt[t].QueryRows(5, &a, false, 0) != erSuccess ||
+			    m_ref[t].QueryRows(5, &b, false, 0) != erSuccess || a != b)
+				return fail("QueryRows");
+			break;
+		}
+		}
+		if (!compare(0, "rows of the first table") ||
+		    !compare(1, "rows of the second table"))
+			return false;
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int big = 2, keys = 200, rounds = 20, nops = 5000, seed = 1;
+	int c;
+	while ((c = getopt(argc, argv, "b:k:n:r:s:")) != -1) {
+		if (c == 'b')
+			big = strtoul(optarg, nullptr, 0);
+		else if (c == 'k')
+			keys = strtoul(optarg, nullptr, 0);
+		else if (c == 'n')
+			nops = strtoul(optarg, nullptr, 0);
+		else if (c == 'r')
+			rounds = strtoul(optarg, nullptr, 0);
+		else if (c == 's')
+			seed = strtoul(optarg, nullptr, 0);
+		else
+			return EXIT_FAILURE;
+	}
+	for (unsigned int r = 0; r < rounds; ++r) {
+		tester t(seed + r, keys);
+		if (!t.run(nops))
+			return EXIT_FAILURE;
+	}
+	for (unsigned int r = 0; r < big; ++r) {
+		tester t(seed + rounds + r, 100 * keys);
+		if (!t.run(16 * nops))
+			return EXIT_FAILURE;
+	}
+	for (unsigned int r = 0; r < rounds; ++r) {
+		share_tester t(seed + r);
+		if (!t.run(nops / 5))
+			return EXIT_FAILURE;
+	}
+	printf("%u+%u rounds of %u operations: ok\n", rounds, big, nops);
+	return EXIT_SUCCESS;
+}
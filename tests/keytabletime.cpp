@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <kopano/platform.h>
+#include <kopano/ECKeyTable.h>
+#include "timeutil.hpp"
+
+using namespace KC;
+
+/*
+ * This program measures ECKeyTable for a large sorted contents table: the
+ * memory needed per row and the latency of positioned QueryRows calls, as
+ * a client scrolling through the table would issue them.
+ *
+ * Usage: keytabletime [-n rows] [-q queries] [-b batch]
+ *
+ * Rows are sorted on a string column (subject-like, 20-80 bytes with
+ * common prefixes) and a descending 8-byte date column. Only the public
+ * ECKeyTable interface is used, so the program can also be built against
+ * older trees for comparison.
+ */
+
+int main(int argc, char **argv)
+{
+	unsigned int nrows = 1000000, nqueries = 10000, batch = 50;
+	int c;
+	while ((c = getopt(argc, argv, "b:n:q:")) != -1) {
+		if (c == 'b')
+			batch = strtoul(optarg, nullptr, 0);
+		else if (c == 'n')
+			nrows = strtoul(optarg, nullptr, 0);
+		else if (c == 'q')
+			nqueries = strtoul(optarg, nullptr, 0);
+		else
+			return EXIT_FAILURE;
+	}
+	if (nrows == 0)
+		return EXIT_FAILURE;
+
+	std::mt19937 rng(1);
+	std::vector<std::vector<ECSortCol>> keys(nrows);
+	size_t keybytes = 0;
+	for (auto &k : keys) {
+		k = subject_key(rng);
+		keybytes += k[0].key.size() + k[1].key.size();
+	}
+
+	auto heap0 = heap_used();
+	auto start = clk::now();
+	std::unique_ptr<ECKeyTable> kt(new ECKeyTable);
+	for (unsigned int i = 0; i < nrows; ++i) {
+		sObjectTableKey row(i + 1, 0);
+		kt->UpdateRow(ECKeyTable::TABLE_ROW_ADD, &row, std::vector<ECSortCol>(keys[i]), nullptr);
+	}
+	auto ins = clk::now() - start;
+	auto heap = heap_used() - heap0;
+	printf("insert   %u rows in %lld us (%.2f us/row), sort data %.1f bytes/row\n",
+	       nrows, usec(ins), static_cast<double>(usec(ins)) / nrows,
+	       static_cast<double>(keybytes) / nrows);
+	printf("memory   GetObjectSize %.1f bytes/row", static_cast<double>(kt->GetObjectSize()) / nrows);
+	if (heap != 0)
+		printf(", heap %.1f bytes/row (%.1f MB)", static_cast<double>(heap) / nrows, heap / 1048576.0);
+	printf("\n");
+
+	/* Random positioned reads, like a client scrolling the table */
+	ECObjectTableList rows;
+	unsigned int count = 0, cur = 0;
+	start = clk::now();
+	for (unsigned int i = 0; i < nqueries; ++i) {
+		rows.clear();
+		kt->SeekRow(ECKeyTable::EC_SEEK_SET, rng() % nrows, nullptr);
+		kt->QueryRows(batch, &rows, false, 0);
+		kt->GetRowCount(&count, &cur);
+	}
+	auto qry = clk::now() - start;
+	printf("query    %u x SeekRow+QueryRows(%u)+GetRowCount: %.2f us/call\n",
+	       nqueries, batch, static_cast<double>(usec(qry)) / nqueries);
+
+	/* Sequential read of the whole table */
+	size_t total = 0;
+	kt->SeekRow(ECKeyTable::EC_SEEK_SET, 0, nullptr);
+	start = clk::now();
+	do {
+		rows.clear();
+		kt->QueryRows(batch, &rows, false, 0);
+		total += rows.size();
+	} while (!rows.empty());
+	auto scan = clk::now() - start;
+	printf("scan     %zu rows in %lld us (%.3f us/row)\n",
+	       total, usec(scan), static_cast<double>(usec(scan)) / nrows);
+	if (total != nrows) {
+		fprintf(stderr, "scan returned %zu rows, expected %u\n", total, nrows);
+		return EXIT_FAILURE;
+	}
+
+	/* Modify a tenth of the rows (new sort key) */
+	unsigned int nmod = nrows / 10;
+	start = clk::now();
+	for (unsigned int i = 0; i < nmod; ++i) {
+		sObjectTableKey row(rng() % nrows + 1, 0), prev;
+		kt->UpdateRow(ECKeyTable::TABLE_ROW_MODIFY, &row, subject_key(rng), &prev);
+	}
+	auto mod = clk::now() - start;
+	printf("modify   %u rows: %.2f us/row\n", nmod, static_cast<double>(usec(mod)) / (nmod ? nmod : 1));
+
+	start = clk::now();
+	kt.reset();
+	printf("free     %lld us\n", usec(clk::now() - start));
+	return EXIT_SUCCESS;
+}
@@ -2,9 +2,13 @@
 /* Copyright 2016, Kopano and its licensors */
 #include <chrono>
 #include <utility>
+#include <vector>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <mapix.h>
 /*
  * This program simulates MAPIAllocateMore allocations to measure allocation
@@ -27,7 +31,12 @@
  *
  * 5. Now go, hack on MAPIAllocateMore, and bring down that walltime.
  *
- * The allocation sizes do not matter, so that is fixed.
+ * Usage: mapialloctime [-r rounds] [-s size] [-v] [-k live-buffers]
+ *
+ * Every child is @size bytes (default 32); with -v, child sizes vary
+ * between 1 and 2*@size, as strings and binaries of a row set do. -k keeps
+ * that many buffers alive at a time (freeing the oldest), which shows in
+ * the peak RSS that is reported at the end. -r repeats the whole histogram.
  */
 
 /* MAPIAllocateBuffer size distribution */
@@ -51,44 +60,91 @@ static constexpr std::pair<unsigned int, unsigned int> dist[] = {
 	{1164, 1}, {1178, 1}, {1216, 1}, {1466, 1}, {1504, 1}, {1526, 1},
 	{1714, 1}, {2120, 1}, {2212, 1}, {2226, 1}, {2700, 1}, {3106, 1},
 };
-static constexpr size_t alloc_size = 32;
+static size_t alloc_size = 32;
+
+static double ns_of(const struct timespec &start, const struct timespec &stop)
+{
+	auto delta = std::chrono::seconds(stop.tv_sec) + std::chrono::nanoseconds(stop.tv_nsec) -
+	             (std::chrono::seconds(start.tv_sec) + std::chrono::nanoseconds(start.tv_nsec));
+	return delta.count();
+}
 
-int main()
+int main(int argc, char **argv)
 {
+	unsigned int rounds = 1, nlive = 0;
+	bool vary = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "k:r:s:v")) != -1) {
+		switch (c) {
+		case 'k': nlive = strtoul(optarg, nullptr, 0); break;
+		case 'r': rounds = strtoul(optarg, nullptr, 0); break;
+		case 's': alloc_size = strtoul(optarg, nullptr, 0); break;
+		case 'v': vary = true; break;
+		default:
+			fprintf(stderr, "Usage: %s [-r rounds] [-s size] [-v] [-k live-buffers]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (alloc_size == 0)
+		alloc_size = 1;
+
 	struct timespec gstart, gstop, start, stop;
-	size_t cnt_alloc = 0, cnt_more = 0;
+	size_t cnt_alloc = 0, cnt_more = 0, live_pos = 0;
+	std::vector<void *> live(nlive);
+	unsigned int seed = 1;
 	clock_gettime(CLOCK_MONOTONIC, &gstart);
 
-	for (const auto &p : dist) {
-		decltype(p.first) nchildren = p.first;
-		decltype(p.second) noccr = p.second;
+	for (unsigned int r = 0; r < rounds; ++r) {
+		for (const auto &p : dist) {
+			decltype(p.first) nchildren = p.first;
+			decltype(p.second) noccr = p.second;
 
-		cnt_alloc += noccr;
-		cnt_more += noccr * nchildren;
-		clock_gettime(CLOCK_MONOTONIC, &start);
-		for (decltype(noccr) i = 0; i < noccr; ++i) {
-			void *ibuf = nullptr;
-			auto ret = MAPIAllocateBuffer(alloc_size, &ibuf);
-			if (ret != hrSuccess)
-				abort();
-			for (decltype(nchildren) j = 0; j < nchildren; ++j) {
-				void *jbuf = nullptr;
-				if (MAPIAllocateMore(alloc_size, ibuf, &jbuf) != hrSuccess)
-					/* nothing */;
+			cnt_alloc += noccr;
+			cnt_more += noccr * nchildren;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (decltype(noccr) i = 0; i < noccr; ++i) {
+				void *ibuf = nullptr;
+				auto ret = MAPIAllocateBuffer(alloc_size, &ibuf);
+				if (ret != hrSuccess)
+					abort();
+				for (decltype(nchildren) j = 0; j < nchildren; ++j) {
+					void *jbuf = nullptr;
+					size_t z = alloc_size;
+					if (vary) {
+						seed = seed * 1103515245 + 12345;
+						z = 1 + (seed >> 16) % (2 * alloc_size);
+					}
+					if (MAPIAllocateMore(z, ibuf, &jbuf) != hrSuccess)
+						abort();
+					/* touch it, as a caller would */
+					memset(jbuf, 0, z);
+				}
+				if (nlive == 0) {
+					MAPIFreeBuffer(ibuf);
+					continue;
+				}
+				MAPIFreeBuffer(live[live_pos]);
+				live[live_pos] = ibuf;
+				live_pos = (live_pos + 1) % nlive;
 			}
-			MAPIFreeBuffer(ibuf);
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			if (rounds == 1)
+				printf("O-%u× C-%u: %zu ns\n", noccr, nchildren, static_cast<size_t>(ns_of(start, stop)));
 		}
-		clock_gettime(CLOCK_MONOTONIC, &stop);
-		auto delta = std::chrono::seconds(stop.tv_sec) + std::chrono::nanoseconds(stop.tv_nsec) -
-		             (std::chrono::seconds(start.tv_sec) + std::chrono::nanoseconds(start.tv_nsec));
-		printf("O-%u× C-%u: %zu ns\n", noccr, nchildren, static_cast<size_t>(delta.count()));
 	}
+	for (auto b : live)
+		MAPIFreeBuffer(b);
 	clock_gettime(CLOCK_MONOTONIC, &gstop);
-	auto delta = std::chrono::seconds(gstop.tv_sec) + std::chrono::nanoseconds(gstop.tv_nsec) -
-	             (std::chrono::seconds(gstart.tv_sec) + std::chrono::nanoseconds(gstart.tv_nsec));
-	printf("all %zu ns\n", static_cast<size_t>(delta.count()));
+	auto ns = ns_of(gstart, gstop);
+	printf("all %zu ns\n", static_cast<size_t>(ns));
 
 	printf("MAPIAllocateBuffer calls: %zu\n", cnt_alloc);
 	printf("MAPIAllocateMore calls: %zu\n", cnt_more);
+	printf("allocations/s: %.0f (%.1f ns per allocation)\n",
+	       (cnt_alloc + cnt_more) / ns * 1e9, ns / (cnt_alloc + cnt_more));
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("peak RSS: %ld kB\n", ru.ru_maxrss);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <list>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <unistd.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include <kopano/platform.h>
+#include <kopano/stringutil.h>
+#include "ECChannelClient.h"
+#include "ECNativeIndex.h"
+
+using namespace KC;
+using clk = std::chrono::steady_clock;
+
+/*
+ * This program benchmarks the native full-text index (ECNativeIndex) on a
+ * synthetic corpus: words drawn from a Zipf distribution over a made-up
+ * vocabulary, in subjects, bodies and sender names. It reports build time,
+ * memory size, and the latency of AND-searches for 1-3 words of middling
+ * frequency over those three fields.
+ *
+ * Usage: nativeindextime [-n messages] [-v vocabulary] [-q queries]
+ *        [-o eml-dir] [-x search-socket -S server-guid -s store-guid]
+ *        [-X xapian-dir]
+ *
+ * To compare with kopano-search on the same corpus: write it out with -o,
+ * deliver the files to one user with kopano-dagent, let kopano-search
+ * index the store, then run again with -x and the GUIDs of the server and
+ * the store; -X adds up the size of the Xapian index files. The corpus
+ * and the queries only depend on -n, -v and -q.
+ */
+
+static const unsigned int fields[] = {
+	PROP_ID(PR_SUBJECT_W), PROP_ID(PR_BODY_W), PROP_ID(PR_SENDER_NAME_W),
+};
+
+class corpus {
+	public:
+	corpus(unsigned int nvocab) : m_rng(1)
+	{
+		static const char *const syl[] = {
+			"ka", "lo", "mi", "ne", "su", "ta", "ri", "po", "de", "vu",
+			"an", "el", "is", "or", "ul", "be", "co", "fa", "gi", "hu",
+		};
+		std::uniform_int_distribution<unsigned int> nsyl(2, 5), pick(0, ARRAY_SIZE(syl) - 1);
+		double sum = 0;
+		for (unsigned int i = 0; i < nvocab; ++i) {
+			std::string w;
+			for (auto n = nsyl(m_rng); n > 0; --n)
+				w += syl[pick(m_rng)];
+			m_vocab.emplace_back(w + std::to_string(i % 97));
+			sum += 1.0 / (i + 1);
+			m_cdf.emplace_back(sum);
+		}
+		for (auto &c : m_cdf)
+			c /= sum;
+	}
+	const std::string &word(unsigned int rank) const { return m_vocab[rank]; }
+	const std::string &zipf()
+	{
+		auto r = std::uniform_real_distribution<double>(0, 1)(m_rng);
+		auto i = std::lower_bound(m_cdf.cbegin(), m_cdf.cend(), r) - m_cdf.cbegin();
+		return m_vocab[std::min<size_t>(i, m_vocab.size() - 1)];
+	}
+	std::string text(unsigned int n)
+	{
+		std::string s;
+		for (unsigned int i = 0; i < n; ++i) {
+			if (i > 0)
+				s += i % 12 == 0 ? ". " : " ";
+			s += zipf();
+		}
+		return s;
+	}
+	std::mt19937 m_rng;
+
+	private:
+	std::vector<std::string> m_vocab;
+	std::vector<double> m_cdf;
+};
+
+static std::string xapian_dir;
+static unsigned long long xapian_bytes;
+
+static int add_size(const char *, const struct stat *st, int type, struct FTW *)
+{
+	if (type == FTW_F)
+		xapian_bytes += st->st_size;
+	return 0;
+}
+
+static void report(const char *what, std::vector<double> &us, unsigned long long hits)
+{
+	if (us.empty())
+		return;
+	std::sort(us.begin(), us.end());
+	double sum = 0;
+	for (auto t : us)
+		sum += t;
+	printf("%s: %zu queries, avg %.1f µs, p50 %.1f µs, p95 %.1f µs, p99 %.1f µs, %.1f hits/query\n",
+	       what, us.size(), sum / us.size(), us[us.size() / 2],
+	       us[us.size() * 95 / 100], us[us.size() * 99 / 100],
+	       static_cast<double>(hits) / us.size());
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nmsg = 100000, nvocab = 50000, nquery = 2000;
+	const char *emldir = nullptr, *sock = nullptr, *server = nullptr, *store = nullptr;
+	int c;
+
+	while ((c = getopt(argc, argv, "S:X:n:o:q:s:v:x:")) != -1) {
+		switch (c) {
+		case 'S': server = optarg; break;
+		case 'X': xapian_dir = optarg; break;
+		case 'n': nmsg = strtoul(optarg, nullptr, 0); break;
+		case 'o': emldir = optarg; break;
+		case 'q': nquery = strtoul(optarg, nullptr, 0); break;
+		case 's': store = optarg; break;
+		case 'v': nvocab = strtoul(optarg, nullptr, 0); break;
+		case 'x': sock = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-n messages] [-v vocabulary] [-q queries] [-o eml-dir] [-x search-socket -S server-guid -s store-guid] [-X xapian-dir]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nvocab < 1000) {
+		fprintf(stderr, "The vocabulary needs at least 1000 words\n");
+		return EXIT_FAILURE;
+	}
+	if (sock != nullptr && (server == nullptr || store == nullptr)) {
+		fprintf(stderr, "-x needs -S and -s\n");
+		return EXIT_FAILURE;
+	}
+
+	corpus cp(nvocab);
+	ECNativeIndex idx;
+	ECNativeIndex::fields_t f(3);
+	unsigned long long textbytes = 0;
+	auto start = clk::now();
+	for (unsigned int i = 1; i <= nmsg; ++i) {
+		f[0] = {fields[0], cp.text(6)};
+		f[1] = {fields[1], cp.text(150)};
+		/* senders come from a small set */
+		f[2] = {fields[2], cp.word(i % 200) + " " + cp.word(200 + i % 300)};
+		for (const auto &x : f)
+			textbytes += x.second.size();
+		if (emldir != nullptr) {
+			auto fp = fopen((std::string(emldir) + "/" + std::to_string(i) + ".eml").c_str(), "w");
+			if (fp == nullptr) {
+				perror(emldir);
+				return EXIT_FAILURE;
+			}
+			fprintf(fp, "From: %s <sender%u@localhost>\r\nSubject: %s\r\n"
+			        "Message-ID: <%u.nativeindextime@localhost>\r\n"
+			        "Content-Type: text/plain; charset=us-ascii\r\n\r\n%s\r\n",
+			        f[2].second.c_str(), i % 200, f[0].second.c_str(), i,
+			        f[1].second.c_str());
+			fclose(fp);
+		}
+		idx.update(i, 1000 + i % 20, f);
+		/* as ECNativeIndexer does */
+		if (idx.nbuffered() >= 1000) {
+			idx.flush();
+			idx.merge(8);
+		}
+	}
+	idx.flush();
+	idx.merge(8);
+	auto secs = std::chrono::duration<double>(clk::now() - start).count();
+	printf("%u messages (%.1f MB of text) indexed in %.2f s, %.0f messages/s\n",
+	       nmsg, textbytes / 1048576.0, secs, nmsg / secs);
+	printf("native index: %.1f MB in %zu segments, %.0f bytes/message\n",
+	       idx.size() / 1048576.0, idx.nsegments(),
+	       static_cast<double>(idx.size()) / std::max(nmsg, 1U));
+
+	/* 1-3 words, each of a frequency between rank 20 and 5000 */
+	std::vector<std::list<SIndexedTerm>> queries(nquery);
+	std::uniform_int_distribution<unsigned int> nwords(1, 3), rank(20, std::min(5000U, nvocab - 1));
+	for (auto &q : queries)
+		for (auto n = nwords(cp.m_rng); n > 0; --n) {
+			SIndexedTerm t;
+			t.strTerm = cp.word(rank(cp.m_rng));
+			t.setFields.insert(std::begin(fields), std::end(fields));
+			q.emplace_back(std::move(t));
+		}
+
+	std::vector<double> us;
+	std::list<unsigned int> matches;
+	unsigned long long hits = 0;
+	for (const auto &q : queries) {
+		auto t = clk::now();
+		idx.query({}, q, matches);
+		us.emplace_back(std::chrono::duration<double, std::micro>(clk::now() - t).count());
+		hits += matches.size();
+	}
+	report("native", us, hits);
+
+	if (sock != nullptr) {
+		ECChannelClient cl(sock, ":;");
+		std::vector<std::string> cmds;
+		std::vector<std::vector<std::string>> rsp;
+		std::vector<ECRESULT> status;
+		us.clear();
+		hits = 0;
+		for (const auto &q : queries) {
+			cmds.clear();
+			cmds.emplace_back("SCOPE " + std::string(server) + " " + store);
+			for (const auto &t : q)
+				cmds.emplace_back("FIND " + kc_join(t.setFields, " ", stringify) + ":" + t.strTerm);
+			cmds.emplace_back("QUERY");
+			auto t = clk::now();
+			auto er = cl.DoCmds(cmds, rsp, status);
+			us.emplace_back(std::chrono::duration<double, std::micro>(clk::now() - t).count());
+			if (er != erSuccess || status.back() != erSuccess) {
+				fprintf(stderr, "kopano-search: query failed: %x\n", er);
+				return EXIT_FAILURE;
+			}
+			if (!rsp.back().empty())
+				hits += tokenize(rsp.back()[0], " ").size();
+		}
+		report("kopano-search", us, hits);
+	}
+	if (!xapian_dir.empty()) {
+		if (nftw(xapian_dir.c_str(), add_size, 16, FTW_PHYS) != 0) {
+			perror(xapian_dir.c_str());
+			return EXIT_FAILURE;
+		}
+		printf("xapian index: %.1f MB\n", xapian_bytes / 1048576.0);
+	}
+	return EXIT_SUCCESS;
+}
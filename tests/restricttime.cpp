@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <kopano/platform.h>
+#include <kopano/ustringutil.h>
+#include <mapidefs.h>
+#include <mapitags.h>
+#include "soapH.h"
+#include "ECGenericObjectTable.h"
+#include "ECRestrictionProgram.h"
+
+using namespace KC;
+using clk = std::chrono::steady_clock;
+
+/*
+ * This program compares ECGenericObjectTable::MatchRowRestrict with a
+ * compiled ECRestrictionProgram on a contents table-like workload, the way
+ * AddRowKey and the search folder code use them: one restriction, many
+ * rows laid out in the same column set.
+ *
+ * Usage: restricttime [-n rows] [-r rounds]
+ *
+ * Both must select the same rows; the program exits with a failure status
+ * if they do not.
+ */
+
+enum { C_SUBJECT, C_SENDER, C_BODY, C_SIZE, C_FLAGS, C_DATE, C_MAX };
+
+static unsigned int columns[C_MAX] = {
+	PR_SUBJECT_A, PR_SENDER_NAME_A, PR_BODY_A, PR_MESSAGE_SIZE,
+	PR_MESSAGE_FLAGS, PR_MESSAGE_DELIVERY_TIME,
+};
+
+struct rows {
+	std::vector<std::string> text;
+	std::vector<hiloLong> date;
+	std::vector<propVal> vals;
+	std::vector<propValArray> rows;
+};
+
+/* Restrictions are built from these and live as long as the program runs */
+struct restr {
+	std::vector<std::unique_ptr<restrictTable>> tables;
+	std::vector<std::unique_ptr<propVal>> props;
+	std::vector<std::unique_ptr<std::string>> strings;
+	std::vector<std::unique_ptr<restrictTable *[]>> lists;
+	std::vector<std::unique_ptr<restrictAnd>> ands;
+	std::vector<std::unique_ptr<restrictOr>> ors;
+	std::vector<std::unique_ptr<restrictContent>> contents;
+	std::vector<std::unique_ptr<restrictProp>> propres;
+	std::vector<std::unique_ptr<restrictBitmask>> bitmasks;
+	std::vector<std::unique_ptr<hiloLong>> hilos;
+
+	restrictTable *table(unsigned int type)
+	{
+		tables.emplace_back(new restrictTable{});
+		tables.back()->ulType = type;
+		return tables.back().get();
+	}
+	propVal *string(unsigned int tag, const char *s)
+	{
+		strings.emplace_back(new std::string(s));
+		props.emplace_back(new propVal{});
+		props.back()->ulPropTag = tag;
+		props.back()->__union = SOAP_UNION_propValData_lpszA;
+		props.back()->Value.lpszA = &(*strings.back())[0];
+		return props.back().get();
+	}
+	restrictTable *content(unsigned int tag, const char *s, unsigned int fuzzy)
+	{
+		auto rt = table(RES_CONTENT);
+		contents.emplace_back(new restrictContent{});
+		rt->lpContent = contents.back().get();
+		rt->lpContent->ulFuzzyLevel = fuzzy;
+		rt->lpContent->ulPropTag = tag;
+		rt->lpContent->lpProp = string(tag, s);
+		return rt;
+	}
+	restrictTable *property(unsigned int relop, propVal *p)
+	{
+		auto rt = table(RES_PROPERTY);
+		propres.emplace_back(new restrictProp{});
+		rt->lpProp = propres.back().get();
+		rt->lpProp->ulType = relop;
+		rt->lpProp->ulPropTag = p->ulPropTag;
+		rt->lpProp->lpProp = p;
+		return rt;
+	}
+	restrictTable *ulong(unsigned int relop, unsigned int tag, unsigned int v)
+	{
+		props.emplace_back(new propVal{});
+		props.back()->ulPropTag = tag;
+		props.back()->__union = SOAP_UNION_propValData_ul;
+		props.back()->Value.ul = v;
+		return property(relop, props.back().get());
+	}
+	restrictTable *systime(unsigned int relop, unsigned int tag, const hiloLong &v)
+	{
+		hilos.emplace_back(new hiloLong(v));
+		props.emplace_back(new propVal{});
+		props.back()->ulPropTag = tag;
+		props.back()->__union = SOAP_UNION_propValData_hilo;
+		props.back()->Value.hilo = hilos.back().get();
+		return property(relop, props.back().get());
+	}
+	restrictTable *bitmask(unsigned int type, unsigned int tag, unsigned int mask)
+	{
+		auto rt = table(RES_BITMASK);
+		bitmasks.emplace_back(new restrictBitmask{});
+		rt->lpBitmask = bitmasks.back().get();
+		rt->lpBitmask->ulType = type;
+		rt->lpBitmask->ulPropTag = tag;
+		rt->lpBitmask->ulMask = mask;
+		return rt;
+	}
+	restrictTable **list(std::initializer_list<restrictTable *> l)
+	{
+		lists.emplace_back(new restrictTable *[l.size()]);
+		std::copy(l.begin(), l.end(), lists.back().get());
+		return lists.back().get();
+	}
+	restrictTable *and_(std::initializer_list<restrictTable *> l)
+	{
+		auto rt = table(RES_AND);
+		ands.emplace_back(new restrictAnd{});
+		rt->lpAnd = ands.back().get();
+		rt->lpAnd->__size = l.size();
+		rt->lpAnd->__ptr = list(l);
+		return rt;
+	}
+	restrictTable *or_(std::initializer_list<restrictTable *> l)
+	{
+		auto rt = table(RES_OR);
+		ors.emplace_back(new restrictOr{});
+		rt->lpOr = ors.back().get();
+		rt->lpOr->__size = l.size();
+		rt->lpOr->__ptr = list(l);
+		return rt;
+	}
+};
+
+static std::string words(std::mt19937 &rng, size_t len)
+{
+	static const char *const w[] = {
+		"meeting", "report", "invoice", "server", "update", "quarterly",
+		"notes", "the", "status", "release", "of", "and", "planning",
+		"Straße", "für", "café", "budget", "review", "draft", "agenda",
+	};
+	std::string s;
+	while (s.size() < len) {
+		s += w[rng() % ARRAY_SIZE(w)];
+		s += ' ';
+	}
+	return s;
+}
+
+static void make_rows(struct rows &r, unsigned int nrows)
+{
+	static const char *const pfx[] = {"", "Re: ", "RE: Re: ", "Fwd: ", "[kopano-dev] "};
+	static const char *const names[] = {
+		"Alice Smith", "Bob Jones", "Jürgen Schmidt", "Søren Ødegaard",
+		"Carol SMITH", "Dave Miller", "Eve Blacksmith", "Frank Müller",
+	};
+	std::mt19937 rng(1);
+
+	r.text.reserve(3 * nrows);
+	r.date.resize(nrows);
+	r.vals.resize(C_MAX * nrows);
+	r.rows.resize(nrows);
+	for (unsigned int i = 0; i < nrows; ++i) {
+		auto v = &r.vals[C_MAX * i];
+		r.text.emplace_back(pfx[rng() % ARRAY_SIZE(pfx)] + words(rng, 15 + rng() % 50));
+		r.text.emplace_back(names[rng() % ARRAY_SIZE(names)]);
+		r.text.emplace_back(words(rng, 200 + rng() % 800));
+		for (unsigned int c = C_SUBJECT; c <= C_BODY; ++c) {
+			v[c].__union = SOAP_UNION_propValData_lpszA;
+			v[c].Value.lpszA = &r.text[r.text.size() - 3 + c][0];
+		}
+		v[C_SIZE].__union = SOAP_UNION_propValData_ul;
+		v[C_SIZE].Value.ul = 1000 + rng() % 100000;
+		v[C_FLAGS].__union = SOAP_UNION_propValData_ul;
+		v[C_FLAGS].Value.ul = rng() % 4 == 0 ? 0 : MSGFLAG_READ;
+		r.date[i].hi = 30000000 + rng() % 1000;
+		r.date[i].lo = rng();
+		v[C_DATE].__union = SOAP_UNION_propValData_hilo;
+		v[C_DATE].Value.hilo = &r.date[i];
+		for (unsigned int c = 0; c < C_MAX; ++c)
+			v[c].ulPropTag = columns[c];
+		r.rows[i].__ptr = v;
+		r.rows[i].__size = C_MAX;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nrows = 100000, rounds = 5;
+	int c;
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		if (c == 'n')
+			nrows = strtoul(optarg, nullptr, 0);
+		else if (c == 'r')
+			rounds = strtoul(optarg, nullptr, 0);
+		else
+			return EXIT_FAILURE;
+	}
+	if (nrows == 0 || rounds == 0)
+		return EXIT_FAILURE;
+
+	struct rows data;
+	make_rows(data, nrows);
+	propTagArray cols(columns, C_MAX);
+	auto locale = createLocaleFromName("en_US");
+
+	restr r;
+	const std::pair<const char *, restrictTable *> cases[] = {
+		{"subject substring", r.content(PR_SUBJECT_A, "INVOICE", FL_SUBSTRING | FL_IGNORECASE)},
+		{"body substring", r.content(PR_BODY_A, "quarterly report", FL_SUBSTRING | FL_IGNORECASE)},
+		{"subject prefix", r.content(PR_SUBJECT_A, "re: ", FL_PREFIX | FL_IGNORECASE)},
+		{"sender equals", r.property(RELOP_EQ, r.string(PR_SENDER_NAME_A, "jürgen schmidt"))},
+		{"search folder", r.and_({
+			r.or_({
+				r.content(PR_BODY_A, "café budget", FL_SUBSTRING | FL_IGNORECASE),
+				r.content(PR_SENDER_NAME_A, "smith", FL_SUBSTRING | FL_IGNORECASE),
+				r.content(PR_SUBJECT_A, "status", FL_SUBSTRING | FL_IGNORECASE),
+			}),
+			r.ulong(RELOP_GT, PR_MESSAGE_SIZE, 50000),
+			r.bitmask(BMR_EQZ, PR_MESSAGE_FLAGS, MSGFLAG_READ),
+		})},
+		{"unread since", r.and_({
+			r.systime(RELOP_GE, PR_MESSAGE_DELIVERY_TIME, {30000900, 0}),
+			r.bitmask(BMR_EQZ, PR_MESSAGE_FLAGS, MSGFLAG_READ),
+		})},
+	};
+
+	printf("%u rows, %u rounds\n", nrows, rounds);
+	printf("%-20s %8s %14s %14s %8s\n", "restriction", "matches", "interp ns/row", "compiled ns/row", "speedup");
+	int ret = EXIT_SUCCESS;
+	for (const auto &t : cases) {
+		unsigned int m1 = 0, m2 = 0;
+		bool fMatch = false;
+
+		auto start = clk::now();
+		for (unsigned int k = 0; k < rounds; ++k)
+			for (auto &row : data.rows)
+				if (ECGenericObjectTable::MatchRowRestrict(nullptr, &row, t.second, nullptr, locale, &fMatch) == erSuccess && fMatch)
+					++m1;
+		auto interp = clk::now() - start;
+
+		start = clk::now();
+		std::shared_ptr<const ECRestrictionProgram> prog;
+		if (ECRestrictionProgram::Compile(t.second, locale, &prog) != erSuccess) {
+			fprintf(stderr, "%s: compile failed\n", t.first);
+			return EXIT_FAILURE;
+		}
+		auto bound = prog->Bind(&cols);
+		for (unsigned int k = 0; k < rounds; ++k)
+			for (auto &row : data.rows)
+				if (prog->Match(nullptr, &row, nullptr, &fMatch, &bound) == erSuccess && fMatch)
+					++m2;
+		auto compiled = clk::now() - start;
+
+		double n = static_cast<double>(nrows) * rounds;
+		double a = std::chrono::duration_cast<std::chrono::nanoseconds>(interp).count() / n;
+		double b = std::chrono::duration_cast<std::chrono::nanoseconds>(compiled).count() / n;
+		printf("%-20s %8u %14.1f %14.1f %7.1fx\n", t.first, m1 / rounds, a, b, b > 0 ? a / b : 0);
+		if (m1 != m2) {
+			fprintf(stderr, "%s: interpreter matched %u rows, program %u\n", t.first, m1 / rounds, m2 / rounds);
+			ret = EXIT_FAILURE;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <kopano/platform.h>
+#include <kopano/ECKeyTable.h>
+#include <mapidefs.h>
+#include "ECSharedTables.h"
+#include "timeutil.hpp"
+
+using namespace KC;
+
+/*
+ * This program compares many sessions viewing the same folder in the same
+ * order with a key table each, and with the rows shared through
+ * ECSharedTables like ECStoreObjectTable does: the memory used, the time
+ * to open the tables, and the time to apply changes to all of them.
+ *
+ * Usage: tablesharetime [-n rows] [-s sessions] [-c changes]
+ *
+ * The program exits with a failure status if any shared table ends up
+ * with different rows than the private ones.
+ */
+
+struct change {
+	ECKeyTable::UpdateType type;
+	sObjectTableKey row;
+	std::vector<ECSortCol> key;
+};
+
+static void load(ECKeyTable &kt, const std::vector<std::vector<ECSortCol>> &keys)
+{
+	for (unsigned int i = 0; i < keys.size(); ++i) {
+		sObjectTableKey row(i + 1, 0);
+		kt.UpdateRow(ECKeyTable::TABLE_ROW_ADD, &row, std::vector<ECSortCol>(keys[i]), nullptr);
+	}
+}
+
+static void apply(ECKeyTable &kt, const change &c)
+{
+	sObjectTableKey prev;
+	kt.UpdateRow(c.type, &c.row, std::vector<ECSortCol>(c.key), &prev);
+}
+
+/* All rows, and the cursor position */
+static ECObjectTableList all_rows(ECKeyTable &kt, unsigned int *cur)
+{
+	ECObjectTableList rows;
+	unsigned int count = 0;
+	kt.GetRowCount(&count, cur);
+	kt.SeekRow(ECKeyTable::EC_SEEK_SET, 0, nullptr);
+	kt.QueryRows(UINT_MAX, &rows, false, EC_TABLE_NOADVANCE);
+	kt.SeekRow(ECKeyTable::EC_SEEK_SET, *cur, nullptr);
+	return rows;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nrows = 100000, nsessions = 50, nchanges = 1000;
+	int c;
+	while ((c = getopt(argc, argv, "c:n:s:")) != -1) {
+		if (c == 'c')
+			nchanges = strtoul(optarg, nullptr, 0);
+		else if (c == 'n')
+			nrows = strtoul(optarg, nullptr, 0);
+		else if (c == 's')
+			nsessions = strtoul(optarg, nullptr, 0);
+		else
+			return EXIT_FAILURE;
+	}
+	if (nrows == 0 || nsessions == 0)
+		return EXIT_FAILURE;
+
+	std::mt19937 rng(1);
+	std::vector<std::vector<ECSortCol>> keys(nrows);
+	for (auto &k : keys)
+		k = subject_key(rng);
+	/* New mail, read flags changing the sort order, deletions */
+	std::vector<change> changes(nchanges);
+	unsigned int next_id = nrows + 1;
+	for (auto &ch : changes) {
+		auto r = rng() % 10;
+		if (r < 3) {
+			ch.type = ECKeyTable::TABLE_ROW_ADD;
+			ch.row = sObjectTableKey(next_id++, 0);
+		} else {
+			ch.type = r < 9 ? ECKeyTable::TABLE_ROW_MODIFY : ECKeyTable::TABLE_ROW_DELETE;
+			ch.row = sObjectTableKey(rng() % nrows + 1, 0);
+		}
+		if (ch.type != ECKeyTable::TABLE_ROW_DELETE)
+			ch.key = subject_key(rng);
+	}
+
+	std::vector<unsigned int> cursors(nsessions);
+	for (auto &cur : cursors)
+		cur = rng() % nrows;
+
+	/* Every session its own rows */
+	auto heap0 = heap_used();
+	std::vector<std::unique_ptr<ECKeyTable>> priv(nsessions);
+	auto start = clk::now();
+	for (unsigned int i = 0; i < nsessions; ++i) {
+		priv[i].reset(new ECKeyTable);
+		load(*priv[i], keys);
+		priv[i]->SeekRow(ECKeyTable::EC_SEEK_SET, cursors[i], nullptr);
+	}
+	auto priv_load = clk::now() - start;
+	auto priv_heap = heap_used() - heap0;
+	size_t priv_size = 0;
+	for (auto &kt : priv)
+		priv_size += kt->GetObjectSize();
+	start = clk::now();
+	for (const auto &ch : changes)
+		for (auto &kt : priv)
+			apply(*kt, ch);
+	auto priv_upd = clk::now() - start;
+
+	/* Shared rows: the first session loads and publishes, others adopt */
+	ECSharedTables shares;
+	ECSharedTables::key key{1, MAPI_MESSAGE, 0, "view"};
+	ECSharedTables::rows_t rows;
+	heap0 = heap_used();
+	std::vector<std::unique_ptr<ECKeyTable>> shared(nsessions);
+	auto seq = shares.Sequence(key);
+	start = clk::now();
+	for (unsigned int i = 0; i < nsessions; ++i) {
+		auto &kt = shared[i];
+		kt.reset(new ECKeyTable);
+		if (shares.Get(key, seq, &rows)) {
+			kt->Adopt(rows);
+		} else {
+			auto t0 = clk::now();
+			load(*kt, keys);
+			shares.Put(key, seq, kt->Share(), usec(clk::now() - t0));
+		}
+		kt->SeekRow(ECKeyTable::EC_SEEK_SET, cursors[i], nullptr);
+	}
+	auto shared_load = clk::now() - start;
+	auto shared_heap = heap_used() - heap0;
+	size_t shared_size = 0;
+	for (auto &kt : shared)
+		shared_size += kt->GetObjectSize();
+	start = clk::now();
+	for (const auto &ch : changes) {
+		auto s = shares.Advance(key.folder, key.objtype, key.flags);
+		for (auto &kt : shared) {
+			/* As ECStoreObjectTable::UpdateSharedRows */
+			kt->LockRows();
+			auto claim = shares.Claim(key, kt->Share(), s);
+			sObjectTableKey prev;
+			if (claim == ECSharedTables::CLAIM_APPLY)
+				apply(*kt, ch);
+			else if (claim == ECSharedTables::CLAIM_APPLIED)
+				/* for the notification */
+				kt->GetPreviousRow(&ch.row, &prev);
+			kt->UnlockRows();
+			if (claim == ECSharedTables::CLAIM_GONE) {
+				kt->Unshare();
+				apply(*kt, ch);
+			}
+		}
+	}
+	auto shared_upd = clk::now() - start;
+	auto st = shares.get_stats();
+
+	printf("%u sessions, %u rows, %u changes\n", nsessions, nrows, nchanges);
+	printf("private  load %8lld us, GetObjectSize %6.1f MB", usec(priv_load), priv_size / 1048576.0);
+	if (priv_heap != 0)
+		printf(", heap %6.1f MB", priv_heap / 1048576.0);
+	printf(", changes %6.2f us/change\n", static_cast<double>(usec(priv_upd)) / (nchanges ? nchanges : 1));
+	printf("shared   load %8lld us, GetObjectSize %6.1f MB", usec(shared_load), shared_size / 1048576.0);
+	if (shared_heap != 0)
+		printf(", heap %6.1f MB", shared_heap / 1048576.0);
+	printf(", changes %6.2f us/change\n", static_cast<double>(usec(shared_upd)) / (nchanges ? nchanges : 1));
+	printf("stats    %u shared, %u users, %.1f MB saved, %llu hits, %llu misses, %llu updates\n",
+	       st.ulTables, st.ulUsers, st.ullSaved / 1048576.0,
+	       static_cast<unsigned long long>(st.ullHits),
+	       static_cast<unsigned long long>(st.ullMisses),
+	       static_cast<unsigned long long>(st.ullUpdates));
+
+	/* Same rows, and the cursors on the same rows */
+	unsigned int bad = 0;
+	for (unsigned int i = 0; i < nsessions; ++i) {
+		unsigned int a = 0, b = 0;
+		if (all_rows(*priv[i], &a) != all_rows(*shared[i], &b) || a != b)
+			++bad;
+	}
+	if (bad != 0) {
+		fprintf(stderr, "%u of %u shared tables differ\n", bad, nsessions);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+/*
+ *	Helpers shared by the *time benchmark programs
+ */
+#pragma once
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#ifdef __GLIBC__
+#	include <malloc.h>
+#endif
+#include <kopano/platform.h>
+#include <kopano/ECKeyTable.h>
+
+using clk = std::chrono::steady_clock;
+
+static inline long long usec(clk::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+/* Nanoseconds per item for @n items processed in @d */
+static inline double nsec_per(clk::duration d, double n)
+{
+	return n > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / n : 0;
+}
+
+/* Bytes in use on the malloc heap, 0 where that cannot be told */
+static inline size_t heap_used()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Sort key of a contents table sorted on subject and descending date: a
+ * subject-like string column of 20-80 bytes with common prefixes, and an
+ * 8-byte date column.
+ */
+static inline std::vector<KC::ECSortCol> subject_key(std::mt19937 &rng)
+{
+	static const char *const pfx[] = {"", "Re: ", "RE: Re: ", "Fwd: ", "[kopano-dev] ", "[kopano-dev] Re: "};
+	static const char *const words[] = {"meeting", "report", "invoice", "server", "update", "quarterly", "notes", "the", "status", "release"};
+	std::vector<KC::ECSortCol> cols(2);
+	auto &s = cols[0].key;
+
+	cols[0].flags = TABLEROW_FLAG_STRING;
+	s = pfx[rng() % KC::ARRAY_SIZE(pfx)];
+	auto len = 20 + rng() % 60;
+	while (s.size() < len) {
+		s += words[rng() % KC::ARRAY_SIZE(words)];
+		s += ' ';
+	}
+	s.resize(len);
+	/* descending date: store the complement big-endian */
+	uint64_t date = ~static_cast<uint64_t>(rng());
+	cols[1].flags = TABLEROW_FLAG_DESC;
+	cols[1].key.resize(sizeof(date));
+	for (size_t i = 0; i < sizeof(date); ++i)
+		cols[1].key[i] = date >> (8 * (sizeof(date) - 1 - i));
+	return cols;
+}
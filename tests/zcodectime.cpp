@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: AGPL-3.0-only */
+/* Copyright 2026, Kopano and its licensors */
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mapidefs.h>
+#include <kopano/fileutil.hpp>
+#include <kopano/zcodec.hpp>
+
+using namespace KC;
+using clk = std::chrono::steady_clock;
+
+/*
+ * This program measures attachment compression per codec: ingest and read
+ * throughput and the compression ratio, as ECFileAttachment would see them.
+ *
+ * Usage: zcodectime [-l level] [-t threads] <scratch file> <file>...
+ *
+ * The files (e.g. a sample of attachments from a mail corpus) are read into
+ * memory first. Each is then written compressed to the scratch file and read
+ * back; the result is checked against the original.
+ */
+
+static double mbps(uint64_t bytes, clk::duration d)
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	return us > 0 ? static_cast<double>(bytes) / us : 0.0;
+}
+
+static bool run(zcodec codec, int level, unsigned int threads,
+    const char *scratch, const std::vector<std::string> &input)
+{
+	uint64_t total = 0, stored = 0;
+	clk::duration wr_time{}, rd_time{};
+	std::string back;
+
+	for (const auto &data : input) {
+		int fd = open(scratch, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", scratch, strerror(errno));
+			return false;
+		}
+		auto start = clk::now();
+		auto wr = zwriter::create(fd, codec, level, threads);
+		if (wr == nullptr || wr->write(data.data(), data.size()) != erSuccess ||
+		    wr->finish() != erSuccess) {
+			fprintf(stderr, "%s: write failed\n", zcodec_name(codec));
+			close(fd);
+			return false;
+		}
+		wr_time += clk::now() - start;
+		stored += lseek(fd, 0, SEEK_END);
+
+		uint64_t usize = 0;
+		if (zcodec_size(fd, &usize) != erSuccess || usize != data.size()) {
+			fprintf(stderr, "%s: size mismatch: %llu/%zu\n", zcodec_name(codec),
+			        static_cast<unsigned long long>(usize), data.size());
+			close(fd);
+			return false;
+		}
+		lseek(fd, 0, SEEK_SET);
+		back.resize(data.size() + 1);
+		start = clk::now();
+		auto rd = zreader::open(fd);
+		auto ret = rd != nullptr ? rd->read(&back[0], back.size()) : -1;
+		rd_time += clk::now() - start;
+		close(fd);
+		if (ret != static_cast<ssize_t>(data.size()) ||
+		    memcmp(back.data(), data.data(), data.size()) != 0) {
+			fprintf(stderr, "%s: data mismatch\n", zcodec_name(codec));
+			return false;
+		}
+		total += data.size();
+	}
+	printf("%-5s level %2d threads %2u: write %8.1f MB/s, read %8.1f MB/s, %12llu -> %12llu bytes (ratio %.2f)\n",
+	       zcodec_name(codec), level, threads, mbps(total, wr_time), mbps(total, rd_time),
+	       static_cast<unsigned long long>(total), static_cast<unsigned long long>(stored),
+	       stored > 0 ? static_cast<double>(total) / stored : 0.0);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int level = 6, c;
+	unsigned int threads = 1;
+	while ((c = getopt(argc, argv, "l:t:")) != -1) {
+		if (c == 'l')
+			level = strtol(optarg, nullptr, 0);
+		else if (c == 't')
+			threads = strtoul(optarg, nullptr, 0);
+		else
+			return EXIT_FAILURE;
+	}
+	if (argc - optind < 2) {
+		fprintf(stderr, "Usage: %s [-l level] [-t threads] scratchfile file...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	auto scratch = argv[optind++];
+	std::vector<std::string> input;
+	for (; optind < argc; ++optind) {
+		std::unique_ptr<FILE, file_deleter> fp(fopen(argv[optind], "r"));
+		std::string buf;
+		if (fp == nullptr || HrMapFileToString(fp.get(), &buf) != hrSuccess) {
+			fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+			return EXIT_FAILURE;
+		}
+		input.emplace_back(std::move(buf));
+	}
+
+	for (auto codec : {zcodec::gzip, zcodec::zstd, zcodec::lz4}) {
+		if (!zcodec_available(codec)) {
+			printf("%-5s not built in\n", zcodec_name(codec));
+			continue;
+		}
+		if (!run(codec, level, 1, scratch, input))
+			return EXIT_FAILURE;
+		if (threads > 1 && codec != zcodec::gzip &&
+		    !run(codec, level, threads, scratch, input))
+			return EXIT_FAILURE;
+	}
+	unlink(scratch);
+	return EXIT_SUCCESS;
+}